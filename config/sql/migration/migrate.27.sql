@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE meta_validators(repo INTEGER NOT NULL, role_name TEXT NOT NULL, etag TEXT NOT NULL DEFAULT "", last_modified TEXT NOT NULL DEFAULT "", meta_sha256 TEXT NOT NULL, UNIQUE(repo, role_name));
+
+DELETE FROM version;
+INSERT INTO version VALUES(27);
+
+RELEASE MIGRATION;
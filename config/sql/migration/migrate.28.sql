@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+ALTER TABLE target_images ADD COLUMN mtime INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE target_images ADD COLUMN ctime INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE target_images ADD COLUMN inode INTEGER NOT NULL DEFAULT 0;
+
+DELETE FROM version;
+INSERT INTO version VALUES(28);
+
+RELEASE MIGRATION;
@@ -0,0 +1,10 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE INDEX installed_versions_current ON installed_versions(ecu_serial, is_current);
+CREATE INDEX installed_versions_pending ON installed_versions(ecu_serial, is_pending);
+
+DELETE FROM version;
+INSERT INTO version VALUES(29);
+
+RELEASE MIGRATION;
@@ -0,0 +1,10 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+ALTER TABLE meta ADD COLUMN meta_file TEXT NOT NULL DEFAULT "";
+ALTER TABLE delegations ADD COLUMN meta_file TEXT NOT NULL DEFAULT "";
+
+DELETE FROM version;
+INSERT INTO version VALUES(30);
+
+RELEASE MIGRATION;
@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE campaigns(unique_mark INTEGER PRIMARY KEY CHECK (unique_mark = 0), campaigns TEXT NOT NULL, etag TEXT NOT NULL DEFAULT "", last_modified TEXT NOT NULL DEFAULT "");
+
+DELETE FROM version;
+INSERT INTO version VALUES(31);
+
+RELEASE MIGRATION;
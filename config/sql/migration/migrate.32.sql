@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE install_journal(ecu_serial TEXT NOT NULL PRIMARY KEY, filename TEXT NOT NULL, sha256 TEXT NOT NULL, stage INTEGER NOT NULL);
+
+DELETE FROM version;
+INSERT INTO version VALUES(32);
+
+RELEASE MIGRATION;
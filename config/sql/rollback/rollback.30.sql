@@ -0,0 +1,20 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+-- Metadata kept in files is dropped, so that it is fetched again. Its validators would make the fetch conditional.
+DELETE FROM meta_validators;
+
+CREATE TABLE meta_migrate(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, UNIQUE(repo, meta_type, version));
+INSERT INTO meta_migrate(meta, repo, meta_type, version) SELECT meta, repo, meta_type, version FROM meta WHERE meta_file = "";
+DROP TABLE meta;
+ALTER TABLE meta_migrate RENAME TO meta;
+
+CREATE TABLE delegations_migrate(meta BLOB NOT NULL, role_name TEXT NOT NULL, UNIQUE(role_name));
+INSERT INTO delegations_migrate(meta, role_name) SELECT meta, role_name FROM delegations WHERE meta_file = "";
+DROP TABLE delegations;
+ALTER TABLE delegations_migrate RENAME TO delegations;
+
+DELETE FROM version;
+INSERT INTO version VALUES(29);
+
+RELEASE ROLLBACK_MIGRATION;
@@ -11,6 +11,7 @@ using Campaign = campaign::Campaign;
 using Updates = std::vector<Uptane::Target>;
 using Target = Uptane::Target;
 using StorageTargetHandle = std::ifstream;
+using CompletionQueue = std::shared_ptr<api::CompletionQueue>;
 
 extern "C" {
 #else
@@ -19,6 +20,7 @@ typedef struct Campaign Campaign;
 typedef struct Updates Updates;
 typedef struct Target Target;
 typedef struct StorageTargetHandle StorageTargetHandle;
+typedef struct CompletionQueue CompletionQueue;
 #endif
 
 Aktualizr *Aktualizr_create_from_cfg(Config *cfg);
@@ -28,6 +30,10 @@ int Aktualizr_uptane_cycle(Aktualizr *a);
 void Aktualizr_destroy(Aktualizr *a);
 
 int Aktualizr_set_signal_handler(Aktualizr *a, void (*handler)(const char *event_name));
+/* Like Aktualizr_set_signal_handler, but passes on DownloadProgressReport events only when the progress of all the
+ * running downloads reaches the next multiple of progress_step percent. */
+int Aktualizr_set_signal_handler_progress_step(Aktualizr *a, void (*handler)(const char *event_name),
+                                               unsigned int progress_step);
 
 Campaign *Aktualizr_campaigns_check(Aktualizr *a);
 int Aktualizr_campaign_accept(Aktualizr *a, Campaign *c);
@@ -54,6 +60,45 @@ StorageTargetHandle *Aktualizr_open_stored_target(Aktualizr *a, const Target *t)
 size_t Aktualizr_read_stored_target(StorageTargetHandle *handle, uint8_t *buf, size_t size);
 int Aktualizr_close_stored_target(StorageTargetHandle *handle);
 
+/* A stored target opened as a read-only file descriptor. Its content has been verified against the length and hashes
+ * of the target; sha256 is the hex digest, terminated by a NUL character. */
+/* NOLINTNEXTLINE(modernize-use-using) */
+typedef struct {
+  int fd;
+  uint64_t length;
+  char sha256[65];
+} Stored_Target_C;
+
+int Aktualizr_open_stored_target_fd(Aktualizr *a, const Target *t, Stored_Target_C *st);
+/* Reads up to size bytes at offset straight into buf, returns the number of bytes read, 0 at the end and -1 on
+ * failure. */
+int64_t Aktualizr_pread_stored_target(const Stored_Target_C *st, uint8_t *buf, size_t size, uint64_t offset);
+/* Maps the whole target read-only, or returns NULL. Unmap with Aktualizr_unmap_stored_target. */
+const uint8_t *Aktualizr_map_stored_target(const Stored_Target_C *st);
+int Aktualizr_unmap_stored_target(const Stored_Target_C *st, const uint8_t *map);
+int Aktualizr_close_stored_target_fd(Stored_Target_C *st);
+
+/* Asynchronous calls for an event loop. The result of a call is not returned but passed to its callback, which runs
+ * inside Aktualizr_completion_queue_dispatch() on the thread of the loop. The loop calls it whenever the file
+ * descriptor of the queue becomes readable. The callbacks get what the synchronous calls return, and updates passed
+ * to the callback of Aktualizr_updates_check_async must be freed with Aktualizr_updates_free. */
+CompletionQueue *Aktualizr_completion_queue_create(void);
+int Aktualizr_completion_queue_fd(CompletionQueue *q);
+int Aktualizr_completion_queue_dispatch(CompletionQueue *q);
+void Aktualizr_completion_queue_destroy(CompletionQueue *q);
+
+/* Like Aktualizr_set_signal_handler, but the handler runs inside Aktualizr_completion_queue_dispatch(). */
+int Aktualizr_set_signal_handler_queued(Aktualizr *a, CompletionQueue *q, void (*handler)(const char *event_name));
+
+int Aktualizr_updates_check_async(Aktualizr *a, CompletionQueue *q, void (*done)(Updates *u, void *user_data),
+                                  void *user_data);
+int Aktualizr_download_target_async(Aktualizr *a, Target *t, CompletionQueue *q,
+                                    void (*done)(int result, void *user_data), void *user_data);
+int Aktualizr_install_target_async(Aktualizr *a, Target *t, CompletionQueue *q,
+                                   void (*done)(int result, void *user_data), void *user_data);
+int Aktualizr_send_manifest_async(Aktualizr *a, const char *manifest, CompletionQueue *q,
+                                  void (*done)(int result, void *user_data), void *user_data);
+
 /* NOLINTNEXTLINE(modernize-use-using) */
 typedef enum { kSuccess = 0, kAlreadyPaused, kAlreadyRunning, kError } Pause_Status_C;
 
@@ -1,16 +1,24 @@
 #ifndef AKTUALIZR_H_
 #define AKTUALIZR_H_
 
+#include <atomic>
+#include <functional>
 #include <future>
 #include <memory>
 
 #include <boost/signals2.hpp>
 
+#include "libaktualizr/completion_queue.h"
 #include "libaktualizr/config.h"
 #include "libaktualizr/events.h"
 #include "libaktualizr/secondaryinterface.h"
+#include "libaktualizr/target_download.h"
+#include "primary/poll_scheduler.h"
 #include "primary/update_lock_file.h"
 
+class AsyncEventDispatcher;
+class HttpInterface;
+class NotificationListener;
 class SotaUptaneClient;
 class INvStorage;
 
@@ -119,6 +127,7 @@ class Aktualizr {
   /**
    * Send local device data to the server.
    * This includes network status, installed packages, hardware etc.
+   * Data that could not be sent is sent again later, with a growing delay.
    * @return Empty std::future object
    *
    * @throw SQLException
@@ -158,6 +167,8 @@ class Aktualizr {
 
   /**
    * Download targets.
+   * While the download runs, SendManifest, SendDeviceData, CampaignCheck and
+   * CampaignControl calls are not held back by it but run alongside.
    * @param updates Vector of targets to download as provided by CheckUpdates.
    * @return std::future object with information about download results.
    *
@@ -168,6 +179,21 @@ class Aktualizr {
    */
   std::future<result::Download> Download(const std::vector<Uptane::Target>& updates, UpdateType = UpdateType::kOnline);
 
+  /**
+   * Download targets like Download(), and return in `handles` one handle per
+   * target, in the order of `updates`. With them each target can be paused,
+   * cancelled or given a priority over the others while the download runs.
+   * The handles are valid before the download starts, so a target can also be
+   * cancelled or reprioritized right away.
+   *
+   * @throw SQLException
+   * @throw std::bad_alloc (memory allocation failure)
+   * @throw std::system_error (failure to lock a mutex)
+   * @throw SotaUptaneClient::NotProvisionedYet (called before provisioning complete)
+   */
+  std::future<result::Download> Download(const std::vector<Uptane::Target>& updates, UpdateType update_type,
+                                         std::vector<api::TargetDownloadHandle>* handles);
+
   struct InstallationLogEntry {
     Uptane::EcuSerial ecu;
     std::vector<Uptane::Target> installs;
@@ -186,6 +212,19 @@ class Aktualizr {
    */
   InstallationLog GetInstallationLog();
 
+  /**
+   * Get a page of the log of installations: for every ECU, up to `limit`
+   * installations after skipping the `offset` oldest ones.
+   * @param offset number of installations to skip per ECU
+   * @param limit maximum number of installations per ECU
+   * @return installation log
+   *
+   * @throw SQLException
+   * @throw std::bad_alloc (memory allocation failure)
+   * @throw std::runtime_error (failure to load ECU serials)
+   */
+  InstallationLog GetInstallationLog(size_t offset, size_t limit);
+
   /**
    * Get list of targets currently in storage. This is intended to be used with
    * DeleteStoredTarget and targets are not guaranteed to be verified and
@@ -221,6 +260,21 @@ class Aktualizr {
    */
   std::ifstream OpenStoredTarget(const Uptane::Target& target);
 
+  /**
+   * Like OpenStoredTarget(), but returns a read-only file descriptor of the
+   * stored binary, which can be read with pread() or mapped with mmap()
+   * without a stream buffer in between. The binary has been verified
+   * against the length and hashes of `target`. The caller owns the
+   * descriptor and has to close() it.
+   * @param target Target object matching the desired target in the storage.
+   * @return File descriptor of the stored binary.
+   *
+   * @throw SQLException
+   * @throw std::runtime_error (target not found or not valid)
+   * @throw std::system_error (failure to open the file)
+   */
+  int OpenStoredTargetFd(const Uptane::Target& target);
+
   /**
    * Install targets.
    * @param updates Vector of targets to install as provided by CheckUpdates or
@@ -380,10 +434,70 @@ class Aktualizr {
    */
   boost::signals2::connection SetSignalHandler(const SigHandler& handler);
 
+  /**
+   * Like SetSignalHandler(), but `handler` is posted to `completions` for
+   * every event, so that it runs on the thread that dispatches them.
+   */
+  boost::signals2::connection SetSignalHandler(const SigHandler& handler,
+                                               const std::shared_ptr<api::CompletionQueue>& completions);
+
+  /**
+   * Receives the ready future of an asynchronous call. get() on it returns
+   * the result or throws what the call would have thrown.
+   */
+  template <class T>
+  using Completion = std::function<void(std::future<T>)>;
+
+  /**
+   * Variants of CheckUpdates(), Download(), Install() and SendManifest() for
+   * an event loop: instead of returning a future, they post `done` to
+   * `completions` once the call has finished, and `done` runs on the thread
+   * that calls CompletionQueue::dispatch(). No thread has to wait for the
+   * result. `done` also runs if Abort() drops the call before it started;
+   * the future then holds a std::future_error.
+   */
+  void CheckUpdates(const std::shared_ptr<api::CompletionQueue>& completions, Completion<result::UpdateCheck> done);
+  void Download(const std::vector<Uptane::Target>& updates, const std::shared_ptr<api::CompletionQueue>& completions,
+                Completion<result::Download> done, UpdateType update_type = UpdateType::kOnline);
+  void Install(const std::vector<Uptane::Target>& updates, const std::shared_ptr<api::CompletionQueue>& completions,
+               Completion<result::Install> done, UpdateType update_type = UpdateType::kOnline);
+  void SendManifest(const Json::Value& custom, const std::shared_ptr<api::CompletionQueue>& completions,
+                    Completion<bool> done);
+
+  /**
+   * Counters of the asynchronous event queue, see `uptane.event_queue_size`.
+   * Both stay zero when events are delivered synchronously.
+   */
+  struct EventQueueStats {
+    /** Download progress reports replaced by a more recent one. */
+    uint64_t coalesced{0};
+    /** Download progress reports dropped because the queue was full. */
+    uint64_t dropped{0};
+  };
+  EventQueueStats GetEventQueueStats() const;
+
+  /**
+   * Describe what libaktualizr is busy with, for diagnosing a slow device
+   * without a profiler: the commands waiting in the queue, the downloads in
+   * progress with the bytes received, the threads of the process and their
+   * state, the most recent trace spans (see `tracing.file`), the size of the
+   * storage and the peak memory use. Doesn't wait for any running command.
+   */
+  Json::Value Snapshot();
+
+  /**
+   * Write Snapshot() to `file` as compact JSON, e.g. on a signal.
+   * @throw std::runtime_error (filesystem failure)
+   */
+  void WriteSnapshot(const boost::filesystem::path& file);
+
  protected:
   Aktualizr(Config config, std::shared_ptr<INvStorage> storage_in, const std::shared_ptr<HttpInterface>& http_in);
 
   std::shared_ptr<SotaUptaneClient> uptane_client_;
+  // The minute of the day that uptane.predownload_windows are matched
+  // against, the local one if empty
+  std::function<int()> minute_of_day_;
 
  private:
   enum class UpdateCycleState {
@@ -402,6 +516,11 @@ class Aktualizr {
     kCheckingForUpdates,
     /** We are downloading an update, and are waiting for it to complete.*/
     kDownloading,
+    /**
+     * We are downloading an update that may not be installed yet (uptane.predownload_windows), and are waiting for it
+     * to complete.
+     */
+    kPredownloading,
     /** We are installing an update, and are waiting for it to complete. */
     kInstalling,
 #ifdef BUILD_OFFLINE_UPDATES
@@ -424,8 +543,11 @@ class Aktualizr {
     kNoUpdates,
     kRebootRequired,
     kStopRequested,
+    kIdle,  // uptane.idle_exit_sec
   };
 
+  using Clock = std::chrono::steady_clock;
+
   /**
    * Run the main update loop until we have a reason to exit.
    * exit_cond_.run_mode determines whether to exit after one update check or to keep going until we have an update that
@@ -434,6 +556,23 @@ class Aktualizr {
    */
   ExitReason RunUpdateLoop();
 
+  /** Schedule the next online update check after one that ended at `now`. */
+  void scheduleOnlinePoll(Clock::time_point now, PollScheduler::Outcome outcome);
+  // Schedules another attempt on the API queue, if the device data was not sent
+  void retryDeviceData(bool sent);
+
+  /** Where the polling state is kept while aktualizr has exited for uptane.idle_exit_sec. */
+  boost::filesystem::path pollStateFile() const { return config_.storage.path / "poll.state"; }
+
+  /** Whether the local time is in one of uptane.predownload_windows. */
+  bool inPredownloadWindow() const;
+
+  /** Start listening for update notifications if uptane.notification_url is set. */
+  void startNotificationListener();
+
+  /** The installation log, with `limit` entries per ECU at most, or all if negative. */
+  InstallationLog loadInstallationLog(int64_t offset, int64_t limit);
+
   UpdateCycleState state_{UpdateCycleState::kUnprovisioned};
   // These hold a running operation for the current state
   std::future<void> op_void_;
@@ -441,13 +580,24 @@ class Aktualizr {
   std::future<result::UpdateCheck> op_update_check_;
   std::future<result::Download> op_download_;
   std::future<result::Install> op_install_;
+  // Device data not sent yet because startup was deferred
+  bool device_data_pending_{false};
+  // Failed attempts to send the device data in a row, and whether the next one is scheduled
+  std::atomic<int> device_data_retries_{0};
+  std::atomic<bool> device_data_retry_scheduled_{false};
+  // An update cycle ran since the heap was last trimmed
+  bool release_memory_pending_{false};
+  // The updates last downloaded in full ahead of being allowed to install
+  std::vector<Uptane::Target> predownloaded_;
+  // The targets of the running pre-download, cancelled when its window ends
+  std::vector<api::TargetDownloadHandle> predownload_handles_;
 
-  using Clock = std::chrono::steady_clock;
   Clock::time_point next_online_poll_;
   Clock::time_point next_offline_poll_;
   // Make sure this is declared before SotaUptaneClient to prevent Valgrind
   // complaints with destructors.
   Config config_;
+  PollScheduler poll_scheduler_;
 
   /**
    * TODO: [OFFUPD] Remove after MVP.
@@ -477,9 +627,19 @@ class Aktualizr {
 
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<event::Channel> sig_;
+  // Only set when events are delivered asynchronously. The client then emits
+  // on its own channel, which feeds the dispatcher.
+  std::unique_ptr<AsyncEventDispatcher> event_dispatcher_;
+  boost::signals2::scoped_connection event_dispatcher_connection_;
   std::unique_ptr<api::CommandQueue> api_queue_;
 
   UpdateLockFile update_lock_file_;
+
+  std::shared_ptr<HttpInterface> http_;
+  // Only set in RunForever() with uptane.notification_url
+  std::unique_ptr<NotificationListener> notification_listener_;
+  // Set by the notification listener, taken by RunUpdateLoop() when idle
+  std::atomic<bool> update_notified_{false};
 };
 
 #endif  // AKTUALIZR_H_
@@ -8,6 +8,7 @@
 #include "json/json.h"
 
 class HttpInterface;
+class INvStorage;
 
 namespace campaign {
 
@@ -41,6 +42,9 @@ class Campaign {
   static std::vector<Campaign> campaignsFromJson(const Json::Value &json);
   static void JsonFromCampaigns(const std::vector<Campaign> &in, Json::Value &out);
   static std::vector<Campaign> fetchAvailableCampaigns(HttpInterface &http_client, const std::string &tls_server);
+  // Conditional fetch against the list kept in storage; `changed` tells if the list differs from the stored one
+  static std::vector<Campaign> fetchAvailableCampaigns(HttpInterface &http_client, const std::string &tls_server,
+                                                       INvStorage &storage, bool *changed);
 
   Campaign() = default;
   explicit Campaign(const Json::Value &json);
@@ -0,0 +1,51 @@
+#ifndef AKTUALIZR_COMPLETION_QUEUE_H_
+#define AKTUALIZR_COMPLETION_QUEUE_H_
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace api {
+
+/**
+ * Hands the results of asynchronous libaktualizr calls over to the thread of
+ * an event loop. Any thread may post() a function; the loop watches fd() and
+ * runs the posted functions with dispatch() whenever it becomes readable.
+ * fd() is an eventfd, so it fits poll(), a GLib GSource or an asio
+ * descriptor alike.
+ */
+class CompletionQueue {
+ public:
+  /**
+   * @throw std::system_error if the eventfd cannot be created
+   */
+  CompletionQueue();
+  ~CompletionQueue();
+  CompletionQueue(const CompletionQueue&) = delete;
+  CompletionQueue(CompletionQueue&&) = delete;
+  CompletionQueue& operator=(const CompletionQueue&) = delete;
+  CompletionQueue& operator=(CompletionQueue&&) = delete;
+
+  /** Readable while functions are waiting for dispatch(). */
+  int fd() const { return fd_; }
+
+  /** Queue `function` to run on the thread that calls dispatch(). Thread-safe. */
+  void post(std::function<void()> function);
+
+  /**
+   * Run the functions posted so far, in the order they were posted, on the
+   * calling thread. Never blocks.
+   * @return the number of functions run
+   */
+  size_t dispatch();
+
+ private:
+  int fd_;
+  std::mutex m_;
+  std::vector<std::function<void()>> queue_;
+};
+
+}  // namespace api
+
+#endif  // AKTUALIZR_COMPLETION_QUEUE_H_
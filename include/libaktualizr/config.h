@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -17,6 +18,12 @@
 
 struct LoggerConfig {
   int loglevel{2};
+  // Write log records from a background thread instead of the logging one
+  bool async{false};
+  // Records waiting for the background thread; further ones are dropped
+  uint64_t async_queue_size{4096U};
+  // Minimum interval between messages from one LOG_*_LIMITED call site; 0 disables it
+  uint64_t rate_limit_ms{1000U};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -71,21 +78,92 @@ struct ProvisionConfig {
 
 struct UptaneConfig {
   uint64_t polling_sec{10U};
+  // Polling interval while an update is in progress (0 for polling_sec)
+  uint64_t polling_active_sec{0U};
+  // Longest polling interval after failed update checks
+  uint64_t polling_max_sec{3600U};
+  // How much each device deviates from the polling intervals, in percent
+  uint64_t polling_jitter_percent{10U};
   std::string director_server;
   std::string repo_server;
+  // Mirror of the Image repo on the local network, e.g. on a site gateway, tried before repo_server (empty for none)
+  std::string repo_mirror_url;
+  // Directory in which to mirror the verified Image repo metadata and downloaded targets for other devices
+  boost::filesystem::path repo_mirror_path;
   CryptoSource key_source{CryptoSource::kFile};
   KeyType key_type{KeyType::kRSA2048};
   bool force_install_completion{false};
   boost::filesystem::path secondary_config_file;
   uint64_t secondary_preinstall_wait_sec{600U};
+  // Time to wait for Secondary manifests before using cached ones (0 for no limit)
+  uint64_t secondary_manifest_timeout_sec{10U};
+  // Don't download images for Secondaries that can receive them while they are downloaded, see SecondaryProvider
+  bool secondary_firmware_passthrough{false};
+  // Send the firmware to Secondaries as soon as its download is verified, instead of when installing
+  bool pipeline_secondary_transfer{false};
+  // Install on the Secondaries while installing on the Primary, for updates whose ECUs don't depend on each other
+  bool concurrent_primary_install{false};
   bool enable_online_updates{true};
   bool enable_offline_updates{false};
   // TODO: [OFFUPD] This might be removed after the MVP.
   boost::filesystem::path offline_updates_source{"/mnt/offline-updates/"};
   boost::filesystem::path update_lock_file{UPDATE_LOCK_FILE_DEFAULT};
+  // Number of targets downloaded in parallel
+  uint64_t download_concurrency{1U};
+  // Initial download priorities of targets by hardware ID, like "brake-ecu=10,infotainment=-1"
+  std::string download_priorities;
+  // Of targets with the same priority, download the smallest first
+  bool download_smallest_first{false};
+  // Report the download progress of each target at most this often (0 for every percent)
+  uint64_t download_progress_interval_ms{0U};
+  // Bandwidth budget for all concurrent target downloads, in bytes per second (0 for no limit)
+  uint64_t download_bandwidth_limit{0U};
+  // Other budgets during times of the day, like "08:00-18:00=262144,22:00-06:00=0"
+  std::string download_bandwidth_windows;
+  // Prefixes of the names of network interfaces that are metered, e.g. cellular modems
+  std::string metered_interfaces{"wwan,ppp"};
+  // Bandwidth budget on a metered link (0 for no limit)
+  uint64_t metered_bandwidth_limit{0U};
+  // Wait with downloads while the link is metered
+  bool pause_downloads_on_metered{false};
+  // Times of the day when updates that may not be installed yet are downloaded, like "22:00-06:00"
+  std::string predownload_windows;
+  // Number of targets copied from an offline update in parallel (0 for one per CPU core)
+  uint64_t offline_fetch_concurrency{0U};
+  // Secondaries that receive firmware or install at the same time, in total and per Secondary type (0 for no limit)
+  uint64_t secondary_install_concurrency{0U};
+  uint64_t secondary_install_concurrency_per_type{0U};
+  // Events queued for delivery to signal handlers on a separate thread (0 to deliver them synchronously)
+  uint64_t event_queue_size{0U};
+  // Finish Secondary cleanup, post-reboot finalization and provisioning in the background after Initialize()
+  bool deferred_startup{false};
+  // Resend an unchanged manifest only after this many seconds (0 to send it on every update check)
+  uint64_t manifest_heartbeat_sec{0U};
+  // Fetch only the Director Targets first, and skip the rest of the update check while they stay the same
+  bool fast_update_check{false};
+  // Fetch the Image repo metadata along with the Director's, and its Snapshot along with its Timestamp
+  bool parallel_metadata_fetch{false};
+  // Fetch all newer Root metadata in one request, from servers that support it
+  bool fetch_root_chain{false};
+  // Number of sibling delegations fetched in parallel while looking for a target in the delegation tree
+  uint64_t delegation_fetch_concurrency{1U};
+  // Answer campaign checks from the last received campaign list for this many seconds (0 to always ask the server)
+  uint64_t campaigns_ttl_sec{0U};
+  // Long-polling URL for update notifications from the server (empty to only poll)
+  std::string notification_url;
+  // Polling interval while update notifications are received
+  uint64_t notification_polling_sec{3600U};
+  // Exit from RunForever() when the next update check is at least this far away (0 to keep running)
+  uint64_t idle_exit_sec{0U};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
+
+  /**
+   * Parse download_priorities into hardware ID => priority.
+   * @throws std::invalid_argument on a malformed rule
+   */
+  static std::map<std::string, int> parseDownloadPriorities(const std::string& spec);
 };
 
 // TODO: move these to their corresponding headers
@@ -107,6 +185,34 @@ struct PackageConfig {
   std::string ostree_server;
   boost::filesystem::path images_path{"/var/sota/images"};
   boost::filesystem::path packages_file{"/usr/package.manifest"};
+  // Upper limit of the total size of stored binary Targets. The least recently used ones are
+  // removed after a download that exceeds it. 0 disables the limit.
+  uint64_t images_max_bytes{0U};
+  // Enforce images_max_bytes in a low priority background task after each successful installation instead of
+  // after each download, always keeping the current, previous and pending Targets of every ECU.
+  bool images_prune_after_install{false};
+
+  // Binary target downloads: split targets of at least download_segment_threshold
+  // bytes into this many parallel range requests. 1 disables segmenting.
+  uint64_t download_segments{1U};
+  uint64_t download_segment_threshold{64U * 1024U * 1024U};
+  // Assemble binary targets with a chunk index in their custom metadata from the chunks of
+  // the stored target files, and only download the missing chunks.
+  bool download_chunked_delta{false};
+
+  // OSTree pulls: "prefer" tries a static delta first and falls back to fetching
+  // individual objects, "auto" leaves the choice to libostree, "disable" never uses deltas.
+  std::string ostree_static_deltas{"prefer"};
+  uint64_t ostree_network_retries{5U};
+  // Create the OSTree deployment in the background right after a fetch
+  bool ostree_prestage{false};
+  // Import OSTree commits of offline updates without checksumming each object on the way in, and verify
+  // them on all cores afterwards
+  bool ostree_offline_fast_import{false};
+  // Local archive mode OSTree repository holding the commits of Secondaries, and the URL
+  // under which Secondaries reach it. Secondaries pull from treehub if either is empty.
+  boost::filesystem::path ostree_mirror_path;
+  std::string ostree_mirror_url;
 
   // Options for simulation
   bool fake_need_reboot{false};
@@ -134,6 +240,20 @@ struct StorageConfig {
 
   // SQLite storage
   utils::BasedPath sqldb_path{"sql.db"};  // based on `/var/sota`
+  std::string sqldb_journal_mode{"wal"};  // SQLite journal_mode
+  std::string sqldb_synchronous{"full"};  // SQLite synchronous setting
+  bool sqldb_cache{true};                 // keep metadata read from the database in memory
+  // Non-Root metadata of at least this many bytes is kept in files instead of the database; 0 keeps all of it there
+  uint64_t sqldb_blob_threshold{1024U * 1024U};
+  utils::BasedPath sqldb_blob_path{"metadata_blobs"};
+  bool sqldb_blob_compress{false};  // zlib-compress metadata files
+  // Vacuum, WAL checkpoint and statistics update while idle, at most this often; 0 disables it
+  uint64_t sqldb_maintenance_interval_sec{24U * 3600U};
+  // Append-only file for report events waiting to be sent; empty keeps them in the database
+  utils::BasedPath report_journal_path{"report_events.journal"};
+  // Report events kept in the journal, and their size as JSON, before the oldest are dropped; 0 for no limit
+  uint64_t report_events_max{0U};
+  uint64_t report_events_max_bytes{0U};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -154,10 +274,22 @@ struct ImportConfig {
 /**
  * @brief The TelemetryConfig struct
  * Report device network information: IP address, hostname, MAC address.
+ * Optionally export client metrics (request counts and latencies) to a file in
+ * the Prometheus text format and report a summary of them to the server, and
+ * report the timings of each update cycle.
  */
 struct TelemetryConfig {
   bool report_network{true};
   bool report_config{true};
+  bool report_metrics{false};
+  bool report_performance{false};
+  boost::filesystem::path metrics_file;
+  // Where the default hardware information comes from: "lshw", or "native" to read sysfs, procfs and the device tree
+  std::string hw_info_source{"lshw"};
+  // Comma-separated parts collected by the native source
+  std::string hw_info_fields{"board,cpu,memory,firmware,network,storage"};
+  // Run lshw if the native source finds nothing
+  bool hw_info_lshw_fallback{false};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -165,6 +297,49 @@ struct TelemetryConfig {
 enum class RollbackMode { kBootloaderNone = 0, kUbootGeneric, kUbootMasked };
 std::ostream& operator<<(std::ostream& os, RollbackMode mode);
 
+/**
+ * Timing of the update cycle, written in the Chrome trace event format.
+ */
+struct TracingConfig {
+  // Output file; tracing is disabled while empty
+  boost::filesystem::path file;
+  // Number of most recent spans kept
+  uint64_t buffer_size{65536U};
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
+/**
+ * Low-memory profile: one budget for the larger in-flight buffers, i.e. HTTP
+ * response bodies, streamed downloads, report batches, cached metadata and
+ * Secondary RPC buffers.
+ */
+struct MemoryConfig {
+  // Bytes these buffers may use together; 0 for no limit
+  uint64_t buffer_budget{0U};
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
+/**
+ * CPU and I/O priorities of the phases of an update cycle, like
+ * "nice=10,io=idle" or "nice=5,io=best-effort:7". They apply to the threads
+ * working on a phase and to the processes they start; empty leaves them as
+ * they are.
+ */
+struct ResourcesConfig {
+  std::string metadata;
+  std::string download;
+  // Verifying the stored targets before they are installed
+  std::string hash;
+  // Installing on the Primary, e.g. deploying an OSTree commit
+  std::string deploy;
+  // Running `docker load` for offline updates of containers
+  std::string container_load;
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
 struct BootloaderConfig {
   RollbackMode rollback_mode{RollbackMode::kBootloaderNone};
   boost::filesystem::path reboot_sentinel_dir{"/var/run/aktualizr-session"};
@@ -203,11 +378,18 @@ class BaseConfig {
   BaseConfig& operator=(const BaseConfig&) = default;
   BaseConfig& operator=(BaseConfig&&) = default;
 
-  void updateFromDirs(const std::vector<boost::filesystem::path>& configs);
+  /**
+   * Read the config files in `configs`. With a `cache`, the merged config is
+   * kept there and read back instead while the config files don't change.
+   */
+  void updateFromDirs(const std::vector<boost::filesystem::path>& configs,
+                      const boost::filesystem::path& cache = boost::filesystem::path());
 
   static void checkDirs(const std::vector<boost::filesystem::path>& configs);
 
   std::vector<boost::filesystem::path> config_dirs_ = {"/usr/lib/sota/conf.d", "/etc/sota/conf.d/"};
+  // Merged contents of config_dirs_
+  boost::filesystem::path config_cache_{"/var/cache/sota/config.toml"};
 };
 
 /**
@@ -242,6 +424,9 @@ class Config : public BaseConfig {
   ImportConfig import;
   TelemetryConfig telemetry;
   BootloaderConfig bootloader;
+  TracingConfig tracing;
+  MemoryConfig memory;
+  ResourcesConfig resources;
 
  private:
   void updateFromPropertyTree(const boost::property_tree::ptree& pt) override;
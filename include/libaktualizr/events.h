@@ -78,13 +78,21 @@ class DownloadProgressReport : public BaseEvent {
   }
 
   DownloadProgressReport(Uptane::Target target_in, std::string description_in, unsigned int progress_in)
-      : target{std::move(target_in)}, description{std::move(description_in)}, progress{progress_in} {
+      : DownloadProgressReport(std::move(target_in), std::move(description_in), progress_in, progress_in) {}
+  DownloadProgressReport(Uptane::Target target_in, std::string description_in, unsigned int progress_in,
+                         unsigned int overall_progress_in)
+      : target{std::move(target_in)},
+        description{std::move(description_in)},
+        progress{progress_in},
+        overall_progress{overall_progress_in} {
     variant = TypeName;
   }
 
   Uptane::Target target;
   std::string description;
   unsigned int progress;
+  // Progress of all the Targets downloaded together, weighted by their length
+  unsigned int overall_progress;
 
  private:
   static const unsigned int ProgressCompletedValue{100};
@@ -169,6 +177,18 @@ class CampaignCheckComplete : public BaseEvent {
   result::CampaignCheck result;
 };
 
+/**
+ * The list of available campaigns differs from the one received before.
+ */
+class CampaignsChanged : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"CampaignsChanged"};
+
+  explicit CampaignsChanged(result::CampaignCheck result_in) : result(std::move(result_in)) { variant = TypeName; }
+
+  result::CampaignCheck result;
+};
+
 /**
  * A campaign has been accepted.
  */
@@ -2,11 +2,14 @@
 #define PACKAGEMANAGERINTERFACE_H_
 
 #include <fstream>
+#include <istream>
+#include <memory>
 #include <mutex>
 #include <string>
 
 #include "libaktualizr/config.h"
 
+class BandwidthLimiter;
 class Bootloader;
 class HttpInterface;
 class KeyManager;
@@ -55,6 +58,11 @@ class PackageManagerInterface {
   PackageManagerInterface& operator=(PackageManagerInterface&&) = delete;
   virtual std::string name() const = 0;
   virtual Json::Value getInstalledPackages() const = 0;
+  /**
+   * Cheap indicator that changes whenever the result of getInstalledPackages()
+   * may have changed. An empty string means that no such indicator exists.
+   */
+  virtual std::string installedPackagesVersion() const { return ""; }
   virtual Uptane::Target getCurrent() const = 0;
   virtual data::InstallationResult install(const Uptane::Target& target) const = 0;
   virtual void completeInstall() const { throw std::runtime_error("Unimplemented"); }
@@ -67,18 +75,62 @@ class PackageManagerInterface {
                                  const KeyManager& keys, const FetcherProgressCb& progress_cb,
                                  const api::FlowControlToken* token);
 #endif
+  /**
+   * Make an OSTree Target of a Secondary available in the local mirror that
+   * Secondaries pull from instead of the remote server. Returns false if this
+   * package manager does not support mirroring or the Target could not be
+   * mirrored.
+   */
+  virtual bool mirrorTarget(const Uptane::Target& target, const KeyManager& keys, const FetcherProgressCb& progress_cb,
+                            const api::FlowControlToken* token) {
+    (void)target;
+    (void)keys;
+    (void)progress_cb;
+    (void)token;
+    return false;
+  }
   virtual TargetStatus verifyTarget(const Uptane::Target& target) const;
   virtual bool checkAvailableDiskSpace(uint64_t required_bytes) const;
   virtual boost::optional<std::pair<uintmax_t, std::string>> checkTargetFile(const Uptane::Target& target) const;
   virtual std::ofstream createTargetFile(const Uptane::Target& target);
   virtual std::ofstream appendTargetFile(const Uptane::Target& target);
   virtual std::ifstream openTargetFile(const Uptane::Target& target) const;
+  /**
+   * Download the image of `target` from byte `from` on without storing it.
+   * The download runs on its own thread and waits while more than
+   * `buffer_size` bytes have not been read yet. The stream ends early, without
+   * its last chunk, if the download fails or, if it starts at the beginning,
+   * the image doesn't match the hashes of `target`.
+   */
+  virtual std::unique_ptr<std::istream> streamTarget(const Uptane::Target& target, const std::string& repo_server,
+                                                     uint64_t from, size_t buffer_size) const;
   virtual void removeTargetFile(const Uptane::Target& target);
   virtual std::vector<Uptane::Target> getTargetFiles();
+  /**
+   * Remove stored Target files, least recently used first, until they take at
+   * most `images_max_bytes`. The files of `retain` and of unfinished
+   * downloads are kept.
+   */
+  void pruneStoredTargets(const std::vector<Uptane::Target>& retain);
+  /**
+   * Targets whose stored files a download must not remove when it enforces
+   * `images_max_bytes`, e.g. the other Targets of the update being
+   * downloaded. The file just downloaded is always kept.
+   */
+  void retainTargets(std::vector<Uptane::Target> targets) {
+    std::lock_guard<std::mutex> guard(retained_targets_mutex_);
+    retained_targets_ = std::move(targets);
+  }
+  /** Limit the bandwidth of all concurrent fetchTarget() downloads with `limiter`, nullptr for no limit. */
+  void setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter) { bandwidth_limiter_ = std::move(limiter); }
 
  protected:
   PackageConfig config;
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<HttpInterface> http_;
+  std::shared_ptr<BandwidthLimiter> bandwidth_limiter_;
+  // See retainTargets()
+  std::mutex retained_targets_mutex_;
+  std::vector<Uptane::Target> retained_targets_;
 };
 #endif  // PACKAGEMANAGERINTERFACE_H_
@@ -1,8 +1,15 @@
 #ifndef UPTANE_SECONDARY_PROVIDER_H
 #define UPTANE_SECONDARY_PROVIDER_H
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
 #include "libaktualizr/config.h"
 #include "libaktualizr/packagemanagerinterface.h"
 #include "libaktualizr/types.h"
@@ -17,19 +24,85 @@ class SecondaryProvider {
   bool getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
   bool getDirectorMetadata(Uptane::MetaBundle* meta_bundle) const;
   bool getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
+  /**
+   * All the metadata of getMetadata(), without a copy while a snapshot is set:
+   * every Secondary then gets the same bundle. Returns nullptr if metadata is
+   * missing.
+   */
+  std::shared_ptr<const Uptane::MetaBundle> getMetadataBundle(const Uptane::Target& target) const;
   bool getEcuSerialsForHwId(EcuSerials* serials) const;
   bool pendingPrimaryUpdate();
   std::string getTreehubCredentials() const;
+  /**
+   * Like getTreehubCredentials(), but points the Secondary to the Primary's
+   * OSTree mirror (see PackageConfig::ostree_mirror_url) when it holds the
+   * commit of `target`.
+   */
+  std::string getTreehubCredentials(const Uptane::Target& target) const;
   std::ifstream getTargetFileHandle(const Uptane::Target& target) const;
+  /**
+   * The image of `target` from byte `from` on. It comes from the Primary's
+   * target store if it was downloaded, and otherwise, if
+   * UptaneConfig::secondary_firmware_passthrough is set, straight from the
+   * server (see PackageManagerInterface::streamTarget()).
+   */
+  std::unique_ptr<std::istream> getTargetStream(const Uptane::Target& target, uint64_t from) const;
+  /**
+   * Path of the downloaded file of `target` in the Primary's target store, for
+   * Secondaries that can copy it without reading it through a stream.
+   */
+  boost::optional<boost::filesystem::path> getTargetFilePath(const Uptane::Target& target) const;
+  /**
+   * The Target last installed on the Secondary `serial` and its complete file
+   * in the Primary's target store, as the base of a delta upload.
+   */
+  boost::optional<std::pair<Uptane::Target, boost::filesystem::path>> getInstalledTargetFile(
+      const Uptane::EcuSerial& serial) const;
+  /**
+   * Replace `dest` with the downloaded file of `target`. Within the same host
+   * this is a reflink or an in-kernel copy (see Utils::copyFile()); the file
+   * in the target store is never linked or moved, as the Primary may still
+   * verify, resume or hand it to other Secondaries.
+   */
+  void copyTargetFile(const Uptane::Target& target, const boost::filesystem::path& dest) const;
+  /**
+   * While a snapshot is set, metadata is served from it instead of being
+   * loaded from storage for every Secondary. Pass nullptr to clear it.
+   */
+  void setMetadataSnapshot(std::shared_ptr<const Uptane::MetaBundle> snapshot);
+  /**
+   * A payload derived from the metadata, e.g. an encoded request that carries
+   * it. While a snapshot is set, `build` runs once per `key` and its result is
+   * shared by all Secondaries until the snapshot changes; without one, it runs
+   * on every call. Returns nullptr if `build` returns an empty string.
+   */
+  std::shared_ptr<const std::string> getMetadataPayload(const std::string& key,
+                                                        const std::function<std::string()>& build) const;
 
  private:
   SecondaryProvider(Config& config_in, std::shared_ptr<const INvStorage> storage_in,
                     std::shared_ptr<const PackageManagerInterface> package_manager_in)
       : config_(config_in), storage_(std::move(storage_in)), package_manager_(std::move(package_manager_in)) {}
 
+  std::string treehubCredentials(const std::string& treehub_url) const;
+  std::shared_ptr<const Uptane::MetaBundle> metadataSnapshot() const;
+
   Config& config_;
   const std::shared_ptr<const INvStorage> storage_;
   const std::shared_ptr<const PackageManagerInterface> package_manager_;
+  // Both guarded by payloads_mutex_, as Secondaries are updated in parallel
+  std::shared_ptr<const Uptane::MetaBundle> metadata_snapshot_;
+  mutable std::mutex payloads_mutex_;
+  mutable std::map<std::string, std::shared_ptr<const std::string>> payloads_;
+  // The credentials archive last built for each Treehub URL, rebuilt when the credentials change
+  struct TreehubCredentials {
+    std::string ca;
+    std::string cert;
+    std::string pkey;
+    std::string archive;
+  };
+  mutable std::mutex credentials_mutex_;
+  mutable std::map<std::string, TreehubCredentials> credentials_;
 };
 
 #endif  // UPTANE_SECONDARY_PROVIDER_H
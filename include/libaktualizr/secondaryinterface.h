@@ -2,6 +2,7 @@
 #define UPTANE_SECONDARYINTERFACE_H
 
 #include <string>
+#include <vector>
 
 #include "libaktualizr/secondary_provider.h"
 #include "libaktualizr/types.h"
@@ -57,6 +58,29 @@ class SecondaryInterface {
   virtual int32_t getRootVersion(bool director) const = 0;
   virtual data::InstallationResult putRoot(const std::string& root, bool director) = 0;
 
+  /**
+   * Send consecutive Root versions, oldest first. Secondaries that can take a
+   * whole chain in one request override this; by default the Roots are sent
+   * one by one and sending stops at the first failure.
+   */
+  virtual data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director) {
+    data::InstallationResult result{data::ResultCode::Numeric::kOk, ""};
+    for (const auto& root : roots) {
+      result = putRoot(root, director);
+      if (!result.isSuccess()) {
+        break;
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Whether sendFirmware() reads the image through
+   * SecondaryProvider::getTargetStream(), so that it can get the image while
+   * it is downloaded instead of from the Primary's target store.
+   */
+  virtual bool acceptsFirmwareStream() const { return false; }
+
   /**
    * Send firmware to a device. This operation should be both idempotent and
    * not commit to installing the new version. Where practical, the
@@ -68,6 +92,36 @@ class SecondaryInterface {
   virtual data::InstallationResult sendFirmware(const Uptane::Target& target, const InstallInfo& install_info,
                                                 const api::FlowControlToken* flow_control) = 0;
 
+  /**
+   * Start sending firmware to a device without waiting until the device has
+   * received it, e.g. when the device fetches it by itself. Returns
+   * boost::none if the firmware has to be sent with sendFirmware() instead.
+   * Otherwise, a successful result means that the transfer has started and
+   * firmwareStatus() tells when it is done.
+   */
+  virtual boost::optional<data::InstallationResult> startFirmware(const Uptane::Target& target,
+                                                                  const InstallInfo& install_info) {
+    (void)target;
+    (void)install_info;
+    return boost::none;
+  }
+
+  /**
+   * The result of the transfer begun by startFirmware(), or boost::none while
+   * it is still in progress.
+   */
+  virtual boost::optional<data::InstallationResult> firmwareStatus(const Uptane::Target& target) {
+    (void)target;
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "Secondary does not send firmware in the background");
+  }
+
+  /**
+   * Stop the transfer begun by startFirmware(), e.g. when the update is
+   * cancelled while it is still in progress.
+   */
+  virtual void cancelFirmware(const Uptane::Target& target) { (void)target; }
+
   /**
    * Commit to installing an update.
    */
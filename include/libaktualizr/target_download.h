@@ -0,0 +1,69 @@
+#ifndef AKTUALIZR_TARGET_DOWNLOAD_H_
+#define AKTUALIZR_TARGET_DOWNLOAD_H_
+
+#include <atomic>
+#include <memory>
+
+#include "libaktualizr/types.h"
+
+namespace api {
+
+class FlowControlToken;
+
+/**
+ * Controls the download of one target of a Download() call, independently of
+ * the others. Pause() and Cancel() act on this target only, while
+ * Aktualizr::Pause() and Aktualizr::Abort() still act on all of them. Of the
+ * targets that have not started downloading yet, the one with the highest
+ * priority starts first when a download slot frees up; paused targets wait
+ * until the others have started. All methods are thread-safe.
+ */
+class TargetDownload {
+ public:
+  /** `parent` is the token of the command that runs the download, it may be null. */
+  TargetDownload(Uptane::Target target, const FlowControlToken* parent);
+  ~TargetDownload();
+  TargetDownload(const TargetDownload&) = delete;
+  TargetDownload(TargetDownload&&) = delete;
+  TargetDownload& operator=(const TargetDownload&) = delete;
+  TargetDownload& operator=(TargetDownload&&) = delete;
+
+  const Uptane::Target& target() const { return target_; }
+
+  /**
+   * Hold the download of this target, keeping what was fetched so far.
+   * @return `false` if it was already paused or cancelled
+   */
+  bool Pause();
+  /**
+   * @return `false` if it was not paused
+   */
+  bool Resume();
+  /**
+   * Stop downloading this target for good. The Download() result then lacks
+   * it and has the kPartialSuccess or kError status.
+   * @return `false` if it was already cancelled
+   */
+  bool Cancel();
+
+  void SetPriority(int priority) { priority_ = priority; }
+  int priority() const { return priority_; }
+  bool paused() const { return paused_; }
+  bool cancelled() const { return cancelled_; }
+
+  /** The token to pass along to the fetcher of this target. */
+  const FlowControlToken* token() const;
+
+ private:
+  Uptane::Target target_;
+  std::unique_ptr<FlowControlToken> token_;
+  std::atomic<int> priority_{0};
+  std::atomic<bool> paused_{false};
+  std::atomic<bool> cancelled_{false};
+};
+
+using TargetDownloadHandle = std::shared_ptr<TargetDownload>;
+
+}  // namespace api
+
+#endif  // AKTUALIZR_TARGET_DOWNLOAD_H_
@@ -3,7 +3,10 @@
 /** \file */
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <istream>
+#include <memory>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -178,8 +181,16 @@ class Hash {
   // order corresponds algorithm priority
   enum class Type { kSha256, kSha512, kUnknownAlgorithm };
 
+  static constexpr size_t kMaxDigestSize = 64;
+  /** Size of a digest of the given type in bytes, 0 for an unknown algorithm. */
+  static constexpr size_t DigestSize(Type type) {
+    return type == Type::kSha256 ? 32 : (type == Type::kSha512 ? kMaxDigestSize : 0);
+  }
+
   static Hash generate(Type type, const std::string &data);
   static Hash generate(Type type, std::istream &source, ssize_t *nread = nullptr);
+  /** From a binary digest, as opposed to the hex string taken by the constructors. */
+  static Hash fromDigest(Type type, const std::string &digest);
   Hash(const std::string &type, const std::string &hash);
   Hash(Type type, const std::string &hash);
 
@@ -189,7 +200,8 @@ class Hash {
   static std::string TypeString(Type type);
   std::string TypeString() const;
   Type type() const;
-  std::string HashString() const { return hash_; }
+  /** Upper case hex string */
+  std::string HashString() const;
   friend std::ostream &operator<<(std::ostream &os, const Hash &h);
 
   static std::string encodeVector(const std::vector<Hash> &hashes);
@@ -200,28 +212,38 @@ class Hash {
   static std::string shortTag(const std::vector<Hash> &hashes);
 
  private:
+  void setHex(const std::string &hash);
+
   Type type_;
-  std::string hash_;
+  // Number of bytes used in digest_, either DigestSize(type_) or 0
+  uint8_t digest_size_{0};
+  std::array<uint8_t, kMaxDigestSize> digest_{};
+  // Upper case, only for hash strings that are not a hex digest of the size of type_
+  std::string other_;
 };
 
 std::ostream &operator<<(std::ostream &os, const Hash &h);
 
-// timestamp, compatible with tuf
+/**
+ * A point in time, with a precision of one second, as used for the expiry of
+ * Uptane metadata. It is kept as seconds since the epoch, so that expiry
+ * checks are a comparison, and only formatted as RFC 3339 when needed.
+ */
 class TimeStamp {
  public:
   static TimeStamp Now();
   static struct tm CurrentTime();
   /** An invalid TimeStamp */
   TimeStamp() = default;
-  explicit TimeStamp(std::string rfc3339);
+  explicit TimeStamp(const std::string &rfc3339);
   explicit TimeStamp(struct tm time);
   bool IsExpiredAt(const TimeStamp &now) const;
-  bool IsValid() const;
-  std::string ToString() const { return time_; }
+  bool IsValid() const { return valid_; }
+  std::string ToString() const;
   bool operator<(const TimeStamp &other) const;
   bool operator>(const TimeStamp &other) const;
   friend std::ostream &operator<<(std::ostream &os, const TimeStamp &t);
-  bool operator==(const TimeStamp &rhs) const { return time_ == rhs.time_; }
+  bool operator==(const TimeStamp &rhs) const { return valid_ == rhs.valid_ && seconds_ == rhs.seconds_; }
 
   class InvalidTimeStamp : public std::domain_error {
    public:
@@ -234,7 +256,10 @@ class TimeStamp {
   };
 
  private:
-  std::string time_;
+  explicit TimeStamp(int64_t seconds) : seconds_(seconds), valid_(true) {}
+
+  int64_t seconds_{0};
+  bool valid_{false};
 };
 
 std::ostream &operator<<(std::ostream &os, const TimeStamp &t);
@@ -326,11 +351,8 @@ struct InstallationResult {
 
 namespace Uptane {
 
-class RepositoryType;
-class Role;
-struct MetaPairHash;
-
-using MetaBundle = std::unordered_map<std::pair<RepositoryType, Role>, std::string, MetaPairHash>;
+// Defined in uptane/tuf.h
+class MetaBundle;
 
 struct InstalledImageInfo {
   InstalledImageInfo() = default;
@@ -422,9 +444,9 @@ class Target {
   std::string sha256Hash() const;
   std::string sha512Hash() const;
   const std::vector<Hash> &hashes() const { return hashes_; }
-  const std::vector<HardwareIdentifier> &hardwareIds() const { return hwids_; }
+  const std::vector<HardwareIdentifier> &hardwareIds() const;
   std::string custom_version() const;
-  Json::Value custom_data() const { return custom_; }
+  const Json::Value &custom_data() const;
   void updateCustom(const Json::Value &custom);
   uint64_t length() const { return length_; }
   bool IsValid() const { return valid; }
@@ -463,8 +485,10 @@ class Target {
   std::string type_;
   EcuMap ecus_;  // Director only
   std::vector<Hash> hashes_;
-  std::vector<HardwareIdentifier> hwids_;  // Image repo only
-  Json::Value custom_;
+  // Image repo only. Interned: a few lists of hardware IDs are shared by all Targets.
+  std::shared_ptr<const std::vector<HardwareIdentifier>> hwids_;
+  // Shared between copies of the Target, replaced as a whole by updateCustom()
+  std::shared_ptr<const Json::Value> custom_;
   uint64_t length_{0};
   std::string uri_;
 
@@ -1,15 +1,43 @@
 #include "get.h"
+
+#include <array>
+#include <deque>
+#include <fstream>
+#include <future>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
+#include "logging/logging.h"
 #include "storage/invstorage.h"
 
-std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
-  auto storage = INvStorage::newStorage(config.storage);
-  storage->importData(config.import);
+static std::unique_ptr<HttpClient> makeClient(Config &config, const std::vector<std::string> &headers) {
+  // Only read an existing database, so that this does not wait for or hold up aktualizr. A database that is
+  // missing or needs a migration is opened for writing instead.
+  std::shared_ptr<INvStorage> storage;
+  if (boost::filesystem::exists(config.storage.sqldb_path.get(config.storage.path))) {
+    try {
+      storage = INvStorage::newStorage(config.storage, true);
+    } catch (const StorageException &e) {
+      LOG_DEBUG << "Opening the database for writing: " << e.what();
+    }
+  }
+  if (storage == nullptr) {
+    storage = INvStorage::newStorage(config.storage);
+    storage->importData(config.import);
+  }
 
   auto client = std_::make_unique<HttpClient>(&headers);
   KeyManager keys(storage, config.keymanagerConfig());
   keys.copyCertsToCurl(*client);
+  return client;
+}
+
+std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
+  auto client = makeClient(config, headers);
   auto resp = client->get(url, HttpInterface::kNoLimit, nullptr);
   if (resp.http_status_code != 200) {
     throw std::runtime_error("Unable to get " + url + ": HTTP_" + std::to_string(resp.http_status_code) + "\n" +
@@ -17,3 +45,135 @@ std::string aktualizrGet(Config &config, const std::string &url, const std::vect
   }
   return resp.body;
 }
+
+namespace {
+struct FileDownload {
+  explicit FileDownload(const GetFile &file_in) : file(file_in) {}
+
+  const GetFile &file;
+  std::ofstream out;
+  MultiPartHasher::Ptr hasher;
+  CurlHandler handle;
+  curl_off_t from{0};
+  std::future<HttpResponse> response;
+};
+}  // namespace
+
+static size_t writeFile(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *download = static_cast<FileDownload *>(userp);
+  long http_code = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(download->handle.get(), CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code < 200 || http_code >= 300) {
+    // Keep error pages out of the file
+    return 0;
+  }
+  const size_t length = size * nmemb;
+  download->out.write(contents, static_cast<std::streamsize>(length));
+  if (!download->out) {
+    return 0;
+  }
+  if (download->hasher != nullptr) {
+    download->hasher->update(reinterpret_cast<const unsigned char *>(contents), length);
+  }
+  return length;
+}
+
+static void startDownload(HttpInterface &http, FileDownload &download, bool resume) {
+  download.from = 0;
+  if (!download.file.sha256.empty()) {
+    download.hasher = MultiPartHasher::create(Hash::Type::kSha256);
+  }
+  if (resume && boost::filesystem::exists(download.file.path)) {
+    download.from = static_cast<curl_off_t>(boost::filesystem::file_size(download.file.path));
+  }
+  if (download.from > 0 && download.hasher != nullptr) {
+    std::ifstream existing(download.file.path.string(), std::ios::binary);
+    std::array<char, 64 * 1024> buf{};
+    while (existing.read(buf.data(), buf.size()) || existing.gcount() > 0) {
+      download.hasher->update(buf.data(), existing.gcount());
+    }
+  }
+  download.out.open(download.file.path.string(),
+                    std::ios::binary | (download.from > 0 ? std::ios::app : std::ios::trunc));
+  if (!download.out) {
+    throw std::runtime_error("Unable to open " + download.file.path.string() + " for writing");
+  }
+  download.response = http.downloadAsync(download.file.url, writeFile, nullptr, &download, download.from,
+                                         &download.handle);
+}
+
+// Returns an error message, empty on success
+static std::string finishDownload(HttpInterface &http, FileDownload &download) {
+  const HttpResponse response = download.response.get();
+  download.out.close();
+  const std::string &url = download.file.url;
+
+  // A server answers a request for the bytes after the end of a complete file with 416
+  const bool complete = download.from > 0 && response.http_status_code == 416;
+  if (!complete) {
+    if (response.curl_code == CURLE_RANGE_ERROR && download.from > 0) {
+      LOG_WARNING << "The server doesn't support byte range requests, downloading " << url << " from the beginning";
+      startDownload(http, download, false);
+      return finishDownload(http, download);
+    }
+    if (response.http_status_code < 200 || response.http_status_code >= 300) {
+      return "Unable to get " + url + ": HTTP_" + std::to_string(response.http_status_code);
+    }
+    if (response.curl_code != CURLE_OK) {
+      return "Unable to get " + url + ": " + response.error_message;
+    }
+  }
+
+  if (download.hasher != nullptr) {
+    const Hash expected(Hash::Type::kSha256, download.file.sha256);
+    const Hash actual = download.hasher->getHash();
+    if (actual != expected) {
+      boost::filesystem::remove(download.file.path);
+      return "Hash mismatch for " + url + ": expected " + boost::algorithm::to_lower_copy(expected.HashString()) +
+             ", got " + boost::algorithm::to_lower_copy(actual.HashString());
+    }
+  }
+  return "";
+}
+
+void aktualizrGetFiles(Config &config, const std::vector<GetFile> &files, const std::vector<std::string> &headers,
+                       size_t jobs, bool resume) {
+  auto client = makeClient(config, headers);
+
+  // deque: the write callbacks keep pointers to the elements
+  std::deque<FileDownload> downloads;
+  for (const auto &file : files) {
+    downloads.emplace_back(file);
+  }
+
+  std::string errors;
+  size_t started = 0;
+  for (size_t finished = 0; finished < downloads.size(); ++finished) {
+    for (; started < downloads.size() && started < finished + std::max<size_t>(jobs, 1); ++started) {
+      try {
+        startDownload(*client, downloads[started], resume);
+      } catch (const std::exception &e) {
+        errors += std::string(e.what()) + "\n";
+      }
+    }
+    FileDownload &download = downloads[finished];
+    if (!download.response.valid()) {
+      continue;
+    }
+    std::string error;
+    try {
+      error = finishDownload(*client, download);
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+    if (!error.empty()) {
+      errors += error + "\n";
+    } else {
+      LOG_INFO << "Downloaded " << download.file.url << " to " << download.file.path;
+    }
+  }
+
+  if (!errors.empty()) {
+    throw std::runtime_error(errors);
+  }
+}
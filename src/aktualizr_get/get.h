@@ -1,8 +1,28 @@
 #ifndef AKTUALIZR_GET_HELPERS
 #define AKTUALIZR_GET_HELPERS
 
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
 #include "libaktualizr/config.h"
 
 std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers);
 
+struct GetFile {
+  std::string url;
+  boost::filesystem::path path;
+  std::string sha256;  // Hex digest to check the file against, empty for none
+};
+
+/**
+ * Stream each of `files` to its path, with up to `jobs` downloads at a time
+ * sharing the connections. With `resume`, existing files are continued where
+ * they end. A file that does not match its hash is removed.
+ * @throws std::runtime_error listing the files that could not be downloaded
+ */
+void aktualizrGetFiles(Config &config, const std::vector<GetFile> &files, const std::vector<std::string> &headers,
+                       size_t jobs, bool resume);
+
 #endif  // AKTUALIZR_GET_HELPERS
@@ -2,8 +2,10 @@
 
 #include <boost/process.hpp>
 
+#include "crypto/crypto.h"
 #include "get.h"
 #include "test_utils.h"
+#include "utilities/utils.h"
 
 static std::string server = "http://localhost:";
 
@@ -17,6 +19,35 @@ TEST(aktualizr_get, good) {
   EXPECT_EQ("{\"path\": \"/path/1/2/3\"}", body);
 }
 
+TEST(aktualizr_get, files) {
+  Config config;
+  TemporaryDirectory dir;
+  config.storage.path = dir.Path();
+  const std::string body_a = "{\"path\": \"/a\"}";
+  const std::string body_b = "{\"path\": \"/b\"}";
+
+  std::vector<std::string> headers;
+  aktualizrGetFiles(config,
+                    {{server + "/a", dir / "a", Crypto::sha256digestHex(body_a)},
+                     {server + "/b", dir / "b", ""},
+                     {server + "/download", dir / "c", ""}},
+                    headers, 2, false);
+  EXPECT_EQ(Utils::readFile(dir / "a"), body_a);
+  EXPECT_EQ(Utils::readFile(dir / "b"), body_b);
+  EXPECT_EQ(Utils::readFile(dir / "c"), "content");
+
+  // The server does not support ranges, so the partial file is downloaded again
+  Utils::writeFile(dir / "b", std::string("{\"pa"));
+  aktualizrGetFiles(config, {{server + "/b", dir / "b", Crypto::sha256digestHex(body_b)}}, headers, 1, true);
+  EXPECT_EQ(Utils::readFile(dir / "b"), body_b);
+
+  // The file is removed when the hash does not match
+  EXPECT_THROW(aktualizrGetFiles(config, {{server + "/a", dir / "a", Crypto::sha256digestHex(body_b)}}, headers, 1,
+                                 false),
+               std::runtime_error);
+  EXPECT_FALSE(boost::filesystem::exists(dir / "a"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -34,7 +34,11 @@ bpo::variables_map parse_options(int argc, char **argv) {
       ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory, by default /var/sota")
       ("header,H", bpo::value<std::vector<std::string> >()->composing(), "Additional headers to pass")
       ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
-      ("url,u", bpo::value<std::string>(), "url to get, mandatory");
+      ("url,u", bpo::value<std::vector<std::string> >()->composing(), "url to get, mandatory; may be repeated with --output")
+      ("output,o", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "file to stream the url to instead of printing it, once for each url")
+      ("sha256", bpo::value<std::vector<std::string> >()->composing(), "expected SHA-256 of each output file")
+      ("jobs,j", bpo::value<size_t>()->default_value(4), "number of urls to get at the same time with --output")
+      ("continue", "continue partially downloaded output files");
   // clang-format on
 
   bpo::variables_map vm;
@@ -70,8 +74,29 @@ int main(int argc, char *argv[]) {
     if (commandline_map.count("header") == 1) {
       headers = commandline_map["header"].as<std::vector<std::string>>();
     }
-    std::string body = aktualizrGet(config, commandline_map["url"].as<std::string>(), headers);
-    std::cout << body;
+    const auto urls = commandline_map["url"].as<std::vector<std::string>>();
+    if (commandline_map.count("output") == 0) {
+      if (urls.size() != 1) {
+        throw std::invalid_argument("Use --output to get more than one url");
+      }
+      std::string body = aktualizrGet(config, urls[0], headers);
+      std::cout << body;
+    } else {
+      const auto outputs = commandline_map["output"].as<std::vector<boost::filesystem::path>>();
+      std::vector<std::string> hashes;
+      if (commandline_map.count("sha256") == 1) {
+        hashes = commandline_map["sha256"].as<std::vector<std::string>>();
+      }
+      if (outputs.size() != urls.size() || (!hashes.empty() && hashes.size() != urls.size())) {
+        throw std::invalid_argument("Give one --output, and one --sha256 if any, for each url");
+      }
+      std::vector<GetFile> files;
+      for (size_t i = 0; i < urls.size(); ++i) {
+        files.push_back({urls[i], outputs[i], hashes.empty() ? std::string() : hashes[i]});
+      }
+      aktualizrGetFiles(config, files, headers, commandline_map["jobs"].as<size_t>(),
+                        commandline_map.count("continue") != 0);
+    }
 
     r = EXIT_SUCCESS;
   } catch (const std::exception &ex) {
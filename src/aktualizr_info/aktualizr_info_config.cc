@@ -17,7 +17,7 @@ AktualizrInfoConfig::AktualizrInfoConfig(const boost::program_options::variables
     checkDirs(configs);
     updateFromDirs(configs);
   } else {
-    updateFromDirs(config_dirs_);
+    updateFromDirs(config_dirs_, config_cache_);
   }
   updateFromCommandLine(cmd);
   postUpdateValues();
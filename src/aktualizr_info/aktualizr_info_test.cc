@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 
 #include "libaktualizr/config.h"
@@ -629,6 +634,87 @@ TEST_F(AktualizrInfoTest, PrintSecondaryEcuCurrentAndPendingVersions) {
   EXPECT_NE(aktualizr_info_output.find("no details about installed nor pending images"), std::string::npos);
 }
 
+/**
+ * Verifies the JSON output of aktualizr-info
+ *
+ * Checks actions:
+ *
+ *  - [x] Print the general information and the requested metadata as one JSON document
+ */
+TEST_F(AktualizrInfoTest, PrintJson) {
+  const Uptane::EcuSerial secondary_ecu_serial{"c6998d3e-2a68-4ac2-817e-4ea6ef87d21f"};
+  const Uptane::HardwareIdentifier secondary_hw_id{"secondary-hdwr-af250269-bd6f-4148-9426-4101df7f613a"};
+  const std::string current_ecu_version = "639a4e39-e6ba-4832-ace4-8b12cf20d562";
+
+  Json::Value meta_root;
+  meta_root["signed"]["version"] = 1;
+  Json::Value meta_targets;
+  meta_targets["signed"]["version"] = 2;
+
+  db_storage_->storeEcuSerials({{primary_ecu_serial, primary_hw_id}, {secondary_ecu_serial, secondary_hw_id}});
+  db_storage_->storeEcuRegistered();
+  db_storage_->storeRoot(Utils::jsonToStr(meta_root), Uptane::RepositoryType::Director(), Uptane::Version(1));
+  db_storage_->storeNonRoot(Utils::jsonToStr(meta_targets), Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  Uptane::EcuMap ecu_map{{secondary_ecu_serial, secondary_hw_id}};
+  db_storage_->saveInstalledVersion(secondary_ecu_serial.ToString(),
+                                    {"secondary.file", ecu_map, {{Hash::Type::kSha256, current_ecu_version}}, 1},
+                                    InstalledVersionUpdateMode::kCurrent, "correlationid1");
+
+  aktualizr_info_process_.run({"--json", "--director-root", "--image-targets"});
+  ASSERT_FALSE(aktualizr_info_output.empty());
+
+  const Json::Value info = Utils::parseJSON(aktualizr_info_output);
+  EXPECT_EQ(info["device_id"].asString(), device_id);
+  EXPECT_TRUE(info["provisioned"].asBool());
+  EXPECT_TRUE(info["fetched_metadata"].asBool());
+  EXPECT_EQ(info["primary"]["serial"].asString(), primary_ecu_serial.ToString());
+  EXPECT_EQ(info["primary"]["hardware_id"].asString(), primary_hw_id.ToString());
+  ASSERT_EQ(info["secondaries"].size(), 1);
+  EXPECT_EQ(info["secondaries"][0]["serial"].asString(), secondary_ecu_serial.ToString());
+  EXPECT_EQ(info["secondaries"][0]["installed"]["filename"].asString(), "secondary.file");
+  EXPECT_EQ(info["secondaries"][0]["installed"]["hash"].asString(), current_ecu_version);
+  EXPECT_EQ(info["secondaries"][0]["correlation_id"].asString(), "correlationid1");
+  EXPECT_EQ(info["director"]["root"], meta_root);
+  EXPECT_EQ(info["image"]["targets"], meta_targets);
+  // Only the requested metadata is included
+  EXPECT_FALSE(info["image"].isMember("root"));
+  EXPECT_FALSE(info.isMember("tls"));
+}
+
+/**
+ * Verifies the watch mode of aktualizr-info
+ *
+ * Checks actions:
+ *
+ *  - [x] Print the JSON document, then the members that change as they are written to the database
+ */
+TEST_F(AktualizrInfoTest, WatchJson) {
+  db_storage_->storeEcuSerials({{primary_ecu_serial, primary_hw_id}});
+  db_storage_->storeEcuRegistered();
+  const std::string pending_ecu_version = "9636753d-2a09-4c80-8b25-64b2c2d0c4df";
+
+  auto watch = std::async(std::launch::async, Process::spawn, "timeout",
+                          std::vector<std::string>{"4", "./aktualizr-info", "-c", test_conf_file_.string(), "--watch"});
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  Uptane::EcuMap ecu_map{{primary_ecu_serial, primary_hw_id}};
+  db_storage_->savePrimaryInstalledVersion({"update-01.bin", ecu_map, {{Hash::Type::kSha256, pending_ecu_version}}, 1},
+                                           InstalledVersionUpdateMode::kPending, "corrid-01");
+
+  std::stringstream output(std::get<1>(watch.get()));
+  std::string line;
+  ASSERT_TRUE(std::getline(output, line));
+  const Json::Value info = Utils::parseJSON(line);
+  EXPECT_EQ(info["device_id"].asString(), device_id);
+  EXPECT_FALSE(info["primary"].isMember("pending"));
+
+  // Only what changed
+  ASSERT_TRUE(std::getline(output, line));
+  const Json::Value diff = Utils::parseJSON(line);
+  EXPECT_EQ(diff.getMemberNames(), std::vector<std::string>{"primary"});
+  EXPECT_EQ(diff["primary"]["pending"]["hash"].asString(), pending_ecu_version);
+  EXPECT_FALSE(std::getline(output, line));
+}
+
 /**
  *  Print device name only for scripting purposes.
  */
@@ -1,3 +1,10 @@
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -12,6 +19,7 @@
 #include "storage/invstorage.h"
 #include "storage/sql_utils.h"
 #include "utilities/aktualizr_version.h"
+#include "utilities/utils.h"
 
 namespace bpo = boost::program_options;
 
@@ -34,6 +42,279 @@ static int loadAndPrintDelegations(const std::shared_ptr<INvStorage> &storage) {
   return EXIT_SUCCESS;
 }
 
+static Json::Value metadataToJson(const std::string &metadata) {
+  Json::Value json = Utils::parseJSON(metadata);
+  // Keep whatever is stored if it is not valid JSON
+  if (json.isNull() && !metadata.empty()) {
+    return Json::Value(metadata);
+  }
+  return json;
+}
+
+static Json::Value targetToJson(const Uptane::Target &target) {
+  Json::Value json;
+  json["filename"] = target.filename();
+  json["hash"] = target.sha256Hash();
+  return json;
+}
+
+// Read everything in a single transaction, so that it is consistent
+static Json::Value infoToJson(const bpo::variables_map &vm, const AktualizrInfoConfig &config,
+                              const std::shared_ptr<INvStorage> &storage,
+                              const std::shared_ptr<PackageManagerInterface> &pacman) {
+  Json::Value out(Json::objectValue);
+  StorageBatch batch(*storage);
+
+  std::string device_id;
+  const bool deviceid_loaded = storage->loadDeviceId(&device_id);
+  if (deviceid_loaded) {
+    out["device_id"] = device_id;
+  }
+  out["provisioned"] = storage->loadEcuRegistered();
+
+  std::string director_root;
+  std::string image_root;
+  const bool has_director_root = storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director());
+  const bool has_image_root = storage->loadLatestRoot(&image_root, Uptane::RepositoryType::Image());
+  const bool has_metadata = has_director_root || has_image_root;
+  out["fetched_metadata"] = has_metadata;
+
+  std::string ca;
+  std::string cert;
+  std::string pkey;
+  storage->loadTlsCreds(&ca, &cert, &pkey);
+  const bool tlscred_loaded = !ca.empty() || !cert.empty() || !pkey.empty();
+  if (vm.count("tls-creds") != 0U || vm.count("tls-root-ca") != 0U) {
+    out["tls"]["root_ca"] = ca;
+  }
+  if (vm.count("tls-creds") != 0U || vm.count("tls-cert") != 0U) {
+    out["tls"]["cert"] = cert;
+  }
+  if (vm.count("tls-creds") != 0U || vm.count("tls-prv-key") != 0U) {
+    out["tls"]["private_key"] = pkey;
+  }
+
+  std::string priv;
+  std::string pub;
+  storage->loadPrimaryKeys(&pub, &priv);
+  const bool ecukeys_loaded = !pub.empty() && !priv.empty();
+  if (ecukeys_loaded) {
+    if (vm.count("ecu-keys") != 0U || vm.count("ecu-keyid") != 0U) {
+      // TODO: probably won't work with p11.
+      out["ecu_keys"]["public_key_id"] = PublicKey(pub, config.uptane.key_type).KeyId();
+    }
+    if (vm.count("ecu-keys") != 0U || vm.count("ecu-pub-key") != 0U) {
+      out["ecu_keys"]["public_key"] = pub;
+    }
+    if (vm.count("ecu-keys") != 0U || vm.count("ecu-prv-key") != 0U) {
+      out["ecu_keys"]["private_key"] = priv;
+    }
+  }
+
+  if (has_metadata) {
+    if (vm.count("image-root") != 0U || vm.count("images-root") != 0U) {
+      if (vm.count("root-version") != 0U) {
+        image_root.clear();
+        storage->loadRoot(&image_root, Uptane::RepositoryType::Image(), Uptane::Version(vm["root-version"].as<int>()));
+      }
+      out["image"]["root"] = metadataToJson(image_root);
+    }
+    if (vm.count("director-root") != 0U) {
+      if (vm.count("root-version") != 0U) {
+        director_root.clear();
+        storage->loadRoot(&director_root, Uptane::RepositoryType::Director(),
+                          Uptane::Version(vm["root-version"].as<int>()));
+      }
+      out["director"]["root"] = metadataToJson(director_root);
+    }
+    const auto add_non_root = [&storage, &out](const char *repo_name, Uptane::RepositoryType repo,
+                                               const Uptane::Role &role) {
+      std::string metadata;
+      if (storage->loadNonRoot(&metadata, repo, role)) {
+        out[repo_name][role.ToString()] = metadataToJson(metadata);
+      }
+    };
+    if (vm.count("image-targets") != 0U || vm.count("image-target") != 0U || vm.count("images-targets") != 0U ||
+        vm.count("images-target") != 0U) {
+      add_non_root("image", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    }
+    if (vm.count("image-snapshot") != 0U || vm.count("images-snapshot") != 0U) {
+      add_non_root("image", Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+    }
+    if (vm.count("image-timestamp") != 0U || vm.count("images-timestamp") != 0U) {
+      add_non_root("image", Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+    }
+    if (vm.count("director-targets") != 0U || vm.count("director-target") != 0U) {
+      add_non_root("director", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+    }
+    if (vm.count("delegation") != 0U) {
+      std::vector<std::pair<Uptane::Role, std::string> > delegations;
+      if (storage->loadAllDelegations(delegations)) {
+        out["image"]["delegations"] = Json::objectValue;
+        for (const auto &delegation : delegations) {
+          out["image"]["delegations"][delegation.first.ToString()] = metadataToJson(delegation.second);
+        }
+      }
+    }
+  }
+
+  const bool secondary_db = !deviceid_loaded && !tlscred_loaded && ecukeys_loaded;
+  const std::string ecu_name = secondary_db ? "secondary" : "primary";
+  EcuSerials serials;
+  if (storage->loadEcuSerials(&serials) && !serials.empty()) {
+    out[ecu_name]["serial"] = serials[0].first.ToString();
+    out[ecu_name]["hardware_id"] = serials[0].second.ToString();
+  }
+
+  std::vector<SecondaryInfo> info;
+  if (vm.count("secondary-keys") != 0U) {
+    storage->loadSecondariesInfo(&info);
+  }
+  out["secondaries"] = Json::arrayValue;
+  for (auto it = serials.cbegin() + std::min<size_t>(serials.size(), 1); it != serials.cend(); ++it) {
+    Json::Value secondary;
+    secondary["serial"] = it->first.ToString();
+    secondary["hardware_id"] = it->second.ToString();
+
+    boost::optional<Uptane::Target> current_version;
+    boost::optional<Uptane::Target> pending_version;
+    Uptane::CorrelationId correlation_id;
+    if (storage->loadInstalledVersions(it->first.ToString(), &current_version, &pending_version, &correlation_id)) {
+      if (!!current_version) {
+        secondary["installed"] = targetToJson(*current_version);
+      }
+      if (!!pending_version) {
+        secondary["pending"] = targetToJson(*pending_version);
+      }
+      if (!correlation_id.empty()) {
+        secondary["correlation_id"] = correlation_id;
+      }
+    }
+
+    const Uptane::EcuSerial &serial = it->first;
+    auto f = std::find_if(info.cbegin(), info.cend(), [&serial](const SecondaryInfo &i) { return serial == i.serial; });
+    if (f != info.cend()) {
+      secondary["public_key_id"] = f->pub_key.KeyId();
+      secondary["public_key"] = f->pub_key.Value();
+    }
+    out["secondaries"].append(secondary);
+  }
+
+  std::vector<MisconfiguredEcu> misconfigured_ecus;
+  storage->loadMisconfiguredEcus(&misconfigured_ecus);
+  out["misconfigured_ecus"] = Json::arrayValue;
+  for (const auto &ecu : misconfigured_ecus) {
+    Json::Value misconfigured;
+    misconfigured["serial"] = ecu.serial.ToString();
+    misconfigured["hardware_id"] = ecu.hardware_id.ToString();
+    misconfigured["state"] = ecu.state == EcuState::kOld ? "removed" : "unregistered";
+    out["misconfigured_ecus"].append(misconfigured);
+  }
+
+  const Uptane::Target current_target = pacman->getCurrent();
+  if (current_target.IsValid()) {
+    out[ecu_name]["installed"] = targetToJson(current_target);
+  }
+  boost::optional<Uptane::Target> pending;
+  Uptane::CorrelationId correlation_id;
+  storage->loadPrimaryInstalledVersions(nullptr, &pending, &correlation_id);
+  if (!!pending) {
+    out[ecu_name]["pending"] = targetToJson(*pending);
+  }
+
+  data::InstallationResult installation_result;
+  std::string raw_report;
+  Uptane::CorrelationId result_correlation_id;
+  if (storage->loadDeviceInstallationResult(&installation_result, &raw_report, &result_correlation_id)) {
+    out["installation_result"] = installation_result.toJson();
+    out["installation_result"]["correlation_id"] = result_correlation_id;
+  }
+  return out;
+}
+
+// Output everything in one JSON document
+static int printJson(const bpo::variables_map &vm, const AktualizrInfoConfig &config,
+                     const std::shared_ptr<INvStorage> &storage) {
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, nullptr);
+  std::cout << Utils::jsonToCanonicalStr(infoToJson(vm, config, storage, pacman)) << std::endl;
+  return EXIT_SUCCESS;
+}
+
+// The top-level members that differ, with null for those that were removed
+static Json::Value jsonDiff(const Json::Value &from, const Json::Value &to) {
+  Json::Value diff(Json::objectValue);
+  for (const auto &name : from.getMemberNames()) {
+    if (!to.isMember(name)) {
+      diff[name] = Json::nullValue;
+    }
+  }
+  for (const auto &name : to.getMemberNames()) {
+    if (!from.isMember(name) || from[name] != to[name]) {
+      diff[name] = to[name];
+    }
+  }
+  return diff;
+}
+
+// Output the JSON document, then a line with the members that changed each time the database or the images
+// change, keeping the storage open in between
+static int watchJson(const bpo::variables_map &vm, const AktualizrInfoConfig &config,
+                     const std::shared_ptr<INvStorage> &storage) {
+  // Also catches changes made outside of the watched directories, like a new OSTree deployment
+  constexpr int kRecheckMs = 10000;
+  // Lets a transaction and the writes that come with it settle before reading
+  constexpr int kSettleMs = 100;
+
+  const std::vector<boost::filesystem::path> dirs{config.storage.sqldb_path.get(config.storage.path).parent_path(),
+                                                  config.pacman.images_path};
+  const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    LOG_WARNING << "Could not watch for changes, checking every " << kRecheckMs / 1000 << "s: " << strerror(errno);
+  }
+  const uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+  for (const auto &dir : dirs) {
+    if (fd >= 0 && inotify_add_watch(fd, dir.c_str(), mask) < 0) {
+      LOG_DEBUG << "Not watching " << dir << ": " << strerror(errno);
+    }
+  }
+  const auto drain = [fd]() {
+    std::array<char, 4096> buf{};
+    while (read(fd, buf.data(), buf.size()) > 0) {
+    }
+  };
+
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, nullptr);
+  Json::Value last = infoToJson(vm, config, storage, pacman);
+  std::cout << Utils::jsonToCanonicalStr(last) << std::endl;
+  while (std::cout) {
+    pollfd pfd{fd, POLLIN, 0};
+    if (poll(&pfd, fd >= 0 ? 1 : 0, kRecheckMs) > 0) {
+      // Changes usually come in bursts
+      do {
+        drain();
+      } while (poll(&pfd, 1, kSettleMs) > 0);
+    }
+
+    Json::Value current;
+    try {
+      current = infoToJson(vm, config, storage, pacman);
+    } catch (const std::exception &e) {
+      // e.g. while aktualizr migrates the database
+      LOG_DEBUG << "Could not read the state: " << e.what();
+      continue;
+    }
+    const Json::Value diff = jsonDiff(last, current);
+    if (!diff.empty()) {
+      std::cout << Utils::jsonToCanonicalStr(diff) << std::endl;
+      last = std::move(current);
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return EXIT_FAILURE;
+}
+
 void checkInfoOptions(const bpo::options_description &description, const bpo::variables_map &vm) {
   if (vm.count("help") != 0) {
     std::cout << description << '\n';
@@ -74,7 +355,9 @@ int main(int argc, char **argv) {
     ("director-targets",  "Outputs targets.json from Director repo")
     ("root-version",  bpo::value<int>(), "Use with --image-root or --director-root to specify the version to output")
     ("allow-migrate", "Opens database in read/write mode to make possible to migrate database if needed")
-    ("wait-until-provisioned", "Outputs metadata when device already provisioned");
+    ("wait-until-provisioned", "Outputs metadata when device already provisioned")
+    ("json", "Outputs the general information and the requested items as one JSON document")
+    ("watch", "Like --json, then outputs a line of JSON with the members that changed each time they change");
   // Support old names and variations due to common typos.
   hidden.add_options()
     ("images-root",  "Outputs root.json from Image repo")
@@ -143,6 +426,13 @@ int main(int argc, char **argv) {
       storage = INvStorage::newStorage(config.storage, readonly);
     }
 
+    if (vm.count("watch") != 0U) {
+      return watchJson(vm, config, storage);
+    }
+    if (vm.count("json") != 0U) {
+      return printJson(vm, config, storage);
+    }
+
     bool deviceid_loaded = false;
     if (storage->loadDeviceId(&device_id)) {
       deviceid_loaded = true;
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 
 #include <boost/filesystem.hpp>
@@ -211,6 +212,12 @@ int main(int argc, char *argv[]) {
     SigHandler::signal(SIGHUP);
     SigHandler::signal(SIGINT);
     SigHandler::signal(SIGTERM);
+    // A snapshot of the client state for diagnosing a slow device
+    SigHandler::signal(SIGUSR1, [&aktualizr, &config]() {
+      const auto now = std::chrono::system_clock::now().time_since_epoch();
+      const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+      aktualizr.WriteSnapshot(config.storage.path / ("snapshot-" + std::to_string(seconds) + ".json"));
+    });
 
     if (commandline_map.count("hwinfo-file") != 0) {
       auto file = commandline_map["hwinfo-file"].as<boost::filesystem::path>();
@@ -94,6 +94,57 @@ TEST(PrimarySecondaryReg, SecondariesMigration) {
   }
 }
 
+/* Stored IP Secondaries that are not up yet are added with the stored
+ * information, so that none of them is taken for removed. */
+TEST(PrimarySecondaryReg, StoredSecondariesOffline) {
+  const Uptane::EcuSerial primary_serial{"p_serial"};
+  const Uptane::HardwareIdentifier primary_hwid{"p_hwid"};
+  const std::vector<std::pair<Uptane::EcuSerial, Uptane::HardwareIdentifier>> secondaries{
+      {Uptane::EcuSerial("s1"), Uptane::HardwareIdentifier("s1_hwid")},
+      {Uptane::EcuSerial("s2"), Uptane::HardwareIdentifier("s2_hwid")}};
+
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.provision.primary_ecu_serial = primary_serial.ToString();
+  conf.provision.primary_ecu_hardware_id = primary_hwid.ToString();
+  const boost::filesystem::path sec_conf_path = temp_dir / "s_config.json";
+  conf.uptane.secondary_config_file = sec_conf_path;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  storage->storeDeviceId("device");
+  storage->storeEcuSerials({{primary_serial, primary_hwid}, secondaries[0], secondaries[1]});
+  Json::Value sec_conf;
+  sec_conf["IP"]["secondary_wait_port"] = 9030;
+  sec_conf["IP"]["secondary_wait_timeout"] = 1;
+  sec_conf["IP"]["secondaries"] = Json::arrayValue;
+  for (size_t i = 0; i < secondaries.size(); ++i) {
+    const auto port = static_cast<int>(9062 + i);
+    storage->saveSecondaryInfo(secondaries[i].first, "IP", PublicKey("key" + std::to_string(i), KeyType::kED25519));
+    Json::Value d;
+    d["ip"] = "127.0.0.1";
+    d["port"] = port;
+    d["verification_type"] = "Full";
+    storage->saveSecondaryData(secondaries[i].first, Utils::jsonToCanonicalStr(d));
+    sec_conf["IP"]["secondaries"][static_cast<int>(i)]["addr"] = "127.0.0.1:" + std::to_string(port);
+  }
+  storage->storeEcuRegistered();
+  Utils::writeFile(sec_conf_path, sec_conf);
+
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  Primary::initSecondaries(aktualizr, sec_conf_path);
+  aktualizr.Initialize();
+
+  std::vector<MisconfiguredEcu> misconfigured;
+  storage->loadMisconfiguredEcus(&misconfigured);
+  EXPECT_TRUE(misconfigured.empty());
+  std::vector<SecondaryInfo> secs_info;
+  storage->loadSecondariesInfo(&secs_info);
+  ASSERT_EQ(secs_info.size(), 2);
+  EXPECT_EQ(secs_info[0].serial, secondaries[0].first);
+  EXPECT_EQ(secs_info[1].pub_key, PublicKey("key1", KeyType::kED25519));
+}
+
 /*
  * Register Virtual Secondaries via json configuration.
  * Reject multiple Secondaries with the same serial.
@@ -6,8 +6,12 @@
 #include <boost/filesystem.hpp>
 
 #include <algorithm>
+#include <exception>
+#include <future>
 #include <unordered_map>
+#include <vector>
 
+#include "firmware_multicast.h"
 #include "ipuptanesecondary.h"
 #include "logging/logging.h"
 #include "secondary.h"
@@ -91,9 +95,7 @@ class SecondaryWaiter {
         timer_{io_context_},
         connected_secondaries_{secondaries} {}
 
-  void addSecondary(const std::string& ip, uint16_t port, VerificationType verification_type) {
-    secondaries_to_wait_for_.insert({key(ip, port), verification_type});
-  }
+  void addSecondary(const IPSecondaryConfig& cfg) { secondaries_to_wait_for_.insert({key(cfg.ip, cfg.port), cfg}); }
 
   void wait() {
     if (secondaries_to_wait_for_.empty()) {
@@ -134,14 +136,15 @@ class SecondaryWaiter {
 
       LOG_INFO << "Accepted connection from a Secondary: (" << sec_ip << ":" << sec_port << ")";
       try {
-        auto secondary = Uptane::IpUptaneSecondary::create(sec_ip, sec_port, it->second, con_socket_.native_handle());
+        auto secondary = Uptane::IpUptaneSecondary::create(sec_ip, sec_port, it->second.verification_type,
+                                                           con_socket_.native_handle(), it->second.keep_alive);
         if (secondary) {
           connected_secondaries_.push_back(secondary);
           // set ip/port in the db so that we can match everything later
           Json::Value d;
           d["ip"] = sec_ip;
           d["port"] = sec_port;
-          d["verification_type"] = Uptane::VerificationTypeToString(it->second);
+          d["verification_type"] = Uptane::VerificationTypeToString(it->second.verification_type);
           aktualizr_.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
         }
       } catch (const std::exception& exc) {
@@ -173,22 +176,38 @@ class SecondaryWaiter {
   boost::asio::deadline_timer timer_;
 
   Secondaries& connected_secondaries_;
-  std::unordered_map<std::string, VerificationType> secondaries_to_wait_for_;
+  std::unordered_map<std::string, IPSecondaryConfig> secondaries_to_wait_for_;
 };
 
+static void storeSecondaryAddress(Aktualizr& aktualizr, const Uptane::EcuSerial& serial,
+                                  const IPSecondaryConfig& cfg) {
+  // set ip/port in the db so that we can match everything later
+  Json::Value d;
+  d["ip"] = cfg.ip;
+  d["port"] = cfg.port;
+  d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
+  aktualizr.SetSecondaryData(serial, Utils::jsonToCanonicalStr(d));
+}
+
 // Four options for each Secondary:
 // 1. Secondary is configured and stored: nothing to do.
 // 2. Secondary is configured but not stored: it must be new. Try to connect to get information and store it. This will
 // cause re-registration.
-// 3. Same as 2 but cannot connect: abort.
+// 3. Same as 2 but cannot connect: wait for it to connect to us, abort if it does not.
 // 4. Secondary is stored but not configured: it must have been removed. Skip it. This will cause re-registration.
+//
+// The Secondaries are connected to concurrently, so that the ones that take
+// long to answer do not add up. A stored Secondary that does not answer is
+// added with the stored information and is connected to again on its next
+// request.
 static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktualizr& aktualizr) {
   Secondaries result;
   SecondaryWaiter sec_waiter{aktualizr, config.secondaries_wait_port, config.secondaries_timeout_s, result};
   auto secondaries_info = aktualizr.GetSecondaries();
 
+  std::vector<std::future<SecondaryInterface::Ptr>> connections;
+  std::vector<bool> stored;
   for (const auto& cfg : config.secondaries_cfg) {
-    SecondaryInterface::Ptr secondary;
     const SecondaryInfo* info = nullptr;
 
     // Try to match the configured Secondaries to stored Secondaries.
@@ -205,48 +224,75 @@ static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktual
       // storage format (before we had the secondary_ecus table) and the
       // configuration, migrate it to the new format.
       info = &secondaries_info[0];
-      Json::Value d;
-      d["ip"] = cfg.ip;
-      d["port"] = cfg.port;
-      d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
-      aktualizr.SetSecondaryData(info->serial, Utils::jsonToCanonicalStr(d));
+      storeSecondaryAddress(aktualizr, info->serial, cfg);
       LOG_INFO << "Migrated a single IP Secondary to new storage format.";
-    } else if (f == secondaries_info.cend()) {
-      // Secondary was not found in storage; it must be new.
-      secondary = Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port, cfg.verification_type);
-      if (secondary == nullptr) {
-        LOG_DEBUG << "Could not connect to IP Secondary at " << cfg.ip << ":" << cfg.port
-                  << "; now trying to wait for it.";
-        sec_waiter.addSecondary(cfg.ip, cfg.port, cfg.verification_type);
-      } else {
-        result.push_back(secondary);
-        // set ip/port in the db so that we can match everything later
-        Json::Value d;
-        d["ip"] = cfg.ip;
-        d["port"] = cfg.port;
-        d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
-        aktualizr.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
-      }
-      continue;
-    } else {
+    } else if (f != secondaries_info.cend()) {
       // The configured Secondary was found in storage.
       info = &(*f);
     }
 
-    if (secondary == nullptr) {
-      secondary = Uptane::IpUptaneSecondary::connectAndCheck(cfg.ip, cfg.port, cfg.verification_type, info->serial,
-                                                             info->hw_id, info->pub_key);
+    if (info == nullptr) {
+      // Secondary was not found in storage; it must be new.
+      connections.push_back(std::async(std::launch::async, [&cfg]() {
+        return Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port, cfg.verification_type, cfg.keep_alive);
+      }));
+    } else {
+      connections.push_back(std::async(std::launch::async, [&cfg, info]() {
+        return Uptane::IpUptaneSecondary::connectAndCheck(cfg.ip, cfg.port, cfg.verification_type, info->serial,
+                                                          info->hw_id, info->pub_key, cfg.keep_alive);
+      }));
+    }
+    stored.push_back(info != nullptr);
+  }
+
+  // Wait for all of them before reporting any error, so that none is still
+  // connecting when this returns.
+  std::vector<SecondaryInterface::Ptr> secondaries;
+  std::exception_ptr error;
+  for (auto& connection : connections) {
+    try {
+      secondaries.push_back(connection.get());
+    } catch (...) {
+      secondaries.emplace_back();
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  for (size_t i = 0; i < secondaries.size(); ++i) {
+    const auto& cfg = config.secondaries_cfg[i];
+    const auto& secondary = secondaries[i];
+    if (stored[i]) {
       if (secondary == nullptr) {
         throw std::runtime_error("Unable to connect to or verify IP Secondary at " + cfg.ip + ":" +
                                  std::to_string(cfg.port));
       }
+      result.push_back(secondary);
+    } else if (secondary == nullptr) {
+      LOG_DEBUG << "Could not connect to IP Secondary at " << cfg.ip << ":" << cfg.port
+                << "; now trying to wait for it.";
+      sec_waiter.addSecondary(cfg);
+    } else {
+      result.push_back(secondary);
+      storeSecondaryAddress(aktualizr, secondary->getSerial(), cfg);
     }
-
-    result.push_back(secondary);
   }
 
   sec_waiter.wait();
 
+  if (!config.multicast_ip.empty()) {
+    auto sender =
+        std::make_shared<FirmwareMulticast::Sender>(config.multicast_ip, config.multicast_port, config.multicast_rate);
+    for (const auto& secondary : result) {
+      auto ip_secondary = std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(secondary);
+      if (ip_secondary) {
+        ip_secondary->setMulticast(sender);
+      }
+    }
+  }
+
   return result;
 }
 
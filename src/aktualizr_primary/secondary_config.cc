@@ -37,9 +37,11 @@ config file example
   "IP": {
                 "secondaries_wait_port": 9040,
                 "secondaries_wait_timeout": 20,
+                "multicast_group": "239.255.42.1:9050",
+                "multicast_rate": 4194304,
                 "secondaries": [
                         {"addr": "127.0.0.1:9031", "verification_type": "Full"}
-                        {"addr": "127.0.0.1:9032", "verification_type": "Tuf"}
+                        {"addr": "127.0.0.1:9032", "verification_type": "Tuf", "keep_alive": true}
                 ]
   },
   "socketcan": {
@@ -96,6 +98,14 @@ void JsonConfigParser::createIPSecondariesCfg(Configs& configs, const Json::Valu
   auto resultant_cfg = std::make_shared<IPSecondariesConfig>(
       static_cast<uint16_t>(json_ip_sec_cfg[IPSecondariesConfig::PortField].asUInt()),
       json_ip_sec_cfg[IPSecondariesConfig::TimeoutField].asInt());
+  if (json_ip_sec_cfg.isMember(IPSecondariesConfig::MulticastField)) {
+    auto group = getIPAndPort(json_ip_sec_cfg[IPSecondariesConfig::MulticastField].asString());
+    resultant_cfg->multicast_ip = group.first;
+    resultant_cfg->multicast_port = group.second;
+  }
+  if (json_ip_sec_cfg.isMember(IPSecondariesConfig::MulticastRateField)) {
+    resultant_cfg->multicast_rate = json_ip_sec_cfg[IPSecondariesConfig::MulticastRateField].asUInt64();
+  }
   auto secondaries = json_ip_sec_cfg[IPSecondariesConfig::SecondariesField];
 
   LOG_INFO << "Found IP secondaries config: " << *resultant_cfg;
@@ -107,7 +117,8 @@ void JsonConfigParser::createIPSecondariesCfg(Configs& configs, const Json::Valu
     if (secondary.isMember(IPSecondaryConfig::VerificationField)) {
       vtype = Uptane::VerificationTypeFromString(secondary[IPSecondaryConfig::VerificationField].asString());
     }
-    IPSecondaryConfig sec_cfg{addr.first, addr.second, vtype};
+    const bool keep_alive = secondary.get(IPSecondaryConfig::KeepAliveField, false).asBool();
+    IPSecondaryConfig sec_cfg{addr.first, addr.second, vtype, keep_alive};
 
     LOG_INFO << "   found IP secondary config: " << sec_cfg;
     resultant_cfg->secondaries_cfg.push_back(sec_cfg);
@@ -23,18 +23,22 @@ class IPSecondaryConfig {
  public:
   static constexpr const char* const AddrField{"addr"};
   static constexpr const char* const VerificationField{"verification_type"};
+  static constexpr const char* const KeepAliveField{"keep_alive"};
 
-  IPSecondaryConfig(std::string addr_ip, uint16_t addr_port, VerificationType verification_type_in)
-      : ip(std::move(addr_ip)), port(addr_port), verification_type(verification_type_in) {}
+  IPSecondaryConfig(std::string addr_ip, uint16_t addr_port, VerificationType verification_type_in,
+                    bool keep_alive_in = false)
+      : ip(std::move(addr_ip)), port(addr_port), verification_type(verification_type_in), keep_alive(keep_alive_in) {}
 
   friend std::ostream& operator<<(std::ostream& os, const IPSecondaryConfig& cfg) {
-    os << "(addr: " << cfg.ip << ":" << cfg.port << " verification_type: " << cfg.verification_type << ")";
+    os << "(addr: " << cfg.ip << ":" << cfg.port << " verification_type: " << cfg.verification_type
+       << " keep_alive: " << cfg.keep_alive << ")";
     return os;
   }
 
   const std::string ip;
   const uint16_t port;
   const VerificationType verification_type;
+  const bool keep_alive;
 };
 
 class IPSecondariesConfig : public SecondaryConfig {
@@ -43,17 +47,28 @@ class IPSecondariesConfig : public SecondaryConfig {
   static constexpr const char* const PortField{"secondaries_wait_port"};
   static constexpr const char* const TimeoutField{"secondaries_wait_timeout"};
   static constexpr const char* const SecondariesField{"secondaries"};
+  static constexpr const char* const MulticastField{"multicast_group"};
+  static constexpr const char* const MulticastRateField{"multicast_rate"};
 
   IPSecondariesConfig(const uint16_t wait_port, const int timeout_s)
       : SecondaryConfig(Type), secondaries_wait_port{wait_port}, secondaries_timeout_s{timeout_s} {}
 
   friend std::ostream& operator<<(std::ostream& os, const IPSecondariesConfig& cfg) {
-    os << "(wait_port: " << cfg.secondaries_wait_port << " timeout_s: " << cfg.secondaries_timeout_s << ")";
+    os << "(wait_port: " << cfg.secondaries_wait_port << " timeout_s: " << cfg.secondaries_timeout_s;
+    if (!cfg.multicast_ip.empty()) {
+      os << " multicast_group: " << cfg.multicast_ip << ":" << cfg.multicast_port
+         << " multicast_rate: " << cfg.multicast_rate;
+    }
+    os << ")";
     return os;
   }
 
   const uint16_t secondaries_wait_port;
   const int secondaries_timeout_s;
+  // Firmware is multicast to this group if set, at up to multicast_rate bytes per second
+  std::string multicast_ip;
+  uint16_t multicast_port{0};
+  uint64_t multicast_rate{4U * 1024U * 1024U};
   std::vector<IPSecondaryConfig> secondaries_cfg;
 };
 
@@ -1,6 +1,7 @@
 #include "aktualizr_secondary.h"
 
 #include <sys/types.h>
+#include <algorithm>
 #include <memory>
 
 #include <boost/lexical_cast.hpp>
@@ -26,14 +27,34 @@ AktualizrSecondary::AktualizrSecondary(AktualizrSecondaryConfig config, std::sha
 PublicKey AktualizrSecondary::publicKey() const { return keys_->UptanePublicKey(); }
 
 Uptane::Manifest AktualizrSecondary::getManifest() const {
-  Uptane::InstalledImageInfo installed_image_info;
-  Uptane::Manifest manifest;
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  updateManifest();
+  return manifest_;
+}
 
-  if (getInstalledImageInfo(installed_image_info)) {
-    manifest = manifest_issuer_->assembleAndSignManifest(installed_image_info);
+void AktualizrSecondary::invalidateManifest() {
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  manifest_valid_ = false;
+}
+
+// Called with manifest_mutex_ held
+void AktualizrSecondary::updateManifest() const {
+  Json::Value key = installedImageKey();
+  if (manifest_valid_ && key == manifest_key_) {
+    return;
   }
 
-  return manifest;
+  Uptane::InstalledImageInfo installed_image_info;
+  if (getInstalledImageInfo(installed_image_info)) {
+    manifest_ = manifest_issuer_->assembleAndSignManifest(installed_image_info);
+    manifest_key_ = std::move(key);
+    manifest_valid_ = true;
+  } else {
+    // Not kept, so that it is tried again on the next request
+    manifest_ = Uptane::Manifest();
+    manifest_valid_ = false;
+  }
+  manifest_json_ = Utils::jsonToStr(manifest_);
 }
 
 data::InstallationResult AktualizrSecondary::putMetadata(const Uptane::SecondaryMetadata& metadata) {
@@ -49,6 +70,7 @@ data::InstallationResult AktualizrSecondary::install() {
 
   auto target_name = pending_target_.filename();
   auto result = installPendingTarget(pending_target_);
+  invalidateManifest();
 
   switch (result.result_code.num_code) {
     case data::ResultCode::Numeric::kOk: {
@@ -128,7 +150,22 @@ data::InstallationResult AktualizrSecondary::findTargets() {
   std::vector<Uptane::Target> targetsForThisEcu;
   if (config_.uptane.verification_type == VerificationType::kFull) {
     // 10. Verify that Targets metadata from the Director and Image repositories match.
-    if (!director_repo_.matchTargetsWithImageTargets(image_repo_.getTargets())) {
+    // Delegations are only searched where their metadata is in storage and matches the Image repo Snapshot
+    auto load_delegation = [this](const Uptane::Role& role,
+                                  const Uptane::Targets& parent) -> std::shared_ptr<const Uptane::Targets> {
+      std::string delegation_raw;
+      if (!storage_->loadDelegation(&delegation_raw, role)) {
+        return nullptr;
+      }
+      try {
+        image_repo_.verifyRoleHashes(delegation_raw, role, false);
+        return Uptane::ImageRepository::verifyDelegation(delegation_raw, role, parent);
+      } catch (const std::exception& e) {
+        LOG_WARNING << "Stored " << role << " metadata could not be verified: " << e.what();
+        return nullptr;
+      }
+    };
+    if (!director_repo_.matchTargetsWithImageTargets(image_repo_.getTargets(), load_delegation)) {
       LOG_ERROR << "Targets metadata from the Director and Image repositories do not match";
       return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
                                       "Targets metadata from the Director and Image repositories do not match");
@@ -242,20 +279,27 @@ void AktualizrSecondary::uptaneInitialize() {
 
 void AktualizrSecondary::registerHandlers() {
   registerHandler(AKIpUptaneMes_PR_getInfoReq,
-                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_versionReq,
-                  std::bind(&AktualizrSecondary::versionHdlr, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::versionHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_manifestReq,
-                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_rootVerReq,
-                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_putRootReq,
                   std::bind(&AktualizrSecondary::putRootHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
+  registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                  std::bind(&AktualizrSecondary::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+
   registerHandler(AKIpUptaneMes_PR_putMetaReq2,
                   std::bind(&AktualizrSecondary::putMetaHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
@@ -278,7 +322,7 @@ MsgHandler::ReturnCode AktualizrSecondary::getInfoHdlr(Asn1Message& in_msg, Asn1
   return ReturnCode::kOk;
 }
 
-MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const {
   const uint32_t version = 2;
   auto version_req = in_msg.versionReq();
   const auto primary_version = static_cast<uint32_t>(version_req->version);
@@ -292,6 +336,49 @@ MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1
 
   auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
   m->version = version;
+  // Only answer with upload parameters if the Primary offered them.
+  if (version_req->uploadChunkSize != nullptr && *version_req->uploadChunkSize > 0) {
+    m->uploadChunkSize = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *m->uploadChunkSize = static_cast<long>(  // NOLINT(google-runtime-int)
+        std::min<uint64_t>(static_cast<uint64_t>(*version_req->uploadChunkSize), config_.network.max_upload_chunk_size));
+  }
+  if (version_req->uploadWindow != nullptr && *version_req->uploadWindow > 0) {
+    m->uploadWindow = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *m->uploadWindow = static_cast<long>(  // NOLINT(google-runtime-int)
+        std::min<uint64_t>(static_cast<uint64_t>(*version_req->uploadWindow), config_.network.max_upload_window));
+  }
+  // SecondaryTcpServer serves several connections at once, so a connection
+  // the Primary keeps open does not block any others.
+  if (version_req->keepAlive != nullptr && *version_req->keepAlive != 0) {
+    m->keepAlive = Asn1Allocation<BOOLEAN_t>();
+    *m->keepAlive = 1;
+  }
+  m->rootChain = Asn1Allocation<BOOLEAN_t>();
+  *m->rootChain = 1;
+  if (supportsUploadResume()) {
+    m->uploadResume = Asn1Allocation<BOOLEAN_t>();
+    *m->uploadResume = 1;
+  }
+  if (config_.network.upload_compression && supportsUploadCompression() &&
+      version_req->uploadCompression != nullptr && *version_req->uploadCompression == AKCompression_deflate) {
+    m->uploadCompression = Asn1Allocation<AKCompression_t>();
+    *m->uploadCompression = AKCompression_deflate;
+  }
+  if (config_.network.upload_delta && supportsUploadDelta() && version_req->uploadDelta != nullptr &&
+      *version_req->uploadDelta != 0) {
+    m->uploadDelta = Asn1Allocation<BOOLEAN_t>();
+    *m->uploadDelta = 1;
+  }
+  if (config_.network.upload_multicast && supportsUploadMulticast() && version_req->uploadMulticast != nullptr &&
+      *version_req->uploadMulticast != 0) {
+    m->uploadMulticast = Asn1Allocation<BOOLEAN_t>();
+    *m->uploadMulticast = 1;
+  }
+  if (config_.network.ostree_background_pull && supportsBackgroundPull() &&
+      version_req->ostreeBackgroundPull != nullptr && *version_req->ostreeBackgroundPull != 0) {
+    m->ostreeBackgroundPull = Asn1Allocation<BOOLEAN_t>();
+    *m->ostreeBackgroundPull = 1;
+  }
 
   return ReturnCode::kOk;
 }
@@ -307,10 +394,12 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getManifestHdlr(Asn1Message&
   out_msg.present(AKIpUptaneMes_PR_manifestResp);
   auto manifest_resp = out_msg.manifestResp();
   manifest_resp->manifest.present = manifest_PR_json;
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  updateManifest();
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  SetString(&manifest_resp->manifest.choice.json, Utils::jsonToStr(getManifest()));
+  SetString(&manifest_resp->manifest.choice.json, manifest_json_);
 
-  LOG_TRACE << "Manifest: \n" << getManifest();
+  LOG_TRACE << "Manifest: \n" << manifest_json_;
   return ReturnCode::kOk;
 }
 
@@ -344,58 +433,87 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getRootVerHdlr(Asn1Message& i
 AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
   LOG_INFO << "Received a put Root request message; verifying contents...";
   auto pr = in_msg.putRootReq();
-  Uptane::RepositoryType repo_type{};
-  if (pr->repotype == AKRepoType_director) {
-    repo_type = Uptane::RepositoryType::Director();
-  } else if (pr->repotype == AKRepoType_image) {
-    repo_type = Uptane::RepositoryType::Image();
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (pr->repotype == AKRepoType_director || pr->repotype == AKRepoType_image) {
+    const Uptane::RepositoryType repo_type =
+        pr->repotype == AKRepoType_director ? Uptane::RepositoryType::Director() : Uptane::RepositoryType::Image();
+    result = putRoot(repo_type, ToString(pr->json));
   } else {
-    repo_type = Uptane::RepositoryType(-1);
+    LOG_WARNING << "Received Root version request with invalid repo type: " << pr->repotype;
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kInternalError,
+        "Received Root version request with invalid repo type: " + std::to_string(pr->repotype));
   }
 
-  const std::string json = ToString(pr->json);
-  LOG_DEBUG << "Received " << repo_type << " repo Root metadata:\n" << json;
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+/* Each Root in the chain is verified against the one stored before it, exactly
+ * as if it had been sent on its own, and the chain stops at the first failure. */
+AktualizrSecondary::ReturnCode AktualizrSecondary::putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto pr = in_msg.putRootChainReq();
+  const int count = pr->roots.list.count;
+  LOG_INFO << "Received a put Root chain request message with " << count << " Roots; verifying contents...";
   data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  int applied = 0;
+  if (pr->repotype == AKRepoType_director || pr->repotype == AKRepoType_image) {
+    const Uptane::RepositoryType repo_type =
+        pr->repotype == AKRepoType_director ? Uptane::RepositoryType::Director() : Uptane::RepositoryType::Image();
+    for (; applied < count; ++applied) {
+      result = putRoot(repo_type, ToString(*pr->roots.list.array[applied]));
+      if (!result.isSuccess()) {
+        break;
+      }
+    }
+  } else {
+    LOG_WARNING << "Received Root chain request with invalid repo type: " << pr->repotype;
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kInternalError,
+        "Received Root chain request with invalid repo type: " + std::to_string(pr->repotype));
+  }
 
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+  m->applied = applied;
+
+  return ReturnCode::kOk;
+}
+
+data::InstallationResult AktualizrSecondary::putRoot(const Uptane::RepositoryType repo_type, const std::string& json) {
+  LOG_DEBUG << "Received " << repo_type << " repo Root metadata:\n" << json;
   if (repo_type == Uptane::RepositoryType::Director()) {
     if (config_.uptane.verification_type == VerificationType::kTuf) {
       LOG_WARNING << "Ignoring new Director Root metadata as it is unnecessary for TUF verification.";
-      result =
-          data::InstallationResult(data::ResultCode::Numeric::kInternalError,
-                                   "Ignoring new Director Root metadata as it is unnecessary for TUF verification.");
-    } else {
-      try {
-        director_repo_.verifyRoot(json);
-        storage_->storeRoot(json, repo_type, Uptane::Version(director_repo_.rootVersion()));
-        storage_->clearNonRootMeta(repo_type);
-      } catch (const std::exception& e) {
-        LOG_ERROR << "Failed to update Director Root metadata: " << e.what();
-        result = data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
-                                          std::string("Failed to update Director Root metadata: ") + e.what());
-      }
+      return data::InstallationResult(
+          data::ResultCode::Numeric::kInternalError,
+          "Ignoring new Director Root metadata as it is unnecessary for TUF verification.");
     }
-  } else if (repo_type == Uptane::RepositoryType::Image()) {
+    try {
+      director_repo_.verifyRoot(json);
+      storage_->storeRoot(json, repo_type, Uptane::Version(director_repo_.rootVersion()));
+      storage_->clearNonRootMeta(repo_type);
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Failed to update Director Root metadata: " << e.what();
+      return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
+                                      std::string("Failed to update Director Root metadata: ") + e.what());
+    }
+  } else {
     try {
       image_repo_.verifyRoot(json);
       storage_->storeRoot(json, repo_type, Uptane::Version(image_repo_.rootVersion()));
       storage_->clearNonRootMeta(repo_type);
     } catch (const std::exception& e) {
       LOG_ERROR << "Failed to update Image repo Root metadata: " << e.what();
-      result = data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
-                                        std::string("Failed to update Image repo Root metadata: ") + e.what());
+      return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
+                                      std::string("Failed to update Image repo Root metadata: ") + e.what());
     }
-  } else {
-    LOG_WARNING << "Received Root version request with invalid repo type: " << pr->repotype;
-    result = data::InstallationResult(
-        data::ResultCode::Numeric::kInternalError,
-        "Received Root version request with invalid repo type: " + std::to_string(pr->repotype));
   }
-
-  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
-  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
-  SetString(&m->description, result.description);
-
-  return ReturnCode::kOk;
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
 void AktualizrSecondary::copyMetadata(Uptane::MetaBundle& meta_bundle, const Uptane::RepositoryType repo,
@@ -1,6 +1,9 @@
 #ifndef AKTUALIZR_SECONDARY_H
 #define AKTUALIZR_SECONDARY_H
 
+#include <mutex>
+#include <string>
+
 #include "aktualizr_secondary_config.h"
 #include "msg_handler.h"
 #include "uptane/directorrepository.h"
@@ -39,6 +42,20 @@ class AktualizrSecondary : public MsgDispatcher {
   virtual bool isTargetSupported(const Uptane::Target& target) const = 0;
   virtual data::InstallationResult installPendingTarget(const Uptane::Target& target) = 0;
   virtual data::InstallationResult applyPendingInstall(const Uptane::Target& target) = 0;
+  // Whether an interrupted firmware upload can continue where it stopped
+  virtual bool supportsUploadResume() const { return false; }
+  // Whether firmware uploads can be received in compressed chunks
+  virtual bool supportsUploadCompression() const { return false; }
+  // Whether firmware uploads can copy parts of the installed image
+  virtual bool supportsUploadDelta() const { return false; }
+  // Whether firmware uploads can be received from a multicast group
+  virtual bool supportsUploadMulticast() const { return false; }
+  // Whether OSTree commits can be pulled in the background
+  virtual bool supportsBackgroundPull() const { return false; }
+  // Identifies the installed image without reading it, e.g. by its file
+  // metadata, so that the manifest is signed again if it is changed outside of
+  // an installation. Null if it only changes through the installation.
+  virtual Json::Value installedImageKey() const { return Json::nullValue; }
 
   // protected interface to be used by child classes
   std::shared_ptr<INvStorage>& storage() { return storage_; }
@@ -46,21 +63,26 @@ class AktualizrSecondary : public MsgDispatcher {
   std::shared_ptr<KeyManager>& keyMngr() { return keys_; }
 
   void initPendingTargetIfAny();
+  // To be called when the installed or pending image has changed
+  void invalidateManifest();
 
  private:
   static void copyMetadata(Uptane::MetaBundle& meta_bundle, Uptane::RepositoryType repo, const Uptane::Role& role,
                            std::string& json);
   data::InstallationResult verifyMetadata(const Uptane::SecondaryMetadata& metadata);
   data::InstallationResult findTargets();
+  data::InstallationResult putRoot(Uptane::RepositoryType repo_type, const std::string& json);
   void uptaneInitialize();
   void registerHandlers();
+  void updateManifest() const;
 
   // Message handlers
   ReturnCode getInfoHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
-  static ReturnCode versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode getManifestHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode getRootVerHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
   ReturnCode putMetaHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
   ReturnCode installHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
 
@@ -72,6 +94,13 @@ class AktualizrSecondary : public MsgDispatcher {
   std::shared_ptr<KeyManager> keys_;
 
   Uptane::ManifestIssuer::Ptr manifest_issuer_;
+  // The signed manifest, as sent to the Primary, until the installed image
+  // changes. Signing it is expensive and the Primary asks for it on each poll.
+  mutable std::mutex manifest_mutex_;
+  mutable bool manifest_valid_{false};
+  mutable Json::Value manifest_key_;
+  mutable Uptane::Manifest manifest_;
+  mutable std::string manifest_json_;
 
   Uptane::DirectorRepository director_repo_;
   Uptane::ImageRepository image_repo_;
@@ -17,12 +17,24 @@ void AktualizrSecondaryNetConfig::updateFromPropertyTree(const boost::property_t
   CopyFromConfig(port, "port", pt);
   CopyFromConfig(primary_ip, "primary_ip", pt);
   CopyFromConfig(primary_port, "primary_port", pt);
+  CopyFromConfig(max_upload_chunk_size, "max_upload_chunk_size", pt);
+  CopyFromConfig(max_upload_window, "max_upload_window", pt);
+  CopyFromConfig(upload_compression, "upload_compression", pt);
+  CopyFromConfig(upload_delta, "upload_delta", pt);
+  CopyFromConfig(upload_multicast, "upload_multicast", pt);
+  CopyFromConfig(ostree_background_pull, "ostree_background_pull", pt);
 }
 
 void AktualizrSecondaryNetConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, port, "port");
   writeOption(out_stream, primary_ip, "primary_ip");
   writeOption(out_stream, primary_port, "primary_port");
+  writeOption(out_stream, max_upload_chunk_size, "max_upload_chunk_size");
+  writeOption(out_stream, max_upload_window, "max_upload_window");
+  writeOption(out_stream, upload_compression, "upload_compression");
+  writeOption(out_stream, upload_delta, "upload_delta");
+  writeOption(out_stream, upload_multicast, "upload_multicast");
+  writeOption(out_stream, ostree_background_pull, "ostree_background_pull");
 }
 
 void AktualizrSecondaryUptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
@@ -74,7 +86,7 @@ KeyManagerConfig AktualizrSecondaryConfig::keymanagerConfig() const {
 }
 
 void AktualizrSecondaryConfig::postUpdateValues() {
-  logger_set_threshold(logger);
+  logger_configure(logger);
   LOG_TRACE << "Final configuration that will be used: \n" << (*this);
 }
 
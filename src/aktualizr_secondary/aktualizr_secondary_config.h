@@ -19,6 +19,17 @@ struct AktualizrSecondaryNetConfig {
   in_port_t port{9030};
   std::string primary_ip;
   in_port_t primary_port{9030};
+  // Upper bounds for the firmware upload parameters the Primary offers.
+  uint64_t max_upload_chunk_size{64U * 1024U};
+  uint64_t max_upload_window{8U};
+  // Accept firmware chunks compressed by the Primary
+  bool upload_compression{true};
+  // Accept firmware uploads that copy unchanged parts of the installed image
+  bool upload_delta{true};
+  // Accept firmware uploads multicast to several Secondaries at once
+  bool upload_multicast{true};
+  // Pull OSTree commits in the background and report progress to the Primary on request
+  bool ostree_background_pull{true};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -1,7 +1,9 @@
 #include "aktualizr_secondary_file.h"
 
+#include "firmware_multicast.h"
 #include "storage/invstorage.h"
 #include "update_agent_file.h"
+#include "upload_compression.h"
 
 const std::string AktualizrSecondaryFile::FileUpdateDefaultFile{"firmware.txt"};
 
@@ -11,9 +13,17 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
 AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& config,
                                                std::shared_ptr<INvStorage> storage,
                                                std::shared_ptr<FileUpdateAgent> update_agent)
-    : AktualizrSecondary(config, std::move(storage)), update_agent_{std::move(update_agent)} {
+    : AktualizrSecondary(config, std::move(storage)),
+      update_agent_{std::move(update_agent)},
+      max_upload_chunk_size_{config.network.max_upload_chunk_size} {
   registerHandler(AKIpUptaneMes_PR_uploadDataReq, std::bind(&AktualizrSecondaryFile::uploadDataHdlr, this,
                                                             std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_uploadOffsetReq, std::bind(&AktualizrSecondaryFile::uploadOffsetHdlr, this,
+                                                              std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_multicastJoinReq, std::bind(&AktualizrSecondaryFile::multicastJoinHdlr, this,
+                                                               std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_multicastStatusReq, std::bind(&AktualizrSecondaryFile::multicastStatusHdlr, this,
+                                                                 std::placeholders::_1, std::placeholders::_2));
   if (!update_agent_) {
     std::string current_target_name;
 
@@ -32,6 +42,8 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
   }
 }
 
+AktualizrSecondaryFile::~AktualizrSecondaryFile() = default;
+
 void AktualizrSecondaryFile::initialize() { initPendingTargetIfAny(); }
 
 data::InstallationResult AktualizrSecondaryFile::receiveData(const uint8_t* data, size_t size) {
@@ -44,6 +56,8 @@ data::InstallationResult AktualizrSecondaryFile::receiveData(const uint8_t* data
   return update_agent_->receiveData(getPendingTarget(), data, size);
 }
 
+Json::Value AktualizrSecondaryFile::installedImageKey() const { return update_agent_->installedImageKey(); }
+
 bool AktualizrSecondaryFile::isTargetSupported(const Uptane::Target& target) const {
   return update_agent_->isTargetSupported(target);
 }
@@ -57,16 +71,45 @@ bool AktualizrSecondaryFile::getInstalledImageInfo(Uptane::InstalledImageInfo& i
 }
 
 data::InstallationResult AktualizrSecondaryFile::installPendingTarget(const Uptane::Target& target) {
+  multicast_.reset();
   return update_agent_->install(target);
 }
 
 void AktualizrSecondaryFile::completeInstall() { return update_agent_->completeInstall(); }
 
+data::InstallationResult AktualizrSecondaryFile::receiveCopy(const AKUploadDataReqMes_t& req) {
+  if (!getPendingTarget().IsValid()) {
+    LOG_ERROR << "Aborting image download; no valid target found.";
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                    "Aborting image download; no valid target found.");
+  }
+  if (req.copyOffset == nullptr || req.copyBase == nullptr || *req.copyOffset < 0 || *req.copyLength < 0) {
+    LOG_ERROR << "Invalid copy from the installed image";
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Invalid copy from the installed image");
+  }
+  return update_agent_->receiveCopy(getPendingTarget(), ToString(*req.copyBase),
+                                    static_cast<uint64_t>(*req.copyOffset), static_cast<uint64_t>(*req.copyLength));
+}
+
 MsgHandler::ReturnCode AktualizrSecondaryFile::uploadDataHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
-  if (last_msg_ != AKIpUptaneMes_PR_uploadDataReq) {
+  auto* offset = in_msg.uploadDataReq()->offset;
+  auto* block = in_msg.uploadDataReq()->block;
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (block != nullptr) {
+    LOG_DEBUG_LIMITED << "Received a lost block of a multicast upload";
+  } else if (last_msg_ != AKIpUptaneMes_PR_uploadDataReq || offset != nullptr) {
+    // The Primary has given up on the multicast upload, if there was one
+    multicast_.reset();
     LOG_INFO << "Received an initial data upload request message; attempting to receive data...";
+    if (offset != nullptr && *offset < 0) {
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Invalid upload offset: " + std::to_string(*offset));
+    } else if (getPendingTarget().IsValid()) {
+      result = update_agent_->beginUpload(getPendingTarget(), offset != nullptr ? static_cast<uint64_t>(*offset) : 0);
+    }
   } else {
-    LOG_DEBUG << "Received another data upload request message; attempting to receive data...";
+    LOG_DEBUG_LIMITED << "Received another data upload request message; attempting to receive data...";
   }
 
   auto rec_buf_size = in_msg.uploadDataReq()->data.size;
@@ -75,7 +118,34 @@ MsgHandler::ReturnCode AktualizrSecondaryFile::uploadDataHdlr(Asn1Message& in_ms
     return ReturnCode::kOk;
   }
 
-  auto result = receiveData(in_msg.uploadDataReq()->data.buf, static_cast<size_t>(rec_buf_size));
+  auto* compression = in_msg.uploadDataReq()->compression;
+  auto* copy_length = in_msg.uploadDataReq()->copyLength;
+  if (result.isSuccess() && block != nullptr) {
+    if (*block < 0 || (compression != nullptr && *compression != AKCompression_none)) {
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid multicast block");
+    } else {
+      std::lock_guard<std::mutex> guard(multicast_mutex_);
+      result = update_agent_->receiveBlock(getPendingTarget(), static_cast<uint64_t>(*block),
+                                           in_msg.uploadDataReq()->data.buf, static_cast<size_t>(rec_buf_size));
+    }
+  } else if (result.isSuccess() && copy_length != nullptr) {
+    result = receiveCopy(*in_msg.uploadDataReq());
+  } else if (result.isSuccess()) {
+    if (compression == nullptr || *compression == AKCompression_none) {
+      result = receiveData(in_msg.uploadDataReq()->data.buf, static_cast<size_t>(rec_buf_size));
+    } else if (*compression != AKCompression_deflate) {
+      LOG_ERROR << "Unsupported firmware data compression: " << *compression;
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Unsupported firmware data compression: " + std::to_string(*compression));
+    } else if (UploadCompression::inflateChunk(in_msg.uploadDataReq()->data.buf, static_cast<size_t>(rec_buf_size),
+                                               static_cast<size_t>(max_upload_chunk_size_), &inflate_buffer_)) {
+      result = receiveData(inflate_buffer_.data(), inflate_buffer_.size());
+    } else {
+      LOG_ERROR << "Failed to decompress a firmware data chunk";
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Failed to decompress a firmware data chunk");
+    }
+  }
 
   auto m = out_msg.present(AKIpUptaneMes_PR_uploadDataResp).uploadDataResp();
   m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -83,3 +153,73 @@ MsgHandler::ReturnCode AktualizrSecondaryFile::uploadDataHdlr(Asn1Message& in_ms
 
   return ReturnCode::kOk;
 }
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadOffsetHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  (void)in_msg;
+  uint64_t offset = 0;
+  if (getPendingTarget().IsValid()) {
+    offset = update_agent_->uploadOffset(getPendingTarget());
+  }
+  LOG_INFO << "Received an upload offset request message; " << offset << " bytes of the target image are stored.";
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadOffsetResp).uploadOffsetResp();
+  m->offset = static_cast<long>(offset);  // NOLINT(google-runtime-int)
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::multicastJoinHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.multicastJoinReq();
+  const std::string group = ToString(req->group);
+  LOG_INFO << "Received a request to receive the target image from multicast group " << group << ":" << req->port;
+  multicast_.reset();
+
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (!getPendingTarget().IsValid()) {
+    result = data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                      "Aborting image download; no valid target found.");
+  } else if (req->port <= 0 || req->port > 65535 || req->blockSize <= 0 ||
+             static_cast<uint64_t>(req->blockSize) > max_upload_chunk_size_ || req->session < 0 ||
+             static_cast<uint64_t>(req->session) > UINT32_MAX) {
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid multicast parameters");
+  } else {
+    std::lock_guard<std::mutex> guard(multicast_mutex_);
+    result = update_agent_->beginBlockUpload(getPendingTarget(), static_cast<uint32_t>(req->blockSize));
+  }
+  if (result.isSuccess()) {
+    const Uptane::Target target = getPendingTarget();
+    try {
+      multicast_ = std_::make_unique<FirmwareMulticast::Receiver>(
+          group, static_cast<uint16_t>(req->port), static_cast<uint32_t>(req->session),
+          [this, target](uint64_t block, const uint8_t* data, size_t size) {
+            std::lock_guard<std::mutex> guard(multicast_mutex_);
+            update_agent_->receiveBlock(target, block, data, size);
+          });
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Failed to join the multicast group: " << e.what();
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+    }
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_multicastJoinResp).multicastJoinResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::multicastStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  if (in_msg.multicastStatusReq()->leave != 0) {
+    multicast_.reset();
+  }
+  std::string missing;
+  if (getPendingTarget().IsValid()) {
+    std::lock_guard<std::mutex> guard(multicast_mutex_);
+    missing = update_agent_->missingBlocks(getPendingTarget());
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_multicastStatusResp).multicastStatusResp();
+  SetString(&m->missing, missing);
+
+  return ReturnCode::kOk;
+}
@@ -2,10 +2,15 @@
 #define AKTUALIZR_SECONDARY_FILE_H
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "aktualizr_secondary.h"
 
 class FileUpdateAgent;
+namespace FirmwareMulticast {
+class Receiver;
+}
 
 class AktualizrSecondaryFile : public AktualizrSecondary {
  public:
@@ -14,9 +19,15 @@ class AktualizrSecondaryFile : public AktualizrSecondary {
   explicit AktualizrSecondaryFile(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryFile(const AktualizrSecondaryConfig& config, std::shared_ptr<INvStorage> storage,
                          std::shared_ptr<FileUpdateAgent> update_agent = nullptr);
+  ~AktualizrSecondaryFile() override;
+  AktualizrSecondaryFile(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile(AktualizrSecondaryFile&&) = delete;
+  AktualizrSecondaryFile& operator=(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile& operator=(AktualizrSecondaryFile&&) = delete;
 
   void initialize() override;
   data::InstallationResult receiveData(const uint8_t* data, size_t size);
+  data::InstallationResult receiveCopy(const AKUploadDataReqMes_t& req);
 
  protected:
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
@@ -25,10 +36,26 @@ class AktualizrSecondaryFile : public AktualizrSecondary {
   data::InstallationResult applyPendingInstall(const Uptane::Target& target) override;
   void completeInstall() override;
 
+  bool supportsUploadResume() const override { return true; }
+  bool supportsUploadCompression() const override { return true; }
+  bool supportsUploadDelta() const override { return true; }
+  bool supportsUploadMulticast() const override { return true; }
+  Json::Value installedImageKey() const override;
+
   ReturnCode uploadDataHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadOffsetHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode multicastJoinHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode multicastStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
 
  private:
   std::shared_ptr<FileUpdateAgent> update_agent_;
+  // Largest chunk the Primary may send, which also bounds decompressed chunks
+  const uint64_t max_upload_chunk_size_;
+  std::vector<uint8_t> inflate_buffer_;
+  // Receives multicast blocks on a thread of its own, so storing blocks is
+  // serialized by multicast_mutex_.
+  std::unique_ptr<FirmwareMulticast::Receiver> multicast_;
+  std::mutex multicast_mutex_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_FILE_H
@@ -10,6 +10,8 @@ AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfi
     : AktualizrSecondary(config, storage) {
   registerHandler(AKIpUptaneMes_PR_downloadOstreeRevReq, std::bind(&AktualizrSecondaryOstree::downloadOstreeRev, this,
                                                                    std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_ostreePullStatusReq, std::bind(&AktualizrSecondaryOstree::pullStatus, this,
+                                                                  std::placeholders::_1, std::placeholders::_2));
 
   std::shared_ptr<OstreeManager> pack_man =
       std::make_shared<OstreeManager>(config.pacman, config.bootloader, AktualizrSecondary::storage(), nullptr);
@@ -17,6 +19,8 @@ AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfi
       std::make_shared<OstreeUpdateAgent>(config.pacman.sysroot, keyMngr(), pack_man, config.uptane.ecu_hardware_id);
 }
 
+AktualizrSecondaryOstree::~AktualizrSecondaryOstree() { stopPull(); }
+
 void AktualizrSecondaryOstree::initialize() {
   initPendingTargetIfAny();
 
@@ -50,6 +54,7 @@ void AktualizrSecondaryOstree::initialize() {
         }
 
         directorRepo().dropTargets(*AktualizrSecondary::storage());
+        invalidateManifest();
       } else {
         LOG_INFO << "Pending update hasn't been applied because a reboot hasn't been detected";
       }
@@ -58,8 +63,15 @@ void AktualizrSecondaryOstree::initialize() {
 }
 
 MsgHandler::ReturnCode AktualizrSecondaryOstree::downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg) {
-  LOG_INFO << "Received an OSTree download request; attempting download...";
-  auto result = downloadOstreeUpdate(ToString(in_msg.downloadOstreeRevReq()->tlsCred));
+  auto req = in_msg.downloadOstreeRevReq();
+  data::InstallationResult result;
+  if (req->background == nullptr || *req->background == 0) {
+    LOG_INFO << "Received an OSTree download request; attempting download...";
+    result = downloadOstreeUpdate(ToString(req->tlsCred));
+  } else {
+    LOG_INFO << "Received an OSTree download request; starting the download in the background...";
+    result = startPull(ToString(req->tlsCred));
+  }
 
   auto m = out_msg.present(AKIpUptaneMes_PR_downloadOstreeRevResp).downloadOstreeRevResp();
   m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -68,7 +80,102 @@ MsgHandler::ReturnCode AktualizrSecondaryOstree::downloadOstreeRev(Asn1Message&
   return ReturnCode::kOk;
 }
 
+MsgHandler::ReturnCode AktualizrSecondaryOstree::pullStatus(Asn1Message& in_msg, Asn1Message& out_msg) {
+  const auto abort = in_msg.ostreePullStatusReq()->abort;
+  if (abort != nullptr && *abort != 0) {
+    LOG_INFO << "Received a request to stop the OSTree download.";
+    stopPull();
+  }
+  std::lock_guard<std::mutex> guard(pull_mutex_);
+  auto m = out_msg.present(AKIpUptaneMes_PR_ostreePullStatusResp).ostreePullStatusResp();
+  m->progress = pull_status_.progress;
+  if (pull_status_.running) {
+    m->done = 0;
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+  } else if (!pull_status_.done) {
+    m->done = 1;
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kGeneralError);
+    SetString(&m->description, "No OSTree download has been started");
+  } else {
+    m->done = 1;
+    m->result = static_cast<AKInstallationResultCode_t>(pull_status_.result.result_code.num_code);
+    SetString(&m->description, pull_status_.result.description);
+  }
+
+  return ReturnCode::kOk;
+}
+
+data::InstallationResult AktualizrSecondaryOstree::startPull(const std::string& packed_tls_creds) {
+  std::lock_guard<std::mutex> guard(pull_mutex_);
+  if (pull_status_.running) {
+    // The Primary asked again, e.g. after losing the connection
+    LOG_INFO << "The OSTree download is already in progress.";
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  const Uptane::Target target = getPendingTarget();
+  if (!target.IsValid()) {
+    LOG_ERROR << "Aborting image download; no valid target found.";
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                    "Aborting image download; no valid target found.");
+  }
+
+  // A thread that is not running anymore has nothing left to do but to return
+  if (pull_thread_.joinable()) {
+    pull_thread_.join();
+  }
+  pull_token_.reset();
+  pull_status_ = PullStatus();
+  pull_status_.running = true;
+  pull_thread_ = std::thread([this, target, packed_tls_creds]() {
+    auto result = update_agent_->downloadTargetRev(
+        target, packed_tls_creds, &pull_token_,
+        [this](const Uptane::Target& /* target */, const std::string& /* description */, unsigned int progress) {
+          std::lock_guard<std::mutex> progress_guard(pull_mutex_);
+          pull_status_.progress = progress;
+        });
+    std::lock_guard<std::mutex> done_guard(pull_mutex_);
+    pull_status_.running = false;
+    pull_status_.done = true;
+    pull_status_.result = result;
+  });
+
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+bool AktualizrSecondaryOstree::pullRunning() {
+  std::lock_guard<std::mutex> guard(pull_mutex_);
+  return pull_status_.running;
+}
+
+void AktualizrSecondaryOstree::stopPull() {
+  pull_token_.setAbort();
+  if (pull_thread_.joinable()) {
+    pull_thread_.join();
+  }
+}
+
+data::InstallationResult AktualizrSecondaryOstree::putMetadata(const Uptane::MetaBundle& meta_bundle) {
+  if (pullRunning()) {
+    LOG_ERROR << "Rejecting new metadata while an OSTree download is in progress.";
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError, "An OSTree download is in progress");
+  }
+  return AktualizrSecondary::putMetadata(meta_bundle);
+}
+
+data::InstallationResult AktualizrSecondaryOstree::install() {
+  if (pullRunning()) {
+    LOG_ERROR << "Cannot install while the OSTree download is in progress.";
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                    "The OSTree download is still in progress");
+  }
+  return AktualizrSecondary::install();
+}
+
 data::InstallationResult AktualizrSecondaryOstree::downloadOstreeUpdate(const std::string& packed_tls_creds) {
+  if (pullRunning()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError, "An OSTree download is in progress");
+  }
   if (!getPendingTarget().IsValid()) {
     LOG_ERROR << "Aborting image download; no valid target found.";
     return data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
@@ -1,8 +1,12 @@
 #ifndef AKTUALIZR_SECONDARY_OSTREE_H
 #define AKTUALIZR_SECONDARY_OSTREE_H
 
+#include <mutex>
+#include <thread>
+
 #include "aktualizr_secondary.h"
 #include "storage/invstorage.h"
+#include "utilities/flow_control.h"
 
 class OstreeUpdateAgent;
 
@@ -10,23 +14,50 @@ class AktualizrSecondaryOstree : public AktualizrSecondary {
  public:
   explicit AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config, const std::shared_ptr<INvStorage>& storage);
+  ~AktualizrSecondaryOstree() override;
+  AktualizrSecondaryOstree(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree(AktualizrSecondaryOstree&&) = delete;
+  AktualizrSecondaryOstree& operator=(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree& operator=(AktualizrSecondaryOstree&&) = delete;
 
   void initialize() override;
   data::InstallationResult downloadOstreeUpdate(const std::string& packed_tls_creds);
 
+  using AktualizrSecondary::putMetadata;
+  data::InstallationResult putMetadata(const Uptane::MetaBundle& meta_bundle) override;
+  data::InstallationResult install() override;
+
  protected:
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
   bool isTargetSupported(const Uptane::Target& target) const override;
   data::InstallationResult installPendingTarget(const Uptane::Target& target) override;
   data::InstallationResult applyPendingInstall(const Uptane::Target& target) override;
   void completeInstall() override;
+  bool supportsBackgroundPull() const override { return true; }
 
  private:
+  // Outcome of the last pull started by a background download request
+  struct PullStatus {
+    bool running{false};
+    bool done{false};
+    unsigned int progress{0};
+    data::InstallationResult result;
+  };
+
   bool hasPendingUpdate() { return storage()->hasPendingInstall(); }
+  data::InstallationResult startPull(const std::string& packed_tls_creds);
+  bool pullRunning();
+  void stopPull();
 
   ReturnCode downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode pullStatus(Asn1Message& in_msg, Asn1Message& out_msg);
 
   std::shared_ptr<OstreeUpdateAgent> update_agent_;
+
+  std::mutex pull_mutex_;
+  PullStatus pull_status_;
+  std::thread pull_thread_;
+  api::FlowControlToken pull_token_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_OSTREE_H
@@ -6,6 +6,7 @@
 
 #include "aktualizr_secondary_file.h"
 #include "crypto/keymanager.h"
+#include "firmware_multicast.h"
 #include "libaktualizr/types.h"
 #include "storage/invstorage.h"
 #include "update_agent_file.h"
@@ -382,6 +383,120 @@ TEST_P(SecondaryTestVerification, VerificationPositive) {
 INSTANTIATE_TEST_SUITE_P(SecondaryTestVerificationType, SecondaryTestVerification,
                          ::testing::Values(VerificationType::kFull, VerificationType::kTuf));
 
+/* Metadata sent again, as by a Primary that retries, is accepted again. Metadata that changed is still checked. */
+TEST_F(SecondaryTest, ResendMetadata) {
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  EXPECT_EQ(secondary_->getPendingTarget().filename(), default_target_);
+
+  // Two Targets for the same ECU
+  auto metadata = uptane_repo_.addImageFile("second_target", secondary_->hwID().ToString(),
+                                            secondary_->serial().ToString());
+  EXPECT_FALSE(secondary_->putMetadata(metadata).isSuccess());
+}
+
+/* The installed image digest is stored at install time and recomputed once the file changes. */
+TEST_F(SecondaryTest, InstalledImageDigest) {
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  ASSERT_EQ(sendImageFile(), data::ResultCode::Numeric::kOk);
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+  EXPECT_TRUE(boost::filesystem::exists(secondary_.targetFilepath().string() + ".digest"));
+
+  Utils::writeFile(secondary_.targetFilepath(), std::string("modified image"));
+  auto manifest = secondary_->getManifest();
+  EXPECT_EQ(manifest.installedImageHash(), Hash::generate(Hash::Type::kSha256, "modified image"));
+}
+
+/* The signed manifest is kept until the installed image changes. */
+TEST_F(SecondaryTest, ManifestCache) {
+  // RSA-PSS signatures differ each time the manifest is signed
+  const auto manifest = secondary_->getManifest();
+  EXPECT_TRUE(manifest.verifySignature(secondary_->publicKey()));
+  EXPECT_EQ(secondary_->getManifest(), manifest);
+
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  EXPECT_EQ(secondary_->getManifest(), manifest);
+  ASSERT_EQ(sendImageFile(), data::ResultCode::Numeric::kOk);
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  const auto installed = secondary_->getManifest();
+  EXPECT_NE(installed, manifest);
+  EXPECT_TRUE(installed.verifySignature(secondary_->publicKey()));
+  EXPECT_NE(installed.installedImageHash(), manifest.installedImageHash());
+  EXPECT_EQ(secondary_->getManifest(), installed);
+}
+
+/* An interrupted upload continues from the bytes the Secondary already has. */
+TEST_F(SecondaryTest, ResumeUpload) {
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  const auto target = secondary_.getPendingVersion();
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  const size_t half = image.size() / 2;
+  auto& agent = *secondary_.update_agent_;
+
+  EXPECT_EQ(agent.uploadOffset(target), 0);
+  ASSERT_TRUE(secondary_->receiveData(reinterpret_cast<const uint8_t*>(image.data()), half).isSuccess());
+  EXPECT_EQ(agent.uploadOffset(target), half);
+
+  EXPECT_FALSE(agent.beginUpload(target, half + 1).isSuccess());
+  ASSERT_TRUE(agent.beginUpload(target, half).isSuccess());
+  ASSERT_TRUE(
+      secondary_->receiveData(reinterpret_cast<const uint8_t*>(image.data()) + half, image.size() - half).isSuccess());
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+}
+
+/* A delta upload copies the unchanged parts of the new image from the installed one. */
+TEST_F(SecondaryTest, DeltaUpload) {
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  const std::string installed = "old header" + image.substr(1);
+  Utils::writeFile(secondary_.targetFilepath(), installed);
+  const std::string installed_sha256 = Hash::generate(Hash::Type::kSha256, installed).HashString();
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  const auto target = secondary_.getPendingVersion();
+  auto& agent = *secondary_.update_agent_;
+
+  ASSERT_TRUE(secondary_->receiveData(reinterpret_cast<const uint8_t*>(image.data()), 1).isSuccess());
+  EXPECT_FALSE(agent.receiveCopy(target, std::string(64, '0'), 10, image.size() - 1).isSuccess());
+  EXPECT_FALSE(agent.receiveCopy(target, installed_sha256, 11, image.size() - 1).isSuccess());
+  EXPECT_FALSE(agent.receiveCopy(target, installed_sha256, 10, image.size()).isSuccess());
+  ASSERT_TRUE(agent.receiveCopy(target, installed_sha256, 10, image.size() - 1).isSuccess());
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+}
+
+/* Blocks of a multicast upload may arrive in any order and more than once. */
+TEST_F(SecondaryTest, BlockUpload) {
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  const auto target = secondary_.getPendingVersion();
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  const uint32_t block_size = 500;
+  const uint64_t blocks = FirmwareMulticast::blockCount(image.size(), block_size);
+  auto& agent = *secondary_.update_agent_;
+  auto block = [&image](uint64_t i) { return reinterpret_cast<const uint8_t*>(image.data()) + i * block_size; };
+  auto block_length = [&image](uint64_t i) { return std::min<size_t>(block_size, image.size() - i * block_size); };
+
+  ASSERT_TRUE(agent.beginBlockUpload(target, block_size).isSuccess());
+  EXPECT_EQ(agent.missingBlocks(target), FirmwareMulticast::allBlocksMissing(blocks));
+  for (uint64_t i = blocks; i-- > 1;) {
+    ASSERT_TRUE(agent.receiveBlock(target, i, block(i), block_length(i)).isSuccess());
+  }
+  EXPECT_TRUE(agent.receiveBlock(target, 1, block(1), block_length(1)).isSuccess());
+  EXPECT_FALSE(agent.receiveBlock(target, 0, block(0), block_size - 1).isSuccess());
+  EXPECT_FALSE(agent.receiveBlock(target, blocks, block(0), block_size).isSuccess());
+  EXPECT_TRUE(FirmwareMulticast::isBlockMissing(agent.missingBlocks(target), 0));
+  EXPECT_FALSE(FirmwareMulticast::isBlockMissing(agent.missingBlocks(target), 1));
+  EXPECT_FALSE(secondary_->install().isSuccess());
+
+  ASSERT_TRUE(agent.beginBlockUpload(target, block_size).isSuccess());
+  for (uint64_t i = 0; i < blocks; ++i) {
+    ASSERT_TRUE(agent.receiveBlock(target, i, block(i), block_length(i)).isSuccess());
+  }
+  EXPECT_EQ(agent.missingBlocks(target), std::string(agent.missingBlocks(target).size(), '\0'));
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+}
+
 TEST_F(SecondaryTest, TwoImagesAndOneTarget) {
   // two images for the same ECU, just one of them is added as a target and signed
   // default image and corresponding target has been already added, just add another image
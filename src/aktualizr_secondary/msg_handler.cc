@@ -1,11 +1,13 @@
 #include "msg_handler.h"
 
+#include <mutex>
+
 #include "logging/logging.h"
 
 void MsgDispatcher::clearHandlers() { handler_map_.clear(); }
 
-void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler) {
-  handler_map_[msg_id] = std::move(handler);
+void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, bool read_only) {
+  handler_map_[msg_id] = HandlerEntry{std::move(handler), read_only};
 }
 
 MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) {
@@ -14,7 +16,14 @@ MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg,
     return MsgHandler::kUnkownMsg;
   }
   LOG_TRACE << "Found a handler for the request, processing it...";
-  auto handle_status_code = find_res_it->second(*in_msg, *out_msg);
+  ReturnCode handle_status_code;
+  if (find_res_it->second.read_only) {
+    std::shared_lock<std::shared_mutex> guard(handler_mutex_);
+    handle_status_code = find_res_it->second.handler(*in_msg, *out_msg);
+  } else {
+    std::unique_lock<std::shared_mutex> guard(handler_mutex_);
+    handle_status_code = find_res_it->second.handler(*in_msg, *out_msg);
+  }
   LOG_TRACE << "Request handler returned a response: " << out_msg->toStr();
 
   // Track the last message to help cut down on repetitive logging. Ignore the
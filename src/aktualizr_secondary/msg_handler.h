@@ -1,7 +1,10 @@
 #ifndef MSG_HANDLER_H
 #define MSG_HANDLER_H
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "AKIpUptaneMes.h"
@@ -25,16 +28,27 @@ class MsgDispatcher : public MsgHandler {
  public:
   using Handler = std::function<ReturnCode(Asn1Message&, Asn1Message&)>;
 
-  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler);
+  /**
+   * Read-only handlers may run concurrently with each other, e.g. to serve a
+   * manifest request on one connection between the chunks of an upload on
+   * another. All other handlers run exclusively.
+   */
+  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, bool read_only = false);
   ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override;
 
  protected:
   void clearHandlers();
 
-  unsigned int last_msg_ = 0;
+  std::atomic<unsigned int> last_msg_{0};
 
  private:
-  std::unordered_map<unsigned int, Handler> handler_map_;
+  struct HandlerEntry {
+    Handler handler;
+    bool read_only;
+  };
+
+  std::unordered_map<unsigned int, HandlerEntry> handler_map_;
+  std::shared_mutex handler_mutex_;
 };
 
 #endif  // MSG_HANDLER_H
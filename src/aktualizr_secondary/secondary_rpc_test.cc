@@ -14,6 +14,7 @@
 #include "secondary_tcp_server.h"
 #include "storage/invstorage.h"
 #include "test_utils.h"
+#include "upload_compression.h"
 
 enum class HandlerVersion { kV1, kV2, kV2Failure };
 
@@ -50,8 +51,20 @@ class SecondaryMock : public MsgDispatcher {
   const PublicKey& publicKey() const { return pub_key_; }
   const Uptane::Manifest& manifest() const { return manifest_; }
   const Uptane::MetaBundle& metadata() const { return meta_bundle_; }
+  const std::vector<std::string>& rootChain() const { return root_chain_; }
+  size_t deflatedChunks() const { return deflated_chunks_; }
   HandlerVersion handlerVersion() const { return handler_version_; }
   void setHandlerVersion(HandlerVersion handler_version_in) { handler_version_ = handler_version_in; }
+  // Answer background OSTree download requests, and report the pull as done
+  // after `polls` status requests
+  void setBackgroundPull(unsigned int polls) {
+    background_pull_ = true;
+    pull_polls_ = polls;
+  }
+  bool pulledInBackground() const { return pulled_in_background_; }
+  // Drop the connection instead of answering the next `failures` status requests
+  void setPullStatusFailures(unsigned int failures) { pull_status_failures_ = failures; }
+  bool pullAborted() const { return pull_aborted_; }
   void registerHandlers() {
     registerBaseHandlers();
     if (handler_version_ == HandlerVersion::kV1) {
@@ -109,6 +122,10 @@ class SecondaryMock : public MsgDispatcher {
                     std::bind(&SecondaryMock::rootVerHdlr, this, std::placeholders::_1, std::placeholders::_2));
     registerHandler(AKIpUptaneMes_PR_putRootReq,
                     std::bind(&SecondaryMock::putRootHdlr, this, std::placeholders::_1, std::placeholders::_2));
+    registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                    std::bind(&SecondaryMock::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+    registerHandler(AKIpUptaneMes_PR_ostreePullStatusReq,
+                    std::bind(&SecondaryMock::pullStatusHdlr, this, std::placeholders::_1, std::placeholders::_2));
   }
 
   // Procotol v2 handlers that fail in predictable ways.
@@ -143,13 +160,38 @@ class SecondaryMock : public MsgDispatcher {
   }
 
   MsgHandler::ReturnCode versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
-    (void)in_msg;
-
     auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
     if (handler_version_ == HandlerVersion::kV1) {
       m->version = 1;
     } else {
       m->version = 2;
+      // Accept pipelined uploads with small chunks, so that even modest
+      // images need several windows.
+      auto req = in_msg.versionReq();
+      if (req->uploadChunkSize != nullptr && req->uploadWindow != nullptr) {
+        m->uploadChunkSize = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+        *m->uploadChunkSize = std::min<long>(*req->uploadChunkSize, 4096);  // NOLINT(google-runtime-int)
+        m->uploadWindow = Asn1Allocation<long>();                           // NOLINT(google-runtime-int)
+        *m->uploadWindow = std::min<long>(*req->uploadWindow, 4);           // NOLINT(google-runtime-int)
+      }
+      if (req->keepAlive != nullptr) {
+        m->keepAlive = Asn1Allocation<BOOLEAN_t>();
+        *m->keepAlive = *req->keepAlive;
+      }
+      // Only the working v2 handlers accept a chain of Roots and compressed
+      // chunks; the failing ones make the Primary fall back to the old requests.
+      if (handler_version_ == HandlerVersion::kV2) {
+        m->rootChain = Asn1Allocation<BOOLEAN_t>();
+        *m->rootChain = 1;
+        if (req->uploadCompression != nullptr) {
+          m->uploadCompression = Asn1Allocation<AKCompression_t>();
+          *m->uploadCompression = *req->uploadCompression;
+        }
+        if (background_pull_ && req->ostreeBackgroundPull != nullptr) {
+          m->ostreeBackgroundPull = Asn1Allocation<BOOLEAN_t>();
+          *m->ostreeBackgroundPull = *req->ostreeBackgroundPull;
+        }
+      }
     }
 
     return ReturnCode::kOk;
@@ -299,7 +341,16 @@ class SecondaryMock : public MsgDispatcher {
     }
 
     size_t data_size = static_cast<size_t>(in_msg.uploadDataReq()->data.size);
-    auto result = receiveImageData(in_msg.uploadDataReq()->data.buf, data_size);
+    data::InstallationResult result;
+    auto* compression = in_msg.uploadDataReq()->compression;
+    if (compression != nullptr && *compression == AKCompression_deflate) {
+      std::vector<uint8_t> chunk;
+      EXPECT_TRUE(UploadCompression::inflateChunk(in_msg.uploadDataReq()->data.buf, data_size, 4096, &chunk));
+      ++deflated_chunks_;
+      result = receiveImageData(chunk.data(), chunk.size());
+    } else {
+      result = receiveImageData(in_msg.uploadDataReq()->data.buf, data_size);
+    }
 
     auto m = out_msg.present(AKIpUptaneMes_PR_uploadDataResp).uploadDataResp();
     m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -327,6 +378,8 @@ class SecondaryMock : public MsgDispatcher {
 
   MsgHandler::ReturnCode downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg) {
     tls_creds_ = ToString(in_msg.downloadOstreeRevReq()->tlsCred);
+    const auto background = in_msg.downloadOstreeRevReq()->background;
+    pulled_in_background_ = background != nullptr && *background != 0;
     auto m = out_msg.present(AKIpUptaneMes_PR_downloadOstreeRevResp).downloadOstreeRevResp();
     m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
     SetString(&m->description, "");
@@ -334,6 +387,29 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode pullStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    if (pull_status_failures_ > 0) {
+      --pull_status_failures_;
+      return ReturnCode::kUnkownMsg;
+    }
+    const auto abort = in_msg.ostreePullStatusReq()->abort;
+    if (abort != nullptr && *abort != 0) {
+      pull_aborted_ = true;
+      pull_polls_ = 0;
+    }
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_ostreePullStatusResp).ostreePullStatusResp();
+    m->done = pull_polls_ == 0 ? 1 : 0;
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+    m->progress = pull_polls_ == 0 ? 100 : 50;
+    if (pull_polls_ > 0) {
+      --pull_polls_;
+    }
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode downloadOstreeRevFailure(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -381,6 +457,21 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto pr = in_msg.putRootChainReq();
+    root_chain_.clear();
+    for (int i = 0; i < pr->roots.list.count; ++i) {
+      root_chain_.push_back(ToString(*pr->roots.list.array[i]));
+    }
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+    m->applied = pr->roots.list.count;
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode putRootFailureHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -427,6 +518,13 @@ class SecondaryMock : public MsgDispatcher {
   const Uptane::Manifest manifest_;
 
   Uptane::MetaBundle meta_bundle_;
+  std::vector<std::string> root_chain_;
+  size_t deflated_chunks_{0};
+  bool background_pull_{false};
+  bool pulled_in_background_{false};
+  unsigned int pull_polls_{0};
+  unsigned int pull_status_failures_{0};
+  bool pull_aborted_{false};
 
   TemporaryDirectory image_dir_;
   boost::filesystem::path image_filepath_;
@@ -508,7 +606,8 @@ class SecondaryRpcCommon : public ::testing::Test {
   const std::string image_targets_ = "image-targets";
 
  protected:
-  SecondaryRpcCommon(size_t image_size, HandlerVersion handler_version, VerificationType vtype)
+  SecondaryRpcCommon(size_t image_size, HandlerVersion handler_version, VerificationType vtype,
+                     bool keep_alive = false)
       : secondary_{Uptane::EcuSerial("serial"),
                    Uptane::HardwareIdentifier("hardware-id"),
                    PublicKey("pub-key", KeyType::kED25519),
@@ -520,7 +619,8 @@ class SecondaryRpcCommon : public ::testing::Test {
         image_file_{"mytarget_image.img", image_size},
         vtype_{vtype} {
     secondary_server_.wait_until_running();
-    ip_secondary_ = Uptane::IpUptaneSecondary::connectAndCreate("localhost", secondary_server_.port(), vtype);
+    ip_secondary_ =
+        Uptane::IpUptaneSecondary::connectAndCreate("localhost", secondary_server_.port(), vtype, keep_alive);
 
     config_.pacman.ostree_server = server_;
     config_.pacman.type = PACKAGE_MANAGER_NONE;
@@ -689,6 +789,17 @@ class SecondaryRpcCommon : public ::testing::Test {
       EXPECT_TRUE(iresult.isSuccess());
       verifyMetadata(secondary_.metadata());
     }
+
+    // Several Roots at once go in one request where the Secondary supports it
+    const std::vector<std::string> chain{image_root_v2_, "image-root-v3"};
+    data::InstallationResult cresult = ip_secondary_->putRootChain(chain, false);
+    if (handler_version == HandlerVersion::kV1 || handler_version == HandlerVersion::kV2Failure) {
+      EXPECT_EQ(cresult.result_code, data::ResultCode::Numeric::kVerificationFailed);
+      EXPECT_EQ(cresult.description, secondary_.verification_failure);
+    } else {
+      EXPECT_TRUE(cresult.isSuccess());
+      EXPECT_EQ(secondary_.rootChain(), chain);
+    }
   }
 
   SecondaryMock secondary_;
@@ -737,6 +848,7 @@ INSTANTIATE_TEST_SUITE_P(SecondaryRpcTestCases, SecondaryRpcTest,
                                            std::make_tuple(1024 - 1, HandlerVersion::kV2, VerificationType::kFull),
                                            std::make_tuple(1024 + 1, HandlerVersion::kV2, VerificationType::kFull),
                                            std::make_tuple(1024 * 10 + 1, HandlerVersion::kV2, VerificationType::kFull),
+                                           std::make_tuple(1024 * 1024 + 1, HandlerVersion::kV2, VerificationType::kFull),
                                            std::make_tuple(1, HandlerVersion::kV2, VerificationType::kTuf),
                                            std::make_tuple(1024, HandlerVersion::kV2, VerificationType::kTuf),
                                            std::make_tuple(1024 - 1, HandlerVersion::kV2, VerificationType::kTuf),
@@ -775,6 +887,165 @@ TEST_F(SecondaryRpcUpgrade, VersionUpgrade) {
   installOstreeRev();
 }
 
+class SecondaryRpcConnections : public SecondaryRpcCommon {
+ protected:
+  SecondaryRpcConnections() : SecondaryRpcCommon(1024, HandlerVersion::kV2, VerificationType::kFull) {}
+};
+
+/* Requests are served while other connections to the Secondary are held open. */
+TEST_F(SecondaryRpcConnections, ConcurrentConnections) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  std::vector<std::unique_ptr<ConnectionSocket>> idle_connections;
+  for (size_t i = 0; i < SecondaryTcpServer::kMaxConnections - 1; ++i) {
+    idle_connections.emplace_back(std::make_unique<ConnectionSocket>("localhost", secondary_server_.port()));
+    ASSERT_EQ(idle_connections.back()->connect(), 0);
+  }
+
+  EXPECT_EQ(ip_secondary_->getManifest(), secondary_.manifest());
+  sendAndInstallBinaryImage();
+}
+
+/* Compressible images go to Secondaries that accept it in deflated chunks. */
+TEST_F(SecondaryRpcConnections, CompressedUpload) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  sendAndInstallBinaryImage();
+  EXPECT_GT(secondary_.deflatedChunks(), 0);
+}
+
+/* While a metadata snapshot is set, the encoded metadata request is built
+ * once and shared by all Secondaries, until the snapshot changes. */
+TEST_F(SecondaryRpcConnections, SharedMetadata) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  Uptane::Target target = image_file_.createTarget(package_manager_);
+  auto snapshot = std::make_shared<Uptane::MetaBundle>();
+  ASSERT_TRUE(secondary_provider_->getMetadata(snapshot.get(), target));
+  secondary_provider_->setMetadataSnapshot(snapshot);
+  EXPECT_EQ(secondary_provider_->getMetadataBundle(target), snapshot);
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+  verifyMetadata(secondary_.metadata());
+
+  int builds = 0;
+  auto build = [&builds]() {
+    ++builds;
+    return std::string("payload");
+  };
+  auto shared = secondary_provider_->getMetadataPayload("ip-putMetaReq2", build);
+  ASSERT_NE(shared, nullptr);
+  EXPECT_NE(*shared, "payload");  // Already encoded by putMetadata()
+  EXPECT_EQ(secondary_provider_->getMetadataPayload("ip-putMetaReq2", build), shared);
+  EXPECT_EQ(builds, 0);
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+
+  secondary_provider_->setMetadataSnapshot(nullptr);
+  auto loaded = secondary_provider_->getMetadataBundle(target);
+  ASSERT_NE(loaded, nullptr);
+  EXPECT_NE(loaded, snapshot);
+  EXPECT_EQ(*loaded, *snapshot);
+  EXPECT_EQ(*secondary_provider_->getMetadataPayload("ip-putMetaReq2", build), "payload");
+  EXPECT_EQ(*secondary_provider_->getMetadataPayload("ip-putMetaReq2", build), "payload");
+  EXPECT_EQ(builds, 2);
+  EXPECT_EQ(secondary_provider_->getMetadataPayload("empty", [] { return std::string(); }), nullptr);
+}
+
+/* Secondaries that pull OSTree commits in the background answer the download
+ * request at once and are polled until the pull is done. */
+TEST_F(SecondaryRpcConnections, BackgroundOstreePull) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  secondary_.setBackgroundPull(2);
+  Json::Value target_json;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  Uptane::Target target = Uptane::Target("OSTREE", target_json);
+  ASSERT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+
+  const auto started = ip_secondary_->startFirmware(target, InstallInfo());
+  ASSERT_TRUE(started);
+  EXPECT_TRUE(started->isSuccess());
+  EXPECT_TRUE(secondary_.pulledInBackground());
+  EXPECT_FALSE(ip_secondary_->firmwareStatus(target));
+  EXPECT_FALSE(ip_secondary_->firmwareStatus(target));
+  const auto status = ip_secondary_->firmwareStatus(target);
+  ASSERT_TRUE(status);
+  EXPECT_TRUE(status->isSuccess());
+  EXPECT_TRUE(ip_secondary_->install(target, InstallInfo(), nullptr).isSuccess());
+
+  // Binary images are still uploaded by sendFirmware()
+  EXPECT_FALSE(ip_secondary_->startFirmware(image_file_.createTarget(package_manager_), InstallInfo()));
+}
+
+/* A background OSTree pull outlives a few failed status requests, but not
+ * more than that. */
+TEST_F(SecondaryRpcConnections, BackgroundOstreePullStatusFailures) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  secondary_.setBackgroundPull(1);
+  Json::Value target_json;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  Uptane::Target target = Uptane::Target("OSTREE", target_json);
+  ASSERT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+
+  const auto started = ip_secondary_->startFirmware(target, InstallInfo());
+  ASSERT_TRUE(started && started->isSuccess());
+  secondary_.setPullStatusFailures(1);
+  boost::optional<data::InstallationResult> status;
+  for (int poll = 0; poll < 10 && !status; ++poll) {
+    status = ip_secondary_->firmwareStatus(target);
+  }
+  ASSERT_TRUE(status);
+  EXPECT_TRUE(status->isSuccess());
+
+  secondary_.setBackgroundPull(1);
+  ASSERT_TRUE(ip_secondary_->startFirmware(target, InstallInfo()));
+  secondary_.setPullStatusFailures(100);
+  status = boost::none;
+  for (int poll = 0; poll < 10 && !status; ++poll) {
+    status = ip_secondary_->firmwareStatus(target);
+  }
+  ASSERT_TRUE(status);
+  EXPECT_EQ(status->result_code.num_code, data::ResultCode::Numeric::kDownloadFailed);
+  secondary_.setPullStatusFailures(0);
+}
+
+/* Cancelling a background OSTree pull stops it on the Secondary. */
+TEST_F(SecondaryRpcConnections, BackgroundOstreePullCancel) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  secondary_.setBackgroundPull(10);
+  Json::Value target_json;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  Uptane::Target target = Uptane::Target("OSTREE", target_json);
+  ASSERT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+
+  const auto started = ip_secondary_->startFirmware(target, InstallInfo());
+  ASSERT_TRUE(started && started->isSuccess());
+  EXPECT_FALSE(ip_secondary_->firmwareStatus(target));
+  ip_secondary_->cancelFirmware(target);
+  EXPECT_TRUE(secondary_.pullAborted());
+}
+
+class SecondaryRpcKeepAlive : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcKeepAlive() : SecondaryRpcCommon(1024 * 10 + 1, GetParam(), VerificationType::kFull, true) {}
+};
+
+/* Requests work over a persistent connection, and fall back to a connection
+ * per request with Secondaries that do not confirm keep-alive. */
+TEST_P(SecondaryRpcKeepAlive, AllRpcCalls) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(ip_secondary_->getManifest(), secondary_.manifest());
+  EXPECT_TRUE(ip_secondary_->ping());
+  installOstreeRev();
+  rotateRoot();
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcKeepAliveCases, SecondaryRpcKeepAlive,
+                         ::testing::Values(HandlerVersion::kV2, HandlerVersion::kV1));
+
 TEST(SecondaryTcpServer, TestIpSecondaryIfSecondaryIsNotRunning) {
   in_port_t secondary_port = TestUtils::getFreePortAsInt();
   SecondaryInterface::Ptr ip_secondary;
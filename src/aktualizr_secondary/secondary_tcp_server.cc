@@ -1,6 +1,7 @@
 #include "secondary_tcp_server.h"
 
 #include <netinet/tcp.h>
+#include <unistd.h>
 
 #include "AKInstallationResultCode.h"
 #include "AKIpUptaneMes.h"
@@ -44,6 +45,16 @@ void SecondaryTcpServer::run() {
   bool first_connection = true;
 
   while (keep_running_.load()) {
+    {
+      std::unique_lock<std::mutex> lock(connections_mutex_);
+      connections_condition_.wait(lock,
+                                  [this] { return connections_.size() < kMaxConnections || !keep_running_.load(); });
+    }
+    JoinFinishedConnections();
+    if (!keep_running_.load()) {
+      break;
+    }
+
     sockaddr_storage peer_sa{};
     socklen_t peer_sa_size = sizeof(sockaddr_storage);
 
@@ -60,6 +71,11 @@ void SecondaryTcpServer::run() {
       LOG_INFO << "Socket accept failed, aborting.";
       break;
     }
+    if (!keep_running_.load()) {
+      // Most likely the connection made by stop() to unblock accept()
+      close(con_fd);
+      break;
+    }
 
     if (first_connection) {
       LOG_INFO << "Primary connected.";
@@ -67,12 +83,19 @@ void SecondaryTcpServer::run() {
     } else {
       LOG_DEBUG << "Primary reconnected.";
     }
-    auto continue_running = HandleOneConnection(*Socket(con_fd));
-    if (!continue_running) {
-      keep_running_.store(false);
+    std::lock_guard<std::mutex> guard(connections_mutex_);
+    connections_[con_fd] = std::thread(&SecondaryTcpServer::ServeConnection, this, con_fd);
+  }
+
+  {
+    // Unblock the connections that are still open and wait for them to finish
+    std::unique_lock<std::mutex> lock(connections_mutex_);
+    for (const auto &connection : connections_) {
+      shutdown(connection.first, SHUT_RDWR);
     }
-    LOG_DEBUG << "Primary disconnected.";
+    connections_condition_.wait(lock, [this] { return connections_.empty(); });
   }
+  JoinFinishedConnections();
 
   {
     std::unique_lock<std::mutex> lock(running_condition_mutex_);
@@ -83,24 +106,52 @@ void SecondaryTcpServer::run() {
   LOG_INFO << "Secondary TCP server exiting.";
 }
 
+void SecondaryTcpServer::ServeConnection(int socket) {
+  auto continue_running = HandleOneConnection(socket);
+  LOG_DEBUG << "Primary disconnected.";
+
+  {
+    std::lock_guard<std::mutex> guard(connections_mutex_);
+    close(socket);
+    auto this_connection = connections_.find(socket);
+    finished_connections_.push_back(std::move(this_connection->second));
+    connections_.erase(this_connection);
+  }
+  connections_condition_.notify_all();
+  if (!continue_running) {
+    stop();
+  }
+}
+
+void SecondaryTcpServer::JoinFinishedConnections() {
+  std::vector<std::thread> finished;
+  {
+    std::lock_guard<std::mutex> guard(connections_mutex_);
+    finished.swap(finished_connections_);
+  }
+  for (auto &connection : finished) {
+    connection.join();
+  }
+}
+
 void SecondaryTcpServer::stop() {
   LOG_DEBUG << "Stopping Secondary TCP server...";
   keep_running_.store(false);
+  connections_condition_.notify_all();
   // unblock accept
   ConnectionSocket("localhost", listen_socket_.port()).connect();
 }
 
 in_port_t SecondaryTcpServer::port() const { return listen_socket_.port(); }
-SecondaryTcpServer::ExitReason SecondaryTcpServer::exit_reason() const { return exit_reason_; }
+SecondaryTcpServer::ExitReason SecondaryTcpServer::exit_reason() const { return exit_reason_.load(); }
 
 static bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg);
 
 bool SecondaryTcpServer::HandleOneConnection(int socket) {
-  // Outside the message loop, because one recv() may have parts of 2 messages
-  // Note that one recv() call returning 2+ messages doesn't work at the
-  // moment. This shouldn't be a problem until we have messages that aren't
-  // strictly request/response
-  DequeueBuffer buffer;
+  // Outside the message loop, because one recv() may have parts of 2 messages,
+  // e.g. when the Primary pipelines uploadDataReq messages. It is large enough
+  // to hold a whole uploadDataReq, so that its data is used where it lands.
+  DequeueBuffer buffer(kReceiveBufferSize);
   bool keep_running_server = true;
   bool keep_running_current_session = true;
 
@@ -109,20 +160,44 @@ bool SecondaryTcpServer::HandleOneConnection(int socket) {
     AKIpUptaneMes_t *m = nullptr;
     asn_dec_rval_t res{};
     asn_codec_ctx_s context{};
-    ssize_t received;
+    ssize_t received = 1;
+    Asn1UploadData upload;
+    size_t decoded_in_place = 0;  // Consumed once the handler is done with the data
+    bool in_place = true;
 
-    do {
+    // Decode what is already buffered before blocking on the socket again.
+    res.code = RC_WMORE;
+    while (res.code == RC_WMORE) {
+      if (in_place && buffer.Size() > 0) {
+        ssize_t length = Asn1DecodeUploadData(buffer.Head(), buffer.Size(), &upload);
+        if (length > 0) {
+          decoded_in_place = static_cast<size_t>(length);
+          res.code = RC_OK;
+          break;
+        }
+        // Not an uploadDataReq, or one too large to buffer whole
+        in_place = length == 0 && buffer.TailSpace() > 0;
+      }
+      if (!in_place && buffer.Size() > 0) {
+        res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void **>(&m), buffer.Head(),
+                         buffer.Size());
+        buffer.Consume(res.consumed);
+        if (res.code != RC_WMORE) {
+          break;
+        }
+      }
       received = recv(socket, buffer.Tail(), buffer.TailSpace(), 0);
-      if (received < 0) {
-        LOG_ERROR << "Failed to read data from a server socket: " << strerror(errno);
+      if (received <= 0) {
+        if (received < 0) {
+          LOG_ERROR << "Failed to read data from a server socket: " << strerror(errno);
+        }
         break;
       }
       buffer.HaveEnqueued(static_cast<size_t>(received));
-      res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void **>(&m), buffer.Head(), buffer.Size());
-      buffer.Consume(res.consumed);
-    } while (res.code == RC_WMORE && received > 0);
+    }
     // Note that ber_decode allocates *m even on failure, so this must always be done
-    Asn1Message::Ptr request_msg = Asn1Message::FromRaw(&m);
+    Asn1Message::Ptr request_msg =
+        decoded_in_place > 0 ? Asn1Message::FromUploadData(upload) : Asn1Message::FromRaw(&m);
 
     if (received == 0) {
       LOG_TRACE << "Primary has closed a connection socket";
@@ -145,7 +220,7 @@ bool SecondaryTcpServer::HandleOneConnection(int socket) {
 
     switch (handle_status_code) {
       case MsgHandler::ReturnCode::kRebootRequired: {
-        exit_reason_ = ExitReason::kRebootNeeded;
+        exit_reason_.store(ExitReason::kRebootNeeded);
         keep_running_current_session = sendResponseMessage(socket, response_msg);
         if (reboot_after_install_) {
           keep_running_server = keep_running_current_session = false;
@@ -164,6 +239,10 @@ bool SecondaryTcpServer::HandleOneConnection(int socket) {
       }
     }  // switch
 
+    if (decoded_in_place > 0) {
+      request_msg.reset();  // It points into buffer
+      buffer.Consume(decoded_in_place);
+    }
   }  // Go back round and read another message
 
   return keep_running_server;
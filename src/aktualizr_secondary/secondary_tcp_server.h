@@ -4,6 +4,9 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "utilities/utils.h"
 
@@ -11,7 +14,9 @@ class MsgHandler;
 
 /**
  * Listens on a socket, decodes calls (ASN.1) and forwards them to an Uptane Secondary
- * implementation
+ * implementation. Each connection is served on its own thread and stays open
+ * until the Primary closes it, so a slow request on one connection does not
+ * hold up the others.
  */
 class SecondaryTcpServer {
  public:
@@ -21,6 +26,11 @@ class SecondaryTcpServer {
     kUnkown,
   };
 
+  // Connections served at the same time; further ones wait to be accepted
+  static constexpr size_t kMaxConnections{4};
+  // Per connection. Holds an uploadDataReq of the largest chunk the Primary sends.
+  static constexpr size_t kReceiveBufferSize{64 * 1024 + 4096};
+
   SecondaryTcpServer(MsgHandler& msg_handler, const std::string& primary_ip, in_port_t primary_port, in_port_t port = 0,
                      bool reboot_after_install = false);
   ~SecondaryTcpServer() = default;
@@ -32,6 +42,7 @@ class SecondaryTcpServer {
   /**
    * Accept connections on the socket, decode requests and respond using the secondary implementation
    */
+
   void run();
   void stop();
 
@@ -42,12 +53,20 @@ class SecondaryTcpServer {
 
  private:
   bool HandleOneConnection(int socket);
+  void ServeConnection(int socket);
+  void JoinFinishedConnections();
 
   MsgHandler& msg_handler_;
   ListenSocket listen_socket_;
   std::atomic<bool> keep_running_;
   bool reboot_after_install_;
-  ExitReason exit_reason_{ExitReason::kNotApplicable};
+  std::atomic<ExitReason> exit_reason_{ExitReason::kNotApplicable};
+
+  // Connection threads, by socket
+  std::unordered_map<int, std::thread> connections_;
+  std::vector<std::thread> finished_connections_;
+  std::mutex connections_mutex_;
+  std::condition_variable connections_condition_;
 
   bool is_running_;
   std::mutex running_condition_mutex_;
@@ -1,23 +1,290 @@
 #include "update_agent_file.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
+#include <cstring>
 #include <fstream>
+#include <vector>
 #include "crypto/crypto.h"
+#include "firmware_multicast.h"
 #include "logging/logging.h"
 #include "uptane/manifest.h"
 
+/**
+ * State of the upload of one target image: the file stays open and data is
+ * written in large blocks for the whole transfer. Every kCheckpointBytes the
+ * file is synced and the hasher state is saved next to it, so that after a
+ * restart the received prefix does not have to be written again.
+ */
+class FileUpdateAgent::UploadSession {
+ public:
+  static constexpr size_t kWriteBufferBytes = 64 * 1024;
+  static constexpr uint64_t kCheckpointBytes = 4 * 1024 * 1024;
+
+  UploadSession(const boost::filesystem::path& filepath, const Uptane::Target& target)
+      : filepath_{filepath},
+        checkpoint_path_{filepath.string() + ".hashstate"},
+        target_hash_{getTargetHash(target)},
+        hasher_{MultiPartHasher::create(target_hash_.type())} {
+    buffer_.reserve(kWriteBufferBytes);
+    fd_ = open(filepath_.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open a new target image file");
+    }
+    stored_ = resume();
+    if (ftruncate(fd_, static_cast<off_t>(stored_)) != 0 || lseek(fd_, static_cast<off_t>(stored_), SEEK_SET) < 0) {
+      close(fd_);
+      throw std::runtime_error("Failed to prepare the new target image file");
+    }
+    if (stored_ > 0) {
+      LOG_INFO << "Resuming the upload of the new target image; " << stored_ << " bytes already stored";
+    }
+  }
+
+  ~UploadSession() {
+    try {
+      flush();
+    } catch (const std::exception& e) {
+      LOG_WARNING << e.what();
+    }
+    close(fd_);
+  }
+
+  UploadSession(const UploadSession&) = delete;
+  UploadSession(UploadSession&&) = delete;
+  UploadSession& operator=(const UploadSession&) = delete;
+  UploadSession& operator=(UploadSession&&) = delete;
+
+  bool isFor(const Uptane::Target& target) const { return getTargetHash(target) == target_hash_; }
+
+  bool restart(uint64_t offset) {
+    if (offset > stored_) {
+      return false;
+    }
+    received_ = offset;
+    return true;
+  }
+  uint64_t stored() const { return stored_; }
+  uint64_t received() const { return received_; }
+
+  void append(const uint8_t* data, size_t size) {
+    // Skip what an earlier transfer of the same image already stored
+    if (received_ < stored_) {
+      const auto skip = static_cast<size_t>(std::min<uint64_t>(stored_ - received_, size));
+      received_ += skip;
+      data += skip;
+      size -= skip;
+    }
+    received_ += size;
+    stored_ += size;
+    hasher_->update(data, size);
+    while (size > 0) {
+      const size_t n = std::min(size, kWriteBufferBytes - buffer_.size());
+      buffer_.insert(buffer_.end(), data, data + n);
+      data += n;
+      size -= n;
+      if (buffer_.size() == kWriteBufferBytes) {
+        flush();
+      }
+    }
+    if (stored_ - checkpoint_ >= kCheckpointBytes) {
+      checkpoint();
+    }
+  }
+
+  /** Write out buffered data, make it durable and return the hash of the stored data. */
+  Hash finish() {
+    flush();
+    if (fdatasync(fd_) != 0) {
+      LOG_WARNING << "Failed to sync the new target image file: " << std::strerror(errno);
+    }
+    return hasher_->getHash();
+  }
+
+  void removeCheckpoint() {
+    boost::system::error_code ec;
+    boost::filesystem::remove(checkpoint_path_, ec);
+  }
+
+ private:
+  void flush() {
+    const uint8_t* data = buffer_.data();
+    size_t size = buffer_.size();
+    while (size > 0) {
+      const ssize_t written = write(fd_, data, size);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        buffer_.clear();
+        throw std::runtime_error(std::string("Failed to write the new target image: ") + std::strerror(errno));
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    buffer_.clear();
+  }
+
+  void checkpoint() {
+    flush();
+    if (fdatasync(fd_) != 0) {
+      return;
+    }
+    const std::string state = hasher_->exportState();
+    if (state.empty()) {
+      return;
+    }
+    Utils::writeFile(checkpoint_path_,
+                     target_hash_.HashString() + "\n" + std::to_string(stored_) + "\n" + Utils::toHex(state),
+                     false);
+    checkpoint_ = stored_;
+  }
+
+  // Returns the number of bytes of the file that can be kept.
+  uint64_t resume() {
+    if (!boost::filesystem::exists(checkpoint_path_)) {
+      return 0;
+    }
+    const std::string content = Utils::readFile(checkpoint_path_);
+    std::vector<std::string> fields;
+    boost::algorithm::split(fields, content, boost::algorithm::is_any_of("\n"));
+    try {
+      const uint64_t offset = std::stoull(fields.at(1));
+      if (fields.at(0) == target_hash_.HashString() && offset <= boost::filesystem::file_size(filepath_) &&
+          hasher_->importState(Utils::fromHex(fields.at(2)))) {
+        checkpoint_ = offset;
+        return offset;
+      }
+    } catch (const std::exception&) {
+    }
+    LOG_INFO << "Upload checkpoint does not match the new target image, receiving it from the start";
+    hasher_->reset();
+    return 0;
+  }
+
+  const boost::filesystem::path filepath_;
+  const boost::filesystem::path checkpoint_path_;
+  const Hash target_hash_;
+  MultiPartHasher::Ptr hasher_;
+  int fd_{-1};
+  std::vector<uint8_t> buffer_;
+  uint64_t stored_{0};      // Bytes in the file, including the ones still buffered
+  uint64_t received_{0};    // Bytes received in the current transfer
+  uint64_t checkpoint_{0};  // Bytes covered by the last checkpoint
+};
+
+/**
+ * A target image that is received in fixed size blocks in any order. The file
+ * gets its full size up front and blocks are written in place; it is hashed
+ * once all of them have arrived.
+ */
+class FileUpdateAgent::BlockUpload {
+ public:
+  BlockUpload(const boost::filesystem::path& filepath, const Uptane::Target& target, uint32_t block_size)
+      : target_hash_{getTargetHash(target)},
+        length_{target.length()},
+        block_size_{block_size},
+        missing_{FirmwareMulticast::allBlocksMissing(FirmwareMulticast::blockCount(length_, block_size))},
+        missing_count_{FirmwareMulticast::blockCount(length_, block_size)} {
+    fd_ = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Failed to open a new target image file");
+    }
+    if (ftruncate(fd_, static_cast<off_t>(length_)) != 0) {
+      close(fd_);
+      throw std::runtime_error("Failed to prepare the new target image file");
+    }
+  }
+
+  ~BlockUpload() { close(fd_); }
+
+  BlockUpload(const BlockUpload&) = delete;
+  BlockUpload(BlockUpload&&) = delete;
+  BlockUpload& operator=(const BlockUpload&) = delete;
+  BlockUpload& operator=(BlockUpload&&) = delete;
+
+  bool isFor(const Uptane::Target& target) const { return getTargetHash(target) == target_hash_; }
+  bool complete() const { return missing_count_ == 0; }
+  const std::string& missing() const { return missing_; }
+
+  void write(uint64_t block, const uint8_t* data, size_t size) {
+    const uint64_t offset = block * block_size_;
+    if (offset >= length_ || size != std::min<uint64_t>(block_size_, length_ - offset)) {
+      throw std::runtime_error("Invalid block " + std::to_string(block) + " of " + std::to_string(size) + " bytes");
+    }
+    if (!FirmwareMulticast::isBlockMissing(missing_, block)) {
+      return;
+    }
+    size_t written = 0;
+    while (written < size) {
+      const ssize_t n = pwrite(fd_, data + written, size - written, static_cast<off_t>(offset + written));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        throw std::runtime_error(std::string("Failed to write the new target image: ") + std::strerror(errno));
+      }
+      written += static_cast<size_t>(n);
+    }
+    FirmwareMulticast::setBlockReceived(&missing_, block);
+    --missing_count_;
+  }
+
+  /** Make the file durable and return its hash. */
+  Hash finish() {
+    if (fdatasync(fd_) != 0) {
+      LOG_WARNING << "Failed to sync the new target image file: " << std::strerror(errno);
+    }
+    auto hasher = MultiPartHasher::create(target_hash_.type());
+    std::vector<uint8_t> buf(UploadSession::kWriteBufferBytes);
+    uint64_t offset = 0;
+    while (offset < length_) {
+      const ssize_t n = pread(fd_, buf.data(), buf.size(), static_cast<off_t>(offset));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      hasher->update(buf.data(), static_cast<uint64_t>(n));
+      offset += static_cast<uint64_t>(n);
+    }
+    return hasher->getHash();
+  }
+
+ private:
+  const Hash target_hash_;
+  const uint64_t length_;
+  const uint32_t block_size_;
+  int fd_{-1};
+  std::string missing_;
+  uint64_t missing_count_;
+};
+
+FileUpdateAgent::FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name)
+    : target_filepath_{std::move(target_filepath)},
+      new_target_filepath_{target_filepath_.string() + ".newtarget"},
+      current_target_name_{std::move(target_name)},
+      installed_digest_{target_filepath_, target_filepath_.string() + ".digest"} {}
+
+FileUpdateAgent::~FileUpdateAgent() = default;
+
 // TODO(OTA-4939): Unify this with the check in
 // SotaUptaneClient::getNewTargets() and make it more generic.
 bool FileUpdateAgent::isTargetSupported(const Uptane::Target& target) const { return target.type() != "OSTREE"; }
 
 bool FileUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const {
-  if (boost::filesystem::exists(target_filepath_)) {
-    auto file_content = Utils::readFile(target_filepath_);
-
+  std::string sha256;
+  uint64_t len = 0;
+  if (installed_digest_.get(&sha256, &len)) {
     installed_image_info.name = current_target_name_;
-    installed_image_info.len = file_content.size();
-    installed_image_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(file_content);
+    installed_image_info.len = len;
+    installed_image_info.hash = sha256;
   } else {
     // mimic the Primary's fake package manager behavior
     auto unknown_target = Uptane::Target::Unknown();
@@ -30,32 +297,40 @@ bool FileUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installe
 }
 
 data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target) {
-  if (!boost::filesystem::exists(new_target_filepath_)) {
+  const bool blocks = block_upload_ && block_upload_->isFor(target) && block_upload_->complete();
+  if ((!blocks && (!upload_ || !upload_->isFor(target))) || !boost::filesystem::exists(new_target_filepath_)) {
     LOG_ERROR << "The target image has not been received";
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The target image has not been received");
   }
 
+  Hash received_hash = blocks ? block_upload_->finish() : upload_->finish();
   auto received_target_image_size = boost::filesystem::file_size(new_target_filepath_);
   if (received_target_image_size != target.length()) {
     LOG_ERROR << "Received image size does not match the size specified in Target metadata: "
               << received_target_image_size << " != " << target.length();
-    boost::filesystem::remove(new_target_filepath_);
+    discardUpload();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "Received image size does not match the size specified in Target metadata: " +
                                         std::to_string(received_target_image_size) +
                                         " != " + std::to_string(target.length()));
   }
 
-  if (!target.MatchHash(new_target_hasher_->getHash())) {
-    LOG_ERROR << "The received image's hash does not match the hash specified in Target metadata: "
-              << new_target_hasher_->getHash() << " != " << getTargetHash(target).HashString();
+  if (!target.MatchHash(received_hash)) {
+    LOG_ERROR << "The received image's hash does not match the hash specified in Target metadata: " << received_hash
+              << " != " << getTargetHash(target).HashString();
+    // Start from scratch next time instead of resuming from corrupted data
+    discardUpload();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The received image's hash does not match the hash specified in Target metadata: " +
-                                        new_target_hasher_->getHash().HashString() +
-                                        " != " + getTargetHash(target).HashString());
+                                        received_hash.HashString() + " != " + getTargetHash(target).HashString());
   }
 
+  if (upload_) {
+    upload_->removeCheckpoint();
+    upload_.reset();
+  }
+  block_upload_.reset();
   boost::filesystem::rename(new_target_filepath_, target_filepath_);
 
   if (boost::filesystem::exists(new_target_filepath_)) {
@@ -69,7 +344,12 @@ data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target)
   }
 
   current_target_name_ = target.filename();
-  new_target_hasher_.reset();
+  // The received image has just been verified, so there is no need to hash it again for the manifest
+  if (!target.sha256Hash().empty()) {
+    installed_digest_.store(target.sha256Hash(), target.length());
+  } else {
+    installed_digest_.reset();
+  }
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
@@ -81,65 +361,192 @@ data::InstallationResult FileUpdateAgent::applyPendingInstall(const Uptane::Targ
                                   "Applying pending updates is not supported by the file update agent");
 }
 
-data::InstallationResult FileUpdateAgent::receiveData(const Uptane::Target& target, const uint8_t* data, size_t size) {
-  std::ofstream target_file(new_target_filepath_.c_str(),
-                            std::ofstream::out | std::ofstream::binary | std::ofstream::app);
+uint64_t FileUpdateAgent::uploadOffset(const Uptane::Target& target) {
+  try {
+    openUpload(target);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return 0;
+  }
+  return upload_->stored();
+}
 
-  if (!target_file.good()) {
-    LOG_ERROR << "Failed to open a new target image file";
+data::InstallationResult FileUpdateAgent::beginUpload(const Uptane::Target& target, const uint64_t offset) {
+  if (offset == 0 && !upload_) {
+    // The file is only opened once data arrives
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  try {
+    openUpload(target);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+  if (!upload_->restart(offset)) {
+    LOG_ERROR << "Cannot resume the upload of the new target image at byte " << offset << "; only "
+              << upload_->stored() << " bytes are stored";
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "Failed to open a new target image file");
+                                    "Cannot resume the upload of the new target image at byte " +
+                                        std::to_string(offset) + "; only " + std::to_string(upload_->stored()) +
+                                        " bytes are stored");
+  }
+  if (offset > 0) {
+    LOG_INFO << "Resuming the upload of the new target image at byte " << offset;
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+void FileUpdateAgent::openUpload(const Uptane::Target& target) {
+  if (!upload_ || !upload_->isFor(target)) {
+    block_upload_.reset();
+    upload_.reset();
+    upload_ = std_::make_unique<UploadSession>(new_target_filepath_, target);
   }
+}
 
-  auto current_new_image_size = target_file.tellp();
-  if (-1 == current_new_image_size) {
-    LOG_ERROR << "Failed to obtain a size of the new target image that is being uploaded";
-    target_file.close();
-    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "Failed to obtain a size of the new target image that is being uploaded");
+void FileUpdateAgent::discardUpload() {
+  if (upload_) {
+    upload_->removeCheckpoint();
+    upload_.reset();
   }
+  block_upload_.reset();
+  boost::system::error_code ec;
+  boost::filesystem::remove(new_target_filepath_, ec);
+}
 
-  if (static_cast<uint64_t>(current_new_image_size) >= target.length()) {
+data::InstallationResult FileUpdateAgent::receiveData(const Uptane::Target& target, const uint8_t* data, size_t size) {
+  try {
+    openUpload(target);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+
+  const uint64_t current_new_image_size = upload_->received();
+  if (current_new_image_size >= target.length()) {
     LOG_ERROR << "The size of the received image data exceeds the expected Target image size: "
               << current_new_image_size << " != " << target.length();
-    target_file.close();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The size of the received image data exceeds the expected Target image size: " +
                                         std::to_string(current_new_image_size) +
                                         " != " + std::to_string(target.length()));
   }
 
-  if (current_new_image_size == 0) {
-    new_target_hasher_ = MultiPartHasher::create(getTargetHash(target).type());
+  try {
+    upload_->append(data, size);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    upload_.reset();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+
+  const uint64_t total_size = upload_->received();
+  LOG_DEBUG_LIMITED << "Received and stored data of a new target image."
+                       " Received in this request (bytes): "
+                    << size << "; total received so far: " << total_size << "; expected total: " << target.length();
+  if (total_size == target.length()) {
+    LOG_INFO << "Successfully received and stored new target image of " << total_size << " bytes.";
   }
 
-  target_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
-  auto written_data_size = target_file.tellp() - current_new_image_size;
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-  if (written_data_size < 0 || static_cast<size_t>(written_data_size) != size) {
-    LOG_ERROR << "The size of data written is not equal to the received data size: " << written_data_size
-              << " != " << size;
-    target_file.close();
+data::InstallationResult FileUpdateAgent::receiveCopy(const Uptane::Target& target, const std::string& base_sha256,
+                                                      const uint64_t from, const uint64_t length) {
+  Uptane::InstalledImageInfo installed;
+  if (!getInstalledImageInfo(installed) || !boost::algorithm::iequals(installed.hash, base_sha256)) {
+    LOG_ERROR << "Cannot copy from the installed image; its hash is not " << base_sha256;
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "The size of data written is not equal to the received data size: " +
-                                        std::to_string(written_data_size) + " != " + std::to_string(size));
+                                    "Cannot copy from the installed image; its hash is not " + base_sha256);
+  }
+  try {
+    openUpload(target);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+  if (from > installed.len || length > installed.len - from || length > target.length() - upload_->received()) {
+    LOG_ERROR << "Invalid copy of " << length << " bytes from byte " << from << " of the installed image";
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Invalid copy of " + std::to_string(length) + " bytes from byte " +
+                                        std::to_string(from) + " of the installed image");
   }
 
-  target_file.close();
-
-  auto total_size = current_new_image_size + written_data_size;
-  LOG_DEBUG << "Received and stored data of a new target image."
-               " Received in this request (bytes): "
-            << size << "; total received so far: " << total_size << "; expected total: " << target.length();
-  if (static_cast<uint64_t>(total_size) == target.length()) {
-    LOG_INFO << "Successfully received and stored new target image of " << total_size << " bytes.";
+  const int fd = open(target_filepath_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR << "Failed to open the installed image: " << std::strerror(errno);
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    std::string("Failed to open the installed image: ") + std::strerror(errno));
   }
+  std::vector<uint8_t> buf(std::min<uint64_t>(length, 64 * 1024));
+  uint64_t copied = 0;
+  std::string error;
+  while (copied < length && error.empty()) {
+    const ssize_t n = pread(fd, buf.data(), std::min<uint64_t>(length - copied, buf.size()),
+                            static_cast<off_t>(from + copied));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      error = "Failed to read the installed image";
+      break;
+    }
+    try {
+      upload_->append(buf.data(), static_cast<size_t>(n));
+    } catch (const std::exception& e) {
+      error = e.what();
+      upload_.reset();
+    }
+    copied += static_cast<uint64_t>(n);
+  }
+  close(fd);
+  if (!error.empty()) {
+    LOG_ERROR << error;
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, error);
+  }
+  LOG_DEBUG_LIMITED << "Copied " << length << " bytes of the installed image into the new target image";
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-  new_target_hasher_->update(data, size);
+data::InstallationResult FileUpdateAgent::beginBlockUpload(const Uptane::Target& target, const uint32_t block_size) {
+  if (block_size == 0) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid block size");
+  }
+  discardUpload();
+  try {
+    block_upload_ = std_::make_unique<BlockUpload>(new_target_filepath_, target, block_size);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
+data::InstallationResult FileUpdateAgent::receiveBlock(const Uptane::Target& target, const uint64_t block,
+                                                       const uint8_t* data, size_t size) {
+  if (!block_upload_ || !block_upload_->isFor(target)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "No block upload of the target image is in progress");
+  }
+  try {
+    block_upload_->write(block, data, size);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+  }
+  if (block_upload_->complete()) {
+    LOG_INFO << "Successfully received and stored new target image of " << target.length() << " bytes.";
+  }
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
+std::string FileUpdateAgent::missingBlocks(const Uptane::Target& target) const {
+  if (!block_upload_ || !block_upload_->isFor(target)) {
+    return std::string();
+  }
+  return block_upload_->missing();
+}
+
 Hash FileUpdateAgent::getTargetHash(const Uptane::Target& target) {
   // TODO(OTA-4831): check target.hashes() size.
   return target.hashes()[0];
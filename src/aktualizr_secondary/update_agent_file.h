@@ -1,31 +1,77 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 
+#include <memory>
+
+#include "json/json.h"
+
 #include "update_agent.h"
+#include "utilities/file_digest_cache.h"
 
 class FileUpdateAgent : public UpdateAgent {
  public:
-  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name)
-      : target_filepath_{std::move(target_filepath)},
-        new_target_filepath_{target_filepath_.string() + ".newtarget"},
-        current_target_name_{std::move(target_name)} {}
+  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name);
+  ~FileUpdateAgent() override;
+  FileUpdateAgent(const FileUpdateAgent&) = delete;
+  FileUpdateAgent(FileUpdateAgent&&) = delete;
+  FileUpdateAgent& operator=(const FileUpdateAgent&) = delete;
+  FileUpdateAgent& operator=(FileUpdateAgent&&) = delete;
 
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
+  /** Inode, size and modification time of the installed image, null if there is none. */
+  Json::Value installedImageKey() const { return installed_digest_.key(); }
 
+  /**
+   * Number of leading bytes of the target image that are already stored,
+   * from this transfer or, via the checkpoint, from one before a restart.
+   */
+  virtual uint64_t uploadOffset(const Uptane::Target& target);
+  /**
+   * The Primary starts sending the image from byte `offset`, which may not be
+   * beyond uploadOffset(). When it starts from an earlier byte, data that is
+   * already stored is not written again.
+   */
+  virtual data::InstallationResult beginUpload(const Uptane::Target& target, uint64_t offset);
   virtual data::InstallationResult receiveData(const Uptane::Target& target, const uint8_t* data, size_t size);
+  /**
+   * Append `length` bytes from byte `from` of the installed image, for delta
+   * uploads. Fails unless the installed image has the SHA-256 `base_sha256`.
+   */
+  virtual data::InstallationResult receiveCopy(const Uptane::Target& target, const std::string& base_sha256,
+                                               uint64_t from, uint64_t length);
+  /**
+   * Receive the target image in blocks of `block_size` bytes that may arrive
+   * in any order, as in a multicast upload. This replaces any other upload
+   * of a target image that is in progress.
+   */
+  virtual data::InstallationResult beginBlockUpload(const Uptane::Target& target, uint32_t block_size);
+  virtual data::InstallationResult receiveBlock(const Uptane::Target& target, uint64_t block, const uint8_t* data,
+                                                size_t size);
+  /** Bitmap of the blocks that are still missing, see FirmwareMulticast. */
+  virtual std::string missingBlocks(const Uptane::Target& target) const;
   data::InstallationResult install(const Uptane::Target& target) override;
 
   void completeInstall() override;
   data::InstallationResult applyPendingInstall(const Uptane::Target& target) override;
 
  private:
+  class UploadSession;
+  class BlockUpload;
+
   static Hash getTargetHash(const Uptane::Target& target);
+  void openUpload(const Uptane::Target& target);
+  void discardUpload();
 
   const boost::filesystem::path target_filepath_;
   const boost::filesystem::path new_target_filepath_;
   std::string current_target_name_;
-  std::shared_ptr<MultiPartHasher> new_target_hasher_;
+  // Open file, write buffer and hasher of the image being received
+  std::unique_ptr<UploadSession> upload_;
+  // Target image that is being received in blocks instead
+  std::unique_ptr<BlockUpload> block_upload_;
+  // Digest of the installed image, kept next to it
+  FileDigestCache installed_digest_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
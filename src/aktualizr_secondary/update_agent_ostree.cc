@@ -2,6 +2,7 @@
 
 #include <boost/algorithm/string/trim.hpp>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "package_manager/ostreemanager.h"
 
@@ -40,18 +41,22 @@ bool OstreeUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& instal
 }
 
 data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Target& target,
-                                                              const std::string& treehub_tls_creds) {
+                                                              const std::string& treehub_tls_creds,
+                                                              const api::FlowControlToken* token,
+                                                              const FetcherProgressCb& progress_cb) {
   std::string treehub_server;
 
   try {
-    std::string ca;
-    std::string cert;
-    std::string pkey;
-    std::string server_url;
-    extractCredentialsArchive(treehub_tls_creds, &ca, &cert, &pkey, &server_url);
-    keyMngr_->loadKeys(&pkey, &cert, &ca);
-    boost::trim(server_url);
-    treehub_server = server_url;
+    // The Primary sends the same archive until the credentials change
+    const std::string archive_hash = Crypto::sha256digestHex(treehub_tls_creds);
+    if (archive_hash != creds_archive_hash_) {
+      creds_archive_hash_.clear();
+      extractCredentialsArchive(treehub_tls_creds, &ca_, &cert_, &pkey_, &treehub_server_);
+      boost::trim(treehub_server_);
+      creds_archive_hash_ = archive_hash;
+    }
+    keyMngr_->loadKeys(&pkey_, &cert_, &ca_);
+    treehub_server = treehub_server_;
   } catch (std::runtime_error& exc) {
     LOG_ERROR << exc.what();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
@@ -64,8 +69,8 @@ data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Targ
   std::chrono::milliseconds wait(500);
 
   for (; tries < max_tries; tries++) {
-    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target);
-    if (result.success) {
+    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target, token, progress_cb);
+    if (result.success || (token != nullptr && token->hasAborted())) {
       break;
     } else if (tries < max_tries - 1) {
       std::this_thread::sleep_for(wait);
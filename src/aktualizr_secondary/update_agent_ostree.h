@@ -1,6 +1,7 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 
+#include "libaktualizr/packagemanagerinterface.h"
 #include "update_agent.h"
 
 class OstreeManager;
@@ -18,7 +19,11 @@ class OstreeUpdateAgent : public UpdateAgent {
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
 
-  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds);
+  // `progress_cb` is given the percentage of the objects received so far.
+  // Aborting `token` stops the pull at the next progress report.
+  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds,
+                                             const api::FlowControlToken* token = nullptr,
+                                             const FetcherProgressCb& progress_cb = nullptr);
 
   data::InstallationResult install(const Uptane::Target& target) override;
 
@@ -31,6 +36,12 @@ class OstreeUpdateAgent : public UpdateAgent {
   std::shared_ptr<KeyManager> keyMngr_;
   std::shared_ptr<OstreeManager> ostreePackMan_;
   const ::std::string targetname_prefix_;
+  // The credentials last extracted, and the SHA-256 of the archive they came from
+  std::string creds_archive_hash_;
+  std::string ca_;
+  std::string cert_;
+  std::string pkey_;
+  std::string treehub_server_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
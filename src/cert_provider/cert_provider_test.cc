@@ -315,6 +315,50 @@ TEST_F(AktualizrCertProviderTest, DeviceCertParams) {
   ASSERT_EQ(openssl.lastStdOut(), str(boost::format("%1%: OK\n") % device_cred_path.certFileFullPath.string()));
 }
 
+/**
+ * Verifies generation of several credential bundles at once
+ *
+ * - [x] Generate the requested number of bundles in parallel
+ * - [x] Generate ECDSA device keys
+ * - [x] Derive the device IDs from the common name
+ * - [x] List the bundles in index.json
+ */
+TEST_F(AktualizrCertProviderTest, BulkGeneration) {
+  DeviceCredGenerator::ArgSet args;
+
+  args.fleetCA = test_args_.fleet_ca_cert;
+  args.fleetCAKey = test_args_.fleet_ca_private_key;
+  args.localDir = test_args_.test_dir;
+  args.commonName = "bulk";
+  args.keyType = "ecdsa";
+  args.bundleCount = "3";
+  args.jobs = "2";
+
+  device_cred_gen_.run(args);
+  ASSERT_EQ(device_cred_gen_.lastExitCode(), 0) << device_cred_gen_.lastStdErr();
+
+  const Json::Value index = Utils::parseJSONFile(boost::filesystem::path(test_args_.test_dir) / "index.json");
+  ASSERT_EQ(index.size(), 3);
+
+  Process openssl("/usr/bin/openssl");
+  for (Json::ArrayIndex i = 0; i < index.size(); ++i) {
+    const std::string number = std::to_string(i + 1);
+    EXPECT_EQ(index[i]["directory"].asString(), number);
+    EXPECT_EQ(index[i]["device_id"].asString(), "bulk-" + number);
+
+    DeviceCredGenerator::OutputPath device_cred_path((boost::filesystem::path(test_args_.test_dir) / number).string());
+    openssl.run({"ec", "-in", device_cred_path.privateKeyFileFullPath.string(), "-noout", "-check"});
+    ASSERT_EQ(openssl.lastExitCode(), 0) << openssl.lastStdErr();
+
+    Cert cert(device_cred_path.certFileFullPath.string());
+    EXPECT_EQ(cert.getSubjectItemValue(NID_commonName), "bulk-" + number);
+
+    openssl.run(
+        {"verify", "-verbose", "-CAfile", test_args_.fleet_ca_cert, device_cred_path.certFileFullPath.string()});
+    ASSERT_EQ(openssl.lastExitCode(), 0) << openssl.lastStdErr();
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
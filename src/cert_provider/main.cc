@@ -1,7 +1,11 @@
+#include <atomic>
 #include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -38,6 +42,7 @@ bpo::variables_map parseOptions(int argc, char** argv) {
       ("credentials,c", bpo::value<boost::filesystem::path>(), "zipped credentials file")
       ("fleet-ca", bpo::value<boost::filesystem::path>(), "path to fleet certificate authority certificate (for signing device certificates)")
       ("fleet-ca-key", bpo::value<boost::filesystem::path>(), "path to the private key of fleet certificate authority")
+      ("key-type", bpo::value<std::string>(), "type of the device key to generate: rsa (default), ecdsa (P-256) or ed25519")
       ("bits", bpo::value<int>(), "size of RSA keys in bits")
       ("days", bpo::value<int>(), "validity term for the certificate in days")
       ("certificate-c", bpo::value<std::string>(), "value for C field in certificate subject name")
@@ -50,6 +55,8 @@ bpo::variables_map parseOptions(int argc, char** argv) {
       ("root-ca,r", "provide root CA certificate")
       ("server-url,u", "provide server URL file")
       ("local,l", bpo::value<boost::filesystem::path>(), "local directory to write credentials to")
+      ("count,n", bpo::value<int>(), "generate this many credential bundles in numbered subdirectories of --local, listed in index.json (requires --fleet-ca)")
+      ("jobs,j", bpo::value<int>(), "number of credential bundles to generate at the same time, by default one per core")
       ("config,g", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory from which to get file names")
       ("skip-checks,s", "skip strict host key checking for ssh/scp commands");
   // clang-format on
@@ -151,6 +158,107 @@ void copyLocal(const boost::filesystem::path& src, const boost::filesystem::path
   boost::filesystem::copy_file(src, dest);
 }
 
+struct CertOptions {
+  Crypto::CertKeyType key_type{Crypto::CertKeyType::kRSA};
+  int rsa_bits{2048};
+  int days{365};
+  std::string c;
+  std::string st;
+  std::string o;
+};
+
+static Crypto::CertKeyType parseKeyType(const std::string& name) {
+  if (name == "rsa") {
+    return Crypto::CertKeyType::kRSA;
+  }
+  if (name == "ecdsa") {
+    return Crypto::CertKeyType::kECDSA;
+  }
+  if (name == "ed25519") {
+    return Crypto::CertKeyType::kED25519;
+  }
+  throw std::invalid_argument("Unknown key type (--key-type): " + name);
+}
+
+static void generateSignedCert(const CertOptions& options, const Crypto::CertificateAuthority& ca,
+                               const std::string& device_id, std::string* pkey, std::string* cert) {
+  StructGuard<EVP_PKEY> key = Crypto::generateCertKeyEVP(options.key_type, options.rsa_bits);
+  StructGuard<X509> certificate =
+      Crypto::generateCert(key.get(), options.days, options.c, options.st, options.o, device_id);
+  Crypto::signCert(ca, certificate.get());
+  Crypto::serializeCert(pkey, cert, certificate.get());
+}
+
+struct BundleLayout {
+  boost::filesystem::path directory;
+  utils::BasedPath pkey_file;
+  utils::BasedPath cert_file;
+  utils::BasedPath ca_file;
+  utils::BasedPath url_file;
+};
+
+/**
+ * Generate a credential bundle for each of `device_ids`, with `jobs` of them at a time. Bundle i is written to the
+ * subdirectory of `local_dir` named after i, with the same layout as a single --local bundle.
+ */
+static void generateBundles(const CertOptions& options, const Crypto::CertificateAuthority& ca,
+                            const std::vector<std::string>& device_ids, const boost::filesystem::path& local_dir,
+                            const BundleLayout& layout, const std::string& ca_contents, const std::string& server_url,
+                            unsigned int jobs) {
+  const size_t width = std::to_string(device_ids.size()).size();
+  std::vector<std::string> names(device_ids.size());
+  for (size_t i = 0; i < device_ids.size(); ++i) {
+    const std::string number = std::to_string(i + 1);
+    names[i] = std::string(width - number.size(), '0') + number;
+  }
+
+  std::atomic<size_t> next{0};
+  std::mutex errors_mutex;
+  std::string errors;
+  const auto worker = [&]() {
+    for (size_t i = next++; i < device_ids.size(); i = next++) {
+      try {
+        std::string pkey;
+        std::string cert;
+        generateSignedCert(options, ca, device_ids[i], &pkey, &cert);
+        const boost::filesystem::path bundle_dir = local_dir / names[i];
+        Utils::writeFile(bundle_dir / layout.pkey_file.get(layout.directory), pkey);
+        Utils::writeFile(bundle_dir / layout.cert_file.get(layout.directory), cert);
+        if (!ca_contents.empty()) {
+          Utils::writeFile(bundle_dir / layout.ca_file.get(layout.directory), ca_contents);
+        }
+        if (!server_url.empty()) {
+          Utils::writeFile(bundle_dir / layout.url_file.get(layout.directory), server_url);
+        }
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> guard(errors_mutex);
+        errors += names[i] + ": " + e.what() + "\n";
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < std::max(jobs, 1U); ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (!errors.empty()) {
+    throw std::runtime_error("Generating credential bundles failed:\n" + errors);
+  }
+
+  Json::Value index(Json::arrayValue);
+  for (size_t i = 0; i < device_ids.size(); ++i) {
+    Json::Value bundle;
+    bundle["directory"] = names[i];
+    bundle["device_id"] = device_ids[i];
+    index.append(bundle);
+  }
+  Utils::writeFile(local_dir / "index.json", index);
+}
+
 int main(int argc, char* argv[]) {
   int exit_code = EXIT_FAILURE;
 
@@ -221,6 +329,20 @@ int main(int argc, char* argv[]) {
       serverUrl = Bootstrap::readServerUrl(credentials_path);
     }
 
+    int bundle_count = 0;
+    if (commandline_map.count("count") != 0) {
+      bundle_count = commandline_map["count"].as<int>();
+      if (bundle_count <= 0) {
+        std::cerr << "The number of credential bundles (--count) should be positive" << std::endl;
+        return EXIT_FAILURE;
+      }
+      if (fleet_ca_path.empty() || local_dir.empty() || !target.empty()) {
+        std::cerr << "Credential bundles (--count) are generated with --fleet-ca into --local, without --target"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+
     std::string device_id;
     if (commandline_map.count("certificate-cn") != 0) {
       device_id = (commandline_map["certificate-cn"].as<std::string>());
@@ -228,11 +350,50 @@ int main(int argc, char* argv[]) {
         std::cerr << "Common name (device ID, --certificate-cn) can't be empty" << std::endl;
         return EXIT_FAILURE;
       }
-    } else {
+    } else if (bundle_count == 0) {
       device_id = Utils::genPrettyName();
       std::cout << "Random device ID is " << device_id << "\n";
     }
 
+    CertOptions cert_options;
+    if (!fleet_ca_path.empty()) {
+      if (commandline_map.count("key-type") != 0) {
+        cert_options.key_type = parseKeyType(commandline_map["key-type"].as<std::string>());
+      }
+
+      if (commandline_map.count("bits") != 0) {
+        cert_options.rsa_bits = (commandline_map["bits"].as<int>());
+      }
+
+      if (commandline_map.count("days") != 0) {
+        cert_options.days = (commandline_map["days"].as<int>());
+      }
+
+      if (commandline_map.count("certificate-c") != 0) {
+        cert_options.c = (commandline_map["certificate-c"].as<std::string>());
+        if (cert_options.c.length() != 2) {
+          std::cerr << "Country code (--certificate-c) should be 2 characters long" << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+
+      if (commandline_map.count("certificate-st") != 0) {
+        cert_options.st = (commandline_map["certificate-st"].as<std::string>());
+        if (cert_options.st.empty()) {
+          std::cerr << "State name (--certificate-st) can't be empty" << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+
+      if (commandline_map.count("certificate-o") != 0) {
+        cert_options.o = (commandline_map["certificate-o"].as<std::string>());
+        if (cert_options.o.empty()) {
+          std::cerr << "Organization name (--certificate-o) can't be empty" << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
     boost::filesystem::path directory = "/var/sota/import";
     utils::BasedPath pkey_file = utils::BasedPath("pkey.pem");
     utils::BasedPath cert_file = utils::BasedPath("client.pem");
@@ -275,6 +436,43 @@ int main(int argc, char* argv[]) {
       directory = commandline_map["directory"].as<boost::filesystem::path>();
     }
 
+    if (bundle_count > 0) {
+      std::vector<std::string> device_ids;
+      std::set<std::string> used_ids;
+      for (int i = 1; i <= bundle_count; ++i) {
+        if (!device_id.empty()) {
+          device_ids.push_back(device_id + "-" + std::to_string(i));
+        } else {
+          std::string random_id;
+          do {
+            random_id = Utils::genPrettyName();
+          } while (!used_ids.insert(random_id).second);
+          device_ids.push_back(random_id);
+        }
+      }
+
+      std::string ca;
+      if (provide_ca) {
+        ca = Bootstrap::readServerCa(credentials_path);
+        if (ca.empty()) {
+          ca = Bootstrap(credentials_path, "").getCa();
+        }
+      }
+
+      unsigned int jobs = std::thread::hardware_concurrency();
+      if (commandline_map.count("jobs") != 0) {
+        jobs = static_cast<unsigned int>(std::max(commandline_map["jobs"].as<int>(), 1));
+      }
+
+      std::cout << "Generating " << bundle_count << " credential bundles in " << local_dir << " ...\n";
+      const Crypto::CertificateAuthority fleet_ca = Crypto::loadCA(fleet_ca_path.native(), fleet_ca_key_path.native());
+      const BundleLayout layout{directory, pkey_file, cert_file, ca_file, url_file};
+      const std::string url = provide_url ? serverUrl : std::string();
+      generateBundles(cert_options, fleet_ca, device_ids, local_dir, layout, ca, url, jobs);
+      std::cout << "...success\n";
+      return EXIT_SUCCESS;
+    }
+
     TemporaryFile tmp_pkey_file(pkey_file.get("").filename().string());
     TemporaryFile tmp_cert_file(cert_file.get("").filename().string());
     TemporaryFile tmp_ca_file(ca_file.get("").filename().string());
@@ -313,47 +511,8 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
       }
     } else {  // fleet CA set => generate and sign a new certificate
-      int rsa_bits = 2048;
-      if (commandline_map.count("bits") != 0) {
-        rsa_bits = (commandline_map["bits"].as<int>());
-      }
-
-      int cert_days = 365;
-      if (commandline_map.count("days") != 0) {
-        cert_days = (commandline_map["days"].as<int>());
-      }
-
-      std::string newcert_c;
-      if (commandline_map.count("certificate-c") != 0) {
-        newcert_c = (commandline_map["certificate-c"].as<std::string>());
-        if (newcert_c.length() != 2) {
-          std::cerr << "Country code (--certificate-c) should be 2 characters long" << std::endl;
-          return EXIT_FAILURE;
-        }
-      }
-
-      std::string newcert_st;
-      if (commandline_map.count("certificate-st") != 0) {
-        newcert_st = (commandline_map["certificate-st"].as<std::string>());
-        if (newcert_st.empty()) {
-          std::cerr << "State name (--certificate-st) can't be empty" << std::endl;
-          return EXIT_FAILURE;
-        }
-      }
-
-      std::string newcert_o;
-      if (commandline_map.count("certificate-o") != 0) {
-        newcert_o = (commandline_map["certificate-o"].as<std::string>());
-        if (newcert_o.empty()) {
-          std::cerr << "Organization name (--certificate-o) can't be empty" << std::endl;
-          return EXIT_FAILURE;
-        }
-      }
-
-      StructGuard<X509> certificate =
-          Crypto::generateCert(rsa_bits, cert_days, newcert_c, newcert_st, newcert_o, device_id);
-      Crypto::signCert(fleet_ca_path.native(), fleet_ca_key_path.native(), certificate.get());
-      Crypto::serializeCert(&pkey, &cert, certificate.get());
+      generateSignedCert(cert_options, Crypto::loadCA(fleet_ca_path.native(), fleet_ca_key_path.native()), device_id,
+                         &pkey, &cert);
 
       if (provide_ca) {
         // Read server root CA from server_ca.pem in archive if found (to support
@@ -0,0 +1,223 @@
+#include "fleet_sim.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+
+#include "http/httpinterface.h"
+#include "libaktualizr/aktualizr.h"
+#include "logging/logging.h"
+#include "storage/invstorage.h"
+#include "utilities/utils.h"
+
+namespace {
+
+// Uses the constructor that takes the storage and HTTP client of the device
+class SimulatedDevice : public Aktualizr {
+ public:
+  SimulatedDevice(Config config, std::shared_ptr<INvStorage> storage, const std::shared_ptr<HttpInterface>& http)
+      : Aktualizr(std::move(config), std::move(storage), http) {}
+};
+
+}  // namespace
+
+FleetSim::FleetSim(Config base, FleetSimConfig sim, HttpFactory http_factory)
+    : base_{std::move(base)}, sim_{std::move(sim)}, http_factory_{std::move(http_factory)}, slots_(sim_.devices) {
+  if (sim_.workers == 0) {
+    throw std::invalid_argument("A fleet simulation needs at least one worker");
+  }
+}
+
+const char* FleetSim::operationName(Operation op) {
+  switch (op) {
+    case Operation::kStartup:
+      return "startup";
+    case Operation::kDeviceData:
+      return "device data";
+    case Operation::kUpdateCheck:
+      return "update check";
+    case Operation::kDownload:
+      return "download";
+    case Operation::kInstall:
+      return "install";
+    case Operation::kManifest:
+      return "manifest";
+    default:
+      return "unknown";
+  }
+}
+
+void FleetSim::run() {
+  const auto start = std::chrono::steady_clock::now();
+  const auto later = [this](size_t a, size_t b) { return slots_[a].due > slots_[b].due; };
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    deadline_ = start + sim_.duration;
+    stop_ = false;
+    remaining_ = slots_.size();
+    queue_.clear();
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      slots_[i].cycles = 0;
+      slots_[i].due = start + sim_.ramp_up * i / std::max<size_t>(slots_.size(), 1);
+      queue_.push_back(i);
+    }
+    std::make_heap(queue_.begin(), queue_.end(), later);
+  }
+  LOG_INFO << "Simulating " << slots_.size() << " devices with " << sim_.workers << " workers";
+
+  std::vector<std::thread> workers;
+  workers.reserve(sim_.workers);
+  for (size_t i = 0; i < sim_.workers; ++i) {
+    workers.emplace_back([this]() { work(); });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  elapsed_ = std::chrono::steady_clock::now() - start;
+}
+
+void FleetSim::stop() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  stop_ = true;
+  cv_.notify_all();
+}
+
+void FleetSim::work() {
+  const auto later = [this](size_t a, size_t b) { return slots_[a].due > slots_[b].due; };
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (stop_ || remaining_ == 0 || std::chrono::steady_clock::now() >= deadline_) {
+      break;
+    }
+    if (queue_.empty()) {
+      // Every device is being simulated by another worker
+      cv_.wait_until(lock, deadline_);
+      continue;
+    }
+    const size_t index = queue_.front();
+    if (slots_[index].due > std::chrono::steady_clock::now()) {
+      cv_.wait_until(lock, std::min(slots_[index].due, deadline_));
+      continue;
+    }
+    std::pop_heap(queue_.begin(), queue_.end(), later);
+    queue_.pop_back();
+    const bool first = slots_[index].cycles == 0;
+
+    lock.unlock();
+    simulate(index, first);
+    lock.lock();
+
+    Slot& slot = slots_[index];
+    ++slot.cycles;
+    if (sim_.cycles != 0 && slot.cycles >= sim_.cycles) {
+      --remaining_;
+    } else {
+      slot.due = std::chrono::steady_clock::now() + nextInterval();
+      queue_.push_back(index);
+      std::push_heap(queue_.begin(), queue_.end(), later);
+    }
+    cv_.notify_all();
+  }
+  cv_.notify_all();
+}
+
+std::chrono::steady_clock::duration FleetSim::nextInterval() {
+  const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(sim_.poll_interval);
+  std::uniform_real_distribution<double> jitter(0.9, 1.1);
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * jitter(gen_));
+}
+
+Config FleetSim::deviceConfig(size_t index) const {
+  Config config = base_;
+  const std::string name = sim_.device_prefix + std::to_string(index);
+  config.provision.device_id = name;
+  config.provision.primary_ecu_serial = name;
+  config.storage.path = sim_.storage_dir / name;
+  // A simulated device does not need to survive a power cut
+  config.storage.sqldb_synchronous = "off";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = config.storage.path / "images";
+  config.bootloader.reboot_sentinel_dir = config.storage.path;
+  config.uptane.update_lock_file = "";
+  config.uptane.secondary_config_file = "";
+  config.telemetry.metrics_file = "";
+  return config;
+}
+
+void FleetSim::record(Operation op, std::chrono::steady_clock::time_point start, bool ok) {
+  latencies_[static_cast<size_t>(op)].observe(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+  if (!ok) {
+    failures_[static_cast<size_t>(op)].add();
+  }
+}
+
+void FleetSim::simulate(size_t index, bool first) {
+  Config config = deviceConfig(index);
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<SimulatedDevice> device;
+  try {
+    auto storage = INvStorage::newStorage(config.storage);
+    device = std_::make_unique<SimulatedDevice>(config, storage, http_factory_(index));
+    device->Initialize();
+    record(Operation::kStartup, start, true);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Device " << config.provision.device_id << " failed to start: " << e.what();
+    record(Operation::kStartup, start, false);
+    return;
+  }
+
+  try {
+    if (first) {
+      start = std::chrono::steady_clock::now();
+      device->SendDeviceData().get();
+      record(Operation::kDeviceData, start, true);
+    }
+
+    start = std::chrono::steady_clock::now();
+    const result::UpdateCheck check = device->CheckUpdates().get();
+    record(Operation::kUpdateCheck, start, check.status != result::UpdateStatus::kError);
+    if (!sim_.install || check.status != result::UpdateStatus::kUpdatesAvailable) {
+      return;
+    }
+
+    start = std::chrono::steady_clock::now();
+    const result::Download download = device->Download(check.updates).get();
+    record(Operation::kDownload, start, download.status == result::DownloadStatus::kSuccess);
+    if (download.status != result::DownloadStatus::kSuccess) {
+      return;
+    }
+
+    start = std::chrono::steady_clock::now();
+    const result::Install install = device->Install(download.updates).get();
+    record(Operation::kInstall, start, install.dev_report.isSuccess());
+
+    start = std::chrono::steady_clock::now();
+    const bool sent = device->SendManifest().get();
+    record(Operation::kManifest, start, sent);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Update cycle of device " << config.provision.device_id << " failed: " << e.what();
+  }
+}
+
+void FleetSim::report(std::ostream& os) const {
+  const double seconds = std::chrono::duration<double>(elapsed_).count();
+  os << "Simulated " << slots_.size() << " devices for " << std::fixed << std::setprecision(1) << seconds << " s\n";
+  os << std::left << std::setw(14) << "operation" << std::right << std::setw(9) << "count" << std::setw(9)
+     << "failed" << std::setw(9) << "per s" << std::setw(11) << "mean ms" << std::setw(11) << "p50 ms"
+     << std::setw(11) << "p90 ms" << std::setw(11) << "p99 ms" << "\n";
+  for (size_t i = 0; i < static_cast<size_t>(Operation::kCount); ++i) {
+    const MetricHistogram& latency = latencies_[i];
+    const uint64_t count = latency.count();
+    if (count == 0) {
+      continue;
+    }
+    // Quantiles are the upper bounds of histogram buckets
+    const auto ms = [](int64_t us) { return static_cast<double>(us) / 1000.0; };
+    os << std::left << std::setw(14) << operationName(static_cast<Operation>(i)) << std::right << std::setw(9)
+       << count << std::setw(9) << failures_[i].value() << std::setw(9)
+       << (seconds > 0 ? static_cast<double>(count) / seconds : 0.0) << std::setw(11)
+       << ms(static_cast<int64_t>(latency.sumUs() / count)) << std::setw(11) << ms(latency.quantileUs(0.5))
+       << std::setw(11) << ms(latency.quantileUs(0.9)) << std::setw(11) << ms(latency.quantileUs(0.99)) << "\n";
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef FLEET_SIM_H_
+#define FLEET_SIM_H_
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/metrics.h"
+
+class HttpInterface;
+
+struct FleetSimConfig {
+  size_t devices{100};
+  // Devices that talk to the server at the same time
+  size_t workers{16};
+  // Mean time between two update checks of a device; each one is jittered by up to 10%
+  std::chrono::milliseconds poll_interval{std::chrono::seconds(30)};
+  // The first update check of the devices is spread over this time
+  std::chrono::milliseconds ramp_up{std::chrono::seconds(10)};
+  // Stop after this time, or after `cycles` update checks of every device if that is not 0
+  std::chrono::milliseconds duration{std::chrono::minutes(5)};
+  unsigned int cycles{0};
+  // Download and install the updates that are found
+  bool install{true};
+  std::string device_prefix{"fleet-sim-"};
+  // Each device keeps its storage in a directory of its own below it. A tmpfs keeps it in memory.
+  boost::filesystem::path storage_dir{"/dev/shm/fleet-sim"};
+};
+
+/**
+ * Runs many simulated devices in one process to load a server with the
+ * requests of a fleet. Each device has its own credentials, fake package
+ * manager and storage below `FleetSimConfig::storage_dir`. A fixed number of
+ * workers take turns with the devices that are due: for every update cycle, a
+ * worker starts an Aktualizr for the device, checks for updates, installs them
+ * and shuts it down again, so that the number of threads does not grow with
+ * the fleet. All HttpClients share one connection cache.
+ */
+class FleetSim {
+ public:
+  enum class Operation { kStartup = 0, kDeviceData, kUpdateCheck, kDownload, kInstall, kManifest, kCount };
+
+  /** Makes the HTTP client of device `index`. */
+  using HttpFactory = std::function<std::shared_ptr<HttpInterface>(size_t index)>;
+
+  /**
+   * Every device uses `base` with its own device ID, ECU serial and storage.
+   * Provisioning credentials are shared by all of them.
+   */
+  FleetSim(Config base, FleetSimConfig sim, HttpFactory http_factory);
+  ~FleetSim() = default;
+  FleetSim(const FleetSim&) = delete;
+  FleetSim(FleetSim&&) = delete;
+  FleetSim& operator=(const FleetSim&) = delete;
+  FleetSim& operator=(FleetSim&&) = delete;
+
+  /** Simulate the fleet until the duration has passed, all cycles are done or stop() is called. */
+  void run();
+  /** Make run() return as soon as the operations in progress have finished. */
+  void stop();
+
+  const MetricHistogram& latency(Operation op) const { return latencies_[static_cast<size_t>(op)]; }
+  uint64_t failures(Operation op) const { return failures_[static_cast<size_t>(op)].value(); }
+  /** Wall-clock time of the last run(). */
+  std::chrono::steady_clock::duration elapsed() const { return elapsed_; }
+
+  /** Count, rate, failures and latency quantiles of every operation. */
+  void report(std::ostream& os) const;
+
+  static const char* operationName(Operation op);
+
+ private:
+  struct Slot {
+    std::chrono::steady_clock::time_point due;
+    unsigned int cycles{0};
+  };
+
+  void work();
+  void simulate(size_t index, bool first);
+  void record(Operation op, std::chrono::steady_clock::time_point start, bool ok);
+  Config deviceConfig(size_t index) const;
+  std::chrono::steady_clock::duration nextInterval();
+
+  const Config base_;
+  const FleetSimConfig sim_;
+  const HttpFactory http_factory_;
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Devices not being simulated right now, ordered by `Slot::due` as a min heap
+  std::vector<size_t> queue_;
+  size_t remaining_{0};
+  std::chrono::steady_clock::time_point deadline_;
+  bool stop_{false};
+  std::mt19937 gen_{std::random_device{}()};
+
+  std::array<MetricHistogram, static_cast<size_t>(Operation::kCount)> latencies_{};
+  std::array<MetricCounter, static_cast<size_t>(Operation::kCount)> failures_{};
+  std::chrono::steady_clock::duration elapsed_{};
+};
+
+#endif  // FLEET_SIM_H_
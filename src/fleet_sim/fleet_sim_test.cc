@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "fleet_sim.h"
+#include "httpfake.h"
+#include "logging/logging.h"
+#include "metafake.h"
+#include "uptane_test_common.h"
+#include "utilities/utils.h"
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+boost::filesystem::path fake_meta_dir;
+
+/* Every device starts, sends its device data once and checks for updates in each cycle. */
+TEST(FleetSim, Cycles) {
+  TemporaryDirectory temp_dir;
+  const Config conf = UptaneTestCommon::makeTestConfig(temp_dir, HttpFake(temp_dir.Path()).tls_server);
+
+  FleetSimConfig sim;
+  sim.devices = 5;
+  sim.workers = 2;
+  sim.poll_interval = std::chrono::milliseconds(10);
+  sim.ramp_up = std::chrono::milliseconds(10);
+  sim.duration = std::chrono::minutes(1);
+  sim.cycles = 2;
+  sim.storage_dir = temp_dir / "fleet";
+  FleetSim fleet(conf, sim, [&temp_dir](size_t index) {
+    const boost::filesystem::path dir = temp_dir / ("http" + std::to_string(index));
+    boost::filesystem::create_directories(dir);
+    return std::make_shared<HttpFake>(dir, "noupdates", fake_meta_dir);
+  });
+  fleet.run();
+
+  EXPECT_EQ(fleet.latency(FleetSim::Operation::kStartup).count(), 10);
+  EXPECT_EQ(fleet.latency(FleetSim::Operation::kDeviceData).count(), 5);
+  EXPECT_EQ(fleet.latency(FleetSim::Operation::kUpdateCheck).count(), 10);
+  EXPECT_EQ(fleet.latency(FleetSim::Operation::kDownload).count(), 0);
+  EXPECT_EQ(fleet.failures(FleetSim::Operation::kStartup), 0);
+  EXPECT_EQ(fleet.failures(FleetSim::Operation::kUpdateCheck), 0);
+  for (size_t i = 0; i < sim.devices; ++i) {
+    EXPECT_TRUE(boost::filesystem::exists(sim.storage_dir / ("fleet-sim-" + std::to_string(i)) / "sql.db"));
+  }
+
+  std::stringstream report;
+  fleet.report(report);
+  EXPECT_NE(report.str().find("update check"), std::string::npos);
+  EXPECT_EQ(report.str().find("download"), std::string::npos);
+}
+
+/* A simulation without a limit of cycles ends with its duration. */
+TEST(FleetSim, Duration) {
+  TemporaryDirectory temp_dir;
+  const Config conf = UptaneTestCommon::makeTestConfig(temp_dir, HttpFake(temp_dir.Path()).tls_server);
+
+  FleetSimConfig sim;
+  sim.devices = 2;
+  sim.workers = 1;
+  sim.poll_interval = std::chrono::milliseconds(50);
+  sim.ramp_up = std::chrono::milliseconds(0);
+  sim.duration = std::chrono::milliseconds(500);
+  sim.storage_dir = temp_dir / "fleet";
+  FleetSim fleet(conf, sim, [&temp_dir](size_t index) {
+    const boost::filesystem::path dir = temp_dir / ("http" + std::to_string(index));
+    boost::filesystem::create_directories(dir);
+    return std::make_shared<HttpFake>(dir, "noupdates", fake_meta_dir);
+  });
+  fleet.run();
+
+  EXPECT_GE(fleet.elapsed(), std::chrono::milliseconds(500));
+  EXPECT_GE(fleet.latency(FleetSim::Operation::kUpdateCheck).count(), 2);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  TemporaryDirectory tmp_dir;
+  fake_meta_dir = tmp_dir.Path();
+  CreateFakeRepoMetaData(fake_meta_dir);
+
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,95 @@
+#include <unistd.h>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "fleet_sim.h"
+#include "http/httpclient.h"
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/aktualizr_version.h"
+
+namespace bpo = boost::program_options;
+
+void check_info_options(const bpo::options_description &description, const bpo::variables_map &vm) {
+  if (vm.count("help") != 0 || (vm.count("config") == 0 && vm.count("version") == 0)) {
+    std::cout << description << '\n';
+    exit(EXIT_SUCCESS);
+  }
+  if (vm.count("version") != 0) {
+    std::cout << "Current fleet-sim version is: " << aktualizr_version() << "\n";
+    exit(EXIT_SUCCESS);
+  }
+}
+
+bpo::variables_map parse_options(int argc, char **argv) {
+  bpo::options_description description(
+      "Simulate a fleet of devices in one process to load test a server, and report the latency and throughput of "
+      "their requests. All devices use the given configuration, which must provision them with shared credentials.");
+  // clang-format off
+  description.add_options()
+      ("help,h", "print usage")
+      ("version,v", "Current fleet-sim version")
+      ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory of the devices, mandatory")
+      ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
+      ("devices,n", bpo::value<size_t>()->default_value(100), "number of devices")
+      ("jobs,j", bpo::value<size_t>()->default_value(16), "number of devices that talk to the server at the same time")
+      ("poll-interval", bpo::value<double>()->default_value(30), "mean seconds between two update checks of a device")
+      ("ramp-up", bpo::value<double>()->default_value(10), "seconds over which the first update checks are spread")
+      ("duration", bpo::value<double>()->default_value(300), "seconds to run for")
+      ("cycles", bpo::value<unsigned int>()->default_value(0), "stop after this many update checks of each device, 0 for no limit")
+      ("no-install", "only check for updates")
+      ("device-prefix", bpo::value<std::string>()->default_value("fleet-sim-"), "device ID and ECU serial prefix of the devices")
+      ("storage-dir", bpo::value<boost::filesystem::path>()->default_value("/dev/shm/fleet-sim"), "directory for the storage of the devices");
+  // clang-format on
+
+  bpo::variables_map vm;
+  try {
+    bpo::basic_parsed_options<char> parsed_options = bpo::command_line_parser(argc, argv).options(description).run();
+    bpo::store(parsed_options, vm);
+    check_info_options(description, vm);
+    bpo::notify(vm);
+  } catch (const bpo::error &ex) {
+    std::cout << ex.what() << std::endl;
+    std::cout << description;
+    exit(EXIT_FAILURE);
+  }
+
+  return vm;
+}
+
+std::chrono::milliseconds seconds(const bpo::variables_map &vm, const char *name) {
+  return std::chrono::milliseconds(static_cast<int64_t>(vm[name].as<double>() * 1000));
+}
+
+int main(int argc, char *argv[]) {
+  logger_init(isatty(1) == 1);
+  logger_set_threshold(boost::log::trivial::info);
+
+  bpo::variables_map commandline_map = parse_options(argc, argv);
+
+  int r = EXIT_FAILURE;
+  try {
+    Config config(commandline_map);
+    FleetSimConfig sim;
+    sim.devices = commandline_map["devices"].as<size_t>();
+    sim.workers = commandline_map["jobs"].as<size_t>();
+    sim.poll_interval = seconds(commandline_map, "poll-interval");
+    sim.ramp_up = seconds(commandline_map, "ramp-up");
+    sim.duration = seconds(commandline_map, "duration");
+    sim.cycles = commandline_map["cycles"].as<unsigned int>();
+    sim.install = commandline_map.count("no-install") == 0;
+    sim.device_prefix = commandline_map["device-prefix"].as<std::string>();
+    sim.storage_dir = commandline_map["storage-dir"].as<boost::filesystem::path>();
+
+    // All HttpClients of the process share one connection cache
+    FleetSim fleet(config, sim, [](size_t) { return std::make_shared<HttpClient>(); });
+    fleet.run();
+    fleet.report(std::cout);
+    r = EXIT_SUCCESS;
+  } catch (const std::exception &ex) {
+    LOG_ERROR << ex.what();
+  }
+  return r;
+}
@@ -1,5 +1,10 @@
 #include "libaktualizr-c.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
 #include <fstream>
+#include <mutex>
 
 #include "libaktualizr/events.h"
 #include "utilities/utils.h"
@@ -68,6 +73,40 @@ int Aktualizr_set_signal_handler(Aktualizr *a, void (*handler)(const char *event
   return 0;
 }
 
+namespace {
+struct ProgressStepFilter {
+  std::mutex m;
+  unsigned int passed{0};
+};
+}  // namespace
+
+int Aktualizr_set_signal_handler_progress_step(Aktualizr *a, void (*handler)(const char *event_name),
+                                               unsigned int progress_step) {
+  try {
+    auto filter = std::make_shared<ProgressStepFilter>();
+    auto functor = [handler, progress_step, filter](const std::shared_ptr<event::BaseEvent> &event) {
+      if (event->isTypeOf<event::AllDownloadsComplete>()) {
+        std::lock_guard<std::mutex> guard(filter->m);
+        filter->passed = 0;
+      } else if (event->isTypeOf<event::DownloadProgressReport>() && progress_step > 1) {
+        const auto &report = dynamic_cast<const event::DownloadProgressReport &>(*event);
+        const unsigned int step = report.overall_progress / progress_step * progress_step;
+        std::lock_guard<std::mutex> guard(filter->m);
+        if (step <= filter->passed && !event::DownloadProgressReport::isDownloadCompleted(report)) {
+          return;
+        }
+        filter->passed = std::max(filter->passed, step);
+      }
+      handler_wrapper(event, handler);
+    };
+    a->SetSignalHandler(functor);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_set_signal_handler_progress_step exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
 Campaign *Aktualizr_campaigns_check(Aktualizr *a) {
   try {
     auto r = a->CampaignCheck().get();
@@ -233,6 +272,199 @@ int Aktualizr_close_stored_target(StorageTargetHandle *handle) {
   }
 }
 
+CompletionQueue *Aktualizr_completion_queue_create() {
+  try {
+    return new CompletionQueue(std::make_shared<api::CompletionQueue>());
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_completion_queue_create exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+int Aktualizr_completion_queue_fd(CompletionQueue *q) { return (q == nullptr) ? -1 : (*q)->fd(); }
+
+int Aktualizr_completion_queue_dispatch(CompletionQueue *q) {
+  if (q == nullptr) {
+    std::cerr << "Aktualizr_completion_queue_dispatch failed: no queue" << std::endl;
+    return -1;
+  }
+  return static_cast<int>((*q)->dispatch());
+}
+
+// Completions still in flight keep the queue itself alive
+void Aktualizr_completion_queue_destroy(CompletionQueue *q) { delete q; }
+
+int Aktualizr_set_signal_handler_queued(Aktualizr *a, CompletionQueue *q, void (*handler)(const char *event_name)) {
+  try {
+    auto functor = std::bind(handler_wrapper, std::placeholders::_1, handler);
+    a->SetSignalHandler(functor, *q);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_set_signal_handler_queued exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int Aktualizr_updates_check_async(Aktualizr *a, CompletionQueue *q, void (*done)(Updates *u, void *user_data),
+                                  void *user_data) {
+  try {
+    a->CheckUpdates(*q, [done, user_data](std::future<result::UpdateCheck> f) {
+      Updates *updates = nullptr;
+      try {
+        auto r = f.get();
+        updates = (!r.updates.empty()) ? new Updates(std::move(r.updates)) : nullptr;
+      } catch (const std::exception &e) {
+        std::cerr << "Update check exception: " << e.what() << std::endl;
+      }
+      done(updates, user_data);
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_updates_check_async exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Calls `done` with 0 if the future holds a result, or -1 if it holds an exception
+template <class R>
+static Aktualizr::Completion<R> status_completion(const char *name, void (*done)(int result, void *user_data),
+                                                  void *user_data) {
+  return [name, done, user_data](std::future<R> f) {
+    int result = 0;
+    try {
+      f.get();
+    } catch (const std::exception &e) {
+      std::cerr << name << " exception: " << e.what() << std::endl;
+      result = -1;
+    }
+    done(result, user_data);
+  };
+}
+
+int Aktualizr_download_target_async(Aktualizr *a, Target *t, CompletionQueue *q,
+                                    void (*done)(int result, void *user_data), void *user_data) {
+  try {
+    a->Download(std::vector<Uptane::Target>({*t}), *q,
+                status_completion<result::Download>("Download", done, user_data));
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_download_target_async exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int Aktualizr_install_target_async(Aktualizr *a, Target *t, CompletionQueue *q,
+                                   void (*done)(int result, void *user_data), void *user_data) {
+  try {
+    a->Install(std::vector<Uptane::Target>({*t}), *q, status_completion<result::Install>("Install", done, user_data));
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_install_target_async exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int Aktualizr_send_manifest_async(Aktualizr *a, const char *manifest, CompletionQueue *q,
+                                  void (*done)(int result, void *user_data), void *user_data) {
+  try {
+    Json::Value custom = Utils::parseJSON(manifest);
+    a->SendManifest(custom, *q, [done, user_data](std::future<bool> f) {
+      int result = -1;
+      try {
+        result = f.get() ? 0 : -1;
+      } catch (const std::exception &e) {
+        std::cerr << "Send manifest exception: " << e.what() << std::endl;
+      }
+      done(result, user_data);
+    });
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_send_manifest_async exception: " << e.what() << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int Aktualizr_open_stored_target_fd(Aktualizr *a, const Target *t, Stored_Target_C *st) {
+  if (t == nullptr || st == nullptr) {
+    std::cerr << "Aktualizr_open_stored_target_fd failed: invalid input" << std::endl;
+    return -1;
+  }
+
+  try {
+    const std::string sha256 = t->sha256Hash();
+    if (sha256.size() >= sizeof(st->sha256)) {
+      std::cerr << "Aktualizr_open_stored_target_fd failed: invalid SHA256 hash" << std::endl;
+      return -1;
+    }
+    st->fd = a->OpenStoredTargetFd(*t);
+    st->length = t->length();
+    std::copy(sha256.begin(), sha256.end(), st->sha256);
+    st->sha256[sha256.size()] = '\0';
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_open_stored_target_fd exception: " << e.what() << std::endl;
+    return -1;
+  }
+}
+
+int64_t Aktualizr_pread_stored_target(const Stored_Target_C *st, uint8_t *buf, size_t size, uint64_t offset) {
+  if (st == nullptr || buf == nullptr) {
+    std::cerr << "Aktualizr_pread_stored_target failed: invalid input" << std::endl;
+    return -1;
+  }
+  // Fill the whole buffer unless the end of the target comes first
+  size_t total = 0;
+  while (total < size && offset + total < st->length) {
+    const ssize_t n = pread(st->fd, buf + total, size - total, static_cast<off_t>(offset + total));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      std::cerr << "Aktualizr_pread_stored_target failed: " << std::strerror(errno) << std::endl;
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += static_cast<size_t>(n);
+  }
+  return static_cast<int64_t>(total);
+}
+
+const uint8_t *Aktualizr_map_stored_target(const Stored_Target_C *st) {
+  if (st == nullptr || st->length == 0) {
+    std::cerr << "Aktualizr_map_stored_target failed: nothing to map" << std::endl;
+    return nullptr;
+  }
+  void *map = mmap(nullptr, st->length, PROT_READ, MAP_SHARED, st->fd, 0);
+  if (map == MAP_FAILED) {
+    std::cerr << "Aktualizr_map_stored_target failed: " << std::strerror(errno) << std::endl;
+    return nullptr;
+  }
+  // Targets are usually read once from start to end
+  madvise(map, st->length, MADV_SEQUENTIAL);
+  return static_cast<const uint8_t *>(map);
+}
+
+int Aktualizr_unmap_stored_target(const Stored_Target_C *st, const uint8_t *map) {
+  if (st == nullptr || map == nullptr) {
+    std::cerr << "Aktualizr_unmap_stored_target failed: invalid input" << std::endl;
+    return -1;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  return munmap(const_cast<uint8_t *>(map), st->length);
+}
+
+int Aktualizr_close_stored_target_fd(Stored_Target_C *st) {
+  if (st == nullptr || st->fd < 0) {
+    std::cerr << "Aktualizr_close_stored_target_fd failed: no open target" << std::endl;
+    return -1;
+  }
+  const int res = close(st->fd);
+  st->fd = -1;
+  return res;
+}
+
 static Pause_Status_C get_Pause_Status_C(result::PauseStatus in) {
   switch (in) {
     case result::PauseStatus::kSuccess: {
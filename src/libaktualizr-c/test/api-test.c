@@ -1,3 +1,4 @@
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,12 +35,16 @@ static void signal_handler(const char *event_name) {
   }
 }
 
+static void async_done(int result, void *user_data) { *(int *)user_data = result; }
+
 int main(int argc, char **argv) {
   Aktualizr *a;
   Campaign *c;
   Updates *u;
   Target *t;
   Config *cfg;
+  CompletionQueue *q;
+  int async_result;
   int err;
 
   if (argc < 3) {
@@ -180,6 +185,32 @@ int main(int argc, char **argv) {
       printf("Aktualizr_close_stored_target failed\n");
       CLEANUP_AND_RETURN_FAILED;
     }
+
+    Stored_Target_C stored;
+    err = Aktualizr_open_stored_target_fd(a, t, &stored);
+    if (err || stored.length == 0 || strlen(stored.sha256) != 64) {
+      printf("Aktualizr_open_stored_target_fd failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    buf = malloc(stored.length);
+    int64_t read_size = Aktualizr_pread_stored_target(&stored, buf, stored.length, 0);
+    const uint8_t *map = Aktualizr_map_stored_target(&stored);
+    if (read_size != (int64_t)stored.length || map == NULL || memcmp(buf, map, stored.length) != 0) {
+      printf("Aktualizr_pread_stored_target and Aktualizr_map_stored_target disagree\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    free(buf);
+    buf = NULL;
+    if (Aktualizr_pread_stored_target(&stored, (uint8_t *)&read_size, 1, stored.length) != 0) {
+      printf("Aktualizr_pread_stored_target read past the end\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    err = Aktualizr_unmap_stored_target(&stored, map);
+    err |= Aktualizr_close_stored_target_fd(&stored);
+    if (err) {
+      printf("Aktualizr_close_stored_target_fd failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
   }
 
 #if 0
@@ -196,6 +227,27 @@ int main(int argc, char **argv) {
     CLEANUP_AND_RETURN_FAILED;
   }
 
+  q = Aktualizr_completion_queue_create();
+  if (q == NULL) {
+    printf("Aktualizr_completion_queue_create failed\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  async_result = 1;
+  err = Aktualizr_send_manifest_async(a, "({\"test_field\":\"test_value\"})", q, &async_done, &async_result);
+  while (!err && async_result == 1) {
+    struct pollfd pfd = {Aktualizr_completion_queue_fd(q), POLLIN, 0};
+    if (poll(&pfd, 1, 10000) != 1) {
+      printf("Aktualizr_send_manifest_async did not complete\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    Aktualizr_completion_queue_dispatch(q);
+  }
+  Aktualizr_completion_queue_destroy(q);
+  if (err || async_result != 0) {
+    printf("Aktualizr_send_manifest_async failed\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+
   err = Aktualizr_send_device_data(a);
   if (err) {
     printf("Aktualizr_send_device_data failed\n");
@@ -2,10 +2,17 @@
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#include <limits>
+#include <vector>
 
 #include "asn1_message.h"
 #include "logging/logging.h"
+#include "logging/metrics.h"
+#include "logging/tracing.h"
 #include "utilities/dequeue_buffer.h"
+#include "utilities/fault_injection.h"
 #include "utilities/utils.h"
 
 #ifndef MSG_NOSIGNAL
@@ -14,7 +21,7 @@
 
 int Asn1StringAppendCallback(const void* buffer, size_t size, void* priv) {
   auto* out_str = static_cast<std::string*>(priv);
-  out_str->append(std::string(static_cast<const char*>(buffer), size));
+  out_str->append(static_cast<const char*>(buffer), size);
   return 0;
 }
 
@@ -52,32 +59,295 @@ void SetString(OCTET_STRING_t* dest, const std::string& str) {
   OCTET_STRING_fromBuf(dest, str.c_str(), static_cast<int>(str.size()));
 }
 
-Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
-  der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1SocketWriteCallback, &con_fd);
+namespace {
+
+// The DER identifier octets of the parts of an uploadDataReq. The module uses
+// explicit tagging, so each context tag is constructed and wraps the field.
+constexpr uint8_t kUploadDataReqTag = 0xAA;  // [10]
+constexpr uint8_t kSequenceTag = 0x30;
+constexpr uint8_t kOctetStringTag = 0x04;
+constexpr uint8_t kIntegerTag = 0x02;
+constexpr uint8_t kEnumeratedTag = 0x0A;
+constexpr uint8_t kOffsetTag = 0xA0;       // [0]
+constexpr uint8_t kCompressionTag = 0xA1;  // [1]
+
+uint8_t ByteAt(const char* buf, size_t pos) {
+  return static_cast<uint8_t>(buf[pos]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+void AppendDerLength(std::string* out, size_t len) {
+  if (len < 0x80) {
+    out->push_back(static_cast<char>(len));
+    return;
+  }
+  std::string bytes;
+  for (; len > 0; len >>= 8U) {
+    bytes.insert(bytes.begin(), static_cast<char>(len & 0xFFU));
+  }
+  out->push_back(static_cast<char>(0x80U | bytes.size()));
+  out->append(bytes);
+}
 
-  // Bounce TCP_NODELAY to flush the TCP send buffer
+// A non-negative INTEGER or ENUMERATED, wrapped in the explicit tag of its field
+void AppendDerUnsigned(std::string* out, uint8_t field_tag, uint8_t tag, uint64_t value) {
+  std::string content;
+  do {
+    content.insert(content.begin(), static_cast<char>(value & 0xFFU));
+    value >>= 8U;
+  } while (value > 0);
+  if ((static_cast<uint8_t>(content[0]) & 0x80U) != 0) {
+    content.insert(content.begin(), '\0');  // Otherwise it would read as negative
+  }
+  out->push_back(static_cast<char>(field_tag));
+  AppendDerLength(out, content.size() + 2);
+  out->push_back(static_cast<char>(tag));
+  AppendDerLength(out, content.size());
+  out->append(content);
+}
+
+/**
+ * Read the identifier and length of the TLV at buf[*pos] and move *pos to its
+ * contents. Returns 0 if buf ends first, and -1 if the identifier is not
+ * `tag` or the length is indefinite or larger than we would ever buffer.
+ */
+int ReadDerHeader(const char* buf, size_t size, size_t* pos, uint8_t tag, size_t* len) {
+  size_t p = *pos;
+  if (p >= size) {
+    return 0;
+  }
+  if (ByteAt(buf, p++) != tag) {
+    return -1;
+  }
+  if (p >= size) {
+    return 0;
+  }
+  const uint8_t first = ByteAt(buf, p++);
+  size_t l = first;
+  if (first >= 0x80) {
+    const size_t len_bytes = first & 0x7FU;
+    if (len_bytes == 0 || len_bytes > sizeof(uint32_t)) {
+      return -1;
+    }
+    if (p + len_bytes > size) {
+      return 0;
+    }
+    l = 0;
+    for (size_t i = 0; i < len_bytes; ++i) {
+      l = (l << 8U) | ByteAt(buf, p++);
+    }
+  }
+  if (l > std::numeric_limits<size_t>::max() - p) {
+    return -1;
+  }
+  *pos = p;
+  *len = l;
+  return 1;
+}
+
+// Read a field written by AppendDerUnsigned() that ends no later than `end`
+bool ReadDerUnsigned(const char* buf, size_t end, size_t* pos, uint8_t field_tag, uint8_t tag, uint64_t* value) {
+  size_t field_len = 0;
+  size_t len = 0;
+  if (ReadDerHeader(buf, end, pos, field_tag, &field_len) != 1 || *pos + field_len > end) {
+    return false;
+  }
+  const size_t field_end = *pos + field_len;
+  if (ReadDerHeader(buf, field_end, pos, tag, &len) != 1 || *pos + len != field_end) {
+    return false;
+  }
+  // Negative values, and values too large for a long, are left to ber_decode()
+  if (len == 0 || len > sizeof(long) || (ByteAt(buf, *pos) & 0x80U) != 0) {  // NOLINT(google-runtime-int)
+    return false;
+  }
+  uint64_t v = 0;
+  for (; *pos < field_end; ++*pos) {
+    v = (v << 8U) | ByteAt(buf, *pos);
+  }
+  *value = v;
+  return true;
+}
+
+bool SendAll(int con_fd, std::vector<iovec> iov) {
+  size_t total = 0;
+  for (const auto& v : iov) {
+    total += v.iov_len;
+  }
+  fault_injection_throttle("secondary_send", total);
+  size_t first = 0;
+  while (first < iov.size()) {
+    msghdr hdr{};
+    hdr.msg_iov = &iov[first];
+    hdr.msg_iovlen = iov.size() - first;
+    ssize_t written = sendmsg(con_fd, &hdr, MSG_NOSIGNAL);
+    if (written < 0) {
+      LOG_ERROR << "write: " << std::strerror(errno);
+      return false;
+    }
+    auto left = static_cast<size_t>(written);
+    while (first < iov.size() && left >= iov[first].iov_len) {
+      left -= iov[first].iov_len;
+      ++first;
+    }
+    if (first < iov.size()) {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+      iov[first].iov_len -= left;
+    }
+  }
+  return true;
+}
+
+// Bounce TCP_NODELAY to flush the TCP send buffer
+void FlushSocket(int con_fd) {
   int no_delay = 1;
   setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
   no_delay = 0;
   setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+}
+
+}  // namespace
 
+Asn1Message::Ptr Asn1Message::FromUploadData(const Asn1UploadData& upload) {
+  Asn1Message::Ptr msg(new Asn1Message());
+  msg->present(AKIpUptaneMes_PR_uploadDataReq);
+  auto m = msg->uploadDataReq();
+  m->data.buf = const_cast<uint8_t*>(upload.data);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+  m->data.size = static_cast<int>(upload.size);
+  msg->borrowed_data_ = true;
+  if (upload.has_offset) {
+    m->offset = Asn1Allocation<long>();              // NOLINT(google-runtime-int)
+    *m->offset = static_cast<long>(upload.offset);  // NOLINT(google-runtime-int)
+  }
+  if (upload.has_compression) {
+    m->compression = Asn1Allocation<AKCompression_t>();
+    *m->compression = upload.compression;
+  }
+  return msg;
+}
+
+std::string Asn1Encode(const Asn1Message::Ptr& tx) {
+  std::string out;
+  asn_enc_rval_t res = der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1StringAppendCallback, &out);
+  if (res.encoded == -1) {
+    out.clear();
+  }
+  return out;
+}
+
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd) {
+  // Encode into memory first: der_encode() emits each TLV separately, and
+  // handing those straight to the socket costs a send() per field.
+  std::string out = Asn1Encode(tx);
+  return !out.empty() && Asn1Send(out, con_fd);
+}
+
+bool Asn1Send(const std::string& encoded, int con_fd) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  bool sent = SendAll(con_fd, {{const_cast<char*>(encoded.data()), encoded.size()}});
+  FlushSocket(con_fd);
+  return sent;
+}
+
+bool Asn1SendUploadData(const Asn1UploadData& upload, int con_fd) {
+  std::string fields;
+  if (upload.has_offset) {
+    AppendDerUnsigned(&fields, kOffsetTag, kIntegerTag, upload.offset);
+  }
+  if (upload.has_compression) {
+    AppendDerUnsigned(&fields, kCompressionTag, kEnumeratedTag, static_cast<uint64_t>(upload.compression));
+  }
+  std::string data_header(1, static_cast<char>(kOctetStringTag));
+  AppendDerLength(&data_header, upload.size);
+  const size_t sequence_size = data_header.size() + upload.size + fields.size();
+  std::string sequence_header(1, static_cast<char>(kSequenceTag));
+  AppendDerLength(&sequence_header, sequence_size);
+
+  std::string header(1, static_cast<char>(kUploadDataReqTag));
+  AppendDerLength(&header, sequence_header.size() + sequence_size);
+  header += sequence_header;
+  header += data_header;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  auto* data = const_cast<uint8_t*>(upload.data);
+  bool sent = SendAll(con_fd, {{&header[0], header.size()}, {data, upload.size}, {&fields[0], fields.size()}});
+  FlushSocket(con_fd);
+  return sent;
+}
+
+ssize_t Asn1DecodeUploadData(const char* buf, size_t size, Asn1UploadData* upload) {
+  size_t pos = 0;
+  size_t len = 0;
+  int header = ReadDerHeader(buf, size, &pos, kUploadDataReqTag, &len);
+  if (header <= 0) {
+    return header;
+  }
+  const size_t end = pos + len;
+  // Check the SEQUENCE too before waiting for the rest of the message
+  header = ReadDerHeader(buf, size, &pos, kSequenceTag, &len);
+  if (header <= 0) {
+    return header;
+  }
+  if (pos + len != end) {
+    return -1;
+  }
+  if (size < end) {
+    return 0;
+  }
+
+  Asn1UploadData result;
+  if (ReadDerHeader(buf, end, &pos, kOctetStringTag, &len) != 1 || pos + len > end ||
+      len > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    return -1;
+  }
+  result.data = reinterpret_cast<const uint8_t*>(buf) + pos;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  result.size = len;
+  pos += len;
+  if (pos < end && ByteAt(buf, pos) == kOffsetTag) {
+    if (!ReadDerUnsigned(buf, end, &pos, kOffsetTag, kIntegerTag, &result.offset)) {
+      return -1;
+    }
+    result.has_offset = true;
+  }
+  if (pos < end && ByteAt(buf, pos) == kCompressionTag) {
+    uint64_t compression = 0;
+    if (!ReadDerUnsigned(buf, end, &pos, kCompressionTag, kEnumeratedTag, &compression)) {
+      return -1;
+    }
+    result.has_compression = true;
+    result.compression = static_cast<AKCompression_t>(compression);
+  }
+  // Fields added by a newer Primary are left to ber_decode() to skip
+  if (pos != end) {
+    return -1;
+  }
+  *upload = result;
+  return static_cast<ssize_t>(end);
+}
+
+Asn1Message::Ptr Asn1Receive(int con_fd, DequeueBuffer& buffer) {
   AKIpUptaneMes_t* m = nullptr;
   asn_dec_rval_t res;
   asn_codec_ctx_s context{};
-  DequeueBuffer buffer;
-  ssize_t received;
-  do {
+  res.code = RC_WMORE;
+  // A previous read may already have buffered (part of) this message.
+  if (buffer.Size() > 0) {
+    res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
+    buffer.Consume(res.consumed);
+  }
+  while (res.code == RC_WMORE) {
     res.code = RC_FAIL;
-    received = recv(con_fd, buffer.Tail(), buffer.TailSpace(), 0);
+    ssize_t received = recv(con_fd, buffer.Tail(), buffer.TailSpace(), 0);
     if (received < 0) {
       LOG_ERROR << "Failed to read data from a connection socket: " << strerror(errno);
       break;
     }
-    LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string(buffer.Tail(), static_cast<size_t>(received)));
+    if (received == 0) {
+      break;
+    }
+    LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string_view(buffer.Tail(), static_cast<size_t>(received)));
     buffer.HaveEnqueued(static_cast<size_t>(received));
     res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
     buffer.Consume(res.consumed);
-  } while (res.code == RC_WMORE && received > 0);
+  }
   // Note that ber_decode allocates *m even on failure, so this must always be done
   Asn1Message::Ptr msg = Asn1Message::FromRaw(&m);
 
@@ -89,6 +359,26 @@ Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
   return msg;
 }
 
+Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
+  TraceSpan span("secondary", "rpc");
+  if (span.active()) {
+    span.annotate("message " + std::to_string(static_cast<int>(tx->present())));
+  }
+  static auto& latency =
+      Metrics::instance().histogram("aktualizr_secondary_rpc_duration_seconds", "Duration of RPCs to Secondaries");
+  static auto& failures =
+      Metrics::instance().counter("aktualizr_secondary_rpc_failures_total", "Secondary RPCs without a valid reply");
+  ScopedLatency timer(latency);
+  fault_injection_throttle("secondary_rpc", 0);
+  Asn1Send(tx, con_fd);
+  DequeueBuffer buffer;
+  Asn1Message::Ptr msg = Asn1Receive(con_fd, buffer);
+  if (msg->present() == AKIpUptaneMes_PR_NOTHING) {
+    failures.add();
+  }
+  return msg;
+}
+
 Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const std::pair<std::string, uint16_t>& addr) {
   ConnectionSocket connection(addr.first, addr.second);
 
@@ -1,11 +1,28 @@
 #ifndef ASN1_MESSAGE_H_
 #define ASN1_MESSAGE_H_
+#include <sys/types.h>
+#include <cstdint>
+
 #include <boost/intrusive_ptr.hpp>
 
 #include "AKIpUptaneMes.h"
 #include "AKTlsConfig.h"
 
 class Asn1Message;
+class DequeueBuffer;
+
+/**
+ * The fields of an uploadDataReq. `data` is not owned: it points into the
+ * buffer the message was decoded from, or into the chunk that is being sent.
+ */
+struct Asn1UploadData {
+  const uint8_t* data{nullptr};
+  size_t size{0};
+  bool has_offset{false};
+  uint64_t offset{0};
+  bool has_compression{false};
+  AKCompression_t compression{AKCompression_none};
+};
 
 template <typename T>
 class Asn1Sub {
@@ -37,7 +54,15 @@ class Asn1Message {
   template <typename T>
   using SubPtr = Asn1Sub<T>;
 
-  ~Asn1Message() { ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_AKIpUptaneMes, &msg_); }
+  ~Asn1Message() {
+    if (borrowed_data_) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+      OCTET_STRING_t& data = msg_.choice.uploadDataReq.data;
+      data.buf = nullptr;
+      data.size = 0;
+    }
+    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_AKIpUptaneMes, &msg_);
+  }
   Asn1Message(const Asn1Message&) = delete;
   Asn1Message(Asn1Message&&) = delete;
   Asn1Message operator=(const Asn1Message&) = delete;
@@ -55,6 +80,12 @@ class Asn1Message {
    */
   static Asn1Message::Ptr FromRaw(AKIpUptaneMes_t** msg) { return new Asn1Message(msg); }
 
+  /**
+   * Create an uploadDataReq whose data borrows upload.data instead of copying
+   * it. The memory upload.data points to must outlive the message.
+   */
+  static Asn1Message::Ptr FromUploadData(const Asn1UploadData& upload);
+
   friend void intrusive_ptr_add_ref(Asn1Message* m) { m->ref_count_++; }
   friend void intrusive_ptr_release(Asn1Message* m) {
     if (--m->ref_count_ == 0) {
@@ -98,6 +129,16 @@ class Asn1Message {
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKRootVerRespMes_t, rootVerResp);
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootReqMes_t, putRootReq);
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootRespMes_t, putRootResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainReqMes_t, putRootChainReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainRespMes_t, putRootChainResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadOffsetReqMes_t, uploadOffsetReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadOffsetRespMes_t, uploadOffsetResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastJoinReqMes_t, multicastJoinReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastJoinRespMes_t, multicastJoinResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStatusReqMes_t, multicastStatusReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStatusRespMes_t, multicastStatusResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKOstreePullStatusReqMes_t, ostreePullStatusReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKOstreePullStatusRespMes_t, ostreePullStatusResp);
 
 #define ASN1_MESSAGE_DEFINE_STR_NAME(MessageID) \
   case MessageID:                               \
@@ -132,6 +173,16 @@ class Asn1Message {
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_rootVerResp);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootReq);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadOffsetReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadOffsetResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastJoinReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastJoinResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStatusReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStatusResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_ostreePullStatusReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_ostreePullStatusResp);
     }
     return "Unknown";
   };
@@ -145,6 +196,7 @@ class Asn1Message {
 
  private:
   int ref_count_{0};
+  bool borrowed_data_{false};  // uploadDataReq.data is not ours to free
 
   Asn1Message() = default;
 
@@ -176,6 +228,38 @@ std::string ToString(const OCTET_STRING_t& octet_str);
 
 void SetString(OCTET_STRING_t* dest, const std::string& str);
 
+/**
+ * DER encode a message, e.g. to send the same one to several Secondaries.
+ * Returns an empty string if encoding fails.
+ */
+std::string Asn1Encode(const Asn1Message::Ptr& tx);
+
+/**
+ * Send a message without waiting for the response.
+ */
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd);
+bool Asn1Send(const std::string& encoded, int con_fd);
+
+/**
+ * Send an uploadDataReq straight from upload.data, without copying it into a
+ * message first. The bytes on the wire are the ones der_encode() produces.
+ */
+bool Asn1SendUploadData(const Asn1UploadData& upload, int con_fd);
+
+/**
+ * Decode an uploadDataReq at the start of `buf` in place, leaving upload->data
+ * pointing into `buf`. Returns the length of the message, 0 if `buf` holds
+ * only the start of one, or -1 if `buf` does not start with an uploadDataReq
+ * in the DER form this handles, in which case use ber_decode() instead.
+ */
+ssize_t Asn1DecodeUploadData(const char* buf, size_t size, Asn1UploadData* upload);
+
+/**
+ * Read one message. Bytes received past its end stay in `buffer` for the next
+ * call, so several pipelined responses can be read from one connection.
+ */
+Asn1Message::Ptr Asn1Receive(int con_fd, DequeueBuffer& buffer);
+
 /**
  * Open a TCP connection to client; send a message and wait for a
  * response.
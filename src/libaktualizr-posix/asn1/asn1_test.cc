@@ -4,6 +4,9 @@
 
 #include <gtest/gtest.h>
 
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <iostream>
 #include <string>
 
@@ -263,6 +266,78 @@ TEST(asn1_common, parse) {
   EXPECT_EQ(AKIpUptaneMes_PR_sendFirmwareReq, msg->present());
 }
 
+/* The uploadDataReq fast path writes what der_encode() would, and decodes it
+ * without copying the data. */
+TEST(asn1_common, UploadDataInPlace) {
+  const std::string data(300, 'x');  // Long enough to need the long form length
+  for (unsigned fields = 0; fields < 4; ++fields) {
+    Asn1UploadData upload;
+    upload.data = reinterpret_cast<const uint8_t*>(data.data());
+    upload.size = data.size();
+    upload.has_offset = (fields & 1U) != 0;
+    upload.offset = 0x80;  // Needs a leading zero to stay positive
+    upload.has_compression = (fields & 2U) != 0;
+    upload.compression = AKCompression_deflate;
+
+    Asn1Message::Ptr original(Asn1Message::Empty());
+    original->present(AKIpUptaneMes_PR_uploadDataReq);
+    auto m = original->uploadDataReq();
+    SetString(&m->data, data);
+    if (upload.has_offset) {
+      m->offset = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+      *m->offset = 0x80;
+    }
+    if (upload.has_compression) {
+      m->compression = Asn1Allocation<AKCompression_t>();
+      *m->compression = AKCompression_deflate;
+    }
+    std::string expected;
+    der_encode(&asn_DEF_AKIpUptaneMes, &original->msg_, Asn1StringAppendCallback, &expected);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    ASSERT_TRUE(Asn1SendUploadData(upload, fds[0]));
+    close(fds[0]);
+    std::string sent;
+    char chunk[512];
+    for (ssize_t n; (n = read(fds[1], chunk, sizeof(chunk))) > 0;) {
+      sent.append(chunk, static_cast<size_t>(n));
+    }
+    close(fds[1]);
+    EXPECT_EQ(Utils::toBase64(sent), Utils::toBase64(expected));
+
+    for (size_t prefix = 0; prefix < expected.size(); ++prefix) {
+      Asn1UploadData partial;
+      ASSERT_EQ(Asn1DecodeUploadData(expected.data(), prefix, &partial), 0);
+    }
+    Asn1UploadData decoded;
+    ASSERT_EQ(Asn1DecodeUploadData(expected.data(), expected.size(), &decoded),
+              static_cast<ssize_t>(expected.size()));
+    EXPECT_GT(reinterpret_cast<const char*>(decoded.data), expected.data());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(decoded.data), decoded.size), data);
+    EXPECT_EQ(decoded.has_offset, upload.has_offset);
+    EXPECT_EQ(decoded.has_compression, upload.has_compression);
+    if (decoded.has_offset) {
+      EXPECT_EQ(decoded.offset, 0x80);
+    }
+    if (decoded.has_compression) {
+      EXPECT_EQ(decoded.compression, AKCompression_deflate);
+    }
+
+    // The message borrows the data, and encodes the same as the original
+    std::string reencoded;
+    Asn1Message::Ptr msg = Asn1Message::FromUploadData(decoded);
+    der_encode(&asn_DEF_AKIpUptaneMes, &msg->msg_, Asn1StringAppendCallback, &reencoded);
+    msg.reset();
+    EXPECT_EQ(reencoded, expected);
+  }
+
+  // Anything else is left to ber_decode()
+  std::string other = Utils::fromBase64("pgkwBwQFaGVsbG8=");
+  Asn1UploadData decoded;
+  EXPECT_EQ(Asn1DecodeUploadData(other.data(), other.size(), &decoded), -1);
+}
+
 TEST(asn1_common, Asn1MessageFromRawNull) {
   Asn1Message::FromRaw(nullptr);
   AKIpUptaneMes_t* m = nullptr;
@@ -0,0 +1,234 @@
+#include "firmware_multicast.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <system_error>
+#include <vector>
+
+#include "logging/logging.h"
+
+namespace FirmwareMulticast {
+
+namespace {
+
+constexpr std::array<uint8_t, 4> kMagic{'A', 'K', 'M', 'C'};
+
+void putUInt32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value >> 24U);
+  out[1] = static_cast<uint8_t>(value >> 16U);
+  out[2] = static_cast<uint8_t>(value >> 8U);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t getUInt32(const uint8_t* in) {
+  return (static_cast<uint32_t>(in[0]) << 24U) | (static_cast<uint32_t>(in[1]) << 16U) |
+         (static_cast<uint32_t>(in[2]) << 8U) | static_cast<uint32_t>(in[3]);
+}
+
+sockaddr_in groupAddress(const std::string& group, uint16_t port) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);  // NOLINT(readability-isolate-declaration)
+  if (inet_pton(AF_INET, group.c_str(), &addr.sin_addr) != 1 || !IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+    throw std::system_error(EINVAL, std::system_category(), "Invalid multicast group " + group);
+  }
+  return addr;
+}
+
+uint32_t newSessionId() {
+  static std::mutex mutex;
+  static std::mt19937 gen{std::random_device{}()};
+  std::lock_guard<std::mutex> guard(mutex);
+  return static_cast<uint32_t>(gen());
+}
+
+}  // namespace
+
+uint64_t blockCount(uint64_t image_size, uint32_t block_size) { return (image_size + block_size - 1) / block_size; }
+
+std::string allBlocksMissing(uint64_t block_count) {
+  std::string bitmap(static_cast<size_t>((block_count + 7) / 8), '\xFF');
+  if (block_count % 8 != 0) {
+    bitmap.back() = static_cast<char>(0xFFU << (8U - block_count % 8));
+  }
+  return bitmap;
+}
+
+bool isBlockMissing(const std::string& bitmap, uint64_t block) {
+  const auto byte = static_cast<size_t>(block / 8);
+  return byte < bitmap.size() && (static_cast<uint8_t>(bitmap[byte]) & (0x80U >> (block % 8))) != 0;
+}
+
+void setBlockReceived(std::string* bitmap, uint64_t block) {
+  const auto byte = static_cast<size_t>(block / 8);
+  if (byte < bitmap->size()) {
+    (*bitmap)[byte] = static_cast<char>(static_cast<uint8_t>((*bitmap)[byte]) & ~(0x80U >> (block % 8)));
+  }
+}
+
+Sender::Session::Session(const std::string& group, uint16_t port, uint64_t rate, const boost::filesystem::path& image,
+                         uint64_t image_size)
+    : id_{newSessionId()},
+      rate_{rate},
+      image_size_{image_size},
+      block_count_{FirmwareMulticast::blockCount(image_size, kBlockSize)} {
+  const sockaddr_in addr = groupAddress(group, port);
+  fd_ = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "open " + image.string());
+  }
+  sock_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  const unsigned char ttl = 1;
+  if (sock_ < 0 || setsockopt(sock_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0 ||
+      connect(sock_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    const int err = errno;
+    if (sock_ >= 0) {
+      close(sock_);
+    }
+    close(fd_);
+    throw std::system_error(err, std::system_category(), "multicast socket");
+  }
+  LOG_INFO << "Multicasting " << image.filename().string() << " to " << group << ":" << port << " in "
+           << block_count_ << " blocks";
+  thread_ = std::thread([this]() { run(); });
+}
+
+Sender::Session::~Session() {
+  stop_ = true;
+  thread_.join();
+  close(sock_);
+  close(fd_);
+}
+
+uint64_t Sender::Session::blocksSent() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return sent_;
+}
+
+bool Sender::Session::waitForBlocks(uint64_t count) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this, count]() { return sent_ >= count || failed_; });
+  return !failed_;
+}
+
+void Sender::Session::run() {
+  std::vector<uint8_t> datagram(kHeaderSize + kBlockSize);
+  std::copy(kMagic.cbegin(), kMagic.cend(), datagram.begin());
+  putUInt32(&datagram[4], id_);
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t bytes = 0;
+  uint64_t block = 0;
+  while (!stop_ && block_count_ > 0) {
+    const uint64_t offset = block * kBlockSize;
+    const auto size = static_cast<size_t>(std::min<uint64_t>(kBlockSize, image_size_ - offset));
+    putUInt32(&datagram[8], static_cast<uint32_t>(block));
+    const ssize_t read = pread(fd_, &datagram[kHeaderSize], size, static_cast<off_t>(offset));
+    // Lost datagrams are repaired later, so only a failure to read is fatal
+    if (read != static_cast<ssize_t>(size) || (send(sock_, datagram.data(), kHeaderSize + size, 0) < 0 &&
+                                               errno != ENOBUFS && errno != EAGAIN && errno != ECONNREFUSED)) {
+      LOG_ERROR << "Multicast of a firmware image failed: " << std::strerror(errno);
+      std::lock_guard<std::mutex> guard(mutex_);
+      failed_ = true;
+      cv_.notify_all();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      ++sent_;
+    }
+    cv_.notify_all();
+    block = (block + 1) % block_count_;
+
+    bytes += size;
+    if (rate_ > 0) {
+      const auto due = start + std::chrono::microseconds(bytes * 1000000 / rate_);
+      std::this_thread::sleep_until(due);
+    }
+  }
+}
+
+Sender::Sender(std::string group, uint16_t port, uint64_t rate) : group_{std::move(group)}, port_{port}, rate_{rate} {}
+
+std::shared_ptr<Sender::Session> Sender::join(const std::string& sha256, const boost::filesystem::path& image,
+                                              uint64_t image_size) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto session = sessions_[sha256].lock();
+  if (!session) {
+    session = std::make_shared<Session>(group_, port_, rate_, image, image_size);
+    sessions_[sha256] = session;
+  }
+  // Forget the sessions that have stopped
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    it = it->second.expired() ? sessions_.erase(it) : std::next(it);
+  }
+  return session;
+}
+
+Receiver::Receiver(const std::string& group, uint16_t port, uint32_t session, BlockHandler handler)
+    : session_{session}, handler_{std::move(handler)} {
+  const sockaddr_in group_addr = groupAddress(group, port);
+  sock_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sock_ < 0) {
+    throw std::system_error(errno, std::system_category(), "multicast socket");
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = group_addr.sin_port;
+  addr.sin_addr = group_addr.sin_addr;
+  ip_mreq mreq{};
+  mreq.imr_multiaddr = group_addr.sin_addr;
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);  // NOLINT(readability-isolate-declaration)
+  // Several Secondaries on one host may receive the same group
+  const int reuse = 1;
+  // Large enough to ride out a slow write of the received blocks
+  const int rcvbuf = 4 * 1024 * 1024;
+  if (setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+      setsockopt(sock_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0 ||
+      bind(sock_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      setsockopt(sock_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+    const int err = errno;
+    close(sock_);
+    throw std::system_error(err, std::system_category(), "join multicast group " + group);
+  }
+  LOG_INFO << "Joined multicast group " << group << ":" << port << " for firmware upload session " << session_;
+  thread_ = std::thread([this]() { run(); });
+}
+
+Receiver::~Receiver() {
+  stop_ = true;
+  thread_.join();
+  // Closing the socket leaves the group
+  close(sock_);
+}
+
+void Receiver::run() {
+  std::vector<uint8_t> datagram(64 * 1024);
+  pollfd pfd{sock_, POLLIN, 0};
+  while (!stop_) {
+    if (poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+    const ssize_t size = recv(sock_, datagram.data(), datagram.size(), 0);
+    if (size < static_cast<ssize_t>(kHeaderSize) || !std::equal(kMagic.cbegin(), kMagic.cend(), datagram.cbegin()) ||
+        getUInt32(&datagram[4]) != session_) {
+      continue;
+    }
+    try {
+      handler_(getUInt32(&datagram[8]), &datagram[kHeaderSize], static_cast<size_t>(size) - kHeaderSize);
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Failed to store a multicast block: " << e.what();
+    }
+  }
+}
+
+}  // namespace FirmwareMulticast
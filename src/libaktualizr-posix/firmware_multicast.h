@@ -0,0 +1,131 @@
+#ifndef UPTANE_FIRMWARE_MULTICAST_H_
+#define UPTANE_FIRMWARE_MULTICAST_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * One-to-many firmware uploads to identical IP Secondaries. The Primary sends
+ * the blocks of an image round and round to a UDP multicast group for as long
+ * as any Secondary receives it, so every Secondary that joins has seen each
+ * block once after one round, no matter how many others receive it too. The
+ * blocks a Secondary has lost are then sent to it by unicast. The datagrams
+ * are not authenticated: like any other upload, the image is verified against
+ * the Target hash before it is installed.
+ *
+ * See AKMulticastJoinReqMes for the datagram format.
+ */
+namespace FirmwareMulticast {
+
+constexpr size_t kHeaderSize{12};
+// A block, its header and the UDP and IP headers fit into one Ethernet frame
+constexpr uint32_t kBlockSize{1400};
+
+uint64_t blockCount(uint64_t image_size, uint32_t block_size);
+
+/** Bitmaps of missing blocks, as in AKMulticastStatusRespMes. */
+std::string allBlocksMissing(uint64_t block_count);
+bool isBlockMissing(const std::string& bitmap, uint64_t block);
+void setBlockReceived(std::string* bitmap, uint64_t block);
+
+/**
+ * The sending side, on the Primary. All Secondaries that receive the same
+ * Target share one session, which stops once none of them uses it anymore.
+ */
+class Sender {
+ public:
+  class Session {
+   public:
+    /** Throws if `image` or the socket can not be opened. */
+    Session(const std::string& group, uint16_t port, uint64_t rate, const boost::filesystem::path& image,
+            uint64_t image_size);
+    ~Session();
+    Session(const Session&) = delete;
+    Session(Session&&) = delete;
+    Session& operator=(const Session&) = delete;
+    Session& operator=(Session&&) = delete;
+
+    uint32_t id() const { return id_; }
+    uint64_t blockCount() const { return block_count_; }
+    /** Blocks sent since the session started. */
+    uint64_t blocksSent() const;
+    /** Wait until `count` blocks have been sent. Returns false if sending failed. */
+    bool waitForBlocks(uint64_t count) const;
+
+   private:
+    void run();
+
+    const uint32_t id_;
+    const uint64_t rate_;
+    const uint64_t image_size_;
+    const uint64_t block_count_;
+    int fd_{-1};
+    int sock_{-1};
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+    uint64_t sent_{0};
+    bool failed_{false};
+    std::atomic<bool> stop_{false};
+  };
+
+  /** Sends to `group`:`port` at up to `rate` bytes per second per Target. */
+  Sender(std::string group, uint16_t port, uint64_t rate);
+
+  const std::string& group() const { return group_; }
+  uint16_t port() const { return port_; }
+
+  /**
+   * The session that sends the image of the Target with hash `sha256`, which
+   * is started if no other Secondary receives it yet. Throws if it can not be
+   * started.
+   */
+  std::shared_ptr<Session> join(const std::string& sha256, const boost::filesystem::path& image, uint64_t image_size);
+
+ private:
+  const std::string group_;
+  const uint16_t port_;
+  const uint64_t rate_;
+  std::mutex mutex_;
+  std::map<std::string, std::weak_ptr<Session>> sessions_;
+};
+
+/**
+ * The receiving side, on a Secondary: calls `handler` for every block of
+ * `session` that arrives, on a thread of its own, until it is destroyed.
+ */
+class Receiver {
+ public:
+  using BlockHandler = std::function<void(uint64_t block, const uint8_t* data, size_t size)>;
+
+  /** Throws std::system_error if the group can not be joined. */
+  Receiver(const std::string& group, uint16_t port, uint32_t session, BlockHandler handler);
+  ~Receiver();
+  Receiver(const Receiver&) = delete;
+  Receiver(Receiver&&) = delete;
+  Receiver& operator=(const Receiver&) = delete;
+  Receiver& operator=(Receiver&&) = delete;
+
+ private:
+  void run();
+
+  const uint32_t session_;
+  const BlockHandler handler_;
+  int sock_{-1};
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+};
+
+}  // namespace FirmwareMulticast
+
+#endif  // UPTANE_FIRMWARE_MULTICAST_H_
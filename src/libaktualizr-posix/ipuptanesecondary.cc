@@ -3,22 +3,30 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 
-#include <array>
+#include <algorithm>
 #include <fstream>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "asn1/asn1_message.h"
 #include "der_encoder.h"
+#include "firmware_multicast.h"
 #include "libaktualizr/secondary_provider.h"
 #include "logging/logging.h"
+#include "package_manager/chunk_index.h"
 #include "uptane/tuf.h"
+#include "upload_compression.h"
+#include "utilities/block_reader.h"
+#include "utilities/dequeue_buffer.h"
 #include "utilities/flow_control.h"
+#include "utilities/json_reader.h"
 #include "utilities/utils.h"
 
 namespace Uptane {
 
 SecondaryInterface::Ptr IpUptaneSecondary::connectAndCreate(const std::string& address, unsigned short port,
-                                                            VerificationType verification_type) {
+                                                            VerificationType verification_type, bool keep_alive) {
   LOG_INFO << "Connecting to and getting info about IP Secondary: " << address << ":" << port << "...";
 
   ConnectionSocket con_sock{address, port};
@@ -31,11 +39,12 @@ SecondaryInterface::Ptr IpUptaneSecondary::connectAndCreate(const std::string& a
     return nullptr;
   }
 
-  return create(address, port, verification_type, *con_sock);
+  return create(address, port, verification_type, *con_sock, keep_alive);
 }
 
 SecondaryInterface::Ptr IpUptaneSecondary::create(const std::string& address, unsigned short port,
-                                                  VerificationType verification_type, int con_fd) {
+                                                  VerificationType verification_type, int con_fd,
+                                                  bool keep_alive) {
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_getInfoReq);
 
@@ -45,7 +54,8 @@ SecondaryInterface::Ptr IpUptaneSecondary::create(const std::string& address, un
   if (resp->present() != AKIpUptaneMes_PR_getInfoResp) {
     LOG_ERROR << "IP Secondary failed to respond to information request at " << address << ":" << port;
     return std::make_shared<IpUptaneSecondary>(address, port, verification_type, EcuSerial::Unknown(),
-                                               HardwareIdentifier::Unknown(), PublicKey("", KeyType::kUnknown));
+                                               HardwareIdentifier::Unknown(), PublicKey("", KeyType::kUnknown),
+                                               keep_alive);
   }
   auto r = resp->getInfoResp();
 
@@ -58,17 +68,18 @@ SecondaryInterface::Ptr IpUptaneSecondary::create(const std::string& address, un
   LOG_INFO << "Got ECU information from IP Secondary: "
            << "hardware ID: " << hw_id << " serial: " << serial;
 
-  return std::make_shared<IpUptaneSecondary>(address, port, verification_type, serial, hw_id, pub_key);
+  return std::make_shared<IpUptaneSecondary>(address, port, verification_type, serial, hw_id, pub_key, keep_alive);
 }
 
 SecondaryInterface::Ptr IpUptaneSecondary::connectAndCheck(const std::string& address, unsigned short port,
                                                            VerificationType verification_type, EcuSerial serial,
-                                                           HardwareIdentifier hw_id, PublicKey pub_key) {
+                                                           HardwareIdentifier hw_id, PublicKey pub_key,
+                                                           bool keep_alive) {
   // try to connect:
   // - if it succeeds compare with what we expect
   // - otherwise, keep using what we know
   try {
-    auto sec = IpUptaneSecondary::connectAndCreate(address, port, verification_type);
+    auto sec = IpUptaneSecondary::connectAndCreate(address, port, verification_type, keep_alive);
     if (sec != nullptr) {
       auto s = sec->getSerial();
       if (s != serial && serial != EcuSerial::Unknown()) {
@@ -96,17 +107,79 @@ SecondaryInterface::Ptr IpUptaneSecondary::connectAndCheck(const std::string& ad
   }
 
   return std::make_shared<IpUptaneSecondary>(address, port, verification_type, std::move(serial), std::move(hw_id),
-                                             std::move(pub_key));
+                                             std::move(pub_key), keep_alive);
 }
 
 IpUptaneSecondary::IpUptaneSecondary(const std::string& address, unsigned short port,
                                      VerificationType verification_type, EcuSerial serial, HardwareIdentifier hw_id,
-                                     PublicKey pub_key)
+                                     PublicKey pub_key, bool keep_alive)
     : addr_{address, port},
       verification_type_{verification_type},
       serial_{std::move(serial)},
       hw_id_{std::move(hw_id)},
-      pub_key_{std::move(pub_key)} {}
+      pub_key_{std::move(pub_key)},
+      keep_alive_{keep_alive} {}
+
+IpUptaneSecondary::~IpUptaneSecondary() = default;
+
+/* Send a request and read the response, over the persistent connection if
+ * the Secondary has confirmed keep-alive. If the Secondary closed the
+ * connection since the last request, e.g. because it has rebooted, the request
+ * is sent once more on a new connection. */
+Asn1Message::Ptr IpUptaneSecondary::rpc(const Asn1Message::Ptr& req) const {
+  if (!keep_alive_confirmed_) {
+    return Asn1Rpc(req, getAddr());
+  }
+  return rpcOnConnection([&req](int con_fd) { return Asn1Send(req, con_fd); });
+}
+
+Asn1Message::Ptr IpUptaneSecondary::rpc(const std::string& encoded) const {
+  if (keep_alive_confirmed_) {
+    return rpcOnConnection([&encoded](int con_fd) { return Asn1Send(encoded, con_fd); });
+  }
+  ConnectionSocket connection(addr_.first, addr_.second);
+  if (connection.connect() < 0) {
+    LOG_ERROR << "Failed to connect to the Secondary ( " << addr_.first << ":" << addr_.second
+              << "): " << std::strerror(errno);
+    return Asn1Message::Empty();
+  }
+  if (!Asn1Send(encoded, *connection)) {
+    return Asn1Message::Empty();
+  }
+  DequeueBuffer buffer;
+  return Asn1Receive(*connection, buffer);
+}
+
+Asn1Message::Ptr IpUptaneSecondary::rpcOnConnection(const std::function<bool(int)>& send) const {
+  std::lock_guard<std::mutex> guard(connection_mutex_);
+  const bool reused = connection_ != nullptr;
+  for (int attempt = 0; attempt < (reused ? 2 : 1); ++attempt) {
+    if (connection_ == nullptr) {
+      connection_ = std::make_unique<ConnectionSocket>(addr_.first, addr_.second);
+      if (connection_->connect() < 0) {
+        LOG_ERROR << "Failed to connect to the Secondary ( " << addr_.first << ":" << addr_.second
+                  << "): " << std::strerror(errno);
+        connection_.reset();
+        return Asn1Message::Empty();
+      }
+      connection_buffer_ = std::make_unique<DequeueBuffer>();
+    }
+    if (send(**connection_)) {
+      auto resp = Asn1Receive(**connection_, *connection_buffer_);
+      if (resp->present() != AKIpUptaneMes_PR_NOTHING) {
+        return resp;
+      }
+    }
+    LOG_DEBUG << "Connection to Secondary " << getSerial() << " was lost";
+    connection_.reset();
+  }
+  return Asn1Message::Empty();
+}
+
+void IpUptaneSecondary::closeConnection() const {
+  std::lock_guard<std::mutex> guard(connection_mutex_);
+  connection_.reset();
+}
 
 /* Determine the best protocol version to use for this Secondary. This did not
  * exist for v1 and thus only works for v2 and beyond. It would be great if we
@@ -120,9 +193,39 @@ void IpUptaneSecondary::getSecondaryVersion() const {
   req->present(AKIpUptaneMes_PR_versionReq);
   auto m = req->versionReq();
   m->version = latest_version;
-  auto resp = Asn1Rpc(req, getAddr());
+  m->uploadChunkSize = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+  *m->uploadChunkSize = static_cast<long>(kUploadChunkSize);  // NOLINT(google-runtime-int)
+  m->uploadWindow = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+  *m->uploadWindow = static_cast<long>(kUploadWindow);  // NOLINT(google-runtime-int)
+  if (keep_alive_) {
+    m->keepAlive = Asn1Allocation<BOOLEAN_t>();
+    *m->keepAlive = 1;
+  }
+  m->uploadCompression = Asn1Allocation<AKCompression_t>();
+  *m->uploadCompression = AKCompression_deflate;
+  m->uploadDelta = Asn1Allocation<BOOLEAN_t>();
+  *m->uploadDelta = 1;
+  if (multicast_) {
+    m->uploadMulticast = Asn1Allocation<BOOLEAN_t>();
+    *m->uploadMulticast = 1;
+  }
+  m->ostreeBackgroundPull = Asn1Allocation<BOOLEAN_t>();
+  *m->ostreeBackgroundPull = 1;
+  auto resp = rpc(req);
+
+  // Secondaries that predate upload parameter negotiation ignore the offer.
+  upload_chunk_size = kDefaultUploadChunkSize;
+  upload_window = 1;
+  root_chain_supported_ = false;
+  upload_resume_supported_ = false;
+  upload_deflate_ = false;
+  upload_delta_ = false;
+  upload_multicast_ = false;
+  ostree_background_pull_ = false;
 
   if (resp->present() != AKIpUptaneMes_PR_versionResp) {
+    keep_alive_confirmed_ = false;
+    closeConnection();
     // Bad response probably means v1, but make sure the Secondary is actually
     // responsive before assuming that.
     if (ping()) {
@@ -145,35 +248,54 @@ void IpUptaneSecondary::getSecondaryVersion() const {
               << latest_version << "! Communication will most likely fail!";
     protocol_version = latest_version;
   }
+  if (r->uploadChunkSize != nullptr && *r->uploadChunkSize > 0) {
+    upload_chunk_size = std::min<size_t>(static_cast<size_t>(*r->uploadChunkSize), kUploadChunkSize);
+  }
+  if (r->uploadWindow != nullptr && *r->uploadWindow > 0) {
+    upload_window = std::min<size_t>(static_cast<size_t>(*r->uploadWindow), kUploadWindow);
+  }
+  LOG_DEBUG << "Uploading firmware to Secondary " << getSerial() << " in chunks of " << upload_chunk_size
+            << " bytes with up to " << upload_window << " chunks in flight";
+  const bool keep_alive = keep_alive_ && r->keepAlive != nullptr && *r->keepAlive != 0;
+  if (keep_alive && !keep_alive_confirmed_) {
+    LOG_DEBUG << "Keeping the connection to Secondary " << getSerial() << " open between requests";
+  } else if (!keep_alive) {
+    closeConnection();
+  }
+  keep_alive_confirmed_ = keep_alive;
+  root_chain_supported_ = r->rootChain != nullptr && *r->rootChain != 0;
+  upload_resume_supported_ = r->uploadResume != nullptr && *r->uploadResume != 0;
+  upload_deflate_ = r->uploadCompression != nullptr && *r->uploadCompression == AKCompression_deflate;
+  upload_delta_ = r->uploadDelta != nullptr && *r->uploadDelta != 0;
+  upload_multicast_ = multicast_ && r->uploadMulticast != nullptr && *r->uploadMulticast != 0;
+  ostree_background_pull_ = r->ostreeBackgroundPull != nullptr && *r->ostreeBackgroundPull != 0;
 }
 
-data::InstallationResult IpUptaneSecondary::putMetadata(const Target& target) {
-  Uptane::MetaBundle meta_bundle;
-  bool load_result;
+bool IpUptaneSecondary::loadMetadata(const Uptane::Target& target, Uptane::MetaBundle* meta_bundle) const {
   if (verification_type_ == VerificationType::kTuf) {
-    load_result = secondary_provider_->getImageRepoMetadata(&meta_bundle, target);
-  } else {
-    load_result = secondary_provider_->getMetadata(&meta_bundle, target);
-  }
-  if (!load_result) {
-    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
-                                    "Unable to load stored metadata from Primary");
+    return secondary_provider_->getImageRepoMetadata(meta_bundle, target);
   }
+  return secondary_provider_->getMetadata(meta_bundle, target);
+}
 
+data::InstallationResult IpUptaneSecondary::putMetadata(const Target& target) {
   getSecondaryVersion();
 
   LOG_INFO << "Sending Uptane metadata to the Secondary";
-  data::InstallationResult put_result;
   if (protocol_version == 2) {
-    put_result = putMetadata_v2(meta_bundle);
-  } else if (protocol_version == 1) {
-    put_result = putMetadata_v1(meta_bundle);
-  } else {
+    return putMetadata_v2(target);
+  }
+  if (protocol_version != 1) {
     LOG_ERROR << "Unexpected protocol version: " << protocol_version;
-    put_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError,
-                                          "Unexpected protocol version: " + std::to_string(protocol_version));
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "Unexpected protocol version: " + std::to_string(protocol_version));
+  }
+  Uptane::MetaBundle meta_bundle;
+  if (!loadMetadata(target, &meta_bundle)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "Unable to load stored metadata from Primary");
   }
-  return put_result;
+  return putMetadata_v1(meta_bundle);
 }
 
 data::InstallationResult IpUptaneSecondary::putMetadata_v1(const Uptane::MetaBundle& meta_bundle) {
@@ -207,7 +329,7 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v1(const Uptane::MetaBun
   SetString(&m->image.choice.json.targets,
             getMetaFromBundle(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_putMetaResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
@@ -233,7 +355,7 @@ void IpUptaneSecondary::addMetadata(const Uptane::MetaBundle& meta_bundle, const
   ASN_SEQUENCE_ADD(&collection, meta_json);
 }
 
-data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::MetaBundle& meta_bundle) {
+std::string IpUptaneSecondary::encodeMetadata_v2(const Uptane::MetaBundle& meta_bundle) const {
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_putMetaReq2);
   auto m = req->putMetaReq2();
@@ -256,7 +378,26 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::MetaBun
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
   addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets(), m->imageRepo.choice.collection);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  return Asn1Encode(req);
+}
+
+data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::Target& target) {
+  // The request only depends on the metadata and the verification type, so
+  // during an update it is encoded once and sent to every such Secondary.
+  const std::string key = verification_type_ == VerificationType::kTuf ? "ip-putMetaReq2-tuf" : "ip-putMetaReq2";
+  auto req = secondary_provider_->getMetadataPayload(key, [this, &target]() {
+    Uptane::MetaBundle meta_bundle;
+    if (!loadMetadata(target, &meta_bundle)) {
+      return std::string();
+    }
+    return encodeMetadata_v2(meta_bundle);
+  });
+  if (req == nullptr) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "Unable to load stored metadata from Primary");
+  }
+
+  auto resp = rpc(*req);
 
   if (resp->present() != AKIpUptaneMes_PR_putMetaResp2) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
@@ -283,7 +424,7 @@ int32_t IpUptaneSecondary::getRootVersion(bool director) const {
     m->repotype = AKRepoType_image;
   }
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_rootVerResp) {
     // v1 (and v2 until this was added) Secondaries won't understand this.
     // Return 0 to indicate that this is unsupported. Sending intermediate Roots
@@ -313,7 +454,7 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   }
   SetString(&m->json, root);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_putRootResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive Root metadata.";
     return data::InstallationResult(
@@ -325,6 +466,42 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
 }
 
+data::InstallationResult IpUptaneSecondary::putRootChain(const std::vector<std::string>& roots, bool director) {
+  if (director && verification_type_ == VerificationType::kTuf) {
+    return putRoot(std::string(), director);
+  }
+  if (protocol_version == 0) {
+    getSecondaryVersion();
+  }
+  if (!root_chain_supported_ || roots.size() <= 1) {
+    return SecondaryInterface::putRootChain(roots, director);
+  }
+
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_putRootChainReq);
+  auto m = req->putRootChainReq();
+  m->repotype = director ? AKRepoType_director : AKRepoType_image;
+  for (const auto& root : roots) {
+    auto* json = Asn1Allocation<OCTET_STRING_t>();
+    SetString(json, root);
+    ASN_SEQUENCE_ADD(&m->roots, json);
+  }
+
+  auto resp = rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_putRootChainResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive a chain of "
+              << roots.size() << " Root metadata versions.";
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "Secondary " + getSerial().ToString() +
+                                        " failed to respond to a request to receive Root metadata.");
+  }
+
+  auto r = resp->putRootChainResp();
+  LOG_DEBUG << "Secondary " << getSerial() << " stored " << r->applied << " of " << roots.size()
+            << " Root metadata versions";
+  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+}
+
 Manifest IpUptaneSecondary::getManifest() const {
   getSecondaryVersion();
 
@@ -332,7 +509,7 @@ Manifest IpUptaneSecondary::getManifest() const {
   Asn1Message::Ptr req(Asn1Message::Empty());
 
   req->present(AKIpUptaneMes_PR_manifestReq);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_manifestResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a manifest request.";
@@ -345,7 +522,7 @@ Manifest IpUptaneSecondary::getManifest() const {
     return Json::Value();
   }
   std::string manifest = ToString(r->manifest.choice.json);  // NOLINT(cppcoreguidelines-pro-type-union-access)
-  return Utils::parseJSON(manifest);
+  return JsonReader::parse(manifest);
 }
 
 bool IpUptaneSecondary::ping() const {
@@ -354,7 +531,7 @@ bool IpUptaneSecondary::ping() const {
 
   auto m = req->getInfoReq();
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   return resp->present() == AKIpUptaneMes_PR_getInfoResp;
 }
@@ -382,16 +559,69 @@ data::InstallationResult IpUptaneSecondary::sendFirmware(const Uptane::Target& t
                                   "Unexpected protocol version: " + std::to_string(protocol_version));
 }
 
+boost::optional<data::InstallationResult> IpUptaneSecondary::startFirmware(const Uptane::Target& target,
+                                                                          const InstallInfo& install_info) {
+  if (install_info.getUpdateType() != UpdateType::kOnline || protocol_version != 2 || !target.IsOstree() ||
+      !ostree_background_pull_) {
+    return boost::none;
+  }
+  pull_status_failures_ = 0;
+  return downloadOstreeRev(target, true);
+}
+
+boost::optional<data::InstallationResult> IpUptaneSecondary::firmwareStatus(const Uptane::Target& target) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_ostreePullStatusReq);
+  auto resp = rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_ostreePullStatusResp) {
+    // The pull goes on without the Primary, so a lost answer is asked again
+    // at the next poll.
+    if (++pull_status_failures_ < kPullStatusAttempts) {
+      LOG_WARNING << "Secondary " << getSerial() << " failed to respond to a request for the OSTree download status"
+                  << ", retrying.";
+      return boost::none;
+    }
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request for the OSTree download status.";
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kDownloadFailed,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request for the OSTree download status.");
+  }
+  pull_status_failures_ = 0;
+
+  auto r = resp->ostreePullStatusResp();
+  if (r->done == 0) {
+    LOG_DEBUG << "Secondary " << getSerial() << " has received " << r->progress << "% of OSTree commit "
+              << target.sha256Hash();
+    return boost::none;
+  }
+  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+}
+
+void IpUptaneSecondary::cancelFirmware(const Uptane::Target& target) {
+  LOG_INFO << "Instructing Secondary " << getSerial() << " to stop downloading OSTree commit " << target.sha256Hash();
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_ostreePullStatusReq);
+  auto m = req->ostreePullStatusReq();
+  m->abort = Asn1Allocation<BOOLEAN_t>();
+  *m->abort = 1;
+  auto resp = rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_ostreePullStatusResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to stop the OSTree download.";
+  }
+}
+
 data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target& target) {
   std::string data_to_send;
 
   if (target.IsOstree()) {
     // empty firmware means OSTree Secondaries: pack credentials instead
-    data_to_send = secondary_provider_->getTreehubCredentials();
+    data_to_send = secondary_provider_->getTreehubCredentials(target);
   } else {
     std::stringstream sstr;
-    auto str = secondary_provider_->getTargetFileHandle(target);
-    sstr << str.rdbuf();
+    auto str = secondary_provider_->getTargetStream(target, 0);
+    sstr << str->rdbuf();
     data_to_send = sstr.str();
   }
 
@@ -401,7 +631,7 @@ data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target
 
   auto m = req->sendFirmwareReq();
   SetString(&m->firmware, data_to_send);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_sendFirmwareResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware.";
@@ -460,7 +690,7 @@ data::InstallationResult IpUptaneSecondary::install_v1(const Uptane::Target& tar
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
   // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp) {
@@ -481,15 +711,19 @@ data::InstallationResult IpUptaneSecondary::install_v2(const Uptane::Target& tar
   return invokeInstallOnSecondary(target);
 }
 
-data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Target& target) {
+data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Target& target, bool background) {
   LOG_INFO << "Instructing Secondary " << getSerial() << " to download OSTree commit " << target.sha256Hash();
-  const std::string tls_creds = secondary_provider_->getTreehubCredentials();
+  const std::string tls_creds = secondary_provider_->getTreehubCredentials(target);
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(static_cast<AKIpUptaneMes_PR>(AKIpUptaneMes_PR_downloadOstreeRevReq));
 
   auto m = req->downloadOstreeRevReq();
   SetString(&m->tlsCred, tls_creds);
-  auto resp = Asn1Rpc(req, getAddr());
+  if (background) {
+    m->background = Asn1Allocation<BOOLEAN_t>();
+    *m->background = 1;
+  }
+  auto resp = rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_downloadOstreeRevResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to download an OSTree commit.";
@@ -502,43 +736,431 @@ data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Targ
   return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
 }
 
+/* Like fetchTarget(), an interrupted upload continues where it stopped
+ * instead of starting over, if the Secondary supports that. Only failures to
+ * reach the Secondary are retried; errors that it reports are final. */
 data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target& target) {
   LOG_INFO << "Uploading the target image (" << target.filename() << ") "
            << "to the Secondary (" << getSerial() << ")";
 
+  if (upload_multicast_) {
+    const auto multicast_result = uploadFirmwareMulticast(target);
+    if (multicast_result && multicast_result->isSuccess()) {
+      return *multicast_result;
+    }
+    if (multicast_result) {
+      LOG_WARNING << "Multicast upload to Secondary " << getSerial() << " failed: " << multicast_result->description
+                  << "; uploading the target image by unicast";
+    }
+  }
+  if (upload_delta_) {
+    const auto delta_result = uploadFirmwareDelta(target);
+    if (delta_result && delta_result->isSuccess()) {
+      return *delta_result;
+    }
+    if (delta_result) {
+      LOG_WARNING << "Delta upload to Secondary " << getSerial() << " failed: " << delta_result->description
+                  << "; uploading the whole target image";
+    }
+  }
+
+  const bool resume = upload_resume_supported_;
+  const unsigned int attempts = resume ? kUploadAttempts : 1;
+  data::InstallationResult upload_result;
+  for (unsigned int attempt = 1; attempt <= attempts; ++attempt) {
+    upload_result = uploadFirmwareFrom(target, resume);
+    if (upload_result.isSuccess() || upload_result.result_code.num_code != data::ResultCode::Numeric::kUnknown) {
+      break;
+    }
+    if (attempt < attempts) {
+      LOG_WARNING << "Uploading the target image to Secondary " << getSerial()
+                  << " was interrupted; resuming the upload";
+    }
+  }
+  return upload_result;
+}
+
+data::InstallationResult IpUptaneSecondary::uploadFirmwareFrom(const Uptane::Target& target, const bool resume) {
   auto upload_result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "");
 
-  auto image_reader = secondary_provider_->getTargetFileHandle(target);
+  // All chunks go over one connection, and up to upload_window of them are
+  // sent before the first response is read, so the upload is not bound by
+  // the round trip time.
+  ConnectionSocket connection(getAddr().first, getAddr().second);
+  if (connection.connect() < 0) {
+    LOG_ERROR << "Failed to connect to the Secondary ( " << getAddr().first << ":" << getAddr().second
+              << "): " << std::strerror(errno);
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+  }
 
   uint64_t image_size = target.length();
-  const size_t size = 1024;
-  size_t total_send_data = 0;
-  std::array<uint8_t, size> buf{};
+  DequeueBuffer rx_buffer;
+  uint64_t offset = 0;
+  if (resume) {
+    offset = receiveUploadOffset(*connection, rx_buffer);
+    if (offset > image_size) {
+      offset = 0;
+    }
+    if (offset > 0) {
+      LOG_INFO << "Secondary " << getSerial() << " already has " << offset << " of " << image_size
+               << " bytes of the target image";
+    }
+  }
+  // A stored image is read in large blocks ahead of the chunks being sent.
+  // Images streamed from the server, and those of package managers that do
+  // not store plain files, are read through the stream of the provider.
+  std::unique_ptr<BlockReader> block_reader;
+  std::unique_ptr<std::istream> image_reader;
+  const auto image_path = secondary_provider_->getTargetFilePath(target);
+  boost::system::error_code ec;
+  if (image_path && boost::filesystem::file_size(*image_path, ec) == image_size && !ec) {
+    try {
+      block_reader = std::make_unique<BlockReader>(*image_path, offset, image_size - offset);
+    } catch (const std::exception& e) {
+      LOG_DEBUG << "Reading the target image through a stream: " << e.what();
+    }
+  }
+  if (!block_reader) {
+    image_reader = secondary_provider_->getTargetStream(target, offset);
+  }
+  uint64_t total_send_data = offset;
+  size_t in_flight = 0;
+  std::vector<uint8_t> buf(upload_chunk_size);
+  const bool deflate = upload_deflate_;
+  std::vector<uint8_t> deflated;
+  uint64_t sent_bytes = 0;
   auto upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 
-  while (total_send_data < image_size && upload_data_result.isSuccess()) {
-    image_reader.read(reinterpret_cast<char*>(buf.data()), buf.size());
-    upload_data_result = uploadFirmwareData(buf.data(), static_cast<size_t>(image_reader.gcount()));
-    total_send_data += static_cast<size_t>(image_reader.gcount());
+  while (upload_data_result.isSuccess() && (total_send_data < image_size || in_flight > 0)) {
+    if (total_send_data < image_size && in_flight < upload_window) {
+      size_t read_size = 0;
+      if (block_reader) {
+        try {
+          read_size = block_reader->read(buf.data(), buf.size());
+        } catch (const std::exception& e) {
+          LOG_ERROR << "Failed to read the target image for Secondary " << getSerial() << ": " << e.what();
+        }
+      } else {
+        image_reader->read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+        read_size = static_cast<size_t>(image_reader->gcount());
+      }
+      if (read_size == 0) {
+        break;
+      }
+      // The first chunk tells the Secondary where this transfer starts
+      const uint64_t* start = total_send_data == offset && offset > 0 ? &offset : nullptr;
+      // Chunks that do not get smaller go as they are
+      const bool send_deflated = deflate && UploadCompression::deflateChunk(buf.data(), read_size, &deflated);
+      const uint8_t* send_data = send_deflated ? deflated.data() : buf.data();
+      const size_t send_size = send_deflated ? deflated.size() : read_size;
+      sent_bytes += send_size;
+      if (!sendFirmwareData(*connection, send_data, send_size, start, send_deflated)) {
+        upload_data_result = data::InstallationResult(
+            data::ResultCode::Numeric::kUnknown,
+            "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+        break;
+      }
+      total_send_data += read_size;
+      ++in_flight;
+      continue;
+    }
+    upload_data_result = receiveFirmwareDataResult(*connection, rx_buffer);
+    --in_flight;
   }
-  if (upload_data_result.isSuccess() && total_send_data == image_size) {
+  if (upload_data_result.isSuccess() && total_send_data == image_size && in_flight == 0) {
+    if (deflate) {
+      LOG_INFO << "Sent " << total_send_data - offset << " bytes of the target image to Secondary " << getSerial()
+               << " in " << sent_bytes << " bytes";
+    }
     upload_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
   } else if (!upload_data_result.isSuccess()) {
     upload_result = upload_data_result;
   } else {
     upload_result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Incomplete upload");
   }
-  image_reader.close();
   return upload_result;
 }
 
-data::InstallationResult IpUptaneSecondary::uploadFirmwareData(const uint8_t* data, size_t size) {
+namespace {
+
+// A run of the new image, copied from the installed image or sent as data
+struct UploadRun {
+  bool copy;
+  uint64_t offset;  // In the installed image for copies, in the new one for data
+  uint64_t length;
+};
+
+/* Content-defined chunks (see ChunkIndex) of the new image that also occur in
+ * the installed one are copied, which keeps the runs aligned across
+ * insertions and removals. Returns the number of bytes that are copied. */
+uint64_t planDeltaUpload(const boost::filesystem::path& base, const boost::filesystem::path& image,
+                         std::vector<UploadRun>* runs) {
+  const ChunkingParams params;
+  std::unordered_map<std::string, Chunk> base_chunks;
+  ChunkIndex::chunkFile(base, params, [&base_chunks](const Chunk& chunk) { base_chunks.emplace(chunk.sha256, chunk); });
+
+  uint64_t copied = 0;
+  ChunkIndex::chunkFile(image, params, [&](const Chunk& chunk) {
+    auto it = base_chunks.find(chunk.sha256);
+    const bool copy = it != base_chunks.end() && it->second.length == chunk.length;
+    const uint64_t offset = copy ? it->second.offset : chunk.offset;
+    if (!runs->empty() && runs->back().copy == copy && runs->back().offset + runs->back().length == offset) {
+      runs->back().length += chunk.length;
+    } else {
+      runs->push_back(UploadRun{copy, offset, chunk.length});
+    }
+    if (copy) {
+      copied += chunk.length;
+    }
+  });
+  return copied;
+}
+
+}  // namespace
+
+/* Returns boost::none if there is nothing to copy from, e.g. because the
+ * Primary no longer has the installed image or it shares no chunks with the
+ * new one. */
+boost::optional<data::InstallationResult> IpUptaneSecondary::uploadFirmwareDelta(const Uptane::Target& target) {
+  const auto base = secondary_provider_->getInstalledTargetFile(getSerial());
+  const auto image_path = secondary_provider_->getTargetFilePath(target);
+  if (!base || !image_path || base->first.sha256Hash().empty() || base->first.MatchTarget(target)) {
+    return boost::none;
+  }
+  std::vector<UploadRun> runs;
+  uint64_t copied = 0;
+  try {
+    copied = planDeltaUpload(base->second, *image_path, &runs);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not compare the target image with the installed one: " << e.what();
+    return boost::none;
+  }
+  if (copied == 0) {
+    return boost::none;
+  }
+  LOG_INFO << "Secondary " << getSerial() << " can copy " << copied << " of " << target.length()
+           << " bytes of the target image from its installed image " << base->first.filename();
+
+  ConnectionSocket connection(getAddr().first, getAddr().second);
+  if (connection.connect() < 0) {
+    LOG_ERROR << "Failed to connect to the Secondary ( " << getAddr().first << ":" << getAddr().second
+              << "): " << std::strerror(errno);
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+  }
+  std::ifstream image(image_path->string(), std::ios::binary);
+  DequeueBuffer rx_buffer;
+  std::vector<uint8_t> buf(upload_chunk_size);
+  const bool deflate = upload_deflate_;
+  std::vector<uint8_t> deflated;
+  uint64_t sent_bytes = 0;
+  size_t in_flight = 0;
+  auto run = runs.cbegin();
+  uint64_t run_done = 0;
+  auto upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+
+  while (upload_data_result.isSuccess() && (run != runs.cend() || in_flight > 0)) {
+    if (run != runs.cend() && in_flight < upload_window) {
+      bool sent = false;
+      if (run->copy) {
+        Asn1Message::Ptr req(Asn1Message::Empty());
+        req->present(AKIpUptaneMes_PR_uploadDataReq);
+        auto m = req->uploadDataReq();
+        m->copyOffset = Asn1Allocation<long>();            // NOLINT(google-runtime-int)
+        *m->copyOffset = static_cast<long>(run->offset);  // NOLINT(google-runtime-int)
+        m->copyLength = Asn1Allocation<long>();            // NOLINT(google-runtime-int)
+        *m->copyLength = static_cast<long>(run->length);  // NOLINT(google-runtime-int)
+        m->copyBase = Asn1Allocation<OCTET_STRING_t>();
+        SetString(m->copyBase, base->first.sha256Hash());
+        sent = Asn1Send(req, *connection);
+        run_done = run->length;
+      } else {
+        const auto size = static_cast<size_t>(std::min<uint64_t>(buf.size(), run->length - run_done));
+        image.seekg(static_cast<std::streamoff>(run->offset + run_done));
+        image.read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(size));
+        if (static_cast<size_t>(image.gcount()) != size) {
+          upload_data_result =
+              data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Could not read the target image");
+          break;
+        }
+        const bool send_deflated = deflate && UploadCompression::deflateChunk(buf.data(), size, &deflated);
+        const uint8_t* send_data = send_deflated ? deflated.data() : buf.data();
+        const size_t send_size = send_deflated ? deflated.size() : size;
+        sent_bytes += send_size;
+        sent = sendFirmwareData(*connection, send_data, send_size, nullptr, send_deflated);
+        run_done += size;
+      }
+      if (!sent) {
+        upload_data_result = data::InstallationResult(
+            data::ResultCode::Numeric::kUnknown,
+            "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+        break;
+      }
+      if (run_done == run->length) {
+        ++run;
+        run_done = 0;
+      }
+      ++in_flight;
+      continue;
+    }
+    upload_data_result = receiveFirmwareDataResult(*connection, rx_buffer);
+    --in_flight;
+  }
+  if (upload_data_result.isSuccess()) {
+    LOG_INFO << "Sent the target image to Secondary " << getSerial() << " in " << sent_bytes << " bytes";
+  }
+  return upload_data_result;
+}
+
+/* The Secondary first receives a round of the multicast session of the
+ * Target, which it shares with all the other Secondaries that receive the same
+ * Target meanwhile, and then gets the blocks it has lost by unicast. Returns
+ * boost::none if the Primary does not have the image as a file. */
+boost::optional<data::InstallationResult> IpUptaneSecondary::uploadFirmwareMulticast(const Uptane::Target& target) {
+  const auto image_path = secondary_provider_->getTargetFilePath(target);
+  if (!image_path || target.length() == 0) {
+    return boost::none;
+  }
+  std::shared_ptr<FirmwareMulticast::Sender::Session> session;
+  try {
+    session = multicast_->join(target.sha256Hash(), *image_path, target.length());
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not multicast the target image: " << e.what();
+    return boost::none;
+  }
+
   Asn1Message::Ptr req(Asn1Message::Empty());
-  req->present(AKIpUptaneMes_PR_uploadDataReq);
+  req->present(AKIpUptaneMes_PR_multicastJoinReq);
+  auto m = req->multicastJoinReq();
+  SetString(&m->group, multicast_->group());
+  m->port = multicast_->port();
+  m->session = static_cast<long>(session->id());  // NOLINT(google-runtime-int)
+  m->blockSize = FirmwareMulticast::kBlockSize;
+  auto resp = rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_multicastJoinResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to join a multicast group.";
+    return boost::none;
+  }
+  if (resp->multicastJoinResp()->result != AKInstallationResult_success) {
+    LOG_WARNING << "Secondary " << getSerial() << " could not join the multicast group: "
+                << ToString(resp->multicastJoinResp()->description);
+    return boost::none;
+  }
+
+  // Every block comes by once in a round, wherever the round starts
+  const uint64_t block_count = session->blockCount();
+  const bool sent = session->waitForBlocks(session->blocksSent() + block_count);
+
+  req = Asn1Message::Empty();
+  req->present(AKIpUptaneMes_PR_multicastStatusReq);
+  req->multicastStatusReq()->leave = 1;
+  resp = rpc(req);
+  // Let the session stop once no other Secondary receives it
+  session.reset();
+  if (!sent || resp->present() != AKIpUptaneMes_PR_multicastStatusResp) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Multicast upload failed");
+  }
+  const std::string missing = ToString(resp->multicastStatusResp()->missing);
+  if (missing.size() != (block_count + 7) / 8) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Secondary " + getSerial().ToString() + " reported invalid missing blocks");
+  }
+  std::vector<uint64_t> lost;
+  for (uint64_t block = 0; block < block_count; ++block) {
+    if (FirmwareMulticast::isBlockMissing(missing, block)) {
+      lost.push_back(block);
+    }
+  }
+  LOG_INFO << "Secondary " << getSerial() << " received " << block_count - lost.size() << " of " << block_count
+           << " blocks of the target image by multicast";
+  if (lost.empty()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+
+  ConnectionSocket connection(getAddr().first, getAddr().second);
+  if (connection.connect() < 0) {
+    LOG_ERROR << "Failed to connect to the Secondary ( " << getAddr().first << ":" << getAddr().second
+              << "): " << std::strerror(errno);
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+  }
+  std::ifstream image(image_path->string(), std::ios::binary);
+  DequeueBuffer rx_buffer;
+  std::vector<uint8_t> buf(FirmwareMulticast::kBlockSize);
+  size_t in_flight = 0;
+  auto next = lost.cbegin();
+  auto upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  while (upload_data_result.isSuccess() && (next != lost.cend() || in_flight > 0)) {
+    if (next != lost.cend() && in_flight < upload_window) {
+      const uint64_t offset = *next * FirmwareMulticast::kBlockSize;
+      const auto size = static_cast<size_t>(std::min<uint64_t>(buf.size(), target.length() - offset));
+      image.seekg(static_cast<std::streamoff>(offset));
+      image.read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(size));
+      if (static_cast<size_t>(image.gcount()) != size) {
+        upload_data_result =
+            data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Could not read the target image");
+        break;
+      }
+      Asn1UploadData upload;
+      upload.data = buf.data();
+      upload.size = size;
+      auto block_req = Asn1Message::FromUploadData(upload);
+      block_req->uploadDataReq()->block = Asn1Allocation<long>();      // NOLINT(google-runtime-int)
+      *block_req->uploadDataReq()->block = static_cast<long>(*next);  // NOLINT(google-runtime-int)
+      if (!Asn1Send(block_req, *connection)) {
+        upload_data_result = data::InstallationResult(
+            data::ResultCode::Numeric::kUnknown,
+            "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+        break;
+      }
+      ++next;
+      ++in_flight;
+      continue;
+    }
+    upload_data_result = receiveFirmwareDataResult(*connection, rx_buffer);
+    --in_flight;
+  }
+  return upload_data_result;
+}
+
+/* Returns 0 if the Secondary does not answer, so that the upload then starts
+ * from the beginning. */
+uint64_t IpUptaneSecondary::receiveUploadOffset(int con_fd, DequeueBuffer& buffer) const {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_uploadOffsetReq);
+  if (!Asn1Send(req, con_fd)) {
+    return 0;
+  }
+  auto resp = Asn1Receive(con_fd, buffer);
+  if (resp->present() != AKIpUptaneMes_PR_uploadOffsetResp || resp->uploadOffsetResp()->offset < 0) {
+    LOG_WARNING << "Secondary " << getSerial() << " failed to respond to an upload offset request.";
+    return 0;
+  }
+  return static_cast<uint64_t>(resp->uploadOffsetResp()->offset);
+}
+
+bool IpUptaneSecondary::sendFirmwareData(int con_fd, const uint8_t* data, size_t size, const uint64_t* offset,
+                                         const bool deflated) {
+  Asn1UploadData upload;
+  upload.data = data;
+  upload.size = size;
+  if (offset != nullptr) {
+    upload.has_offset = true;
+    upload.offset = *offset;
+  }
+  if (deflated) {
+    upload.has_compression = true;
+    upload.compression = AKCompression_deflate;
+  }
+  return Asn1SendUploadData(upload, con_fd);
+}
 
-  auto m = req->uploadDataReq();
-  OCTET_STRING_fromBuf(&m->data, reinterpret_cast<const char*>(data), static_cast<int>(size));
-  auto resp = Asn1Rpc(req, getAddr());
+data::InstallationResult IpUptaneSecondary::receiveFirmwareDataResult(int con_fd, DequeueBuffer& buffer) const {
+  auto resp = Asn1Receive(con_fd, buffer);
 
   if (resp->present() == AKIpUptaneMes_PR_NOTHING) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware data.";
@@ -565,7 +1187,7 @@ data::InstallationResult IpUptaneSecondary::invokeInstallOnSecondary(const Uptan
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
   // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = rpc(req);
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp2) {
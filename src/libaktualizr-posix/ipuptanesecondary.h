@@ -1,27 +1,49 @@
 #ifndef UPTANE_IPUPTANESECONDARY_H_
 #define UPTANE_IPUPTANESECONDARY_H_
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <boost/intrusive_ptr.hpp>
+#include <boost/optional.hpp>
+
 #include "libaktualizr/secondaryinterface.h"
 #include "libaktualizr/types.h"
 
 struct AKMetaCollection;
 using AKMetaCollection_t = struct AKMetaCollection;
+class Asn1Message;
+class ConnectionSocket;
+class DequeueBuffer;
+namespace FirmwareMulticast {
+class Sender;
+}
 
 namespace Uptane {
 
 class IpUptaneSecondary : public SecondaryInterface {
  public:
+  // If keep_alive is set, requests share one connection to the Secondary
+  // once the Secondary has confirmed that it supports that.
   static SecondaryInterface::Ptr connectAndCreate(const std::string& address, unsigned short port,
-                                                  VerificationType verification_type);
+                                                  VerificationType verification_type, bool keep_alive = false);
   static SecondaryInterface::Ptr create(const std::string& address, unsigned short port,
-                                        VerificationType verification_type, int con_fd);
+                                        VerificationType verification_type, int con_fd, bool keep_alive = false);
 
   static SecondaryInterface::Ptr connectAndCheck(const std::string& address, unsigned short port,
                                                  VerificationType verification_type, EcuSerial serial,
-                                                 HardwareIdentifier hw_id, PublicKey pub_key);
+                                                 HardwareIdentifier hw_id, PublicKey pub_key,
+                                                 bool keep_alive = false);
 
   explicit IpUptaneSecondary(const std::string& address, unsigned short port, VerificationType verification_type,
-                             EcuSerial serial, HardwareIdentifier hw_id, PublicKey pub_key);
+                             EcuSerial serial, HardwareIdentifier hw_id, PublicKey pub_key, bool keep_alive = false);
+  ~IpUptaneSecondary() override;
+  IpUptaneSecondary(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary(IpUptaneSecondary&&) = delete;
+  IpUptaneSecondary& operator=(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary& operator=(IpUptaneSecondary&&) = delete;
 
   std::string Type() const override { return "IP"; }
   EcuSerial getSerial() const override { return serial_; };
@@ -31,13 +53,22 @@ class IpUptaneSecondary : public SecondaryInterface {
   void init(std::shared_ptr<SecondaryProvider> secondary_provider_in) override {
     secondary_provider_ = std::move(secondary_provider_in);
   }
+  // Multicast firmware to this Secondary, together with the others that share
+  // `sender` and receive the same Target, if it supports that.
+  void setMulticast(std::shared_ptr<FirmwareMulticast::Sender> sender) { multicast_ = std::move(sender); }
   data::InstallationResult putMetadata(const Target& target) override;
   int32_t getRootVersion(bool director) const override;
   data::InstallationResult putRoot(const std::string& root, bool director) override;
+  data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director) override;
   Manifest getManifest() const override;
   bool ping() const override;
+  bool acceptsFirmwareStream() const override { return true; }
   data::InstallationResult sendFirmware(const Uptane::Target& target, const InstallInfo& install_info,
                                         const api::FlowControlToken* flow_control) override;
+  boost::optional<data::InstallationResult> startFirmware(const Uptane::Target& target,
+                                                          const InstallInfo& install_info) override;
+  boost::optional<data::InstallationResult> firmwareStatus(const Uptane::Target& target) override;
+  void cancelFirmware(const Uptane::Target& target) override;
   data::InstallationResult install(const Uptane::Target& target, const InstallInfo& info,
                                    const api::FlowControlToken* flow_control) override;
 
@@ -53,9 +84,16 @@ class IpUptaneSecondary : public SecondaryInterface {
 
  private:
   const std::pair<std::string, uint16_t>& getAddr() const { return addr_; }
+  boost::intrusive_ptr<Asn1Message> rpc(const boost::intrusive_ptr<Asn1Message>& req) const;
+  // Send a request that is already DER encoded, e.g. one shared by all Secondaries
+  boost::intrusive_ptr<Asn1Message> rpc(const std::string& encoded) const;
+  boost::intrusive_ptr<Asn1Message> rpcOnConnection(const std::function<bool(int)>& send) const;
+  void closeConnection() const;
   void getSecondaryVersion() const;
+  bool loadMetadata(const Uptane::Target& target, Uptane::MetaBundle* meta_bundle) const;
   data::InstallationResult putMetadata_v1(const Uptane::MetaBundle& meta_bundle);
-  data::InstallationResult putMetadata_v2(const Uptane::MetaBundle& meta_bundle);
+  data::InstallationResult putMetadata_v2(const Uptane::Target& target);
+  std::string encodeMetadata_v2(const Uptane::MetaBundle& meta_bundle) const;
   data::InstallationResult sendFirmware_v1(const Uptane::Target& target);
   data::InstallationResult sendFirmware_v2(const Uptane::Target& target);
   data::InstallationResult install_v1(const Uptane::Target& target);
@@ -63,9 +101,15 @@ class IpUptaneSecondary : public SecondaryInterface {
   static void addMetadata(const Uptane::MetaBundle& meta_bundle, Uptane::RepositoryType repo, const Uptane::Role& role,
                           AKMetaCollection_t& collection);
   data::InstallationResult invokeInstallOnSecondary(const Uptane::Target& target);
-  data::InstallationResult downloadOstreeRev(const Uptane::Target& target);
+  data::InstallationResult downloadOstreeRev(const Uptane::Target& target, bool background = false);
   data::InstallationResult uploadFirmware(const Uptane::Target& target);
-  data::InstallationResult uploadFirmwareData(const uint8_t* data, size_t size);
+  data::InstallationResult uploadFirmwareFrom(const Uptane::Target& target, bool resume);
+  boost::optional<data::InstallationResult> uploadFirmwareDelta(const Uptane::Target& target);
+  boost::optional<data::InstallationResult> uploadFirmwareMulticast(const Uptane::Target& target);
+  uint64_t receiveUploadOffset(int con_fd, DequeueBuffer& buffer) const;
+  static bool sendFirmwareData(int con_fd, const uint8_t* data, size_t size, const uint64_t* offset = nullptr,
+                               bool deflated = false);
+  data::InstallationResult receiveFirmwareDataResult(int con_fd, DequeueBuffer& buffer) const;
 
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   const std::pair<std::string, uint16_t> addr_;
@@ -74,6 +118,40 @@ class IpUptaneSecondary : public SecondaryInterface {
   const HardwareIdentifier hw_id_;
   const PublicKey pub_key_;
   mutable uint32_t protocol_version{0};
+
+  // Firmware upload parameters: what is offered to the Secondary, and what
+  // applies if it does not answer the offer.
+  static constexpr size_t kUploadChunkSize{64 * 1024};
+  static constexpr size_t kUploadWindow{8};
+  static constexpr size_t kDefaultUploadChunkSize{1024};
+  mutable size_t upload_chunk_size{kDefaultUploadChunkSize};
+  mutable size_t upload_window{1};
+
+  // Persistent connection, used once keep_alive_ is confirmed by the Secondary
+  const bool keep_alive_;
+  mutable std::atomic<bool> keep_alive_confirmed_{false};
+  mutable std::unique_ptr<ConnectionSocket> connection_;
+  mutable std::unique_ptr<DequeueBuffer> connection_buffer_;
+  mutable std::mutex connection_mutex_;
+
+  // Whether the Secondary accepts a whole chain of Roots in one request
+  mutable std::atomic<bool> root_chain_supported_{false};
+  // Whether the Secondary can tell how much of an interrupted upload it kept.
+  // Interrupted uploads are then retried from there up to kUploadAttempts times.
+  static constexpr unsigned int kUploadAttempts{3};
+  mutable std::atomic<bool> upload_resume_supported_{false};
+  // Whether firmware chunks may be sent deflated
+  mutable std::atomic<bool> upload_deflate_{false};
+  // Whether uploads may copy the unchanged parts of the Secondary's installed image
+  mutable std::atomic<bool> upload_delta_{false};
+  // Whether the Secondary can join the multicast group of multicast_
+  std::shared_ptr<FirmwareMulticast::Sender> multicast_;
+  mutable std::atomic<bool> upload_multicast_{false};
+  // Whether the Secondary pulls OSTree commits in the background. A pull is
+  // only given up after kPullStatusAttempts status requests in a row failed.
+  static constexpr unsigned int kPullStatusAttempts{3};
+  mutable std::atomic<bool> ostree_background_pull_{false};
+  unsigned int pull_status_failures_{0};
 };
 
 }  // namespace Uptane
@@ -0,0 +1,32 @@
+#include "upload_compression.h"
+
+#include <zlib.h>
+
+namespace UploadCompression {
+
+bool deflateChunk(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+  if (size < 2) {
+    return false;
+  }
+  // Anything that does not fit into size - 1 bytes is not worth sending compressed
+  out->resize(size - 1);
+  auto out_size = static_cast<uLongf>(out->size());
+  if (compress2(out->data(), &out_size, data, static_cast<uLong>(size), Z_BEST_SPEED) != Z_OK) {
+    return false;
+  }
+  out->resize(out_size);
+  return true;
+}
+
+bool inflateChunk(const uint8_t* data, size_t size, size_t max_size, std::vector<uint8_t>* out) {
+  out->resize(max_size);
+  auto out_size = static_cast<uLongf>(out->size());
+  if (uncompress(out->data(), &out_size, data, static_cast<uLong>(size)) != Z_OK) {
+    out->clear();
+    return false;
+  }
+  out->resize(out_size);
+  return true;
+}
+
+}  // namespace UploadCompression
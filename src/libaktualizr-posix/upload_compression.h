@@ -0,0 +1,30 @@
+#ifndef UPTANE_UPLOAD_COMPRESSION_H_
+#define UPTANE_UPLOAD_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Compression of single firmware upload chunks between the Primary and IP
+ * Secondaries. Every chunk is a zlib stream of its own, so the Secondary can
+ * decompress, hash and store chunks as they arrive, and chunks that would
+ * not get smaller are simply sent as they are.
+ */
+namespace UploadCompression {
+
+/**
+ * Compress `size` bytes at `data` into `out`. Returns false, leaving `out`
+ * unspecified, if the compressed chunk would not be smaller.
+ */
+bool deflateChunk(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+
+/**
+ * Decompress one chunk into `out`. Fails for corrupt data and for chunks that
+ * would decompress to more than `max_size` bytes.
+ */
+bool inflateChunk(const uint8_t* data, size_t size, size_t max_size, std::vector<uint8_t>* out);
+
+}  // namespace UploadCompression
+
+#endif  // UPTANE_UPLOAD_COMPRESSION_H_
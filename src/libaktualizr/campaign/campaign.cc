@@ -1,5 +1,6 @@
 #include "libaktualizr/campaign.h"
 #include "http/httpclient.h"
+#include "storage/invstorage.h"
 #include "utilities/utils.h"
 
 namespace campaign {
@@ -121,4 +122,34 @@ std::vector<Campaign> Campaign::fetchAvailableCampaigns(HttpInterface &http_clie
 
   return campaignsFromJson(json);
 }
+
+std::vector<Campaign> Campaign::fetchAvailableCampaigns(HttpInterface &http_client, const std::string &tls_server,
+                                                        INvStorage &storage, bool *changed) {
+  *changed = false;
+  std::string stored;
+  HttpValidators validators;
+  const bool have_stored = storage.loadCampaigns(&stored, &validators.etag, &validators.last_modified);
+  if (!have_stored) {
+    validators = HttpValidators();
+  }
+
+  HttpResponse response =
+      http_client.getConditional(tls_server + "/campaigner/campaigns", kMaxCampaignsMetaSize, &validators, nullptr);
+  Json::Value json;
+  if (response.isNotModified() && have_stored) {
+    LOG_DEBUG << "List of available campaigns did not change";
+    json = Utils::parseJSON(stored);
+  } else if (response.isOk()) {
+    *changed = !have_stored || response.body != stored;
+    storage.storeCampaigns(response.body, validators.etag, validators.last_modified);
+    json = response.getJson();
+  } else {
+    LOG_ERROR << "Failed to fetch list of available campaigns";
+    return {};
+  }
+
+  LOG_TRACE << "Campaign: " << json;
+
+  return campaignsFromJson(json);
+}
 }  // namespace campaign
@@ -1,5 +1,14 @@
 #include "libaktualizr/config.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 #include <boost/filesystem.hpp>
 
 #include "logging/logging.h"
@@ -14,17 +23,56 @@ void BaseConfig::checkDirs(const std::vector<boost::filesystem::path>& configs)
   }
 }
 
-void BaseConfig::updateFromToml(const boost::filesystem::path& filename) {
+static boost::property_tree::ptree readToml(const boost::filesystem::path& filename) {
   LOG_INFO << "Reading config: " << filename;
   if (!boost::filesystem::exists(filename)) {
     throw std::runtime_error("Config file " + filename.string() + " does not exist.");
   }
   boost::property_tree::ptree pt;
   boost::property_tree::ini_parser::read_ini(filename.string(), pt);
-  updateFromPropertyTree(pt);
+  return pt;
+}
+
+// Sets the values in `from` in `into`, the way reading `from` after `into` would
+static void mergeToml(boost::property_tree::ptree& into, const boost::property_tree::ptree& from) {
+  for (const auto& child : from) {
+    const auto found = into.find(child.first);
+    if (found == into.not_found()) {
+      into.push_back(child);
+    } else if (child.second.empty()) {
+      into.to_iterator(found)->second = child.second;
+    } else {
+      mergeToml(into.to_iterator(found)->second, child.second);
+    }
+  }
 }
 
-void BaseConfig::updateFromDirs(const std::vector<boost::filesystem::path>& configs) {
+// First line of the cached config, which identifies the config files it was made from
+static std::string cacheHeader(const std::map<std::string, boost::filesystem::path>& configs_map) {
+  // Bump the version whenever the layout of the cache changes
+  std::string key = "1";
+  for (const auto& config_file : configs_map) {
+    struct stat st {};
+    if (stat(config_file.second.c_str(), &st) != 0) {
+      return "";
+    }
+    key += "\n" + config_file.second.string() + " " + std::to_string(st.st_size) + " " +
+           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+  }
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char c : key) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+  }
+  std::ostringstream header;
+  header << "; " << std::hex << std::setw(16) << std::setfill('0') << hash << "\n";
+  return header.str();
+}
+
+void BaseConfig::updateFromToml(const boost::filesystem::path& filename) { updateFromPropertyTree(readToml(filename)); }
+
+void BaseConfig::updateFromDirs(const std::vector<boost::filesystem::path>& configs,
+                                const boost::filesystem::path& cache) {
   std::map<std::string, boost::filesystem::path> configs_map;
   for (const auto& config : configs) {
     if (!boost::filesystem::exists(config)) {
@@ -38,8 +86,77 @@ void BaseConfig::updateFromDirs(const std::vector<boost::filesystem::path>& conf
       configs_map[config.filename().string()] = config;
     }
   }
+  const std::string header = cache.empty() || configs_map.empty() ? std::string() : cacheHeader(configs_map);
+  if (header.empty()) {
+    for (const auto& config_file : configs_map) {
+      updateFromToml(config_file.second);
+    }
+    return;
+  }
+
+  boost::property_tree::ptree pt;
+  // The cache holds every option, including secrets such as p11.pass. One that others can read, e.g. written by an
+  // older version, is made again.
+  struct stat cache_st {};
+  const bool private_cache = stat(cache.c_str(), &cache_st) == 0 && (cache_st.st_mode & (S_IRWXG | S_IRWXO)) == 0 &&
+                             cache_st.st_uid == getuid();
+  std::ifstream cached;
+  if (private_cache) {
+    cached.open(cache.string());
+  }
+  std::string line;
+  if (cached && std::getline(cached, line) && line + "\n" == header) {
+    try {
+      boost::property_tree::ini_parser::read_ini(cached, pt);
+      LOG_DEBUG << "Reading cached config: " << cache;
+      updateFromPropertyTree(pt);
+      return;
+    } catch (const boost::property_tree::ini_parser_error& e) {
+      LOG_WARNING << "Ignoring the cached config in " << cache << ": " << e.what();
+      pt.clear();
+    }
+  }
+
   for (const auto& config_file : configs_map) {
-    updateFromToml(config_file.second);
+    mergeToml(pt, readToml(config_file.second));
+  }
+  updateFromPropertyTree(pt);
+
+  // Only valid configs get here. Concurrent processes may write the cache at the same time.
+  boost::filesystem::path tmp_cache = cache;
+  tmp_cache += "." + std::to_string(getpid());
+  try {
+    if (!cache.parent_path().empty() && !boost::filesystem::exists(cache.parent_path())) {
+      Utils::createDirectories(cache.parent_path(), S_IRWXU);
+    }
+    std::ostringstream out;
+    out << header;
+    boost::property_tree::ini_parser::write_ini(out, pt);
+    const std::string content = out.str();
+    // Only readable by the owner, whatever the umask
+    boost::filesystem::remove(tmp_cache);
+    const int fd = ::open(tmp_cache.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      throw std::runtime_error("Error creating " + tmp_cache.string() + ": " + std::strerror(errno));
+    }
+    size_t written = 0;
+    while (written < content.size()) {
+      const ssize_t res = ::write(fd, content.data() + written, content.size() - written);
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      if (res <= 0) {
+        ::close(fd);
+        throw std::runtime_error("Error writing " + tmp_cache.string());
+      }
+      written += static_cast<size_t>(res);
+    }
+    ::close(fd);
+    boost::filesystem::rename(tmp_cache, cache);
+  } catch (const std::exception& e) {
+    LOG_DEBUG << "Could not cache the config in " << cache << ": " << e.what();
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp_cache, ec);
   }
 }
 
@@ -1,11 +1,14 @@
 #include <fcntl.h>
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <sstream>
 
 #include "bootstrap/bootstrap.h"
 #include "libaktualizr/config.h"
+#include "utilities/bandwidth_limiter.h"
 #include "utilities/config_utils.h"
 #include "utilities/exceptions.h"
+#include "utilities/resource_policy.h"
 #include "utilities/utils.h"
 
 std::ostream& operator<<(std::ostream& os, ProvisionMode mode) {
@@ -87,32 +90,147 @@ void ProvisionConfig::writeToStream(std::ostream& out_stream) const {
 
 void UptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(polling_sec, "polling_sec", pt);
+  CopyFromConfig(polling_active_sec, "polling_active_sec", pt);
+  CopyFromConfig(polling_max_sec, "polling_max_sec", pt);
+  CopyFromConfig(polling_jitter_percent, "polling_jitter_percent", pt);
   CopyFromConfig(director_server, "director_server", pt);
   CopyFromConfig(repo_server, "repo_server", pt);
+  CopyFromConfig(repo_mirror_url, "repo_mirror_url", pt);
+  CopyFromConfig(repo_mirror_path, "repo_mirror_path", pt);
   CopyFromConfig(key_source, "key_source", pt);
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(force_install_completion, "force_install_completion", pt);
   CopyFromConfig(secondary_config_file, "secondary_config_file", pt);
   CopyFromConfig(secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec", pt);
+  CopyFromConfig(secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec", pt);
+  CopyFromConfig(secondary_firmware_passthrough, "secondary_firmware_passthrough", pt);
+  CopyFromConfig(pipeline_secondary_transfer, "pipeline_secondary_transfer", pt);
+  CopyFromConfig(concurrent_primary_install, "concurrent_primary_install", pt);
   CopyFromConfig(enable_online_updates, "enable_online_updates", pt);
   CopyFromConfig(enable_offline_updates, "enable_offline_updates", pt);
   CopyFromConfig(offline_updates_source, "offline_updates_source", pt);
   CopyFromConfig(update_lock_file, "update_lock_file", pt);
+  CopyFromConfig(download_concurrency, "download_concurrency", pt);
+  CopyFromConfig(download_priorities, "download_priorities", pt);
+  CopyFromConfig(download_smallest_first, "download_smallest_first", pt);
+  CopyFromConfig(download_progress_interval_ms, "download_progress_interval_ms", pt);
+  CopyFromConfig(download_bandwidth_limit, "download_bandwidth_limit", pt);
+  CopyFromConfig(download_bandwidth_windows, "download_bandwidth_windows", pt);
+  CopyFromConfig(metered_interfaces, "metered_interfaces", pt);
+  CopyFromConfig(metered_bandwidth_limit, "metered_bandwidth_limit", pt);
+  CopyFromConfig(pause_downloads_on_metered, "pause_downloads_on_metered", pt);
+  CopyFromConfig(predownload_windows, "predownload_windows", pt);
+  CopyFromConfig(offline_fetch_concurrency, "offline_fetch_concurrency", pt);
+  CopyFromConfig(secondary_install_concurrency, "secondary_install_concurrency", pt);
+  CopyFromConfig(secondary_install_concurrency_per_type, "secondary_install_concurrency_per_type", pt);
+  CopyFromConfig(event_queue_size, "event_queue_size", pt);
+  CopyFromConfig(deferred_startup, "deferred_startup", pt);
+  CopyFromConfig(manifest_heartbeat_sec, "manifest_heartbeat_sec", pt);
+  CopyFromConfig(fast_update_check, "fast_update_check", pt);
+  CopyFromConfig(parallel_metadata_fetch, "parallel_metadata_fetch", pt);
+  CopyFromConfig(fetch_root_chain, "fetch_root_chain", pt);
+  CopyFromConfig(delegation_fetch_concurrency, "delegation_fetch_concurrency", pt);
+  CopyFromConfig(campaigns_ttl_sec, "campaigns_ttl_sec", pt);
+  CopyFromConfig(notification_url, "notification_url", pt);
+  CopyFromConfig(notification_polling_sec, "notification_polling_sec", pt);
+  CopyFromConfig(idle_exit_sec, "idle_exit_sec", pt);
 }
 
 void UptaneConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, polling_sec, "polling_sec");
+  writeOption(out_stream, polling_active_sec, "polling_active_sec");
+  writeOption(out_stream, polling_max_sec, "polling_max_sec");
+  writeOption(out_stream, polling_jitter_percent, "polling_jitter_percent");
   writeOption(out_stream, director_server, "director_server");
   writeOption(out_stream, repo_server, "repo_server");
+  writeOption(out_stream, repo_mirror_url, "repo_mirror_url");
+  writeOption(out_stream, repo_mirror_path, "repo_mirror_path");
   writeOption(out_stream, key_source, "key_source");
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, force_install_completion, "force_install_completion");
   writeOption(out_stream, secondary_config_file, "secondary_config_file");
   writeOption(out_stream, secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec");
+  writeOption(out_stream, secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec");
+  writeOption(out_stream, secondary_firmware_passthrough, "secondary_firmware_passthrough");
+  writeOption(out_stream, pipeline_secondary_transfer, "pipeline_secondary_transfer");
+  writeOption(out_stream, concurrent_primary_install, "concurrent_primary_install");
   writeOption(out_stream, enable_online_updates, "enable_online_updates");
   writeOption(out_stream, enable_offline_updates, "enable_offline_updates");
   writeOption(out_stream, offline_updates_source, "offline_updates_source");
   writeOption(out_stream, update_lock_file, "update_lock_file");
+  writeOption(out_stream, download_concurrency, "download_concurrency");
+  writeOption(out_stream, download_priorities, "download_priorities");
+  writeOption(out_stream, download_smallest_first, "download_smallest_first");
+  writeOption(out_stream, download_progress_interval_ms, "download_progress_interval_ms");
+  writeOption(out_stream, download_bandwidth_limit, "download_bandwidth_limit");
+  writeOption(out_stream, download_bandwidth_windows, "download_bandwidth_windows");
+  writeOption(out_stream, metered_interfaces, "metered_interfaces");
+  writeOption(out_stream, metered_bandwidth_limit, "metered_bandwidth_limit");
+  writeOption(out_stream, pause_downloads_on_metered, "pause_downloads_on_metered");
+  writeOption(out_stream, predownload_windows, "predownload_windows");
+  writeOption(out_stream, offline_fetch_concurrency, "offline_fetch_concurrency");
+  writeOption(out_stream, secondary_install_concurrency, "secondary_install_concurrency");
+  writeOption(out_stream, secondary_install_concurrency_per_type, "secondary_install_concurrency_per_type");
+  writeOption(out_stream, event_queue_size, "event_queue_size");
+  writeOption(out_stream, deferred_startup, "deferred_startup");
+  writeOption(out_stream, manifest_heartbeat_sec, "manifest_heartbeat_sec");
+  writeOption(out_stream, fast_update_check, "fast_update_check");
+  writeOption(out_stream, parallel_metadata_fetch, "parallel_metadata_fetch");
+  writeOption(out_stream, fetch_root_chain, "fetch_root_chain");
+  writeOption(out_stream, delegation_fetch_concurrency, "delegation_fetch_concurrency");
+  writeOption(out_stream, campaigns_ttl_sec, "campaigns_ttl_sec");
+  writeOption(out_stream, notification_url, "notification_url");
+  writeOption(out_stream, notification_polling_sec, "notification_polling_sec");
+  writeOption(out_stream, idle_exit_sec, "idle_exit_sec");
+}
+
+std::map<std::string, int> UptaneConfig::parseDownloadPriorities(const std::string& spec) {
+  std::vector<std::string> rules;
+  boost::split(rules, spec, boost::is_any_of(","));
+  std::map<std::string, int> priorities;
+  for (auto rule : rules) {
+    boost::trim(rule);
+    if (rule.empty()) {
+      continue;
+    }
+    const auto separator = rule.rfind('=');
+    size_t consumed = 0;
+    try {
+      if (separator != std::string::npos && separator != 0) {
+        priorities[rule.substr(0, separator)] = std::stoi(rule.substr(separator + 1), &consumed);
+      }
+    } catch (const std::logic_error&) {
+      consumed = 0;
+    }
+    if (consumed == 0 || separator + 1 + consumed != rule.size()) {
+      throw std::invalid_argument("Invalid download priority \"" + rule + "\", expected hardware_id=priority");
+    }
+  }
+  return priorities;
+}
+
+void MemoryConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(buffer_budget, "buffer_budget", pt);
+}
+
+void MemoryConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, buffer_budget, "buffer_budget");
+}
+
+void ResourcesConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(metadata, "metadata", pt);
+  CopyFromConfig(download, "download", pt);
+  CopyFromConfig(hash, "hash", pt);
+  CopyFromConfig(deploy, "deploy", pt);
+  CopyFromConfig(container_load, "container_load", pt);
+}
+
+void ResourcesConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, metadata, "metadata");
+  writeOption(out_stream, download, "download");
+  writeOption(out_stream, hash, "hash");
+  writeOption(out_stream, deploy, "deploy");
+  writeOption(out_stream, container_load, "container_load");
 }
 
 /**
@@ -152,7 +270,7 @@ Config::Config(const boost::program_options::variables_map& cmd) {
     checkDirs(configs);
     updateFromDirs(configs);
   } else {
-    updateFromDirs(config_dirs_);
+    updateFromDirs(config_dirs_, config_cache_);
   }
   updateFromCommandLine(cmd);
   postUpdateValues();
@@ -163,7 +281,7 @@ KeyManagerConfig Config::keymanagerConfig() const {
 }
 
 void Config::postUpdateValues() {
-  logger_set_threshold(logger);
+  logger_configure(logger);
 
   if (provision.mode == ProvisionMode::kDefault) {
     provision.mode = provision.provision_path.empty() ? ProvisionMode::kDeviceCred : ProvisionMode::kSharedCred;
@@ -217,6 +335,48 @@ void Config::postUpdateValues() {
     uptane.polling_sec = 1;
   }
 
+  if (uptane.polling_jitter_percent > 50) {
+    LOG_WARNING << "Maximum value for uptane.polling_jitter_percent is 50. Fixing.";
+    uptane.polling_jitter_percent = 50;
+  }
+
+  try {
+    BandwidthLimiter::parseWindows(uptane.download_bandwidth_windows);
+  } catch (const std::invalid_argument& e) {
+    LOG_WARNING << e.what() << " in uptane.download_bandwidth_windows. Ignoring it.";
+    uptane.download_bandwidth_windows.clear();
+  }
+  for (auto* policy : {&resources.metadata, &resources.download, &resources.hash, &resources.deploy,
+                       &resources.container_load}) {
+    try {
+      ResourcePolicy::parse(*policy);
+    } catch (const std::invalid_argument& e) {
+      LOG_WARNING << e.what() << " in the [resources] section. Ignoring it.";
+      policy->clear();
+    }
+  }
+  try {
+    UptaneConfig::parseDownloadPriorities(uptane.download_priorities);
+  } catch (const std::invalid_argument& e) {
+    LOG_WARNING << e.what() << " in uptane.download_priorities. Ignoring it.";
+    uptane.download_priorities.clear();
+  }
+  try {
+    BandwidthLimiter::parseWindows(uptane.predownload_windows, false);
+  } catch (const std::invalid_argument& e) {
+    LOG_WARNING << e.what() << " in uptane.predownload_windows. Ignoring it.";
+    uptane.predownload_windows.clear();
+  }
+
+  if (uptane.download_concurrency < 1) {
+    LOG_WARNING << "Minimum value for uptane.download_concurrency is 1. Fixing.";
+    uptane.download_concurrency = 1;
+  }
+  if (uptane.delegation_fetch_concurrency < 1) {
+    LOG_WARNING << "Minimum value for uptane.delegation_fetch_concurrency is 1. Fixing.";
+    uptane.delegation_fetch_concurrency = 1;
+  }
+
   LOG_TRACE << "Final configuration that will be used: \n" << (*this);
 }
 
@@ -230,8 +390,11 @@ void Config::updateFromTomlString(const std::string& contents) {
 
 void Config::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   // Keep this order the same as in config.h and Config::writeToStream().
-  if (!loglevel_from_cmdline) {
-    CopySubtreeFromConfig(logger, "logger", pt);
+  const int cmdline_loglevel = logger.loglevel;
+  CopySubtreeFromConfig(logger, "logger", pt);
+  if (loglevel_from_cmdline) {
+    logger.loglevel = cmdline_loglevel;
+  } else {
     // If not already set from the commandline, set the loglevel now so that it
     // affects the rest of the config processing.
     logger_set_threshold(logger);
@@ -245,6 +408,9 @@ void Config::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopySubtreeFromConfig(import, "import", pt);
   CopySubtreeFromConfig(telemetry, "telemetry", pt);
   CopySubtreeFromConfig(bootloader, "bootloader", pt);
+  CopySubtreeFromConfig(tracing, "tracing", pt);
+  CopySubtreeFromConfig(memory, "memory", pt);
+  CopySubtreeFromConfig(resources, "resources", pt);
 }
 
 void Config::updateFromCommandLine(const boost::program_options::variables_map& cmd) {
@@ -285,4 +451,7 @@ void Config::writeToStream(std::ostream& sink) const {
   WriteSectionToStream(import, "import", sink);
   WriteSectionToStream(telemetry, "telemetry", sink);
   WriteSectionToStream(bootloader, "bootloader", sink);
+  WriteSectionToStream(tracing, "tracing", sink);
+  WriteSectionToStream(memory, "memory", sink);
+  WriteSectionToStream(resources, "resources", sink);
 }
@@ -4,6 +4,7 @@
 #include <string>
 
 #include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 
@@ -41,6 +42,23 @@ TEST(config, TomlInt) {
   EXPECT_EQ(conf.uptane.polling_sec, 99u);
 }
 
+/* Malformed download priorities are ignored as a whole. */
+TEST(config, TomlDownloadPriorities) {
+  Config conf;
+  conf.updateFromTomlString("[uptane]\ndownload_priorities = \"brake-ecu=10, infotainment=-1\"\n");
+  conf.postUpdateValues();
+  EXPECT_EQ(UptaneConfig::parseDownloadPriorities(conf.uptane.download_priorities),
+            (std::map<std::string, int>{{"brake-ecu", 10}, {"infotainment", -1}}));
+
+  for (const std::string spec : {"brake-ecu=10,malformed", "=10", "brake-ecu=", "brake-ecu=high", "brake-ecu=1x"}) {
+    conf.updateFromTomlString("[uptane]\ndownload_priorities = \"" + spec + "\"\n");
+    EXPECT_THROW(UptaneConfig::parseDownloadPriorities(conf.uptane.download_priorities), std::invalid_argument)
+        << spec;
+    conf.postUpdateValues();
+    EXPECT_EQ(conf.uptane.download_priorities, "") << spec;
+  }
+}
+
 /*
  * Check that user can specify Primary serial via a config file.
  */
@@ -223,6 +241,53 @@ TEST(config, TwoDirs) {
   EXPECT_EQ(config.provision.provision_path.string(), "y_prov_path");
 }
 
+class CachedConfig : public Config {
+ public:
+  CachedConfig(const std::vector<boost::filesystem::path> &dirs, const boost::filesystem::path &cache) {
+    updateFromDirs(dirs, cache);
+    postUpdateValues();
+  }
+};
+
+/* The merged config files are cached, and read again once one of them changes. */
+TEST(config, CachedDirs) {
+  TemporaryDirectory temp_dir;
+  std::vector<boost::filesystem::path> dirs = generate_multi_config(temp_dir);
+  const boost::filesystem::path cache = temp_dir / "cache" / "config.toml";
+  const auto private_file = boost::filesystem::owner_read | boost::filesystem::owner_write;
+
+  CachedConfig config(dirs, cache);
+  EXPECT_EQ(config.storage.path.string(), "path_z");
+  EXPECT_EQ(config.pacman.sysroot.string(), "sysroot_z");
+  EXPECT_NE(config.pacman.os, "os_a");
+  EXPECT_EQ(config.provision.provision_path.string(), "y_prov_path");
+  ASSERT_TRUE(boost::filesystem::exists(cache));
+  // It may hold secrets
+  EXPECT_EQ(boost::filesystem::status(cache).permissions(), private_file);
+  EXPECT_EQ(boost::filesystem::status(cache.parent_path()).permissions(), boost::filesystem::owner_all);
+
+  // Only the cache is read while the config files stay the same
+  std::string cached = Utils::readFile(cache);
+  boost::replace_all(cached, "sysroot_z", "sysroot_cached");
+  Utils::writeFile(cache, cached);
+  boost::filesystem::permissions(cache, private_file);
+  CachedConfig from_cache(dirs, cache);
+  EXPECT_EQ(from_cache.storage.path.string(), "path_z");
+  EXPECT_EQ(from_cache.pacman.sysroot.string(), "sysroot_cached");
+  EXPECT_EQ(from_cache.provision.provision_path.string(), "y_prov_path");
+
+  // A cache that others can read is made again
+  boost::filesystem::permissions(cache, boost::filesystem::add_perms | boost::filesystem::others_read);
+  CachedConfig readable(dirs, cache);
+  EXPECT_EQ(readable.pacman.sysroot.string(), "sysroot_z");
+  EXPECT_EQ(boost::filesystem::status(cache).permissions(), private_file);
+
+  Utils::writeFile(dirs[0] / "z.toml", std::string("[storage]\npath = \"path_changed\"\n[pacman]\nsysroot = \"sysroot_z\"\n"));
+  CachedConfig changed(dirs, cache);
+  EXPECT_EQ(changed.storage.path.string(), "path_changed");
+  EXPECT_EQ(changed.pacman.sysroot.string(), "sysroot_z");
+}
+
 void checkConfigExpectations(const Config &conf) {
   EXPECT_EQ(conf.storage.type, StorageType::kSqlite);
   EXPECT_EQ(conf.pacman.type, PACKAGE_MANAGER_NONE);
@@ -2,20 +2,24 @@
 
 #include <array>
 #include <iostream>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <string>
+#include <unordered_map>
 
 #include <openssl/pkcs12.h>
 #include <openssl/rsa.h>
 #include <sodium.h>
-#include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/scoped_array.hpp>
 
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
+#include "logging/tracing.h"
 #include "openssl_compat.h"
 #include "utilities/utils.h"
 
@@ -79,17 +83,106 @@ PublicKey::PublicKey(const std::string &value, KeyType type) : value_(value), ty
   }
 }
 
-bool PublicKey::VerifySignature(const std::string &signature, const std::string &message) const {
-  switch (type_) {
-    case KeyType::kED25519:
-      return Crypto::ED25519Verify(boost::algorithm::unhex(value_), Utils::fromBase64(signature), message);
-    case KeyType::kRSA2048:
-    case KeyType::kRSA3072:
-    case KeyType::kRSA4096:
-      return Crypto::RSAPSSVerify(value_, Utils::fromBase64(signature), message);
-    default:
+namespace {
+// Signatures already verified in this process, identified by key, signature and
+// message digest. Metadata checked repeatedly (e.g. Root at every offline check)
+// then only costs a hash of the message.
+class VerifiedSignatures {
+ public:
+  bool contains(const std::string &id) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
       return false;
+    }
+    order_.splice(order_.begin(), order_, it->second);
+    return true;
   }
+
+  void insert(const std::string &id) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (index_.count(id) != 0) {
+      return;
+    }
+    order_.push_front(id);
+    index_[id] = order_.begin();
+    if (order_.size() > kMaxEntries) {
+      index_.erase(order_.back());
+      order_.pop_back();
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxEntries = 256;
+  std::mutex mutex_;
+  std::list<std::string> order_;
+  std::unordered_map<std::string, std::list<std::string>::iterator> index_;
+};
+
+VerifiedSignatures &verifiedSignatures() {
+  static VerifiedSignatures verified;
+  return verified;
+}
+
+// RSA public keys parsed from PEM, by PEM. Parsing costs more than verifying.
+std::shared_ptr<RSA> parsedRsaKey(const std::string &public_key) {
+  static constexpr size_t kMaxKeys = 32;
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<RSA>> keys;
+
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = keys.find(public_key);
+    if (it != keys.end()) {
+      return it->second;
+    }
+  }
+
+  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
+                       BIO_vfree);
+  RSA *r = nullptr;
+  if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
+    LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
+  }
+  std::shared_ptr<RSA> rsa(r, RSA_free);
+#if AKTUALIZR_OPENSSL_PRE_11
+  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
+#else
+  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
+#endif
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (keys.size() >= kMaxKeys) {
+    keys.clear();
+  }
+  keys.emplace(public_key, rsa);
+  return rsa;
+}
+}  // namespace
+
+bool PublicKey::VerifySignature(const std::string &signature, const std::string &message) const {
+  TraceSpan span("crypto", "verify");
+  if (type_ != KeyType::kED25519 && !Crypto::IsRsaKeyType(type_)) {
+    return false;
+  }
+
+  const std::string digest = Crypto::sha256digest(message);
+  const std::string id = Crypto::sha256digest(value_ + '\n' + signature) + digest;
+  if (verifiedSignatures().contains(id)) {
+    return true;
+  }
+
+  bool valid;
+  if (type_ == KeyType::kED25519) {
+    valid = Crypto::ED25519Verify(Utils::fromHex(value_), Utils::fromBase64(signature), message);
+  } else {
+    valid = Crypto::RSAPSSVerifyDigest(value_, Utils::fromBase64(signature), digest);
+  }
+  if (valid) {
+    verifiedSignatures().insert(id);
+  }
+  return valid;
 }
 
 bool PublicKey::operator==(const PublicKey &rhs) const { return value_ == rhs.value_ && type_ == rhs.type_; }
@@ -118,7 +211,7 @@ std::string PublicKey::KeyId() const {
   std::string key_content = value_;
   // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
   boost::algorithm::trim_right_if(key_content, boost::algorithm::is_any_of("\n"));
-  std::string keyid = boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))));
+  std::string keyid = Utils::toHex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))));
   std::transform(keyid.begin(), keyid.end(), keyid.begin(), ::tolower);
   return keyid;
 }
@@ -130,7 +223,7 @@ std::string Crypto::sha256digest(const std::string &text) {
 }
 
 std::string Crypto::sha256digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha256digest(text)));
+  return Utils::toHex(sha256digest(text), true);
 }
 
 std::string Crypto::sha512digest(const std::string &text) {
@@ -140,7 +233,30 @@ std::string Crypto::sha512digest(const std::string &text) {
 }
 
 std::string Crypto::sha512digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha512digest(text)));
+  return Utils::toHex(sha512digest(text), true);
+}
+
+static std::string rsaPssSign(RSA *rsa, const std::string &message) {
+  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa));
+  boost::scoped_array<unsigned char> EM(new unsigned char[sign_size]);
+  boost::scoped_array<unsigned char> pSignature(new unsigned char[sign_size]);
+
+  std::string digest = Crypto::sha256digest(message);
+  int status = RSA_padding_add_PKCS1_PSS(rsa, EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
+                                         EVP_sha256(), -1 /* maximum salt length*/);
+  if (status == 0) {
+    LOG_ERROR << "RSA_padding_add_PKCS1_PSS failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
+
+  /* perform digital signature */
+  status = RSA_private_encrypt(RSA_size(rsa), EM.get(), pSignature.get(), rsa, RSA_NO_PADDING);
+  if (status == -1) {
+    LOG_ERROR << "RSA_private_encrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
+  std::string retval = std::string(reinterpret_cast<char *>(pSignature.get()), sign_size);
+  return retval;
 }
 
 std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message) {
@@ -155,56 +271,41 @@ std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, c
       return std::string();
     }
 
+    return Crypto::RSAPSSSign(key.get(), message);
+  }
+
+  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(private_key.c_str()), static_cast<int>(private_key.size())),
+                       BIO_vfree);
+  key.reset(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr));
+  if (key != nullptr) {
     rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    if (rsa == nullptr) {
-      LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
-  } else {
-    StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(private_key.c_str()), static_cast<int>(private_key.size())),
-                         BIO_vfree);
-    key.reset(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr));
-    if (key != nullptr) {
-      rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    }
+  }
 
-    if (rsa == nullptr) {
-      LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
+  if (rsa == nullptr) {
+    LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
 
 #if AKTUALIZR_OPENSSL_PRE_11
-    RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
+  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
 #else
-    RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
+  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
 #endif
-  }
-
-  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa.get()));
-  boost::scoped_array<unsigned char> EM(new unsigned char[sign_size]);
-  boost::scoped_array<unsigned char> pSignature(new unsigned char[sign_size]);
-
-  std::string digest = Crypto::sha256digest(message);
-  int status = RSA_padding_add_PKCS1_PSS(rsa.get(), EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
-                                         EVP_sha256(), -1 /* maximum salt length*/);
-  if (status == 0) {
-    LOG_ERROR << "RSA_padding_add_PKCS1_PSS failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-    return std::string();
-  }
+  return rsaPssSign(rsa.get(), message);
+}
 
-  /* perform digital signature */
-  status = RSA_private_encrypt(RSA_size(rsa.get()), EM.get(), pSignature.get(), rsa.get(), RSA_NO_PADDING);
-  if (status == -1) {
-    LOG_ERROR << "RSA_private_encrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+std::string Crypto::RSAPSSSign(EVP_PKEY *key, const std::string &message) {
+  StructGuard<RSA> rsa(EVP_PKEY_get1_RSA(key), RSA_free);
+  if (rsa == nullptr) {
+    LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
     return std::string();
   }
-  std::string retval = std::string(reinterpret_cast<char *>(pSignature.get()), sign_size);
-  return retval;
+  return rsaPssSign(rsa.get(), message);
 }
 
 std::string Crypto::Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message) {
   if (key_type == KeyType::kED25519) {
-    return Crypto::ED25519Sign(boost::algorithm::unhex(private_key), message);
+    return Crypto::ED25519Sign(Utils::fromHex(private_key), message);
   }
   return Crypto::RSAPSSSign(engine, private_key, message);
 }
@@ -217,23 +318,15 @@ std::string Crypto::ED25519Sign(const std::string &private_key, const std::strin
 }
 
 bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message) {
-  StructGuard<RSA> rsa(nullptr, RSA_free);
-  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
-                       BIO_vfree);
-  {
-    RSA *r = nullptr;
-    if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
-      LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return false;
-    }
-    rsa.reset(r);
-  }
+  return RSAPSSVerifyDigest(public_key, signature, Crypto::sha256digest(message));
+}
 
-#if AKTUALIZR_OPENSSL_PRE_11
-  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
-#else
-  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
-#endif
+bool Crypto::RSAPSSVerifyDigest(const std::string &public_key, const std::string &signature,
+                                const std::string &digest) {
+  const std::shared_ptr<RSA> rsa = parsedRsaKey(public_key);
+  if (rsa == nullptr) {
+    return false;
+  }
 
   const auto size = static_cast<unsigned int>(RSA_size(rsa.get()));
   boost::scoped_array<unsigned char> pDecrypted(new unsigned char[size]);
@@ -248,14 +341,13 @@ bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &sign
     return false;
   }
 
-  std::string digest = Crypto::sha256digest(message);
-
   /* verify the data */
   status = RSA_verify_PKCS1_PSS(rsa.get(), reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
                                 pDecrypted.get(), -2 /* salt length recovered from signature*/);
 
   return status == 1;
 }
+
 bool Crypto::ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message) {
   if (public_key.size() < crypto_sign_PUBLICKEYBYTES || signature.size() < crypto_sign_BYTES) {
     return false;
@@ -458,9 +550,9 @@ bool Crypto::generateEDKeyPair(std::string *public_key, std::string *private_key
   std::array<unsigned char, crypto_sign_PUBLICKEYBYTES> pk{};
   std::array<unsigned char, crypto_sign_SECRETKEYBYTES> sk{};
   crypto_sign_keypair(pk.data(), sk.data());
-  *public_key = boost::algorithm::hex(std::string(reinterpret_cast<char *>(pk.data()), crypto_sign_PUBLICKEYBYTES));
+  *public_key = Utils::toHex(std::string_view(reinterpret_cast<char *>(pk.data()), crypto_sign_PUBLICKEYBYTES));
   // std::transform(public_key->begin(), public_key->end(), public_key->begin(), ::tolower);
-  *private_key = boost::algorithm::hex(std::string(reinterpret_cast<char *>(sk.data()), crypto_sign_SECRETKEYBYTES));
+  *private_key = Utils::toHex(std::string_view(reinterpret_cast<char *>(sk.data()), crypto_sign_SECRETKEYBYTES));
   // std::transform(private_key->begin(), private_key->end(), private_key->begin(), ::tolower);
   return true;
 }
@@ -514,9 +606,42 @@ KeyType Crypto::IdentifyRSAKeyType(const std::string &public_key_pem) {
   }
 }
 
+StructGuard<EVP_PKEY> Crypto::generateCertKeyEVP(CertKeyType key_type, const int rsa_bits) {
+  if (key_type == CertKeyType::kRSA) {
+    return generateRSAKeyPairEVP(rsa_bits);
+  }
+
+  const int id = key_type == CertKeyType::kECDSA ? EVP_PKEY_EC : EVP_PKEY_ED25519;
+  StructGuard<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new_id(id, nullptr), EVP_PKEY_CTX_free);
+  if (ctx == nullptr || EVP_PKEY_keygen_init(ctx.get()) <= 0) {
+    throw std::runtime_error(std::string("EVP_PKEY_keygen_init failed: ") + ERR_error_string(ERR_get_error(), nullptr));
+  }
+  if (key_type == CertKeyType::kECDSA && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1) <= 0) {
+    throw std::runtime_error(std::string("EVP_PKEY_CTX_set_ec_paramgen_curve_nid failed: ") +
+                             ERR_error_string(ERR_get_error(), nullptr));
+  }
+  EVP_PKEY *pkey = nullptr;
+  if (EVP_PKEY_keygen(ctx.get(), &pkey) <= 0) {
+    throw std::runtime_error(std::string("EVP_PKEY_keygen failed: ") + ERR_error_string(ERR_get_error(), nullptr));
+  }
+  return {pkey, EVP_PKEY_free};
+}
+
+// Ed25519 signs the message itself, without a separate digest
+static const EVP_MD *certDigest(EVP_PKEY *signing_key) {
+  return EVP_PKEY_id(signing_key) == EVP_PKEY_ED25519 ? nullptr : EVP_sha256();
+}
+
 StructGuard<X509> Crypto::generateCert(const int rsa_bits, const int cert_days, const std::string &cert_c,
                                        const std::string &cert_st, const std::string &cert_o,
                                        const std::string &cert_cn, bool self_sign) {
+  StructGuard<EVP_PKEY> certificate_pkey(Crypto::generateRSAKeyPairEVP(rsa_bits));
+  return generateCert(certificate_pkey.get(), cert_days, cert_c, cert_st, cert_o, cert_cn, self_sign);
+}
+
+StructGuard<X509> Crypto::generateCert(EVP_PKEY *const pkey, const int cert_days, const std::string &cert_c,
+                                       const std::string &cert_st, const std::string &cert_o,
+                                       const std::string &cert_cn, bool self_sign) {
   // create certificate
   StructGuard<X509> certificate(X509_new(), X509_free);
   if (certificate.get() == nullptr) {
@@ -573,10 +698,7 @@ StructGuard<X509> Crypto::generateCert(const int rsa_bits, const int cert_days,
                              ERR_error_string(ERR_get_error(), nullptr));
   }
 
-  // create and set key.
-  StructGuard<EVP_PKEY> certificate_pkey(Crypto::generateRSAKeyPairEVP(rsa_bits));
-
-  if (X509_set_pubkey(certificate.get(), certificate_pkey.get()) == 0) {
+  if (X509_set_pubkey(certificate.get(), pkey) == 0) {
     throw std::runtime_error(std::string("X509_set_pubkey failed: ") + ERR_error_string(ERR_get_error(), nullptr));
   }
 
@@ -591,8 +713,7 @@ StructGuard<X509> Crypto::generateCert(const int rsa_bits, const int cert_days,
 
   // self-sign
   if (self_sign) {
-    const EVP_MD *cert_digest = EVP_sha256();
-    if (X509_sign(certificate.get(), certificate_pkey.get(), cert_digest) == 0) {
+    if (X509_sign(certificate.get(), pkey, certDigest(pkey)) == 0) {
       throw std::runtime_error(std::string("X509_sign failed: ") + ERR_error_string(ERR_get_error(), nullptr));
     }
     LOG_INFO << "Successfully self-signed the generated certificate. This should not be used in production!";
@@ -601,7 +722,7 @@ StructGuard<X509> Crypto::generateCert(const int rsa_bits, const int cert_days,
   return certificate;
 }
 
-void Crypto::signCert(const std::string &cacert_path, const std::string &capkey_path, X509 *const certificate) {
+Crypto::CertificateAuthority Crypto::loadCA(const std::string &cacert_path, const std::string &capkey_path) {
   // read CA certificate
   std::string cacert_contents = Utils::readFile(cacert_path);
   StructGuard<BIO> bio_in_cacert(BIO_new_mem_buf(cacert_contents.c_str(), static_cast<int>(cacert_contents.size())),
@@ -623,8 +744,19 @@ void Crypto::signCert(const std::string &cacert_path, const std::string &capkey_
                              ERR_error_string(ERR_get_error(), nullptr));
   }
 
+  CertificateAuthority ca;
+  ca.certificate = std::move(ca_certificate);
+  ca.key = std::move(ca_privkey);
+  return ca;
+}
+
+void Crypto::signCert(const std::string &cacert_path, const std::string &capkey_path, X509 *const certificate) {
+  signCert(loadCA(cacert_path, capkey_path), certificate);
+}
+
+void Crypto::signCert(const CertificateAuthority &ca, X509 *const certificate) {
   // set issuer name
-  X509_NAME *ca_subj = X509_get_subject_name(ca_certificate.get());
+  X509_NAME *ca_subj = X509_get_subject_name(ca.certificate.get());
   if (ca_subj == nullptr) {
     throw std::runtime_error(std::string("X509_get_subject_name failed: ") +
                              ERR_error_string(ERR_get_error(), nullptr));
@@ -635,8 +767,7 @@ void Crypto::signCert(const std::string &cacert_path, const std::string &capkey_
   }
 
   // sign
-  const EVP_MD *cert_digest = EVP_sha256();
-  if (X509_sign(certificate, ca_privkey.get(), cert_digest) == 0) {
+  if (X509_sign(certificate, ca.key.get(), certDigest(ca.key.get())) == 0) {
     throw std::runtime_error(std::string("X509_sign failed: ") + ERR_error_string(ERR_get_error(), nullptr));
   }
 }
@@ -654,15 +785,19 @@ void Crypto::serializeCert(std::string *pkey, std::string *cert, X509 *const cer
     throw std::runtime_error(std::string("X509_get_pubkey failed: ") + ERR_error_string(ERR_get_error(), nullptr));
   }
 
-  StructGuard<RSA> certificate_rsa(EVP_PKEY_get1_RSA(certificate_pkey.get()), RSA_free);
-  if (certificate_rsa == nullptr) {
-    throw std::runtime_error(std::string("EVP_PKEY_get1_RSA failed: ") + ERR_error_string(ERR_get_error(), nullptr));
+  int ret;
+  if (EVP_PKEY_base_id(certificate_pkey.get()) == EVP_PKEY_RSA) {
+    // Keep the traditional format for RSA keys
+    StructGuard<RSA> certificate_rsa(EVP_PKEY_get1_RSA(certificate_pkey.get()), RSA_free);
+    if (certificate_rsa == nullptr) {
+      throw std::runtime_error(std::string("EVP_PKEY_get1_RSA failed: ") + ERR_error_string(ERR_get_error(), nullptr));
+    }
+    ret = PEM_write_bio_RSAPrivateKey(privkey_file.get(), certificate_rsa.get(), nullptr, nullptr, 0, nullptr, nullptr);
+  } else {
+    ret = PEM_write_bio_PrivateKey(privkey_file.get(), certificate_pkey.get(), nullptr, nullptr, 0, nullptr, nullptr);
   }
-
-  int ret =
-      PEM_write_bio_RSAPrivateKey(privkey_file.get(), certificate_rsa.get(), nullptr, nullptr, 0, nullptr, nullptr);
   if (ret == 0) {
-    throw std::runtime_error(std::string("PEM_write_RSAPrivateKey failed: ") +
+    throw std::runtime_error(std::string("PEM_write_bio_PrivateKey failed: ") +
                              ERR_error_string(ERR_get_error(), nullptr));
   }
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast)
@@ -685,6 +820,10 @@ void Crypto::serializeCert(std::string *pkey, std::string *cert, X509 *const cer
 }
 
 MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
+  auto openssl_hasher = MultiPartOpenSSLHasher::create(hash_type);
+  if (openssl_hasher != nullptr) {
+    return openssl_hasher;
+  }
   switch (hash_type) {
     case Hash::Type::kSha256: {
       return std::make_shared<MultiPartSHA256Hasher>();
@@ -699,36 +838,175 @@ MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
   }
 }
 
-std::string MultiPartSHA512Hasher::getHexDigest() {
+std::string MultiPartHasher::getHexDigest() { return Utils::toHex(getDigest()); }
+
+std::string MultiPartSHA512Hasher::getDigest() {
   std::array<unsigned char, crypto_hash_sha512_BYTES> sha512_hash{};
   crypto_hash_sha512_final(&state_, sha512_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES));
+  return std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES);
 }
 
-std::string MultiPartSHA256Hasher::getHexDigest() {
+std::string MultiPartSHA256Hasher::getDigest() {
   std::array<unsigned char, crypto_hash_sha256_BYTES> sha256_hash{};
   crypto_hash_sha256_final(&state_, sha256_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES));
+  return std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES);
 }
 
-Hash Hash::generate(Type type, const std::string &data) {
-  std::string hash;
+std::shared_ptr<MultiPartOpenSSLHasher> MultiPartOpenSSLHasher::create(Hash::Type hash_type) {
+  if (hash_type != Hash::Type::kSha256 && hash_type != Hash::Type::kSha512) {
+    return nullptr;
+  }
+  return std::make_shared<MultiPartOpenSSLHasher>(hash_type);
+}
+
+void MultiPartOpenSSLHasher::update(const unsigned char *part, uint64_t size) {
+  if (hash_type_ == Hash::Type::kSha256) {
+    SHA256_Update(&sha256_, part, static_cast<size_t>(size));
+  } else {
+    SHA512_Update(&sha512_, part, static_cast<size_t>(size));
+  }
+}
+
+void MultiPartOpenSSLHasher::reset() {
+  if (hash_type_ == Hash::Type::kSha256) {
+    SHA256_Init(&sha256_);
+  } else {
+    SHA512_Init(&sha512_);
+  }
+}
+
+std::string MultiPartOpenSSLHasher::getDigest() {
+  if (hash_type_ == Hash::Type::kSha256) {
+    std::array<unsigned char, SHA256_DIGEST_LENGTH> digest{};
+    SHA256_Final(digest.data(), &sha256_);
+    return std::string(reinterpret_cast<char *>(digest.data()), digest.size());
+  }
+  std::array<unsigned char, SHA512_DIGEST_LENGTH> digest{};
+  SHA512_Final(digest.data(), &sha512_);
+  return std::string(reinterpret_cast<char *>(digest.data()), digest.size());
+}
+
+std::string MultiPartOpenSSLHasher::exportState() const {
+  if (hash_type_ == Hash::Type::kSha256) {
+    return std::string(reinterpret_cast<const char *>(&sha256_), sizeof(sha256_));
+  }
+  return std::string(reinterpret_cast<const char *>(&sha512_), sizeof(sha512_));
+}
+
+bool MultiPartOpenSSLHasher::importState(const std::string &state) {
+  char *dest = nullptr;
+  if (hash_type_ == Hash::Type::kSha256 && state.size() == sizeof(sha256_)) {
+    dest = reinterpret_cast<char *>(&sha256_);
+  } else if (hash_type_ == Hash::Type::kSha512 && state.size() == sizeof(sha512_)) {
+    dest = reinterpret_cast<char *>(&sha512_);
+  } else {
+    return false;
+  }
+  std::copy(state.begin(), state.end(), dest);
+  return true;
+}
+
+MultiPartMultiHasher::MultiPartMultiHasher(const std::vector<Hash::Type> &hash_types) {
+  for (const auto hash_type : hash_types) {
+    if (hash_type == Hash::Type::kUnknownAlgorithm) {
+      continue;
+    }
+    auto hasher = MultiPartHasher::create(hash_type);
+    if (hasher != nullptr) {
+      hashers_.push_back(std::move(hasher));
+      hash_types_.push_back(hash_type);
+    }
+  }
+}
+
+void MultiPartMultiHasher::update(const unsigned char *part, uint64_t size) {
+  while (size > 0) {
+    const uint64_t block = std::min(size, kBlockSize);
+    for (auto &hasher : hashers_) {
+      hasher->update(part, block);
+    }
+    part += block;
+    size -= block;
+  }
+}
+
+void MultiPartMultiHasher::reset() {
+  for (auto &hasher : hashers_) {
+    hasher->reset();
+  }
+}
+
+std::string MultiPartMultiHasher::exportState() const {
+  // One line per hasher: the hash type and the hex encoded state
+  std::string state;
+  for (size_t i = 0; i < hashers_.size(); ++i) {
+    const std::string hasher_state = hashers_[i]->exportState();
+    if (hasher_state.empty()) {
+      return std::string();
+    }
+    state += Hash::TypeString(hash_types_[i]) + " " + Utils::toHex(hasher_state) + "\n";
+  }
+  return state;
+}
+
+bool MultiPartMultiHasher::importState(const std::string &state) {
+  std::vector<std::string> lines;
+  boost::algorithm::split(lines, state, boost::algorithm::is_any_of("\n"), boost::algorithm::token_compress_on);
+  if (!lines.empty() && lines.back().empty()) {
+    lines.pop_back();
+  }
+  if (lines.size() != hashers_.size()) {
+    return false;
+  }
+
+  std::vector<std::string> hasher_states;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const auto sep = lines[i].find(' ');
+    if (sep == std::string::npos || lines[i].substr(0, sep) != Hash::TypeString(hash_types_[i])) {
+      return false;
+    }
+    try {
+      hasher_states.push_back(Utils::fromHex(std::string_view(lines[i]).substr(sep + 1)));
+    } catch (const std::exception &) {
+      return false;
+    }
+  }
+
+  // Check every state before changing any hasher
+  std::vector<std::string> previous;
+  for (size_t i = 0; i < hashers_.size(); ++i) {
+    previous.push_back(hashers_[i]->exportState());
+    if (!hashers_[i]->importState(hasher_states[i])) {
+      for (size_t j = 0; j < i; ++j) {
+        hashers_[j]->importState(previous[j]);
+      }
+      return false;
+    }
+  }
+  return true;
+}
 
+std::vector<Hash> MultiPartMultiHasher::getHashes() {
+  std::vector<Hash> hashes;
+  hashes.reserve(hashers_.size());
+  for (auto &hasher : hashers_) {
+    hashes.push_back(hasher->getHash());
+  }
+  return hashes;
+}
+
+Hash Hash::generate(Type type, const std::string &data) {
   switch (type) {
     case Type::kSha256: {
-      hash = boost::algorithm::hex(Crypto::sha256digest(data));
-      break;
+      return Hash::fromDigest(type, Crypto::sha256digest(data));
     }
     case Type::kSha512: {
-      hash = boost::algorithm::hex(Crypto::sha512digest(data));
-      break;
+      return Hash::fromDigest(type, Crypto::sha512digest(data));
     }
     default: {
       throw std::invalid_argument("Unsupported hash type");
     }
   }
-
-  return Hash(type, hash);
 }
 
 Hash Hash::generate(Type type, std::istream &source, ssize_t *nread) {
@@ -767,7 +1045,18 @@ Hash Hash::generate(Type type, std::istream &source, ssize_t *nread) {
   return hasher->getHash();
 }
 
-Hash::Hash(const std::string &type, const std::string &hash) : hash_(boost::algorithm::to_upper_copy(hash)) {
+Hash Hash::fromDigest(Type type, const std::string &digest) {
+  Hash hash(type, std::string());
+  if (digest.size() == DigestSize(type) && !digest.empty()) {
+    hash.digest_size_ = static_cast<uint8_t>(digest.size());
+    std::copy(digest.cbegin(), digest.cend(), hash.digest_.begin());
+  } else {
+    hash.other_ = Utils::toHex(digest);
+  }
+  return hash;
+}
+
+Hash::Hash(const std::string &type, const std::string &hash) {
   if (type == "sha512") {
     type_ = Hash::Type::kSha512;
   } else if (type == "sha256") {
@@ -775,11 +1064,65 @@ Hash::Hash(const std::string &type, const std::string &hash) : hash_(boost::algo
   } else {
     type_ = Hash::Type::kUnknownAlgorithm;
   }
+  setHex(hash);
+}
+
+Hash::Hash(Type type, const std::string &hash) : type_(type) { setHex(hash); }
+
+namespace {
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+}  // namespace
+
+void Hash::setHex(const std::string &hash) {
+  const size_t size = DigestSize(type_);
+  if (size != 0 && hash.size() == 2 * size) {
+    size_t i = 0;
+    for (; i < size; ++i) {
+      const int high = hexValue(hash[2 * i]);
+      const int low = hexValue(hash[2 * i + 1]);
+      if (high < 0 || low < 0) {
+        break;
+      }
+      digest_[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    if (i == size) {
+      digest_size_ = static_cast<uint8_t>(size);
+      return;
+    }
+  }
+  // Not a digest, e.g. in tests or from a broken server. Keep it for comparisons and logs.
+  other_ = boost::algorithm::to_upper_copy(hash);
 }
 
-Hash::Hash(Type type, const std::string &hash) : type_(type), hash_(boost::algorithm::to_upper_copy(hash)) {}
+bool Hash::operator==(const Hash &other) const {
+  if (type_ != other.type_ || digest_size_ != other.digest_size_ || other_ != other.other_) {
+    return false;
+  }
+  // Constant time, the digests might be checked against attacker controlled data
+  uint8_t diff = 0;
+  for (size_t i = 0; i < digest_size_; ++i) {
+    diff = static_cast<uint8_t>(diff | (digest_[i] ^ other.digest_[i]));
+  }
+  return diff == 0;
+}
 
-bool Hash::operator==(const Hash &other) const { return type_ == other.type_ && hash_ == other.hash_; }
+std::string Hash::HashString() const {
+  if (digest_size_ == 0) {
+    return other_;
+  }
+  return Utils::toHex(std::string_view(reinterpret_cast<const char *>(digest_.data()), digest_size_));
+}
 
 std::string Hash::TypeString(Type type) {
   switch (type) {
@@ -797,7 +1140,7 @@ std::string Hash::TypeString() const { return TypeString(type_); }
 Hash::Type Hash::type() const { return type_; }
 
 std::ostream &operator<<(std::ostream &os, const Hash &h) {
-  os << "Hash: " << h.hash_;
+  os << "Hash: " << h.HashString();
   return os;
 }
 
@@ -806,7 +1149,7 @@ std::string Hash::shortTag(const std::vector<Hash> &hashes) {
   std::string res = "(unknown)";
   for (const auto &i : hashes) {
     if (i.type_ < best) {
-      res.assign(i.hash_, 0, 12);
+      res = i.HashString().substr(0, 12);
       best = i.type_;
     }
   }
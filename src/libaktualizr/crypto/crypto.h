@@ -10,6 +10,7 @@
 #include <cstdint>    // for uint64_t
 #include <memory>     // for shared_ptr
 #include <string>     // for string
+#include <vector>     // for vector
 
 #include "libaktualizr/types.h"  // for Hash, KeyType, Hash::Type
 #include "utilities/utils.h"     // for StructGuard
@@ -18,6 +19,8 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
 
 // some older versions of openssl have BIO_new_mem_buf defined with first parameter of type (void*)
 //   which is not true and breaks our build
@@ -41,8 +44,18 @@ class MultiPartHasher {
     update(reinterpret_cast<const unsigned char *>(part), static_cast<uint64_t>(size));
   }
   virtual void reset() = 0;
-  virtual std::string getHexDigest() = 0;
+  // The binary digest. Like getHexDigest() and getHash(), this finishes hashing.
+  virtual std::string getDigest() = 0;
+  std::string getHexDigest();
   virtual Hash getHash() = 0;
+  // Intermediate state, to resume hashing later on the same device. Empty if
+  // the hasher can not export it.
+  virtual std::string exportState() const { return std::string(); }
+  // Returns false, leaving the hasher unchanged, if `state` is not valid.
+  virtual bool importState(const std::string &state) {
+    (void)state;
+    return false;
+  }
 };
 
 class MultiPartSHA512Hasher : public MultiPartHasher {
@@ -55,8 +68,18 @@ class MultiPartSHA512Hasher : public MultiPartHasher {
   MultiPartSHA512Hasher &operator=(MultiPartSHA512Hasher &&) = delete;
   void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha512_update(&state_, part, size); }
   void reset() override { crypto_hash_sha512_init(&state_); }
-  std::string getHexDigest() override;
-  Hash getHash() override { return Hash(Hash::Type::kSha512, getHexDigest()); }
+  std::string getDigest() override;
+  Hash getHash() override { return Hash::fromDigest(Hash::Type::kSha512, getDigest()); }
+  std::string exportState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool importState(const std::string &state) override {
+    if (state.size() != sizeof(state_)) {
+      return false;
+    }
+    std::copy(state.begin(), state.end(), reinterpret_cast<char *>(&state_));
+    return true;
+  }
 
  private:
   crypto_hash_sha512_state state_{};
@@ -72,14 +95,78 @@ class MultiPartSHA256Hasher : public MultiPartHasher {
   MultiPartSHA256Hasher &operator=(MultiPartSHA256Hasher &&) = delete;
   void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha256_update(&state_, part, size); }
   void reset() override { crypto_hash_sha256_init(&state_); }
-  std::string getHexDigest() override;
+  std::string getDigest() override;
 
-  Hash getHash() override { return Hash(Hash::Type::kSha256, getHexDigest()); }
+  Hash getHash() override { return Hash::fromDigest(Hash::Type::kSha256, getDigest()); }
+  std::string exportState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool importState(const std::string &state) override {
+    if (state.size() != sizeof(state_)) {
+      return false;
+    }
+    std::copy(state.begin(), state.end(), reinterpret_cast<char *>(&state_));
+    return true;
+  }
 
  private:
   crypto_hash_sha256_state state_{};
 };
 
+/**
+ * Hasher backed by OpenSSL, which uses the SHA instructions of the CPU
+ * (SHA-NI, ARMv8 cryptography extensions) when it detects them at runtime.
+ * The SHA contexts are used directly as, unlike EVP contexts, their state can
+ * be exported.
+ */
+class MultiPartOpenSSLHasher : public MultiPartHasher {
+ public:
+  // Returns nullptr for unsupported hash types.
+  static std::shared_ptr<MultiPartOpenSSLHasher> create(Hash::Type hash_type);
+
+  explicit MultiPartOpenSSLHasher(Hash::Type hash_type) : hash_type_(hash_type) { reset(); }
+  ~MultiPartOpenSSLHasher() override = default;
+  MultiPartOpenSSLHasher(const MultiPartOpenSSLHasher &) = delete;
+  MultiPartOpenSSLHasher(MultiPartOpenSSLHasher &&) = delete;
+  MultiPartOpenSSLHasher &operator=(const MultiPartOpenSSLHasher &) = delete;
+  MultiPartOpenSSLHasher &operator=(MultiPartOpenSSLHasher &&) = delete;
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
+  std::string getDigest() override;
+  Hash getHash() override { return Hash::fromDigest(hash_type_, getDigest()); }
+  std::string exportState() const override;
+  bool importState(const std::string &state) override;
+
+ private:
+  const Hash::Type hash_type_;
+  SHA256_CTX sha256_{};
+  SHA512_CTX sha512_{};
+};
+
+/**
+ * Computes the digests of several hash types in a single pass over the data:
+ * each part is fed to all hashers block by block, while the block is still
+ * in the CPU cache. Unsupported hash types are ignored.
+ */
+class MultiPartMultiHasher {
+ public:
+  explicit MultiPartMultiHasher(const std::vector<Hash::Type> &hash_types);
+
+  void update(const unsigned char *part, uint64_t size);
+  void reset();
+  std::vector<Hash> getHashes();
+  bool empty() const { return hashers_.empty(); }
+  // State of all the hashers, empty if one of them can not export it.
+  std::string exportState() const;
+  // Returns false, leaving the hashers unchanged, if `state` does not match them.
+  bool importState(const std::string &state);
+
+ private:
+  static constexpr uint64_t kBlockSize = 16 * 1024;
+  std::vector<MultiPartHasher::Ptr> hashers_;
+  std::vector<Hash::Type> hash_types_;
+};
+
 class Crypto {
  public:
   static std::string sha256digest(const std::string &text);
@@ -89,6 +176,7 @@ class Crypto {
   /** A lower case, hexadecimal version of sha512digest */
   static std::string sha512digestHex(const std::string &text);
   static std::string RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message);
+  static std::string RSAPSSSign(EVP_PKEY *key, const std::string &message);
   static std::string Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message);
   static std::string ED25519Sign(const std::string &private_key, const std::string &message);
   static bool parseP12(BIO *p12_bio, const std::string &p12_password, std::string *out_pkey, std::string *out_cert,
@@ -101,15 +189,34 @@ class Crypto {
   static bool generateKeyPair(KeyType key_type, std::string *public_key, std::string *private_key);
 
   static bool RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message);
+  // Same as RSAPSSVerify, with the SHA-256 digest of the message already computed
+  static bool RSAPSSVerifyDigest(const std::string &public_key, const std::string &signature,
+                                 const std::string &digest);
   static bool ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message);
 
   static bool IsRsaKeyType(KeyType type);
   static KeyType IdentifyRSAKeyType(const std::string &public_key_pem);
 
+  // Key of a generated client certificate. ECDSA uses the P-256 curve.
+  enum class CertKeyType { kRSA, kECDSA, kED25519 };
+  static StructGuard<EVP_PKEY> generateCertKeyEVP(CertKeyType key_type, int rsa_bits);
+
   static StructGuard<X509> generateCert(int rsa_bits, int cert_days, const std::string &cert_c,
                                         const std::string &cert_st, const std::string &cert_o,
                                         const std::string &cert_cn, bool self_sign = false);
+  // Takes a reference on `pkey`, which can be serialized with the certificate by serializeCert()
+  static StructGuard<X509> generateCert(EVP_PKEY *pkey, int cert_days, const std::string &cert_c,
+                                        const std::string &cert_st, const std::string &cert_o,
+                                        const std::string &cert_cn, bool self_sign = false);
+
+  struct CertificateAuthority {
+    StructGuard<X509> certificate{nullptr, X509_free};
+    StructGuard<EVP_PKEY> key{nullptr, EVP_PKEY_free};
+  };
+  // Read a CA once to sign many certificates
+  static CertificateAuthority loadCA(const std::string &cacert_path, const std::string &capkey_path);
   static void signCert(const std::string &cacert_path, const std::string &capkey_path, X509 *certificate);
+  static void signCert(const CertificateAuthority &ca, X509 *certificate);
   static void serializeCert(std::string *pkey, std::string *cert, X509 *certificate);
 };
 
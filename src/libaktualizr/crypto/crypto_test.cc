@@ -40,6 +40,56 @@ TEST(crypto, sha512_is_correct) {
   EXPECT_EQ(expected_result, result);
 }
 
+/* OpenSSL and libsodium hashers agree, several digests can be computed in one pass and resumed. */
+TEST(crypto, multipart_hashers) {
+  std::string data;
+  for (int i = 0; i < 5000; ++i) {
+    data += "This is string for testing";
+  }
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+
+  MultiPartSHA256Hasher sha256;
+  MultiPartSHA512Hasher sha512;
+  sha256.update(bytes, data.size());
+  sha512.update(bytes, data.size());
+  const Hash expected_sha256 = sha256.getHash();
+  const Hash expected_sha512 = sha512.getHash();
+
+  for (const auto& expected : {expected_sha256, expected_sha512}) {
+    auto openssl = MultiPartOpenSSLHasher::create(expected.type());
+    ASSERT_NE(openssl, nullptr);
+    openssl->update(bytes, data.size());
+    EXPECT_EQ(openssl->getHash(), expected);
+  }
+
+  MultiPartMultiHasher multi({Hash::Type::kSha256, Hash::Type::kUnknownAlgorithm, Hash::Type::kSha512});
+  ASSERT_FALSE(multi.empty());
+  multi.update(bytes, 100);
+  multi.update(bytes + 100, data.size() - 100);
+  const auto hashes = multi.getHashes();
+  ASSERT_EQ(hashes.size(), 2);
+  EXPECT_EQ(hashes[0], expected_sha256);
+  EXPECT_EQ(hashes[1], expected_sha512);
+
+  EXPECT_TRUE(MultiPartMultiHasher({Hash::Type::kUnknownAlgorithm}).empty());
+
+  // Hashing resumes from an exported state
+  MultiPartMultiHasher first({Hash::Type::kSha256, Hash::Type::kSha512});
+  first.update(bytes, 1000);
+  const std::string state = first.exportState();
+  ASSERT_FALSE(state.empty());
+  MultiPartMultiHasher resumed({Hash::Type::kSha256, Hash::Type::kSha512});
+  ASSERT_TRUE(resumed.importState(state));
+  resumed.update(bytes + 1000, data.size() - 1000);
+  EXPECT_EQ(resumed.getHashes(), hashes);
+
+  MultiPartMultiHasher other({Hash::Type::kSha512});
+  EXPECT_FALSE(other.importState(state));
+  EXPECT_FALSE(other.importState("sha512 00\n"));
+  other.update(bytes, data.size());
+  EXPECT_EQ(other.getHashes()[0], expected_sha512);
+}
+
 /* Sign and verify a file with RSA key stored in a file. */
 TEST(crypto, sign_verify_rsa_file) {
   std::string text = "This is text for sign";
@@ -63,6 +113,19 @@ TEST(crypto, VerifyNewSig) {
   EXPECT_TRUE(pkey.VerifySignature(signature, text)) << "Sig " << signature << " not ok";
 }
 
+/* Signatures verified before are still checked against the message. */
+TEST(crypto, VerifyRepeatedSig) {
+  PublicKey pkey(fs::path("tests/test_data/public.key"));
+  const auto signature = Utils::readFile("tests/test_data/rsa_sig.sig");
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(pkey.VerifySignature(signature, "my message"));
+    EXPECT_FALSE(pkey.VerifySignature(signature, "my other message"));
+  }
+
+  PublicKey other_key(fs::path("tests/test_data/prov/ecukey.pub"));
+  EXPECT_FALSE(other_key.VerifySignature(signature, "my message"));
+}
+
 #ifdef BUILD_P11
 
 class P11Crypto : public ::testing::Test {
@@ -4,6 +4,9 @@
 
 #include <fstream>
 
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
 #include "logging/logging.h"
 #include "utilities/utils.h"
 
@@ -30,6 +33,22 @@ TEST(Hash, DecodeBad) {
   EXPECT_EQ(Hash::decodeVector(bad4), std::vector<Hash>{});
 }
 
+TEST(Hash, Digest) {
+  const std::string hex = "b5bb9d8014a0f9b1d61e21e796d78dccdf1352f23cd32812f4850b878ae4944c";
+  const Hash hash(Hash::Type::kSha256, hex);
+  EXPECT_EQ(hash, Hash("sha256", boost::algorithm::to_upper_copy(hex)));
+  EXPECT_EQ(hash.HashString(), boost::algorithm::to_upper_copy(hex));
+  EXPECT_EQ(hash, Hash::fromDigest(Hash::Type::kSha256, boost::algorithm::unhex(hex)));
+  EXPECT_NE(hash, Hash(Hash::Type::kSha512, hex));
+  EXPECT_NE(hash, Hash(Hash::Type::kSha256, hex.substr(0, 63) + "d"));
+  EXPECT_NE(hash, Hash(Hash::Type::kSha256, hex.substr(0, 62)));
+
+  // Hash strings that are not hex digests are kept as they are
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "not-hex").HashString(), "NOT-HEX");
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "not-hex"), Hash(Hash::Type::kSha256, "NOT-HEX"));
+  EXPECT_NE(Hash(Hash::Type::kSha256, "not-hex"), hash);
+}
+
 TEST(Hash, shortTag) {
   std::vector<Hash> hashes = {{Hash::Type::kSha256, "B5bB9d8014a0f9b1d61e21e796d78dccdf1352f23cd32812f4850b878ae4944c"},
                               {Hash::Type::kSha512,
@@ -1,6 +1,7 @@
 #include "keymanager.h"
 
 #include <stdexcept>
+#include <tuple>
 #include <utility>
 
 #include <boost/filesystem.hpp>
@@ -36,6 +37,8 @@ KeyManager::KeyManager(std::shared_ptr<INvStorage> backend, KeyManagerConfig con
 
 void KeyManager::loadKeys(const std::string *pkey_content, const std::string *cert_content,
                           const std::string *ca_content) {
+  // Missing credentials are looked up again by the next loadKeysOnce()
+  bool complete = true;
   if (config_.tls_pkey_source == CryptoSource::kFile) {
     std::string pkey;
     if (pkey_content != nullptr) {
@@ -48,6 +51,8 @@ void KeyManager::loadKeys(const std::string *pkey_content, const std::string *ce
         tmp_pkey_file = std_::make_unique<TemporaryFile>("tls-pkey");
       }
       tmp_pkey_file->PutContents(pkey);
+    } else {
+      complete = false;
     }
   }
   if (config_.tls_cert_source == CryptoSource::kFile) {
@@ -62,6 +67,8 @@ void KeyManager::loadKeys(const std::string *pkey_content, const std::string *ce
         tmp_cert_file = std_::make_unique<TemporaryFile>("tls-cert");
       }
       tmp_cert_file->PutContents(cert);
+    } else {
+      complete = false;
     }
   }
   if (config_.tls_ca_source == CryptoSource::kFile) {
@@ -76,8 +83,23 @@ void KeyManager::loadKeys(const std::string *pkey_content, const std::string *ce
         tmp_ca_file = std_::make_unique<TemporaryFile>("tls-ca");
       }
       tmp_ca_file->PutContents(ca);
+    } else {
+      complete = false;
     }
   }
+  keys_loaded_ = complete;
+}
+
+void KeyManager::loadKeysOnce() {
+  std::lock_guard<std::mutex> guard(load_mutex_);
+  if (!keys_loaded_) {
+    loadKeys();
+  }
+}
+
+void KeyManager::invalidateKeys() {
+  std::lock_guard<std::mutex> guard(load_mutex_);
+  keys_loaded_ = false;
 }
 
 std::string KeyManager::getPkeyFile() const {
@@ -266,22 +288,22 @@ bool KeyManager::copyCertsToCurl(HttpInterface &http) const {
 }
 
 Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
-  ENGINE *crypto_engine = nullptr;
-  std::string private_key;
+  std::string b64sig;
   if (config_.uptane_key_source == CryptoSource::kPkcs11) {
     if (!built_with_p11) {
       throw std::runtime_error("Aktualizr was built without PKCS#11");
     }
-    crypto_engine = (*p11_)->getEngine();
-    private_key = config_.p11.uptane_key_id;
-  }
-
-  std::string b64sig;
-  if (config_.uptane_key_source == CryptoSource::kFile) {
+    // The engine keeps the key handle, so only the signature itself goes to the HSM
+    const std::shared_ptr<EVP_PKEY> key = (*p11_)->getPrivateKey(config_.p11.uptane_key_id);
+    if (key != nullptr) {
+      b64sig = Utils::toBase64(Crypto::RSAPSSSign(key.get(), Utils::jsonToCanonicalStr(in_data)));
+    }
+  } else {
+    std::string private_key;
     backend_->loadPrimaryPrivate(&private_key);
+    b64sig = Utils::toBase64(
+        Crypto::Sign(config_.uptane_key_type, nullptr, private_key, Utils::jsonToCanonicalStr(in_data)));
   }
-  b64sig = Utils::toBase64(
-      Crypto::Sign(config_.uptane_key_type, crypto_engine, private_key, Utils::jsonToCanonicalStr(in_data)));
 
   Json::Value signature;
   switch (config_.uptane_key_type) {
@@ -312,7 +334,13 @@ std::string KeyManager::generateUptaneKeyPair() {
   if (config_.uptane_key_source == CryptoSource::kFile) {
     std::string primary_private;
     if (!backend_->loadPrimaryKeys(&primary_public, &primary_private)) {
-      bool result_ = Crypto::generateKeyPair(config_.uptane_key_type, &primary_public, &primary_private);
+      bool result_;
+      if (pregenerated_keys_.valid()) {
+        std::tie(primary_public, primary_private) = pregenerated_keys_.get();
+        result_ = !primary_public.empty() && !primary_private.empty();
+      } else {
+        result_ = Crypto::generateKeyPair(config_.uptane_key_type, &primary_public, &primary_private);
+      }
       if (result_) {
         backend_->storePrimaryKeys(primary_public, primary_private);
       }
@@ -336,6 +364,22 @@ std::string KeyManager::generateUptaneKeyPair() {
   return primary_public;
 }
 
+void KeyManager::pregenerateUptaneKeyPair() {
+  std::string primary_public;
+  if (config_.uptane_key_source != CryptoSource::kFile || pregenerated_keys_.valid() ||
+      backend_->loadPrimaryPublic(&primary_public)) {
+    return;
+  }
+  const KeyType key_type = config_.uptane_key_type;
+  pregenerated_keys_ = std::async(std::launch::async, [key_type]() {
+    std::pair<std::string, std::string> keys;
+    if (!Crypto::generateKeyPair(key_type, &keys.first, &keys.second)) {
+      keys = {};
+    }
+    return keys;
+  });
+}
+
 PublicKey KeyManager::UptanePublicKey() const {
   std::string primary_public;
   if (config_.uptane_key_source == CryptoSource::kFile) {
@@ -1,8 +1,11 @@
 #ifndef KEYMANAGER_H_
 #define KEYMANAGER_H_
 
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 
 #include "json/json.h"
 
@@ -28,6 +31,14 @@ class KeyManager {
   bool copyCertsToCurl(HttpInterface &http) const;
   void loadKeys(const std::string *pkey_content = nullptr, const std::string *cert_content = nullptr,
                 const std::string *ca_content = nullptr);
+  /**
+   * Load the TLS credentials from storage unless they were loaded already
+   * since the last call to invalidateKeys().
+   */
+  void loadKeysOnce();
+  /** Make the next loadKeysOnce() read the credentials again, e.g. after they
+   * were rotated. */
+  void invalidateKeys();
   std::string getPkeyFile() const;
   std::string getCertFile() const;
   std::string getCaFile() const;
@@ -37,6 +48,12 @@ class KeyManager {
   std::string getCN() const;
   void getCertInfo(std::string *subject, std::string *issuer, std::string *not_before, std::string *not_after) const;
   std::string generateUptaneKeyPair();
+  /**
+   * Start generating the Uptane key pair on another thread if none is stored
+   * yet, so that generateUptaneKeyPair() has less or nothing to wait for. A key
+   * pair stored in the meantime, e.g. by an import, is used instead.
+   */
+  void pregenerateUptaneKeyPair();
   KeyType getUptaneKeyType() const { return config_.uptane_key_type; }
   Json::Value signTuf(const Json::Value &in_data) const;
 
@@ -49,6 +66,11 @@ class KeyManager {
   std::unique_ptr<TemporaryFile> tmp_pkey_file;
   std::unique_ptr<TemporaryFile> tmp_cert_file;
   std::unique_ptr<TemporaryFile> tmp_ca_file;
+  // Targets may be downloaded in parallel, and all of them load the keys
+  std::mutex load_mutex_;
+  bool keys_loaded_{false};
+  // Public and private key, both empty if the generation failed
+  std::future<std::pair<std::string, std::string>> pregenerated_keys_;
 };
 
 #endif  // KEYMANAGER_H_
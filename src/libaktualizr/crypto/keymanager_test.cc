@@ -113,6 +113,61 @@ TEST(KeyManager, InitFileValid) {
   EXPECT_EQ(cert, Utils::readFile(cert_file));
 }
 
+/* Credentials are read again only after they were invalidated. */
+TEST(KeyManager, LoadKeysOnce) {
+  Config config;
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+
+  // Nothing to load yet, so the next call looks again
+  keys.loadKeysOnce();
+  EXPECT_TRUE(keys.getCertFile().empty());
+
+  const std::string cert = Utils::readFile("tests/test_data/prov/client.pem");
+  storage->storeTlsCreds(Utils::readFile("tests/test_data/prov/root.crt"), cert,
+                         Utils::readFile("tests/test_data/prov/pkey.pem"));
+  keys.loadKeysOnce();
+  const std::string cert_file = keys.getCertFile();
+  ASSERT_FALSE(cert_file.empty());
+  EXPECT_EQ(Utils::readFile(cert_file), cert);
+
+  const std::string new_cert = Utils::readFile("tests/test_data/prov/root.crt");
+  storage->storeTlsCert(new_cert);
+  keys.loadKeysOnce();
+  EXPECT_EQ(Utils::readFile(keys.getCertFile()), cert);
+  keys.invalidateKeys();
+  keys.loadKeysOnce();
+  EXPECT_EQ(Utils::readFile(keys.getCertFile()), new_cert);
+}
+
+/* A pregenerated key pair is stored on first use, unless one was stored in the meantime. */
+TEST(KeyManager, PregenerateUptaneKeyPair) {
+  Config config;
+  config.uptane.key_type = KeyType::kED25519;
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  {
+    KeyManager keys(storage, config.keymanagerConfig());
+    keys.pregenerateUptaneKeyPair();
+    const std::string public_key = keys.generateUptaneKeyPair();
+    EXPECT_FALSE(public_key.empty());
+    std::string stored_public;
+    EXPECT_TRUE(storage->loadPrimaryPublic(&stored_public));
+    EXPECT_EQ(stored_public, public_key);
+  }
+
+  storage->clearPrimaryKeys();
+  {
+    KeyManager keys(storage, config.keymanagerConfig());
+    keys.pregenerateUptaneKeyPair();
+    storage->storePrimaryKeys("imported_public", "imported_private");
+    EXPECT_EQ(keys.generateUptaneKeyPair(), "imported_public");
+  }
+}
+
 #ifdef BUILD_P11
 
 class P11KeyManager : public ::testing::Test {
@@ -157,6 +212,33 @@ TEST_F(P11KeyManager, SignTufPkcs11) {
   EXPECT_NE(signed_json["signatures"][0]["sig"].asString().size(), 0);
 }
 
+/* Sign repeatedly with the key handle kept by the engine. */
+TEST_F(P11KeyManager, SignTufPkcs11Repeated) {
+  P11Config p11_conf;
+  p11_conf.module = module_path_;
+  p11_conf.pass = pass_;
+  p11_conf.uptane_key_id = "03";
+
+  Config config;
+  config.p11 = p11_conf;
+  config.uptane.key_source = CryptoSource::kPkcs11;
+
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig(), p11_);
+
+  const PublicKey public_key = keys.UptanePublicKey();
+  EXPECT_EQ(public_key, keys.UptanePublicKey());
+  for (int i = 0; i < 3; ++i) {
+    Json::Value tosign_json;
+    tosign_json["counter"] = i;
+    Json::Value signed_json = keys.signTuf(tosign_json);
+    EXPECT_TRUE(public_key.VerifySignature(signed_json["signatures"][0]["sig"].asString(),
+                                           Utils::jsonToCanonicalStr(tosign_json)));
+  }
+}
+
 /* Generate Uptane keys, use them for signing, and verify them. */
 TEST_F(P11KeyManager, GenSignTufPkcs11) {
   Json::Value tosign_json;
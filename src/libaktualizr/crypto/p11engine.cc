@@ -181,6 +181,13 @@ bool P11Engine::readUptanePublicKey(const std::string& uptane_key_id, std::strin
     return false;  // id is a hex string
   }
 
+  std::lock_guard<std::mutex> lock(keys_mutex_);
+  const auto cached = public_keys_.find(uptane_key_id);
+  if (cached != public_keys_.end()) {
+    *key_out = cached->second;
+    return true;
+  }
+
   PKCS11_SLOT* slot = findTokenSlot();
   if (slot == nullptr) {
     return false;
@@ -221,11 +228,34 @@ bool P11Engine::readUptanePublicKey(const std::string& uptane_key_id, std::strin
   // NOLINTNEXTLINE(google-runtime-int,cppcoreguidelines-pro-type-cstyle-cast)
   long length = BIO_get_mem_data(mem.get(), &pem_key);
   key_out->assign(pem_key, static_cast<size_t>(length));
+  public_keys_[uptane_key_id] = *key_out;
 
   return true;
 }
 
+std::shared_ptr<EVP_PKEY> P11Engine::getPrivateKey(const std::string& id) {
+  std::lock_guard<std::mutex> lock(keys_mutex_);
+  const auto cached = private_keys_.find(id);
+  if (cached != private_keys_.end()) {
+    return cached->second;
+  }
+
+  // TODO(OTA-2138): this call leaks memory somehow...
+  std::shared_ptr<EVP_PKEY> key(ENGINE_load_private_key(ssl_engine_, id.c_str(), nullptr, nullptr), EVP_PKEY_free);
+  if (key == nullptr) {
+    LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
+  }
+  private_keys_[id] = key;
+  return key;
+}
+
 bool P11Engine::generateUptaneKeyPair(const std::string& uptane_key_id) {
+  std::lock_guard<std::mutex> lock(keys_mutex_);
+  // Whatever was read for this id before is about to be overwritten
+  public_keys_.erase(uptane_key_id);
+  private_keys_.erase(uptane_key_id);
+
   PKCS11_SLOT* slot = findTokenSlot();
   if (slot == nullptr) {
     return false;
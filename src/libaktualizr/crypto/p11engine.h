@@ -1,7 +1,9 @@
 #ifndef P11ENGINE_H_
 #define P11ENGINE_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
 
 #include "libaktualizr/config.h"
 
@@ -59,6 +61,13 @@ class P11Engine {
   bool readTlsCert(const std::string &id, std::string *cert_out) const;
   bool generateUptaneKeyPair(const std::string &uptane_key_id);
 
+  /**
+   * Load a private key through the engine. The handle is looked up on the token
+   * once and then reused for every signature, like the public keys read by
+   * readUptanePublicKey().
+   */
+  std::shared_ptr<EVP_PKEY> getPrivateKey(const std::string &id);
+
  private:
   const boost::filesystem::path module_path_;
   const std::string pass_;
@@ -66,6 +75,9 @@ class P11Engine {
   std::string uri_prefix_;
   P11ContextWrapper ctx_;
   P11SlotsWrapper wslots_;
+  std::mutex keys_mutex_;
+  std::map<std::string, std::string> public_keys_;
+  std::map<std::string, std::shared_ptr<EVP_PKEY>> private_keys_;
 
   static boost::filesystem::path findPkcsLibrary();
   PKCS11_slot_st *findTokenSlot() const;
@@ -1,13 +1,28 @@
 #include "httpclient.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <ctime>
 #include <sstream>
+#include <thread>
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+#include "logging/metrics.h"
+#include "logging/tracing.h"
+#include "utilities/fault_injection.h"
+#include "utilities/memory_budget.h"
+#include "utilities/retry_policy.h"
 #include "utilities/utils.h"
 
 struct WriteStringArg {
   std::string out;
   int64_t limit{0};
+  MemoryBudget::Reservation budget;
+  CURL* handle{nullptr};
 };
 
 /*****************************************************************************/
@@ -28,12 +43,90 @@ static size_t writeString(void* contents, size_t size, size_t nmemb, void* userp
       return 0;
     }
   }
-  (static_cast<WriteStringArg*>(userp))->out.append(static_cast<char*>(contents), size * nmemb);
+  if (arg->out.empty() && arg->handle != nullptr) {
+    // Size the body once from the Content-Length, rather than copying it each time the string grows
+    curl_off_t length = -1;
+    if (curl_easy_getinfo(arg->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length > 0 &&
+        (arg->limit <= 0 || length <= arg->limit) &&
+        static_cast<uint64_t>(length) <= MemoryBudget::instance().available()) {
+      arg->out.reserve(static_cast<size_t>(length));
+    }
+  }
+  if (!arg->budget.tryGrow(size * nmemb)) {
+    LOG_WARNING_LIMITED << "HTTP response of more than " << arg->out.length() << " bytes exceeds the memory budget";
+    return 0;
+  }
+  arg->out.append(static_cast<char*>(contents), size * nmemb);
 
   // return size of written data
   return size * nmemb;
 }
 
+struct ResponseHeaders {
+  HttpValidators validators;
+  int64_t retry_after_sec{-1};
+};
+
+/* Seconds in a Retry-After value, which is either a number of seconds or an HTTP date. */
+static int64_t parseRetryAfter(const std::string& value) {
+  if (!value.empty() && std::all_of(value.begin(), value.end(), ::isdigit)) {
+    return std::stoll(value.substr(0, 18));
+  }
+  struct tm date {};
+  if (strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S", &date) == nullptr) {
+    return -1;
+  }
+  return std::max<int64_t>(static_cast<int64_t>(timegm(&date) - time(nullptr)), 0);
+}
+
+/* The max-age directive of a Cache-Control value, in seconds. */
+static int64_t parseMaxAge(const std::string& value) {
+  const std::string lower = boost::algorithm::to_lower_copy(value);
+  const auto pos = lower.find("max-age=");
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  const auto begin = pos + std::strlen("max-age=");
+  const auto end = lower.find_first_not_of("0123456789", begin);
+  const std::string digits = lower.substr(begin, std::min<size_t>(end - begin, 18));
+  return digits.empty() ? -1 : std::stoll(digits);
+}
+
+/**
+ * Header handler for the curl library. Keeps the cache validators of the
+ * response and how long it asks the client to wait before polling again.
+ * https://curl.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+ */
+static size_t readResponseHeaders(char* buffer, size_t size, size_t nitems, void* userdata) {
+  auto* headers = static_cast<ResponseHeaders*>(userdata);
+  const std::string header(buffer, size * nitems);
+  const auto colon = header.find(':');
+  if (colon != std::string::npos) {
+    const std::string name = boost::algorithm::to_lower_copy(header.substr(0, colon));
+    const std::string value = boost::algorithm::trim_copy(header.substr(colon + 1));
+    if (name == "etag") {
+      headers->validators.etag = value;
+    } else if (name == "last-modified") {
+      headers->validators.last_modified = value;
+    } else if (name == "retry-after") {
+      headers->retry_after_sec = std::max(headers->retry_after_sec, parseRetryAfter(value));
+    } else if (name == "cache-control") {
+      headers->retry_after_sec = std::max(headers->retry_after_sec, parseMaxAge(value));
+    }
+  }
+  return size * nitems;
+}
+
+static void annotateUrl(TraceSpan* span, CURL* handle) {
+  if (span->active()) {
+    char* url = nullptr;
+    curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url);
+    if (url != nullptr) {
+      span->annotate(url);
+    }
+  }
+}
+
 static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
   (void)dltotal;
   (void)dlnow;
@@ -58,13 +151,61 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   return 0;
 }
 
-HttpClient::HttpClient(const std::vector<std::string>* extra_headers) {
+CurlShareWrapper::CurlShareWrapper() {
+  share_ = curl_share_init();
+  if (share_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl share handle");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, CurlShareWrapper::lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, CurlShareWrapper::unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  // Sharing the connection cache is only supported since curl 7.57.0
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlShareWrapper::~CurlShareWrapper() { curl_share_cleanup(share_); }
+
+std::shared_ptr<CurlShareWrapper> CurlShareWrapper::instance() {
+  // Clients made for other purposes, e.g. the Secondaries or the report queue,
+  // then reuse the DNS entries, connections and TLS sessions of the others
+  static const auto share = std::make_shared<CurlShareWrapper>();
+  return share;
+}
+
+void CurlShareWrapper::lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+  (void)handle;
+  (void)access;
+  static_cast<CurlShareWrapper*>(userptr)->mutexes_.at(static_cast<size_t>(data)).lock();
+}
+
+void CurlShareWrapper::unlock(CURL* handle, curl_lock_data data, void* userptr) {
+  (void)handle;
+  static_cast<CurlShareWrapper*>(userptr)->mutexes_.at(static_cast<size_t>(data)).unlock();
+}
+
+HttpClient::HttpClient(const std::vector<std::string>* extra_headers) : share_(CurlShareWrapper::instance()) {
   curl = curl_easy_init();
   if (curl == nullptr) {
     throw std::runtime_error("Could not initialize curl");
   }
   headers = nullptr;
 
+  // All handles duplicated from this one inherit the share handle, so that
+  // connections and TLS sessions are reused across requests.
+  curlEasySetoptWrapper(curl, CURLOPT_SHARE, share_->get());
+  curlEasySetoptWrapper(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+  // HTTP/2 where the server offers it in the TLS handshake, so that concurrent requests to the device gateway are
+  // multiplexed on one connection rather than opening one each
+  const long http_version = CURL_HTTP_VERSION_2TLS;  // NOLINT(google-runtime-int)
+  curlEasySetoptWrapper(curl, CURLOPT_HTTP_VERSION, http_version);
+  curlEasySetoptWrapper(curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
   curlEasySetoptWrapper(curl, CURLOPT_NOSIGNAL, 1L);
   curlEasySetoptWrapper(curl, CURLOPT_TIMEOUT, 60L);
   curlEasySetoptWrapper(curl, CURLOPT_CONNECTTIMEOUT, 60L);
@@ -95,7 +236,10 @@ HttpClient::HttpClient(const std::string& socket) : HttpClient() {
 }
 
 HttpClient::HttpClient(const HttpClient& curl_in)
-    : HttpInterface(curl_in), pkcs11_key(curl_in.pkcs11_key), pkcs11_cert(curl_in.pkcs11_key) {
+    : HttpInterface(curl_in),
+      share_(curl_in.share_),
+      pkcs11_key(curl_in.pkcs11_key),
+      pkcs11_cert(curl_in.pkcs11_key) {
   curl = curl_easy_duphandle(curl_in.curl);
   headers = curl_slist_dup(curl_in.headers);
 }
@@ -107,6 +251,15 @@ HttpClient::~HttpClient() {
   curl_easy_cleanup(curl);
 }
 
+#if LIBCURL_VERSION_NUM >= 0x074d00
+// Curl copies the blob, also into every handle duplicated from this one, so no
+// file has to be written and the credentials are parsed from memory.
+static void setBlob(CURL* curl, CURLoption option, const std::string& data) {
+  curl_blob blob{const_cast<char*>(data.data()), data.size(), CURL_BLOB_COPY};
+  curlEasySetoptWrapper(curl, option, &blob);
+}
+#endif
+
 void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
                           CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYPEER, 1);
@@ -116,20 +269,33 @@ void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const s
   if (ca_source == CryptoSource::kPkcs11) {
     throw std::runtime_error("Accessing CA certificate on PKCS11 devices isn't currently supported");
   }
+#if LIBCURL_VERSION_NUM >= 0x074d00
+  // In-memory CA bundles are only supported since curl 7.77.0. Drop the
+  // default bundle path so that, as with a file, only this CA is trusted.
+  curlEasySetoptWrapper(curl, CURLOPT_CAINFO, static_cast<const char*>(nullptr));
+  setBlob(curl, CURLOPT_CAINFO_BLOB, ca);
+  tls_ca_file.reset();
+#else
   std::unique_ptr<TemporaryFile> tmp_ca_file = std_::make_unique<TemporaryFile>("tls-ca");
   tmp_ca_file->PutContents(ca);
   curlEasySetoptWrapper(curl, CURLOPT_CAINFO, tmp_ca_file->Path().c_str());
   tls_ca_file = std::move_if_noexcept(tmp_ca_file);
+#endif
 
   if (cert_source == CryptoSource::kPkcs11) {
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, cert.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "ENG");
   } else {  // cert_source == CryptoSource::kFile
+#if LIBCURL_VERSION_NUM >= 0x074d00
+    setBlob(curl, CURLOPT_SSLCERT_BLOB, cert);
+    tls_cert_file.reset();
+#else
     std::unique_ptr<TemporaryFile> tmp_cert_file = std_::make_unique<TemporaryFile>("tls-cert");
     tmp_cert_file->PutContents(cert);
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, tmp_cert_file->Path().c_str());
-    curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "PEM");
     tls_cert_file = std::move_if_noexcept(tmp_cert_file);
+#endif
+    curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "PEM");
   }
   pkcs11_cert = (cert_source == CryptoSource::kPkcs11);
 
@@ -139,19 +305,44 @@ void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const s
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, pkey.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "ENG");
   } else {  // pkey_source == CryptoSource::kFile
+#if LIBCURL_VERSION_NUM >= 0x074d00
+    setBlob(curl, CURLOPT_SSLKEY_BLOB, pkey);
+    tls_pkey_file.reset();
+#else
     std::unique_ptr<TemporaryFile> tmp_pkey_file = std_::make_unique<TemporaryFile>("tls-pkey");
     tmp_pkey_file->PutContents(pkey);
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, tmp_pkey_file->Path().c_str());
-    curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "PEM");
     tls_pkey_file = std::move_if_noexcept(tmp_pkey_file);
+#endif
+    curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "PEM");
   }
   pkcs11_key = (pkey_source == CryptoSource::kPkcs11);
 }
 
 HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control) {
+  return performGet(url, maxsize, flow_control, nullptr);
+}
+
+HttpResponse HttpClient::getConditional(const std::string& url, int64_t maxsize, HttpValidators* validators,
+                                        const api::FlowControlToken* flow_control) {
+  return performGet(url, maxsize, flow_control, validators);
+}
+
+HttpResponse HttpClient::performGet(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control,
+                                    HttpValidators* validators) {
   CURL* curl_get = Utils::curlDupHandleWrapper(curl, pkcs11_key);
 
-  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, headers);
+  curl_slist* req_headers = curl_slist_dup(headers);
+  if (validators != nullptr) {
+    if (!validators->etag.empty()) {
+      req_headers = curl_slist_append(req_headers, ("If-None-Match: " + validators->etag).c_str());
+    }
+    if (!validators->last_modified.empty()) {
+      req_headers = curl_slist_append(req_headers, ("If-Modified-Since: " + validators->last_modified).c_str());
+    }
+  }
+  ResponseHeaders received;
+  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, req_headers);
 
   if (pkcs11_cert) {
     curlEasySetoptWrapper(curl_get, CURLOPT_SSLCERTTYPE, "ENG");
@@ -162,6 +353,9 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   curlEasySetoptWrapper(curl_get, CURLOPT_POSTFIELDS, "");
   curlEasySetoptWrapper(curl_get, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_get, CURLOPT_HTTPGET, 1L);
+  // Accept every encoding this libcurl can decode: gzip and deflate, and br and zstd if built with them. The body
+  // is decompressed as it arrives, so maxsize limits its decompressed size.
+  curlEasySetoptWrapper(curl_get, CURLOPT_ACCEPT_ENCODING, "");
   if (flow_control != nullptr) {
     // Handle cancellation
     curlEasySetoptWrapper(curl_get, CURLOPT_NOPROGRESS, 0);
@@ -170,8 +364,13 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   }
 
   LOG_DEBUG << "GET " << url;
-  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize);
+  HttpResponse response = perform(curl_get, url, RETRY_TIMES, maxsize, &received);
   curl_easy_cleanup(curl_get);
+  curl_slist_free_all(req_headers);
+  // a 304 response may leave out the validators, as they did not change
+  if (validators != nullptr && (!response.isNotModified() || !received.validators.empty())) {
+    *validators = received.validators;
+  }
   return response;
 }
 
@@ -183,7 +382,7 @@ HttpResponse HttpClient::post(const std::string& url, const std::string& content
   curlEasySetoptWrapper(curl_post, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_post, CURLOPT_POST, 1);
   curlEasySetoptWrapper(curl_post, CURLOPT_POSTFIELDS, data.c_str());
-  auto result = perform(curl_post, RETRY_TIMES, HttpInterface::kPostRespLimit);
+  auto result = perform(curl_post, url, RETRY_TIMES, HttpInterface::kPostRespLimit);
   curl_easy_cleanup(curl_post);
   curl_slist_free_all(req_headers);
   return result;
@@ -203,7 +402,7 @@ HttpResponse HttpClient::put(const std::string& url, const std::string& content_
   curlEasySetoptWrapper(curl_put, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_put, CURLOPT_POSTFIELDS, data.c_str());
   curlEasySetoptWrapper(curl_put, CURLOPT_CUSTOMREQUEST, "PUT");
-  HttpResponse result = perform(curl_put, RETRY_TIMES, HttpInterface::kPutRespLimit);
+  HttpResponse result = perform(curl_put, url, RETRY_TIMES, HttpInterface::kPutRespLimit);
   curl_easy_cleanup(curl_put);
   curl_slist_free_all(req_headers);
   return result;
@@ -215,8 +414,10 @@ HttpResponse HttpClient::put(const std::string& url, const Json::Value& data) {
   return put(url, "application/json", data_str);
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t size_limit) {
+HttpResponse HttpClient::perform(CURL* curl_handler, const std::string& url, int retry_times, int64_t size_limit,
+                                 ResponseHeaders* received) {
+  static const RetryPolicy kRetryPolicy{0, std::chrono::seconds(1), std::chrono::seconds(kMaxInlineRetryAfterSec),
+                                        2.0, 0.5};
   if (size_limit >= 0) {
     // it will only take effect if the server declares the size in advance,
     //    writeString callback takes care of the other case
@@ -224,28 +425,80 @@ HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t si
   }
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
+  ResponseHeaders response_headers;
+  if (received == nullptr) {
+    received = &response_headers;
+  }
+  curlEasySetoptWrapper(curl_handler, CURLOPT_HEADERFUNCTION, readResponseHeaders);
+  curlEasySetoptWrapper(curl_handler, CURLOPT_HEADERDATA, static_cast<void*>(received));
+
+  static auto& requests = Metrics::instance().counter("aktualizr_http_requests_total", "HTTP requests");
+  static auto& errors =
+      Metrics::instance().counter("aktualizr_http_errors_total", "HTTP requests failed in curl or with a 5xx status");
+  static auto& refused = Metrics::instance().counter("aktualizr_http_circuit_open_total",
+                                                     "HTTP requests not made while their endpoint kept failing");
+  static auto& latency =
+      Metrics::instance().histogram("aktualizr_http_request_duration_seconds", "Duration of HTTP requests");
+  CircuitBreaker& breaker = CircuitBreaker::forEndpoint(url);
+  for (int retry = 1;; ++retry) {
+    if (!breaker.allow()) {
+      refused.add();
+      LOG_DEBUG << "Not connecting to " << CircuitBreaker::endpointOf(url) << " for now, after repeated failures";
+      return HttpResponse("", 0, CURLE_COULDNT_CONNECT, "endpoint failed repeatedly, not retrying yet");
+    }
+    CircuitBreaker::Call call(breaker);
+
+    *received = ResponseHeaders();
+    WriteStringArg response_arg;
+    response_arg.limit = size_limit;
+    response_arg.handle = curl_handler;
+    curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
+    TraceSpan span("http", "request");
+    CURLcode result;
+    {
+      ScopedLatency timer(latency);
+      result = curl_easy_perform(curl_handler);
+      fault_injection_throttle("http_perform", response_arg.out.size());
+    }
+    requests.add();
+    annotateUrl(&span, curl_handler);
+    long http_code;  // NOLINT(google-runtime-int)
+    curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
+    HttpResponse response(std::move(response_arg.out), http_code, result,
+                          (result != CURLE_OK) ? curl_easy_strerror(result) : "");
+    response.retry_after_sec = received->retry_after_sec;
+    LOG_TRACE << "response http code: " << response.http_status_code;
+    LOG_TRACE << "response: " << response.body;
+
+    // Failures of this request rather than of the endpoint: cancelled, or a response that is too large
+    const bool local_failure = result == CURLE_ABORTED_BY_CALLBACK || result == CURLE_WRITE_ERROR ||
+                               result == CURLE_FILESIZE_EXCEEDED;
+    // The server asks this client to slow down, and is otherwise fine
+    const bool throttled = response.http_status_code == 429;
+    const bool failed = (response.curl_code != CURLE_OK && !local_failure) || response.http_status_code >= 500;
+    if (!failed && !throttled) {
+      // A local failure leaves the call released, without a verdict on the endpoint
+      if (!local_failure) {
+        call.success();
+      }
+      return response;
+    }
+    LOG_ERROR << "curl error " << response.curl_code << " (http code " << response.http_status_code
+              << "): " << response.error_message;
+    if (failed) {
+      errors.add();
+      call.failure();
+    } else {
+      call.success();
+    }
 
-  WriteStringArg response_arg;
-  response_arg.limit = size_limit;
-  curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
-  CURLcode result = curl_easy_perform(curl_handler);
-  long http_code;  // NOLINT(google-runtime-int)
-  curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
-  HttpResponse response(response_arg.out, http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-  if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
-    std::ostringstream error_message;
-    error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
-                  << "): " << response.error_message;
-    LOG_ERROR << error_message.str();
-    if (retry_times != 0) {
-      sleep(1);
-      // NOLINTNEXTLINE(misc-no-recursion)
-      response = perform(curl_handler, --retry_times, size_limit);
+    const int64_t retry_after =
+        (throttled || response.http_status_code == 503) ? response.retry_after_sec : int64_t{-1};
+    if (retry > retry_times || retry_after > kMaxInlineRetryAfterSec) {
+      return response;
     }
+    std::this_thread::sleep_for(kRetryPolicy.delay(retry, retry_after));
   }
-  LOG_TRACE << "response http code: " << response.http_status_code;
-  LOG_TRACE << "response: " << response.body;
-  return response;
 }
 
 HttpResponse HttpClient::download(const std::string& url, curl_write_callback write_cb,
@@ -256,13 +509,33 @@ HttpResponse HttpClient::download(const std::string& url, curl_write_callback wr
 std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
                                                     curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
                                                     CurlHandler* easyp) {
-  CURL* curl_download = Utils::curlDupHandleWrapper(curl, pkcs11_key);
-
-  CurlHandler curlp = CurlHandler(curl_download, curl_easy_cleanup);
-
+  CurlHandler curlp = prepareDownload(url, write_cb, progress_cb, userp);
   if (easyp != nullptr) {
     *easyp = curlp;
   }
+  curlEasySetoptWrapper(curlp.get(), CURLOPT_RESUME_FROM_LARGE, from);
+  return performAsync(curlp);
+}
+
+std::future<HttpResponse> HttpClient::downloadRangeAsync(const std::string& url, curl_write_callback write_cb,
+                                                         curl_xferinfo_callback progress_cb, void* userp,
+                                                         curl_off_t from, curl_off_t to) {
+  CurlHandler curlp = prepareDownload(url, write_cb, progress_cb, userp);
+  const std::string range = std::to_string(from) + "-" + std::to_string(to);
+  curlEasySetoptWrapper(curlp.get(), CURLOPT_RANGE, range.c_str());
+  return performAsync(curlp);
+}
+
+CurlHandler HttpClient::prepareDownload(const std::string& url, curl_write_callback write_cb,
+                                        curl_xferinfo_callback progress_cb, void* userp) {
+  CURL* curl_download = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+
+  // The handle can outlive this HttpClient (see `easyp`), so it keeps its own
+  // reference to the share handle.
+  CurlHandler curlp = CurlHandler(curl_download, [share = share_](CURL* handle) {
+    curl_easy_cleanup(handle);
+    (void)share;
+  });
 
   curlEasySetoptWrapper(curl_download, CURLOPT_HTTPHEADER, headers);
   curlEasySetoptWrapper(curl_download, CURLOPT_URL, url.c_str());
@@ -277,13 +550,29 @@ std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl
   curlEasySetoptWrapper(curl_download, CURLOPT_TIMEOUT, 0);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
-  curlEasySetoptWrapper(curl_download, CURLOPT_RESUME_FROM_LARGE, from);
+  return curlp;
+}
 
+std::future<HttpResponse> HttpClient::performAsync(const CurlHandler& curlp) {
   std::promise<HttpResponse> resp_promise;
   auto resp_future = resp_promise.get_future();
   std::thread(
       [curlp](std::promise<HttpResponse> promise) {
-        CURLcode result = curl_easy_perform(curlp.get());
+        static auto& downloaded =
+            Metrics::instance().counter("aktualizr_http_download_bytes_total", "Bytes received by downloads");
+        static auto& latency =
+            Metrics::instance().histogram("aktualizr_http_download_duration_seconds", "Duration of downloads");
+        TraceSpan span("http", "download");
+        CURLcode result;
+        {
+          ScopedLatency timer(latency);
+          result = curl_easy_perform(curlp.get());
+        }
+        curl_off_t bytes = 0;
+        if (curl_easy_getinfo(curlp.get(), CURLINFO_SIZE_DOWNLOAD_T, &bytes) == CURLE_OK && bytes > 0) {
+          downloaded.add(static_cast<uint64_t>(bytes));
+        }
+        annotateUrl(&span, curlp.get());
         long http_code;  // NOLINT(google-runtime-int)
         curl_easy_getinfo(curlp.get(), CURLINFO_RESPONSE_CODE, &http_code);
         HttpResponse response("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
@@ -1,8 +1,10 @@
 #ifndef HTTPCLIENT_H_
 #define HTTPCLIENT_H_
 
+#include <array>
 #include <future>
 #include <memory>
+#include <mutex>
 
 #include <curl/curl.h>
 #include "gtest/gtest_prod.h"
@@ -10,6 +12,8 @@
 
 #include "httpinterface.h"
 
+struct ResponseHeaders;
+
 /**
  * Helper class to manage curl_global_init/curl_global_cleanup calls
  */
@@ -23,6 +27,36 @@ class CurlGlobalInitWrapper {
   CurlGlobalInitWrapper &operator=(CurlGlobalInitWrapper &&) = delete;
 };
 
+/**
+ * Share handle for the connection cache, TLS session cache and DNS cache.
+ *
+ * Every request performed by HttpClient runs on a short-lived copy of the
+ * template handle. Attaching all of them to one share handle lets curl keep
+ * connections alive and resume TLS sessions between requests instead of doing
+ * a full TCP and TLS handshake every time. Curl keys the cache by host, port
+ * and TLS configuration, so it is safe to use for several servers at once.
+ */
+class CurlShareWrapper {
+ public:
+  /** The share handle of the process, used by every HttpClient. */
+  static std::shared_ptr<CurlShareWrapper> instance();
+
+  CurlShareWrapper();
+  ~CurlShareWrapper();
+  CurlShareWrapper(const CurlShareWrapper &) = delete;
+  CurlShareWrapper(CurlShareWrapper &&) = delete;
+  CurlShareWrapper &operator=(const CurlShareWrapper &) = delete;
+  CurlShareWrapper &operator=(CurlShareWrapper &&) = delete;
+  CURLSH *get() const { return share_; }
+
+ private:
+  static void lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+  static void unlock(CURL *handle, curl_lock_data data, void *userptr);
+
+  CURLSH *share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> mutexes_;
+};
+
 class HttpClient : public HttpInterface {
  public:
   explicit HttpClient(const std::vector<std::string> *extra_headers = nullptr);
@@ -33,6 +67,8 @@ class HttpClient : public HttpInterface {
   HttpClient &operator=(const HttpClient &) = delete;
   HttpClient &operator=(HttpClient &&) = default;
   HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, HttpValidators *validators,
+                              const api::FlowControlToken *flow_control) override;
   HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
   HttpResponse post(const std::string &url, const Json::Value &data) override;
   HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
@@ -43,6 +79,9 @@ class HttpClient : public HttpInterface {
   std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                           curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                           CurlHandler *easyp) override;
+  std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                               curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                               curl_off_t to) override;
   void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
                 const std::string &pkey, CryptoSource pkey_source) override;
   bool updateHeader(const std::string &name, const std::string &value);
@@ -52,15 +91,27 @@ class HttpClient : public HttpInterface {
   FRIEND_TEST(GetTest, download_speed_limit);
 
   static const CurlGlobalInitWrapper manageCurlGlobalInit_;
+  // Must outlive every handle that was duplicated from `curl`.
+  std::shared_ptr<CurlShareWrapper> share_;
   CURL *curl;
   curl_slist *headers;
-  HttpResponse perform(CURL *curl_handler, int retry_times, int64_t size_limit);
+  // Retries failures with the backoff of kRetryPolicy, unless the circuit breaker of the endpoint of `url` is open
+  HttpResponse perform(CURL *curl_handler, const std::string &url, int retry_times, int64_t size_limit,
+                       ResponseHeaders *received = nullptr);
+  HttpResponse performGet(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                          HttpValidators *validators);
+  CurlHandler prepareDownload(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                              void *userp);
+  static std::future<HttpResponse> performAsync(const CurlHandler &curlp);
   static curl_slist *curl_slist_dup(curl_slist *sl);
 
+  // Only used with curl versions that cannot take credentials from memory
   std::unique_ptr<TemporaryFile> tls_ca_file;
   std::unique_ptr<TemporaryFile> tls_cert_file;
   std::unique_ptr<TemporaryFile> tls_pkey_file;
   static const int RETRY_TIMES = 2;
+  // A longer Retry-After is left to the caller, which can schedule the next attempt instead of waiting for it
+  static const int64_t kMaxInlineRetryAfterSec = 5;
   static const long kSpeedLimitTimeInterval = 60L;   // NOLINT(google-runtime-int)
   static const long kSpeedLimitBytesPerSec = 5000L;  // NOLINT(google-runtime-int)
 
@@ -24,6 +24,21 @@ TEST(CopyConstructorTest, copied) {
   EXPECT_EQ(resp["path"].asString(), path);
 }
 
+/* Requests on a client and on its copies share one connection cache. */
+TEST(CopyConstructorTest, shared_connections) {
+  HttpClient http;
+  for (int i = 0; i < 3; ++i) {
+    HttpClient http_copy(http);
+    const std::string path = "/path/" + std::to_string(i);
+    EXPECT_EQ(http.get(server + path, HttpInterface::kNoLimit, nullptr).getJson()["path"].asString(), path);
+    EXPECT_EQ(http_copy.get(server + path, HttpInterface::kNoLimit, nullptr).getJson()["path"].asString(), path);
+  }
+  Json::Value data;
+  data["key"] = "val";
+  EXPECT_EQ(http.post(server + "/path/1", data).getJson()["data"]["key"].asString(), "val");
+  EXPECT_EQ(http.put(server + "/path/1", data).getJson()["data"]["key"].asString(), "val");
+}
+
 TEST(GetTest, get_performed) {
   HttpClient http;
   std::string path = "/path/1/2/3";
@@ -31,6 +46,26 @@ TEST(GetTest, get_performed) {
   EXPECT_EQ(response["path"].asString(), path);
 }
 
+/* Conditional GET is answered with 304 when the resource did not change. */
+TEST(GetTest, conditional) {
+  HttpClient http;
+  HttpValidators validators;
+  HttpResponse resp = http.getConditional(server + "/etag", HttpInterface::kNoLimit, &validators, nullptr);
+  EXPECT_EQ(resp.http_status_code, 200);
+  EXPECT_EQ(resp.getJson()["version"].asInt(), 1);
+  EXPECT_EQ(validators.etag, "\"v1\"");
+
+  resp = http.getConditional(server + "/etag", HttpInterface::kNoLimit, &validators, nullptr);
+  EXPECT_TRUE(resp.isNotModified());
+  EXPECT_TRUE(resp.body.empty());
+  EXPECT_EQ(validators.etag, "\"v1\"");
+
+  validators.etag = "\"v0\"";
+  resp = http.getConditional(server + "/etag", HttpInterface::kNoLimit, &validators, nullptr);
+  EXPECT_EQ(resp.http_status_code, 200);
+  EXPECT_EQ(validators.etag, "\"v1\"");
+}
+
 TEST(GetTestWithHeaders, get_performed) {
   std::vector<std::string> headers = {"Authorization: Bearer token"};
   HttpClient http(&headers);
@@ -48,6 +83,17 @@ TEST(GetTest, download_size_limit) {
   EXPECT_EQ(resp.curl_code, CURLE_FILESIZE_EXCEEDED);
 }
 
+/* Compressed responses are decompressed, and the size limit applies to the decompressed body. */
+TEST(GetTest, compressed) {
+  HttpClient http;
+  HttpResponse resp = http.get(server + "/gzip", HttpInterface::kNoLimit, nullptr);
+  ASSERT_TRUE(resp.isOk());
+  EXPECT_EQ(resp.getJson()["data"].asString(), std::string(65536, 'a'));
+
+  resp = http.get(server + "/gzip", 1024, nullptr);
+  EXPECT_FALSE(resp.isOk());
+}
+
 /* Reject http GET responses that do not meet speed limit. */
 TEST(GetTest, download_speed_limit) {
   HttpClient http;
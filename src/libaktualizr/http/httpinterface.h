@@ -27,7 +27,11 @@ struct HttpResponse {
   long http_status_code{0};  // NOLINT(google-runtime-int)
   CURLcode curl_code{CURLE_OK};
   std::string error_message;
+  // How long the server asked to wait before polling again, from Retry-After
+  // or Cache-Control: max-age, in seconds. -1 if it did not say.
+  int64_t retry_after_sec{-1};
   bool isOk() const { return (curl_code == CURLE_OK && http_status_code >= 200 && http_status_code < 400); }
+  bool isNotModified() const { return curl_code == CURLE_OK && http_status_code == 304; }
   bool wasInterrupted() const { return curl_code == CURLE_ABORTED_BY_CALLBACK; };
   std::string getStatusStr() const {
     return std::to_string(curl_code) + " " + error_message + " HTTP " + std::to_string(http_status_code);
@@ -36,12 +40,30 @@ struct HttpResponse {
   Json::Value getJson() const { return Utils::parseJSON(body); }
 };
 
+/** Cache validators of a response, sent back to make a later GET conditional */
+struct HttpValidators {
+  std::string etag;
+  std::string last_modified;
+  bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
 class HttpInterface {
  public:
   HttpInterface() = default;
   virtual ~HttpInterface() = default;
   virtual HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) = 0;
   HttpResponse get(const std::string &url, int64_t maxsize) { return get(url, maxsize, nullptr); }
+  /**
+   * GET a resource unless it still matches `validators`, taken from an earlier
+   * response. A resource that did not change is answered with HTTP 304 and an
+   * empty body. `validators` is replaced by those of the response.
+   * Implementations that cannot send conditional requests do a plain get().
+   */
+  virtual HttpResponse getConditional(const std::string &url, int64_t maxsize, HttpValidators *validators,
+                                      const api::FlowControlToken *flow_control) {
+    *validators = HttpValidators();
+    return get(url, maxsize, flow_control);
+  }
   virtual HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) = 0;
   virtual HttpResponse post(const std::string &url, const Json::Value &data) = 0;
   virtual HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) = 0;
@@ -52,6 +74,24 @@ class HttpInterface {
   virtual std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                                   curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                                   CurlHandler *easyp) = 0;
+  /**
+   * Download bytes [from, to] (inclusive) of a resource. A server that honours
+   * the range answers with HTTP 206. Implementations that cannot issue range
+   * requests fail with CURLE_RANGE_ERROR so callers can fall back to download().
+   */
+  virtual std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                                       curl_xferinfo_callback progress_cb, void *userp,
+                                                       curl_off_t from, curl_off_t to) {
+    (void)url;
+    (void)write_cb;
+    (void)progress_cb;
+    (void)userp;
+    (void)from;
+    (void)to;
+    std::promise<HttpResponse> resp_promise;
+    resp_promise.set_value(HttpResponse("", 0, CURLE_RANGE_ERROR, "Range requests are not supported"));
+    return resp_promise.get_future();
+  }
   virtual void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
                         CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) = 0;
   static constexpr int64_t kNoLimit = 0;  // no limit the size of downloaded data
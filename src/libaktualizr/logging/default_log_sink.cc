@@ -1,6 +1,16 @@
+#include <atomic>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <string>
 
+#include <boost/core/null_deleter.hpp>
+#include <boost/log/core/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/log/sinks/unbounded_fifo_queue.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/utility/setup/console.hpp>
 
@@ -29,6 +39,73 @@ static void color_fmt(boost::log::record_view const& rec, boost::log::formatting
   }
 }
 
+namespace {
+
+/**
+ * Records waiting for the background thread. They are counted rather than
+ * held in a bounded queue, so that enqueueing stays lock-free.
+ */
+struct AsyncQueueState {
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> capacity{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+AsyncQueueState& asyncQueueState() {
+  static AsyncQueueState state;
+  return state;
+}
+
+std::string droppedNote(uint64_t dropped) {
+  return std::to_string(dropped) + " log messages dropped; the log queue was full";
+}
+
+/**
+ * Writes records from the background thread, first noting how many were
+ * dropped because the queue was full.
+ */
+class AsyncConsoleBackend : public boost::log::sinks::text_ostream_backend {
+ public:
+  void consume(boost::log::record_view const& rec, string_type const& message) {
+    AsyncQueueState& state = asyncQueueState();
+    const uint64_t dropped = state.dropped.exchange(0);
+    if (dropped > 0) {
+      boost::log::sinks::text_ostream_backend::consume(rec, droppedNote(dropped));
+    }
+    boost::log::sinks::text_ostream_backend::consume(rec, message);
+    --state.pending;
+  }
+};
+
+using AsyncConsoleSink = boost::log::sinks::asynchronous_sink<AsyncConsoleBackend>;
+
+struct ConsoleSinks {
+  std::mutex mutex;
+  std::ostream* stream{nullptr};
+  bool use_colors{false};
+  boost::shared_ptr<boost::log::sinks::sink> sync_sink;
+  boost::shared_ptr<AsyncConsoleSink> async_sink;
+};
+
+ConsoleSinks& consoleSinks() {
+  static ConsoleSinks sinks;
+  return sinks;
+}
+
+void stopAsyncSink(ConsoleSinks& sinks) {
+  if (sinks.async_sink) {
+    sinks.async_sink->stop();
+    sinks.async_sink->flush();
+    sinks.async_sink.reset();
+    const uint64_t dropped = asyncQueueState().dropped.exchange(0);
+    if (dropped > 0) {
+      *sinks.stream << droppedNote(dropped) << std::endl;
+    }
+  }
+}
+
+}  // namespace
+
 void logger_init_sink(bool use_colors = false) {
   auto* stream = &std::cerr;
   if (getenv("LOG_STDERR") == nullptr) {
@@ -39,4 +116,73 @@ void logger_init_sink(bool use_colors = false) {
   if (use_colors) {
     sink->set_formatter(&color_fmt);
   }
+
+  ConsoleSinks& sinks = consoleSinks();
+  std::lock_guard<std::mutex> guard(sinks.mutex);
+  sinks.stream = stream;
+  sinks.use_colors = use_colors;
+  sinks.sync_sink = sink;
+}
+
+void logger_flush() {
+  ConsoleSinks& sinks = consoleSinks();
+  std::lock_guard<std::mutex> guard(sinks.mutex);
+  if (sinks.async_sink) {
+    sinks.async_sink->flush();
+  }
+}
+
+/**
+ * Switch between writing records from the logging thread and from a
+ * background one, with at most `queue_size` records waiting for it.
+ */
+void logger_set_async_sink(bool async, size_t queue_size) {
+  ConsoleSinks& sinks = consoleSinks();
+  std::lock_guard<std::mutex> guard(sinks.mutex);
+  asyncQueueState().capacity = queue_size;
+  if (sinks.stream == nullptr || async == (sinks.async_sink != nullptr)) {
+    return;
+  }
+  auto core = boost::log::core::get();
+  if (!async) {
+    core->remove_sink(sinks.async_sink);
+    stopAsyncSink(sinks);
+    core->add_sink(sinks.sync_sink);
+    return;
+  }
+
+  auto backend = boost::make_shared<AsyncConsoleBackend>();
+  backend->add_stream(boost::shared_ptr<std::ostream>(sinks.stream, boost::null_deleter()));
+  backend->auto_flush(true);
+  auto sink = boost::make_shared<AsyncConsoleSink>(backend);
+  if (sinks.use_colors) {
+    sink->set_formatter(&color_fmt);
+  } else {
+    sink->set_formatter(boost::log::expressions::stream << boost::log::expressions::smessage);
+  }
+  sink->set_filter([](boost::log::attribute_value_set const&) {
+    AsyncQueueState& state = asyncQueueState();
+    if (state.pending++ >= state.capacity) {
+      --state.pending;
+      ++state.dropped;
+      return false;
+    }
+    return true;
+  });
+  core->add_sink(sink);
+  core->remove_sink(sinks.sync_sink);
+  sinks.async_sink = sink;
+
+  // Write whatever is still queued when the program ends
+  static std::once_flag at_exit;
+  std::call_once(at_exit, [] {
+    std::atexit([] {
+      ConsoleSinks& s = consoleSinks();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      if (s.async_sink) {
+        boost::log::core::get()->remove_sink(s.async_sink);
+        stopAsyncSink(s);
+      }
+    });
+  });
 }
@@ -1,5 +1,7 @@
 #include "logging.h"
 
+#include <chrono>
+
 #include <boost/log/core/core.hpp>
 #include <boost/log/expressions.hpp>
 
@@ -8,8 +10,11 @@
 using boost::log::trivial::severity_level;
 
 static severity_level gLoggingThreshold;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::atomic<int64_t> gRateLimitNs{std::chrono::nanoseconds(std::chrono::seconds(1)).count()};
 
 extern void logger_init_sink(bool use_colors = false);
+extern void logger_set_async_sink(bool async, size_t queue_size);
 
 int64_t get_curlopt_verbose() { return gLoggingThreshold <= boost::log::trivial::trace ? 1L : 0L; }
 
@@ -39,6 +44,31 @@ void logger_set_threshold(const LoggerConfig& lconfig) {
   logger_set_threshold(static_cast<boost::log::trivial::severity_level>(loglevel));
 }
 
+void logger_configure(const LoggerConfig& lconfig) {
+  logger_set_threshold(lconfig);
+  gRateLimitNs = std::chrono::nanoseconds(std::chrono::milliseconds(lconfig.rate_limit_ms)).count();
+  logger_set_async_sink(lconfig.async, static_cast<size_t>(lconfig.async_queue_size));
+}
+
+bool LogRateLimiter::allow(uint64_t* suppressed) {
+  const int64_t interval = gRateLimitNs;
+  const int64_t now = std::chrono::steady_clock::now().time_since_epoch() / std::chrono::nanoseconds(1);
+  int64_t next = next_ns_;
+  if (interval > 0 && (now < next || !next_ns_.compare_exchange_strong(next, now + interval))) {
+    ++suppressed_;
+    return false;
+  }
+  *suppressed = suppressed_.exchange(0);
+  return true;
+}
+
+std::ostream& operator<<(std::ostream& os, const LogSuppressed& suppressed) {
+  if (suppressed.count > 0) {
+    os << "(" << suppressed.count << " similar messages suppressed) ";
+  }
+  return os;
+}
+
 void logger_set_enable(bool enabled) { boost::log::core::get()->set_logging_enabled(enabled); }
 
 int loggerGetSeverity() { return static_cast<int>(gLoggingThreshold); }
@@ -1,11 +1,23 @@
 #ifndef SOTA_CLIENT_TOOLS_LOGGING_H_
 #define SOTA_CLIENT_TOOLS_LOGGING_H_
 
-#include <boost/log/trivial.hpp>
+#include <atomic>
 #include <cstdint>
+#include <ostream>
+
+#include <boost/log/trivial.hpp>
 
 struct LoggerConfig;
 
+/**
+ * Messages below this level are compiled out, so that not even their
+ * arguments are evaluated: 0 keeps everything, 1 drops LOG_TRACE and 2 drops
+ * LOG_DEBUG as well. Set through the LOG_MIN_LEVEL CMake option.
+ */
+#ifndef AKTUALIZR_LOG_MIN_LEVEL
+#define AKTUALIZR_LOG_MIN_LEVEL 0
+#endif
+
 /** Log an unrecoverable error */
 #define LOG_FATAL BOOST_LOG_TRIVIAL(fatal)
 
@@ -19,11 +31,69 @@ struct LoggerConfig;
 /** Report a user-visible message about operation */
 #define LOG_INFO BOOST_LOG_TRIVIAL(info)
 
+#if AKTUALIZR_LOG_MIN_LEVEL >= 2
+#define LOG_DEBUG while (false) BOOST_LOG_TRIVIAL(debug)
+#else
 /** Report a message for developer debugging */
 #define LOG_DEBUG BOOST_LOG_TRIVIAL(debug)
+#endif
 
+#if AKTUALIZR_LOG_MIN_LEVEL >= 1
+#define LOG_TRACE while (false) BOOST_LOG_TRIVIAL(trace)
+#else
 /** Report very-verbose debugging information */
 #define LOG_TRACE BOOST_LOG_TRIVIAL(trace)
+#endif
+
+/**
+ * Lets through at most one message per LoggerConfig::rate_limit_ms. Each
+ * LOG_*_LIMITED call site has its own.
+ */
+class LogRateLimiter {
+ public:
+  /**
+   * Whether a message may be logged now. If so, *suppressed is set to the
+   * number of messages held back since the last one.
+   */
+  bool allow(uint64_t* suppressed);
+
+ private:
+  std::atomic<int64_t> next_ns_{0};
+  std::atomic<uint64_t> suppressed_{0};
+};
+
+/** Prefixes a rate-limited message with how many were held back before it */
+struct LogSuppressed {
+  uint64_t count;
+};
+std::ostream& operator<<(std::ostream& os, const LogSuppressed& suppressed);
+
+// A LogRateLimiter of its own for every place this is expanded in
+#define LOG_CALL_SITE_LIMITER()    \
+  ([]() -> LogRateLimiter& {       \
+    static LogRateLimiter limiter; \
+    return limiter;                \
+  }())
+
+#define LOG_LIMITED(severity)                                                           \
+  if (uint64_t log_suppressed_ = 0; !LOG_CALL_SITE_LIMITER().allow(&log_suppressed_)) { \
+  } else                                                                                \
+    BOOST_LOG_TRIVIAL(severity) << LogSuppressed{log_suppressed_}
+
+/** Rate-limited variants, for messages logged in loops, e.g. once per chunk */
+#define LOG_ERROR_LIMITED LOG_LIMITED(error)
+#define LOG_WARNING_LIMITED LOG_LIMITED(warning)
+#define LOG_INFO_LIMITED LOG_LIMITED(info)
+#if AKTUALIZR_LOG_MIN_LEVEL >= 2
+#define LOG_DEBUG_LIMITED LOG_DEBUG
+#else
+#define LOG_DEBUG_LIMITED LOG_LIMITED(debug)
+#endif
+#if AKTUALIZR_LOG_MIN_LEVEL >= 1
+#define LOG_TRACE_LIMITED LOG_TRACE
+#else
+#define LOG_TRACE_LIMITED LOG_LIMITED(trace)
+#endif
 
 // Use like:
 // curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, get_curlopt_verbose());
@@ -35,6 +105,18 @@ void logger_set_threshold(boost::log::trivial::severity_level threshold);
 
 void logger_set_threshold(const LoggerConfig& lconfig);
 
+/**
+ * Apply all of `lconfig`: the threshold, whether records are written from a
+ * background thread, and the interval of rate-limited messages.
+ */
+void logger_configure(const LoggerConfig& lconfig);
+
+/**
+ * Wait until records queued for the background thread have been written.
+ * Does nothing while logging is synchronous.
+ */
+void logger_flush();
+
 void logger_set_enable(bool enabled);
 
 int loggerGetSeverity();
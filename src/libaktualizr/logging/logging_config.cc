@@ -5,6 +5,24 @@
 
 void LoggerConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(loglevel, "loglevel", pt);
+  CopyFromConfig(async, "async", pt);
+  CopyFromConfig(async_queue_size, "async_queue_size", pt);
+  CopyFromConfig(rate_limit_ms, "rate_limit_ms", pt);
 }
 
-void LoggerConfig::writeToStream(std::ostream& out_stream) const { writeOption(out_stream, loglevel, "loglevel"); }
+void LoggerConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, loglevel, "loglevel");
+  writeOption(out_stream, async, "async");
+  writeOption(out_stream, async_queue_size, "async_queue_size");
+  writeOption(out_stream, rate_limit_ms, "rate_limit_ms");
+}
+
+void TracingConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(file, "file", pt);
+  CopyFromConfig(buffer_size, "buffer_size", pt);
+}
+
+void TracingConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, file, "file");
+  writeOption(out_stream, buffer_size, "buffer_size");
+}
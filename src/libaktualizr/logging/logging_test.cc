@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+
+static size_t countOf(const std::string& haystack, const std::string& needle) {
+  size_t count = 0;
+  for (size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+/* A rate-limited call site lets one message through per interval, and
+ * reports how many it held back. */
+TEST(Logging, RateLimit) {
+  LoggerConfig config;
+  config.rate_limit_ms = 60000;
+  logger_configure(config);
+
+  testing::internal::CaptureStdout();
+  for (int i = 0; i < 10; ++i) {
+    LOG_INFO_LIMITED << "limited message";
+    LOG_INFO << "plain message";
+  }
+  std::string output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(countOf(output, "limited message"), 1);
+  EXPECT_EQ(countOf(output, "plain message"), 10);
+
+  LogRateLimiter limiter;
+  uint64_t suppressed = 0;
+  EXPECT_TRUE(limiter.allow(&suppressed));
+  EXPECT_FALSE(limiter.allow(&suppressed));
+  EXPECT_FALSE(limiter.allow(&suppressed));
+
+  config.rate_limit_ms = 0;
+  logger_configure(config);
+  EXPECT_TRUE(limiter.allow(&suppressed));
+  EXPECT_EQ(suppressed, 2);
+  EXPECT_TRUE(limiter.allow(&suppressed));
+  EXPECT_EQ(suppressed, 0);
+}
+
+/* Records are written from the background thread once flushed, and logging
+ * is synchronous again when that is switched off. */
+TEST(Logging, Async) {
+  LoggerConfig config;
+  config.async = true;
+  config.async_queue_size = 100000;
+  logger_configure(config);
+
+  testing::internal::CaptureStdout();
+  for (int i = 0; i < 1000; ++i) {
+    LOG_INFO << "async message " << i;
+  }
+  logger_flush();
+  std::string output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(countOf(output, "async message "), 1000);
+  EXPECT_NE(output.find("async message 999"), std::string::npos);
+
+  config.async = false;
+  logger_configure(config);
+  testing::internal::CaptureStdout();
+  LOG_INFO << "sync message";
+  output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(countOf(output, "sync message"), 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,159 @@
+#include "metrics.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+void MetricHistogram::observe(std::chrono::microseconds duration) {
+  const int64_t us = std::max<int64_t>(duration.count(), 0);
+  size_t bucket = 0;
+  while (bucket < kBuckets && us > boundUs(bucket)) {
+    ++bucket;
+  }
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(static_cast<uint64_t>(us), std::memory_order_relaxed);
+}
+
+uint64_t MetricHistogram::cumulative(size_t i) const {
+  uint64_t total = 0;
+  for (size_t b = 0; b <= i && b < buckets_.size(); ++b) {
+    total += buckets_[b].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+int64_t MetricHistogram::quantileUs(double q) const {
+  const uint64_t total = cumulative(kBuckets);
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<uint64_t>(q * static_cast<double>(total));
+  for (size_t i = 0; i < kBuckets; ++i) {
+    if (cumulative(i) > rank) {
+      return boundUs(i);
+    }
+  }
+  // Beyond the last bound; the best we know is the last bound
+  return boundUs(kBuckets - 1);
+}
+
+Metrics& Metrics::instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+template <typename T>
+static T& getOrCreate(std::map<std::string, T>& map, const std::string& name, const std::string& help) {
+  auto it = map.find(name);
+  if (it == map.end()) {
+    it = map.emplace(name, T{help, std::make_unique<typename decltype(T::metric)::element_type>()}).first;
+  }
+  return it->second;
+}
+
+MetricCounter& Metrics::counter(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> guard(m_);
+  return *getOrCreate(counters_, name, help).metric;
+}
+
+MetricGauge& Metrics::gauge(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> guard(m_);
+  return *getOrCreate(gauges_, name, help).metric;
+}
+
+MetricHistogram& Metrics::histogram(const std::string& name, const std::string& help) {
+  std::lock_guard<std::mutex> guard(m_);
+  return *getOrCreate(histograms_, name, help).metric;
+}
+
+static std::string seconds(int64_t us) {
+  std::ostringstream out;
+  out << std::setprecision(6) << static_cast<double>(us) / 1e6;
+  return out.str();
+}
+
+std::string Metrics::toPrometheus() const {
+  std::lock_guard<std::mutex> guard(m_);
+  std::ostringstream out;
+  for (const auto& c : counters_) {
+    out << "# HELP " << c.first << " " << c.second.help << "\n";
+    out << "# TYPE " << c.first << " counter\n";
+    out << c.first << " " << c.second.metric->value() << "\n";
+  }
+  for (const auto& g : gauges_) {
+    out << "# HELP " << g.first << " " << g.second.help << "\n";
+    out << "# TYPE " << g.first << " gauge\n";
+    out << g.first << " " << g.second.metric->value() << "\n";
+  }
+  for (const auto& h : histograms_) {
+    const MetricHistogram& hist = *h.second.metric;
+    out << "# HELP " << h.first << " " << h.second.help << "\n";
+    out << "# TYPE " << h.first << " histogram\n";
+    for (size_t i = 0; i < MetricHistogram::kBuckets; ++i) {
+      out << h.first << "_bucket{le=\"" << seconds(MetricHistogram::boundUs(i)) << "\"} " << hist.cumulative(i)
+          << "\n";
+    }
+    out << h.first << "_bucket{le=\"+Inf\"} " << hist.cumulative(MetricHistogram::kBuckets) << "\n";
+    out << h.first << "_sum " << seconds(static_cast<int64_t>(hist.sumUs())) << "\n";
+    out << h.first << "_count " << hist.count() << "\n";
+  }
+  return out.str();
+}
+
+Json::Value Metrics::summary() const {
+  std::lock_guard<std::mutex> guard(m_);
+  Json::Value res(Json::objectValue);
+  for (const auto& c : counters_) {
+    res[c.first] = static_cast<Json::UInt64>(c.second.metric->value());
+  }
+  for (const auto& g : gauges_) {
+    res[g.first] = static_cast<Json::Int64>(g.second.metric->value());
+  }
+  for (const auto& h : histograms_) {
+    const MetricHistogram& hist = *h.second.metric;
+    Json::Value entry;
+    entry["count"] = static_cast<Json::UInt64>(hist.count());
+    entry["sum_us"] = static_cast<Json::UInt64>(hist.sumUs());
+    entry["p50_us"] = static_cast<Json::Int64>(hist.quantileUs(0.5));
+    entry["p95_us"] = static_cast<Json::Int64>(hist.quantileUs(0.95));
+    entry["p99_us"] = static_cast<Json::Int64>(hist.quantileUs(0.99));
+    res[h.first] = entry;
+  }
+  return res;
+}
+
+void Metrics::setOutput(const boost::filesystem::path& file) {
+  std::lock_guard<std::mutex> guard(m_);
+  output_ = file;
+}
+
+void Metrics::flush() const {
+  boost::filesystem::path file;
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    file = output_;
+  }
+  if (file.empty()) {
+    return;
+  }
+  // Write aside and rename, so scrapers never see a partial file
+  const boost::filesystem::path tmp = file.string() + ".tmp";
+  {
+    std::ofstream out(tmp.string(), std::ios::trunc);
+    if (!out) {
+      LOG_WARNING << "Could not write metrics to " << tmp;
+      return;
+    }
+    out << toPrometheus();
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename(tmp, file, ec);
+  if (ec) {
+    LOG_WARNING << "Could not write metrics to " << file << ": " << ec.message();
+  }
+}
@@ -0,0 +1,122 @@
+#ifndef SOTA_CLIENT_TOOLS_METRICS_H_
+#define SOTA_CLIENT_TOOLS_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+class MetricCounter {
+ public:
+  void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class MetricGauge {
+ public:
+  void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+  void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * Latency histogram with exponential buckets: the upper bound of bucket i is
+ * 100 us * 2^i, so the relative error of a quantile is at most a factor of
+ * two from 100 us up to about 100 s.
+ */
+class MetricHistogram {
+ public:
+  static constexpr size_t kBuckets = 21;
+  static constexpr int64_t kFirstBoundUs = 100;
+
+  void observe(std::chrono::microseconds duration);
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  /** Total of all observations, in microseconds. */
+  uint64_t sumUs() const { return sum_us_.load(std::memory_order_relaxed); }
+  /** Observations up to and including bucket i; the last one is +Inf. */
+  uint64_t cumulative(size_t i) const;
+  static int64_t boundUs(size_t i) { return kFirstBoundUs << i; }
+  /** Upper bound of the bucket holding quantile q, in microseconds. */
+  int64_t quantileUs(double q) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets + 1> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_us_{0};
+};
+
+/**
+ * Process-wide registry of counters, gauges and latency histograms.
+ * Metrics are created on first use and live until the process exits, so call
+ * sites can keep a reference:
+ * static auto& requests = Metrics::instance().counter("aktualizr_http_requests_total", "HTTP requests");
+ */
+class Metrics {
+ public:
+  static Metrics& instance();
+
+  MetricCounter& counter(const std::string& name, const std::string& help);
+  MetricGauge& gauge(const std::string& name, const std::string& help);
+  MetricHistogram& histogram(const std::string& name, const std::string& help);
+
+  /** Prometheus text exposition format. Histograms are in seconds. */
+  std::string toPrometheus() const;
+  /** Counter and gauge values, and count, sum and quantiles of histograms. */
+  Json::Value summary() const;
+
+  /** Rewrite `file` with toPrometheus() on every flush(); empty to disable. */
+  void setOutput(const boost::filesystem::path& file);
+  void flush() const;
+
+ private:
+  template <typename T>
+  struct Entry {
+    std::string help;
+    std::unique_ptr<T> metric;
+  };
+
+  mutable std::mutex m_;
+  std::map<std::string, Entry<MetricCounter>> counters_;
+  std::map<std::string, Entry<MetricGauge>> gauges_;
+  std::map<std::string, Entry<MetricHistogram>> histograms_;
+  boost::filesystem::path output_;
+};
+
+/** Observes the lifetime of the scope it lives in into a histogram. */
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(MetricHistogram& histogram)
+      : histogram_(&histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedLatency() {
+    if (histogram_ != nullptr) {
+      histogram_->observe(
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_));
+    }
+  }
+  ScopedLatency(ScopedLatency&& other) noexcept : histogram_(other.histogram_), start_(other.start_) {
+    other.histogram_ = nullptr;
+  }
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(ScopedLatency&&) = delete;
+
+ private:
+  MetricHistogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_METRICS_H_
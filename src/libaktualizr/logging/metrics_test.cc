@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "json/json.h"
+
+#include "logging/metrics.h"
+#include "utilities/utils.h"
+
+/* Observations land in the first bucket whose bound is not exceeded. */
+TEST(Metrics, HistogramBuckets) {
+  MetricHistogram hist;
+  hist.observe(std::chrono::microseconds(50));
+  hist.observe(std::chrono::microseconds(100));
+  hist.observe(std::chrono::microseconds(150));
+  hist.observe(std::chrono::seconds(1000));
+  EXPECT_EQ(hist.count(), 4);
+  EXPECT_EQ(hist.cumulative(0), 2);
+  EXPECT_EQ(hist.cumulative(1), 3);
+  EXPECT_EQ(hist.cumulative(MetricHistogram::kBuckets - 1), 3);
+  EXPECT_EQ(hist.cumulative(MetricHistogram::kBuckets), 4);
+  EXPECT_EQ(hist.quantileUs(0.5), 200);
+  EXPECT_EQ(hist.sumUs(), 1000000300);
+}
+
+/* The same name always refers to the same metric. */
+TEST(Metrics, Registry) {
+  MetricCounter &counter = Metrics::instance().counter("test_registry_total", "Test counter");
+  counter.add(2);
+  Metrics::instance().counter("test_registry_total", "Test counter").add();
+  EXPECT_EQ(counter.value(), 3);
+
+  Metrics::instance().gauge("test_registry_gauge", "Test gauge").set(-5);
+  const Json::Value summary = Metrics::instance().summary();
+  EXPECT_EQ(summary["test_registry_total"].asUInt64(), 3);
+  EXPECT_EQ(summary["test_registry_gauge"].asInt64(), -5);
+}
+
+/* Metrics are written in the Prometheus text format. */
+TEST(Metrics, Prometheus) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path output = temp_dir / "aktualizr.prom";
+  Metrics::instance().counter("test_prom_total", "Test counter").add(7);
+  {
+    ScopedLatency timer(Metrics::instance().histogram("test_prom_seconds", "Test histogram"));
+  }
+
+  Metrics::instance().setOutput(output);
+  Metrics::instance().flush();
+  Metrics::instance().setOutput("");
+  const std::string text = Utils::readFile(output);
+  EXPECT_NE(text.find("# TYPE test_prom_total counter\ntest_prom_total 7\n"), std::string::npos);
+  EXPECT_NE(text.find("# TYPE test_prom_seconds histogram\n"), std::string::npos);
+  EXPECT_NE(text.find("test_prom_seconds_bucket{le=\"+Inf\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_prom_seconds_count 1\n"), std::string::npos);
+  EXPECT_FALSE(boost::filesystem::exists(output.string() + ".tmp"));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
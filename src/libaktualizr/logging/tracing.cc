@@ -0,0 +1,128 @@
+#include "tracing.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+
+static uint32_t currentThread() {
+  // Small sequential numbers read better in trace viewers than hashed ids
+  static std::atomic<uint32_t> next_thread{1};
+  thread_local uint32_t thread = next_thread++;
+  return thread;
+}
+
+Tracer& Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::configure(const TracingConfig& config) {
+  if (config.file.empty()) {
+    return;
+  }
+  enable(static_cast<size_t>(config.buffer_size), config.file);
+}
+
+void Tracer::enable(size_t capacity, const boost::filesystem::path& output) {
+  std::lock_guard<std::mutex> guard(m_);
+  ring_.assign(std::max<size_t>(capacity, 1U), Span{});
+  next_ = 0;
+  wrapped_ = false;
+  dirty_ = false;
+  output_ = output;
+  enabled_ = true;
+  LOG_INFO << "Tracing update cycles into " << output_;
+}
+
+void Tracer::disable() {
+  enabled_ = false;
+  std::lock_guard<std::mutex> guard(m_);
+  ring_.clear();
+  ring_.shrink_to_fit();
+  next_ = 0;
+  wrapped_ = false;
+  dirty_ = false;
+}
+
+void Tracer::record(const char* category, const char* name, Clock::time_point start, Clock::time_point end,
+                    std::string detail) {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  const uint32_t thread = currentThread();
+  std::lock_guard<std::mutex> guard(m_);
+  if (ring_.empty()) {
+    return;
+  }
+  Span& span = ring_[next_];
+  span.category = category;
+  span.name = name;
+  span.start_us = duration_cast<microseconds>(start - epoch_).count();
+  span.duration_us = duration_cast<microseconds>(end - start).count();
+  span.thread = thread;
+  span.detail = std::move(detail);
+  if (++next_ == ring_.size()) {
+    next_ = 0;
+    wrapped_ = true;
+  }
+  dirty_ = true;
+}
+
+Json::Value Tracer::toChromeTrace() const {
+  Json::Value events{Json::arrayValue};
+  std::lock_guard<std::mutex> guard(m_);
+  const size_t count = wrapped_ ? ring_.size() : next_;
+  const size_t first = wrapped_ ? next_ : 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Span& span = ring_[(first + i) % ring_.size()];
+    Json::Value event;
+    event["name"] = span.name;
+    event["cat"] = span.category;
+    event["ph"] = "X";
+    event["ts"] = Json::Int64(span.start_us);
+    event["dur"] = Json::Int64(span.duration_us);
+    event["pid"] = 1;
+    event["tid"] = span.thread;
+    if (!span.detail.empty()) {
+      event["args"]["detail"] = span.detail;
+    }
+    events.append(event);
+  }
+  Json::Value trace;
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  return trace;
+}
+
+void Tracer::flush() {
+  boost::filesystem::path output;
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    if (!dirty_ || output_.empty()) {
+      return;
+    }
+    dirty_ = false;
+    output = output_;
+  }
+  const Json::Value trace = toChromeTrace();
+  // Write aside and rename, so that a reader never sees a partial file
+  const boost::filesystem::path tmp = output.string() + ".tmp";
+  {
+    std::ofstream file(tmp.string(), std::ios::out | std::ios::trunc);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    file << Json::writeString(builder, trace);
+    if (!file) {
+      LOG_WARNING << "Could not write trace to " << tmp;
+      return;
+    }
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename(tmp, output, ec);
+  if (ec) {
+    LOG_WARNING << "Could not write trace to " << output << ": " << ec.message();
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef SOTA_CLIENT_TOOLS_TRACING_H_
+#define SOTA_CLIENT_TOOLS_TRACING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+struct TracingConfig;
+
+/**
+ * Records timed spans of work into a fixed-size ring buffer and exports them
+ * in the Chrome trace event format, which chrome://tracing and Perfetto can
+ * open. Recording is off until enable() is called; while it is off, a span
+ * costs one relaxed atomic load.
+ */
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static Tracer& instance();
+
+  /** Enable recording if `config.file` is set. */
+  void configure(const TracingConfig& config);
+  void enable(size_t capacity, const boost::filesystem::path& output);
+  void disable();
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  /** Category and name must be string literals, only their pointer is kept. */
+  void record(const char* category, const char* name, Clock::time_point start, Clock::time_point end,
+              std::string detail);
+  Json::Value toChromeTrace() const;
+  /** Write the recorded spans to the output file, if any were added since the
+   * last call. */
+  void flush();
+
+ private:
+  struct Span {
+    const char* category;
+    const char* name;
+    int64_t start_us;
+    int64_t duration_us;
+    uint32_t thread;
+    std::string detail;
+  };
+
+  std::atomic<bool> enabled_{false};
+  mutable std::mutex m_;
+  std::vector<Span> ring_;
+  size_t next_{0};
+  bool wrapped_{false};
+  bool dirty_{false};
+  boost::filesystem::path output_;
+  Clock::time_point epoch_{Clock::now()};
+};
+
+/**
+ * Times the scope it lives in and records it with the Tracer.
+ * Use like:
+ * TraceSpan span("http", "request");
+ * span.annotate(url);
+ */
+class TraceSpan {
+ public:
+  TraceSpan(const char* category, const char* name)
+      : category_(category), name_(name), active_(Tracer::instance().enabled()) {
+    if (active_) {
+      start_ = Tracer::Clock::now();
+    }
+  }
+  ~TraceSpan() {
+    if (active_) {
+      Tracer::instance().record(category_, name_, start_, Tracer::Clock::now(), std::move(detail_));
+    }
+  }
+  TraceSpan(TraceSpan&& other) noexcept
+      : category_(other.category_),
+        name_(other.name_),
+        active_(other.active_),
+        start_(other.start_),
+        detail_(std::move(other.detail_)) {
+    other.active_ = false;
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+  TraceSpan& operator=(TraceSpan&&) = delete;
+
+  bool active() const { return active_; }
+  bool annotated() const { return !detail_.empty(); }
+  /** Attach a detail, e.g. the URL of a request. Only copied when recording. */
+  void annotate(const std::string& detail) {
+    if (active_) {
+      detail_ = detail;
+    }
+  }
+
+ private:
+  const char* category_;
+  const char* name_;
+  bool active_;
+  Tracer::Clock::time_point start_;
+  std::string detail_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_TRACING_H_
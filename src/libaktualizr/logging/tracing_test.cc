@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "json/json.h"
+
+#include "logging/tracing.h"
+#include "utilities/utils.h"
+
+/* Nothing is recorded while tracing is disabled. */
+TEST(Tracing, Disabled) {
+  Tracer::instance().disable();
+  {
+    TraceSpan span("test", "disabled");
+    EXPECT_FALSE(span.active());
+    span.annotate("ignored");
+    EXPECT_FALSE(span.annotated());
+  }
+  EXPECT_EQ(Tracer::instance().toChromeTrace()["traceEvents"].size(), 0);
+}
+
+/* Spans are exported as complete events, and only the most recent ones are
+ * kept. */
+TEST(Tracing, RingBuffer) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path output = temp_dir / "trace.json";
+  Tracer::instance().enable(2, output);
+  {
+    TraceSpan outer("test", "outer");
+    outer.annotate("detail");
+    for (int i = 0; i < 2; ++i) {
+      TraceSpan inner("test", "inner");
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  Tracer::instance().flush();
+  Tracer::instance().disable();
+
+  const Json::Value trace = Utils::parseJSONFile(output);
+  const Json::Value& events = trace["traceEvents"];
+  ASSERT_EQ(events.size(), 2);
+  EXPECT_EQ(events[0]["name"], "inner");
+  EXPECT_EQ(events[1]["name"], "outer");
+  EXPECT_EQ(events[1]["ph"], "X");
+  EXPECT_EQ(events[1]["cat"], "test");
+  EXPECT_EQ(events[1]["args"]["detail"], "detail");
+  EXPECT_GE(events[1]["dur"].asInt64(), 2000);
+  EXPECT_LE(events[1]["ts"].asInt64(), events[0]["ts"].asInt64());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
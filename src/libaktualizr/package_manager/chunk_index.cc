@@ -0,0 +1,139 @@
+#include "package_manager/chunk_index.h"
+
+#include <array>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "crypto/crypto.h"
+
+namespace {
+
+// Chunks are never larger, so that a wrong index can not make chunking buffer too much
+constexpr uint64_t kMaxChunkSize = 64U * 1024U * 1024U;
+
+std::array<uint64_t, 256> makeGearTable() {
+  std::array<uint64_t, 256> table{};
+  uint64_t state = 0;
+  for (auto& entry : table) {
+    // splitmix64
+    state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27U)) * 0x94d049bb133111ebULL;
+    entry = z ^ (z >> 31U);
+  }
+  return table;
+}
+
+uint64_t asUInt64(const Json::Value& value, const char* name) {
+  if (!value.isUInt64()) {
+    throw std::runtime_error(std::string("Invalid ") + name + " in chunk index");
+  }
+  return value.asUInt64();
+}
+
+}  // namespace
+
+ChunkIndex ChunkIndex::fromJson(const Json::Value& json) {
+  if (!json.isObject() || !json["chunking"].isObject() || !json["chunks"].isArray()) {
+    throw std::runtime_error("Chunk index has no chunking parameters or chunks");
+  }
+  ChunkIndex index;
+  index.params_.min = asUInt64(json["chunking"]["min"], "min");
+  index.params_.avg = asUInt64(json["chunking"]["avg"], "avg");
+  index.params_.max = asUInt64(json["chunking"]["max"], "max");
+  if (index.params_.min == 0 || index.params_.min > index.params_.avg || index.params_.avg > index.params_.max ||
+      index.params_.max > kMaxChunkSize) {
+    throw std::runtime_error("Invalid chunking parameters in chunk index");
+  }
+
+  uint64_t offset = 0;
+  index.chunks_.reserve(json["chunks"].size());
+  for (const auto& entry : json["chunks"]) {
+    Chunk chunk;
+    chunk.offset = offset;
+    chunk.length = asUInt64(entry["length"], "chunk length");
+    chunk.sha256 = boost::algorithm::to_lower_copy(entry["sha256"].asString());
+    if (chunk.length == 0 || chunk.length > index.params_.max || chunk.sha256.size() != 64) {
+      throw std::runtime_error("Invalid chunk in chunk index");
+    }
+    offset += chunk.length;
+    index.chunks_.push_back(std::move(chunk));
+  }
+  return index;
+}
+
+ChunkIndex ChunkIndex::build(const boost::filesystem::path& path, const ChunkingParams& params) {
+  ChunkIndex index;
+  index.params_ = params;
+  chunkFile(path, params, [&index](const Chunk& chunk) { index.chunks_.push_back(chunk); });
+  return index;
+}
+
+void ChunkIndex::chunkFile(const boost::filesystem::path& path, const ChunkingParams& params,
+                           const std::function<void(const Chunk&)>& cb) {
+  static const std::array<uint64_t, 256> gear = makeGearTable();
+  unsigned int bits = 0;
+  while ((params.avg >> (bits + 1U)) != 0) {
+    ++bits;
+  }
+  // The top bits of the hash depend on the most bytes
+  const uint64_t mask = (bits == 0) ? 0 : ~0ULL << (64U - bits);
+
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open " + path.string());
+  }
+  std::array<char, 64 * 1024> buf{};
+  MultiPartSHA256Hasher hasher;
+  Chunk chunk;
+  uint64_t hash = 0;
+  while (file) {
+    file.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    const auto read = static_cast<size_t>(file.gcount());
+    size_t start = 0;
+    for (size_t i = 0; i < read; ++i) {
+      hash = (hash << 1U) + gear[static_cast<unsigned char>(buf[i])];
+      const uint64_t length = chunk.length + (i + 1 - start);
+      if ((length >= params.min && (hash & mask) == 0) || length >= params.max) {
+        hasher.update(reinterpret_cast<const unsigned char*>(buf.data() + start), i + 1 - start);
+        chunk.length = length;
+        chunk.sha256 = boost::algorithm::to_lower_copy(hasher.getHexDigest());
+        cb(chunk);
+        chunk.offset += chunk.length;
+        chunk.length = 0;
+        hasher.reset();
+        hash = 0;
+        start = i + 1;
+      }
+    }
+    hasher.update(reinterpret_cast<const unsigned char*>(buf.data() + start), read - start);
+    chunk.length += read - start;
+  }
+  if (file.bad()) {
+    throw std::runtime_error("Could not read " + path.string());
+  }
+  if (chunk.length > 0) {
+    chunk.sha256 = boost::algorithm::to_lower_copy(hasher.getHexDigest());
+    cb(chunk);
+  }
+}
+
+Json::Value ChunkIndex::toJson() const {
+  Json::Value json;
+  json["chunking"]["min"] = Json::Value(static_cast<Json::UInt64>(params_.min));
+  json["chunking"]["avg"] = Json::Value(static_cast<Json::UInt64>(params_.avg));
+  json["chunking"]["max"] = Json::Value(static_cast<Json::UInt64>(params_.max));
+  json["chunks"] = Json::Value(Json::arrayValue);
+  for (const auto& chunk : chunks_) {
+    Json::Value entry;
+    entry["length"] = Json::Value(static_cast<Json::UInt64>(chunk.length));
+    entry["sha256"] = chunk.sha256;
+    json["chunks"].append(entry);
+  }
+  return json;
+}
+
+uint64_t ChunkIndex::length() const { return chunks_.empty() ? 0 : chunks_.back().offset + chunks_.back().length; }
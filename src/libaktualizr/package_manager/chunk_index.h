@@ -0,0 +1,68 @@
+#ifndef CHUNK_INDEX_H_
+#define CHUNK_INDEX_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+/**
+ * Bounds of content-defined chunks, in bytes. A chunk ends where the rolling
+ * gear hash of the last 64 bytes has its top log2(`avg`) bits set to zero, but
+ * never before `min` bytes and always at `max` bytes.
+ * As the boundaries only depend on the bytes just before them, an insertion
+ * or removal only changes the chunks around it.
+ */
+struct ChunkingParams {
+  uint64_t min{16U * 1024U};
+  uint64_t avg{64U * 1024U};
+  uint64_t max{256U * 1024U};
+};
+
+struct Chunk {
+  uint64_t offset{0};
+  uint64_t length{0};
+  // Lower case hex SHA-256 of the chunk content
+  std::string sha256;
+};
+
+/**
+ * The chunks of a binary Target, for downloading only the parts that differ
+ * from the files already on the device. The index of a Target is referred to
+ * by its `chunk_index` custom metadata and has the format
+ *
+ *     {"chunking": {"min": 16384, "avg": 65536, "max": 262144},
+ *      "chunks": [{"length": 70312, "sha256": "..."}, ...]}
+ *
+ * where the chunks are listed in file order. The gear hash table is that of
+ * splitmix64 seeded with 0, so that other tools can create the same chunks.
+ */
+class ChunkIndex {
+ public:
+  /** Throws std::runtime_error if `json` is not a valid chunk index. */
+  static ChunkIndex fromJson(const Json::Value& json);
+  /** The index of the file at `path`. Throws if it can not be read. */
+  static ChunkIndex build(const boost::filesystem::path& path, const ChunkingParams& params);
+
+  /**
+   * Split the file at `path` into chunks as given by `params` and call `cb` for
+   * each of them in file order. Throws if the file can not be read.
+   */
+  static void chunkFile(const boost::filesystem::path& path, const ChunkingParams& params,
+                        const std::function<void(const Chunk&)>& cb);
+
+  Json::Value toJson() const;
+  const ChunkingParams& params() const { return params_; }
+  const std::vector<Chunk>& chunks() const { return chunks_; }
+  uint64_t length() const;
+
+ private:
+  ChunkingParams params_;
+  std::vector<Chunk> chunks_;
+};
+
+#endif  // CHUNK_INDEX_H_
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+#include "logging/logging.h"
+#include "package_manager/chunk_index.h"
+#include "utilities/utils.h"
+
+namespace {
+std::string randomData(size_t size, unsigned int seed) {
+  std::mt19937 gen(seed);
+  std::string data(size, '\0');
+  for (auto& c : data) {
+    c = static_cast<char>(gen() & 0xFFU);
+  }
+  return data;
+}
+
+const ChunkingParams params{2 * 1024, 8 * 1024, 32 * 1024};
+}  // namespace
+
+/* Chunks cover the whole file within their bounds and survive a round trip through JSON. */
+TEST(ChunkIndex, Build) {
+  TemporaryFile file;
+  file.PutContents(randomData(1024 * 1024, 1));
+
+  const ChunkIndex index = ChunkIndex::build(file.Path(), params);
+  ASSERT_GT(index.chunks().size(), 16);
+  EXPECT_EQ(index.length(), 1024 * 1024);
+  uint64_t offset = 0;
+  for (size_t i = 0; i < index.chunks().size(); ++i) {
+    const Chunk& chunk = index.chunks()[i];
+    EXPECT_EQ(chunk.offset, offset);
+    EXPECT_LE(chunk.length, params.max);
+    if (i + 1 < index.chunks().size()) {
+      EXPECT_GE(chunk.length, params.min);
+    }
+    EXPECT_EQ(chunk.sha256.size(), 64);
+    offset += chunk.length;
+  }
+
+  const ChunkIndex parsed = ChunkIndex::fromJson(index.toJson());
+  EXPECT_EQ(parsed.toJson(), index.toJson());
+  EXPECT_EQ(parsed.params().avg, params.avg);
+}
+
+/* Inserting data only changes the chunks around it. */
+TEST(ChunkIndex, Insertion) {
+  const std::string data = randomData(1024 * 1024, 2);
+  TemporaryFile old_file;
+  old_file.PutContents(data);
+  TemporaryFile new_file;
+  new_file.PutContents(data.substr(0, 500000) + randomData(100, 3) + data.substr(500000));
+
+  std::set<std::string> old_chunks;
+  for (const auto& chunk : ChunkIndex::build(old_file.Path(), params).chunks()) {
+    old_chunks.insert(chunk.sha256);
+  }
+  uint64_t shared = 0;
+  for (const auto& chunk : ChunkIndex::build(new_file.Path(), params).chunks()) {
+    if (old_chunks.count(chunk.sha256) != 0) {
+      shared += chunk.length;
+    }
+  }
+  EXPECT_GT(shared, data.size() - 4 * params.max);
+}
+
+/* Indexes with impossible chunking parameters or chunks are rejected. */
+TEST(ChunkIndex, Invalid) {
+  EXPECT_THROW(ChunkIndex::fromJson(Json::Value()), std::runtime_error);
+  Json::Value json = Utils::parseJSON(
+      R"({"chunking": {"min": 10, "avg": 20, "max": 30}, "chunks": [{"length": 30, "sha256": "00"}]})");
+  EXPECT_THROW(ChunkIndex::fromJson(json), std::runtime_error);
+  json["chunks"][0]["sha256"] = std::string(64, 'A');
+  EXPECT_EQ(ChunkIndex::fromJson(json).chunks()[0].sha256, std::string(64, 'a'));
+  json["chunks"][0]["length"] = 31;
+  EXPECT_THROW(ChunkIndex::fromJson(json), std::runtime_error);
+  json["chunks"][0]["length"] = 30;
+  json["chunking"]["min"] = 25;
+  EXPECT_THROW(ChunkIndex::fromJson(json), std::runtime_error);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -7,6 +7,7 @@
 #include <string>
 #include <thread>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/process.hpp>
 
 #include "crypto/keymanager.h"
@@ -132,6 +133,77 @@ TEST(Fetcher, PauseBinary) {
   test_pause(target);
 }
 
+/* Download a large binary target as parallel range requests. */
+TEST(Fetcher, DownloadSegmented) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+  config.pacman.download_segments = 4;
+  config.pacman.download_segment_threshold = 1 << 20;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100 * (1 << 20);
+  Uptane::Target target("large_file", target_json);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  config.pacman.download_segments = 1;
+}
+
+static uint64_t readAll(std::istream& in) {
+  std::vector<char> buf(256 * 1024);
+  uint64_t total = 0;
+  while (in.read(buf.data(), static_cast<std::streamsize>(buf.size())) || in.gcount() > 0) {
+    total += static_cast<uint64_t>(in.gcount());
+  }
+  return total;
+}
+
+/* Stream a large binary target through a small buffer without storing it.
+ * Withhold the last chunk of a stream that fails the hash check. */
+TEST(Fetcher, StreamTarget) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100 * (1 << 20);
+  Uptane::Target target("large_file", target_json);
+
+  auto stream = pacman->streamTarget(target, server, 0, 1 << 20);
+  EXPECT_EQ(readAll(*stream), target.length());
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kNotFound);
+
+  stream = pacman->streamTarget(target, server, 1000, 1 << 20);
+  EXPECT_EQ(readAll(*stream), target.length() - 1000);
+
+  target_json["hashes"]["sha256"] = "0000000000000000000000000000000000000000000000000000000000000000";
+  Uptane::Target bad_target("large_file", target_json);
+  stream = pacman->streamTarget(bad_target, server, 0, 1 << 20);
+  EXPECT_LT(readAll(*stream), bad_target.length());
+
+  // Abandoning a stream cancels its download
+  stream = pacman->streamTarget(target, server, 0, 1 << 20);
+  std::vector<char> buf(1024);
+  stream->read(buf.data(), static_cast<std::streamsize>(buf.size()));
+  EXPECT_EQ(stream->gcount(), 1024);
+  stream.reset();
+}
+
 class HttpCustomUri : public HttpFake {
  public:
   HttpCustomUri(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
@@ -282,6 +354,201 @@ TEST(Fetcher, DownloadLengthZero) {
   EXPECT_EQ(http->counter, 1);
 }
 
+class HttpCounting : public HttpFake {
+ public:
+  HttpCounting(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)progress_cb;
+    (void)from;
+
+    const std::string content = boost::algorithm::ends_with(url, "other_file") ? "1" : "0";
+    write_cb(const_cast<char*>(&content[0]), 1, 1, userp);
+    counter++;
+    return HttpResponse(content, 200, CURLE_OK, "");
+  }
+
+  int counter = 0;
+};
+
+/* Targets with the same content are stored once, and the least recently used
+ * Targets are removed when the store exceeds its size limit. */
+TEST(Fetcher, StoreDedupAndLimit) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.images_max_bytes = 1;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpCounting>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  Uptane::Target copy("fake_file_copy", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(copy, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 1);
+  EXPECT_EQ(pacman->verifyTarget(copy), TargetStatus::kGood);
+
+  // Removing one of the names keeps the file of the other
+  pacman->removeTargetFile(copy);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+
+  Json::Value other_json;
+  other_json["hashes"]["sha256"] = "6b86b273ff34fce19d6b804eff5a3f5747ada4eaa22f1d49c01e52ddb7875b4b";
+  other_json["length"] = 1;
+  Uptane::Target other("other_file", other_json);
+  EXPECT_TRUE(pacman->fetchTarget(other, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 2);
+  EXPECT_EQ(pacman->verifyTarget(other), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kNotFound);
+  config.pacman.images_max_bytes = 0;
+}
+
+/* With images_prune_after_install, downloads don't remove stored Targets, and
+ * pruning keeps the retained Targets. */
+TEST(Fetcher, PruneStoredTargetsRetain) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.images_max_bytes = 1;
+  config.pacman.images_prune_after_install = true;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpCounting>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  Json::Value other_json;
+  other_json["hashes"]["sha256"] = "6b86b273ff34fce19d6b804eff5a3f5747ada4eaa22f1d49c01e52ddb7875b4b";
+  other_json["length"] = 1;
+  Uptane::Target other("other_file", other_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(other, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(other), TargetStatus::kGood);
+
+  // The retained Target is kept even though the store is over its limit
+  pacman->pruneStoredTargets({target});
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(other), TargetStatus::kNotFound);
+  config.pacman.images_max_bytes = 0;
+  config.pacman.images_prune_after_install = false;
+}
+
+/* A download that makes room for itself keeps the other Targets of the
+ * update being downloaded. */
+TEST(Fetcher, StoreLimitRetainsUpdate) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.images_max_bytes = 1;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpCounting>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  Json::Value other_json;
+  other_json["hashes"]["sha256"] = "6b86b273ff34fce19d6b804eff5a3f5747ada4eaa22f1d49c01e52ddb7875b4b";
+  other_json["length"] = 1;
+  Uptane::Target other("other_file", other_json);
+  pacman->retainTargets({target, other});
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(other, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(other), TargetStatus::kGood);
+  pacman->retainTargets({});
+  config.pacman.images_max_bytes = 0;
+}
+
+class HttpBadMirror : public HttpFake {
+ public:
+  HttpBadMirror(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)progress_cb;
+    (void)from;
+
+    urls.push_back(url);
+    const std::string content = boost::algorithm::starts_with(url, "http://mirror") ? "1" : "0";
+    write_cb(const_cast<char*>(&content[0]), 1, 1, userp);
+    return HttpResponse(content, 200, CURLE_OK, "");
+  }
+
+  std::vector<std::string> urls;
+};
+
+/* A Target that doesn't match its hash when downloaded from the Image repo
+ * mirror is downloaded again from the Image repo. */
+TEST(Fetcher, MirrorHashMismatchFallback) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+  config.uptane.repo_mirror_url = "http://mirror";
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpBadMirror>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  ASSERT_EQ(http->urls.size(), 2U);
+  EXPECT_EQ(http->urls[0], "http://mirror/targets/fake_file");
+  EXPECT_EQ(http->urls[1], server + "/targets/fake_file");
+  config.uptane.repo_mirror_url = "";
+}
+
+/* Fall back to a single stream if range requests are not supported. */
+TEST(Fetcher, DownloadSegmentedFallback) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+  config.pacman.download_segments = 4;
+  config.pacman.download_segment_threshold = 1;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpZeroLength>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_EQ(http->counter, 1);
+  config.pacman.download_segments = 1;
+}
+
 /* Don't bother downloading a target that is larger than the available disk
  * space. */
 TEST(Fetcher, NotEnoughDiskSpace) {
@@ -1,8 +1,16 @@
 #include "ostreemanager.h"
 
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <gio/gio.h>
 #include <json/json.h>
@@ -19,6 +27,7 @@
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/fetcher.h"
+#include "utilities/resource_policy.h"
 #include "utilities/utils.h"
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
@@ -69,23 +78,20 @@ static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data)
   }
 }
 
+static boost::filesystem::path unverifiedMarker(OstreeRepo *repo);
+static bool finishFastImport(OstreeRepo *repo, const std::string &commit);
+
 data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysroot_path,
                                              const std::string &ostree_server, const KeyManager &keys,
                                              const Uptane::Target &target, const api::FlowControlToken *token,
                                              OstreeProgressCb progress_cb, const char *alt_remote,
-                                             boost::optional<std::unordered_map<std::string, std::string>> headers) {
+                                             boost::optional<std::unordered_map<std::string, std::string>> headers,
+                                             const PackageConfig *pconfig) {
   if (!target.IsOstree()) {
     throw std::logic_error("Invalid type of Target, got " + target.type() + ", expected OSTREE");
   }
 
-  const std::string refhash = target.sha256Hash();
-  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
-  const char *const commit_ids[] = {refhash.c_str()};
   GError *error = nullptr;
-  GVariantBuilder builder;
-  GVariant *options;
-  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
-
   GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(sysroot_path);
   GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
   if (error != nullptr) {
@@ -93,9 +99,31 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
     g_error_free(error);
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "Could not get OSTree repo");
   }
+  // An interrupted offline import must not count as pulled before it is verified.
+  if (!finishFastImport(repo.get(), target.sha256Hash()) && boost::filesystem::exists(unverifiedMarker(repo.get()))) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "Could not verify an earlier import of an OSTree commit");
+  }
+  return pull(repo.get(), ostree_server, keys, target, token, std::move(progress_cb), alt_remote, std::move(headers),
+              pconfig);
+}
+
+data::InstallationResult OstreeManager::pull(OstreeRepo *repo, const std::string &ostree_server,
+                                             const KeyManager &keys, const Uptane::Target &target,
+                                             const api::FlowControlToken *token, OstreeProgressCb progress_cb,
+                                             const char *alt_remote,
+                                             boost::optional<std::unordered_map<std::string, std::string>> headers,
+                                             const PackageConfig *pconfig) {
+  const std::string refhash = target.sha256Hash();
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
+  const char *const commit_ids[] = {refhash.c_str()};
+  GError *error = nullptr;
+  GVariantBuilder builder;
+  GVariant *options;
+  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
 
   GHashTable *ref_list = nullptr;
-  if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
+  if (ostree_repo_list_commit_objects_starting_with(repo, refhash.c_str(), &ref_list, nullptr, &error) != 0) {
     guint length = g_hash_table_size(ref_list);
     g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
     // should never be greater than 1, but use >= for robustness
@@ -119,38 +147,69 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
       ostree_remote_uri = uri_override;
     }
     // addRemote overwrites any previous ostree remote that was set
-    if (!OstreeManager::addRemote(repo.get(), ostree_remote_uri, &keys)) {
+    if (!OstreeManager::addRemote(repo, ostree_remote_uri, &keys)) {
       return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
                                       std::string("Error adding a default OSTree remote: ") + remote);
     }
   }
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
-  g_variant_builder_add(&builder, "{s@v}", "flags", g_variant_new_variant(g_variant_new_int32(0)));
+  const PackageConfig default_config;
+  const PackageConfig &pull_config = pconfig != nullptr ? *pconfig : default_config;
+  const std::string &static_deltas = pull_config.ostree_static_deltas;
+  if (static_deltas != "prefer" && static_deltas != "auto" && static_deltas != "disable") {
+    LOG_WARNING << "Unknown ostree_static_deltas value \"" << static_deltas << "\", using \"auto\"";
+  }
+  // With "prefer" a pull that requires a static delta is tried first. OSTree looks up a delta from any
+  // commit present locally to the Target commit in the summary, and fails early when there is none.
+  bool require_delta = static_deltas == "prefer";
+  const auto network_retries = static_cast<guint32>(std::min<uint64_t>(pull_config.ostree_network_retries, UINT32_MAX));
 
-  g_variant_builder_add(&builder, "{s@v}", "refs", g_variant_new_variant(g_variant_new_strv(commit_ids, 1)));
+  PullMetaStruct mt(target, token, g_cancellable_new(), std::move(progress_cb));
+  for (;;) {
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(&builder, "{s@v}", "flags", g_variant_new_variant(g_variant_new_int32(0)));
+
+    g_variant_builder_add(&builder, "{s@v}", "refs", g_variant_new_variant(g_variant_new_strv(commit_ids, 1)));
+    g_variant_builder_add(&builder, "{s@v}", "n-network-retries",
+                          g_variant_new_variant(g_variant_new_uint32(network_retries)));
+    if (require_delta) {
+      g_variant_builder_add(&builder, "{s@v}", "require-static-deltas",
+                            g_variant_new_variant(g_variant_new_boolean(TRUE)));
+    } else if (static_deltas == "disable") {
+      g_variant_builder_add(&builder, "{s@v}", "disable-static-deltas",
+                            g_variant_new_variant(g_variant_new_boolean(TRUE)));
+    }
 
-  if (!!headers && !(*headers).empty()) {
-    GVariantBuilder hdr_builder;
-    g_variant_builder_init(&hdr_builder, G_VARIANT_TYPE("a(ss)"));
+    if (!!headers && !(*headers).empty()) {
+      GVariantBuilder hdr_builder;
+      g_variant_builder_init(&hdr_builder, G_VARIANT_TYPE("a(ss)"));
 
-    for (const auto &kv : *headers) {
-      g_variant_builder_add(&hdr_builder, "(ss)", kv.first.c_str(), kv.second.c_str());
+      for (const auto &kv : *headers) {
+        g_variant_builder_add(&hdr_builder, "(ss)", kv.first.c_str(), kv.second.c_str());
+      }
+      g_variant_builder_add(&builder, "{s@v}", "http-headers",
+                            g_variant_new_variant(g_variant_builder_end(&hdr_builder)));
     }
-    g_variant_builder_add(&builder, "{s@v}", "http-headers",
-                          g_variant_new_variant(g_variant_builder_end(&hdr_builder)));
-  }
 
-  options = g_variant_builder_end(&builder);
+    options = g_variant_builder_end(&builder);
 
-  PullMetaStruct mt(target, token, g_cancellable_new(), std::move(progress_cb));
-  progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
-  if (ostree_repo_pull_with_options(repo.get(), alt_remote == nullptr ? remote : alt_remote, options, progress.get(),
-                                    mt.cancellable.get(), &error) == 0) {
+    progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
+    if (ostree_repo_pull_with_options(repo, alt_remote == nullptr ? remote : alt_remote, options,
+                                      progress.get(), mt.cancellable.get(), &error) != 0) {
+      break;
+    }
+    g_variant_unref(options);
+    if (require_delta && !g_cancellable_is_cancelled(mt.cancellable.get())) {
+      LOG_INFO << "No usable static delta for " << refhash << " (" << error->message
+               << "), pulling individual objects";
+      g_error_free(error);
+      error = nullptr;
+      require_delta = false;
+      continue;
+    }
     LOG_ERROR << "Error while pulling image: " << error->code << " " << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
-    g_variant_unref(options);
     return install_res;
   }
   ostree_async_progress_finish(progress.get());
@@ -158,20 +217,235 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "Pulling OSTree image was successful");
 }
 
+GObjectUniquePtr<OstreeRepo> OstreeManager::OpenMirrorRepo(const boost::filesystem::path &path, GError **error) {
+  GFile *fl = g_file_new_for_path(path.c_str());
+  GObjectUniquePtr<OstreeRepo> repo(ostree_repo_new(fl));
+  g_object_unref(fl);
+  // Secondaries pull from the mirror over HTTP, which requires an archive mode repository
+  if (!boost::filesystem::exists(path / "config")) {
+    boost::filesystem::create_directories(path);
+    if (ostree_repo_create(repo.get(), OSTREE_REPO_MODE_ARCHIVE, nullptr, error) == 0) {
+      return nullptr;
+    }
+  } else if (ostree_repo_open(repo.get(), nullptr, error) == 0) {
+    return nullptr;
+  }
+  return repo;
+}
+
+bool OstreeManager::mirrorTarget(const Uptane::Target &target, const KeyManager &keys,
+                                 const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) {
+  if (!target.IsOstree() || config.ostree_mirror_path.empty()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(mirror_mutex_);
+  GError *error = nullptr;
+  GObjectUniquePtr<OstreeRepo> mirror = OpenMirrorRepo(config.ostree_mirror_path, &error);
+  if (mirror == nullptr) {
+    LOG_ERROR << "Could not open the OSTree mirror at " << config.ostree_mirror_path << ": " << error->message;
+    g_error_free(error);
+    return false;
+  }
+
+  // If the Primary already has the commit, for example because it runs the same image, copy it locally.
+  // Otherwise it is downloaded once here and every Secondary pulls it from the mirror.
+  std::string source = config.ostree_server;
+  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
+  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  if (repo != nullptr) {
+    g_autoptr(GVariant) commit = nullptr;
+    if (ostree_repo_load_variant_if_exists(repo.get(), OSTREE_OBJECT_TYPE_COMMIT, target.sha256Hash().c_str(),
+                                           &commit, &error) != 0 &&
+        commit != nullptr) {
+      GFile *repo_file = ostree_repo_get_path(repo.get());
+      g_autofree char *repo_path = g_file_get_path(repo_file);
+      source = std::string("file://") + repo_path;
+    }
+  }
+  if (error != nullptr) {
+    g_error_free(error);
+    error = nullptr;
+  }
+
+  LOG_INFO << "Mirroring OSTree commit " << target.sha256Hash() << " from " << source;
+  data::InstallationResult result =
+      pull(mirror.get(), source, keys, target, token, progress_cb, nullptr, boost::none, &config);
+  if (!result.success) {
+    LOG_ERROR << "Could not mirror OSTree commit " << target.sha256Hash() << ": " << result.description;
+    return false;
+  }
+
+  // Keep only the latest commit of each hardware ID
+  for (const auto &hwid : target.hardwareIds()) {
+    const std::string ref = "aktualizr-mirror/" + hwid.ToString();
+    if (ostree_repo_set_ref_immediate(mirror.get(), nullptr, ref.c_str(), target.sha256Hash().c_str(), nullptr,
+                                      &error) == 0) {
+      LOG_WARNING << "Could not set OSTree mirror ref " << ref << ": " << error->message;
+      g_error_free(error);
+      error = nullptr;
+    }
+  }
+  gint objects_total = 0;
+  gint objects_pruned = 0;
+  guint64 pruned_bytes = 0;
+  if (ostree_repo_prune(mirror.get(), OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY, 0, &objects_total, &objects_pruned,
+                        &pruned_bytes, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not prune the OSTree mirror: " << error->message;
+    g_error_free(error);
+  } else if (objects_pruned > 0) {
+    LOG_INFO << "Pruned " << objects_pruned << " objects (" << pruned_bytes << " bytes) from the OSTree mirror";
+  }
+  return true;
+}
+
+// Marker of an OSTree commit being imported from an offline update without
+// checksumming its objects on the way in, holding the commit hash. Until
+// finishFastImport() has verified them, the commit isn't trusted, even if
+// aktualizr was interrupted in between.
+static boost::filesystem::path unverifiedMarker(OstreeRepo *repo) {
+  GFile *repo_file = ostree_repo_get_path(repo);
+  g_autofree char *repo_path = g_file_get_path(repo_file);
+  return boost::filesystem::path(repo_path) / "state" / "aktualizr-unverified-import";
+}
+
+enum class ObjectsCheck { kGood, kRepaired, kFailed };
+
+/**
+ * Checksum every object of `commit` in `repo`, spread over all cores. The
+ * commit object's checksum is its name, the hash signed in the Uptane
+ * metadata, and it holds the checksums of the objects below it, so this
+ * verifies the whole tree. If the commit can't be walked, e.g. because its
+ * import was interrupted, all objects of the repository are checked instead.
+ *
+ * Corrupt objects are deleted, and the commit with them (kRepaired), so that
+ * they are imported again. kFailed means that the objects couldn't be listed.
+ */
+static ObjectsCheck fsckObjects(OstreeRepo *repo, const std::string &commit) {
+  GError *error = nullptr;
+  GHashTable *listed = nullptr;
+  bool whole_repo = false;
+  if (ostree_repo_traverse_commit(repo, commit.c_str(), 0, &listed, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not walk OSTree commit " << commit << " (" << error->message
+                << "), verifying all objects of the repository";
+    g_clear_error(&error);
+    whole_repo = true;
+    if (ostree_repo_list_objects(repo, OSTREE_REPO_LIST_OBJECTS_ALL, &listed, nullptr, &error) == 0) {
+      LOG_ERROR << "Could not list the OSTree objects: " << error->message;
+      g_error_free(error);
+      return ObjectsCheck::kFailed;
+    }
+  }
+  std::vector<std::pair<OstreeObjectType, std::string>> objects;
+  GHashTableIter iter;
+  gpointer key = nullptr;
+  g_hash_table_iter_init(&iter, listed);
+  while (g_hash_table_iter_next(&iter, &key, nullptr) != 0) {
+    const char *checksum = nullptr;
+    OstreeObjectType type;
+    ostree_object_name_deserialize(static_cast<GVariant *>(key), &checksum, &type);
+    objects.emplace_back(type, checksum);
+  }
+  g_hash_table_unref(listed);
+
+  // This thread uses `repo`, the others their own handle on it.
+  const size_t workers =
+      std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), objects.size()));
+  std::vector<GObjectUniquePtr<OstreeRepo>> handles;
+  GFile *repo_file = ostree_repo_get_path(repo);
+  for (size_t i = 1; i < workers; ++i) {
+    GObjectUniquePtr<OstreeRepo> handle(ostree_repo_new(repo_file));
+    if (ostree_repo_open(handle.get(), nullptr, &error) == 0) {
+      LOG_DEBUG << "Verifying with fewer threads: " << error->message;
+      g_clear_error(&error);
+      break;
+    }
+    handles.push_back(std::move(handle));
+  }
+
+  std::atomic<size_t> next{0};
+  std::mutex corrupt_mutex;
+  std::vector<std::pair<OstreeObjectType, std::string>> corrupt;
+  auto verify = [&objects, &next, &corrupt_mutex, &corrupt](OstreeRepo *handle) {
+    GError *fsck_error = nullptr;
+    for (size_t i = next++; i < objects.size(); i = next++) {
+      const auto &object = objects[i];
+      if (ostree_repo_fsck_object(handle, object.first, object.second.c_str(), nullptr, &fsck_error) == 0) {
+        LOG_ERROR << "Corrupt OSTree object " << object.second << "." << ostree_object_type_to_string(object.first)
+                  << ": " << fsck_error->message;
+        g_clear_error(&fsck_error);
+        std::lock_guard<std::mutex> guard(corrupt_mutex);
+        corrupt.push_back(object);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (const auto &handle : handles) {
+    threads.emplace_back(verify, handle.get());
+  }
+  verify(repo);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (corrupt.empty() && !whole_repo) {
+    return ObjectsCheck::kGood;
+  }
+  for (const auto &object : corrupt) {
+    ostree_repo_delete_object(repo, object.first, object.second.c_str(), nullptr, nullptr);
+  }
+  ostree_repo_delete_object(repo, OSTREE_OBJECT_TYPE_COMMIT, commit.c_str(), nullptr, nullptr);
+  return ObjectsCheck::kRepaired;
+}
+
+/**
+ * Verify the objects of an import that skipped checksumming them, if there
+ * was one. Returns whether `commit` can be trusted; it is deleted if it was the
+ * import and turned out corrupt.
+ */
+static bool finishFastImport(OstreeRepo *repo, const std::string &commit) {
+  const boost::filesystem::path marker = unverifiedMarker(repo);
+  if (!boost::filesystem::exists(marker)) {
+    return true;
+  }
+  const std::string imported = Utils::readFile(marker);
+  LOG_INFO << "Verifying the objects of OSTree commit " << imported;
+  const ObjectsCheck check = fsckObjects(repo, imported);
+  if (check == ObjectsCheck::kFailed) {
+    return false;
+  }
+  // Anything left in the repository has been verified now.
+  boost::system::error_code ec;
+  boost::filesystem::remove(marker, ec);
+  return check == ObjectsCheck::kGood || imported != commit;
+}
+
+// Whether `commit` is the one of an import that hasn't been verified yet.
+static bool importUnverified(OstreeRepo *repo, const std::string &commit) {
+  const boost::filesystem::path marker = unverifiedMarker(repo);
+  return boost::filesystem::exists(marker) && Utils::readFile(marker) == commit;
+}
+
 #ifdef BUILD_OFFLINE_UPDATES
 /**
  * Simplified version of `OstreeManager::pull()` for performing local pulls.
+ *
+ * With `fast_import`, the objects are imported without checksumming each of
+ * them on the way in, which lets libostree copy them with reflinks or
+ * copy_file_range() where the filesystems allow, and are verified afterwards
+ * on all cores, see finishFastImport(). If that fails, the commit is imported again
+ * the slow way.
  */
 data::InstallationResult OstreeManager::pullLocal(const boost::filesystem::path &sysroot_path,
                                                   const boost::filesystem::path &srcrepo_path,
-                                                  const Uptane::Target &target, OstreeProgressCb progress_cb) {
+                                                  const Uptane::Target &target, OstreeProgressCb progress_cb,
+                                                  bool fast_import) {
   if (!target.IsOstree()) {
     throw std::logic_error("Invalid type of Target, got " + target.type() + ", expected OSTREE");
   }
 
   // The "OSTree server" in this case will be a local directory.
   const std::string ostree_server = "file://" + boost::filesystem::absolute(srcrepo_path).string();
-  const uint32_t pullflags = OSTREE_REPO_PULL_FLAGS_UNTRUSTED;
   const std::string refhash = target.sha256Hash();
   // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
   const char *const commit_ids[] = {refhash.c_str()};
@@ -184,12 +458,16 @@ data::InstallationResult OstreeManager::pullLocal(const boost::filesystem::path
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "Could not get OSTree repo");
   }
 
+  // Objects of an interrupted import must not be taken as they are, neither
+  // by this one nor as an already pulled commit.
+  const bool trusted = finishFastImport(repo.get(), refhash);
+
   GHashTable *ref_list = nullptr;
   if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
     guint length = g_hash_table_size(ref_list);
     g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
     // should never be greater than 1, but use >= for robustness
-    if (length >= 1) {
+    if (length >= 1 && trusted) {
       LOG_DEBUG << "refhash already pulled";
       return data::InstallationResult(true, data::ResultCode::Numeric::kAlreadyProcessed, "Refhash was already pulled");
     }
@@ -199,6 +477,20 @@ data::InstallationResult OstreeManager::pullLocal(const boost::filesystem::path
     error = nullptr;
   }
 
+  const boost::filesystem::path unverified = unverifiedMarker(repo.get());
+  uint32_t pullflags = OSTREE_REPO_PULL_FLAGS_UNTRUSTED;
+  if (boost::filesystem::exists(unverified)) {
+    LOG_ERROR << "Could not verify an earlier import of an OSTree commit";
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "Could not verify an earlier import of an OSTree commit");
+  }
+  if (fast_import) {
+    // Before any object arrives, so that an interrupted import is verified too
+    boost::filesystem::create_directories(unverified.parent_path());
+    Utils::writeFile(unverified, refhash);
+    pullflags = OSTREE_REPO_PULL_FLAGS_NONE;
+  }
+
   if (!OstreeManager::addRemote(repo.get(), ostree_server)) {
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "Error adding OSTree remote");
   }
@@ -227,13 +519,24 @@ data::InstallationResult OstreeManager::pullLocal(const boost::filesystem::path
   }
   ostree_async_progress_finish(progress.get());
   g_variant_unref(options);
+
+  if (fast_import && !finishFastImport(repo.get(), refhash)) {
+    if (boost::filesystem::exists(unverified)) {
+      return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                      "Could not verify the imported OSTree commit");
+    }
+    LOG_WARNING << "The imported OSTree commit failed verification, importing it again object by object";
+    return pullLocal(sysroot_path, srcrepo_path, target, mt.progress_cb, false);
+  }
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "Pulling local OSTree image was successful");
 }
 #endif  // defined(BUILD_OFFLINE_UPDATES)
 
-data::InstallationResult OstreeManager::install(const Uptane::Target &target) const {
+data::InstallationResult OstreeManager::deployTree(OstreeSysroot *sysroot, const Uptane::Target &target,
+                                                   GCancellable *cancellable,
+                                                   GObjectUniquePtr<OstreeDeployment> *new_deployment,
+                                                   GObjectUniquePtr<OstreeDeployment> *merge_deployment) const {
   const char *opt_osname = nullptr;
-  GCancellable *cancellable = nullptr;
   GError *error = nullptr;
   g_autofree char *revision = nullptr;
 
@@ -241,8 +544,7 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
     opt_osname = config.os.c_str();
   }
 
-  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot, &error);
 
   if (error != nullptr) {
     LOG_ERROR << "could not get repo";
@@ -250,8 +552,8 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "could not get repo");
   }
 
-  auto origin = StructGuard<GKeyFile>(
-      ostree_sysroot_origin_new_from_refspec(sysroot.get(), target.sha256Hash().c_str()), g_key_file_free);
+  auto origin = StructGuard<GKeyFile>(ostree_sysroot_origin_new_from_refspec(sysroot, target.sha256Hash().c_str()),
+                                      g_key_file_free);
   if (ostree_repo_resolve_rev(repo.get(), target.sha256Hash().c_str(), FALSE, &revision, &error) == 0) {
     LOG_ERROR << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
@@ -259,21 +561,14 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
     return install_res;
   }
 
-  GObjectUniquePtr<OstreeDeployment> merge_deployment(ostree_sysroot_get_merge_deployment(sysroot.get(), opt_osname));
-  if (merge_deployment == nullptr) {
+  merge_deployment->reset(ostree_sysroot_get_merge_deployment(sysroot, opt_osname));
+  if (*merge_deployment == nullptr) {
     LOG_ERROR << "No merge deployment";
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "No merge deployment");
   }
 
-  if (ostree_sysroot_prepare_cleanup(sysroot.get(), cancellable, &error) == 0) {
-    LOG_ERROR << error->message;
-    data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
-    g_error_free(error);
-    return install_res;
-  }
-
   std::string args_content =
-      std::string(ostree_bootconfig_parser_get(ostree_deployment_get_bootconfig(merge_deployment.get()), "options"));
+      std::string(ostree_bootconfig_parser_get(ostree_deployment_get_bootconfig(merge_deployment->get()), "options"));
 
 #ifdef TORIZON
   {
@@ -313,14 +608,132 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
   auto *kargs_strv = const_cast<char **>(&kargs_strv_vector[0]);
 
   OstreeDeployment *new_deployment_raw = nullptr;
-  if (ostree_sysroot_deploy_tree(sysroot.get(), opt_osname, revision, origin.get(), merge_deployment.get(), kargs_strv,
+  if (ostree_sysroot_deploy_tree(sysroot, opt_osname, revision, origin.get(), merge_deployment->get(), kargs_strv,
                                  &new_deployment_raw, cancellable, &error) == 0) {
     LOG_ERROR << "ostree_sysroot_deploy_tree: " << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     return install_res;
   }
-  GObjectUniquePtr<OstreeDeployment> new_deployment = GObjectUniquePtr<OstreeDeployment>(new_deployment_raw);
+  new_deployment->reset(new_deployment_raw);
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+// Whether anything below path was created, changed or removed at or after the given time.
+static bool treeModifiedSince(const boost::filesystem::path &path, std::time_t since) {
+  auto modified = [since](const boost::filesystem::path &p) {
+    struct stat st {};
+    return lstat(p.c_str(), &st) != 0 || st.st_mtime >= since || st.st_ctime >= since;
+  };
+  if (modified(path)) {
+    return true;
+  }
+  boost::system::error_code ec;
+  boost::filesystem::recursive_directory_iterator it(path, ec);
+  for (; !ec && it != boost::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+    if (modified(it->path())) {
+      return true;
+    }
+  }
+  return static_cast<bool>(ec);
+}
+
+void OstreeManager::prestage(const Uptane::Target &target) {
+  auto staged = std_::make_unique<PrestagedDeployment>();
+  staged->revision = target.sha256Hash();
+  staged->staged_at = std::time(nullptr);
+
+  // Run the checkout and the /etc merge with the lowest CPU priority and the idle I/O class
+  const ScopedResourcePolicy policy(ResourcePolicy::lowest());
+
+  try {
+    staged->sysroot = OstreeManager::LoadSysroot(config.sysroot);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "OSTree pre-staging skipped: " << e.what();
+    return;
+  }
+  GError *error = nullptr;
+  if (ostree_sysroot_prepare_cleanup(staged->sysroot.get(), prestage_cancellable_.get(), &error) == 0) {
+    LOG_WARNING << "OSTree pre-staging skipped: " << error->message;
+    g_error_free(error);
+    return;
+  }
+  LOG_INFO << "Pre-staging OSTree deployment of " << staged->revision;
+  const auto result = deployTree(staged->sysroot.get(), target, prestage_cancellable_.get(), &staged->deployment,
+                                 &staged->merge_deployment);
+  if (!result.success) {
+    LOG_WARNING << "OSTree pre-staging failed, the deployment will be created at install time";
+    return;
+  }
+  LOG_INFO << "OSTree deployment of " << staged->revision << " pre-staged";
+  std::lock_guard<std::mutex> guard(prestage_mutex_);
+  prestaged_ = std::move(staged);
+}
+
+std::unique_ptr<OstreeManager::PrestagedDeployment> OstreeManager::takePrestaged(const Uptane::Target &target) const {
+  if (prestage_thread_.joinable()) {
+    prestage_thread_.join();
+  }
+  std::unique_ptr<PrestagedDeployment> staged;
+  {
+    std::lock_guard<std::mutex> guard(prestage_mutex_);
+    staged = std::move(prestaged_);
+  }
+  if (staged == nullptr || staged->revision != target.sha256Hash()) {
+    return nullptr;
+  }
+
+  // The deployment can only be used if the sysroot did not change and the /etc it was merged from is unmodified.
+  GError *error = nullptr;
+  gboolean changed = FALSE;
+  if (ostree_sysroot_load_if_changed(staged->sysroot.get(), &changed, nullptr, &error) == 0) {
+    LOG_WARNING << "Discarding pre-staged OSTree deployment: " << error->message;
+    g_error_free(error);
+    return nullptr;
+  }
+  if (changed != FALSE) {
+    LOG_INFO << "Discarding pre-staged OSTree deployment: deployments changed since it was staged";
+    return nullptr;
+  }
+  g_autofree char *merge_dir =
+      ostree_sysroot_get_deployment_dirpath(staged->sysroot.get(), staged->merge_deployment.get());
+  const boost::filesystem::path sysroot_path = config.sysroot.empty() ? "/" : config.sysroot;
+  if (treeModifiedSince(sysroot_path / merge_dir / "etc", staged->staged_at)) {
+    LOG_INFO << "Discarding pre-staged OSTree deployment: /etc changed since it was staged";
+    return nullptr;
+  }
+  return staged;
+}
+
+data::InstallationResult OstreeManager::install(const Uptane::Target &target) const {
+  GCancellable *cancellable = nullptr;
+  GError *error = nullptr;
+
+  GObjectUniquePtr<OstreeSysroot> sysroot;
+  GObjectUniquePtr<OstreeDeployment> new_deployment;
+  GObjectUniquePtr<OstreeDeployment> merge_deployment;
+
+  // A discarded pre-staged deployment is not referenced anywhere and is removed by the cleanup below.
+  std::unique_ptr<PrestagedDeployment> staged = takePrestaged(target);
+  if (staged != nullptr) {
+    LOG_INFO << "Using pre-staged OSTree deployment of " << staged->revision;
+    sysroot = std::move(staged->sysroot);
+    new_deployment = std::move(staged->deployment);
+    merge_deployment = std::move(staged->merge_deployment);
+  } else {
+    sysroot = OstreeManager::LoadSysroot(config.sysroot);
+    if (ostree_sysroot_prepare_cleanup(sysroot.get(), cancellable, &error) == 0) {
+      LOG_ERROR << error->message;
+      data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
+      g_error_free(error);
+      return install_res;
+    }
+    data::InstallationResult deploy_res =
+        deployTree(sysroot.get(), target, cancellable, &new_deployment, &merge_deployment);
+    if (!deploy_res.success) {
+      return deploy_res;
+    }
+  }
 
   if (ostree_sysroot_simple_write_deployment(sysroot.get(), nullptr, new_deployment.get(), merge_deployment.get(),
                                              OSTREE_SYSROOT_SIMPLE_WRITE_DEPLOYMENT_FLAGS_NONE, cancellable,
@@ -331,6 +744,8 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
     return install_res;
   }
 
+  invalidateSysroot();
+
   // set reboot flag to be notified later
   if (bootloader_ != nullptr) {
     bootloader_->rebootFlagSet();
@@ -365,6 +780,7 @@ data::InstallationResult OstreeManager::finalizeInstall(const Uptane::Target &ta
   }
 
   bootloader_->rebootFlagClear();
+  invalidateSysroot();
   return install_result;
 }
 
@@ -374,20 +790,22 @@ OstreeManager::OstreeManager(const PackageConfig &pconfig, const BootloaderConfi
                              const std::shared_ptr<INvStorage> &storage, const std::shared_ptr<HttpInterface> &http,
                              Bootloader *bootloader)
     : PackageManagerInterface(pconfig, BootloaderConfig(), storage, http),
-      bootloader_(bootloader == nullptr ? new Bootloader(bconfig, *storage) : bootloader) {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
-  if (sysroot_smart == nullptr) {
-    throw std::runtime_error("Could not find OSTree sysroot at: " + config.sysroot.string());
-  }
-
+      bootloader_(bootloader == nullptr ? new Bootloader(bconfig, *storage) : bootloader),
+      prestage_cancellable_(g_cancellable_new()) {
   // consider boot successful as soon as we started, missing internet connection or connection to Secondaries are not
-  // proper reasons to roll back
+  // proper reasons to roll back. imageUpdated() loads the sysroot and throws if it cannot.
   if (imageUpdated()) {
     bootloader_->setBootOK();
   }
 }
 
-OstreeManager::~OstreeManager() { bootloader_.reset(nullptr); }
+OstreeManager::~OstreeManager() {
+  g_cancellable_cancel(prestage_cancellable_.get());
+  if (prestage_thread_.joinable()) {
+    prestage_thread_.join();
+  }
+  bootloader_.reset(nullptr);
+}
 
 bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &fetcher, const KeyManager &keys,
                                 const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) {
@@ -396,7 +814,16 @@ bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &f
     // while the target is aimed for a Secondary ECU that is configured with another/non-OSTree package manager
     return PackageManagerInterface::fetchTarget(target, fetcher, keys, progress_cb, token);
   }
-  return OstreeManager::pull(config.sysroot, config.ostree_server, keys, target, token, progress_cb).success;
+  const bool success = OstreeManager::pull(config.sysroot, config.ostree_server, keys, target, token, progress_cb,
+                                           nullptr, boost::none, &config)
+                           .success;
+  if (success && config.ostree_prestage) {
+    if (prestage_thread_.joinable()) {
+      prestage_thread_.join();
+    }
+    prestage_thread_ = std::thread(&OstreeManager::prestage, this, target);
+  }
+  return success;
 }
 
 #ifdef BUILD_OFFLINE_UPDATES
@@ -409,7 +836,8 @@ bool OstreeManager::fetchTargetOffUpd(const Uptane::Target &target, const Uptane
     return PackageManagerInterface::fetchTargetOffUpd(target, fetcher, keys, progress_cb, token);
   }
   auto srcrepo_path = fetcher.getImagesPath() / "ostree";
-  return OstreeManager::pullLocal(config.sysroot, srcrepo_path, target, progress_cb).success;
+  return OstreeManager::pullLocal(config.sysroot, srcrepo_path, target, progress_cb, config.ostree_offline_fast_import)
+      .success;
 }
 #endif
 
@@ -426,8 +854,7 @@ TargetStatus OstreeManager::verifyTargetInternal(const Uptane::Target &target) c
   const std::string refhash = target.sha256Hash();
   GError *error = nullptr;
 
-  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  GObjectUniquePtr<OstreeRepo> repo = cachedRepo(&error);
   if (error != nullptr) {
     LOG_ERROR << "Could not get OSTree repo";
     g_error_free(error);
@@ -440,7 +867,9 @@ TargetStatus OstreeManager::verifyTargetInternal(const Uptane::Target &target) c
     g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
     // should never be greater than 1, but use >= for robustness
     if (length >= 1) {
-      return TargetStatus::kGood;
+      // Verifying and repairing an unverified import is left to pullLocal(),
+      // which imports the commit again if needed.
+      return importUnverified(repo.get(), refhash) ? TargetStatus::kIncomplete : TargetStatus::kGood;
     }
   }
   if (error != nullptr) {
@@ -474,9 +903,22 @@ Json::Value OstreeManager::getInstalledPackages() const {
   return packages;
 }
 
+std::string OstreeManager::installedPackagesVersion() const {
+  boost::system::error_code ec;
+  const auto size = boost::filesystem::file_size(config.packages_file, ec);
+  if (ec) {
+    return "";
+  }
+  const auto mtime = boost::filesystem::last_write_time(config.packages_file, ec);
+  if (ec) {
+    return "";
+  }
+  return std::to_string(mtime) + ":" + std::to_string(size);
+}
+
 std::string OstreeManager::getCurrentHash() const {
   OstreeDeployment *deployment = nullptr;
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  GObjectUniquePtr<OstreeSysroot> sysroot_smart = cachedSysroot();
   if (config.booted == BootedType::kBooted) {
     deployment = ostree_sysroot_get_booted_deployment(sysroot_smart.get());
   } else {
@@ -537,7 +979,7 @@ Uptane::Target OstreeManager::getCurrent() const {
 
 // used for bootloader rollback
 bool OstreeManager::imageUpdated() {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  GObjectUniquePtr<OstreeSysroot> sysroot_smart = cachedSysroot();
 
   // image updated if no pending deployment in the list of deployments
   GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
@@ -559,7 +1001,7 @@ bool OstreeManager::imageUpdated() {
 }
 
 GObjectUniquePtr<OstreeDeployment> OstreeManager::getStagedDeployment() const {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  GObjectUniquePtr<OstreeSysroot> sysroot_smart = cachedSysroot();
 
   GPtrArray *deployments = nullptr;
   OstreeDeployment *res = nullptr;
@@ -577,6 +1019,47 @@ GObjectUniquePtr<OstreeDeployment> OstreeManager::getStagedDeployment() const {
   return GObjectUniquePtr<OstreeDeployment>(res);
 }
 
+void OstreeManager::refreshSysroot() const {
+  // libostree updates the modification time of the deployment directory whenever it writes the deployments
+  const auto deploy_dir = (config.sysroot.empty() ? boost::filesystem::path("/") : config.sysroot) / "ostree/deploy";
+  struct stat st {};
+  const bool have_mtime = stat(deploy_dir.c_str(), &st) == 0;
+  if (sysroot_ != nullptr && have_mtime && st.st_mtim.tv_sec == sysroot_mtime_.tv_sec &&
+      st.st_mtim.tv_nsec == sysroot_mtime_.tv_nsec) {
+    return;
+  }
+  if (sysroot_ != nullptr) {
+    LOG_DEBUG << "OSTree deployments changed, loading the sysroot again";
+  }
+  sysroot_ = OstreeManager::LoadSysroot(config.sysroot);
+  repo_.reset();
+  sysroot_mtime_ = have_mtime ? st.st_mtim : timespec{};
+}
+
+GObjectUniquePtr<OstreeSysroot> OstreeManager::cachedSysroot() const {
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  refreshSysroot();
+  return GObjectUniquePtr<OstreeSysroot>(static_cast<OstreeSysroot *>(g_object_ref(sysroot_.get())));
+}
+
+GObjectUniquePtr<OstreeRepo> OstreeManager::cachedRepo(GError **error) const {
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  refreshSysroot();
+  if (repo_ == nullptr) {
+    repo_ = LoadRepo(sysroot_.get(), error);
+    if (repo_ == nullptr) {
+      return nullptr;
+    }
+  }
+  return GObjectUniquePtr<OstreeRepo>(static_cast<OstreeRepo *>(g_object_ref(repo_.get())));
+}
+
+void OstreeManager::invalidateSysroot() const {
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  sysroot_.reset();
+  repo_.reset();
+}
+
 GObjectUniquePtr<OstreeSysroot> OstreeManager::LoadSysroot(const boost::filesystem::path &path) {
   GObjectUniquePtr<OstreeSysroot> sysroot = nullptr;
 
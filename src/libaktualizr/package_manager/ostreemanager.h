@@ -2,8 +2,11 @@
 #define OSTREE_H_
 
 #include <boost/optional/optional.hpp>
+#include <ctime>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 #include <glib/gi18n.h>
@@ -52,6 +55,7 @@ class OstreeManager : public PackageManagerInterface {
   OstreeManager &operator=(OstreeManager &&) = delete;
   std::string name() const override { return "ostree"; }
   Json::Value getInstalledPackages() const override;
+  std::string installedPackagesVersion() const override;
   virtual std::string getCurrentHash() const;
   Uptane::Target getCurrent() const override;
   bool imageUpdated();
@@ -76,18 +80,59 @@ class OstreeManager : public PackageManagerInterface {
       const boost::filesystem::path &sysroot_path, const std::string &ostree_server, const KeyManager &keys,
       const Uptane::Target &target, const api::FlowControlToken *token = nullptr,
       OstreeProgressCb progress_cb = nullptr, const char *alt_remote = nullptr,
-      boost::optional<std::unordered_map<std::string, std::string>> headers = boost::none);
+      boost::optional<std::unordered_map<std::string, std::string>> headers = boost::none,
+      const PackageConfig *pconfig = nullptr);
+  static data::InstallationResult pull(OstreeRepo *repo, const std::string &ostree_server, const KeyManager &keys,
+                                       const Uptane::Target &target, const api::FlowControlToken *token,
+                                       OstreeProgressCb progress_cb, const char *alt_remote,
+                                       boost::optional<std::unordered_map<std::string, std::string>> headers,
+                                       const PackageConfig *pconfig);
+  static GObjectUniquePtr<OstreeRepo> OpenMirrorRepo(const boost::filesystem::path &path, GError **error);
+  bool mirrorTarget(const Uptane::Target &target, const KeyManager &keys, const FetcherProgressCb &progress_cb,
+                    const api::FlowControlToken *token) override;
 
 #ifdef BUILD_OFFLINE_UPDATES
   static data::InstallationResult pullLocal(const boost::filesystem::path &sysroot_path,
                                             const boost::filesystem::path &srcrepo_path, const Uptane::Target &target,
-                                            OstreeProgressCb progress_cb = nullptr);
+                                            OstreeProgressCb progress_cb = nullptr, bool fast_import = false);
 #endif
 
  private:
+  // A deployment created in the background after a fetch, not yet written to the bootloader configuration.
+  struct PrestagedDeployment {
+    std::string revision;
+    std::time_t staged_at{0};
+    GObjectUniquePtr<OstreeSysroot> sysroot;
+    GObjectUniquePtr<OstreeDeployment> deployment;
+    GObjectUniquePtr<OstreeDeployment> merge_deployment;
+  };
+
   TargetStatus verifyTargetInternal(const Uptane::Target &target) const;
+  data::InstallationResult deployTree(OstreeSysroot *sysroot, const Uptane::Target &target, GCancellable *cancellable,
+                                      GObjectUniquePtr<OstreeDeployment> *new_deployment,
+                                      GObjectUniquePtr<OstreeDeployment> *merge_deployment) const;
+  void prestage(const Uptane::Target &target);
+  std::unique_ptr<PrestagedDeployment> takePrestaged(const Uptane::Target &target) const;
+  // The sysroot, loaded again only when its deployments changed. It is replaced rather than reloaded in place, so
+  // that a caller can keep using its reference while another one gets a newer sysroot.
+  GObjectUniquePtr<OstreeSysroot> cachedSysroot() const;
+  // The repo of cachedSysroot()
+  GObjectUniquePtr<OstreeRepo> cachedRepo(GError **error) const;
+  // Load the sysroot again on the next use, after this process changed the deployments
+  void invalidateSysroot() const;
+  void refreshSysroot() const;
 
   std::unique_ptr<Bootloader> bootloader_;
+  GObjectUniquePtr<GCancellable> prestage_cancellable_;
+  mutable std::thread prestage_thread_;
+  mutable std::mutex prestage_mutex_;
+  mutable std::unique_ptr<PrestagedDeployment> prestaged_;
+  std::mutex mirror_mutex_;
+  mutable std::mutex sysroot_mutex_;
+  mutable GObjectUniquePtr<OstreeSysroot> sysroot_;
+  mutable GObjectUniquePtr<OstreeRepo> repo_;
+  // Modification time of the deployment directory when sysroot_ was loaded
+  mutable struct timespec sysroot_mtime_ {};
 };
 
 #endif  // OSTREE_H_
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -149,6 +150,31 @@ TEST(OstreeManager, GetCurrentTarget) {
   EXPECT_EQ(dut.getCurrentHash(), current_target.sha256Hash()) << "hash should match";
 }
 
+/* A commit already in the local repository is copied into the mirror without a download. */
+TEST(OstreeManager, MirrorLocalCommit) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.ostree_server = "bad-url";
+  config.pacman.ostree_mirror_path = temp_dir / "mirror";
+  config.storage.path = temp_dir.Path();
+  config.pacman.booted = BootedType::kStaged;
+  auto storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+  auto target = dut.getCurrent();
+
+  EXPECT_TRUE(dut.mirrorTarget(target, keys, nullptr, nullptr));
+  const std::string hash = target.sha256Hash();
+  EXPECT_TRUE(boost::filesystem::exists(config.pacman.ostree_mirror_path / "objects" / hash.substr(0, 2) /
+                                        (hash.substr(2) + ".commit")));
+  EXPECT_NE(Utils::readFile(config.pacman.ostree_mirror_path / "config").find("archive"), std::string::npos);
+
+  // Mirroring the same commit again is a no-op
+  EXPECT_TRUE(dut.mirrorTarget(target, keys, nullptr, nullptr));
+}
+
 /* Communicate with a remote OSTree server without credentials. */
 TEST(OstreeManager, AddRemoteNoCreds) {
   TemporaryDirectory temp_dir;
@@ -271,6 +297,82 @@ TEST(OstreeManager, AddRemoteWithCreds) {
   g_object_unref(repo);
 }
 
+#ifdef BUILD_OFFLINE_UPDATES
+// Copy of the test sysroot whose repository misses the current commit and
+// has one of its file objects corrupted.
+static boost::filesystem::path corruptSysroot(const TemporaryDirectory &temp_dir, const std::string &commit) {
+  const boost::filesystem::path sysroot = temp_dir / "sysroot";
+  EXPECT_EQ(system(("cp -r " + test_sysroot.string() + " " + sysroot.string()).c_str()), 0);
+  const boost::filesystem::path objects = sysroot / "ostree" / "repo" / "objects";
+  boost::filesystem::remove(objects / commit.substr(0, 2) / (commit.substr(2) + ".commit"));
+  for (boost::filesystem::recursive_directory_iterator it(objects), end; it != end; ++it) {
+    if (it->path().extension() == ".file" && boost::filesystem::is_regular_file(it->symlink_status()) &&
+        boost::filesystem::file_size(it->path()) > 0) {
+      boost::filesystem::permissions(it->path(), boost::filesystem::add_perms | boost::filesystem::owner_write);
+      std::ofstream(it->path().string(), std::ios::app) << "corrupt";
+      break;
+    }
+  }
+  return sysroot;
+}
+
+/* A fast import that takes in a corrupt object is rejected and imported again untrusted. */
+TEST(OstreeManager, FastImportCorruptObject) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const auto target = OstreeManager(config.pacman, config.bootloader, storage, nullptr).getCurrent();
+  config.pacman.sysroot = corruptSysroot(temp_dir, target.sha256Hash());
+
+  const auto result = OstreeManager::pullLocal(config.pacman.sysroot, test_sysroot / "ostree" / "repo", target,
+                                               nullptr, true);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kOk);
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.sysroot / "ostree/repo/state/aktualizr-unverified-import"));
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+  EXPECT_EQ(dut.verifyTarget(target), TargetStatus::kGood);
+
+  // The corrupt object was imported again, so a full check passes now.
+  const auto again = OstreeManager::pullLocal(config.pacman.sysroot, test_sysroot / "ostree" / "repo", target);
+  EXPECT_EQ(again.result_code.num_code, data::ResultCode::Numeric::kAlreadyProcessed);
+  EXPECT_EQ(system(("ostree fsck --repo=" + (config.pacman.sysroot / "ostree" / "repo").string()).c_str()), 0);
+}
+
+/* A commit left behind by an interrupted fast import is not trusted until it is verified, and imported again if
+ * it is corrupt. */
+TEST(OstreeManager, FastImportInterrupted) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  const auto target = OstreeManager(config.pacman, config.bootloader, storage, nullptr).getCurrent();
+  const std::string commit = target.sha256Hash();
+  config.pacman.sysroot = corruptSysroot(temp_dir, commit);
+  const boost::filesystem::path repo = config.pacman.sysroot / "ostree" / "repo";
+  // The commit object made it in before the import was interrupted.
+  const std::string commit_object = "objects/" + commit.substr(0, 2) + "/" + commit.substr(2) + ".commit";
+  boost::filesystem::copy_file(test_sysroot / "ostree" / "repo" / commit_object, repo / commit_object);
+  boost::filesystem::create_directories(repo / "state");
+  Utils::writeFile(repo / "state" / "aktualizr-unverified-import", commit);
+
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+  EXPECT_EQ(dut.verifyTarget(target), TargetStatus::kIncomplete);
+  // Checking again doesn't verify or repair anything.
+  EXPECT_EQ(dut.verifyTarget(target), TargetStatus::kIncomplete);
+  EXPECT_TRUE(boost::filesystem::exists(repo / "state" / "aktualizr-unverified-import"));
+
+  const auto result = OstreeManager::pullLocal(config.pacman.sysroot, test_sysroot / "ostree" / "repo", target);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kOk);
+  EXPECT_FALSE(boost::filesystem::exists(repo / "state" / "aktualizr-unverified-import"));
+  EXPECT_EQ(dut.verifyTarget(target), TargetStatus::kGood);
+  EXPECT_EQ(system(("ostree fsck --repo=" + repo.string()).c_str()), 0);
+}
+#endif  // BUILD_OFFLINE_UPDATES
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -15,6 +15,28 @@ void PackageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
       CopyFromConfig(images_path, cp.first, pt);
     } else if (cp.first == "packages_file") {
       CopyFromConfig(packages_file, cp.first, pt);
+    } else if (cp.first == "images_max_bytes") {
+      CopyFromConfig(images_max_bytes, cp.first, pt);
+    } else if (cp.first == "images_prune_after_install") {
+      CopyFromConfig(images_prune_after_install, cp.first, pt);
+    } else if (cp.first == "download_segments") {
+      CopyFromConfig(download_segments, cp.first, pt);
+    } else if (cp.first == "download_segment_threshold") {
+      CopyFromConfig(download_segment_threshold, cp.first, pt);
+    } else if (cp.first == "download_chunked_delta") {
+      CopyFromConfig(download_chunked_delta, cp.first, pt);
+    } else if (cp.first == "ostree_static_deltas") {
+      CopyFromConfig(ostree_static_deltas, cp.first, pt);
+    } else if (cp.first == "ostree_network_retries") {
+      CopyFromConfig(ostree_network_retries, cp.first, pt);
+    } else if (cp.first == "ostree_prestage") {
+      CopyFromConfig(ostree_prestage, cp.first, pt);
+    } else if (cp.first == "ostree_offline_fast_import") {
+      CopyFromConfig(ostree_offline_fast_import, cp.first, pt);
+    } else if (cp.first == "ostree_mirror_path") {
+      CopyFromConfig(ostree_mirror_path, cp.first, pt);
+    } else if (cp.first == "ostree_mirror_url") {
+      CopyFromConfig(ostree_mirror_url, cp.first, pt);
     } else if (cp.first == "fake_need_reboot") {
       CopyFromConfig(fake_need_reboot, cp.first, pt);
     } else if (cp.first == "booted") {
@@ -32,6 +54,17 @@ void PackageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, ostree_server, "ostree_server");
   writeOption(out_stream, images_path, "images_path");
   writeOption(out_stream, packages_file, "packages_file");
+  writeOption(out_stream, images_max_bytes, "images_max_bytes");
+  writeOption(out_stream, images_prune_after_install, "images_prune_after_install");
+  writeOption(out_stream, download_segments, "download_segments");
+  writeOption(out_stream, download_segment_threshold, "download_segment_threshold");
+  writeOption(out_stream, download_chunked_delta, "download_chunked_delta");
+  writeOption(out_stream, ostree_static_deltas, "ostree_static_deltas");
+  writeOption(out_stream, ostree_network_retries, "ostree_network_retries");
+  writeOption(out_stream, ostree_prestage, "ostree_prestage");
+  writeOption(out_stream, ostree_offline_fast_import, "ostree_offline_fast_import");
+  writeOption(out_stream, ostree_mirror_path, "ostree_mirror_path");
+  writeOption(out_stream, ostree_mirror_url, "ostree_mirror_url");
   writeOption(out_stream, fake_need_reboot, "fake_need_reboot");
   writeOption(out_stream, booted, "booted");
 
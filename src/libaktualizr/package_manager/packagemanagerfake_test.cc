@@ -5,6 +5,8 @@
 #include <sstream>
 #include <string>
 
+#include <archive.h>
+#include <archive_entry.h>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
@@ -184,6 +186,68 @@ TEST(PackageManagerFake, FinalizeAfterReboot) {
   EXPECT_EQ(result.result_code, data::ResultCode::Numeric::kOk);
 }
 
+#ifdef BUILD_OFFLINE_UPDATES
+/* Write `content` zstd-compressed to `path`. Returns false if libarchive can't. */
+static bool writeZstd(const boost::filesystem::path &path, const std::string &content) {
+  StructGuardInt<struct archive> a(archive_write_new(), archive_write_free);
+  if (archive_write_add_filter_zstd(a.get()) != ARCHIVE_OK || archive_write_set_format_raw(a.get()) != ARCHIVE_OK ||
+      archive_write_open_filename(a.get(), path.c_str()) != ARCHIVE_OK) {
+    return false;
+  }
+  StructGuard<struct archive_entry> entry(archive_entry_new(), archive_entry_free);
+  archive_entry_set_pathname(entry.get(), "image");
+  archive_entry_set_filetype(entry.get(), AE_IFREG);
+  archive_entry_set_size(entry.get(), static_cast<la_int64_t>(content.size()));
+  return archive_write_header(a.get(), entry.get()) == ARCHIVE_OK &&
+         archive_write_data(a.get(), content.data(), content.size()) == static_cast<la_ssize_t>(content.size()) &&
+         archive_write_close(a.get()) == ARCHIVE_OK;
+}
+
+/*
+ * Fetch a target stored zstd-compressed in the lockbox of an offline update,
+ * verifying the decompressed image against its hash.
+ * Reject a compressed image that does not match the hash.
+ */
+TEST(PackageManagerFake, FetchCompressedOffline) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, nullptr);
+
+  const boost::filesystem::path lockbox = temp_dir.Path() / "lockbox";
+  boost::filesystem::create_directories(lockbox / "images");
+  const Uptane::OfflineUpdateFetcher fetcher(lockbox);
+  std::string content;
+  for (int i = 0; i < 100000; ++i) {
+    content += std::to_string(i);
+  }
+  if (!writeZstd(lockbox / "images" / "image.bin.zst", content)) {
+    GTEST_SKIP() << "libarchive can't write zstd";
+  }
+  EXPECT_LT(boost::filesystem::file_size(lockbox / "images" / "image.bin.zst"), content.size() / 2);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const Uptane::Target target("image.bin", primary_ecu,
+                              {Hash(Hash::Type::kSha256, Crypto::sha256digestHex(content))}, content.size());
+  EXPECT_TRUE(fakepm.fetchTargetOffUpd(target, fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
+  std::stringstream fetched;
+  fetched << fakepm.openTargetFile(target).rdbuf();
+  EXPECT_EQ(fetched.str(), content);
+
+  content[0] = 'x';
+  ASSERT_TRUE(writeZstd(lockbox / "images" / "bad.bin.zst", content));
+  const Uptane::Target bad("bad.bin", primary_ecu,
+                           {Hash(Hash::Type::kSha256, Crypto::sha256digestHex(fetched.str()))}, content.size());
+  EXPECT_FALSE(fakepm.fetchTargetOffUpd(bad, fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(fakepm.verifyTarget(bad), TargetStatus::kNotFound);
+}
+#endif  // BUILD_OFFLINE_UPDATES
+
 #ifdef FIU_ENABLE
 
 #include "utilities/fault_injection.h"
@@ -1,50 +1,429 @@
 #include "libaktualizr/packagemanagerinterface.h"
 
+#include <archive.h>
+#include <archive_entry.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
 #include <chrono>
+#include <ctime>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
 #include "logging/logging.h"
+#include "package_manager/chunk_index.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
 #include "uptane/fetcher.h"
 #include "utilities/apiqueue.h"
+#include "utilities/bandwidth_limiter.h"
+#include "utilities/block_reader.h"
+#include "utilities/fault_injection.h"
+#include "utilities/memory_budget.h"
+
+class DownloadPipeline;
+
+// Suffix of the file next to a partial target file that holds the hasher
+// state for a prefix of it, so that a resumed download does not rehash it.
+static const char* const kHashCheckpointSuffix = ".hashstate";
+
+static void writeHashCheckpoint(const std::string& filepath, uint64_t offset, const MultiPartMultiHasher& hasher) {
+  const std::string state = hasher.exportState();
+  if (state.empty()) {
+    return;
+  }
+  try {
+    Utils::writeFile(filepath + kHashCheckpointSuffix, std::to_string(offset) + "\n" + state, false);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not write hash checkpoint of " << filepath << ": " << e.what();
+  }
+}
+
+static void removeHashCheckpoint(const std::string& filepath) {
+  boost::system::error_code ec;
+  boost::filesystem::remove(filepath + kHashCheckpointSuffix, ec);
+}
+
+// Index in the target store of when each stored file was last part of an update, used
+// to remove the least recently used files once the store exceeds its size limit.
+static const char* const kLastUsedIndex = ".last-used.json";
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::mutex last_used_mutex;
+
+static void touchTargetFile(const boost::filesystem::path& images_path, const std::string& filename) {
+  std::lock_guard<std::mutex> guard(last_used_mutex);
+  const auto index_path = images_path / kLastUsedIndex;
+  Json::Value index;
+  try {
+    if (boost::filesystem::exists(index_path)) {
+      index = Utils::parseJSONFile(index_path);
+    }
+    index[filename] = static_cast<Json::Int64>(std::time(nullptr));
+    Utils::writeFile(index_path, index);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not update " << index_path << ": " << e.what();
+  }
+}
+
+// Removes stored files, least recently used first, until the store holds at most max_bytes.
+// The files in `keep` and files of Targets being downloaded are never removed.
+static void pruneTargetFiles(INvStorage& storage, const boost::filesystem::path& images_path, uint64_t max_bytes,
+                             const std::set<std::string>& keep) {
+  std::lock_guard<std::mutex> guard(last_used_mutex);
+  const auto index_path = images_path / kLastUsedIndex;
+  Json::Value index;
+  try {
+    if (boost::filesystem::exists(index_path)) {
+      index = Utils::parseJSONFile(index_path);
+    }
+  } catch (const std::exception& e) {
+    LOG_DEBUG << "Could not read " << index_path << ": " << e.what();
+  }
+
+  // Several Target names can refer to the same stored file
+  std::map<std::string, std::vector<std::string>> names_by_file;
+  for (const auto& name : storage.getAllTargetNames()) {
+    names_by_file[storage.getTargetFilename(name)].push_back(name);
+  }
+  struct Candidate {
+    int64_t last_used;
+    std::string filename;
+    uint64_t size;
+  };
+  std::vector<Candidate> candidates;
+  uint64_t total = 0;
+  for (const auto& entry : names_by_file) {
+    boost::system::error_code ec;
+    const auto path = images_path / entry.first;
+    const uint64_t size = boost::filesystem::file_size(path, ec);
+    if (ec || entry.first.empty()) {
+      continue;
+    }
+    total += size;
+    if (keep.count(entry.first) != 0 || boost::filesystem::exists(path.string() + kHashCheckpointSuffix)) {
+      continue;
+    }
+    int64_t last_used = index[entry.first].asInt64();
+    if (last_used == 0) {
+      last_used = static_cast<int64_t>(boost::filesystem::last_write_time(path, ec));
+    }
+    candidates.push_back({last_used, entry.first, size});
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) { return a.last_used < b.last_used; });
+
+  for (const auto& candidate : candidates) {
+    if (total <= max_bytes) {
+      break;
+    }
+    LOG_INFO << "Removing least recently used stored Target file " << candidate.filename << " ("
+             << candidate.size << " bytes)";
+    for (const auto& name : names_by_file[candidate.filename]) {
+      storage.deleteTargetInfo(name);
+    }
+    boost::system::error_code ec;
+    boost::filesystem::remove(images_path / candidate.filename, ec);
+    index.removeMember(candidate.filename);
+    total -= candidate.size;
+  }
+  try {
+    Utils::writeFile(index_path, index);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not update " << index_path << ": " << e.what();
+  }
+}
+
+// Target files are stored under their digest, so a file downloaded for another Target
+// name may already hold this Target. Point the Target to it; it is verified before use.
+static bool adoptStoredFile(INvStorage& storage, const boost::filesystem::path& images_path,
+                            const Uptane::Target& target) {
+  const std::string filename = target.hashes()[0].HashString();
+  const auto path = images_path / filename;
+  boost::system::error_code ec;
+  if (boost::filesystem::file_size(path, ec) != target.length() || ec ||
+      boost::filesystem::exists(path.string() + kHashCheckpointSuffix)) {
+    return false;
+  }
+  storage.storeTargetFilename(target.filename(), filename);
+  return true;
+}
+
+// Reads the size and the metadata that change whenever the file content does.
+// ctime is included as, unlike mtime, it can not be set back by a user.
+static bool statTargetFile(const std::string& filepath, TargetFileVerification* verification) {
+  struct stat st {};
+  if (::stat(filepath.c_str(), &st) != 0) {
+    return false;
+  }
+  static constexpr int64_t kNanoseconds = 1000000000;
+  verification->real_size = static_cast<uint64_t>(st.st_size);
+  verification->mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * kNanoseconds + st.st_mtim.tv_nsec;
+  verification->ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * kNanoseconds + st.st_ctim.tv_nsec;
+  verification->inode = static_cast<uint64_t>(st.st_ino);
+  return true;
+}
+
+// Records the digests of a verified target file, so that it is not hashed
+// again as long as the file is not changed.
+static void storeTargetVerification(INvStorage& storage, const Uptane::Target& target, const std::string& filepath,
+                                    const std::vector<Hash>& hashes) {
+  TargetFileVerification verification;
+  if (!statTargetFile(filepath, &verification)) {
+    return;
+  }
+  for (const auto& hash : hashes) {
+    if (hash.type() == Hash::Type::kSha256) {
+      verification.sha256 = boost::algorithm::to_lower_copy(hash.HashString());
+    } else if (hash.type() == Hash::Type::kSha512) {
+      verification.sha512 = boost::algorithm::to_lower_copy(hash.HashString());
+    }
+  }
+  try {
+    storage.storeTargetVerification(target.filename(), verification);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not record the verification of " << target.filename() << ": " << e.what();
+  }
+}
+
+// Returns true if the recorded digests cover all the known hashes of the target, and match them.
+static bool verificationMatches(const Uptane::Target& target, const TargetFileVerification& verification) {
+  bool matched = false;
+  for (const auto& hash : target.hashes()) {
+    std::string recorded;
+    if (hash.type() == Hash::Type::kSha256) {
+      recorded = verification.sha256;
+    } else if (hash.type() == Hash::Type::kSha512) {
+      recorded = verification.sha512;
+    } else {
+      continue;
+    }
+    if (recorded.empty() || !(Hash(hash.type(), recorded) == hash)) {
+      return false;
+    }
+    matched = true;
+  }
+  return matched;
+}
 
 struct DownloadMetaStruct {
  public:
   DownloadMetaStruct(Uptane::Target target_in, FetcherProgressCb progress_cb_in, const api::FlowControlToken* token_in)
-      : hash_type{target_in.hashes()[0].type()},
-        target{std::move(target_in)},
+      : target{std::move(target_in)},
         token{token_in},
         progress_cb{std::move(progress_cb_in)},
         time_lastreport{std::chrono::steady_clock::now()} {}
   uintmax_t downloaded_length{0};
   unsigned int last_progress{0};
   std::ofstream fhandle;
-  const Hash::Type hash_type;
-  MultiPartHasher& hasher() {
-    switch (hash_type) {
-      case Hash::Type::kSha256:
-        return sha256_hasher;
-      case Hash::Type::kSha512:
-        return sha512_hasher;
-      default:
-        throw std::runtime_error("Unknown hash algorithm");
+  MultiPartMultiHasher& hasher() {
+    if (hasher_.empty()) {
+      throw std::runtime_error("Unknown hash algorithm");
     }
+    return hasher_;
+  }
+  bool hasKnownHash() const { return !hasher_.empty(); }
+  // All the known hashes listed for the target are computed in the same pass and must match
+  bool hashesMatch() {
+    computed_hashes = hasher().getHashes();
+    for (const auto& hash : computed_hashes) {
+      if (!target.MatchHash(hash)) {
+        return false;
+      }
+    }
+    return true;
   }
   Uptane::Target target;
   const api::FlowControlToken* token;
   FetcherProgressCb progress_cb;
+  // Hashes and writes the data instead of the curl callback when set
+  DownloadPipeline* pipeline{nullptr};
+  BandwidthLimiter* limiter{nullptr};
+  // Set by hashesMatch
+  std::vector<Hash> computed_hashes;
   // each LogProgressInterval msec log dowload progress for big files
   std::chrono::time_point<std::chrono::steady_clock> time_lastreport;
 
  private:
-  MultiPartSHA256Hasher sha256_hasher;
-  MultiPartSHA512Hasher sha512_hasher;
+  static std::vector<Hash::Type> hashTypes(const Uptane::Target& target) {
+    std::vector<Hash::Type> types;
+    for (const auto& hash : target.hashes()) {
+      types.push_back(hash.type());
+    }
+    return types;
+  }
+
+  MultiPartMultiHasher hasher_{hashTypes(target)};
+};
+
+/**
+ * Hashes and writes downloaded data on a worker thread, so that a slow disk or
+ * hasher does not hold up the curl write callback and the TCP receive window.
+ * Data is handed over in a few large blocks; the callback only waits when all
+ * of them are queued.
+ */
+class DownloadPipeline {
+ public:
+  // If `filepath` is not empty, the hasher state is checkpointed regularly for that file.
+  explicit DownloadPipeline(DownloadMetaStruct& ds, std::string filepath = "")
+      : ds_(ds), filepath_(std::move(filepath)), offset_(ds.downloaded_length), checkpoint_offset_(offset_) {
+    for (size_t i = 0; i < kBlocks; ++i) {
+      free_.emplace_back();
+      free_.back().reserve(kBlockSize);
+    }
+    current_ = takeFreeBlock();
+    worker_ = std::thread([this]() { run(); });
+    ds_.pipeline = this;
+  }
+  ~DownloadPipeline() {
+    try {
+      finish();
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Error while writing a target: " << e.what();
+    }
+  }
+  DownloadPipeline(const DownloadPipeline&) = delete;
+  DownloadPipeline(DownloadPipeline&&) = delete;
+  DownloadPipeline& operator=(const DownloadPipeline&) = delete;
+  DownloadPipeline& operator=(DownloadPipeline&&) = delete;
+
+  // Returns false if writing failed and the transfer should be aborted.
+  bool push(const char* data, size_t size) {
+    while (size > 0) {
+      const size_t chunk = std::min(size, kBlockSize - current_.size());
+      current_.insert(current_.end(), data, data + chunk);
+      data += chunk;
+      size -= chunk;
+      if (current_.size() == kBlockSize) {
+        queue(std::move(current_));
+        current_ = takeFreeBlock();
+      }
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    return !failed_;
+  }
+
+  // Waits for all data to be hashed and written. Throws if writing failed.
+  void finish() {
+    if (!worker_.joinable()) {
+      return;
+    }
+    if (!current_.empty()) {
+      queue(std::move(current_));
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+    ds_.pipeline = nullptr;
+    if (failed_) {
+      throw std::runtime_error("Could not write to the target file");
+    }
+    // The transfer may be resumed later, e.g. after a pause
+    if (offset_ > checkpoint_offset_ && offset_ < ds_.target.length()) {
+      checkpoint();
+    }
+  }
+
+ private:
+  static constexpr size_t kBlockSize = 256 * 1024;
+  static constexpr size_t kBlocks = 4;
+  static constexpr uint64_t kCheckpointInterval = 64 * 1024 * 1024;
+
+  std::vector<char> takeFreeBlock() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !free_.empty(); });
+    std::vector<char> block = std::move(free_.back());
+    free_.pop_back();
+    block.clear();
+    return block;
+  }
+
+  void queue(std::vector<char>&& block) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      full_.push_back(std::move(block));
+    }
+    cv_.notify_all();
+  }
+
+  bool process(const std::vector<char>& block) {
+    try {
+      ds_.fhandle.write(block.data(), static_cast<std::streamsize>(block.size()));
+      ds_.hasher().update(reinterpret_cast<const unsigned char*>(block.data()), block.size());
+      offset_ += block.size();
+      if (offset_ - checkpoint_offset_ >= kCheckpointInterval) {
+        checkpoint();
+      }
+      return static_cast<bool>(ds_.fhandle);
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Error while writing a target: " << e.what();
+      return false;
+    }
+  }
+
+  void checkpoint() {
+    if (filepath_.empty()) {
+      return;
+    }
+    // The checkpoint must not cover data that is not in the file yet
+    ds_.fhandle.flush();
+    if (ds_.fhandle) {
+      writeHashCheckpoint(filepath_, offset_, ds_.hasher());
+      checkpoint_offset_ = offset_;
+    }
+  }
+
+  void run() {
+    for (;;) {
+      std::vector<char> block;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !full_.empty() || done_; });
+        if (full_.empty()) {
+          return;
+        }
+        block = std::move(full_.front());
+        full_.pop_front();
+      }
+      if (!failed_ && !process(block)) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        failed_ = true;
+      }
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        free_.push_back(std::move(block));
+      }
+      cv_.notify_all();
+    }
+  }
+
+  DownloadMetaStruct& ds_;
+  const std::string filepath_;
+  uint64_t offset_;
+  uint64_t checkpoint_offset_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::vector<char>> full_;
+  std::vector<std::vector<char>> free_;
+  std::vector<char> current_;
+  bool done_{false};
+  bool failed_{false};
+  std::thread worker_;
 };
 
 static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
@@ -56,21 +435,25 @@ static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* u
     return downloaded + 1;  // curl will abort if return unexpected size;
   }
 
-  ds->fhandle.write(contents, static_cast<std::streamsize>(downloaded));
-  ds->hasher().update(reinterpret_cast<const unsigned char*>(contents), downloaded);
+  if (ds->limiter != nullptr) {
+    ds->limiter->acquire(downloaded);
+  }
+  fault_injection_throttle("download_write", downloaded);
+  if (ds->pipeline != nullptr) {
+    if (!ds->pipeline->push(contents, downloaded)) {
+      return downloaded + 1;
+    }
+  } else {
+    ds->fhandle.write(contents, static_cast<std::streamsize>(downloaded));
+    ds->hasher().update(reinterpret_cast<const unsigned char*>(contents), downloaded);
+  }
   ds->downloaded_length += downloaded;
   return downloaded;
 }
 
 static constexpr int64_t LogProgressInterval = 15000;
 
-static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
-  (void)dltotal;
-  (void)dlnow;
-  (void)ultotal;
-  (void)ulnow;
-  auto* ds = static_cast<DownloadMetaStruct*>(clientp);
-
+static void ReportProgress(DownloadMetaStruct* ds) {
   uint64_t expected = ds->target.length();
   auto progress = static_cast<unsigned int>((ds->downloaded_length * 100) / expected);
   if (ds->progress_cb && progress > ds->last_progress) {
@@ -84,21 +467,495 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
       ds->time_lastreport = now;
     }
   }
+}
+
+static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto* ds = static_cast<DownloadMetaStruct*>(clientp);
+
+  ReportProgress(ds);
   if (ds->token != nullptr && ds->token->hasAborted()) {
     return 1;
   }
+  // Interrupted like for a paused token, resumed once the limiter allows it
+  if (ds->limiter != nullptr && ds->limiter->paused()) {
+    return 1;
+  }
   return 0;
 }
 
-static void restoreHasherState(MultiPartHasher& hasher, std::ifstream data) {
-  static constexpr size_t buf_len = 1024;
-  std::array<uint8_t, buf_len> buf{};
-  do {
-    data.read(reinterpret_cast<char*>(buf.data()), buf.size());
-    hasher.update(buf.data(), static_cast<uint64_t>(data.gcount()));
-  } while (data.gcount() != 0);
+// One byte range of a segmented download. Each segment is written at its own
+// offset of the target file, so the transfers share nothing but the fd.
+struct SegmentMetaStruct {
+  int fd{-1};
+  uint64_t offset{0};
+  uint64_t length{0};
+  std::atomic<uint64_t> written{0};
+  const api::FlowControlToken* token{nullptr};
+  const std::atomic<bool>* cancel{nullptr};
+  BandwidthLimiter* limiter{nullptr};
+};
+
+static size_t SegmentDownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  assert(userp);
+  auto* seg = static_cast<SegmentMetaStruct*>(userp);
+  size_t downloaded = size * nmemb;
+  uint64_t written = seg->written;
+  if ((written + downloaded) > seg->length) {
+    // Also catches servers that ignore the range and send the whole file.
+    return downloaded + 1;
+  }
+  if (seg->limiter != nullptr) {
+    seg->limiter->acquire(downloaded);
+  }
+  fault_injection_throttle("download_write", downloaded);
+
+  size_t done = 0;
+  while (done < downloaded) {
+    const ssize_t res =
+        ::pwrite(seg->fd, contents + done, downloaded - done, static_cast<off_t>(seg->offset + written + done));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    done += static_cast<size_t>(res);
+  }
+  seg->written += downloaded;
+  return downloaded;
 }
 
+static int SegmentProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                  curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto* seg = static_cast<SegmentMetaStruct*>(clientp);
+  if (*seg->cancel || (seg->token != nullptr && seg->token->hasAborted())) {
+    return 1;
+  }
+  return 0;
+}
+
+// Closes a file descriptor when it goes out of scope
+class FdGuard {
+ public:
+  explicit FdGuard(int fd) : fd_(fd) {}
+  ~FdGuard() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  FdGuard(const FdGuard&) = delete;
+  FdGuard(FdGuard&&) = delete;
+  FdGuard& operator=(const FdGuard&) = delete;
+  FdGuard& operator=(FdGuard&&) = delete;
+  int get() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+/**
+ * Hash `length` bytes of the file at `filepath` from `offset`, in large reads
+ * that overlap reading slow storage with hashing.
+ */
+static void hashFileRange(MultiPartMultiHasher& hasher, const std::string& filepath, uint64_t offset,
+                          uint64_t length) {
+  BlockReader reader(filepath, offset, length);
+  std::vector<uint8_t> buf(static_cast<size_t>(std::min<uint64_t>(length, BlockReader::kBlockSize)));
+  while (const size_t count = reader.read(buf.data(), buf.size())) {
+    hasher.update(buf.data(), count);
+  }
+}
+
+/**
+ * Download a fresh target as `segments_count` parallel range requests into a
+ * preallocated file. Segments are hashed in order as soon as each one is
+ * complete, so hashing overlaps with the transfer of the later ones.
+ *
+ * Returns false if the server does not honour range requests; the caller then
+ * falls back to a single stream. Other failures throw, after truncating the
+ * file to its contiguous downloaded prefix so the next attempt can resume.
+ */
+static bool fetchTargetSegments(HttpInterface& http, const std::string& url, const std::string& filepath,
+                                DownloadMetaStruct& ds, uint64_t segments_count) {
+  const uint64_t length = ds.target.length();
+  segments_count = std::min<uint64_t>(segments_count, length);
+
+  const int fd = ::open(filepath.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open file " + filepath + ": " + std::strerror(errno));
+  }
+  if (::posix_fallocate(fd, 0, static_cast<off_t>(length)) != 0 && ::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Can't allocate file " + filepath + ": " + std::strerror(errno));
+  }
+
+  std::atomic<bool> cancel{false};
+  std::vector<SegmentMetaStruct> segments(segments_count);
+  std::vector<std::future<HttpResponse>> responses;
+  responses.reserve(segments_count);
+  const uint64_t segment_length = length / segments_count;
+  for (uint64_t i = 0; i < segments_count; ++i) {
+    auto& seg = segments[i];
+    seg.fd = fd;
+    seg.offset = i * segment_length;
+    seg.length = (i + 1 == segments_count) ? length - seg.offset : segment_length;
+    seg.token = ds.token;
+    seg.cancel = &cancel;
+    seg.limiter = ds.limiter;
+    responses.push_back(http.downloadRangeAsync(url, SegmentDownloadHandler, SegmentProgressHandler, &seg,
+                                                static_cast<curl_off_t>(seg.offset),
+                                                static_cast<curl_off_t>(seg.offset + seg.length - 1)));
+  }
+
+  HttpResponse failed;
+  uint64_t failed_at = segments_count;
+  for (uint64_t i = 0; i < segments_count && failed_at == segments_count; ++i) {
+    while (responses[i].wait_for(std::chrono::milliseconds(200)) != std::future_status::ready) {
+      ds.downloaded_length = 0;
+      for (const auto& seg : segments) {
+        ds.downloaded_length += seg.written;
+      }
+      ReportProgress(&ds);
+    }
+    HttpResponse response = responses[i].get();
+    if (response.curl_code != CURLE_OK || response.http_status_code != 206 ||
+        segments[i].written != segments[i].length) {
+      failed = response;
+      failed_at = i;
+      break;
+    }
+    hashFileRange(ds.hasher(), filepath, segments[i].offset, segments[i].length);
+  }
+
+  // The transfers still reference `segments` and `fd`.
+  cancel = true;
+  for (auto& response : responses) {
+    if (response.valid()) {
+      response.wait();
+    }
+  }
+
+  if (failed_at == segments_count) {
+    ds.downloaded_length = length;
+    ReportProgress(&ds);
+    ::close(fd);
+    return true;
+  }
+
+  if (failed.curl_code == CURLE_RANGE_ERROR || failed.http_status_code == 200) {
+    ::close(fd);
+    return false;
+  }
+  // Keep everything up to the first gap for a later resumed download.
+  const uint64_t prefix = segments[failed_at].offset + segments[failed_at].written;
+  if (::ftruncate(fd, static_cast<off_t>(prefix)) != 0) {
+    LOG_WARNING << "Could not truncate " << filepath << ": " << std::strerror(errno);
+  }
+  ::close(fd);
+  if (ds.token != nullptr && ds.token->hasAborted()) {
+    throw Uptane::Exception("image", "Download of a target was aborted");
+  }
+  throw Uptane::Exception("image", "Could not download file, error: " + failed.getStatusStr());
+}
+
+static constexpr int64_t kMaxChunkIndexSize = 16 * 1024 * 1024;
+
+// The URL of the chunk index described in the custom metadata of a Target. A
+// relative URI is relative to the directory of the Target.
+static std::string chunkIndexUrl(const Json::Value& chunk_index, const std::string& target_url) {
+  const std::string uri = chunk_index["uri"].asString();
+  if (uri.empty() || uri.find("://") != std::string::npos) {
+    return uri;
+  }
+  return target_url.substr(0, target_url.rfind('/') + 1) + uri;
+}
+
+static bool copyFileRange(int from_fd, int to_fd, uint64_t from_offset, uint64_t to_offset, uint64_t length) {
+  std::array<char, 64 * 1024> buf{};
+  while (length > 0) {
+    const ssize_t res = ::pread(from_fd, buf.data(), std::min<uint64_t>(length, buf.size()),
+                                static_cast<off_t>(from_offset));
+    if (res <= 0) {
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    size_t done = 0;
+    while (done < static_cast<size_t>(res)) {
+      const ssize_t written = ::pwrite(to_fd, buf.data() + done, static_cast<size_t>(res) - done,
+                                       static_cast<off_t>(to_offset + done));
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      done += static_cast<size_t>(written);
+    }
+    from_offset += static_cast<uint64_t>(res);
+    to_offset += static_cast<uint64_t>(res);
+    length -= static_cast<uint64_t>(res);
+  }
+  return true;
+}
+
+/**
+ * Assemble a fresh target from the chunks listed in its chunk index. Chunks
+ * that are also in one of the stored target files, e.g. the installed version,
+ * are copied from there; each run of missing chunks is downloaded with one
+ * range request. The result is then hashed as a whole, and verified like any
+ * other download.
+ *
+ * Returns false if the target can't be assembled this way, e.g. as the index
+ * can't be fetched or the server does not honour range requests; the caller
+ * then downloads the whole target. Other failures throw.
+ */
+static bool fetchTargetChunks(HttpInterface& http, INvStorage& storage, const boost::filesystem::path& images_path,
+                              const std::string& url, const std::string& filepath, DownloadMetaStruct& ds) {
+  const Json::Value& chunk_index = ds.target.custom_data()["chunk_index"];
+  const std::string index_url = chunkIndexUrl(chunk_index, url);
+  if (index_url.empty()) {
+    LOG_WARNING << "Chunk index of " << ds.target.filename() << " has no URI";
+    return false;
+  }
+  const HttpResponse response = http.get(index_url, kMaxChunkIndexSize, ds.token);
+  if (!response.isOk()) {
+    LOG_WARNING << "Could not fetch the chunk index of " << ds.target.filename() << ": " << response.getStatusStr();
+    return false;
+  }
+  if (chunk_index.isMember("sha256") &&
+      Crypto::sha256digestHex(response.body) != boost::algorithm::to_lower_copy(chunk_index["sha256"].asString())) {
+    LOG_WARNING << "Chunk index of " << ds.target.filename() << " does not match its hash";
+    return false;
+  }
+  ChunkIndex index;
+  try {
+    index = ChunkIndex::fromJson(Utils::parseJSON(response.body));
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Invalid chunk index of " << ds.target.filename() << ": " << e.what();
+    return false;
+  }
+  const uint64_t length = ds.target.length();
+  if (index.length() != length) {
+    LOG_WARNING << "Chunk index of " << ds.target.filename() << " does not match the length of the target";
+    return false;
+  }
+
+  // Where the chunks of the index can be found on the device
+  struct LocalChunk {
+    std::string path;
+    uint64_t offset;
+  };
+  std::map<std::string, LocalChunk> local;
+  for (const auto& chunk : index.chunks()) {
+    local.emplace(chunk.sha256, LocalChunk{"", 0});
+  }
+  std::set<std::string> seeds;
+  for (const auto& name : storage.getAllTargetNames()) {
+    const std::string seed = (images_path / storage.getTargetFilename(name)).string();
+    if (seed != filepath && boost::filesystem::is_regular_file(seed) &&
+        !boost::filesystem::exists(seed + kHashCheckpointSuffix)) {
+      seeds.insert(seed);
+    }
+  }
+  for (const auto& seed : seeds) {
+    try {
+      ChunkIndex::chunkFile(seed, index.params(), [&local, &seed](const Chunk& chunk) {
+        auto it = local.find(chunk.sha256);
+        if (it != local.end() && it->second.path.empty()) {
+          it->second = LocalChunk{seed, chunk.offset};
+        }
+      });
+    } catch (const std::exception& e) {
+      LOG_DEBUG << "Could not look for chunks in " << seed << ": " << e.what();
+    }
+  }
+
+  const int fd = ::open(filepath.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open file " + filepath + ": " + std::strerror(errno));
+  }
+  if (::posix_fallocate(fd, 0, static_cast<off_t>(length)) != 0 && ::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Can't allocate file " + filepath + ": " + std::strerror(errno));
+  }
+
+  std::map<std::string, int> seed_fds;
+  auto closeAll = [&fd, &seed_fds]() {
+    for (const auto& seed_fd : seed_fds) {
+      if (seed_fd.second >= 0) {
+        ::close(seed_fd.second);
+      }
+    }
+    ::close(fd);
+  };
+  std::atomic<bool> cancel{false};
+  uint64_t reused = 0;
+  const auto& chunks = index.chunks();
+  for (size_t i = 0; i < chunks.size();) {
+    const LocalChunk& found = local[chunks[i].sha256];
+    if (!found.path.empty()) {
+      auto seed_fd = seed_fds.find(found.path);
+      if (seed_fd == seed_fds.end()) {
+        seed_fd = seed_fds.emplace(found.path, ::open(found.path.c_str(), O_RDONLY | O_CLOEXEC)).first;
+      }
+      // The final hash check catches a stored file that changed after it was chunked
+      if (seed_fd->second >= 0 &&
+          copyFileRange(seed_fd->second, fd, found.offset, chunks[i].offset, chunks[i].length)) {
+        reused += chunks[i].length;
+        ds.downloaded_length = chunks[i].offset + chunks[i].length;
+        ++i;
+        continue;
+      }
+    }
+
+    // Fetch this chunk and the missing ones after it in one go
+    size_t end = i + 1;
+    while (end < chunks.size() && local[chunks[end].sha256].path.empty()) {
+      ++end;
+    }
+    SegmentMetaStruct seg;
+    seg.fd = fd;
+    seg.offset = chunks[i].offset;
+    seg.length = chunks[end - 1].offset + chunks[end - 1].length - seg.offset;
+    seg.token = ds.token;
+    seg.cancel = &cancel;
+    seg.limiter = ds.limiter;
+    const auto from = static_cast<curl_off_t>(seg.offset);
+    const auto to = static_cast<curl_off_t>(seg.offset + seg.length - 1);
+    const HttpResponse range =
+        http.downloadRangeAsync(url, SegmentDownloadHandler, SegmentProgressHandler, &seg, from, to).get();
+    if (range.curl_code != CURLE_OK || range.http_status_code != 206 || seg.written != seg.length) {
+      // Unlike a segmented download, the chunks before the failure are not a prefix of the target to resume from
+      if (::ftruncate(fd, 0) != 0) {
+        LOG_WARNING << "Could not truncate " << filepath << ": " << std::strerror(errno);
+      }
+      closeAll();
+      if (range.curl_code == CURLE_RANGE_ERROR || range.http_status_code == 200) {
+        return false;
+      }
+      if (ds.token != nullptr && ds.token->hasAborted()) {
+        throw Uptane::Exception("image", "Download of a target was aborted");
+      }
+      throw Uptane::Exception("image", "Could not download file, error: " + range.getStatusStr());
+    }
+    ds.downloaded_length = seg.offset + seg.length;
+    ReportProgress(&ds);
+    i = end;
+  }
+  closeAll();
+  LOG_INFO << "Reused " << reused << " of " << length << " bytes of " << ds.target.filename()
+           << " from stored files";
+
+  hashFileRange(ds.hasher(), filepath, 0, length);
+  ds.downloaded_length = length;
+  ReportProgress(&ds);
+  return true;
+}
+
+/**
+ * Rebuild the hasher state for the file at `filepath`. If a hash checkpoint
+ * for a prefix of the file is found, only the data after it is hashed again.
+ */
+static void restoreHasherState(MultiPartMultiHasher& hasher, const std::string& filepath) {
+  const uint64_t file_size = boost::filesystem::file_size(filepath);
+  uint64_t offset = 0;
+  const std::string checkpoint = filepath + kHashCheckpointSuffix;
+  if (boost::filesystem::exists(checkpoint)) {
+    const std::string content = Utils::readFile(checkpoint);
+    const auto sep = content.find('\n');
+    bool restored = false;
+    try {
+      const uint64_t checkpoint_offset = std::stoull(content.substr(0, sep));
+      restored = sep != std::string::npos && checkpoint_offset <= file_size &&
+                 hasher.importState(content.substr(sep + 1));
+      if (restored) {
+        offset = checkpoint_offset;
+      }
+    } catch (const std::exception&) {
+      restored = false;
+    }
+    if (restored) {
+      LOG_DEBUG << "Resuming hash of " << filepath << " at offset " << offset;
+    } else {
+      LOG_INFO << "Hash checkpoint of " << filepath << " does not match the file, hashing it again";
+    }
+  }
+
+  hashFileRange(hasher, filepath, offset, file_size - offset);
+}
+
+// Serializes the disk space checks and reservations of concurrent downloads
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::mutex disk_space_mutex;
+// Space of running downloads that the file system could not preallocate, and
+// so is not yet accounted for by statvfs()
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::atomic<uint64_t> unallocated_reserved_bytes{0};
+
+/**
+ * Reserves the disk space for the rest of a download, so that concurrent
+ * downloads can't both pass the disk space check and then run out of space.
+ * The space is allocated in the target file without changing its size, which
+ * also keeps the file in few extents. If the file system doesn't support
+ * that, the space is counted against the available space until the
+ * reservation goes out of scope.
+ */
+class DiskSpaceReservation {
+ public:
+  DiskSpaceReservation(const PackageManagerInterface& pacman, std::string filepath, uint64_t offset, uint64_t length)
+      : filepath_(std::move(filepath)), offset_(offset), length_(length) {
+    std::lock_guard<std::mutex> guard(disk_space_mutex);
+    if (!pacman.checkAvailableDiskSpace(length_)) {
+      throw std::runtime_error("Insufficient disk space available to download target");
+    }
+    preallocate();
+  }
+  ~DiskSpaceReservation() { unallocated_reserved_bytes -= unallocated_; }
+  DiskSpaceReservation(const DiskSpaceReservation&) = delete;
+  DiskSpaceReservation(DiskSpaceReservation&&) = delete;
+  DiskSpaceReservation& operator=(const DiskSpaceReservation&) = delete;
+  DiskSpaceReservation& operator=(DiskSpaceReservation&&) = delete;
+
+  // Allocates the reserved space again after the file was truncated
+  void restart() {
+    std::lock_guard<std::mutex> guard(disk_space_mutex);
+    length_ += offset_;
+    offset_ = 0;
+    preallocate();
+  }
+
+ private:
+  void preallocate() {
+    bool allocated = false;
+    const int fd = ::open(filepath_.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      allocated = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset_), static_cast<off_t>(length_)) == 0;
+      if (!allocated && errno != EOPNOTSUPP && errno != ENOSYS) {
+        LOG_DEBUG << "Could not preallocate " << filepath_ << ": " << std::strerror(errno);
+      }
+      ::close(fd);
+    }
+    unallocated_reserved_bytes -= unallocated_;
+    unallocated_ = allocated ? 0 : length_;
+    unallocated_reserved_bytes += unallocated_;
+  }
+
+  const std::string filepath_;
+  uint64_t offset_;
+  uint64_t length_;
+  uint64_t unallocated_{0};
+};
+
 bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher,
                                           const KeyManager& keys, const FetcherProgressCb& progress_cb,
                                           const api::FlowControlToken* token) {
@@ -109,11 +966,17 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
       throw Uptane::Exception("image", "No hash defined for the target");
     }
     TargetStatus exists = PackageManagerInterface::verifyTarget(target);
+    if (exists == TargetStatus::kNotFound && adoptStoredFile(*storage_, config.images_path, target)) {
+      LOG_DEBUG << "Found a stored file with the content of " << target.filename();
+      exists = PackageManagerInterface::verifyTarget(target);
+    }
     if (exists == TargetStatus::kGood) {
       LOG_INFO << "Image already downloaded; skipping download";
+      touchTargetFile(config.images_path, storage_->getTargetFilename(target.filename()));
       return true;
     }
     std::unique_ptr<DownloadMetaStruct> ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+    ds->limiter = bandwidth_limiter_.get();
     if (target.length() == 0) {
       LOG_INFO << "Skipping download of target with length 0";
       ds->fhandle = createTargetFile(target);
@@ -123,7 +986,7 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
       LOG_INFO << "Continuing incomplete download of file " << target.filename();
       auto target_check = checkTargetFile(target);
       ds->downloaded_length = target_check->first;
-      ::restoreHasherState(ds->hasher(), openTargetFile(target));
+      ::restoreHasherState(ds->hasher(), target_check->second);
       ds->fhandle = appendTargetFile(target);
     } else {
       // If the target was found, but is oversized or the hash doesn't match,
@@ -133,52 +996,134 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
     }
 
     const uint64_t required_bytes = target.length() - ds->downloaded_length;
-    if (!checkAvailableDiskSpace(required_bytes)) {
-      throw std::runtime_error("Insufficient disk space available to download target");
+    DiskSpaceReservation reservation(*this, checkTargetFile(target)->second, ds->downloaded_length, required_bytes);
+
+    if (bandwidth_limiter_ != nullptr && !bandwidth_limiter_->waitUntilResumed(token)) {
+      throw Uptane::Exception("image", "Download of a target was aborted");
     }
 
+    // Targets without a URL of their own are looked for in the Image repo
+    // mirror first, if there is one
     std::string target_url = target.uri();
+    std::string mirror_url;
     if (target_url.empty()) {
       target_url = fetcher.getRepoServer() + "/targets/" + Utils::urlEncode(target.filename());
+      if (!fetcher.getRepoMirror().empty()) {
+        mirror_url = fetcher.getRepoMirror() + "/targets/" + Utils::urlEncode(target.filename());
+      }
     }
 
-    HttpResponse response;
-    for (;;) {
-      response = http_->download(target_url, DownloadHandler, ProgressHandler, ds.get(),
-                                 static_cast<curl_off_t>(ds->downloaded_length));
-
-      if (response.curl_code == CURLE_RANGE_ERROR) {
+    bool downloaded = false;
+    if (exists != TargetStatus::kIncomplete && config.download_chunked_delta &&
+        target.custom_data()["chunk_index"].isObject()) {
+      ds->fhandle.close();
+      LOG_DEBUG << "Assembling " << target.filename() << " from its chunks";
+      downloaded = fetchTargetChunks(*http_, *storage_, config.images_path, target_url,
+                                     checkTargetFile(target)->second, *ds);
+      if (!downloaded) {
+        LOG_INFO << "Downloading " << target.filename() << " in full";
+        ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+        ds->limiter = bandwidth_limiter_.get();
+        ds->fhandle = createTargetFile(target);
+        reservation.restart();
+      }
+    }
+    if (!downloaded && exists != TargetStatus::kIncomplete && config.download_segments > 1 &&
+        target.length() >= config.download_segment_threshold) {
+      ds->fhandle.close();
+      LOG_DEBUG << "Downloading " << target.filename() << " in " << config.download_segments << " segments";
+      downloaded = fetchTargetSegments(*http_, target_url, checkTargetFile(target)->second, *ds,
+                                       config.download_segments);
+      if (!downloaded) {
         LOG_WARNING << "The image server doesn't support byte range requests,"
-                       " try to download the image from the beginning: "
+                       " downloading the image in a single stream: "
                     << target_url;
         ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+        ds->limiter = bandwidth_limiter_.get();
         ds->fhandle = createTargetFile(target);
-        continue;
+        reservation.restart();
       }
+    }
 
-      if (!response.wasInterrupted()) {
-        break;
-      }
-      ds->fhandle.close();
-      // sleep if paused or abort the download
-      if (!token->canContinue()) {
-        throw Uptane::Exception("image", "Download of a target was aborted");
+    if (!downloaded) {
+      HttpResponse response;
+      for (;;) {
+        const std::string &url = mirror_url.empty() ? target_url : mirror_url;
+        {
+          DownloadPipeline pipeline(*ds, checkTargetFile(target)->second);
+          response = http_->download(url, DownloadHandler, ProgressHandler, ds.get(),
+                                     static_cast<curl_off_t>(ds->downloaded_length));
+          pipeline.finish();
+        }
+
+        if (response.curl_code == CURLE_RANGE_ERROR) {
+          LOG_WARNING << "The image server doesn't support byte range requests,"
+                         " try to download the image from the beginning: "
+                      << target_url;
+          ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+          ds->limiter = bandwidth_limiter_.get();
+          ds->fhandle = createTargetFile(target);
+          reservation.restart();
+          continue;
+        }
+
+        if (!response.wasInterrupted()) {
+          // The mirror is not trusted: anything wrong with what it sent, including too much data or a wrong hash,
+          // is retried from the Image repo
+          if (!mirror_url.empty() && (!response.isOk() || !ds->hashesMatch())) {
+            LOG_INFO << "Could not download " << target.filename() << " from the Image repo mirror ("
+                     << (response.isOk() ? "hash mismatch" : response.getStatusStr()) << "), downloading it from "
+                     << target_url;
+            ds->fhandle.close();
+            mirror_url.clear();
+            ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+            ds->limiter = bandwidth_limiter_.get();
+            ds->fhandle = createTargetFile(target);
+            reservation.restart();
+            continue;
+          }
+          break;
+        }
+        ds->fhandle.close();
+        // sleep if paused or abort the download
+        if (!token->canContinue() ||
+            (bandwidth_limiter_ != nullptr && !bandwidth_limiter_->waitUntilResumed(token))) {
+          throw Uptane::Exception("image", "Download of a target was aborted");
+        }
+        ds->fhandle = appendTargetFile(target);
       }
-      ds->fhandle = appendTargetFile(target);
-    }
-    LOG_TRACE << "Download status: " << response.getStatusStr() << std::endl;
-    if (!response.isOk()) {
-      if (response.curl_code == CURLE_WRITE_ERROR) {
-        throw Uptane::OversizedTarget(target.filename());
+      LOG_TRACE << "Download status: " << response.getStatusStr() << std::endl;
+      if (!response.isOk()) {
+        if (response.curl_code == CURLE_WRITE_ERROR) {
+          throw Uptane::OversizedTarget(target.filename());
+        }
+        throw Uptane::Exception("image", "Could not download file, error: " + response.error_message);
       }
-      throw Uptane::Exception("image", "Could not download file, error: " + response.error_message);
     }
-    if (!target.MatchHash(Hash(ds->hash_type, ds->hasher().getHexDigest()))) {
+    if (!ds->hashesMatch()) {
       ds->fhandle.close();
       removeTargetFile(target);
       throw Uptane::TargetHashMismatch(target.filename());
     }
     ds->fhandle.close();
+    const std::string filepath = checkTargetFile(target)->second;
+    removeHashCheckpoint(filepath);
+    storeTargetVerification(*storage_, target, filepath, ds->computed_hashes);
+    const std::string filename = boost::filesystem::path(filepath).filename().string();
+    touchTargetFile(config.images_path, filename);
+    if (config.images_max_bytes > 0 && !config.images_prune_after_install) {
+      std::set<std::string> keep{filename};
+      {
+        std::lock_guard<std::mutex> guard(retained_targets_mutex_);
+        for (const auto& retained : retained_targets_) {
+          const std::string retained_file = storage_->getTargetFilename(retained.filename());
+          if (!retained_file.empty()) {
+            keep.insert(retained_file);
+          }
+        }
+      }
+      pruneTargetFiles(*storage_, config.images_path, config.images_max_bytes, keep);
+    }
     result = true;
   } catch (const std::exception& e) {
     LOG_WARNING << "Error while downloading a target: " << e.what();
@@ -187,6 +1132,94 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
 }
 
 #ifdef BUILD_OFFLINE_UPDATES
+// Size of the reads of an image from the lockbox of an offline update
+static constexpr size_t kOfflineReadSize = 1024 * 1024;
+// Suffix of the images stored zstd-compressed in a lockbox
+static const char* const kCompressedImageSuffix = ".zst";
+
+/**
+ * An image in the lockbox of an offline update, read front to back. To save
+ * space on the removable medium, and reads from it, an image can be stored
+ * zstd-compressed as `<target name>.zst` instead; it is then decompressed as it
+ * is read, and read() returns the original bytes that the Target's hashes are
+ * for. An uncompressed image takes precedence.
+ */
+class LockboxImage {
+ public:
+  LockboxImage(const boost::filesystem::path& images_path, const std::string& filename)
+      : path_(choosePath(images_path, filename)), fd_(open(path_.c_str(), O_RDONLY | O_CLOEXEC)) {
+    if (fd_.get() < 0) {
+      throw std::runtime_error("Can't read file " + path_.string() + ": " + std::strerror(errno));
+    }
+    // The image is read once, front to back
+    posix_fadvise(fd_.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (path_.filename().string() == filename) {
+      return;
+    }
+
+    archive_.reset(archive_read_new());
+    // Without zstd support in libarchive, this falls back to running zstd.
+    archive_read_support_filter_zstd(archive_.get());
+    archive_read_support_format_raw(archive_.get());
+    struct archive_entry* entry = nullptr;
+    if (archive_read_open_fd(archive_.get(), fd_.get(), kOfflineReadSize) != ARCHIVE_OK ||
+        archive_read_next_header(archive_.get(), &entry) != ARCHIVE_OK) {
+      throw std::runtime_error("Can't decompress file " + path_.string() + ": " + errorString());
+    }
+  }
+
+  bool compressed() const { return archive_ != nullptr; }
+  const boost::filesystem::path& path() const { return path_; }
+
+  /* Read up to `size` bytes of the image; returns 0 at its end. */
+  size_t read(char* buffer, size_t size) {
+    ssize_t count;
+    if (compressed()) {
+      count = archive_read_data(archive_.get(), buffer, size);
+      if (count < 0) {
+        throw std::runtime_error("Can't decompress file " + path_.string() + ": " + errorString());
+      }
+    } else {
+      do {
+        count = ::read(fd_.get(), buffer, size);
+      } while (count < 0 && errno == EINTR);
+      if (count < 0) {
+        throw std::runtime_error("Can't read file " + path_.string() + ": " + std::strerror(errno));
+      }
+    }
+
+    // Don't keep what was read in the page cache at the expense of anything else
+    const uint64_t consumed = compressed() ? static_cast<uint64_t>(archive_filter_bytes(archive_.get(), -1))
+                                           : consumed_ + static_cast<uint64_t>(count);
+    if (consumed > consumed_) {
+      posix_fadvise(fd_.get(), static_cast<off_t>(consumed_), static_cast<off_t>(consumed - consumed_),
+                    POSIX_FADV_DONTNEED);
+      consumed_ = consumed;
+    }
+    return static_cast<size_t>(count);
+  }
+
+ private:
+  static boost::filesystem::path choosePath(const boost::filesystem::path& images_path, const std::string& filename) {
+    const boost::filesystem::path compressed = images_path / (filename + kCompressedImageSuffix);
+    if (!boost::filesystem::exists(images_path / filename) && boost::filesystem::exists(compressed)) {
+      return compressed;
+    }
+    return images_path / filename;
+  }
+
+  std::string errorString() const {
+    const char* error = archive_error_string(archive_.get());
+    return error != nullptr ? error : "unknown error";
+  }
+
+  const boost::filesystem::path path_;
+  const FdGuard fd_;
+  StructGuardInt<struct archive> archive_{nullptr, archive_read_free};
+  // Bytes of the file read so far, compressed or not
+  uint64_t consumed_{0};
+};
+
 bool PackageManagerInterface::fetchTargetOffUpd(const Uptane::Target& target,
                                                 const Uptane::OfflineUpdateFetcher& fetcher, const KeyManager& keys,
                                                 const FetcherProgressCb& progress_cb,
@@ -200,71 +1233,71 @@ bool PackageManagerInterface::fetchTargetOffUpd(const Uptane::Target& target,
     }
 
     LOG_INFO << "Initiating fetching of file " << target.filename();
-    if (!checkAvailableDiskSpace(target.length())) {
-      throw std::runtime_error("Insufficient disk space available to fetch target");
-    }
-
-    auto destination_file = createTargetFile(target);
-
-    boost::filesystem::path const source_path = fetcher.getImagesPath() / target.filename();
-    std::ifstream source(source_path.string(), std::ios::binary);
-    if (!source.good()) {
-      throw std::runtime_error("Can't read file " + source_path.string());
+    LockboxImage source(fetcher.getImagesPath(), target.filename());
+    if (source.compressed()) {
+      LOG_INFO << "Decompressing " << source.path();
     }
 
-    // Find the first hash we know about
-    MultiPartHasher::Ptr hasher{};
-    for (const auto& hash : target.hashes()) {
-      hasher = MultiPartHasher::create(hash.type());
-      if (hasher) {
-        break;
-      }
-    }
-    if (!hasher) {
+    // Compute all the hashes we know about in one pass
+    DownloadMetaStruct ds(target, nullptr, token);
+    if (!ds.hasKnownHash()) {
       throw Uptane::Exception("offline", "Target does not contain a known hash type");
     }
+    ds.fhandle = createTargetFile(target);
+    const DiskSpaceReservation reservation(*this, checkTargetFile(target)->second, 0, target.length());
 
-    std::array<char, 16L * 1024> buffer{};
-    int64_t downloaded_length = 0;
+    // Large reads keep removable media streaming; the image is hashed and
+    // written on the pipeline's thread while the next block is read, and
+    // decompressed if need be.
+    std::vector<char> buffer(kOfflineReadSize);
     uint64_t last_progress = 0;
+    {
+      DownloadPipeline pipeline(ds);
+      for (;;) {
+        const size_t count = source.read(buffer.data(), buffer.size());
+        if (count == 0) {
+          break;
+        }
 
-    for (;;) {
-      source.read(buffer.data(), buffer.size());
-
-      // This is equivalent to the work done by DownloadHandler in the online case.
-      if (static_cast<uint64_t>(downloaded_length + source.gcount()) > target.length()) {
-        LOG_WARNING << "File " << target.filename() << " is bigger than expected";
-        return false;
-      }
-      destination_file.write(buffer.data(), source.gcount());
-      hasher->update(buffer.data(), source.gcount());
-      downloaded_length += source.gcount();
+        // This is equivalent to the work done by DownloadHandler in the online case.
+        if (ds.downloaded_length + static_cast<uint64_t>(count) > target.length()) {
+          LOG_WARNING << "File " << target.filename() << " is bigger than expected";
+          return false;
+        }
+        if (!pipeline.push(buffer.data(), count)) {
+          break;
+        }
+        ds.downloaded_length += static_cast<uint64_t>(count);
 
-      // This is equivalent to the work done by ProgressHandler in the online case.
-      auto progress = (static_cast<uint64_t>(downloaded_length * 100)) / target.length();
-      if (progress_cb && (progress > last_progress)) {
-        last_progress = progress;
-        progress_cb(target, "Fetching", static_cast<unsigned int>(progress));
-      }
+        // This is equivalent to the work done by ProgressHandler in the online case.
+        auto progress = (ds.downloaded_length * 100) / target.length();
+        if (progress_cb && (progress > last_progress)) {
+          last_progress = progress;
+          progress_cb(target, "Fetching", static_cast<unsigned int>(progress));
+        }
 
-      if (source.gcount() == 0) {
-        break;
+        if (token != nullptr && token->hasAborted()) {
+          throw Uptane::Exception("image", "Fetching of a target was aborted");
+        }
       }
-      if (token != nullptr && token->hasAborted()) {
-        throw Uptane::Exception("image", "Fetching of a target was aborted");
+      try {
+        pipeline.finish();
+      } catch (const std::exception&) {
+        // A write error is assumed to be due to file size like in the online case.
+        throw Uptane::OversizedTarget(target.filename());
       }
     }
 
-    destination_file.close();
-    if (!destination_file) {
-      // A write error is assumed to be due to file size like in the online case.
+    ds.fhandle.close();
+    if (!ds.fhandle) {
       throw Uptane::OversizedTarget(target.filename());
     }
 
-    if (!target.MatchHash(hasher->getHash())) {
+    if (!ds.hashesMatch()) {
       removeTargetFile(target);
       throw Uptane::TargetHashMismatch(target.filename());
     }
+    storeTargetVerification(*storage_, target, checkTargetFile(target)->second, ds.computed_hashes);
     LOG_DEBUG << "Successfully fetched  " << target.filename();
     return true;
   } catch (const std::exception& e) {
@@ -287,14 +1320,25 @@ TargetStatus PackageManagerInterface::verifyTarget(const Uptane::Target& target)
     return TargetStatus::kOversized;
   }
 
-  // Even if the file exists and the length matches, recheck the hash.
+  // Trust the digests recorded when the file was last verified, as long as it did not change since.
+  TargetFileVerification recorded;
+  TargetFileVerification current;
+  if (storage_->loadTargetVerification(target.filename(), &recorded) &&
+      statTargetFile(target_exists->second, &current) && recorded.real_size == current.real_size &&
+      recorded.mtime == current.mtime && recorded.ctime == current.ctime && recorded.inode == current.inode &&
+      verificationMatches(target, recorded)) {
+    return TargetStatus::kGood;
+  }
+
+  // Otherwise, even if the file exists and the length matches, recheck the hash.
   DownloadMetaStruct ds(target, nullptr, nullptr);
   ds.downloaded_length = target_exists->first;
-  ::restoreHasherState(ds.hasher(), openTargetFile(target));
-  if (!target.MatchHash(Hash(ds.hash_type, ds.hasher().getHexDigest()))) {
+  ::restoreHasherState(ds.hasher(), target_exists->second);
+  if (!ds.hashesMatch()) {
     LOG_ERROR << "Target exists with expected length, but hash does not match metadata! " << target;
     return TargetStatus::kHashMismatch;
   }
+  storeTargetVerification(*storage_, target, target_exists->second, ds.computed_hashes);
 
   return TargetStatus::kGood;
 }
@@ -306,7 +1350,8 @@ bool PackageManagerInterface::checkAvailableDiskSpace(const uint64_t required_by
     LOG_WARNING << "Unable to read filesystem statistics: error code " << stat_res;
     return true;
   }
-  const uint64_t available_bytes = (static_cast<uint64_t>(stvfsbuf.f_bsize) * stvfsbuf.f_bavail);
+  uint64_t available_bytes = (static_cast<uint64_t>(stvfsbuf.f_bsize) * stvfsbuf.f_bavail);
+  available_bytes -= std::min<uint64_t>(available_bytes, unallocated_reserved_bytes);
   const uint64_t reserved_bytes = 1 << 20;
 
   if (required_bytes + reserved_bytes < available_bytes) {
@@ -342,10 +1387,177 @@ std::ifstream PackageManagerInterface::openTargetFile(const Uptane::Target& targ
   return stream;
 }
 
+namespace {
+/**
+ * Hands out the chunks of a download running on its own thread, see
+ * PackageManagerInterface::streamTarget(). The newest chunk is only handed
+ * out once the next one has arrived or the download has been checked, so a
+ * reader never gets all of an image that fails the checks.
+ */
+class TargetDownloadBuf : public std::streambuf {
+ public:
+  TargetDownloadBuf(std::shared_ptr<HttpInterface> http, std::string url, Uptane::Target target, uint64_t from,
+                    size_t buffer_size)
+      : http_(std::move(http)),
+        url_(std::move(url)),
+        target_(std::move(target)),
+        from_(from),
+        buffer_size_(buffer_size),
+        hasher_(hashTypes(target_)) {
+    producer_ = std::thread([this]() { run(); });
+  }
+  ~TargetDownloadBuf() override {
+    {
+      std::lock_guard<std::mutex> guard(m_);
+      cancelled_ = true;
+    }
+    cv_.notify_all();
+    producer_.join();
+  }
+  TargetDownloadBuf(const TargetDownloadBuf&) = delete;
+  TargetDownloadBuf(TargetDownloadBuf&&) = delete;
+  TargetDownloadBuf& operator=(const TargetDownloadBuf&) = delete;
+  TargetDownloadBuf& operator=(TargetDownloadBuf&&) = delete;
+
+ protected:
+  int_type underflow() override {
+    std::unique_lock<std::mutex> lock(m_);
+    cv_.wait(lock, [this]() { return done_ || chunks_.size() > 1; });
+    if (chunks_.empty() || failed_) {
+      return traits_type::eof();
+    }
+    current_ = std::move(chunks_.front());
+    chunks_.pop_front();
+    buffered_ -= current_.size();
+    budget_.shrink(current_.size());
+    lock.unlock();
+    cv_.notify_all();
+    setg(current_.data(), current_.data(), current_.data() + current_.size());
+    return traits_type::to_int_type(*gptr());
+  }
+
+ private:
+  static std::vector<Hash::Type> hashTypes(const Uptane::Target& target) {
+    std::vector<Hash::Type> types;
+    for (const auto& hash : target.hashes()) {
+      types.push_back(hash.type());
+    }
+    return types;
+  }
+
+  static size_t write(char* contents, size_t size, size_t nmemb, void* userp) {
+    auto* buf = static_cast<TargetDownloadBuf*>(userp);
+    const size_t length = size * nmemb;
+    if (buf->received_ + length > buf->target_.length() - buf->from_) {
+      return length + 1;  // curl will abort if return unexpected size;
+    }
+    buf->hasher_.update(reinterpret_cast<const unsigned char*>(contents), length);
+
+    std::unique_lock<std::mutex> lock(buf->m_);
+    // Two chunks are always kept, so that the download goes on however small the budget is
+    buf->cv_.wait(lock, [buf, length]() {
+      if (buf->cancelled_) {
+        return true;
+      }
+      if (buf->chunks_.size() <= 1) {
+        buf->budget_.grow(length);
+        return true;
+      }
+      return buf->buffered_ + length <= buf->buffer_size_ && buf->budget_.tryGrow(length);
+    });
+    if (buf->cancelled_) {
+      return 0;
+    }
+    buf->chunks_.emplace_back(contents, contents + length);
+    buf->buffered_ += length;
+    buf->received_ += length;
+    lock.unlock();
+    buf->cv_.notify_all();
+    return length;
+  }
+
+  void run() {
+    // A reader that falls behind slows the download down, which the server or
+    // the low speed limit may cut off; the download then continues where it stopped
+    HttpResponse response;
+    for (int attempt = 0; attempt < kAttempts; ++attempt) {
+      response = http_->download(url_, write, nullptr, this, static_cast<curl_off_t>(from_ + received_));
+      if (response.isOk() || response.curl_code == CURLE_WRITE_ERROR || response.curl_code == CURLE_RANGE_ERROR) {
+        break;
+      }
+      LOG_WARNING << "Download of " << target_.filename() << " was interrupted: " << response.getStatusStr();
+    }
+    bool good = response.isOk() && from_ + received_ == target_.length();
+    if (!good) {
+      LOG_ERROR << "Could not download " << target_.filename() << ": " << response.getStatusStr();
+    } else if (from_ == 0) {
+      for (const auto& hash : hasher_.getHashes()) {
+        if (!target_.MatchHash(hash)) {
+          LOG_ERROR << "Hash mismatch for " << target_.filename();
+          good = false;
+        }
+      }
+    }
+    {
+      std::lock_guard<std::mutex> guard(m_);
+      failed_ = !good;
+      done_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  static constexpr int kAttempts = 3;
+
+  const std::shared_ptr<HttpInterface> http_;
+  const std::string url_;
+  const Uptane::Target target_;
+  const uint64_t from_;
+  const size_t buffer_size_;
+  // Only used by the download thread
+  MultiPartMultiHasher hasher_;
+  uint64_t received_{0};
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<std::vector<char>> chunks_;
+  size_t buffered_{0};
+  MemoryBudget::Reservation budget_;
+  bool done_{false};
+  bool failed_{false};
+  bool cancelled_{false};
+  std::vector<char> current_;
+  std::thread producer_;
+};
+
+class TargetDownloadStream : public std::istream {
+ public:
+  TargetDownloadStream(std::shared_ptr<HttpInterface> http, std::string url, Uptane::Target target, uint64_t from,
+                       size_t buffer_size)
+      : std::istream(nullptr), buf_(std::move(http), std::move(url), std::move(target), from, buffer_size) {
+    rdbuf(&buf_);
+  }
+
+ private:
+  TargetDownloadBuf buf_;
+};
+}  // namespace
+
+std::unique_ptr<std::istream> PackageManagerInterface::streamTarget(const Uptane::Target& target,
+                                                                    const std::string& repo_server, uint64_t from,
+                                                                    size_t buffer_size) const {
+  std::string target_url = target.uri();
+  if (target_url.empty()) {
+    target_url = repo_server + "/targets/" + Utils::urlEncode(target.filename());
+  }
+  LOG_DEBUG << "Streaming " << target.filename() << " from byte " << from;
+  return std_::make_unique<TargetDownloadStream>(http_, target_url, target, from, buffer_size);
+}
+
 std::ofstream PackageManagerInterface::createTargetFile(const Uptane::Target& target) {
   std::string filename = target.hashes()[0].HashString();
   std::string filepath = (config.images_path / filename).string();
   boost::filesystem::create_directories(config.images_path);
+  removeHashCheckpoint(filepath);
   std::ofstream stream(filepath, std::ios::binary | std::ios::ate);
   if (!stream.good()) {
     throw std::runtime_error("Can't write to file " + filepath);
@@ -372,8 +1584,30 @@ void PackageManagerInterface::removeTargetFile(const Uptane::Target& target) {
     LOG_WARNING << "PackageManagerInterface::removeTargetFile failed. Target doesn't exist: " + target.filename();
     return;
   }
-  boost::filesystem::remove(file->second);
+  const std::string filename = storage_->getTargetFilename(target.filename());
   storage_->deleteTargetInfo(target.filename());
+  // Keep the file while other Target names still refer to it
+  for (const auto& name : storage_->getAllTargetNames()) {
+    if (storage_->getTargetFilename(name) == filename) {
+      return;
+    }
+  }
+  boost::filesystem::remove(file->second);
+  removeHashCheckpoint(file->second);
+}
+
+void PackageManagerInterface::pruneStoredTargets(const std::vector<Uptane::Target>& retain) {
+  if (config.images_max_bytes == 0) {
+    return;
+  }
+  std::set<std::string> keep;
+  for (const auto& target : retain) {
+    const std::string filename = storage_->getTargetFilename(target.filename());
+    if (!filename.empty()) {
+      keep.insert(filename);
+    }
+  }
+  pruneTargetFiles(*storage_, config.images_path, config.images_max_bytes, keep);
 }
 
 std::vector<Uptane::Target> PackageManagerInterface::getTargetFiles() {
@@ -1,4 +1,5 @@
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 
@@ -6,10 +7,20 @@
 
 #include "libaktualizr/aktualizr.h"
 #include "libaktualizr/events.h"
+#include "logging/metrics.h"
+#include "logging/tracing.h"
+#include "primary/event_dispatcher.h"
+#include "primary/notification_listener.h"
 #include "primary/sotauptaneclient.h"
 #include "primary/update_lock_file.h"
 #include "utilities/apiqueue.h"
+#include "utilities/bandwidth_limiter.h"
+#include "utilities/memory_budget.h"
+#include "utilities/process_stats.h"
+#include "utilities/resource_policy.h"
+#include "utilities/retry_policy.h"
 #include "utilities/timer.h"
+#include "utilities/utils.h"
 
 using std::make_shared;
 using std::move;
@@ -17,29 +28,77 @@ using std::shared_ptr;
 
 namespace bf = boost::filesystem;
 
+namespace {
+
+// Passes the future of a command to `done` on the thread that dispatches `completions`
+template <class R>
+std::function<void(std::future<R>)> postTo(const std::shared_ptr<api::CompletionQueue> &completions,
+                                           Aktualizr::Completion<R> done) {
+  return [completions, done](std::future<R> result) {
+    auto ready = std::make_shared<std::future<R>>(std::move(result));
+    completions->post([done, ready]() { done(std::move(*ready)); });
+  };
+}
+
+}  // namespace
+
 Aktualizr::Aktualizr(const Config &config)
     : Aktualizr(config, INvStorage::newStorage(config.storage), std::make_shared<HttpClient>()) {}
 
 Aktualizr::Aktualizr(Config config, std::shared_ptr<INvStorage> storage_in,
                      const std::shared_ptr<HttpInterface> &http_in)
     : config_{std::move(config)},
+      poll_scheduler_{config_.uptane},
       sig_{new event::Channel()},
       api_queue_{new api::CommandQueue()},
-      update_lock_file_{config_.uptane.update_lock_file} {
+      update_lock_file_{config_.uptane.update_lock_file},
+      http_{http_in} {
   if (sodium_init() == -1) {  // Note that sodium_init doesn't require a matching 'sodium_deinit'
     throw std::runtime_error("Unable to initialize libsodium");
   }
 
+  Tracer::instance().configure(config_.tracing);
+  Metrics::instance().setOutput(config_.telemetry.metrics_file);
+  MemoryBudget::instance().setLimit(config_.memory.buffer_budget);
+  ResourcePolicies::instance().configure(config_.resources);
   storage_ = std::move(storage_in);
   storage_->importData(config_.import);
 
-  uptane_client_ = std::make_shared<SotaUptaneClient>(config_, storage_, http_in, sig_, api_queue_->FlowControlToken());
+  auto client_events = sig_;
+  if (config_.uptane.event_queue_size > 0) {
+    event_dispatcher_ =
+        std_::make_unique<AsyncEventDispatcher>(sig_, static_cast<size_t>(config_.uptane.event_queue_size));
+    client_events = std::make_shared<event::Channel>();
+    event_dispatcher_connection_ = client_events->connect(
+        [this](const std::shared_ptr<event::BaseEvent> &event) { event_dispatcher_->enqueue(event); });
+  }
+  uptane_client_ =
+      std::make_shared<SotaUptaneClient>(config_, storage_, http_in, client_events, api_queue_->FlowControlToken());
 }
 
-Aktualizr::~Aktualizr() { api_queue_.reset(nullptr); }
+Aktualizr::~Aktualizr() {
+  notification_listener_.reset();
+  api_queue_.reset(nullptr);
+  // Stop taking events from the client, then deliver what is still queued
+  event_dispatcher_connection_.disconnect();
+  event_dispatcher_.reset();
+  Tracer::instance().flush();
+  Metrics::instance().flush();
+}
 
 void Aktualizr::Initialize() {
-  uptane_client_->initialize();
+  uptane_client_->initialize(config_.uptane.deferred_startup);
+  if (config_.uptane.deferred_startup) {
+    // Queued ahead of everything else, so later commands see a completed startup
+    std::function<void()> task([this]() {
+      try {
+        uptane_client_->completeStartup();
+      } catch (const std::exception &e) {
+        LOG_ERROR << "Deferred startup failed: " << e.what();
+      }
+    });
+    api_queue_->enqueue(std::move(task), api::Lane::kControl);
+  }
   api_queue_->run();
 }
 
@@ -90,6 +149,9 @@ std::ostream &operator<<(std::ostream &os, Aktualizr::UpdateCycleState state) {
     case Aktualizr::UpdateCycleState::kDownloading:
       os << "Downloading";
       break;
+    case Aktualizr::UpdateCycleState::kPredownloading:
+      os << "Predownloading";
+      break;
     case Aktualizr::UpdateCycleState::kInstalling:
       os << "Installing";
       break;
@@ -123,6 +185,21 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
     next_offline_poll_ = Clock::now() + std::chrono::hours(24 * 365 * 10);
   }
 
+  // Exit while idle, to be started again by e.g. a systemd timer
+  const bool idle_exit = config_.uptane.idle_exit_sec > 0 && config_.uptane.notification_url.empty() &&
+                         !config_.uptane.enable_offline_updates && exit_cond_.get() == RunMode::kUntilRebootNeeded;
+  // Started again after exiting while idle: wait for the check that was due next
+  bool resumed = false;
+  Clock::time_point resumed_poll;
+  if (idle_exit) {
+    const auto wall_now = std::chrono::system_clock::now();
+    const auto next_check = poll_scheduler_.load(pollStateFile(), wall_now);
+    resumed = !!next_check;
+    if (resumed) {
+      resumed_poll = Clock::now() + std::chrono::duration_cast<Clock::duration>(*next_check - wall_now);
+    }
+  }
+
   int64_t loops = 0;
   Clock::time_point marker_time;
 
@@ -151,12 +228,14 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
         case UpdateCycleState::kSendingManifest:
         case UpdateCycleState::kCheckingForUpdates:
         case UpdateCycleState::kDownloading:
+        case UpdateCycleState::kPredownloading:
         case UpdateCycleState::kInstalling:
           // In these cases we need to poll for Offline updates
           if (OfflineUpdateAvailable()) {
             api_queue_->abort();
             // TODO: How can we send an 'update failed' the next time we have idle network
             op_update_check_ = CheckUpdatesOffline(config_.uptane.offline_updates_source);
+            release_memory_pending_ = true;
             state_ = UpdateCycleState::kCheckingForUpdatesOffline;
           }
           break;
@@ -181,12 +260,23 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
           op_bool_ = AttemptProvision();
         } else if (op_bool_.valid() && op_bool_.wait_until(next_offline_poll_) == std::future_status::ready) {
           if (op_bool_.get()) {
-            // Provisioned OK, send device data
-            op_void_ = SendDeviceData();
-            state_ = UpdateCycleState::kSendingDeviceData;
+            if (resumed) {
+              // The device data was sent before exiting
+              resumed = false;
+              next_online_poll_ = resumed_poll;
+              state_ = UpdateCycleState::kIdle;
+            } else if (config_.uptane.deferred_startup) {
+              // Provisioned OK, device data can wait until the first update check is done
+              device_data_pending_ = true;
+              state_ = UpdateCycleState::kIdle;
+            } else {
+              // Provisioned OK, send device data
+              op_void_ = SendDeviceData();
+              state_ = UpdateCycleState::kSendingDeviceData;
+            }
           } else {
             // If we didn't provision, then stay in this state. We'll wait until next_online_poll_ before trying again
-            next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kFailed);
           }
           op_bool_ = {};  // Clear future
         } else {
@@ -206,36 +296,70 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
           state_ = UpdateCycleState::kIdle;
         }
         break;
-      case UpdateCycleState::kIdle:
+      case UpdateCycleState::kIdle: {
         update_lock_file_.UpdateComplete();
-        if (next_online_poll_ <= now) {
+        startNotificationListener();
+        const bool notified = update_notified_.exchange(false);
+        if (notified || next_online_poll_ <= now) {
+          // Replaced when the check is done
           next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
           if (!config_.uptane.enable_online_updates) {
             state_ = UpdateCycleState::kIdle;
             break;
           }
           op_update_check_ = CheckUpdates();
+          release_memory_pending_ = true;
           state_ = UpdateCycleState::kCheckingForUpdates;
+        } else if (device_data_pending_) {
+          device_data_pending_ = false;
+          op_void_ = SendDeviceData();
+          state_ = UpdateCycleState::kSendingDeviceData;
         } else {
           // Idle
+          Tracer::instance().flush();
+          Metrics::instance().flush();
+          if (release_memory_pending_) {
+            // Once per cycle, while the database is not otherwise in use
+            storage_->idleMaintenance();
+            // The metadata of the cycle has been freed by now, in many small pieces
+            Utils::releaseFreeMemory();
+            release_memory_pending_ = false;
+          }
           std::unique_lock<std::mutex> guard{exit_cond_.m};
           if (exit_cond_.run_mode == RunMode::kOnce) {
             // We've performed one round of checks, exit from 'once' runmode.
             exit_cond_.run_mode = RunMode::kStop;
             return ExitReason::kNoUpdates;
           }
+          const auto until_poll = next_online_poll_ - now;
+          if (idle_exit && !update_notified_ && until_poll >= std::chrono::seconds(config_.uptane.idle_exit_sec)) {
+            poll_scheduler_.save(pollStateFile(),
+                                 std::chrono::system_clock::now() +
+                                     std::chrono::duration_cast<std::chrono::system_clock::duration>(until_poll));
+            LOG_INFO << "Exiting until the next update check in "
+                     << std::chrono::duration_cast<std::chrono::seconds>(until_poll).count() << "s";
+            exit_cond_.run_mode = RunMode::kStop;
+            exit_cond_.cv.notify_all();
+            return ExitReason::kIdle;
+          }
           auto next_wake_up = std::min(next_offline_poll_, next_online_poll_);
-          exit_cond_.cv.wait_until(guard, next_wake_up);
+          if (!update_notified_) {
+            exit_cond_.cv.wait_until(guard, next_wake_up);
+          }
         }
         break;
+      }
       case UpdateCycleState::kSendingManifest:
         if (op_bool_.wait_until(next_offline_poll_) == std::future_status::ready) {
-          next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
           try {
-            op_bool_.get();
+            // The next check was scheduled when the manifest was sent, unless that fails
+            if (!op_bool_.get()) {
+              scheduleOnlinePoll(now, PollScheduler::Outcome::kFailed);
+            }
             state_ = UpdateCycleState::kIdle;
           } catch (SotaUptaneClient::ProvisioningFailed &) {
             LOG_INFO << "Didn't put manifest to server because the device was not able to provision";
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kFailed);
             // We can get to this state when doing an offline update
             state_ = UpdateCycleState::kUnprovisioned;
           }
@@ -245,17 +369,35 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
         if (op_update_check_.wait_until(next_offline_poll_) == std::future_status::ready) {
           result::UpdateCheck const update_result = op_update_check_.get();
           if (update_lock_file_.ShouldUpdate() == UpdateLockFile::kNoUpdate) {
-            next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+            scheduleOnlinePoll(now, update_result.updates.empty() ? PollScheduler::Outcome::kIdle
+                                                                   : PollScheduler::Outcome::kActive);
+            const auto &updates = update_result.updates;
+            const bool predownloaded =
+                updates.size() == predownloaded_.size() &&
+                std::equal(updates.cbegin(), updates.cend(), predownloaded_.cbegin(),
+                           [](const Uptane::Target &a, const Uptane::Target &b) { return a.MatchTarget(b); });
+            if (!updates.empty() && !predownloaded && inPredownloadWindow()) {
+              // Not allowed to install yet, but then only the installation is left to do
+              LOG_INFO << "Downloading " << updates.size() << " targets ahead of being allowed to install them";
+              predownload_handles_ = uptane_client_->makeDownloadHandles(updates);
+              std::function<result::Download()> task([this, updates, handles = predownload_handles_]() {
+                return uptane_client_->predownloadImages(updates, handles);
+              });
+              op_download_ = api_queue_->enqueue(std::move(task), api::Lane::kBulk);
+              state_ = UpdateCycleState::kPredownloading;
+              break;
+            }
             state_ = UpdateCycleState::kIdle;
             break;
           }
           if (update_result.updates.empty()) {
             if (update_result.status == result::UpdateStatus::kError) {
+              scheduleOnlinePoll(now, PollScheduler::Outcome::kFailed);
               op_bool_ = SendManifest();
               state_ = UpdateCycleState::kSendingManifest;
               break;
             }
-            next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
             state_ = UpdateCycleState::kIdle;
             break;
           }
@@ -270,11 +412,12 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
           if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
             if (download_result.status != result::DownloadStatus::kNothingToDownload) {
               // If the download failed, inform the backend immediately.
+              scheduleOnlinePoll(now, PollScheduler::Outcome::kFailed);
               op_bool_ = SendManifest();
               state_ = UpdateCycleState::kSendingManifest;
               break;
             }
-            next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
             state_ = UpdateCycleState::kIdle;
             break;
           }
@@ -282,6 +425,25 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
           state_ = UpdateCycleState::kInstalling;
         }
         break;
+      case UpdateCycleState::kPredownloading:
+        if (!predownload_handles_.empty() && !inPredownloadWindow()) {
+          // What was fetched so far is kept, and resumed in the next window or
+          // by the download before the installation
+          LOG_INFO << "The pre-download window has ended, stopping the pre-download";
+          for (auto &handle : predownload_handles_) {
+            handle->Cancel();
+          }
+          predownload_handles_.clear();
+        }
+        if (op_download_.wait_until(next_offline_poll_) == std::future_status::ready) {
+          result::Download const download_result = op_download_.get();
+          if (download_result.status == result::DownloadStatus::kSuccess) {
+            predownloaded_ = download_result.updates;
+          }
+          predownload_handles_.clear();
+          state_ = UpdateCycleState::kIdle;
+        }
+        break;
       case UpdateCycleState::kInstalling:
         if (op_install_.wait_until(next_offline_poll_) == std::future_status::ready) {
           if (uptane_client_->isInstallCompletionRequired()) {
@@ -291,11 +453,12 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
           if (!uptane_client_->hasPendingUpdates()) {
             // If updates were applied and no any reboot/finalization is required then send/put manifest
             // as soon as possible, don't wait for config_.uptane.polling_sec
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
             op_bool_ = SendManifest();
             state_ = UpdateCycleState::kSendingManifest;
             break;
           }
-          next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+          scheduleOnlinePoll(now, PollScheduler::Outcome::kActive);
           state_ = UpdateCycleState::kIdle;
         }
         break;
@@ -303,11 +466,12 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
       case UpdateCycleState::kCheckingForUpdatesOffline: {
         result::UpdateCheck const update_result = op_update_check_.get();  // No need to timeout
         if (update_result.updates.empty() || update_lock_file_.ShouldUpdate() == UpdateLockFile::kNoUpdate) {
-          next_online_poll_ = now + std::chrono::seconds(config_.uptane.polling_sec);
+          scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
           state_ = UpdateCycleState::kIdle;
           break;
         }
         if (update_result.status == result::UpdateStatus::kError) {
+          scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
           op_bool_ = SendManifest();
           state_ = UpdateCycleState::kSendingManifest;
           break;
@@ -320,6 +484,7 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
         result::Download const download_result = op_download_.get();
         if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
           if (download_result.status != result::DownloadStatus::kNothingToDownload) {
+            scheduleOnlinePoll(now, PollScheduler::Outcome::kIdle);
             op_bool_ = SendManifest();
             state_ = UpdateCycleState::kSendingManifest;
             break;
@@ -351,6 +516,8 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
         //    is true if any ecu is pending. I'm not aware of any system that can get into this
         //    state.
         // Kick off a manifest send now anyway
+        scheduleOnlinePoll(now, uptane_client_->hasPendingUpdates() ? PollScheduler::Outcome::kActive
+                                                                    : PollScheduler::Outcome::kIdle);
         op_bool_ = SendManifest();
         state_ = UpdateCycleState::kSendingManifest;
         break;
@@ -372,6 +539,49 @@ Aktualizr::ExitReason Aktualizr::RunUpdateLoop() {
   return ExitReason::kStopRequested;
 }
 
+void Aktualizr::scheduleOnlinePoll(Clock::time_point now, PollScheduler::Outcome outcome) {
+  if (!poll_scheduler_.hasDeviceSeed()) {
+    std::string device_id;
+    if (storage_->loadDeviceId(&device_id)) {
+      poll_scheduler_.setDeviceSeed(device_id);
+    }
+  }
+  auto interval = poll_scheduler_.next(outcome, uptane_client_->takePollHint());
+  if (outcome == PollScheduler::Outcome::kIdle && notification_listener_ != nullptr &&
+      notification_listener_->connected()) {
+    // The server tells us about updates, polling is only a safety net
+    interval = std::max<std::chrono::milliseconds>(interval,
+                                                   std::chrono::seconds(config_.uptane.notification_polling_sec));
+  }
+  if (outcome == PollScheduler::Outcome::kFailed) {
+    LOG_INFO << "Next update check in " << std::chrono::duration_cast<std::chrono::seconds>(interval).count()
+             << "s, after " << poll_scheduler_.failures() << " failed attempts";
+  }
+  next_online_poll_ = now + interval;
+}
+
+bool Aktualizr::inPredownloadWindow() const {
+  // Checked by Config::postUpdateValues()
+  const auto windows = BandwidthLimiter::parseWindows(config_.uptane.predownload_windows, false);
+  const int minute = minute_of_day_ ? minute_of_day_() : BandwidthLimiter::localMinuteOfDay();
+  return BandwidthLimiter::findWindow(windows, minute) != nullptr;
+}
+
+void Aktualizr::startNotificationListener() {
+  if (notification_listener_ != nullptr || config_.uptane.notification_url.empty() ||
+      exit_cond_.get() != RunMode::kUntilRebootNeeded) {
+    return;
+  }
+  notification_listener_ = std_::make_unique<NotificationListener>(
+      config_.uptane.notification_url, http_,
+      [this]() {
+        update_notified_ = true;
+        std::lock_guard<std::mutex> const lock{exit_cond_.m};
+        exit_cond_.cv.notify_all();
+      },
+      std::chrono::seconds(1), std::chrono::seconds(config_.uptane.polling_max_sec));
+}
+
 void Aktualizr::Shutdown() {
   std::lock_guard<std::mutex> const guard{exit_cond_.m};
   exit_cond_.run_mode = RunMode::kStop;
@@ -400,7 +610,7 @@ std::future<bool> Aktualizr::AttemptProvision() {
 
 std::future<result::CampaignCheck> Aktualizr::CampaignCheck() {
   std::function<result::CampaignCheck()> task([this] { return uptane_client_->campaignCheck(); });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), api::Lane::kControl);
 }
 
 std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, campaign::Cmd cmd) {
@@ -419,22 +629,51 @@ std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, cam
         break;
     }
   });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), api::Lane::kControl);
 }
 
 void Aktualizr::SetCustomHardwareInfo(Json::Value hwinfo) { uptane_client_->setCustomHardwareInfo(std::move(hwinfo)); }
 std::future<void> Aktualizr::SendDeviceData() {
-  std::function<void()> task([this] { uptane_client_->sendDeviceData(); });
-  return api_queue_->enqueue(std::move(task));
+  std::function<void()> task([this] { retryDeviceData(uptane_client_->sendDeviceData()); });
+  return api_queue_->enqueue(std::move(task), api::Lane::kControl);
 }
 
 // FIXME: [TDX] This solution must be reviewed (we should probably have a method to be used just for the data proxy).
 std::future<void> Aktualizr::SendDeviceData(const Json::Value &hwinfo) {
   std::function<void()> task([this, hwinfo] {
     uptane_client_->setCustomHardwareInfo(hwinfo);
-    uptane_client_->sendDeviceData();
+    retryDeviceData(uptane_client_->sendDeviceData());
   });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), api::Lane::kControl);
+}
+
+void Aktualizr::retryDeviceData(bool sent) {
+  static const RetryPolicy kPolicy{0, std::chrono::seconds(30), std::chrono::minutes(30), 2.0, 0.5};
+  if (sent) {
+    device_data_retries_ = 0;
+    return;
+  }
+  // A single attempt is scheduled, however many sends failed
+  if (device_data_retry_scheduled_.exchange(true)) {
+    return;
+  }
+  const auto delay = kPolicy.delay(++device_data_retries_);
+  LOG_INFO << "Sending device data again in " << std::chrono::duration_cast<std::chrono::seconds>(delay).count()
+           << "s";
+  auto ran = std::make_shared<std::atomic<bool>>(false);
+  auto retry = std::make_shared<api::Command<void>>([this, ran] {
+    *ran = true;
+    device_data_retry_scheduled_ = false;
+    retryDeviceData(uptane_client_->sendDeviceData());
+  });
+  // Abort() drops the retry without running it, so that the next failure can schedule one again
+  retry->OnComplete([this, ran] {
+    if (!*ran) {
+      device_data_retry_scheduled_ = false;
+    }
+  });
+  // Waits in the queue rather than on a worker thread
+  api_queue_->enqueueAfter(delay, std::move(retry), api::Lane::kControl);
 }
 
 std::future<void> Aktualizr::CompleteSecondaryUpdates() {
@@ -450,7 +689,19 @@ std::future<result::UpdateCheck> Aktualizr::CheckUpdates() {
 std::future<result::Download> Aktualizr::Download(const std::vector<Uptane::Target> &updates, UpdateType update_type) {
   std::function<result::Download()> task(
       [this, updates, update_type]() { return uptane_client_->downloadImages(updates, update_type); });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), api::Lane::kBulk);
+}
+
+std::future<result::Download> Aktualizr::Download(const std::vector<Uptane::Target> &updates, UpdateType update_type,
+                                                  std::vector<api::TargetDownloadHandle> *handles) {
+  auto controls = uptane_client_->makeDownloadHandles(updates);
+  if (handles != nullptr) {
+    *handles = controls;
+  }
+  std::function<result::Download()> task([this, updates, update_type, controls]() {
+    return uptane_client_->downloadImages(updates, update_type, controls);
+  });
+  return api_queue_->enqueue(std::move(task), api::Lane::kBulk);
 }
 
 std::future<result::Install> Aktualizr::Install(const std::vector<Uptane::Target> &updates, UpdateType update_type) {
@@ -459,13 +710,41 @@ std::future<result::Install> Aktualizr::Install(const std::vector<Uptane::Target
   return api_queue_->enqueue(std::move(task));
 }
 
+void Aktualizr::CheckUpdates(const std::shared_ptr<api::CompletionQueue> &completions,
+                             Completion<result::UpdateCheck> done) {
+  std::function<result::UpdateCheck()> task([this] { return uptane_client_->fetchMeta(); });
+  api_queue_->enqueue(std::move(task), api::Lane::kMetadata, postTo(completions, std::move(done)));
+}
+
+void Aktualizr::Download(const std::vector<Uptane::Target> &updates,
+                         const std::shared_ptr<api::CompletionQueue> &completions, Completion<result::Download> done,
+                         UpdateType update_type) {
+  std::function<result::Download()> task(
+      [this, updates, update_type]() { return uptane_client_->downloadImages(updates, update_type); });
+  api_queue_->enqueue(std::move(task), api::Lane::kBulk, postTo(completions, std::move(done)));
+}
+
+void Aktualizr::Install(const std::vector<Uptane::Target> &updates,
+                        const std::shared_ptr<api::CompletionQueue> &completions, Completion<result::Install> done,
+                        UpdateType update_type) {
+  std::function<result::Install()> task(
+      [this, updates, update_type] { return uptane_client_->uptaneInstall(updates, update_type); });
+  api_queue_->enqueue(std::move(task), api::Lane::kMetadata, postTo(completions, std::move(done)));
+}
+
 bool Aktualizr::SetInstallationRawReport(const std::string &custom_raw_report) {
   return storage_->storeDeviceInstallationRawReport(custom_raw_report);
 }
 
 std::future<bool> Aktualizr::SendManifest(const Json::Value &custom) {
   std::function<bool()> task([this, custom]() { return uptane_client_->putManifest(custom); });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), api::Lane::kControl);
+}
+
+void Aktualizr::SendManifest(const Json::Value &custom, const std::shared_ptr<api::CompletionQueue> &completions,
+                             Completion<bool> done) {
+  std::function<bool()> task([this, custom]() { return uptane_client_->putManifest(custom); });
+  api_queue_->enqueue(std::move(task), api::Lane::kControl, postTo(completions, std::move(done)));
 }
 
 result::Pause Aktualizr::Pause() {
@@ -493,7 +772,29 @@ boost::signals2::connection Aktualizr::SetSignalHandler(
   return sig_->connect(handler);
 }
 
-Aktualizr::InstallationLog Aktualizr::GetInstallationLog() {
+boost::signals2::connection Aktualizr::SetSignalHandler(const SigHandler &handler,
+                                                        const std::shared_ptr<api::CompletionQueue> &completions) {
+  return sig_->connect([handler, completions](const shared_ptr<event::BaseEvent> &event) {
+    completions->post([handler, event]() { handler(event); });
+  });
+}
+
+Aktualizr::EventQueueStats Aktualizr::GetEventQueueStats() const {
+  EventQueueStats stats;
+  if (event_dispatcher_) {
+    stats.coalesced = event_dispatcher_->coalesced();
+    stats.dropped = event_dispatcher_->dropped();
+  }
+  return stats;
+}
+
+Aktualizr::InstallationLog Aktualizr::GetInstallationLog() { return loadInstallationLog(0, -1); }
+
+Aktualizr::InstallationLog Aktualizr::GetInstallationLog(size_t offset, size_t limit) {
+  return loadInstallationLog(static_cast<int64_t>(offset), static_cast<int64_t>(limit));
+}
+
+Aktualizr::InstallationLog Aktualizr::loadInstallationLog(int64_t offset, int64_t limit) {
   std::vector<Aktualizr::InstallationLogEntry> ilog;
 
   EcuSerials serials;
@@ -504,10 +805,9 @@ Aktualizr::InstallationLog Aktualizr::GetInstallationLog() {
   ilog.reserve(serials.size());
   for (const auto &s : serials) {
     Uptane::EcuSerial serial = s.first;
-    std::vector<Uptane::Target> installs;
 
     std::vector<Uptane::Target> log;
-    storage_->loadInstallationLog(serial.ToString(), &log, true);
+    storage_->loadInstallationLogPage(serial.ToString(), &log, true, offset, limit);
 
     ilog.emplace_back(Aktualizr::InstallationLogEntry{serial, std::move(log)});
   }
@@ -523,6 +823,32 @@ std::ifstream Aktualizr::OpenStoredTarget(const Uptane::Target &target) {
   return uptane_client_->openStoredTarget(target);
 }
 
+int Aktualizr::OpenStoredTargetFd(const Uptane::Target &target) { return uptane_client_->openStoredTargetFd(target); }
+
+Json::Value Aktualizr::Snapshot() {
+  // A few hundred spans cover the last update cycle without bloating the file
+  static const Json::ArrayIndex max_spans = 256;
+
+  Json::Value snapshot = uptane_client_->snapshot();
+  snapshot["time"] = TimeStamp::Now().ToString();
+  snapshot["commands"] = api_queue_->snapshot();
+  snapshot["threads"] = ProcessStats::threads();
+  snapshot["memory"] = ProcessStats::memory();
+  snapshot["metrics"] = Metrics::instance().summary();
+
+  const Json::Value events = Tracer::instance().toChromeTrace()["traceEvents"];
+  Json::Value &spans = snapshot["spans"] = Json::Value(Json::arrayValue);
+  for (Json::ArrayIndex i = events.size() > max_spans ? events.size() - max_spans : 0; i < events.size(); ++i) {
+    spans.append(events[i]);
+  }
+  return snapshot;
+}
+
+void Aktualizr::WriteSnapshot(const boost::filesystem::path &file) {
+  Utils::writeFile(file, Utils::jsonToCanonicalStr(Snapshot()));
+  LOG_INFO << "Wrote a snapshot of the client state to " << file;
+}
+
 #ifdef BUILD_OFFLINE_UPDATES
 bool Aktualizr::OfflineUpdateAvailable() {
   static const std::string update_subdir{"metadata"};
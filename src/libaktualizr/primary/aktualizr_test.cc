@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
 #include <future>
 #include <string>
@@ -118,6 +121,71 @@ TEST(Aktualizr, FullNoUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+/*
+ * With deferred startup, device data is sent after the first update check.
+ */
+TEST(Aktualizr, DeferredStartup) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.deferred_startup = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::vector<std::string> events;
+  auto f_cb = [&events](const std::shared_ptr<event::BaseEvent>& event) {
+    if (!event->isTypeOf<event::DownloadProgressReport>()) {
+      events.push_back(event->variant);
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+
+  aktualizr.Initialize();
+  aktualizr.UptaneCycle();
+
+  const std::vector<std::string> expected{"UpdateCheckComplete", "SendDeviceDataComplete"};
+  EXPECT_EQ(events, expected);
+}
+
+/*
+ * After exiting while idle, a start for the next update check does not send
+ * the device data again, but a start once that state is stale does.
+ */
+TEST(Aktualizr, IdleExitRestart) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.polling_sec = 3600;
+  conf.uptane.idle_exit_sec = 60;
+  auto storage = INvStorage::newStorage(conf.storage);
+  const boost::filesystem::path state_file = conf.storage.path / "poll.state";
+
+  auto run = [&conf, &storage, &http]() {
+    std::vector<std::string> events;
+    {
+      UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+      boost::signals2::connection conn = aktualizr.SetSignalHandler(
+          [&events](const std::shared_ptr<event::BaseEvent>& event) { events.push_back(event->variant); });
+      aktualizr.Initialize();
+      auto loop = aktualizr.RunForever();
+      EXPECT_EQ(loop.wait_for(std::chrono::seconds(20)), std::future_status::ready);
+    }
+    return std::find(events.begin(), events.end(), "SendDeviceDataComplete") != events.end();
+  };
+
+  EXPECT_TRUE(run());
+  ASSERT_TRUE(boost::filesystem::exists(state_file));
+  EXPECT_FALSE(run());
+  ASSERT_TRUE(boost::filesystem::exists(state_file));
+
+  // The check that was due long ago
+  Json::Value state = Utils::parseJSONFile(state_file);
+  state["nextCheck"] = 0;
+  Utils::writeFile(state_file, state);
+  EXPECT_TRUE(run());
+}
+
 /*
  * Compute device installation failure code as concatenation of ECU failure
  * codes during installation.
@@ -1535,6 +1603,182 @@ TEST(Aktualizr, DownloadWithUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+/*
+ * Download several targets in parallel under a bandwidth budget. Every target
+ * still gets its own DownloadTargetComplete event.
+ */
+TEST(Aktualizr, DownloadWithUpdatesParallel) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.download_concurrency = 4;
+  conf.uptane.download_bandwidth_limit = 1024 * 1024;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::atomic<size_t> targets_complete{0};
+  auto f_cb = [&targets_complete](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->isTypeOf<event::DownloadTargetComplete>()) {
+      EXPECT_TRUE(dynamic_cast<event::DownloadTargetComplete*>(event.get())->success);
+      ++targets_complete;
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2u);
+
+  result::Download result = aktualizr.Download(update_result.updates).get();
+  EXPECT_EQ(result.status, result::DownloadStatus::kSuccess);
+  ASSERT_EQ(result.updates.size(), 2u);
+  // The order of the requested targets is preserved.
+  EXPECT_EQ(result.updates[0].filename(), "primary_firmware.txt");
+  EXPECT_EQ(result.updates[1].filename(), "secondary_firmware.txt");
+  EXPECT_EQ(targets_complete, 2u);
+}
+
+/*
+ * Control the targets of a download one by one: a target with a higher
+ * priority starts first, and a cancelled target is left out of the result.
+ */
+TEST(Aktualizr, DownloadHandles) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.download_concurrency = 1;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::mutex m;
+  std::vector<std::pair<std::string, bool>> completed;
+  auto f_cb = [&m, &completed](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->isTypeOf<event::DownloadTargetComplete>()) {
+      const auto download_event = dynamic_cast<event::DownloadTargetComplete*>(event.get());
+      std::lock_guard<std::mutex> guard(m);
+      completed.emplace_back(download_event->update.filename(), download_event->success);
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+  // The events are delivered asynchronously
+  auto wait_for_events = [&m, &completed](size_t count) {
+    for (int i = 0; i < 100; ++i) {
+      {
+        std::lock_guard<std::mutex> guard(m);
+        if (completed.size() >= count) {
+          return;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+  };
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2u);
+  EXPECT_EQ(update_result.updates[0].filename(), "primary_firmware.txt");
+  EXPECT_EQ(update_result.updates[1].filename(), "secondary_firmware.txt");
+
+  // Hold the queue so that the handles are set up before the download starts
+  EXPECT_EQ(aktualizr.Pause().status, result::PauseStatus::kSuccess);
+  std::vector<api::TargetDownloadHandle> handles;
+  auto download = aktualizr.Download(update_result.updates, UpdateType::kOnline, &handles);
+  ASSERT_EQ(handles.size(), 2u);
+  EXPECT_EQ(handles[1]->target().filename(), "secondary_firmware.txt");
+  handles[1]->SetPriority(1);
+  EXPECT_EQ(aktualizr.Resume().status, result::PauseStatus::kSuccess);
+
+  result::Download result = download.get();
+  EXPECT_EQ(result.status, result::DownloadStatus::kSuccess);
+  // The result keeps the order of the requested targets
+  ASSERT_EQ(result.updates.size(), 2u);
+  EXPECT_EQ(result.updates[0].filename(), "primary_firmware.txt");
+  EXPECT_EQ(result.updates[1].filename(), "secondary_firmware.txt");
+  wait_for_events(2);
+  {
+    std::lock_guard<std::mutex> guard(m);
+    ASSERT_EQ(completed.size(), 2u);
+    EXPECT_EQ(completed[0], std::make_pair(std::string("secondary_firmware.txt"), true));
+    EXPECT_EQ(completed[1], std::make_pair(std::string("primary_firmware.txt"), true));
+    completed.clear();
+  }
+
+  EXPECT_EQ(aktualizr.Pause().status, result::PauseStatus::kSuccess);
+  download = aktualizr.Download(update_result.updates, UpdateType::kOnline, &handles);
+  ASSERT_EQ(handles.size(), 2u);
+  EXPECT_TRUE(handles[0]->Cancel());
+  EXPECT_FALSE(handles[0]->Cancel());
+  EXPECT_FALSE(handles[0]->Pause());
+  EXPECT_TRUE(handles[0]->cancelled());
+  EXPECT_EQ(aktualizr.Resume().status, result::PauseStatus::kSuccess);
+
+  result = download.get();
+  EXPECT_EQ(result.status, result::DownloadStatus::kPartialSuccess);
+  ASSERT_EQ(result.updates.size(), 1u);
+  EXPECT_EQ(result.updates[0].filename(), "secondary_firmware.txt");
+  wait_for_events(2);
+  std::lock_guard<std::mutex> guard(m);
+  ASSERT_EQ(completed.size(), 2u);
+  EXPECT_EQ(completed[0], std::make_pair(std::string("primary_firmware.txt"), false));
+  EXPECT_EQ(completed[1], std::make_pair(std::string("secondary_firmware.txt"), true));
+}
+
+/*
+ * Start the downloads by the configured priorities of the hardware, and of
+ * equal priorities, with the smallest target.
+ */
+TEST(Aktualizr, DownloadPriorities) {
+  for (const bool by_hardware : {false, true}) {
+    TemporaryDirectory temp_dir;
+    auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+    Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+    conf.uptane.download_concurrency = 1;
+    conf.uptane.download_smallest_first = true;
+    if (by_hardware) {
+      conf.uptane.download_priorities = "primary_hw=2, secondary_hw=1";
+    }
+
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    std::mutex m;
+    std::vector<std::string> completed;
+    auto f_cb = [&m, &completed](const std::shared_ptr<event::BaseEvent>& event) {
+      if (event->isTypeOf<event::DownloadTargetComplete>()) {
+        std::lock_guard<std::mutex> guard(m);
+        completed.push_back(dynamic_cast<event::DownloadTargetComplete*>(event.get())->update.filename());
+      }
+    };
+    boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+
+    aktualizr.Initialize();
+    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    ASSERT_EQ(update_result.updates.size(), 2u);
+    ASSERT_EQ(update_result.updates[0].filename(), "primary_firmware.txt");
+    ASSERT_LT(update_result.updates[1].length(), update_result.updates[0].length());
+
+    std::vector<api::TargetDownloadHandle> handles;
+    result::Download result = aktualizr.Download(update_result.updates, UpdateType::kOnline, &handles).get();
+    EXPECT_EQ(result.status, result::DownloadStatus::kSuccess);
+    ASSERT_EQ(handles.size(), 2u);
+    EXPECT_EQ(handles[0]->priority(), by_hardware ? 2 : 0);
+    EXPECT_EQ(handles[1]->priority(), by_hardware ? 1 : 0);
+    for (int i = 0; i < 100; ++i) {
+      {
+        std::lock_guard<std::mutex> guard(m);
+        if (completed.size() >= 2) {
+          break;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::lock_guard<std::mutex> guard(m);
+    ASSERT_EQ(completed.size(), 2u);
+    EXPECT_EQ(completed[0], by_hardware ? "primary_firmware.txt" : "secondary_firmware.txt");
+  }
+}
+
 class HttpDownloadFailure : public HttpFake {
  public:
   using Responses = std::vector<std::pair<std::string, HttpResponse>>;
@@ -1686,6 +1930,46 @@ TEST(Aktualizr, DownloadListRemove) {
   EXPECT_EQ(targets.size(), 0);
 }
 
+/*
+ * A snapshot shows the waiting commands, the stored targets and the state of
+ * the process, and can be written to a file.
+ */
+TEST(Aktualizr, Snapshot) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  aktualizr.Download(update_result.updates).get();
+
+  EXPECT_EQ(aktualizr.Pause().status, result::PauseStatus::kSuccess);
+  auto check = aktualizr.CheckUpdates();
+  const Json::Value snapshot = aktualizr.Snapshot();
+  EXPECT_TRUE(snapshot["commands"]["paused"].asBool());
+  EXPECT_EQ(snapshot["commands"]["pending"]["metadata"].asUInt64(), 1);
+  EXPECT_EQ(snapshot["commands"]["pending"]["bulk"].asUInt64(), 0);
+  EXPECT_EQ(snapshot["storage"]["targets"].asUInt64(), 2);
+  EXPECT_GT(snapshot["storage"]["files"]["sql.db"].asUInt64(), 0);
+  ASSERT_EQ(snapshot["downloads"].size(), 2);
+  EXPECT_EQ(snapshot["downloads"][0]["received"], snapshot["downloads"][0]["bytes"]);
+  EXPECT_GT(snapshot["threads"].size(), 1);
+  EXPECT_GT(snapshot["memory"]["residentPeak"].asUInt64(), 0);
+  EXPECT_TRUE(snapshot["spans"].isArray());
+  EXPECT_EQ(aktualizr.Resume().status, result::PauseStatus::kSuccess);
+  check.get();
+
+  const boost::filesystem::path file = temp_dir / "snapshot.json";
+  aktualizr.WriteSnapshot(file);
+  const Json::Value written = Utils::parseJSONFile(file);
+  EXPECT_EQ(written["commands"]["pending"]["metadata"].asUInt64(), 0);
+  EXPECT_FALSE(written["commands"]["paused"].asBool());
+  EXPECT_EQ(written["storage"]["targets"].asUInt64(), 2);
+}
+
 /*
  * Automatically remove old targets during installation cycles.
  * Get log of installation.
@@ -1974,6 +2258,7 @@ TEST(Aktualizr, InstallWithUpdates) {
       << "Primary firmware is present in storage before the download";
   EXPECT_THROW(aktualizr.OpenStoredTarget(secondary_target).get(), std::runtime_error)
       << "Secondary firmware is present in storage before the download";
+  EXPECT_THROW(aktualizr.OpenStoredTargetFd(primary_target), std::runtime_error);
 
   result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
   aktualizr.Download(update_result.updates).get();
@@ -1981,6 +2266,11 @@ TEST(Aktualizr, InstallWithUpdates) {
       << "Primary firmware is not present in storage after the download";
   EXPECT_NO_THROW(aktualizr.OpenStoredTarget(secondary_target))
       << "Secondary firmware is not present in storage after the download";
+  const int fd = aktualizr.OpenStoredTargetFd(primary_target);
+  ASSERT_GE(fd, 0);
+  std::string content(primary_target.length() + 1, '\0');
+  EXPECT_EQ(pread(fd, &content[0], content.size(), 0), primary_target.length());
+  close(fd);
 
   // After updates have been downloaded, try to install them.
   aktualizr.Install(update_result.updates);
@@ -2151,6 +2441,68 @@ TEST(Aktualizr, CampaignCheckAndControl) {
   EXPECT_TRUE(campaign_events.campaignpostpone_seen);
 }
 
+class HttpFakeCampaignConditional : public HttpFakeCampaign {
+ public:
+  HttpFakeCampaignConditional(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
+      : HttpFakeCampaign(test_dir_in, meta_dir_in) {}
+
+  HttpResponse getConditional(const std::string& url, int64_t maxsize, HttpValidators* validators,
+                              const api::FlowControlToken* flow_control) override {
+    ++campaign_requests;
+    if (validators->etag == "\"v1\"") {
+      return HttpResponse("", 304, CURLE_OK, "");
+    }
+    validators->etag = "\"v1\"";
+    validators->last_modified.clear();
+    return get(url, maxsize, flow_control);
+  }
+
+  unsigned int campaign_requests{0};
+};
+
+/* Answer campaign checks from the stored campaign list while the server reports
+ * it unchanged, and from memory within the configured TTL.
+ * Send CampaignsChanged only when a new list was received. */
+TEST(Aktualizr, CampaignCache) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeCampaignConditional>(temp_dir.Path(), fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  unsigned int changed_events = 0;
+  auto handler = [&changed_events](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->variant == "CampaignsChanged") {
+      ++changed_events;
+    }
+  };
+
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.SetSignalHandler(handler);
+    aktualizr.Initialize();
+
+    EXPECT_EQ(aktualizr.CampaignCheck().get().campaigns.size(), 1);
+    auto result = aktualizr.CampaignCheck().get();
+    ASSERT_EQ(result.campaigns.size(), 1);
+    EXPECT_EQ(result.campaigns[0].id, "c2eb7e8d-8aa0-429d-883f-5ed8fdb2a493");
+    EXPECT_EQ(http->campaign_requests, 2);
+    EXPECT_EQ(changed_events, 1);
+  }
+
+  conf.uptane.campaigns_ttl_sec = 3600;
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.SetSignalHandler(handler);
+    aktualizr.Initialize();
+
+    EXPECT_EQ(aktualizr.CampaignCheck().get().campaigns.size(), 1);
+    EXPECT_EQ(aktualizr.CampaignCheck().get().campaigns.size(), 1);
+    EXPECT_EQ(http->campaign_requests, 3);
+    EXPECT_EQ(changed_events, 1);
+  }
+}
+
 class HttpFakeNoCorrelationId : public HttpFake {
  public:
   HttpFakeNoCorrelationId(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
@@ -1,8 +1,12 @@
 #include <fcntl.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -61,6 +65,104 @@ TEST(AktualizrUpdateLock, DisableUsingLock) {
   EXPECT_GT(installs, 0);
 }
 
+/**
+ * Serves the targets only after a delay, like large ones, and stops like curl
+ * does when the progress callback asks to.
+ */
+class HttpSlowTargets : public HttpFake {
+ public:
+  HttpSlowTargets(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
+      : HttpFake(test_dir_in, "hasupdates", meta_dir_in) {}
+
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler* easyp) override {
+    if (url.find("/targets/") == std::string::npos) {
+      return HttpFake::downloadAsync(url, write_cb, progress_cb, userp, from, easyp);
+    }
+    if (on_target_) {
+      on_target_();
+    }
+    return std::async(std::launch::async, [this, url, write_cb, progress_cb, userp, from, easyp]() {
+      for (int i = 0; i < 30; ++i) {
+        if (progress_cb(userp, 0, 0, 0, 0) != 0) {
+          return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Aborted by callback");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      return HttpFake::downloadAsync(url, write_cb, progress_cb, userp, from, easyp).get();
+    });
+  }
+
+  // Called when a target download starts
+  void onTarget(std::function<void()> on_target) { on_target_ = std::move(on_target); }
+
+ private:
+  std::function<void()> on_target_;
+};
+
+/*
+ * Download the updates in a pre-download window while the lock is held,
+ * without installing them.
+ * Stop the pre-download when the window ends.
+ */
+TEST(AktualizrUpdateLock, Predownload) {
+  TemporaryDirectory const temp_dir;
+  auto http = std::make_shared<HttpSlowTargets>(temp_dir.Path(), fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  auto lock_file = temp_dir.Path() / "update.lock";
+  conf.uptane.update_lock_file = lock_file;
+  conf.uptane.predownload_windows = "00:00-01:00";
+
+  int const fd = open(lock_file.c_str(), O_CREAT | O_RDWR, 0666);
+  ASSERT_GE(fd, 0) << "Open lock file failed:" << strerror(errno);
+  ASSERT_EQ(flock(fd, LOCK_EX), 0) << "flock failed:" << strerror(errno);
+
+  std::atomic<int> minute{30};
+  std::atomic<int> downloaded{0};
+  std::atomic<int> failed{0};
+  std::atomic<int> installs{0};
+  auto f_cb = [&downloaded, &failed, &installs](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->isTypeOf<event::DownloadTargetComplete>()) {
+      const auto* download_event = dynamic_cast<event::DownloadTargetComplete*>(event.get());
+      if (download_event->success) {
+        ++downloaded;
+      } else {
+        ++failed;
+      }
+    } else if (event->isTypeOf<event::InstallStarted>()) {
+      ++installs;
+    }
+  };
+
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.minute_of_day() = [&minute]() { return minute.load(); };
+    boost::signals2::connection const conn = aktualizr.SetSignalHandler(f_cb);
+    aktualizr.Initialize();
+
+    // The window ends while the first target is being downloaded
+    http->onTarget([&minute]() { minute = 90; });
+    aktualizr.UptaneCycle();
+    EXPECT_EQ(downloaded, 0);
+    EXPECT_GT(failed, 0);
+    EXPECT_EQ(installs, 0);
+
+    // The pre-download runs to completion in the next window
+    http->onTarget(nullptr);
+    minute = 30;
+    failed = 0;
+    aktualizr.UptaneCycle();
+    EXPECT_GT(downloaded, 0);
+    EXPECT_EQ(failed, 0);
+    EXPECT_EQ(installs, 0);
+  }
+
+  ASSERT_EQ(flock(fd, LOCK_UN), 0) << "flock unlock failed:" << strerror(errno);
+  close(fd);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
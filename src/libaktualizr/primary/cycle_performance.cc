@@ -0,0 +1,119 @@
+#include "cycle_performance.h"
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+static Json::Int64 toMs(CyclePerformance::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+static Json::Int64 toMs(std::chrono::system_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+void CyclePerformance::startCycle() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  report_ = Json::Value(Json::objectValue);
+  transferred_ = false;
+}
+
+void CyclePerformance::add(const char *key, Clock::duration duration) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  // Summed up, e.g. when a download is rechecked against the metadata again before the installation
+  report_[key] = report_.get(key, 0).asInt64() + toMs(duration);
+}
+
+void CyclePerformance::addMetadataFetch(Clock::duration duration) { add("metadataMs", duration); }
+
+void CyclePerformance::addVerification(Clock::duration duration) { add("verifyMs", duration); }
+
+void CyclePerformance::addInstall(Clock::duration duration) {
+  add("installMs", duration);
+  std::lock_guard<std::mutex> guard(mutex_);
+  transferred_ = enabled_;
+}
+
+void CyclePerformance::addDownload(const Uptane::Target &target, Clock::duration duration, bool success) {
+  if (!enabled_) {
+    return;
+  }
+  Json::Value download;
+  download["target"] = target.filename();
+  download["bytes"] = static_cast<Json::UInt64>(target.length());
+  download["ms"] = toMs(duration);
+  download["ok"] = success;
+  std::lock_guard<std::mutex> guard(mutex_);
+  report_["downloads"].append(download);
+  transferred_ = true;
+}
+
+void CyclePerformance::addSecondaryTransfer(const Uptane::EcuSerial &ecu, const Uptane::Target &target,
+                                            Clock::duration duration, bool success) {
+  if (!enabled_) {
+    return;
+  }
+  Json::Value transfer;
+  transfer["ecu"] = ecu.ToString();
+  const auto hwid = target.ecus().find(ecu);
+  if (hwid != target.ecus().end()) {
+    transfer["hwid"] = hwid->second.ToString();
+  }
+  transfer["bytes"] = static_cast<Json::UInt64>(target.length());
+  transfer["ms"] = toMs(duration);
+  transfer["ok"] = success;
+  std::lock_guard<std::mutex> guard(mutex_);
+  report_["secondaries"].append(transfer);
+  transferred_ = true;
+}
+
+Json::Value CyclePerformance::take() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Json::Value report;
+  if (transferred_) {
+    report.swap(report_);
+  }
+  report_ = Json::Value(Json::objectValue);
+  transferred_ = false;
+  return report;
+}
+
+void CyclePerformance::savePending(const boost::filesystem::path &file, Json::Value report,
+                                   std::chrono::system_clock::time_point now) {
+  report["appliedAt"] = toMs(now);
+  try {
+    Utils::writeFile(file, Utils::jsonToCanonicalStr(report));
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not keep the performance report until the reboot: " << e.what();
+  }
+}
+
+Json::Value CyclePerformance::takePending(const boost::filesystem::path &file,
+                                          std::chrono::system_clock::time_point now) {
+  boost::system::error_code ec;
+  if (!boost::filesystem::exists(file, ec)) {
+    return Json::Value();
+  }
+  Json::Value report;
+  try {
+    report = Utils::parseJSONFile(file);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not read the performance report in " << file << ": " << e.what();
+  }
+  boost::filesystem::remove(file, ec);
+  if (!report.isObject() || !report["appliedAt"].isInt64()) {
+    LOG_WARNING << "Ignoring the malformed performance report in " << file;
+    return Json::Value();
+  }
+  // Only the wall clock runs on across the reboot. It may have been set back meanwhile.
+  const Json::Int64 reboot_ms = toMs(now) - report["appliedAt"].asInt64();
+  report.removeMember("appliedAt");
+  if (reboot_ms >= 0) {
+    report["rebootMs"] = reboot_ms;
+  }
+  return report;
+}
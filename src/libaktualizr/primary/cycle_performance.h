@@ -0,0 +1,66 @@
+#ifndef CYCLE_PERFORMANCE_H_
+#define CYCLE_PERFORMANCE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include "json/json.h"
+
+#include "libaktualizr/types.h"
+
+/**
+ * Collects the timings of one update cycle, from the metadata check to the
+ * end of the installation, for the UpdateCyclePerformance report (see
+ * `telemetry.report_performance`). Durations are in milliseconds and
+ * transfers come with their size, so that the server can work out the
+ * throughput. The downloads run in parallel, so all methods are thread-safe.
+ */
+class CyclePerformance {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit CyclePerformance(bool enabled) : enabled_(enabled) {}
+
+  bool enabled() const { return enabled_; }
+
+  /** Forget what was collected for the previous cycle. */
+  void startCycle();
+  void addMetadataFetch(Clock::duration duration);
+  void addVerification(Clock::duration duration);
+  void addDownload(const Uptane::Target &target, Clock::duration duration, bool success);
+  void addSecondaryTransfer(const Uptane::EcuSerial &ecu, const Uptane::Target &target, Clock::duration duration,
+                            bool success);
+  void addInstall(Clock::duration duration);
+
+  /**
+   * The timings of the cycle, after which a new cycle starts.
+   * @return null if nothing was downloaded or installed
+   */
+  Json::Value take();
+
+  /**
+   * Keep `report` in `file` until the reboot that completes the installation.
+   */
+  static void savePending(const boost::filesystem::path &file, Json::Value report,
+                          std::chrono::system_clock::time_point now = std::chrono::system_clock::now());
+  /**
+   * The report saved by savePending(), with the time from the end of the
+   * installation until `now` added as `rebootMs`. The file is removed.
+   * @return null if there is none
+   */
+  static Json::Value takePending(const boost::filesystem::path &file,
+                                 std::chrono::system_clock::time_point now = std::chrono::system_clock::now());
+
+ private:
+  void add(const char *key, Clock::duration duration);
+
+  const bool enabled_;
+  std::mutex mutex_;
+  Json::Value report_{Json::objectValue};
+  bool transferred_{false};
+};
+
+#endif  // CYCLE_PERFORMANCE_H_
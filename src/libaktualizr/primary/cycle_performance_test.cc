@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "primary/cycle_performance.h"
+#include "utilities/utils.h"
+
+static Uptane::Target makeTarget(const std::string &filename, uint64_t length, const Uptane::EcuMap &ecus = {}) {
+  return Uptane::Target(filename, ecus, std::vector<Hash>{}, length);
+}
+
+/* A cycle that transferred something is reported with its timings, then a new cycle starts. */
+TEST(CyclePerformance, Take) {
+  CyclePerformance performance(true);
+  performance.startCycle();
+  performance.addMetadataFetch(std::chrono::milliseconds(120));
+  // Nothing to report without a download or an installation
+  EXPECT_TRUE(performance.take().isNull());
+
+  performance.addMetadataFetch(std::chrono::milliseconds(120));
+  performance.addVerification(std::chrono::milliseconds(5));
+  performance.addVerification(std::chrono::milliseconds(7));
+  performance.addDownload(makeTarget("a", 1000), std::chrono::milliseconds(250), true);
+  const Uptane::EcuSerial ecu("secondary");
+  const Uptane::Target firmware = makeTarget("b", 2000, {{ecu, Uptane::HardwareIdentifier("board-v2")}});
+  performance.addDownload(firmware, std::chrono::milliseconds(500), false);
+  performance.addSecondaryTransfer(ecu, firmware, std::chrono::milliseconds(800), true);
+  performance.addInstall(std::chrono::milliseconds(3000));
+
+  const Json::Value report = performance.take();
+  EXPECT_EQ(report["metadataMs"].asInt64(), 120);
+  EXPECT_EQ(report["verifyMs"].asInt64(), 12);
+  EXPECT_EQ(report["installMs"].asInt64(), 3000);
+  ASSERT_EQ(report["downloads"].size(), 2);
+  EXPECT_EQ(report["downloads"][0]["target"].asString(), "a");
+  EXPECT_EQ(report["downloads"][0]["bytes"].asUInt64(), 1000);
+  EXPECT_EQ(report["downloads"][0]["ms"].asInt64(), 250);
+  EXPECT_TRUE(report["downloads"][0]["ok"].asBool());
+  EXPECT_FALSE(report["downloads"][1]["ok"].asBool());
+  ASSERT_EQ(report["secondaries"].size(), 1);
+  EXPECT_EQ(report["secondaries"][0]["ecu"].asString(), "secondary");
+  EXPECT_EQ(report["secondaries"][0]["hwid"].asString(), "board-v2");
+  EXPECT_EQ(report["secondaries"][0]["bytes"].asUInt64(), 2000);
+  EXPECT_EQ(report["secondaries"][0]["ms"].asInt64(), 800);
+
+  EXPECT_TRUE(performance.take().isNull());
+}
+
+/* Nothing is collected unless telemetry.report_performance is set. */
+TEST(CyclePerformance, Disabled) {
+  CyclePerformance performance(false);
+  performance.startCycle();
+  performance.addDownload(makeTarget("a", 1000), std::chrono::milliseconds(250), true);
+  performance.addInstall(std::chrono::milliseconds(3000));
+  EXPECT_TRUE(performance.take().isNull());
+}
+
+/* A report kept over a reboot gets the time from the installation to the restart. */
+TEST(CyclePerformance, Pending) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path file = temp_dir / "performance.pending";
+  EXPECT_TRUE(CyclePerformance::takePending(file).isNull());
+
+  CyclePerformance performance(true);
+  performance.addInstall(std::chrono::milliseconds(3000));
+  const auto applied = std::chrono::system_clock::now();
+  CyclePerformance::savePending(file, performance.take(), applied);
+
+  const Json::Value report = CyclePerformance::takePending(file, applied + std::chrono::seconds(42));
+  EXPECT_EQ(report["installMs"].asInt64(), 3000);
+  EXPECT_EQ(report["rebootMs"].asInt64(), 42000);
+  EXPECT_FALSE(report.isMember("appliedAt"));
+  EXPECT_FALSE(boost::filesystem::exists(file));
+  EXPECT_TRUE(CyclePerformance::takePending(file).isNull());
+
+  // A clock set back during the boot gives no reboot time
+  CyclePerformance::savePending(file, Json::Value(Json::objectValue), applied);
+  EXPECT_FALSE(CyclePerformance::takePending(file, applied - std::chrono::seconds(1)).isMember("rebootMs"));
+
+  Utils::writeFile(file, std::string("not json"));
+  EXPECT_TRUE(CyclePerformance::takePending(file).isNull());
+  EXPECT_FALSE(boost::filesystem::exists(file));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
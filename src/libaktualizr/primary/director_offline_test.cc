@@ -4,6 +4,7 @@
 #include <boost/filesystem.hpp>
 #include "storage/sqlstorage.h"
 #include "uptane/directorrepository.h"
+#include "uptane/exceptions.h"
 #include "uptane/fetcher.h"
 
 boost::filesystem::path offline_update_path;  // NOLINT
@@ -34,6 +35,37 @@ TEST(DirectorOffline, Simple) {
   EXPECT_EQ(correlation_id, "urn:tdx-ota:lockbox:test1:1:188c4ce5faa5");
 }
 
+/* The lockbox is listed once, and each metadata file is read from it at most once. */
+TEST(DirectorOffline, FetcherIndex) {
+  const TemporaryDirectory dir;
+  const auto director_path = dir / "metadata" / "director";
+  boost::filesystem::create_directories(director_path);
+  Utils::writeFile(director_path / "1.root.json", std::string(R"({"signed": {"version": 1}})"));
+  OfflineUpdateFetcher const fetcher(dir.Path());
+
+  EXPECT_TRUE(fetcher.hasMetadataFile(Uptane::RepositoryType::Director(), "1.root.json"));
+  EXPECT_FALSE(fetcher.hasMetadataFile(Uptane::RepositoryType::Director(), "2.root.json"));
+  EXPECT_FALSE(fetcher.hasMetadataFile(Uptane::RepositoryType::Image(), "1.root.json"));
+
+  std::string root;
+  fetcher.fetchRole(&root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(), Uptane::Role::Root(),
+                    Uptane::Version(1), nullptr);
+  EXPECT_EQ(root, R"({"signed": {"version": 1}})");
+  EXPECT_THROW(fetcher.fetchRole(&root, 4, Uptane::RepositoryType::Director(), Uptane::Role::Root(),
+                                 Uptane::Version(1), nullptr),
+               Uptane::MetadataFetchFailure);
+
+  // Files added or changed after the lockbox was listed and read are not seen
+  Utils::writeFile(director_path / "1.root.json", std::string("changed"));
+  Utils::writeFile(director_path / "2.root.json", std::string("added"));
+  fetcher.fetchRole(&root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(), Uptane::Role::Root(),
+                    Uptane::Version(1), nullptr);
+  EXPECT_EQ(root, R"({"signed": {"version": 1}})");
+  EXPECT_THROW(fetcher.fetchRole(&root, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(),
+                                 Uptane::Role::Root(), Uptane::Version(2), nullptr),
+               Uptane::MetadataFetchFailure);
+}
+
 #endif  // BUILD_OFFLINE_UPDATES
 
 int main(int argc, char** argv) {
@@ -0,0 +1,67 @@
+#include "download_progress.h"
+
+static const unsigned int kProgressCompleted = 100;
+
+void DownloadProgressAggregator::start(const std::vector<Uptane::Target> &targets) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  targets_.clear();
+  for (const auto &target : targets) {
+    targets_[target.filename()].length = target.length();
+  }
+}
+
+std::shared_ptr<event::DownloadProgressReport> DownloadProgressAggregator::update(const Uptane::Target &target,
+                                                                                  const std::string &description,
+                                                                                  unsigned int progress,
+                                                                                  Clock::time_point now) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  // A Target downloaded on its own joins the current set
+  auto it = targets_.find(target.filename());
+  if (it == targets_.end()) {
+    it = targets_.emplace(target.filename(), TargetProgress()).first;
+    it->second.length = target.length();
+  }
+  TargetProgress &state = it->second;
+  state.progress = progress;
+
+  const bool completed = progress >= kProgressCompleted;
+  const bool due = !state.started || now - state.reported_at >= interval_;
+  if (!completed && (progress <= state.reported || !due)) {
+    return nullptr;
+  }
+  state.reported = progress;
+  state.reported_at = now;
+  state.started = true;
+  return std::make_shared<event::DownloadProgressReport>(target, description, progress, overallProgress());
+}
+
+unsigned int DownloadProgressAggregator::overallProgress() const {
+  uint64_t total = 0;
+  uint64_t done = 0;
+  unsigned int sum = 0;
+  for (const auto &entry : targets_) {
+    total += entry.second.length;
+    done += entry.second.length / kProgressCompleted * entry.second.progress +
+            entry.second.length % kProgressCompleted * entry.second.progress / kProgressCompleted;
+    sum += entry.second.progress;
+  }
+  if (total == 0) {
+    // Only Targets of unknown length, e.g. OSTree commits
+    return targets_.empty() ? 0 : sum / static_cast<unsigned int>(targets_.size());
+  }
+  return static_cast<unsigned int>(done * kProgressCompleted / total);
+}
+
+Json::Value DownloadProgressAggregator::snapshot() {
+  Json::Value snapshot{Json::arrayValue};
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (const auto &target : targets_) {
+    Json::Value entry;
+    entry["target"] = target.first;
+    entry["bytes"] = static_cast<Json::UInt64>(target.second.length);
+    // The progress is all a fetcher reports
+    entry["received"] = static_cast<Json::UInt64>(target.second.length * target.second.progress / kProgressCompleted);
+    snapshot.append(entry);
+  }
+  return snapshot;
+}
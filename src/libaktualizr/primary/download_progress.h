@@ -0,0 +1,57 @@
+#ifndef DOWNLOAD_PROGRESS_H_
+#define DOWNLOAD_PROGRESS_H_
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+#include "libaktualizr/events.h"
+
+/**
+ * Turns the progress callbacks of concurrent downloads into one stream of
+ * DownloadProgressReport events.
+ *
+ * The progress of each Target is reported at most once per `interval`, and
+ * always when it completes. Each report also carries the progress of all the
+ * Targets downloaded since the last start(), weighted by their length.
+ */
+class DownloadProgressAggregator {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /** An `interval` of 0 reports every increase. */
+  explicit DownloadProgressAggregator(std::chrono::milliseconds interval) : interval_(interval) {}
+
+  /** Start a new set of downloads. */
+  void start(const std::vector<Uptane::Target> &targets);
+
+  /** The event for `progress` of `target`, or nullptr if it is not reported. */
+  std::shared_ptr<event::DownloadProgressReport> update(const Uptane::Target &target, const std::string &description,
+                                                        unsigned int progress, Clock::time_point now = Clock::now());
+
+  /** The Targets of the current set with their length and the bytes received so far, for diagnostics. */
+  Json::Value snapshot();
+
+ private:
+  struct TargetProgress {
+    uint64_t length{0};
+    unsigned int progress{0};
+    unsigned int reported{0};
+    Clock::time_point reported_at;
+    bool started{false};
+  };
+
+  // Called with mutex_ held
+  unsigned int overallProgress() const;
+
+  const std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::map<std::string, TargetProgress> targets_;
+};
+
+#endif  // DOWNLOAD_PROGRESS_H_
@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "primary/download_progress.h"
+
+static Uptane::Target makeTarget(const std::string &filename, uint64_t length) {
+  return Uptane::Target(filename, Uptane::EcuMap{}, std::vector<Hash>{}, length);
+}
+
+/* Each Target is reported at most once per interval, and always on completion. */
+TEST(DownloadProgressAggregator, Interval) {
+  DownloadProgressAggregator aggregator(std::chrono::milliseconds(1000));
+  const auto target = makeTarget("a", 100);
+  aggregator.start({target});
+  const auto t0 = DownloadProgressAggregator::Clock::now();
+
+  auto report = aggregator.update(target, "Downloading", 1, t0);
+  ASSERT_NE(report, nullptr);
+  EXPECT_EQ(report->progress, 1);
+  EXPECT_EQ(aggregator.update(target, "Downloading", 2, t0 + std::chrono::milliseconds(500)), nullptr);
+  report = aggregator.update(target, "Downloading", 3, t0 + std::chrono::milliseconds(1000));
+  ASSERT_NE(report, nullptr);
+  EXPECT_EQ(report->progress, 3);
+  // No report without progress
+  EXPECT_EQ(aggregator.update(target, "Downloading", 3, t0 + std::chrono::milliseconds(3000)), nullptr);
+  report = aggregator.update(target, "Downloading", 100, t0 + std::chrono::milliseconds(3001));
+  ASSERT_NE(report, nullptr);
+  EXPECT_TRUE(event::DownloadProgressReport::isDownloadCompleted(*report));
+}
+
+/* Without an interval, every increase is reported. */
+TEST(DownloadProgressAggregator, NoInterval) {
+  DownloadProgressAggregator aggregator(std::chrono::milliseconds(0));
+  const auto target = makeTarget("a", 100);
+  const auto now = DownloadProgressAggregator::Clock::now();
+  EXPECT_NE(aggregator.update(target, "Downloading", 1, now), nullptr);
+  EXPECT_NE(aggregator.update(target, "Downloading", 2, now), nullptr);
+  EXPECT_EQ(aggregator.update(target, "Downloading", 2, now), nullptr);
+}
+
+/* The overall progress is weighted by the length of the Targets of the set. */
+TEST(DownloadProgressAggregator, Overall) {
+  DownloadProgressAggregator aggregator(std::chrono::milliseconds(0));
+  const auto small = makeTarget("small", 100);
+  const auto large = makeTarget("large", 300);
+  aggregator.start({small, large});
+  const auto now = DownloadProgressAggregator::Clock::now();
+
+  auto report = aggregator.update(small, "Downloading", 100, now);
+  ASSERT_NE(report, nullptr);
+  EXPECT_EQ(report->overall_progress, 25);
+  report = aggregator.update(large, "Downloading", 50, now);
+  ASSERT_NE(report, nullptr);
+  EXPECT_EQ(report->progress, 50);
+  EXPECT_EQ(report->overall_progress, 62);
+
+  // A new set starts from scratch
+  aggregator.start({large});
+  report = aggregator.update(large, "Downloading", 10, now);
+  ASSERT_NE(report, nullptr);
+  EXPECT_EQ(report->overall_progress, 10);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
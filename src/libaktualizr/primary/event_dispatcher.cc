@@ -0,0 +1,68 @@
+#include "event_dispatcher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "logging/logging.h"
+
+AsyncEventDispatcher::AsyncEventDispatcher(std::shared_ptr<event::Channel> sink, size_t capacity)
+    : sink_(std::move(sink)), capacity_(std::max<size_t>(capacity, 1U)) {
+  thread_ = std::thread(&AsyncEventDispatcher::run, this);
+}
+
+AsyncEventDispatcher::~AsyncEventDispatcher() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  if (coalesced_ != 0 || dropped_ != 0) {
+    LOG_DEBUG << "Event dispatcher coalesced " << coalesced_ << " and dropped " << dropped_ << " progress reports";
+  }
+}
+
+void AsyncEventDispatcher::enqueue(std::shared_ptr<event::BaseEvent> event) {
+  std::unique_lock<std::mutex> lock(m_);
+  if (event->isTypeOf<event::DownloadProgressReport>()) {
+    const auto &report = dynamic_cast<const event::DownloadProgressReport &>(*event);
+    for (auto &queued : queue_) {
+      if (queued->isTypeOf<event::DownloadProgressReport>() &&
+          dynamic_cast<const event::DownloadProgressReport &>(*queued).target.filename() == report.target.filename()) {
+        queued = std::move(event);
+        ++coalesced_;
+        return;
+      }
+    }
+    // The completion report is the one consumers wait for, never drop it
+    if (queue_.size() >= capacity_ && !event::DownloadProgressReport::isDownloadCompleted(report)) {
+      ++dropped_;
+      return;
+    }
+  }
+  cv_.wait(lock, [this] { return queue_.size() < capacity_ || shutdown_; });
+  queue_.push_back(std::move(event));
+  lock.unlock();
+  cv_.notify_all();
+}
+
+void AsyncEventDispatcher::run() {
+  std::unique_lock<std::mutex> lock(m_);
+  while (true) {
+    cv_.wait(lock, [this] { return !queue_.empty() || shutdown_; });
+    if (queue_.empty()) {
+      break;
+    }
+    auto event = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    // A producer may be waiting for a free slot
+    cv_.notify_all();
+    try {
+      (*sink_)(event);
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Signal handler failed on " << event->variant << " event: " << e.what();
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef EVENT_DISPATCHER_H_
+#define EVENT_DISPATCHER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "libaktualizr/events.h"
+
+/**
+ * Delivers events to the signal handlers on a dedicated thread, so that a
+ * slow handler does not hold up downloads and installations.
+ *
+ * The queue holds at most `capacity` events. While it is full, download
+ * progress reports are dropped and any other event waits for a free slot. A
+ * progress report for a target that already has one waiting replaces it.
+ */
+class AsyncEventDispatcher {
+ public:
+  AsyncEventDispatcher(std::shared_ptr<event::Channel> sink, size_t capacity);
+  /** Delivers the events that are still queued before returning. */
+  ~AsyncEventDispatcher();
+  AsyncEventDispatcher(const AsyncEventDispatcher &) = delete;
+  AsyncEventDispatcher(AsyncEventDispatcher &&) = delete;
+  AsyncEventDispatcher &operator=(const AsyncEventDispatcher &) = delete;
+  AsyncEventDispatcher &operator=(AsyncEventDispatcher &&) = delete;
+
+  void enqueue(std::shared_ptr<event::BaseEvent> event);
+
+  /** Progress reports replaced by a more recent one for the same target. */
+  uint64_t coalesced() const { return coalesced_; }
+  /** Progress reports dropped because the queue was full. */
+  uint64_t dropped() const { return dropped_; }
+
+ private:
+  void run();
+
+  std::shared_ptr<event::Channel> sink_;
+  const size_t capacity_;
+  std::deque<std::shared_ptr<event::BaseEvent>> queue_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool shutdown_{false};
+  std::atomic<uint64_t> coalesced_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::thread thread_;
+};
+
+#endif  // EVENT_DISPATCHER_H_
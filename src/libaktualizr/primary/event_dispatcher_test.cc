@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libaktualizr/events.h"
+#include "primary/event_dispatcher.h"
+
+static std::shared_ptr<event::BaseEvent> progress(const std::string &filename, unsigned int value) {
+  Uptane::Target target(filename, Uptane::EcuMap{}, std::vector<Hash>{}, 0);
+  return std::make_shared<event::DownloadProgressReport>(target, "", value);
+}
+
+/* Delivers events in order while the handler of the first one is stalled,
+ * keeping only the latest progress report of each target and dropping
+ * progress reports once the queue is full. */
+class AsyncEventDispatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    sink = std::make_shared<event::Channel>();
+    sink->connect([this](const std::shared_ptr<event::BaseEvent> &event) {
+      if (event->isTypeOf<event::SendDeviceDataComplete>()) {
+        started.set_value();
+        gate.get_future().wait();
+      }
+      std::string name = event->variant;
+      if (event->isTypeOf<event::DownloadProgressReport>()) {
+        const auto &report = dynamic_cast<const event::DownloadProgressReport &>(*event);
+        name = report.target.filename() + ":" + std::to_string(report.progress);
+      }
+      received.push_back(name);
+    });
+  }
+
+  std::shared_ptr<event::Channel> sink;
+  std::promise<void> started;
+  std::promise<void> gate;
+  std::vector<std::string> received;
+};
+
+TEST_F(AsyncEventDispatcherTest, Coalesce) {
+  uint64_t coalesced = 0;
+  {
+    AsyncEventDispatcher dispatcher(sink, 8);
+    dispatcher.enqueue(std::make_shared<event::SendDeviceDataComplete>());
+    started.get_future().wait();
+    dispatcher.enqueue(progress("a", 10));
+    dispatcher.enqueue(progress("b", 10));
+    dispatcher.enqueue(progress("a", 20));
+    dispatcher.enqueue(progress("a", 30));
+    dispatcher.enqueue(std::make_shared<event::PutManifestComplete>(true));
+    gate.set_value();
+    coalesced = dispatcher.coalesced();
+  }
+  EXPECT_EQ(coalesced, 2);
+  const std::vector<std::string> expected{"SendDeviceDataComplete", "a:30", "b:10", "PutManifestComplete"};
+  EXPECT_EQ(received, expected);
+}
+
+TEST_F(AsyncEventDispatcherTest, Drop) {
+  uint64_t dropped = 0;
+  {
+    AsyncEventDispatcher dispatcher(sink, 2);
+    dispatcher.enqueue(std::make_shared<event::SendDeviceDataComplete>());
+    started.get_future().wait();
+    dispatcher.enqueue(progress("a", 10));
+    dispatcher.enqueue(progress("b", 10));
+    dispatcher.enqueue(progress("c", 10));
+    dropped = dispatcher.dropped();
+    gate.set_value();
+    // Waits for a free slot instead of being dropped
+    dispatcher.enqueue(progress("c", 100));
+  }
+  EXPECT_EQ(dropped, 1);
+  const std::vector<std::string> expected{"SendDeviceDataComplete", "a:10", "b:10", "c:100"};
+  EXPECT_EQ(received, expected);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
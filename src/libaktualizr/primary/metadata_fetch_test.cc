@@ -1,9 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <ctime>
 #include <string>
+#include <thread>
 
 #include "httpfake.h"
 #include "libaktualizr/aktualizr.h"
+#include "logging/metrics.h"
 #include "test_utils.h"
 #include "uptane_repo.h"
 #include "uptane_test_common.h"
@@ -42,14 +47,15 @@ class HttpFakeMetaCounter : public HttpFake {
     return HttpFake::get(url, maxsize, flow_control);
   }
 
-  int director_1root_count{0};
-  int director_2root_count{0};
-  int director_targets_count{0};
-  int image_1root_count{0};
-  int image_2root_count{0};
-  int image_timestamp_count{0};
-  int image_snapshot_count{0};
-  int image_targets_count{0};
+  // Atomic, as the metadata of both repos can be fetched in parallel
+  std::atomic<int> director_1root_count{0};
+  std::atomic<int> director_2root_count{0};
+  std::atomic<int> director_targets_count{0};
+  std::atomic<int> image_1root_count{0};
+  std::atomic<int> image_2root_count{0};
+  std::atomic<int> image_timestamp_count{0};
+  std::atomic<int> image_snapshot_count{0};
+  std::atomic<int> image_targets_count{0};
 };
 
 /*
@@ -140,6 +146,165 @@ TEST(Aktualizr, MetadataFetch) {
   EXPECT_EQ(http->image_targets_count, 1);
 }
 
+/*
+ * With uptane.parallel_metadata_fetch, the Image repo metadata is fetched along
+ * with the Director's even without new targets, and the Snapshot along with the
+ * Timestamp even when the stored one is still current.
+ */
+TEST(Aktualizr, ParallelMetadataFetch) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.parallel_metadata_fetch = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kNoUpdatesAvailable);
+  EXPECT_EQ(http->director_targets_count, 1);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+  EXPECT_EQ(http->image_snapshot_count, 1);
+  EXPECT_EQ(http->image_targets_count, 1);
+
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+  uptane_repo_.addTarget("firmware.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.signTargets();
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(update_result.updates.size(), 1);
+  EXPECT_EQ(http->director_targets_count, 2);
+  EXPECT_EQ(http->image_timestamp_count, 2);
+  EXPECT_EQ(http->image_snapshot_count, 2);
+  EXPECT_EQ(http->image_targets_count, 2);
+
+  // Nothing changed: the Snapshot is still requested, but not the Targets
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->image_timestamp_count, 3);
+  EXPECT_EQ(http->image_snapshot_count, 3);
+  EXPECT_EQ(http->image_targets_count, 2);
+}
+
+static MetricCounter &reusedChecks() {
+  return Metrics::instance().counter("aktualizr_update_checks_reused_total",
+                                     "Update checks answered by the previous one");
+}
+
+/*
+ * With uptane.fast_update_check, a check with unchanged Director Targets reuses
+ * the result of the previous one without fetching the Image repo metadata. A
+ * change of the ECUs or of the installed versions makes the next check
+ * recompute it.
+ */
+TEST(Aktualizr, FastUpdateCheck) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.fast_update_check = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+  uptane_repo_.addTarget("firmware.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.signTargets();
+
+  const uint64_t reused = reusedChecks().value();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1U);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+  EXPECT_EQ(reusedChecks().value(), reused);
+
+  // Nothing changed: the result is reused, the Image repo is not contacted
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1U);
+  EXPECT_EQ(update_result.updates[0].filename(), "firmware.txt");
+  EXPECT_EQ(http->director_targets_count, 2);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+  EXPECT_EQ(reusedChecks().value(), reused + 1);
+
+  // The Secondary is stored again: the result is recomputed once
+  SecondaryInfo info;
+  ASSERT_TRUE(storage->loadSecondaryInfo(Uptane::EcuSerial("secondary_ecu_serial"), &info));
+  storage->saveSecondaryInfo(info.serial, info.type, info.pub_key);
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(update_result.updates.size(), 1U);
+  EXPECT_EQ(reusedChecks().value(), reused + 1);
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(reusedChecks().value(), reused + 2);
+
+  // The update got installed meanwhile: nothing left to do
+  storage->savePrimaryInstalledVersion(update_result.updates[0], InstalledVersionUpdateMode::kCurrent, "");
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kNoUpdatesAvailable);
+  EXPECT_EQ(reusedChecks().value(), reused + 2);
+}
+
+/*
+ * With uptane.fast_update_check, the result of the previous check is not
+ * reused once the stored Image repo metadata has expired: it is fetched again.
+ */
+TEST(Aktualizr, FastUpdateCheckImageMetaExpired) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.fast_update_check = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  const int expiration_in_sec = 5;
+  time_t expiration_time = std::time(nullptr) + expiration_in_sec;
+  struct tm expiration_tm {};
+  gmtime_r(&expiration_time, &expiration_tm);
+  DirectorRepo director_repo{meta_dir.Path(), "", ""};
+  ImageRepo image_repo{meta_dir.Path(), TimeStamp(expiration_tm).ToString(), ""};
+  director_repo.generateRepo(KeyType::kED25519);
+  image_repo.generateRepo(KeyType::kED25519);
+  image_repo.addBinaryImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+  director_repo.addTarget("firmware.txt", image_repo.getTarget("firmware.txt"), "primary_hw", "CA:FE:A6:D2:84:9D");
+  director_repo.signTargets();
+
+  const uint64_t reused = reusedChecks().value();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+  EXPECT_EQ(reusedChecks().value(), reused + 1);
+
+  std::this_thread::sleep_for(std::chrono::seconds(expiration_in_sec + 1));
+  image_repo.refresh(Uptane::Role::Root());
+  image_repo.refresh(Uptane::Role::Targets());
+  image_repo.refresh(Uptane::Role::Snapshot());
+  image_repo.refresh(Uptane::Role::Timestamp());
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(update_result.updates.size(), 1U);
+  EXPECT_EQ(http->director_targets_count, 3);
+  EXPECT_EQ(http->image_timestamp_count, 2);
+  EXPECT_EQ(reusedChecks().value(), reused + 1);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,71 @@
+#include "primary/notification_listener.h"
+
+#include <algorithm>
+
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+
+NotificationListener::NotificationListener(std::string url, std::shared_ptr<HttpInterface> http,
+                                           std::function<void()> on_notification,
+                                           std::chrono::milliseconds retry_pause,
+                                           std::chrono::milliseconds max_retry_pause)
+    : url_{std::move(url)},
+      http_{std::move(http)},
+      on_notification_{std::move(on_notification)},
+      retry_pause_{retry_pause},
+      max_retry_pause_{std::max(retry_pause, max_retry_pause)} {
+  thread_ = std::thread(std::bind(&NotificationListener::run, this));
+}
+
+NotificationListener::~NotificationListener() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    shutdown_ = true;
+  }
+  token_.setAbort();
+  cv_.notify_all();
+  thread_.join();
+}
+
+bool NotificationListener::pause(std::chrono::milliseconds duration) {
+  std::unique_lock<std::mutex> lock(m_);
+  return !cv_.wait_for(lock, duration, [this] { return shutdown_; });
+}
+
+void NotificationListener::run() {
+  std::chrono::milliseconds retry_pause = retry_pause_;
+  while (!token_.hasAborted()) {
+    const auto start = std::chrono::steady_clock::now();
+    const HttpResponse response = http_->get(url_, kMaxNotificationSize, &token_);
+    if (token_.hasAborted()) {
+      break;
+    }
+
+    if (response.isOk()) {
+      if (!connected_.exchange(true)) {
+        LOG_INFO << "Listening for update notifications";
+      }
+      retry_pause = retry_pause_;
+      if (response.http_status_code != 204 && response.http_status_code != 304) {
+        LOG_DEBUG << "Update notification received";
+        on_notification_();
+      } else if (std::chrono::steady_clock::now() - start < retry_pause_) {
+        // The server does not hold requests open, don't hammer it
+        if (!pause(retry_pause_)) {
+          break;
+        }
+      }
+      continue;
+    }
+
+    if (connected_.exchange(false)) {
+      LOG_WARNING << "Lost the connection for update notifications: " << response.getStatusStr();
+      on_notification_();
+    }
+    LOG_DEBUG << "Retrying to listen for update notifications in " << retry_pause.count() << " ms";
+    if (!pause(retry_pause)) {
+      break;
+    }
+    retry_pause = std::min(retry_pause * 2, max_retry_pause_);
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef NOTIFICATION_LISTENER_H_
+#define NOTIFICATION_LISTENER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "utilities/flow_control.h"
+
+class HttpInterface;
+
+/**
+ * Waits for update notifications from the server with HTTP long polling.
+ *
+ * The server holds every request to the notification URL open until it has
+ * news for the device, or until it gives up. HTTP 204 and 304 answers mean
+ * that there was no news; any other successful answer is a notification, and
+ * `on_notification` is called. The next request is sent right away.
+ *
+ * While the server can not be reached, requests are retried with exponential
+ * backoff from `retry_pause` up to `max_retry_pause`, and connected() is
+ * false. `on_notification` is also called once when the connection is lost,
+ * so that the caller can go back to polling.
+ */
+class NotificationListener {
+ public:
+  NotificationListener(std::string url, std::shared_ptr<HttpInterface> http, std::function<void()> on_notification,
+                       std::chrono::milliseconds retry_pause, std::chrono::milliseconds max_retry_pause);
+  ~NotificationListener();
+  NotificationListener(const NotificationListener&) = delete;
+  NotificationListener(NotificationListener&&) = delete;
+  NotificationListener& operator=(const NotificationListener&) = delete;
+  NotificationListener& operator=(NotificationListener&&) = delete;
+
+  bool connected() const { return connected_; }
+
+ private:
+  static constexpr int64_t kMaxNotificationSize = 64 * 1024;
+
+  void run();
+  // Returns false on shutdown
+  bool pause(std::chrono::milliseconds duration);
+
+  const std::string url_;
+  std::shared_ptr<HttpInterface> http_;
+  std::function<void()> on_notification_;
+  const std::chrono::milliseconds retry_pause_;
+  const std::chrono::milliseconds max_retry_pause_;
+  std::atomic<bool> connected_{false};
+  // Aborts the request in flight on shutdown
+  api::FlowControlToken token_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool shutdown_{false};
+  std::thread thread_;
+};
+
+#endif  // NOTIFICATION_LISTENER_H_
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <future>
+
+#include "primary/notification_listener.h"
+
+#include "httpfake.h"
+#include "logging/logging.h"
+
+using std::chrono::milliseconds;
+
+/* Answers the notification requests in order, then holds them until aborted. */
+class HttpFakeNotifications : public HttpFake {
+ public:
+  HttpFakeNotifications(const boost::filesystem::path &test_dir_in, std::deque<HttpResponse> responses)
+      : HttpFake(test_dir_in), responses_(std::move(responses)) {}
+
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    (void)maxsize;
+    EXPECT_EQ(url, "https://notifications.example.com/device");
+    std::unique_lock<std::mutex> lock(m_);
+    ++requests_;
+    if (responses_.empty()) {
+      drained_.set_value();
+      while (!flow_control->hasAborted()) {
+        lock.unlock();
+        std::this_thread::sleep_for(milliseconds(10));
+        lock.lock();
+      }
+      return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "aborted");
+    }
+    HttpResponse response = responses_.front();
+    responses_.pop_front();
+    return response;
+  }
+
+  std::future<void> drained() { return drained_.get_future(); }
+  int requests() {
+    std::lock_guard<std::mutex> lock(m_);
+    return requests_;
+  }
+
+ private:
+  std::mutex m_;
+  std::deque<HttpResponse> responses_;
+  std::promise<void> drained_;
+  int requests_{0};
+};
+
+/*
+ * Every answer but 204 and 304 is a notification. Losing the connection is
+ * reported once, and the listener connects again.
+ */
+TEST(NotificationListener, Notifications) {
+  TemporaryDirectory temp_dir;
+  const HttpResponse none("", 204, CURLE_OK, "");
+  const HttpResponse update("{}", 200, CURLE_OK, "");
+  const HttpResponse failure("", 0, CURLE_COULDNT_CONNECT, "no route");
+  auto http = std::make_shared<HttpFakeNotifications>(
+      temp_dir.Path(), std::deque<HttpResponse>{none, update, failure, failure, update, none});
+  auto drained = http->drained();
+
+  std::atomic<int> notifications{0};
+  {
+    NotificationListener listener(
+        "https://notifications.example.com/device", http, [&notifications]() { ++notifications; }, milliseconds(1),
+        milliseconds(4));
+    ASSERT_EQ(drained.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    EXPECT_TRUE(listener.connected());
+  }
+  EXPECT_EQ(http->requests(), 7);
+  // Two updates and one lost connection
+  EXPECT_EQ(notifications, 3);
+}
+
+/* A listener that can not connect is not connected, and stops right away when destroyed. */
+TEST(NotificationListener, Unreachable) {
+  TemporaryDirectory temp_dir;
+  const HttpResponse failure("", 0, CURLE_COULDNT_CONNECT, "no route");
+  auto http = std::make_shared<HttpFakeNotifications>(temp_dir.Path(), std::deque<HttpResponse>(5, failure));
+  std::atomic<int> notifications{0};
+  NotificationListener listener(
+      "https://notifications.example.com/device", http, [&notifications]() { ++notifications; }, milliseconds(1),
+      std::chrono::hours(1));
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_FALSE(listener.connected());
+  EXPECT_EQ(notifications, 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
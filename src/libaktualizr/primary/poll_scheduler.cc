@@ -0,0 +1,97 @@
+#include "primary/poll_scheduler.h"
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+PollScheduler::PollScheduler(const UptaneConfig& config)
+    : interval_{std::chrono::seconds(config.polling_sec)},
+      active_interval_{std::chrono::seconds(config.polling_active_sec)},
+      max_interval_{std::chrono::seconds(std::max(config.polling_max_sec, config.polling_sec))},
+      jitter_percent_{static_cast<int64_t>(std::min<uint64_t>(config.polling_jitter_percent, 50))} {
+  if (active_interval_.count() == 0 || active_interval_ > interval_) {
+    active_interval_ = interval_;
+  }
+}
+
+void PollScheduler::setDeviceSeed(const std::string& seed) {
+  // FNV-1a, so that a device keeps its place in the range across restarts and versions
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char c : seed) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+  }
+  jitter_position_ = static_cast<double>(hash % 10000) / 10000.0;
+  seeded_ = true;
+}
+
+std::chrono::milliseconds PollScheduler::next(Outcome outcome, int64_t server_hint_sec) {
+  std::chrono::milliseconds interval = outcome == Outcome::kActive ? active_interval_ : interval_;
+  if (outcome == Outcome::kFailed) {
+    // Retry at the usual interval first, then back off
+    for (unsigned i = 0; i < failures_ && interval < max_interval_; ++i) {
+      interval *= 2;
+    }
+    interval = std::min(interval, max_interval_);
+    ++failures_;
+  } else {
+    failures_ = 0;
+  }
+
+  // Between (100 - jitter_percent)% and (100 + jitter_percent)% of the interval
+  const double spread = seeded_ ? static_cast<double>(jitter_percent_) / 100.0 : 0.0;
+  auto jittered = std::chrono::milliseconds(
+      static_cast<int64_t>(static_cast<double>(interval.count()) * (1.0 + spread * (2.0 * jitter_position_ - 1.0))));
+
+  if (server_hint_sec >= 0) {
+    // Never sooner than the server asked for, but spread out after it
+    const std::chrono::milliseconds hint = std::chrono::seconds(std::min(server_hint_sec, kMaxServerHintSec));
+    const auto hinted = std::chrono::milliseconds(
+        static_cast<int64_t>(static_cast<double>(hint.count()) * (1.0 + spread * jitter_position_)));
+    jittered = std::max(jittered, hinted);
+  }
+  // The same minimum as for uptane.polling_sec
+  return std::max<std::chrono::milliseconds>(jittered, std::chrono::seconds(1));
+}
+
+void PollScheduler::save(const boost::filesystem::path& file, std::chrono::system_clock::time_point next_check) const {
+  Json::Value state;
+  state["nextCheck"] = static_cast<Json::Int64>(
+      std::chrono::duration_cast<std::chrono::seconds>(next_check.time_since_epoch()).count());
+  state["failures"] = failures_;
+  try {
+    Utils::writeFile(file, Utils::jsonToCanonicalStr(state));
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not keep the time of the next update check: " << e.what();
+  }
+}
+
+boost::optional<std::chrono::system_clock::time_point> PollScheduler::load(const boost::filesystem::path& file,
+                                                                          std::chrono::system_clock::time_point now) {
+  boost::system::error_code ec;
+  if (!boost::filesystem::exists(file, ec)) {
+    return boost::none;
+  }
+  Json::Value state;
+  try {
+    state = Utils::parseJSONFile(file);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not read the time of the next update check from " << file << ": " << e.what();
+  }
+  boost::filesystem::remove(file, ec);
+  if (!state.isObject() || !state["nextCheck"].isInt64() || !state["failures"].isUInt()) {
+    LOG_WARNING << "Ignoring the malformed polling state in " << file;
+    return boost::none;
+  }
+  const std::chrono::system_clock::time_point next_check{std::chrono::seconds(state["nextCheck"].asInt64())};
+  if (next_check + max_interval_ < now) {
+    LOG_DEBUG << "Ignoring the stale polling state in " << file;
+    return boost::none;
+  }
+  failures_ = state["failures"].asUInt();
+  // The clock may have been set back meanwhile, never wait longer than the longest interval
+  return std::min(std::max(next_check, now), now + max_interval_);
+}
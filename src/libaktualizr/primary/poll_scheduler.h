@@ -0,0 +1,75 @@
+#ifndef POLL_SCHEDULER_H_
+#define POLL_SCHEDULER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
+struct UptaneConfig;
+
+/**
+ * Decides when the next online update check is due.
+ *
+ * Checks are uptane.polling_sec apart, or polling_active_sec apart while an
+ * update is in progress. After a failed check the interval doubles, up to
+ * polling_max_sec. The server can ask for a longer interval with Retry-After
+ * or Cache-Control: max-age. On top of that, every device stretches or
+ * shrinks the interval by a fixed fraction of its own, of up to
+ * polling_jitter_percent, so that devices which lost the server at the same
+ * time do not all come back at the same time.
+ */
+class PollScheduler {
+ public:
+  enum class Outcome {
+    kIdle,    // the check found nothing to do
+    kActive,  // an update is in progress
+    kFailed,  // the check failed, e.g. the server answered with an error
+  };
+
+  explicit PollScheduler(const UptaneConfig& config);
+
+  /** Fixes the jitter of this device, from e.g. its device ID. Until then there is none. */
+  void setDeviceSeed(const std::string& seed);
+  bool hasDeviceSeed() const { return seeded_; }
+
+  /**
+   * Time from the end of a check with `outcome` to the next one.
+   * `server_hint_sec` is the interval asked for by the server, negative if it
+   * did not ask for any.
+   */
+  std::chrono::milliseconds next(Outcome outcome, int64_t server_hint_sec = -1);
+
+  unsigned failures() const { return failures_; }
+
+  /**
+   * Keeps the backoff and the time of the next check in `file`, for when
+   * aktualizr exits while idle and is started again later.
+   */
+  void save(const boost::filesystem::path& file, std::chrono::system_clock::time_point next_check) const;
+
+  /**
+   * Restores what save() kept in `file`, and removes it so that it is only
+   * used once. Returns the time of the next check, or nothing if no state was
+   * kept or if it is stale: a check that was due more than the longest
+   * interval ago means that aktualizr was not started again for it.
+   */
+  boost::optional<std::chrono::system_clock::time_point> load(const boost::filesystem::path& file,
+                                                              std::chrono::system_clock::time_point now);
+
+ private:
+  static constexpr int64_t kMaxServerHintSec = 24 * 3600;
+
+  std::chrono::milliseconds interval_;
+  std::chrono::milliseconds active_interval_;
+  std::chrono::milliseconds max_interval_;
+  int64_t jitter_percent_;
+  // Where this device sits in the jitter range, in [0, 1)
+  double jitter_position_{0.0};
+  bool seeded_{false};
+  unsigned failures_{0};
+};
+
+#endif  // POLL_SCHEDULER_H_
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <set>
+
+#include "primary/poll_scheduler.h"
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+static UptaneConfig makeConfig() {
+  UptaneConfig config;
+  config.polling_sec = 10;
+  config.polling_active_sec = 2;
+  config.polling_max_sec = 60;
+  config.polling_jitter_percent = 10;
+  return config;
+}
+
+/* Without a seed there is no jitter. */
+TEST(PollScheduler, Intervals) {
+  PollScheduler dut(makeConfig());
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle), seconds(10));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kActive), seconds(2));
+}
+
+/* The interval doubles after every failed check, up to the maximum, and is back to normal after a good one. */
+TEST(PollScheduler, Backoff) {
+  PollScheduler dut(makeConfig());
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(10));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(20));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(40));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(60));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(60));
+  EXPECT_EQ(dut.failures(), 5);
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle), seconds(10));
+  EXPECT_EQ(dut.failures(), 0);
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kFailed), seconds(10));
+}
+
+/* The server can make the interval longer, but not shorter. */
+TEST(PollScheduler, ServerHint) {
+  PollScheduler dut(makeConfig());
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle, 300), seconds(300));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle, 1), seconds(10));
+  EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle, 0), seconds(10));
+}
+
+/* Every device keeps its own offset within the jitter range. */
+TEST(PollScheduler, Jitter) {
+  std::set<int64_t> intervals;
+  for (int i = 0; i < 20; ++i) {
+    PollScheduler dut(makeConfig());
+    dut.setDeviceSeed("device-" + std::to_string(i));
+    const milliseconds first = dut.next(PollScheduler::Outcome::kIdle);
+    EXPECT_GE(first, seconds(9));
+    EXPECT_LT(first, seconds(11));
+    EXPECT_EQ(dut.next(PollScheduler::Outcome::kIdle), first);
+    intervals.insert(first.count());
+
+    const milliseconds hinted = dut.next(PollScheduler::Outcome::kIdle, 100);
+    EXPECT_GE(hinted, seconds(100));
+    EXPECT_LT(hinted, seconds(110));
+  }
+  EXPECT_GT(intervals.size(), 10);
+
+  PollScheduler again(makeConfig());
+  again.setDeviceSeed("device-0");
+  PollScheduler same(makeConfig());
+  same.setDeviceSeed("device-0");
+  EXPECT_EQ(again.next(PollScheduler::Outcome::kIdle), same.next(PollScheduler::Outcome::kIdle));
+}
+
+/* The backoff and the next check survive a restart, within the longest
+ * interval. The state is used once, and ignored once it is stale. */
+TEST(PollScheduler, SaveLoad) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path file = temp_dir / "poll.state";
+  const auto now = std::chrono::system_clock::time_point(seconds(1000000));
+
+  PollScheduler empty(makeConfig());
+  EXPECT_FALSE(empty.load(file, now));
+
+  PollScheduler dut(makeConfig());
+  dut.next(PollScheduler::Outcome::kFailed);
+  dut.next(PollScheduler::Outcome::kFailed);
+  dut.save(file, now + seconds(40));
+
+  PollScheduler restarted(makeConfig());
+  EXPECT_TRUE(restarted.load(file, now + seconds(10)) == now + seconds(40));
+  EXPECT_EQ(restarted.failures(), 2);
+  EXPECT_EQ(restarted.next(PollScheduler::Outcome::kFailed), seconds(40));
+  EXPECT_FALSE(boost::filesystem::exists(file));
+  EXPECT_FALSE(PollScheduler(makeConfig()).load(file, now + seconds(10)));
+
+  // Overdue, or too far ahead after the clock was set back
+  dut.save(file, now + seconds(40));
+  EXPECT_TRUE(PollScheduler(makeConfig()).load(file, now + seconds(50)) == now + seconds(50));
+  dut.save(file, now + seconds(40));
+  EXPECT_TRUE(PollScheduler(makeConfig()).load(file, now - seconds(3600)) == now - seconds(3600) + seconds(60));
+
+  // Overdue by more than the longest interval
+  dut.save(file, now + seconds(40));
+  PollScheduler stale(makeConfig());
+  EXPECT_FALSE(stale.load(file, now + seconds(200)));
+  EXPECT_EQ(stale.failures(), 0U);
+  EXPECT_FALSE(boost::filesystem::exists(file));
+
+  Utils::writeFile(file, std::string("not json"));
+  EXPECT_FALSE(PollScheduler(makeConfig()).load(file, now));
+  EXPECT_FALSE(boost::filesystem::exists(file));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
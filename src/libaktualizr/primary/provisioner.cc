@@ -205,6 +205,7 @@ void Provisioner::initTlsCreds() {
     throw ServerError("Received malformed device credentials from the server");
   }
   storage_->storeTlsCreds(ca, cert, pkey);
+  key_manager_->invalidateKeys();
 
   // Set provisioned (device) credentials.
   if (!key_manager_->copyCertsToCurl(*http_client_)) {
@@ -1,11 +1,16 @@
 #include "reportqueue.h"
 
+#include <algorithm>
 #include <chrono>
+#include <set>
 
 #include "http/httpclient.h"
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
+#include "logging/metrics.h"
 #include "storage/invstorage.h"
+#include "utilities/memory_budget.h"
+#include "utilities/retry_policy.h"
 
 ReportQueue::ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface> http_client,
                          std::shared_ptr<INvStorage> storage_in, int run_pause_s, int event_number_limit)
@@ -34,28 +39,50 @@ ReportQueue::~ReportQueue() {
 }
 
 void ReportQueue::run() {
-  // Check if queue is nonempty. If so, move any reports to the Json array and
-  // try to send it to the server. Clear the Json array only if the send
-  // succeeds.
+  // Sleep until events are enqueued, then send them batch after batch until
+  // the storage is empty. Back off exponentially while the server fails,
+  // starting from run_pause_s_, or as long as the server asks.
+  const RetryPolicy retry_policy{0, std::chrono::seconds(run_pause_s_), kMaxRetryPause, 2.0, 0.5};
+  int retry = 0;
+  auto is_shutdown = [this] { return shutdown_; };
+
   std::unique_lock<std::mutex> lock(m_);
   while (!shutdown_) {
-    flushQueue();
-    cv_.wait_for(lock, std::chrono::seconds(run_pause_s_));
+    if (!pending_) {
+      cv_.wait(lock, [this] { return shutdown_ || pending_; });
+      cv_.wait_for(lock, kFlushDebounce, is_shutdown);
+      continue;
+    }
+    if (flushQueue()) {
+      retry = 0;
+      continue;
+    }
+    if (!pending_) {
+      continue;
+    }
+    const auto retry_pause = retry_policy.delay(++retry, retry_after_sec_);
+    LOG_TRACE << "Retrying to send report events in " << retry_pause.count() << " ms";
+    cv_.wait_for(lock, retry_pause, is_shutdown);
   }
 }
 
 void ReportQueue::enqueue(std::unique_ptr<ReportEvent> event) {
   {
     std::lock_guard<std::mutex> lock(m_);
-    storage->saveReportEvent(event->toJson());
+    storage->saveReportEvent(event->toJson(), event->urgent);
+    pending_ = true;
   }
   cv_.notify_all();
 }
 
-void ReportQueue::flushQueue() {
+bool ReportQueue::flushQueue() {
   int64_t max_id = 0;
   Json::Value report_array{Json::arrayValue};
-  storage->loadReportEvents(&report_array, &max_id, cur_event_number_limit_);
+  // A batch is smaller while the memory budget is short; it still holds at least one event
+  const auto max_bytes = static_cast<int64_t>(
+      std::min<uint64_t>(static_cast<uint64_t>(cur_batch_bytes_), MemoryBudget::instance().available()));
+  storage->loadReportEvents(&report_array, &max_id, cur_event_number_limit_, max_bytes);
+  coalesceEvents(&report_array);
 
   if (config.tls.server.empty()) {
     // Prevent a lot of unnecessary garbage output in uptane vector tests.
@@ -63,10 +90,28 @@ void ReportQueue::flushQueue() {
     report_array.clear();
   }
 
-  if (!report_array.empty()) {
-    HttpResponse response = http->post(config.tls.server + "/events", report_array);
+  bool retry_now = false;
+  if (report_array.empty()) {
+    pending_ = false;
+  } else {
+    static auto& sent = Metrics::instance().counter("aktualizr_report_events_sent_total", "Report events delivered");
+    static auto& failures =
+        Metrics::instance().counter("aktualizr_report_post_failures_total", "Report batches the server did not accept");
+    static auto& latency =
+        Metrics::instance().histogram("aktualizr_report_post_duration_seconds", "Duration of posting a report batch");
+    HttpResponse response;
+    {
+      ScopedLatency timer(latency);
+      response = http->post(config.tls.server + "/events", report_array);
+    }
 
     bool delete_events{response.isOk()};
+    retry_after_sec_ = response.isOk() ? -1 : response.retry_after_sec;
+    if (response.isOk()) {
+      sent.add(report_array.size());
+    } else {
+      failures.add();
+    }
     // 404 implies the server does not support this feature. Nothing we can
     // do, just move along.
     if (response.http_status_code == 404) {
@@ -76,8 +121,11 @@ void ReportQueue::flushQueue() {
       if (report_array.size() > 1) {
         // if 413 is received to posting of more than one event then try sending less events next time
         cur_event_number_limit_ = report_array.size() > 2 ? static_cast<int>(report_array.size() / 2U) : 1;
+        const auto batch_bytes = static_cast<int64_t>(Utils::jsonToCanonicalStr(report_array).size());
+        cur_batch_bytes_ = std::max<int64_t>(1, batch_bytes / 2);
         LOG_DEBUG << "Got 413 response to request that contains " << report_array.size() << " events. Will try to send "
                   << cur_event_number_limit_ << " events.";
+        retry_now = true;
       } else {
         // An event is too big to be accepted by the server, let's drop it
         LOG_WARNING << "Dropping a report event " << report_array[0].get("id", "unknown") << " since the server `"
@@ -91,8 +139,38 @@ void ReportQueue::flushQueue() {
       report_array.clear();
       storage->deleteReportEvents(max_id);
       cur_event_number_limit_ = event_number_limit_;
+      cur_batch_bytes_ = kMaxBatchBytes;
+      retry_now = true;
     }
   }
+  return retry_now;
+}
+
+void ReportQueue::coalesceEvents(Json::Value* report_array) {
+  // Only events that report a state rather than a step are safe to drop
+  static const std::set<std::string> coalescable{"campaign_postponed",     "DevicePaused",
+                                                 "DeviceResumed",          "EcuDownloadStarted",
+                                                 "EcuInstallationStarted", "EcuInstallationApplied"};
+  if (report_array->size() < 2) {
+    return;
+  }
+
+  Json::Value coalesced{Json::arrayValue};
+  const Json::Value* previous = nullptr;
+  for (const auto& event : *report_array) {
+    if (previous != nullptr && event["eventType"].isObject() && (*previous)["eventType"].isObject() &&
+        coalescable.count(event["eventType"]["id"].asString()) != 0 &&
+        event["eventType"] == (*previous)["eventType"] && event["event"] == (*previous)["event"]) {
+      LOG_TRACE << "Coalescing report event " << event.get("id", "unknown");
+      continue;
+    }
+    coalesced.append(event);
+    previous = &event;
+  }
+  if (coalesced.size() != report_array->size()) {
+    LOG_DEBUG << "Coalesced " << report_array->size() - coalesced.size() << " redundant report events";
+    *report_array = std::move(coalesced);
+  }
 }
 
 void ReportEvent::setEcu(const Uptane::EcuSerial& ecu) { custom["ecu"] = ecu.ToString(); }
@@ -105,8 +183,10 @@ void ReportEvent::setCorrelationId(const std::string& correlation_id) {
 Json::Value ReportEvent::toJson() const {
   Json::Value out;
 
+  struct tm time_struct {};
+  gmtime_r(&timestamp, &time_struct);
   out["id"] = id;
-  out["deviceTime"] = timestamp.ToString();
+  out["deviceTime"] = TimeStamp(time_struct).ToString();
   out["eventType"]["id"] = type;
   out["eventType"]["version"] = version;
   out["event"] = custom;
@@ -116,10 +196,12 @@ Json::Value ReportEvent::toJson() const {
 
 CampaignAcceptedReport::CampaignAcceptedReport(const std::string& campaign_id) : ReportEvent("campaign_accepted", 0) {
   custom["campaignId"] = campaign_id;
+  urgent = true;
 }
 
 CampaignDeclinedReport::CampaignDeclinedReport(const std::string& campaign_id) : ReportEvent("campaign_declined", 0) {
   custom["campaignId"] = campaign_id;
+  urgent = true;
 }
 
 CampaignPostponedReport::CampaignPostponedReport(const std::string& campaign_id)
@@ -161,6 +243,7 @@ EcuInstallationAppliedReport::EcuInstallationAppliedReport(const Uptane::EcuSeri
     : ReportEvent("EcuInstallationApplied", 0) {
   setEcu(ecu);
   setCorrelationId(correlation_id);
+  urgent = true;
 }
 
 EcuInstallationCompletedReport::EcuInstallationCompletedReport(const Uptane::EcuSerial& ecu,
@@ -168,5 +251,13 @@ EcuInstallationCompletedReport::EcuInstallationCompletedReport(const Uptane::Ecu
     : ReportEvent("EcuInstallationCompleted", 0) {
   setEcu(ecu);
   setCorrelationId(correlation_id);
+  urgent = true;
   custom["success"] = success;
 }
+
+UpdateCyclePerformanceReport::UpdateCyclePerformanceReport(const Json::Value& performance,
+                                                           const std::string& correlation_id)
+    : ReportEvent("UpdateCyclePerformance", 0) {
+  custom = performance;
+  setCorrelationId(correlation_id);
+}
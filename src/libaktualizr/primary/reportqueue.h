@@ -2,14 +2,16 @@
 #define REPORTQUEUE_H_
 
 #include <json/json.h>
+#include <chrono>
 #include <condition_variable>
+#include <ctime>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <utility>  // for move
 
-#include "libaktualizr/types.h"  // for EcuSerial (ptr only), TimeStamp
+#include "libaktualizr/types.h"  // for EcuSerial (ptr only)
 #include "utilities/utils.h"     // for Utils
 
 class Config;
@@ -22,13 +24,17 @@ class ReportEvent {
   std::string type;
   int version;
   Json::Value custom;
-  TimeStamp timestamp;
+  // Formatted only by toJson()
+  std::time_t timestamp;
+  // Sent ahead of other events and never dropped, for what the server needs to
+  // know soon after a device was offline
+  bool urgent{false};
 
   Json::Value toJson() const;
 
  protected:
   ReportEvent(std::string event_type, int event_version)
-      : id(Utils::randomUuid()), type(std::move(event_type)), version(event_version), timestamp(TimeStamp::Now()) {}
+      : id(Utils::randomUuid()), type(std::move(event_type)), version(event_version), timestamp(std::time(nullptr)) {}
 
   void setEcu(const Uptane::EcuSerial& ecu);
   void setCorrelationId(const std::string& correlation_id);
@@ -84,6 +90,11 @@ class EcuInstallationCompletedReport : public ReportEvent {
   EcuInstallationCompletedReport(const Uptane::EcuSerial& ecu, const std::string& correlation_id, bool success);
 };
 
+class UpdateCyclePerformanceReport : public ReportEvent {
+ public:
+  UpdateCyclePerformanceReport(const Json::Value& performance, const std::string& correlation_id);
+};
+
 class ReportQueue {
  public:
   ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface> http_client,
@@ -96,8 +107,23 @@ class ReportQueue {
   void run();
   void enqueue(std::unique_ptr<ReportEvent> event);
 
+  /** Time given to a burst of events to accumulate into one request. */
+  static constexpr std::chrono::milliseconds kFlushDebounce{200};
+  /** Upper bound of the pause between retries while the server fails. */
+  static constexpr std::chrono::seconds kMaxRetryPause{600};
+  /** Upper bound of the stored size of the events sent in one request. */
+  static constexpr int64_t kMaxBatchBytes = 512 * 1024;
+
+  /**
+   * Drop events that repeat the state reported by the event right before
+   * them, such as a second DevicePaused for the same correlation ID.
+   */
+  static void coalesceEvents(Json::Value* report_array);
+
  private:
-  void flushQueue();
+  /** Send one batch of events. Returns true if it should be followed by
+   * another attempt right away; clears pending_ once nothing is left. */
+  bool flushQueue();
 
   const Config& config;
   std::shared_ptr<HttpInterface> http;
@@ -106,10 +132,16 @@ class ReportQueue {
   std::mutex m_;
   std::queue<std::unique_ptr<ReportEvent>> report_queue_;
   bool shutdown_{false};
+  // Events may be waiting in storage. True at start to pick up events stored
+  // by a previous run.
+  bool pending_{true};
   std::shared_ptr<INvStorage> storage;
   const int run_pause_s_;
+  // Of the last failed request, for the pause before the next one
+  int64_t retry_after_sec_{-1};
   const int event_number_limit_;
   int cur_event_number_limit_;
+  int64_t cur_batch_bytes_{kMaxBatchBytes};
 };
 
 #endif  // REPORTQUEUE_H_
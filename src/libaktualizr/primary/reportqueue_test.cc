@@ -133,6 +133,26 @@ TEST(ReportQueue, SingleEvent) {
   EXPECT_EQ(http->events_seen, num_events);
 }
 
+/* An event enqueued to an idle queue is sent without waiting for the retry
+ * pause. */
+TEST(ReportQueue, FlushOnEnqueue) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "reportqueue/SingleEvent";
+
+  auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), 1);
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+  ReportQueue report_queue(config, http, sql_storage, 60);
+  // Let the queue find the storage empty and go idle
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  report_queue.enqueue(std_::make_unique<EcuDownloadCompletedReport>(Uptane::EcuSerial("SingleEvent"), "", true));
+  EXPECT_EQ(http->expected_events_received.get_future().wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(http->events_seen, 1);
+}
+
 /* Test ten events. */
 TEST(ReportQueue, MultipleEvents) {
   TemporaryDirectory temp_dir;
@@ -277,6 +297,25 @@ TEST(ReportQueue, PayloadTooLarge) {
   }
 }
 
+/* Consecutive events reporting the same state are sent once. */
+TEST(ReportQueue, CoalesceEvents) {
+  Json::Value events{Json::arrayValue};
+  events.append(DevicePausedReport("corr").toJson());
+  events.append(DevicePausedReport("corr").toJson());
+  events.append(DevicePausedReport("other").toJson());
+  events.append(EcuDownloadCompletedReport(Uptane::EcuSerial("ecu"), "corr", true).toJson());
+  events.append(EcuDownloadCompletedReport(Uptane::EcuSerial("ecu"), "corr", true).toJson());
+  events.append(DevicePausedReport("other").toJson());
+
+  ReportQueue::coalesceEvents(&events);
+  ASSERT_EQ(events.size(), 5);
+  EXPECT_EQ(events[0]["event"]["correlationId"], "corr");
+  EXPECT_EQ(events[1]["event"]["correlationId"], "other");
+  EXPECT_EQ(events[2]["eventType"]["id"], "EcuDownloadCompleted");
+  EXPECT_EQ(events[3]["eventType"]["id"], "EcuDownloadCompleted");
+  EXPECT_EQ(events[4]["eventType"]["id"], "DevicePaused");
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
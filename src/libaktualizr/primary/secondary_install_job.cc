@@ -1,6 +1,17 @@
 #include "primary/secondary_install_job.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
 #include "logging/logging.h"
 #include "primary/sotauptaneclient.h"
+#include "utilities/flow_control.h"
 
 // These are passed as const reference not value because they are references,
 // not rvalues at the call site.
@@ -28,11 +39,6 @@ SecondaryEcuInstallationJob::SecondaryEcuInstallationJob(
   }
 }
 
-void SecondaryEcuInstallationJob::SendFirmwareAsync() {
-  firmware_send_ = std::async(std::launch::async, &SecondaryEcuInstallationJob::SendFirmware, this);
-}
-
-// Called in bg thread from SendFirmwareAsync
 void SecondaryEcuInstallationJob::SendFirmware() {
   if (!installation_result_.isSuccess()) {
     // Can fail in the ctor, but we can't report it until now
@@ -42,30 +48,108 @@ void SecondaryEcuInstallationJob::SendFirmware() {
   // TODO: Is this the right time to send EcuInstallationStartedReport
   uptane_client_.report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(ecu_serial_, correlation_id_));
 
+  const auto presend = uptane_client_.takePresendResult(ecu_serial_, target_);
+  if (presend && presend->isSuccess()) {
+    LOG_INFO << "Secondary " << ecu_serial_ << " received " << target_.filename() << " during the download";
+    installation_result_ = *presend;
+    uptane_client_.storage->saveInstallStage(ecu_serial_, target_, InstallStage::kFirmwareSent);
+    return;
+  }
+  if (uptane_client_.storage->loadInstallStage(ecu_serial_, target_) != InstallStage::kNone) {
+    // The installation was interrupted after this step. If the Secondary lost the firmware meanwhile, e.g. because it
+    // restarted as well, Install() sends it again.
+    LOG_INFO << "Secondary " << ecu_serial_ << " received " << target_.filename() << " before an interruption";
+    sent_before_interruption_ = true;
+    return;
+  }
+
+  send_started_ = std::chrono::steady_clock::now();
   try {
+    const auto started = secondary_.startFirmware(target_, install_info_);
+    if (started) {
+      installation_result_ = *started;
+      receiving_ = started->isSuccess();
+      if (!receiving_) {
+        RecordTransfer();
+      }
+      return;
+    }
     installation_result_ = secondary_.sendFirmware(target_, install_info_, uptane_client_.flow_control_);
   } catch (const std::exception& ex) {
     installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
   }
+  RecordTransfer();
 }
 
-void SecondaryEcuInstallationJob::WaitForFirmwareSent() { firmware_send_.wait(); }
+void SecondaryEcuInstallationJob::RecordTransfer() {
+  const auto duration = std::chrono::steady_clock::now() - send_started_;
+  uptane_client_.performance_.addSecondaryTransfer(ecu_serial_, target_, duration, installation_result_.isSuccess());
+  if (installation_result_.isSuccess()) {
+    uptane_client_.storage->saveInstallStage(ecu_serial_, target_, InstallStage::kFirmwareSent);
+  }
+}
+
+bool SecondaryEcuInstallationJob::PollFirmware() {
+  if (!receiving_) {
+    return true;
+  }
+  try {
+    const auto status = secondary_.firmwareStatus(target_);
+    if (!status) {
+      return false;
+    }
+    installation_result_ = *status;
+  } catch (const std::exception& ex) {
+    installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
+  receiving_ = false;
+  RecordTransfer();
+  return true;
+}
 
-void SecondaryEcuInstallationJob::InstallAsync() {
-  install_ = std::async(std::launch::async, &SecondaryEcuInstallationJob::Install, this);
+void SecondaryEcuInstallationJob::CancelFirmware() {
+  if (!receiving_) {
+    return;
+  }
+  try {
+    secondary_.cancelFirmware(target_);
+  } catch (const std::exception& ex) {
+    LOG_WARNING << "Failed to stop the Secondary receiving the firmware: " << ex.what();
+  }
+  installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled,
+                                                  "Stopped waiting for the Secondary to receive the firmware");
+  receiving_ = false;
+  RecordTransfer();
 }
 
-// Called in bg thread from InstallAsync
 void SecondaryEcuInstallationJob::Install() {
   if (!Ok()) {
-    LOG_ERROR << "SecondaryEcuInstallationJob::InstallAsync() called even though sending firmware failed";
+    LOG_ERROR << "SecondaryEcuInstallationJob::Install() called even though sending firmware failed";
     return;
   }
 
-  try {
-    installation_result_ = secondary_.install(target_, install_info_, uptane_client_.flow_control_);
-  } catch (const std::exception& ex) {
-    installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  if (uptane_client_.storage->loadInstallStage(ecu_serial_, target_) == InstallStage::kInstalled) {
+    LOG_INFO << "Secondary " << ecu_serial_ << " installed " << target_.filename() << " before an interruption";
+    installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  } else {
+    installation_result_ = InstallOnSecondary();
+    if (sent_before_interruption_ && installation_result_.result_code == data::ResultCode::Numeric::kDownloadFailed) {
+      LOG_INFO << "Secondary " << ecu_serial_ << " no longer has " << target_.filename() << ", sending it again";
+      sent_before_interruption_ = false;
+      send_started_ = std::chrono::steady_clock::now();
+      try {
+        installation_result_ = secondary_.sendFirmware(target_, install_info_, uptane_client_.flow_control_);
+      } catch (const std::exception& ex) {
+        installation_result_ = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+      }
+      RecordTransfer();
+      if (installation_result_.isSuccess()) {
+        installation_result_ = InstallOnSecondary();
+      }
+    }
+    if (installation_result_.result_code == data::ResultCode::Numeric::kOk) {
+      uptane_client_.storage->saveInstallStage(ecu_serial_, target_, InstallStage::kInstalled);
+    }
   }
 
   if (installation_result_.result_code == data::ResultCode::Numeric::kNeedCompletion) {
@@ -79,7 +163,13 @@ void SecondaryEcuInstallationJob::Install() {
   have_installed_ = true;
 }
 
-void SecondaryEcuInstallationJob::WaitForInstall() { install_.wait(); }
+data::InstallationResult SecondaryEcuInstallationJob::InstallOnSecondary() {
+  try {
+    return secondary_.install(target_, install_info_, uptane_client_.flow_control_);
+  } catch (const std::exception& ex) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
+}
 
 bool SecondaryEcuInstallationJob::Ok() const { return installation_result_.isSuccess(); }
 
@@ -98,4 +188,102 @@ result::Install::EcuReport SecondaryEcuInstallationJob::InstallationReport() con
       target_, ecu_serial_,
       data::InstallationResult(data::ResultCode(data::ResultCode::Numeric::kOperationCancelled),
                                "Install aborted because not all ECUs received the update"));
-}
\ No newline at end of file
+}
+
+void WaitForSecondaryFirmware(std::vector<SecondaryEcuInstallationJob>& jobs,
+                              const api::FlowControlToken* flow_control, std::chrono::milliseconds poll_interval) {
+  std::vector<SecondaryEcuInstallationJob*> receiving;
+  for (auto& job : jobs) {
+    if (job.Receiving()) {
+      receiving.push_back(&job);
+    }
+  }
+  if (!receiving.empty()) {
+    LOG_INFO << "Waiting for " << receiving.size() << " Secondaries to receive their firmware";
+  }
+
+  while (!receiving.empty()) {
+    receiving.erase(std::remove_if(receiving.begin(), receiving.end(),
+                                   [](SecondaryEcuInstallationJob* job) { return job->PollFirmware(); }),
+                    receiving.end());
+    if (receiving.empty()) {
+      break;
+    }
+    if (flow_control != nullptr && !flow_control->canContinue()) {
+      for (auto* job : receiving) {
+        job->CancelFirmware();
+      }
+      break;
+    }
+    std::this_thread::sleep_for(poll_interval);
+  }
+}
+
+void RunSecondaryInstallationJobs(std::vector<SecondaryEcuInstallationJob>& jobs, size_t max_parallel,
+                                  size_t max_per_type, const std::function<void(SecondaryEcuInstallationJob&)>& step) {
+  if (jobs.empty()) {
+    return;
+  }
+
+  // Largest Targets first
+  std::vector<size_t> pending(jobs.size());
+  std::iota(pending.begin(), pending.end(), 0);
+  std::stable_sort(pending.begin(), pending.end(),
+                   [&jobs](size_t a, size_t b) { return jobs[a].target().length() > jobs[b].target().length(); });
+  std::vector<std::string> types;
+  types.reserve(jobs.size());
+  for (const auto& job : jobs) {
+    types.push_back(job.secondary_type());
+  }
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::map<std::string, size_t> running;
+  static constexpr size_t kNone = SIZE_MAX;
+  // Takes the first pending job whose Secondary type is below its limit, waiting for one if necessary.
+  auto take_job = [&]() -> size_t {
+    std::unique_lock<std::mutex> lock(m);
+    for (;;) {
+      if (pending.empty()) {
+        return kNone;
+      }
+      for (auto it = pending.begin(); it != pending.end(); ++it) {
+        if (max_per_type == 0 || running[types[*it]] < max_per_type) {
+          const size_t i = *it;
+          pending.erase(it);
+          ++running[types[i]];
+          return i;
+        }
+      }
+      cv.wait(lock);
+    }
+  };
+  auto worker = [&]() {
+    for (size_t i = take_job(); i != kNone; i = take_job()) {
+      try {
+        step(jobs[i]);
+      } catch (const std::exception& e) {
+        LOG_ERROR << "Secondary installation step for " << jobs[i].ecu_serial() << " failed: " << e.what();
+      }
+      {
+        std::lock_guard<std::mutex> guard(m);
+        --running[types[i]];
+      }
+      cv.notify_all();
+    }
+  };
+
+  const size_t workers = max_parallel == 0 ? jobs.size() : std::min(jobs.size(), max_parallel);
+  if (workers <= 1) {
+    worker();
+    return;
+  }
+  std::vector<std::future<void>> threads;
+  threads.reserve(workers);
+  for (size_t n = 0; n < workers; ++n) {
+    threads.push_back(std::async(std::launch::async, worker));
+  }
+  for (auto& t : threads) {
+    t.get();
+  }
+}
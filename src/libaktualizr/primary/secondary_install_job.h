@@ -5,14 +5,16 @@
 #include "libaktualizr/secondaryinterface.h"
 #include "libaktualizr/types.h"
 
-#include <future>
+#include <chrono>
+#include <functional>
+#include <vector>
 
 class SotaUptaneClient;
 
 /**
  * This represents the job of installing firmware on a secondary.
- * It is possible to kick off background tasks to separately send and install
- * the firmware, wait for their completion and fetch the results.
+ * Sending and installing the firmware are separate steps, which
+ * RunSecondaryInstallationJobs() runs for many jobs in parallel.
  */
 class SecondaryEcuInstallationJob {
  public:
@@ -21,24 +23,29 @@ class SecondaryEcuInstallationJob {
                               const std::string& correlation_id, UpdateType update_type);
 
   /**
-   * Start sending the firmware to the secondary
+   * Send the firmware to the secondary. If the secondary receives it in the
+   * background, this returns once the transfer has started and Receiving()
+   * is true until PollFirmware() has seen it finish.
    */
-  void SendFirmwareAsync();
+  void SendFirmware();
 
   /**
-   * Wait for the firmware to finish being sent, and fetch the result
+   * Check on a transfer the secondary receives in the background.
+   * @return true once it has finished
    */
-  void WaitForFirmwareSent();
+  bool PollFirmware();
 
   /**
-   * Start installing the firmware on the secondary
+   * Stop a transfer the secondary receives in the background
    */
-  void InstallAsync();
+  void CancelFirmware();
+
+  bool Receiving() const { return receiving_; }
 
   /**
-   * Wait for the installation to complete, and fetch the result
+   * Install the firmware on the secondary
    */
-  void WaitForInstall();
+  void Install();
 
   /**
    * Are things OK so far?
@@ -52,9 +59,13 @@ class SecondaryEcuInstallationJob {
 
   Uptane::Target target() const { return target_; }
 
+  std::string secondary_type() const { return secondary_.Type(); }
+
  private:
-  void SendFirmware();
-  void Install();
+  // Hand the duration of the transfer to the update cycle performance report
+  void RecordTransfer();
+  data::InstallationResult InstallOnSecondary();
+
   SotaUptaneClient& uptane_client_;
   SecondaryInterface& secondary_;
   Uptane::Target target_;
@@ -62,9 +73,29 @@ class SecondaryEcuInstallationJob {
   std::string correlation_id_;
   InstallInfo install_info_;
   data::InstallationResult installation_result_{};  // default ctor => success
-  std::future<void> firmware_send_;
-  std::future<void> install_;
   bool have_installed_{false};
+  bool receiving_{false};
+  // The firmware was not sent again because the install journal says the Secondary received it before
+  bool sent_before_interruption_{false};
+  std::chrono::steady_clock::time_point send_started_;
 };
 
+/**
+ * Run `step` for every job, on at most `max_parallel` threads and for at most
+ * `max_per_type` Secondaries of the same type at a time (0 for no limit).
+ * Jobs with larger Targets start first so that they do not end up last on
+ * the critical path. Returns once all jobs have run.
+ */
+void RunSecondaryInstallationJobs(std::vector<SecondaryEcuInstallationJob>& jobs, size_t max_parallel,
+                                  size_t max_per_type, const std::function<void(SecondaryEcuInstallationJob&)>& step);
+
+/**
+ * Poll the jobs whose secondaries receive firmware in the background until
+ * all of them have finished, from a single thread. If `flow_control` is
+ * aborted, the jobs still receiving fail as cancelled.
+ */
+void WaitForSecondaryFirmware(std::vector<SecondaryEcuInstallationJob>& jobs,
+                              const api::FlowControlToken* flow_control,
+                              std::chrono::milliseconds poll_interval = std::chrono::seconds(1));
+
 #endif  // AKTUALIZR_SECONDARYINSTALLATIONJOB_H
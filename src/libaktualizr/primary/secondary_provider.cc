@@ -1,5 +1,7 @@
 #include "libaktualizr/secondary_provider.h"
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
 #include <fstream>
 
 #include "logging/logging.h"
@@ -7,6 +9,9 @@
 #include "uptane/tuf.h"
 #include "utilities/utils.h"
 
+// Bytes downloaded ahead of a Secondary that receives an image while it is downloaded
+static constexpr size_t kPassThroughBufferSize = 16 * 1024 * 1024;
+
 bool SecondaryProvider::getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const {
   if (!getDirectorMetadata(meta_bundle)) {
     return false;
@@ -17,7 +22,70 @@ bool SecondaryProvider::getMetadata(Uptane::MetaBundle* meta_bundle, const Uptan
   return true;
 }
 
+std::shared_ptr<const Uptane::MetaBundle> SecondaryProvider::getMetadataBundle(const Uptane::Target& target) const {
+  auto snapshot = metadataSnapshot();
+  if (snapshot) {
+    return snapshot;
+  }
+  auto meta_bundle = std::make_shared<Uptane::MetaBundle>();
+  if (!getMetadata(meta_bundle.get(), target)) {
+    return nullptr;
+  }
+  return meta_bundle;
+}
+
+std::shared_ptr<const Uptane::MetaBundle> SecondaryProvider::metadataSnapshot() const {
+  std::lock_guard<std::mutex> guard(payloads_mutex_);
+  return metadata_snapshot_;
+}
+
+void SecondaryProvider::setMetadataSnapshot(std::shared_ptr<const Uptane::MetaBundle> snapshot) {
+  std::lock_guard<std::mutex> guard(payloads_mutex_);
+  metadata_snapshot_ = std::move(snapshot);
+  payloads_.clear();
+}
+
+std::shared_ptr<const std::string> SecondaryProvider::getMetadataPayload(
+    const std::string& key, const std::function<std::string()>& build) const {
+  std::unique_lock<std::mutex> lock(payloads_mutex_);
+  if (!metadata_snapshot_) {
+    lock.unlock();
+    auto payload = std::make_shared<const std::string>(build());
+    return payload->empty() ? nullptr : payload;
+  }
+  auto it = payloads_.find(key);
+  if (it != payloads_.end()) {
+    return it->second;
+  }
+  // Built under the lock, so that Secondaries updated in parallel wait for
+  // the first one instead of all building their own copy.
+  auto payload = std::make_shared<const std::string>(build());
+  if (payload->empty()) {
+    return nullptr;
+  }
+  payloads_.emplace(key, payload);
+  return payload;
+}
+
+static bool copyFromSnapshot(const Uptane::MetaBundle& snapshot, Uptane::MetaBundle* meta_bundle,
+                             Uptane::RepositoryType repo, const std::vector<Uptane::Role>& roles) {
+  for (const auto& role : roles) {
+    const std::string* meta = snapshot.find(repo, role);
+    if (meta == nullptr) {
+      return false;
+    }
+    meta_bundle->emplace(std::make_pair(repo, role), *meta);
+  }
+  return true;
+}
+
 bool SecondaryProvider::getDirectorMetadata(Uptane::MetaBundle* meta_bundle) const {
+  const auto shared = metadataSnapshot();
+  if (shared && copyFromSnapshot(*shared, meta_bundle, Uptane::RepositoryType::Director(),
+                                 {Uptane::Role::Root(), Uptane::Role::Targets()})) {
+    return true;
+  }
+
   std::string root;
   std::string targets;
 
@@ -36,6 +104,17 @@ bool SecondaryProvider::getDirectorMetadata(Uptane::MetaBundle* meta_bundle) con
 }
 
 bool SecondaryProvider::getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const {
+  // TODO: Support delegations for Secondaries. This is the purpose of providing
+  // the desired Target.
+  (void)target;
+
+  const auto shared = metadataSnapshot();
+  if (shared && copyFromSnapshot(*shared, meta_bundle, Uptane::RepositoryType::Image(),
+                                 {Uptane::Role::Root(), Uptane::Role::Timestamp(), Uptane::Role::Snapshot(),
+                                  Uptane::Role::Targets()})) {
+    return true;
+  }
+
   std::string root;
   std::string timestamp;
   std::string snapshot;
@@ -63,10 +142,6 @@ bool SecondaryProvider::getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, co
   meta_bundle->emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Snapshot()), snapshot);
   meta_bundle->emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Targets()), targets);
 
-  // TODO: Support delegations for Secondaries. This is the purpose of providing
-  // the desired Target.
-  (void)target;
-
   return true;
 }
 
@@ -87,6 +162,23 @@ bool SecondaryProvider::pendingPrimaryUpdate() {
 }
 
 std::string SecondaryProvider::getTreehubCredentials() const {
+  return treehubCredentials(config_.pacman.ostree_server);
+}
+
+std::string SecondaryProvider::getTreehubCredentials(const Uptane::Target& target) const {
+  const auto& pacman = config_.pacman;
+  const std::string hash = boost::algorithm::to_lower_copy(target.sha256Hash());
+  if (!pacman.ostree_mirror_path.empty() && !pacman.ostree_mirror_url.empty() && hash.size() > 2) {
+    const auto commit_object = pacman.ostree_mirror_path / "objects" / hash.substr(0, 2) / (hash.substr(2) + ".commit");
+    if (boost::filesystem::exists(commit_object)) {
+      LOG_DEBUG << "Secondaries pull " << hash << " from the OSTree mirror at " << pacman.ostree_mirror_url;
+      return treehubCredentials(pacman.ostree_mirror_url);
+    }
+  }
+  return getTreehubCredentials();
+}
+
+std::string SecondaryProvider::treehubCredentials(const std::string& treehub_url) const {
   if (config_.tls.pkey_source != CryptoSource::kFile || config_.tls.cert_source != CryptoSource::kFile ||
       config_.tls.ca_source != CryptoSource::kFile) {
     LOG_ERROR << "Cannot send OSTree update to a Secondary when not using file as credential sources";
@@ -100,7 +192,14 @@ std::string SecondaryProvider::getTreehubCredentials() const {
     return "";
   }
 
-  const std::string treehub_url = config_.pacman.ostree_server;
+  // Secondaries keep the credentials they extracted while they get the same archive
+  std::lock_guard<std::mutex> guard(credentials_mutex_);
+  auto cached = credentials_.find(treehub_url);
+  if (cached != credentials_.end() && cached->second.ca == ca && cached->second.cert == cert &&
+      cached->second.pkey == pkey) {
+    return cached->second.archive;
+  }
+
   std::map<std::string, std::string> archive_map = {
       {"ca.pem", ca}, {"client.pem", cert}, {"pkey.pem", pkey}, {"server.url", treehub_url}};
 
@@ -108,7 +207,8 @@ std::string SecondaryProvider::getTreehubCredentials() const {
     std::stringstream as;
     Utils::writeArchive(archive_map, as);
 
-    return as.str();
+    credentials_[treehub_url] = TreehubCredentials{ca, cert, pkey, as.str()};
+    return credentials_[treehub_url].archive;
   } catch (std::runtime_error& exc) {
     LOG_ERROR << "Could not create credentials archive: " << exc.what();
     return "";
@@ -118,3 +218,50 @@ std::string SecondaryProvider::getTreehubCredentials() const {
 std::ifstream SecondaryProvider::getTargetFileHandle(const Uptane::Target& target) const {
   return package_manager_->openTargetFile(target);
 }
+
+std::unique_ptr<std::istream> SecondaryProvider::getTargetStream(const Uptane::Target& target, uint64_t from) const {
+  const auto file = package_manager_->checkTargetFile(target);
+  if (config_.uptane.secondary_firmware_passthrough && (!file || file->first != target.length())) {
+    return package_manager_->streamTarget(target, config_.uptane.repo_server, from, kPassThroughBufferSize);
+  }
+  auto stream = std_::make_unique<std::ifstream>(package_manager_->openTargetFile(target));
+  stream->seekg(static_cast<std::streamoff>(from));
+  return stream;
+}
+
+boost::optional<boost::filesystem::path> SecondaryProvider::getTargetFilePath(const Uptane::Target& target) const {
+  auto file = package_manager_->checkTargetFile(target);
+  if (!file) {
+    return boost::none;
+  }
+  return boost::filesystem::path(file->second);
+}
+
+boost::optional<std::pair<Uptane::Target, boost::filesystem::path>> SecondaryProvider::getInstalledTargetFile(
+    const Uptane::EcuSerial& serial) const {
+  boost::optional<Uptane::Target> current;
+  if (!storage_->loadInstalledVersions(serial.ToString(), &current, nullptr, nullptr) || !current) {
+    return boost::none;
+  }
+  auto file = package_manager_->checkTargetFile(*current);
+  if (!file || file->first != current->length()) {
+    return boost::none;
+  }
+  return std::make_pair(*current, boost::filesystem::path(file->second));
+}
+
+void SecondaryProvider::copyTargetFile(const Uptane::Target& target, const boost::filesystem::path& dest) const {
+  const auto path = getTargetFilePath(target);
+  if (path) {
+    Utils::copyFile(*path, dest);
+    return;
+  }
+  // Custom package managers may serve targets that are not plain files
+  auto source = getTargetFileHandle(target);
+  std::ofstream out_file(dest.string(), std::ios::binary);
+  out_file << source.rdbuf();
+  out_file.close();
+  if (!out_file) {
+    throw std::runtime_error("Error writing " + dest.string());
+  }
+}
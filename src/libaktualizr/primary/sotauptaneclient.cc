@@ -1,30 +1,42 @@
 #include "primary/sotauptaneclient.h"
 
-#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "libaktualizr/campaign.h"
 #include "logging/logging.h"
+#include "logging/metrics.h"
+#include "logging/tracing.h"
 #include "primary/secondary_install_job.h"
 #include "provisioner.h"
 #include "uptane/exceptions.h"
+#include "utilities/bandwidth_limiter.h"
+#include "utilities/hardware_info.h"
+#include "utilities/json_reader.h"
+#include "utilities/resource_policy.h"
+#include "utilities/retry_policy.h"
 #include "utilities/utils.h"
 
 // Fields to ignore from image-repo custom metadata when merging it with the one from the director.
 static const std::vector<std::string> IMAGE_REPO_MERGE_IGNORE{"hardwareIds", "targetFormat", "uri"};
 
-static void report_progress_cb(event::Channel *channel, const Uptane::Target &target, const std::string &description,
-                               unsigned int progress) {
-  if (channel == nullptr) {
-    return;
-  }
-  auto event = std::make_shared<event::DownloadProgressReport>(target, description, progress);
-  (*channel)(event);
-}
+// Attempts to download a target, see downloadImage()
+static const RetryPolicy kDownloadRetryPolicy{3, std::chrono::milliseconds(500), std::chrono::seconds(10), 2.0, 0.5};
+// Delays between the pings of a Secondary that is not reachable yet, see waitSecondariesReachable()
+static const RetryPolicy kSecondaryPingRetryPolicy{0, std::chrono::milliseconds(100), std::chrono::milliseconds(1000),
+                                                   2.0, 0.5};
 
 /**
  * A utility class to compare targets between Image and Director repositories.
@@ -48,12 +60,23 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
       http(std::move(http_in)),
       package_manager_(PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http)),
       key_manager_(std::make_shared<KeyManager>(storage, config.keymanagerConfig())),
-      uptane_fetcher(new Uptane::Fetcher(config, http)),
+      uptane_fetcher(new Uptane::Fetcher(config, http, storage)),
       events_channel(std::move(events_channel_in)),
       provisioner_(config.provision, storage, http, key_manager_, secondaries),
+      download_progress_(std::chrono::milliseconds(config.uptane.download_progress_interval_ms)),
+      performance_(config.telemetry.report_performance),
       flow_control_(flow_control) {
+  // Usually the slowest part of the first start, overlapped with the rest of it
+  key_manager_->pregenerateUptaneKeyPair();
   report_queue = std_::make_unique<ReportQueue>(config, http, storage);
+  package_manager_->setBandwidthLimiter(std::make_shared<BandwidthLimiter>(config.uptane));
   secondary_provider_ = SecondaryProviderBuilder::Build(config, storage, package_manager_);
+  image_repo.setSpeculativeSnapshot(config.uptane.parallel_metadata_fetch);
+  if (!config.uptane.repo_mirror_path.empty()) {
+    repo_mirror_ = std_::make_unique<Uptane::RepoMirror>(config.uptane.repo_mirror_path);
+  }
+  // Checked by Config::postUpdateValues()
+  download_priorities_ = UptaneConfig::parseDownloadPriorities(config.uptane.download_priorities);
 }
 
 void SotaUptaneClient::addSecondary(const std::shared_ptr<SecondaryInterface> &sec) {
@@ -98,6 +121,7 @@ bool SotaUptaneClient::attemptProvision() {
 
 data::InstallationResult SotaUptaneClient::PackageInstall(const Uptane::Target &target) {
   LOG_INFO << "Installing package using " << package_manager_->name() << " package manager";
+  ScopedResourcePolicy policy(ResourcePhase::kDeploy);
   try {
     return package_manager_->install(target);
   } catch (std::exception &ex) {
@@ -149,6 +173,7 @@ void SotaUptaneClient::finalizeAfterReboot() {
                                   correlation_id);
     report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(primary_ecu_serial, correlation_id, false));
   }
+  reportPerformanceAfterReboot(correlation_id);
 
   director_repo.dropTargets(*storage);  // fix for OTA-2587, listen to backend again after end of install
 
@@ -157,6 +182,9 @@ void SotaUptaneClient::finalizeAfterReboot() {
   computeDeviceInstallationResult(&ir, &raw_report);
   storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
   putManifestSimple();
+  if (install_res.success) {
+    pruneStoredTargetsInBackground();
+  }
 }
 
 data::InstallationResult SotaUptaneClient::PackageInstallSetResult(const Uptane::Target &target,
@@ -193,20 +221,37 @@ data::InstallationResult SotaUptaneClient::PackageInstallSetResult(const Uptane:
  * changes. (Unfortunately, it can change often due to CPU frequency scaling.)
  * However, users can provide custom info via the API, and that will be sent if
  * it has changed. */
-void SotaUptaneClient::reportHwInfo() {
+bool SotaUptaneClient::reportHwInfo() {
   Json::Value hw_info;
   std::string stored_hash;
   storage->loadDeviceDataHash("hardware_info", &stored_hash);
+  // Set if the native hardware information was collected, and not to be collected again until the next boot
+  std::string boot_id;
 
   if (custom_hardware_info_.empty()) {
-    if (!stored_hash.empty()) {
-      LOG_TRACE << "Not reporting default hardware information because it has already been reported";
-      return;
+    if (config.telemetry.hw_info_source == "native") {
+      boot_id = HardwareInfo::bootId();
+      std::string stored_boot_id;
+      if (!stored_hash.empty() && !boot_id.empty() &&
+          storage->loadDeviceDataHash("hardware_info_boot", &stored_boot_id) && stored_boot_id == boot_id) {
+        LOG_TRACE << "Not collecting default hardware information because it has already been reported in this boot";
+        return true;
+      }
+      hw_info = HardwareInfo::collect(config.telemetry.hw_info_fields);
+      if (hw_info.empty() && config.telemetry.hw_info_lshw_fallback) {
+        LOG_DEBUG << "No native hardware information found, running lshw";
+        hw_info = Utils::getHardwareInfo();
+      }
+    } else {
+      if (!stored_hash.empty()) {
+        LOG_TRACE << "Not reporting default hardware information because it has already been reported";
+        return true;
+      }
+      hw_info = Utils::getHardwareInfo();
     }
-    hw_info = Utils::getHardwareInfo();
     if (hw_info.empty()) {
       LOG_WARNING << "Unable to fetch hardware information from host system.";
-      return;
+      return true;
     }
   } else {
     hw_info = custom_hardware_info_;
@@ -220,15 +265,26 @@ void SotaUptaneClient::reportHwInfo() {
       LOG_DEBUG << "Reporting custom hardware information";
     }
     const HttpResponse response = http->put(config.tls.server + "/system_info", hw_info);
-    if (response.isOk()) {
-      storage->storeDeviceDataHash("hardware_info", new_hash.HashString());
+    if (!response.isOk()) {
+      return false;
     }
+    storage->storeDeviceDataHash("hardware_info", new_hash.HashString());
   } else {
     LOG_TRACE << "Not reporting hardware information because it has not changed";
   }
+  if (!boot_id.empty()) {
+    storage->storeDeviceDataHash("hardware_info_boot", boot_id);
+  }
+  return true;
 }
 
-void SotaUptaneClient::reportInstalledPackages() {
+bool SotaUptaneClient::reportInstalledPackages() {
+  const std::string version = package_manager_->installedPackagesVersion();
+  if (!version.empty() && version == reported_packages_version_) {
+    LOG_TRACE << "Not reporting installed packages because they have not changed";
+    return true;
+  }
+
   const Json::Value packages = package_manager_->getInstalledPackages();
   const Hash new_hash = Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(packages));
   std::string stored_hash;
@@ -236,18 +292,31 @@ void SotaUptaneClient::reportInstalledPackages() {
         new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
     LOG_DEBUG << "Reporting installed packages";
     const HttpResponse response = http->put(config.tls.server + "/core/installed", packages);
-    if (response.isOk()) {
-      storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
+    if (!response.isOk()) {
+      return false;
     }
+    storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
+    reported_packages_version_ = version;
   } else {
     LOG_TRACE << "Not reporting installed packages because they have not changed";
+    reported_packages_version_ = version;
   }
+  return true;
 }
 
-void SotaUptaneClient::reportNetworkInfo() {
+bool SotaUptaneClient::reportNetworkInfo() {
   if (!config.telemetry.report_network) {
     LOG_TRACE << "Not reporting network information because telemetry is disabled";
-    return;
+    return true;
+  }
+
+  // The monitor has to be polled every time so that it does not keep reporting old notifications
+  if (network_monitor_.changed()) {
+    network_info_reported_ = false;
+  }
+  if (network_info_reported_) {
+    LOG_TRACE << "Not reporting network information because it has not changed";
+    return true;
   }
 
   Json::Value network_info;
@@ -255,7 +324,7 @@ void SotaUptaneClient::reportNetworkInfo() {
     network_info = Utils::getNetworkInfo();
   } catch (const std::exception &ex) {
     LOG_ERROR << "Failed to get network info: " << ex.what();
-    return;
+    return true;
   }
   const Hash new_hash = Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(network_info));
   std::string stored_hash;
@@ -263,18 +332,27 @@ void SotaUptaneClient::reportNetworkInfo() {
         new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
     LOG_DEBUG << "Reporting network information";
     const HttpResponse response = http->put(config.tls.server + "/system_info/network", network_info);
-    if (response.isOk()) {
-      storage->storeDeviceDataHash("network_info", new_hash.HashString());
+    if (!response.isOk()) {
+      return false;
     }
+    storage->storeDeviceDataHash("network_info", new_hash.HashString());
+    network_info_reported_ = true;
   } else {
     LOG_TRACE << "Not reporting network information because it has not changed";
+    network_info_reported_ = true;
   }
+  return true;
 }
 
-void SotaUptaneClient::reportAktualizrConfiguration() {
+bool SotaUptaneClient::reportAktualizrConfiguration() {
   if (!config.telemetry.report_config) {
     LOG_TRACE << "Not reporting libaktualizr configuration because telemetry is disabled";
-    return;
+    return true;
+  }
+  // The configuration does not change while running
+  if (config_reported_) {
+    LOG_TRACE << "Not reporting libaktualizr configuration because it has not changed";
+    return true;
   }
 
   std::stringstream conf_ss;
@@ -286,23 +364,91 @@ void SotaUptaneClient::reportAktualizrConfiguration() {
         new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
     LOG_DEBUG << "Reporting libaktualizr configuration";
     const HttpResponse response = http->post(config.tls.server + "/system_info/config", "application/toml", conf_str);
-    if (response.isOk()) {
-      storage->storeDeviceDataHash("configuration", new_hash.HashString());
+    if (!response.isOk()) {
+      return false;
     }
+    storage->storeDeviceDataHash("configuration", new_hash.HashString());
+    config_reported_ = true;
   } else {
     LOG_TRACE << "Not reporting libaktualizr configuration because it has not changed";
+    config_reported_ = true;
   }
+  return true;
 }
 
-Json::Value SotaUptaneClient::AssembleManifest() {
-  Json::Value manifest;  // signed top-level
-  Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
-  manifest["primary_ecu_serial"] = primary_ecu_serial.ToString();
+void SotaUptaneClient::reportMetrics() {
+  if (!config.telemetry.report_metrics) {
+    LOG_TRACE << "Not reporting metrics because telemetry is disabled";
+    return;
+  }
 
-  // first part: report current version/state of all ECUs
-  Json::Value version_manifest;
+  // Metrics change on every cycle, so there is no point in deduplicating them
+  LOG_DEBUG << "Reporting metrics";
+  const HttpResponse response = http->put(config.tls.server + "/system_info/metrics", Metrics::instance().summary());
+  if (!response.isOk()) {
+    LOG_DEBUG << "Could not report metrics: " << response.getStatusStr();
+  }
+}
 
-  Json::Value primary_manifest = uptane_manifest->assembleManifest(package_manager_->getCurrent());
+void SotaUptaneClient::reportPerformance(const std::string &correlation_id, bool pending_reboot) {
+  Json::Value performance = performance_.take();
+  if (performance.isNull()) {
+    return;
+  }
+  if (pending_reboot) {
+    CyclePerformance::savePending(config.storage.path / "performance.pending", std::move(performance));
+    return;
+  }
+  report_queue->enqueue(std_::make_unique<UpdateCyclePerformanceReport>(performance, correlation_id));
+}
+
+void SotaUptaneClient::reportPerformanceAfterReboot(const std::string &correlation_id) {
+  if (!performance_.enabled()) {
+    return;
+  }
+  const Json::Value performance = CyclePerformance::takePending(config.storage.path / "performance.pending");
+  if (!performance.isNull()) {
+    report_queue->enqueue(std_::make_unique<UpdateCyclePerformanceReport>(performance, correlation_id));
+  }
+}
+
+void SotaUptaneClient::requestSecondaryManifests() {
+  for (const auto &sec : secondaries) {
+    auto pending = pending_manifests.find(sec.first);
+    if (pending != pending_manifests.end() &&
+        pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      // Still busy with an earlier request; don't stack another one on it.
+      continue;
+    }
+    // Not std::async: an abandoned std::async future would block on its
+    // destruction until the Secondary eventually answers or times out.
+    std::promise<Uptane::Manifest> promise;
+    pending_manifests[sec.first] = promise.get_future();
+    std::thread(
+        [secondary = sec.second](std::promise<Uptane::Manifest> result) {
+          Uptane::Manifest secmanifest;
+          try {
+            secmanifest = secondary->getManifest();
+          } catch (const std::exception &ex) {
+            // Not critical; it might just be temporarily offline.
+            LOG_DEBUG << "Failed to get manifest from Secondary with serial " << secondary->getSerial() << ": "
+                      << ex.what();
+          }
+          result.set_value(secmanifest);
+        },
+        std::move(promise))
+        .detach();
+  }
+}
+
+Json::Value SotaUptaneClient::AssembleManifest() {
+  Json::Value manifest = assembleManifestContent();
+  signPrimaryManifest(&manifest);
+  return manifest;
+}
+
+void SotaUptaneClient::signPrimaryManifest(Json::Value *manifest) {
+  const std::string primary_ecu_serial = primaryEcuSerial().ToString();
   std::vector<std::pair<Uptane::EcuSerial, int64_t>> ecu_cnt;
   std::string report_counter;
   if (!storage->loadEcuReportCounter(&ecu_cnt) || ecu_cnt.empty()) {
@@ -312,16 +458,36 @@ Json::Value SotaUptaneClient::AssembleManifest() {
     report_counter = std::to_string(ecu_cnt[0].second + 1);
     storage->saveEcuReportCounter(ecu_cnt[0].first, ecu_cnt[0].second + 1);
   }
-  version_manifest[primary_ecu_serial.ToString()] = uptane_manifest->sign(primary_manifest, report_counter);
+  Json::Value &primary_manifest = (*manifest)["ecu_version_manifests"][primary_ecu_serial];
+  primary_manifest = uptane_manifest->sign(primary_manifest, report_counter);
+}
 
+Json::Value SotaUptaneClient::assembleManifestContent() {
+  Json::Value manifest;  // signed top-level
+  Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
+  manifest["primary_ecu_serial"] = primary_ecu_serial.ToString();
+
+  // first part: report current version/state of all ECUs
+  Json::Value version_manifest;
+
+  // Signed later by signPrimaryManifest()
+  version_manifest[primary_ecu_serial.ToString()] = uptane_manifest->assembleManifest(package_manager_->getCurrent());
+
+  requestSecondaryManifests();
+  const auto timeout = std::chrono::seconds(config.uptane.secondary_manifest_timeout_sec);
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
   for (auto it = secondaries.begin(); it != secondaries.end(); it++) {
     const Uptane::EcuSerial &ecu_serial = it->first;
     Uptane::Manifest secmanifest;
-    try {
-      secmanifest = it->second->getManifest();
-    } catch (const std::exception &ex) {
-      // Not critical; it might just be temporarily offline.
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << ecu_serial << ": " << ex.what();
+    auto pending = pending_manifests.find(ecu_serial);
+    if (pending != pending_manifests.end()) {
+      if (timeout.count() == 0 || pending->second.wait_until(deadline) == std::future_status::ready) {
+        secmanifest = pending->second.get();
+        pending_manifests.erase(pending);
+      } else {
+        LOG_WARNING << "Secondary " << ecu_serial << " did not send its manifest within "
+                    << config.uptane.secondary_manifest_timeout_sec << " seconds";
+      }
     }
 
     bool from_cache = false;
@@ -330,7 +496,7 @@ Json::Value SotaUptaneClient::AssembleManifest() {
       std::string cached;
       if (storage->loadCachedEcuManifest(ecu_serial, &cached)) {
         LOG_WARNING << "Could not reach Secondary " << ecu_serial << ", sending a cached version of its manifest";
-        secmanifest = Utils::parseJSON(cached);
+        secmanifest = JsonReader::parse(cached);
         from_cache = true;
       } else {
         LOG_ERROR << "Failed to get a valid manifest from Secondary with serial " << ecu_serial << " or from cache!";
@@ -398,17 +564,37 @@ Json::Value SotaUptaneClient::AssembleManifest() {
 
 bool SotaUptaneClient::hasPendingUpdates() const { return storage->hasPendingInstall(); }
 
-void SotaUptaneClient::initialize() {
-  provisioner_.Prepare();
-
-  uptane_manifest = std::make_shared<Uptane::ManifestIssuer>(key_manager_, provisioner_.PrimaryEcuSerial());
+// Run one startup phase and append its duration to the breakdown.
+template <typename F>
+static void startupPhase(const char *name, std::string *breakdown, F &&phase) {
+  TraceSpan span("startup", name);
+  const auto start = std::chrono::steady_clock::now();
+  phase();
+  const auto elapsed =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+  *breakdown += std::string(breakdown->empty() ? "" : ", ") + name + " " + std::to_string(elapsed) + " ms";
+}
 
-  startupCleanSecondaries();
-  completePreviousSecondaryUpdates();
+void SotaUptaneClient::initialize(bool defer_startup) {
+  std::string breakdown;
+  startupPhase("prepare", &breakdown, [this]() {
+    provisioner_.Prepare();
+    uptane_manifest = std::make_shared<Uptane::ManifestIssuer>(key_manager_, provisioner_.PrimaryEcuSerial());
+  });
+  LOG_INFO << "Startup: " << breakdown;
 
-  finalizeAfterReboot();
+  if (!defer_startup) {
+    completeStartup();
+  }
+}
 
-  attemptProvision();
+void SotaUptaneClient::completeStartup() {
+  std::string breakdown;
+  startupPhase("cleanSecondaries", &breakdown, [this]() { startupCleanSecondaries(); });
+  startupPhase("secondaryUpdates", &breakdown, [this]() { completePreviousSecondaryUpdates(); });
+  startupPhase("finalizeAfterReboot", &breakdown, [this]() { finalizeAfterReboot(); });
+  startupPhase("provision", &breakdown, [this]() { attemptProvision(); });
+  LOG_INFO << "Startup completed: " << breakdown;
 }
 
 void SotaUptaneClient::requiresProvision() {
@@ -443,6 +629,55 @@ void SotaUptaneClient::updateDirectorMeta(UpdateType utype) {
   }
 }
 
+// With uptane.fast_update_check, only the Director Targets are fetched at
+// first; the rest of the Director metadata is only updated when they change.
+bool SotaUptaneClient::checkDirectorMetaUnchanged() {
+  requiresProvision();
+  try {
+    if (director_repo.checkMetaUnchanged(*storage, *uptane_fetcher, flow_control_)) {
+      LOG_DEBUG << "Director Targets metadata has not changed";
+      return true;
+    }
+  } catch (const Uptane::LocallyAborted &) {
+    throw;
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Quick Director metadata check failed: " << e.what();
+  }
+  return false;
+}
+
+// The decision only depends on the Director Targets, the installed versions
+// and the ECUs, and on the Image repo metadata the updates were completed
+// from. While none of them changed, getNewTargets() and the lookups in the
+// delegation tree would come to the same result.
+boost::optional<result::UpdateCheck> SotaUptaneClient::reuseUpdateDecision() {
+  if (!update_decision_ || update_decision_->director_hash.empty() ||
+      update_decision_->director_hash != director_repo.acceptedTargetsHash() ||
+      update_decision_->director_version != director_repo.getTargets().version() ||
+      update_decision_->storage_generation != storage->installedStateGeneration()) {
+    return boost::none;
+  }
+  if (!update_decision_->result.updates.empty()) {
+    if (!image_meta_current_) {
+      return boost::none;
+    }
+    try {
+      image_repo.checkMetaOffline(*storage);
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Stored Image repo metadata can not be used, checking for updates again: " << e.what();
+      return boost::none;
+    }
+    if (image_repo.getSnapshotVersion() != update_decision_->image_snapshot_version) {
+      return boost::none;
+    }
+  }
+  LOG_DEBUG << "Director Targets and installed versions have not changed, reusing the last update check";
+  static auto& reused =
+      Metrics::instance().counter("aktualizr_update_checks_reused_total", "Update checks answered by the previous one");
+  reused.add();
+  return update_decision_->result;
+}
+
 void SotaUptaneClient::updateImageMeta(UpdateType utype) {
   try {
     if (utype == UpdateType::kOffline) {
@@ -455,7 +690,7 @@ void SotaUptaneClient::updateImageMeta(UpdateType utype) {
 #endif
     } else {
       requiresProvision();
-      image_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+      fetchImageMeta();
     }
   } catch (const std::exception &e) {
     LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
@@ -463,6 +698,38 @@ void SotaUptaneClient::updateImageMeta(UpdateType utype) {
   }
 }
 
+// The mirror is not trusted: metadata that is not available from it already
+// comes from repo_server, and so does all of it if what it had was rejected,
+// e.g. because it was expired or older than the stored metadata.
+void SotaUptaneClient::fetchImageMeta() {
+  if (uptane_fetcher->getRepoMirror().empty()) {
+    image_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+    return;
+  }
+  try {
+    image_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+  } catch (const Uptane::LocallyAborted &) {
+    throw;
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Image repo metadata from the mirror was rejected (" << e.what() << "), fetching it from "
+                << uptane_fetcher->getRepoServer();
+    image_repo.updateMeta(*storage, *uptane_fetcher->withoutMirror(), flow_control_);
+  }
+}
+
+// The mirror is for other devices, so it is kept up to date even without
+// updates for this one. Failing to do so does not affect this device's update.
+void SotaUptaneClient::updateRepoMirror(const bool fetch) {
+  try {
+    if (fetch) {
+      fetchImageMeta();
+    }
+    repo_mirror_->storeMetadata(*storage);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not update the Image repo mirror: " << e.what();
+  }
+}
+
 void SotaUptaneClient::checkDirectorMetaOffline(UpdateType utype) {
   try {
     if (utype == UpdateType::kOffline) {
@@ -645,38 +912,36 @@ void SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, u
 std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane::Targets &cur_targets,
                                                                    const Uptane::Target &queried_target, int level,
                                                                    bool terminating, bool offline, UpdateType utype) {
-  TargetCompare target_comp(queried_target);
-  const auto it = std::find_if(cur_targets.targets.cbegin(), cur_targets.targets.cend(), target_comp);
-  if (it != cur_targets.targets.cend()) {
-    return std_::make_unique<Uptane::Target>(*it);
+  const Uptane::Target *found = cur_targets.findTarget(queried_target.filename());
+  if (found != nullptr && found->MatchTarget(queried_target)) {
+    return std_::make_unique<Uptane::Target>(*found);
   }
 
   if (terminating || level >= Uptane::kDelegationsMaxDepth) {
     return std::unique_ptr<Uptane::Target>(nullptr);
   }
 
-  for (const auto &delegate_name : cur_targets.delegated_role_names_) {
-    Uptane::Role delegate_role = Uptane::Role::Delegation(delegate_name);
-    auto patterns = cur_targets.paths_for_role_.find(delegate_role);
-    if (patterns == cur_targets.paths_for_role_.end()) {
-      continue;
-    }
-
-    bool match = false;
-    for (const auto &pattern : patterns->second) {
-      if (fnmatch(pattern.c_str(), queried_target.filename().c_str(), 0) == 0) {
-        match = true;
-        break;
+  // Delegations with a path pattern matching the target name. They are searched in order, while the next ones are
+  // fetched ahead.
+  const std::vector<Uptane::Role> roles = cur_targets.delegationsForPath(queried_target.filename());
+  const size_t ahead =
+      utype == UpdateType::kOffline ? 0 : static_cast<size_t>(config.uptane.delegation_fetch_concurrency) - 1;
+  std::vector<std::future<Uptane::Targets>> prefetched(roles.size());
+  for (size_t i = 0; i < roles.size(); ++i) {
+    for (size_t k = i + 1; k < roles.size() && k <= i + ahead; ++k) {
+      if (!prefetched[k].valid()) {
+        prefetched[k] = std::async(std::launch::async, [this, &role = roles[k], &cur_targets, offline]() {
+          return Uptane::getTrustedDelegation(role, cur_targets, image_repo, *storage, *uptane_fetcher, offline,
+                                              flow_control_);
+        });
       }
     }
-    if (!match) {
-      continue;
-    }
-
-    // Target name matches one of the patterns
 
+    const Uptane::Role &delegate_role = roles[i];
     Uptane::Targets delegation;
-    if (utype == UpdateType::kOffline) {
+    if (prefetched[i].valid()) {
+      delegation = prefetched[i].get();
+    } else if (utype == UpdateType::kOffline) {
       // TODO: [OFFUPD] Protect with an #ifdef ??
       delegation = Uptane::getTrustedDelegation(delegate_role, cur_targets, image_repo, *storage,
                                                 *uptane_fetcher_offupd, offline, flow_control_);
@@ -688,13 +953,10 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane:
       continue;
     }
 
-    auto is_terminating = cur_targets.terminating_role_.find(delegate_role);
-    if (is_terminating == cur_targets.terminating_role_.end()) {
-      throw Uptane::Exception("image", "Inconsistent delegations");
-    }
+    const bool is_terminating = cur_targets.delegationTerminates(delegate_role);
 
     // NOLINTNEXTLINE(misc-no-recursion)
-    auto found_target = findTargetHelper(delegation, queried_target, level + 1, is_terminating->second, offline, utype);
+    auto found_target = findTargetHelper(delegation, queried_target, level + 1, is_terminating, offline, utype);
     if (found_target != nullptr) {
       return found_target;
     }
@@ -713,7 +975,49 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetInDelegationTree(con
   return findTargetHelper(*toplevel_targets, target, 0, false, offline, utype);
 }
 
+std::vector<api::TargetDownloadHandle> SotaUptaneClient::makeDownloadHandles(
+    const std::vector<Uptane::Target> &targets) const {
+  std::vector<api::TargetDownloadHandle> handles;
+  handles.reserve(targets.size());
+  for (const auto &target : targets) {
+    handles.push_back(std::make_shared<api::TargetDownload>(target, flow_control_));
+    handles.back()->SetPriority(downloadPriority(target));
+  }
+  return handles;
+}
+
+int SotaUptaneClient::downloadPriority(const Uptane::Target &target) const {
+  // A hint from the server comes first, then the highest priority of the hardware the target is for
+  const Json::Value &hint = target.custom_data()["downloadPriority"];
+  if (hint.isInt()) {
+    return hint.asInt();
+  }
+  boost::optional<int> priority;
+  auto apply = [this, &priority](const Uptane::HardwareIdentifier &hwid) {
+    const auto rule = download_priorities_.find(hwid.ToString());
+    if (rule != download_priorities_.cend() && (!priority || rule->second > *priority)) {
+      priority = rule->second;
+    }
+  };
+  for (const auto &ecu : target.ecus()) {
+    apply(ecu.second);
+  }
+  for (const auto &hwid : target.hardwareIds()) {
+    apply(hwid);
+  }
+  return priority ? *priority : 0;
+}
+
 result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets, UpdateType utype) {
+  return downloadImages(targets, utype, makeDownloadHandles(targets));
+}
+
+result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets, UpdateType utype,
+                                                  const std::vector<api::TargetDownloadHandle> &handles) {
+  TraceSpan span("update", "downloadImages");
+  if (handles.size() != targets.size()) {
+    throw std::invalid_argument("One download handle per target is required");
+  }
   if (utype != UpdateType::kOffline) {
     requiresAlreadyProvisioned();
   }
@@ -722,14 +1026,25 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
   std::lock_guard<std::mutex> guard(download_mutex);
   result::Download result;
   std::vector<Uptane::Target> downloaded_targets;
+  download_progress_.start(targets);
+  {
+    // Only what is sent along with this download may be skipped when installing
+    std::map<Uptane::EcuSerial, Presend> earlier;
+    {
+      std::lock_guard<std::mutex> presends_guard(presends_mutex_);
+      std::swap(earlier, presends_);
+    }
+  }
 
   result::UpdateStatus update_status;
+  const auto verify_started = CyclePerformance::Clock::now();
   try {
     update_status = checkUpdatesOffline(targets, utype);
   } catch (const std::exception &e) {
     last_exception = std::current_exception();
     update_status = result::UpdateStatus::kError;
   }
+  performance_.addVerification(CyclePerformance::Clock::now() - verify_started);
 
   if (update_status == result::UpdateStatus::kNoUpdatesAvailable) {
     result = result::Download({}, result::DownloadStatus::kNothingToDownload, "");
@@ -743,9 +1058,88 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     sendEvent<event::AllDownloadsComplete>(result);
     return result;
   }
+  if (config.pacman.images_max_bytes > 0 && !config.pacman.images_prune_after_install) {
+    // A download that makes room must not remove the other images of this update
+    std::vector<Uptane::Target> retain = retainedTargets();
+    retain.insert(retain.end(), targets.begin(), targets.end());
+    package_manager_->retainTargets(std::move(retain));
+  }
+
+  // Run up to download_concurrency downloads at the same time. They share the
+  // bandwidth budget of the package manager's BandwidthLimiter. Copying from
+  // an offline update is bound by hashing instead, so it gets up to one worker
+  // per core.
+  size_t concurrency = config.uptane.download_concurrency;
+  if (utype == UpdateType::kOffline) {
+    concurrency = config.uptane.offline_fetch_concurrency > 0
+                      ? static_cast<size_t>(config.uptane.offline_fetch_concurrency)
+                      : std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  const size_t workers = std::max<size_t>(std::min(targets.size(), concurrency), 1U);
 
+  std::vector<std::pair<bool, Uptane::Target>> results;
+  results.reserve(targets.size());
   for (const auto &target : targets) {
-    auto res = downloadImage(target, utype);
+    results.emplace_back(false, target);
+  }
+  // Each free worker takes the pending target with the highest priority,
+  // unless it is paused and others are not. Of equal priorities, the smallest
+  // goes first with uptane.download_smallest_first, otherwise the first one.
+  // The priorities may change at any time, so they are compared when a worker
+  // asks for more work.
+  std::mutex pending_mutex;
+  std::vector<size_t> pending(targets.size());
+  std::iota(pending.begin(), pending.end(), 0);
+  const bool smallest_first = config.uptane.download_smallest_first;
+  auto next_target = [&handles, &pending, &pending_mutex, smallest_first]() -> boost::optional<size_t> {
+    std::lock_guard<std::mutex> pending_guard(pending_mutex);
+    if (pending.empty()) {
+      return boost::none;
+    }
+    auto first = std::min_element(pending.begin(), pending.end(), [&handles, smallest_first](size_t a, size_t b) {
+      const api::TargetDownload &x = *handles[a];
+      const api::TargetDownload &y = *handles[b];
+      if (x.paused() != y.paused()) {
+        return !x.paused();
+      }
+      const int x_priority = x.priority();
+      const int y_priority = y.priority();
+      if (x_priority != y_priority || !smallest_first) {
+        return x_priority > y_priority;
+      }
+      return x.target().length() < y.target().length();
+    });
+    const size_t i = *first;
+    pending.erase(first);
+    return i;
+  };
+  auto download_worker = [this, &targets, &handles, &results, &next_target, utype]() {
+    ScopedResourcePolicy policy(ResourcePhase::kDownload);
+    for (auto i = next_target(); i; i = next_target()) {
+      if (handles[*i]->cancelled()) {
+        LOG_INFO << "Download of " << targets[*i].filename() << " was cancelled";
+        sendEvent<event::DownloadTargetComplete>(targets[*i], false);
+        continue;
+      }
+      results[*i] = downloadImage(targets[*i], utype, handles[*i]->token());
+      if (results[*i].first) {
+        presendFirmware(targets[*i], utype);
+      }
+    }
+  };
+  if (workers <= 1) {
+    download_worker();
+  } else {
+    std::vector<std::future<void>> running;
+    for (size_t i = 0; i < workers; ++i) {
+      running.push_back(std::async(std::launch::async, download_worker));
+    }
+    for (auto &r : running) {
+      r.get();
+    }
+  }
+
+  for (const auto &res : results) {
     if (res.first) {
       downloaded_targets.push_back(res.second);
     }
@@ -763,12 +1157,74 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     }
     storeInstallationFailure(
         data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Target download failed."));
+    // No installation follows to end the cycle
+    reportPerformance(director_repo.getCorrelationId(), false);
   }
 
   sendEvent<event::AllDownloadsComplete>(result);
   return result;
 }
 
+result::Download SotaUptaneClient::predownloadImages(const std::vector<Uptane::Target> &targets,
+                                                     const std::vector<api::TargetDownloadHandle> &handles) {
+  TraceSpan span("update", "predownloadImages");
+  requiresAlreadyProvisioned();
+  std::lock_guard<std::mutex> guard(download_mutex);
+
+  // The update may be installed at any time later, so the download must not
+  // slow down what runs in the meantime
+  ScopedResourcePolicy policy(ResourcePolicy::lowest());
+
+  // No installation failure is stored: the next pre-download, or the download
+  // before the update is installed, tries again
+  download_progress_.start(targets);
+  std::vector<Uptane::Target> downloaded;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (handles[i]->cancelled()) {
+      continue;
+    }
+    if (downloadImage(targets[i], UpdateType::kOnline, handles[i]->token()).first) {
+      downloaded.push_back(targets[i]);
+    } else if (flow_control_ != nullptr && flow_control_->hasAborted()) {
+      break;
+    }
+  }
+
+  if (downloaded.size() == targets.size()) {
+    LOG_INFO << "Pre-downloaded " << targets.size() << " targets, they are installed once the update is allowed";
+    return result::Download(downloaded, result::DownloadStatus::kSuccess, "");
+  }
+  LOG_WARNING << "Pre-downloaded only " << downloaded.size() << " of " << targets.size() << " targets";
+  return result::Download(downloaded,
+                          downloaded.empty() ? result::DownloadStatus::kError : result::DownloadStatus::kPartialSuccess,
+                          "");
+}
+
+Json::Value SotaUptaneClient::snapshot() {
+  Json::Value snapshot;
+  snapshot["downloads"] = download_progress_.snapshot();
+
+  Json::Value &stats = snapshot["storage"];
+  boost::system::error_code ec;
+  const boost::filesystem::path db = config.storage.sqldb_path.get(config.storage.path);
+  for (const auto &file : {db, boost::filesystem::path(db.string() + "-wal")}) {
+    const auto size = boost::filesystem::file_size(file, ec);
+    if (!ec) {
+      stats["files"][file.filename().string()] = static_cast<Json::UInt64>(size);
+    }
+  }
+  const auto space = boost::filesystem::space(config.storage.path, ec);
+  if (!ec) {
+    stats["freeBytes"] = static_cast<Json::UInt64>(space.available);
+  }
+  try {
+    stats["targets"] = static_cast<Json::UInt64>(storage->getAllTargetNames().size());
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Could not count the stored targets: " << e.what();
+  }
+  return snapshot;
+}
+
 void SotaUptaneClient::reportPause() {
   auto correlation_id = director_repo.getCorrelationId();
   report_queue->enqueue(std_::make_unique<DevicePausedReport>(correlation_id));
@@ -779,7 +1235,11 @@ void SotaUptaneClient::reportResume() {
   report_queue->enqueue(std_::make_unique<DeviceResumedReport>(correlation_id));
 }
 
-std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Target &target, UpdateType utype) {
+std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Target &target, UpdateType utype,
+                                                                const api::FlowControlToken *token) {
+  TraceSpan span("update", "downloadImage");
+  const api::FlowControlToken *flow_control = token != nullptr ? token : flow_control_;
+  span.annotate(target.filename());
   auto correlation_id = director_repo.getCorrelationId();
   // Send an event for all ECUs that are touched by this target. Don't report
   // this to the server for offline updates, since that would create confusion
@@ -795,36 +1255,55 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
 
   bool success = false;
   try {
-    KeyManager keys(storage, config.keymanagerConfig());
-    keys.loadKeys();
+    // The credentials only change on provisioning, so they are loaded once
+    // rather than for every target.
+    key_manager_->loadKeysOnce();
+    const KeyManager &keys = *key_manager_;
     auto prog_cb = [this](const Uptane::Target &t, const std::string &description, unsigned int progress) {
-      report_progress_cb(events_channel.get(), t, description, progress);
+      if (events_channel == nullptr) {
+        return;
+      }
+      auto event = download_progress_.update(t, description, progress);
+      if (event != nullptr) {
+        (*events_channel)(event);
+      }
     };
 
     const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
 
-    if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
-      const int max_tries = 3;
+    if (passesThroughSecondaries(target, utype)) {
+      LOG_INFO << "Not downloading " << target.filename() << ", its Secondaries will receive it while it is installed";
+      success = true;
+    } else if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
       int tries = 0;
-      std::chrono::milliseconds wait(500);
+      const auto started = CyclePerformance::Clock::now();
 
-      for (; tries < max_tries; tries++) {
+      while (true) {
+        ++tries;
         if (utype == UpdateType::kOffline) {
 #ifdef BUILD_OFFLINE_UPDATES
-          success = package_manager_->fetchTargetOffUpd(target, *uptane_fetcher_offupd, keys, prog_cb, flow_control_);
+          success = package_manager_->fetchTargetOffUpd(target, *uptane_fetcher_offupd, keys, prog_cb, flow_control);
 #else
           success = false;
 #endif
         } else {
-          success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, prog_cb, flow_control_);
+          success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, prog_cb, flow_control);
         }
         // Skip trying to fetch the 'target' if control flow token transaction
         // was set to the 'abort' or 'pause' state, see the CommandQueue and FlowControlToken.
-        if (success || (flow_control_ != nullptr && flow_control_->hasAborted())) {
+        if (success || (flow_control != nullptr && flow_control->hasAborted()) ||
+            !kDownloadRetryPolicy.shouldRetry(tries)) {
           break;
-        } else if (tries < max_tries - 1) {
-          std::this_thread::sleep_for(wait);
-          wait *= 2;
+        }
+        std::this_thread::sleep_for(kDownloadRetryPolicy.delay(tries));
+      }
+      performance_.addDownload(target, CyclePerformance::Clock::now() - started, success);
+      if (success && repo_mirror_ != nullptr && utype == UpdateType::kOnline && !target.IsOstree()) {
+        try {
+          auto content = package_manager_->openTargetFile(target);
+          repo_mirror_->storeTarget(target, content);
+        } catch (const std::exception &e) {
+          LOG_WARNING << "Could not add " << target.filename() << " to the Image repo mirror: " << e.what();
         }
       }
       if (!success) {
@@ -837,9 +1316,14 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
     } else {
       // we emulate successful download in case of the Secondary OSTree update
       success = true;
+      if (!config.pacman.ostree_mirror_path.empty() && utype != UpdateType::kOffline &&
+          !package_manager_->mirrorTarget(target, keys, prog_cb, flow_control)) {
+        LOG_WARNING << "Secondaries will download " << target.filename() << " from the OSTree server";
+      }
     }
   } catch (const std::exception &e) {
     LOG_ERROR << "Error downloading image: " << e.what();
+    std::lock_guard<std::mutex> guard(last_exception_mutex);
     last_exception = std::current_exception();
   }
 
@@ -851,16 +1335,42 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
     }
   }
 
+  static auto& downloaded = Metrics::instance().counter("aktualizr_targets_downloaded_total", "Targets downloaded");
+  static auto& failed =
+      Metrics::instance().counter("aktualizr_target_download_failures_total", "Targets that failed to download");
+  (success ? downloaded : failed).add();
+
   sendEvent<event::DownloadTargetComplete>(target, success);
   return {success, target};
 }
 
 void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count,
-                                       UpdateType utype) {
-  updateDirectorMeta(utype);
+                                       UpdateType utype, boost::optional<result::UpdateCheck> *reused) {
+  TraceSpan span("update", "uptaneIteration");
+  const bool director_unchanged =
+      utype == UpdateType::kOnline && config.uptane.fast_update_check && checkDirectorMetaUnchanged();
+  // The Image repo metadata is verified on its own, and only checked against the Director Targets afterwards
+  std::future<void> image_update;
+  if (!director_unchanged) {
+    image_meta_current_ = false;
+    if (utype == UpdateType::kOnline && config.uptane.parallel_metadata_fetch) {
+      requiresProvision();
+      image_update = std::async(std::launch::async, [this]() { fetchImageMeta(); });
+    }
+    updateDirectorMeta(utype);
+  }
   if (flow_control_ != nullptr && flow_control_->hasAborted()) {
     return;
   }
+  if (director_unchanged && reused != nullptr) {
+    *reused = reuseUpdateDecision();
+    if (*reused) {
+      if (repo_mirror_ != nullptr) {
+        updateRepoMirror(true);
+      }
+      return;
+    }
+  }
 
   std::vector<Uptane::Target> tmp_targets;
   unsigned int ecus;
@@ -872,9 +1382,51 @@ void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, uns
     throw;
   }
 
+  // Whether the Image repo metadata was fetched in this iteration
+  bool image_fetched = false;
   if (!tmp_targets.empty()) {
     LOG_INFO << "New updates found in Director metadata. Checking Image repo metadata...";
-    updateImageMeta(utype);
+    bool checked = false;
+    if (image_update.valid()) {
+      try {
+        image_update.get();
+      } catch (const std::exception &e) {
+        LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
+        throw;
+      }
+      checked = true;
+      image_fetched = true;
+      image_meta_current_ = true;
+    } else if (director_unchanged && image_meta_current_) {
+      // The Image repo metadata was fetched for these very Director Targets already
+      try {
+        image_repo.checkMetaOffline(*storage);
+        checked = true;
+      } catch (const std::exception &e) {
+        LOG_DEBUG << "Stored Image repo metadata can not be used, fetching it again: " << e.what();
+      }
+    }
+    if (!checked) {
+      image_meta_current_ = false;
+      updateImageMeta(utype);
+      image_fetched = true;
+      image_meta_current_ = utype == UpdateType::kOnline;
+    }
+  }
+
+  if (image_update.valid()) {
+    // Not needed without new Targets
+    try {
+      image_update.get();
+      image_fetched = true;
+      image_meta_current_ = true;
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Image repo metadata update failed: " << e.what();
+    }
+  }
+
+  if (repo_mirror_ != nullptr && utype == UpdateType::kOnline) {
+    updateRepoMirror(!image_fetched);
   }
 
   if (targets != nullptr) {
@@ -911,18 +1463,23 @@ void SotaUptaneClient::uptaneOfflineIteration(std::vector<Uptane::Target> *targe
   }
 }
 
-void SotaUptaneClient::sendDeviceData() {
+bool SotaUptaneClient::sendDeviceData() {
+  TraceSpan span("update", "sendDeviceData");
   requiresProvision();
 
-  reportHwInfo();
-  reportInstalledPackages();
-  reportNetworkInfo();
-  reportAktualizrConfiguration();
+  bool sent = reportHwInfo();
+  sent = reportInstalledPackages() && sent;
+  sent = reportNetworkInfo() && sent;
+  sent = reportAktualizrConfiguration() && sent;
+  reportMetrics();
   sendEvent<event::SendDeviceDataComplete>();
+  return sent;
 }
 
 result::UpdateCheck SotaUptaneClient::fetchMeta() {
+  TraceSpan span("update", "fetchMeta");
   requiresProvision();
+  ScopedResourcePolicy policy(ResourcePhase::kMetadata);
 
   reportNetworkInfo();
 
@@ -938,12 +1495,17 @@ result::UpdateCheck SotaUptaneClient::fetchMeta() {
     LOG_INFO << "An update is pending. Skipping check for update until installation is complete.";
     return {{}, 0, result::UpdateStatus::kError, "There are pending updates, no new updates are checked"};
   }
+  // An update completed by a reboot of a Secondary only
+  reportPerformanceAfterReboot(director_repo.getCorrelationId());
+  performance_.startCycle();
 
   // Uptane step 1 (build the vehicle version manifest):
   if (!putManifestSimple()) {
     LOG_ERROR << "Error sending manifest!";
   }
+  const auto started = CyclePerformance::Clock::now();
   auto result = checkUpdates();
+  performance_.addMetadataFetch(CyclePerformance::Clock::now() - started);
   sendEvent<event::UpdateCheckComplete>(result);
   return result;
 }
@@ -951,9 +1513,13 @@ result::UpdateCheck SotaUptaneClient::fetchMeta() {
 result::UpdateCheck SotaUptaneClient::checkUpdates(UpdateType utype) {
   std::vector<Uptane::Target> updates;
   unsigned int ecus_count = 0;
+  boost::optional<result::UpdateCheck> reused;
+  // Read before checking, so that changes made in the meantime make the decision stale
+  const uint64_t storage_generation = storage->installedStateGeneration();
   try {
-    uptaneIteration(&updates, &ecus_count, utype);
+    uptaneIteration(&updates, &ecus_count, utype, utype == UpdateType::kOnline ? &reused : nullptr);
   } catch (const Uptane::Exception &e) {
+    update_decision_ = boost::none;
     // TODO: Consider using this check throughout sotauptaneclient for more consistent exception handling.
     if (e.getPersistence() == Uptane::Persistence::kPermanent && utype == UpdateType::kOnline) {
       LOG_ERROR << "Unable to verify metadata.";
@@ -963,13 +1529,18 @@ result::UpdateCheck SotaUptaneClient::checkUpdates(UpdateType utype) {
     last_exception = std::current_exception();
     return {{}, 0, result::UpdateStatus::kError, "Could not update metadata."};
   } catch (const std::exception &e) {
+    update_decision_ = boost::none;
     last_exception = std::current_exception();
     return {{}, 0, result::UpdateStatus::kError, "Could not update metadata."};
   }
+  if (reused) {
+    return *reused;
+  }
+  update_decision_ = boost::none;
 
   if (updates.empty()) {
     LOG_DEBUG << "No new updates found in Uptane metadata.";
-    return {{}, 0, result::UpdateStatus::kNoUpdatesAvailable, ""};
+    return rememberUpdateDecision(utype, storage_generation, {{}, 0, result::UpdateStatus::kNoUpdatesAvailable, ""});
   }
 
   // 5.4.4.2.10.: Verify that Targets metadata from the Director and Image
@@ -1007,7 +1578,23 @@ result::UpdateCheck SotaUptaneClient::checkUpdates(UpdateType utype) {
   } else {
     LOG_INFO << updates.size() << " new updates found in both Director and Image repo metadata.";
   }
-  return {updates, ecus_count, result::UpdateStatus::kUpdatesAvailable, ""};
+  return rememberUpdateDecision(utype, storage_generation,
+                                {updates, ecus_count, result::UpdateStatus::kUpdatesAvailable, ""});
+}
+
+result::UpdateCheck SotaUptaneClient::rememberUpdateDecision(UpdateType utype, uint64_t storage_generation,
+                                                             result::UpdateCheck result) {
+  // An aborted check may have stopped before finding the updates
+  if (utype == UpdateType::kOnline && (flow_control_ == nullptr || !flow_control_->hasAborted())) {
+    UpdateDecision decision;
+    decision.director_version = director_repo.getTargets().version();
+    decision.director_hash = director_repo.acceptedTargetsHash();
+    decision.storage_generation = storage_generation;
+    decision.image_snapshot_version = image_repo.getSnapshotVersion();
+    decision.result = result;
+    update_decision_ = std::move(decision);
+  }
+  return result;
 }
 
 result::UpdateStatus SotaUptaneClient::checkUpdatesOffline(const std::vector<Uptane::Target> &targets,
@@ -1060,9 +1647,11 @@ result::UpdateStatus SotaUptaneClient::checkUpdatesOffline(const std::vector<Upt
 }
 
 result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates, UpdateType utype) {
+  TraceSpan span("update", "uptaneInstall");
   if (utype != UpdateType::kOffline) {
     requiresAlreadyProvisioned();
   }
+  const auto started = CyclePerformance::Clock::now();
 
   auto correlation_id = director_repo.getCorrelationId();
 
@@ -1077,6 +1666,7 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
     // Recheck the Uptane metadata and make sure the requested updates are
     // consistent with the stored metadata.
     result::UpdateStatus update_status;
+    const auto verify_started = CyclePerformance::Clock::now();
     try {
       update_status = checkUpdatesOffline(updates, utype);
     } catch (const std::exception &e) {
@@ -1095,19 +1685,23 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 
     Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
     // Recheck the downloaded update hashes.
-    for (const auto &update : updates) {
-      if (update.IsForEcu(primary_ecu_serial) || !update.IsOstree()) {
-        // download binary images for any target, for both Primary and Secondary
-        // download an OSTree revision just for Primary, Secondary will do it by itself
-        // Primary cannot verify downloaded OSTree targets for Secondaries,
-        // Downloading of Secondary's OSTree repo revision to the Primary's can fail
-        // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
-        if (package_manager_->verifyTarget(update) != TargetStatus::kGood) {
-          result.dev_report = {false, data::ResultCode::Numeric::kInternalError, ""};
-          return std::make_tuple(result, "Downloaded target is invalid");
+    {
+      ScopedResourcePolicy policy(ResourcePhase::kHash);
+      for (const auto &update : updates) {
+        if ((update.IsForEcu(primary_ecu_serial) || !update.IsOstree()) && !passesThroughSecondaries(update, utype)) {
+          // download binary images for any target, for both Primary and Secondary
+          // download an OSTree revision just for Primary, Secondary will do it by itself
+          // Primary cannot verify downloaded OSTree targets for Secondaries,
+          // Downloading of Secondary's OSTree repo revision to the Primary's can fail
+          // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
+          if (package_manager_->verifyTarget(update) != TargetStatus::kGood) {
+            result.dev_report = {false, data::ResultCode::Numeric::kInternalError, ""};
+            return std::make_tuple(result, "Downloaded target is invalid");
+          }
         }
       }
     }
+    performance_.addVerification(CyclePerformance::Clock::now() - verify_started);
 
     // wait some time for Secondaries to come up
     // note: this fail after a time out but will be retried at the next install
@@ -1144,6 +1738,9 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
       }
     }
 
+    // Metadata and firmware sent during the download are not sent concurrently with what follows
+    waitPresends();
+
     //   6 - send metadata to all the ECUs
     data::InstallationResult metadata_res;
     std::string rr;
@@ -1156,14 +1753,16 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
     // Send the firmware to all secondary ECUs. Note we want to do this before
     // committing the first install
 
-    for (auto &install : secondary_installs) {
-      install.SendFirmwareAsync();
-    }
+    const auto max_parallel = static_cast<size_t>(config.uptane.secondary_install_concurrency);
+    const auto max_per_type = static_cast<size_t>(config.uptane.secondary_install_concurrency_per_type);
+    RunSecondaryInstallationJobs(secondary_installs, max_parallel, max_per_type,
+                                 [](SecondaryEcuInstallationJob &install) { install.SendFirmware(); });
+    // Secondaries that fetch their firmware by themselves are polled from here
+    WaitForSecondaryFirmware(secondary_installs, flow_control_);
 
     bool all_secondary_firmware_sent = true;
     data::InstallationResult first_error;
     for (auto &install : secondary_installs) {
-      install.WaitForFirmwareSent();
       if (!install.Ok() && all_secondary_firmware_sent) {
         all_secondary_firmware_sent = false;
         first_error = install.InstallationReport().install_res;
@@ -1175,6 +1774,30 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
       return std::make_tuple(result, "Secondary download failed");
     }
 
+    // Record the fact we are starting an installation on the Secondaries,
+    // mirroring the logic in SotaUptaneClient::PackageInstallSetResult. See the
+    // comments there for more information.
+    auto install_on_secondaries = [this, &secondary_installs, &correlation_id, max_parallel, max_per_type]() {
+      {
+        StorageBatch batch(*storage);
+        for (auto &install : secondary_installs) {
+          storage->saveInstalledVersion(install.ecu_serial().ToString(), install.target(),
+                                        InstalledVersionUpdateMode::kNone, correlation_id);
+        }
+        batch.commit();
+      }
+
+      RunSecondaryInstallationJobs(secondary_installs, max_parallel, max_per_type,
+                                   [](SecondaryEcuInstallationJob &install) { install.Install(); });
+    };
+
+    // For updates whose ECUs don't depend on each other, the Secondaries don't wait for the Primary install
+    std::future<void> concurrent_installs;
+    if (config.uptane.concurrent_primary_install && !primary_installs.empty() && !secondary_installs.empty()) {
+      LOG_INFO << "Installing on the Secondaries while installing on the Primary";
+      concurrent_installs = std::async(std::launch::async, install_on_secondaries);
+    }
+
     //   7 - send images to ECUs (deploy for OSTree)
     bool primary_install_failed = false;
     if (!primary_installs.empty()) {
@@ -1212,23 +1835,18 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
     }
 
     // Install on secondaries
-    if (!primary_install_failed) {
-      // Record the fact we are starting an installation, mirroring the logic in
-      // SotaUptaneClient::PackageInstallSetResult. See the comments there for
-      // more information.
-      for (auto &install : secondary_installs) {
-        storage->saveInstalledVersion(install.ecu_serial().ToString(), install.target(),
-                                      InstalledVersionUpdateMode::kNone, correlation_id);
-      }
-
-      for (auto &install : secondary_installs) {
-        install.InstallAsync();
-      }
-
-      for (auto &install : secondary_installs) {
-        install.WaitForInstall();
-      }
+    bool secondaries_installed = true;
+    if (concurrent_installs.valid()) {
+      concurrent_installs.get();
+    } else if (!primary_install_failed) {
+      install_on_secondaries();
+    } else {
+      LOG_WARNING << "Skipping installation on secondaries since primary install failed";
+      secondaries_installed = false;
+    }
 
+    if (secondaries_installed) {
+      StorageBatch batch(*storage);
       for (auto &install : secondary_installs) {
         auto report = install.InstallationReport();
         result.ecu_reports.push_back(report);
@@ -1247,9 +1865,10 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 
         storage->saveEcuInstallationResult(install.ecu_serial(), report.install_res);
       }
-    } else {
-      LOG_WARNING << "Skipping installation on secondaries since primary install failed";
+      batch.commit();
     }
+    // Only an installation that stopped before this point is resumed
+    storage->clearInstallJournal();
 
     computeDeviceInstallationResult(&result.dev_report, &rr);
 
@@ -1257,8 +1876,13 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
   }();
 
   storage->storeDeviceInstallationResult(r.dev_report, raw_report, correlation_id);
+  performance_.addInstall(CyclePerformance::Clock::now() - started);
+  reportPerformance(correlation_id, r.dev_report.needCompletion());
 
   sendEvent<event::AllInstallsComplete>(r);
+  if (r.dev_report.isSuccess() || r.dev_report.needCompletion()) {
+    pruneStoredTargetsInBackground();
+  }
 
   return r;
 }
@@ -1266,7 +1890,22 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 result::CampaignCheck SotaUptaneClient::campaignCheck() {
   requiresProvision();
 
-  auto campaigns = campaign::Campaign::fetchAvailableCampaigns(*http, config.tls.server);
+  const auto now = std::chrono::steady_clock::now();
+  if (campaigns_cached_ && config.uptane.campaigns_ttl_sec > 0 &&
+      now < campaigns_fetched_ + std::chrono::seconds(config.uptane.campaigns_ttl_sec)) {
+    LOG_DEBUG << "Using the campaign list received "
+              << std::chrono::duration_cast<std::chrono::seconds>(now - campaigns_fetched_).count() << " s ago";
+    result::CampaignCheck result(campaigns_);
+    sendEvent<event::CampaignCheckComplete>(result);
+    return result;
+  }
+
+  bool changed = false;
+  auto campaigns = campaign::Campaign::fetchAvailableCampaigns(*http, config.tls.server, *storage, &changed);
+  // An empty list may come from a failed request, so it is asked for again on the next check
+  campaigns_ = campaigns;
+  campaigns_fetched_ = now;
+  campaigns_cached_ = !campaigns.empty();
   for (const auto &c : campaigns) {
     LOG_INFO << "Campaign: " << c.name;
     LOG_INFO << "Campaign id: " << c.id;
@@ -1275,6 +1914,9 @@ result::CampaignCheck SotaUptaneClient::campaignCheck() {
     LOG_INFO << "Message: " << c.description;
   }
   result::CampaignCheck result(campaigns);
+  if (changed) {
+    sendEvent<event::CampaignsChanged>(result);
+  }
   sendEvent<event::CampaignCheckComplete>(result);
   return result;
 }
@@ -1337,10 +1979,22 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
   }
 
   static bool connected = true;
-  auto manifest = AssembleManifest();
+  auto manifest = assembleManifestContent();
   if (!custom.empty()) {
     manifest["custom"] = custom;
   }
+  // Secondary manifests are embedded as signed by the Secondaries, so the
+  // unsigned content tells whether anything changed since the last upload
+  const std::string content_hash =
+      Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(manifest)).HashString();
+  const auto now = std::chrono::steady_clock::now();
+  if (config.uptane.manifest_heartbeat_sec > 0 && content_hash == acked_manifest_hash_ &&
+      now < last_manifest_put_ + std::chrono::seconds(config.uptane.manifest_heartbeat_sec)) {
+    LOG_DEBUG << "Not sending manifest because it has not changed";
+    return true;
+  }
+
+  signPrimaryManifest(&manifest);
   auto signed_manifest = uptane_manifest->sign(manifest);
   HttpResponse response = http->put(config.uptane.director_server + "/manifest", signed_manifest);
   if (response.isOk()) {
@@ -1349,6 +2003,8 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
     }
     connected = true;
     storage->clearInstallationResults();
+    acked_manifest_hash_ = content_hash;
+    last_manifest_put_ = now;
 
     return true;
   } else {
@@ -1360,6 +2016,7 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
 }
 
 bool SotaUptaneClient::putManifest(const Json::Value &custom) {
+  TraceSpan span("update", "putManifest");
   requiresProvision();
 
   bool success = putManifestSimple(custom);
@@ -1391,33 +2048,162 @@ bool SotaUptaneClient::waitSecondariesReachable(const std::vector<Uptane::Target
 
   LOG_INFO << "Waiting for Secondaries to connect to start installation...";
 
-  auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(config.uptane.secondary_preinstall_wait_sec);
-  while (std::chrono::system_clock::now() <= deadline) {
-    if (targeted_secondaries.empty()) {
-      return true;
-    }
-
-    for (auto sec_it = targeted_secondaries.begin(); sec_it != targeted_secondaries.end();) {
-      bool connected = false;
+  // Probe all of them at the same time, so that the wait is as long as the one
+  // of the slowest Secondary rather than the sum of their connect timeouts
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(config.uptane.secondary_preinstall_wait_sec);
+  auto probe = [deadline](const Uptane::EcuSerial &serial, SecondaryInterface *sec) {
+    for (int retry = 1;; ++retry) {
       try {
-        connected = sec_it->second->ping();
+        if (sec->ping()) {
+          return true;
+        }
       } catch (const std::exception &ex) {
-        LOG_DEBUG << "Failed to ping Secondary with serial " << sec_it->first << ": " << ex.what();
+        LOG_DEBUG << "Failed to ping Secondary with serial " << serial << ": " << ex.what();
+      }
+      const auto backoff = kSecondaryPingRetryPolicy.delay(retry);
+      if (std::chrono::steady_clock::now() + backoff > deadline) {
+        return false;
       }
-      if (connected) {
-        sec_it = targeted_secondaries.erase(sec_it);
+      std::this_thread::sleep_for(backoff);
+    }
+  };
+
+  std::map<Uptane::EcuSerial, std::future<bool>> probes;
+  for (const auto &sec : targeted_secondaries) {
+    probes.emplace(sec.first, std::async(std::launch::async, probe, sec.first, sec.second));
+  }
+
+  bool all_connected = true;
+  for (auto &p : probes) {
+    if (!p.second.get()) {
+      LOG_ERROR << "Secondary with serial " << p.first << " failed to connect!";
+      all_connected = false;
+    }
+  }
+
+  return all_connected;
+}
+
+bool SotaUptaneClient::passesThroughSecondaries(const Uptane::Target &target, UpdateType utype) {
+  if (!config.uptane.secondary_firmware_passthrough || utype != UpdateType::kOnline || target.IsOstree() ||
+      target.ecus().empty() || target.IsForEcu(primaryEcuSerial())) {
+    return false;
+  }
+  for (const auto &ecu : target.ecus()) {
+    auto sec = secondaries.find(ecu.first);
+    if (sec == secondaries.end() || !sec->second->acceptsFirmwareStream()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Sending the firmware is idempotent and does not commit to the installation
+ * (see SecondaryInterface::sendFirmware()), so it can be done while the other
+ * Targets are still downloading. */
+void SotaUptaneClient::presendFirmware(const Uptane::Target &target, UpdateType utype) {
+  if (!config.uptane.pipeline_secondary_transfer || utype != UpdateType::kOnline) {
+    return;
+  }
+  for (const auto &ecu : target.ecus()) {
+    auto sec = secondaries.find(ecu.first);
+    if (sec == secondaries.end()) {
+      continue;
+    }
+    LOG_INFO << "Sending " << target.filename() << " to Secondary " << ecu.first << " ahead of the installation";
+    Presend presend{target, std::async(std::launch::async, [this, target, secondary = sec->second, utype]() {
+                      data::InstallationResult result = sendMetadataToEcu(target, *secondary, utype);
+                      if (!result.isSuccess()) {
+                        return result;
+                      }
+                      try {
+                        return secondary->sendFirmware(target, InstallInfo(utype), flow_control_);
+                      } catch (const std::exception &ex) {
+                        return data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+                      }
+                    })};
+    {
+      std::lock_guard<std::mutex> guard(presends_mutex_);
+      auto earlier = presends_.find(ecu.first);
+      if (earlier == presends_.end()) {
+        presends_.emplace(ecu.first, std::move(presend));
       } else {
-        sec_it++;
+        std::swap(earlier->second, presend);
       }
     }
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    // An earlier transfer to the same Secondary is waited for here, outside of the lock
   }
+}
 
-  for (const auto &sec : targeted_secondaries) {
-    LOG_ERROR << "Secondary with serial " << sec.second->getSerial() << " failed to connect!";
+void SotaUptaneClient::waitPresends() {
+  std::lock_guard<std::mutex> guard(presends_mutex_);
+  for (const auto &presend : presends_) {
+    presend.second.result.wait();
   }
+}
 
-  return false;
+boost::optional<data::InstallationResult> SotaUptaneClient::takePresendResult(const Uptane::EcuSerial &ecu_serial,
+                                                                              const Uptane::Target &target) {
+  std::future<data::InstallationResult> result;
+  {
+    std::lock_guard<std::mutex> guard(presends_mutex_);
+    auto presend = presends_.find(ecu_serial);
+    if (presend == presends_.end()) {
+      return boost::none;
+    }
+    const bool same_target = presend->second.target.MatchTarget(target);
+    result = std::move(presend->second.result);
+    presends_.erase(presend);
+    if (!same_target) {
+      return boost::none;
+    }
+  }
+  return result.get();
+}
+
+std::vector<Uptane::Target> SotaUptaneClient::retainedTargets() {
+  // Kept so that a rollback finds its image
+  std::vector<Uptane::Target> retain;
+  EcuSerials serials;
+  storage->loadEcuSerials(&serials);
+  for (const auto &ecu : serials) {
+    boost::optional<Uptane::Target> current;
+    boost::optional<Uptane::Target> pending;
+    storage->loadInstalledVersions(ecu.first.ToString(), &current, &pending, nullptr);
+    for (const auto &version : {current, pending}) {
+      if (version) {
+        retain.push_back(*version);
+      }
+    }
+    std::vector<Uptane::Target> log;
+    storage->loadInstallationLog(ecu.first.ToString(), &log, true);
+    const size_t previous = std::min<size_t>(log.size(), 2);
+    retain.insert(retain.end(), log.end() - static_cast<std::ptrdiff_t>(previous), log.end());
+  }
+  return retain;
+}
+
+void SotaUptaneClient::pruneStoredTargetsInBackground() {
+  if (!config.pacman.images_prune_after_install || config.pacman.images_max_bytes == 0) {
+    return;
+  }
+  if (prune_stored_targets_.valid() &&
+      prune_stored_targets_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    LOG_DEBUG << "Removal of stored Targets is still running";
+    return;
+  }
+
+  const std::vector<Uptane::Target> retain = retainedTargets();
+  prune_stored_targets_ = std::async(std::launch::async, [this, retain]() {
+    // The removal must not slow down an update
+    ScopedResourcePolicy policy(ResourcePolicy::lowest());
+    try {
+      package_manager_->pruneStoredTargets(retain);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not remove stored Targets: " << e.what();
+    }
+  });
 }
 
 void SotaUptaneClient::storeInstallationFailure(const data::InstallationResult &result) {
@@ -1458,93 +2244,157 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
                                      repo.ToString() + " repo Root version: " + std::to_string(sec_root_version));
   } else if (sec_root_version > 0 && last_root_version - sec_root_version > 1) {
     // Only send intermediate Roots that would otherwise be skipped. The latest
-    // will be sent with the complete set of the latest metadata.
+    // will be sent with the complete set of the latest metadata. Secondaries
+    // that support it get the whole chain in one request.
+    std::vector<std::string> roots;
     for (int v = sec_root_version + 1; v < last_root_version; v++) {
       std::string root;
-      if (!storage->loadRoot(&root, repo, Uptane::Version(v))) {
-        LOG_WARNING << "Couldn't find Root metadata in the storage, trying remote repo";
-        try {
-          if (utype == UpdateType::kOffline) {
-            // TODO: [OFFUPD] Test this condition; How?
-            // TODO: [OFFUPD] Protect with an #ifdef ??
-            uptane_fetcher_offupd->fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(),
-                                             Uptane::Version(v), flow_control_);
-          } else {
-            uptane_fetcher->fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(), Uptane::Version(v),
-                                      flow_control_);
-          }
-        } catch (const std::exception &e) {
-          LOG_ERROR << "Root metadata could not be fetched for Secondary with serial " << secondary.getSerial()
-                    << ", skipping to the next Secondary";
-          result = data::InstallationResult(data::ResultCode::Numeric::kInternalError,
-                                            "Root metadata could not be fetched for Secondary with serial " +
-                                                secondary.getSerial().ToString() + ", skipping to the next Secondary");
-          break;
-        }
+      if (!loadIntermediateRoot(&root, repo, v, utype)) {
+        LOG_ERROR << "Root metadata could not be fetched for Secondary with serial " << secondary.getSerial()
+                  << ", skipping to the next Secondary";
+        result = data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                          "Root metadata could not be fetched for Secondary with serial " +
+                                              secondary.getSerial().ToString() + ", skipping to the next Secondary");
+        break;
       }
+      roots.push_back(std::move(root));
+    }
+    if (!roots.empty()) {
+      data::InstallationResult put_result{data::ResultCode::Numeric::kOk, ""};
       try {
-        result = secondary.putRoot(root, repo == Uptane::RepositoryType::Director());
+        put_result = secondary.putRootChain(roots, repo == Uptane::RepositoryType::Director());
       } catch (const std::exception &ex) {
-        result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+        put_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
       }
-      if (!result.isSuccess()) {
+      if (!put_result.isSuccess()) {
         LOG_ERROR << "Sending Root metadata to Secondary with serial " << secondary.getSerial()
-                  << " failed: " << result.result_code << " " << result.description;
-        break;
+                  << " failed: " << put_result.result_code << " " << put_result.description;
+        result = put_result;
       }
     }
   }
   return result;
 }
 
-// TODO: the function blocks until it updates all the Secondaries. Consider non-blocking operation.
+/* Intermediate Roots are the same for every Secondary, so they are loaded or
+ * fetched once per metadata distribution. The lock also serializes the remote
+ * fetches, which share one HTTP handle. */
+bool SotaUptaneClient::loadIntermediateRoot(std::string *root, Uptane::RepositoryType repo, int version,
+                                            UpdateType utype) {
+  std::lock_guard<std::mutex> guard(intermediate_roots_mutex);
+  const auto key = std::make_pair(repo.ToString(), version);
+  auto cached = intermediate_roots.find(key);
+  if (cached != intermediate_roots.end()) {
+    *root = cached->second;
+    return true;
+  }
+  if (!storage->loadRoot(root, repo, Uptane::Version(version))) {
+    LOG_WARNING << "Couldn't find Root metadata in the storage, trying remote repo";
+    try {
+      if (utype == UpdateType::kOffline) {
+        // TODO: [OFFUPD] Test this condition; How?
+        // TODO: [OFFUPD] Protect with an #ifdef ??
+        uptane_fetcher_offupd->fetchRole(root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(),
+                                         Uptane::Version(version), flow_control_);
+      } else {
+        uptane_fetcher->fetchRole(root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(), Uptane::Version(version),
+                                  flow_control_);
+      }
+    } catch (const std::exception &e) {
+      return false;
+    }
+  }
+  intermediate_roots.emplace(key, *root);
+  return true;
+}
+
+data::InstallationResult SotaUptaneClient::sendMetadataToEcu(const Uptane::Target &target,
+                                                             SecondaryInterface &secondary, UpdateType utype) {
+  /* Root rotation if necessary */
+  data::InstallationResult result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), secondary, utype);
+  if (!result.isSuccess()) {
+    return result;
+  }
+  result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), secondary, utype);
+  if (!result.isSuccess()) {
+    return result;
+  }
+  try {
+    if (utype == UpdateType::kOffline) {
+#ifdef BUILD_OFFLINE_UPDATES
+      result = secondary.putMetadataOffUpd(target, *uptane_fetcher_offupd);
+#else
+      result = data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                        "sendMetadataToEcus(): Offline-updates not enabled");
+#endif
+    } else {
+      result = secondary.putMetadata(target);
+    }
+  } catch (const std::exception &ex) {
+    result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
+  return result;
+}
+
+/* Secondaries are sent their metadata in parallel, each on its own thread;
+ * the jobs for one Secondary keep their order. The function still blocks until
+ * all Secondaries are done. */
 void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                                           std::string *raw_installation_report, UpdateType utype) {
-  data::InstallationResult final_result{data::ResultCode::Numeric::kOk, ""};
-  std::string result_code_err_str;
+  struct MetadataJob {
+    const Uptane::Target &target;
+    Uptane::EcuSerial ecu_serial;
+    Uptane::HardwareIdentifier hw_id;
+    SecondaryInterface &secondary;
+    data::InstallationResult result;
+  };
+  std::vector<MetadataJob> jobs;
+  std::map<Uptane::EcuSerial, std::vector<size_t>> jobs_per_ecu;
   for (const auto &target : targets) {
     for (const auto &ecu : target.ecus()) {
-      const Uptane::EcuSerial ecu_serial = ecu.first;
-      const Uptane::HardwareIdentifier hw_id = ecu.second;
-      auto sec = secondaries.find(ecu_serial);
+      auto sec = secondaries.find(ecu.first);
       if (sec == secondaries.end()) {
         continue;
       }
+      jobs_per_ecu[ecu.first].push_back(jobs.size());
+      jobs.push_back({target, ecu.first, ecu.second, *sec->second, data::InstallationResult()});
+    }
+  }
 
-      data::InstallationResult local_result{data::ResultCode::Numeric::kOk, ""};
-      do {
-        /* Root rotation if necessary */
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), *(sec->second), utype);
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), *(sec->second), utype);
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        try {
-          if (utype == UpdateType::kOffline) {
-#ifdef BUILD_OFFLINE_UPDATES
-            local_result = sec->second->putMetadataOffUpd(target, *uptane_fetcher_offupd);
-#else
-            local_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError,
-                                                    "sendMetadataToEcus(): Offline-updates not enabled");
-#endif
-          } else {
-            local_result = sec->second->putMetadata(target);
-          }
-        } catch (const std::exception &ex) {
-          local_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  // Load the metadata bundle once for all Secondaries.
+  auto meta_bundle = std::make_shared<Uptane::MetaBundle>();
+  if (!jobs.empty() && utype == UpdateType::kOnline &&
+      secondary_provider_->getMetadata(meta_bundle.get(), targets[0])) {
+    secondary_provider_->setMetadataSnapshot(meta_bundle);
+  }
+  intermediate_roots.clear();
+  try {
+    std::vector<std::future<void>> workers;
+    for (const auto &ecu_jobs : jobs_per_ecu) {
+      const std::vector<size_t> &indices = ecu_jobs.second;
+      workers.push_back(std::async(std::launch::async, [this, &jobs, &indices, utype]() {
+        for (const size_t i : indices) {
+          jobs[i].result = sendMetadataToEcu(jobs[i].target, jobs[i].secondary, utype);
         }
-      } while (false);
-      if (!local_result.isSuccess()) {
-        LOG_ERROR << "Sending metadata to " << sec->first << " failed: " << local_result.result_code << " "
-                  << local_result.description;
-        const std::string ecu_code_str = hw_id.ToString() + ":" + local_result.result_code.ToString();
-        result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
-      }
+      }));
+    }
+    for (auto &worker : workers) {
+      worker.get();
+    }
+  } catch (...) {
+    secondary_provider_->setMetadataSnapshot(nullptr);
+    throw;
+  }
+  secondary_provider_->setMetadataSnapshot(nullptr);
+
+  data::InstallationResult final_result{data::ResultCode::Numeric::kOk, ""};
+  std::string result_code_err_str;
+  for (const auto &job : jobs) {
+    if (!job.result.isSuccess()) {
+      LOG_ERROR << "Sending metadata to " << job.ecu_serial << " failed: " << job.result.result_code << " "
+                << job.result.description;
+      const std::string ecu_code_str = job.hw_id.ToString() + ":" + job.result.result_code.ToString();
+      result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
     }
   }
 
@@ -1563,9 +2413,9 @@ void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &tar
   }
 }
 
-Uptane::LazyTargetsList SotaUptaneClient::allTargets() const {
+Uptane::LazyTargetsList SotaUptaneClient::allTargets(Uptane::TargetFilter filter) const {
   // TODO: [OFFUPD] Note this used in tests only ATM.
-  return Uptane::LazyTargetsList(image_repo, storage, uptane_fetcher, flow_control_);
+  return Uptane::LazyTargetsList(image_repo, storage, uptane_fetcher, flow_control_, std::move(filter));
 }
 
 void SotaUptaneClient::startupCleanSecondaries() {
@@ -1578,108 +2428,180 @@ void SotaUptaneClient::startupCleanSecondaries() {
     pending_serials.insert(ecu.first);
   }
 
-  // ...and call cleanStartup() on them.
+  // ...and call cleanStartup() on them, all at the same time.
+  std::vector<std::future<void>> cleanups;
   for (const auto &secondary : secondaries) {
     if (pending_serials.find(secondary.first) != pending_serials.end()) {
       continue;
     }
-    secondary.second->cleanStartup();
+    cleanups.push_back(std::async(std::launch::async, [sec = secondary.second]() { sec->cleanStartup(); }));
+  }
+  for (auto &cleanup : cleanups) {
+    cleanup.get();
+  }
+}
+
+namespace {
+// Result of checking a Secondary with a pending update, see checkAndUpdatePendingSecondaries()
+struct PendingSecondaryCheck {
+  enum class Outcome { kNotInstalled, kPending, kFailed, kInstalled };
+  Outcome outcome{Outcome::kNotInstalled};
+  data::InstallationResult install_result;
+};
+
+PendingSecondaryCheck checkPendingSecondary(SecondaryInterface &sec, const Uptane::Target &pending_version,
+                                            const Hash &pending_hash) {
+  using Outcome = PendingSecondaryCheck::Outcome;
+  const Uptane::EcuSerial serial = sec.getSerial();
+  PendingSecondaryCheck check;
+
+  // Give secondaries a chance to complete the last install: this is likely useful mostly to virtual secondaries.
+  LOG_INFO << "Trying to complete pending update " << pending_hash << " on Secondary with serial " << serial;
+  auto opt_install_res = sec.completePendingInstall(pending_version);
+  if (opt_install_res) {
+    if (opt_install_res->isSuccess()) {
+      // Follow with normal process, i.e. use manifest to confirm installation.
+    } else if (opt_install_res->needCompletion()) {
+      LOG_INFO << "Update " << pending_hash << " remains pending on Secondary with serial " << serial;
+      check.outcome = Outcome::kPending;
+      return check;
+    } else {
+      // Failure detected by secondary; clear pending state.
+      LOG_INFO << "Pending update " << pending_hash << " failed to complete on Secondary with serial " << serial;
+      check.outcome = Outcome::kFailed;
+      check.install_result = *opt_install_res;
+      return check;
+    }
+  }
+
+  Uptane::Manifest manifest = sec.getManifest();
+  if (manifest.empty()) {
+    LOG_DEBUG << "Failed to get manifest from Secondary with serial " << serial;
+    return check;
+  }
+  bool verified = false;
+  try {
+    verified = manifest.verifySignature(sec.getPublicKey());
+  } catch (const std::exception &ex) {
+    LOG_ERROR << "Failed to get public key from Secondary with serial " << serial << ": " << ex.what();
+  }
+  if (!verified) {
+    LOG_ERROR << "Invalid manifest or signature reported by Secondary: "
+              << " serial: " << serial << " manifest: " << manifest;
+    return check;
   }
+
+  auto current_ecu_hash = manifest.installedImageHash();
+  if (pending_hash == current_ecu_hash) {
+    LOG_INFO << "The pending update " << current_ecu_hash << " has been installed on " << serial;
+    check.outcome = Outcome::kInstalled;
+  } else {
+    LOG_DEBUG << "The pending update for ECU " << serial << " has not been installed (" << pending_hash
+              << " != " << current_ecu_hash << ")";
+  }
+  return check;
 }
+}  // namespace
 
 void SotaUptaneClient::checkAndUpdatePendingSecondaries() {
+  using Outcome = PendingSecondaryCheck::Outcome;
   std::vector<std::pair<Uptane::EcuSerial, Hash>> pending_ecus;
   storage->getPendingEcus(&pending_ecus);
 
+  struct PendingEcu {
+    Uptane::EcuSerial serial;
+    std::shared_ptr<SecondaryInterface> sec;
+    Uptane::Target pending_version;
+    Uptane::CorrelationId correlation_id;
+    std::future<PendingSecondaryCheck> check;
+  };
+  std::vector<PendingEcu> checks;
   for (const auto &pending_ecu : pending_ecus) {
     if (primaryEcuSerial() == pending_ecu.first) {
       continue;
     }
-    auto &sec = secondaries[pending_ecu.first];
-
-    // Give secondaries a chance to complete the last install: this is likely useful mostly to virtual secondaries.
-    {
-      const Uptane::EcuSerial &serial = pending_ecu.first;
-      boost::optional<Uptane::Target> pending_version;
-      Uptane::CorrelationId correlation_id;
-      storage->loadInstalledVersions(serial.ToString(), nullptr, &pending_version, &correlation_id);
-
-      LOG_INFO << "Trying to complete pending update " << pending_ecu.second << " on Secondary with serial "
-               << pending_ecu.first;
-      auto opt_install_res = sec->completePendingInstall(*pending_version);
-      if (opt_install_res) {
-        if (opt_install_res->isSuccess()) {
-          // Follow with normal process, i.e. use manifest to confirm installation.
-        } else if (opt_install_res->needCompletion()) {
-          LOG_INFO << "Update " << pending_ecu.second << " remains pending on Secondary with serial "
-                   << pending_ecu.first;
-          continue;
-        } else {
-          // Failure detected by secondary; clear pending state.
-          LOG_INFO << "Pending update " << pending_ecu.second << " failed to complete on Secondary with serial "
-                   << pending_ecu.first;
-          storage->saveEcuInstallationResult(serial, *opt_install_res);
-          storage->saveInstalledVersion(serial.ToString(), *pending_version, InstalledVersionUpdateMode::kNone,
-                                        correlation_id);
-
-          report_queue->enqueue(
-              std_::make_unique<EcuInstallationCompletedReport>(pending_ecu.first, correlation_id, false));
-
-          data::InstallationResult ir;
-          std::string raw_report;
-          computeDeviceInstallationResult(&ir, &raw_report);
-          storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
-          sec->rollbackPendingInstall();
-          continue;
-        }
-      }
-    }
-
-    Uptane::Manifest manifest;
-    try {
-      manifest = sec->getManifest();
-    } catch (const std::exception &ex) {
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << pending_ecu.first << ": " << ex.what();
+    auto sec = secondaries.find(pending_ecu.first);
+    if (sec == secondaries.end()) {
+      LOG_ERROR << "Pending update for unknown Secondary with serial " << pending_ecu.first;
       continue;
     }
-    if (manifest.empty()) {
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << pending_ecu.first;
+    boost::optional<Uptane::Target> pending_version;
+    Uptane::CorrelationId correlation_id;
+    if (!storage->loadInstalledVersions(pending_ecu.first.ToString(), nullptr, &pending_version, &correlation_id) ||
+        !pending_version) {
       continue;
     }
-    bool verified = false;
-    try {
-      verified = manifest.verifySignature(sec->getPublicKey());
-    } catch (const std::exception &ex) {
-      LOG_ERROR << "Failed to get public key from Secondary with serial " << pending_ecu.first << ": " << ex.what();
-    }
-    if (!verified) {
-      LOG_ERROR << "Invalid manifest or signature reported by Secondary: "
-                << " serial: " << pending_ecu.first << " manifest: " << manifest;
+
+    // Check all of them at the same time. Not std::async, for the same reason
+    // as in requestSecondaryManifests().
+    std::promise<PendingSecondaryCheck> promise;
+    checks.push_back({pending_ecu.first, sec->second, *pending_version, correlation_id, promise.get_future()});
+    std::thread(
+        [secondary = sec->second, target = *pending_version, hash = pending_ecu.second](
+            std::promise<PendingSecondaryCheck> result) {
+          PendingSecondaryCheck check;
+          try {
+            check = checkPendingSecondary(*secondary, target, hash);
+          } catch (const std::exception &ex) {
+            LOG_DEBUG << "Failed to check pending update on Secondary with serial " << secondary->getSerial() << ": "
+                      << ex.what();
+          }
+          result.set_value(check);
+        },
+        std::move(promise))
+        .detach();
+  }
+  if (checks.empty()) {
+    return;
+  }
+
+  const auto timeout = std::chrono::seconds(config.uptane.secondary_manifest_timeout_sec);
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::vector<std::pair<PendingEcu *, PendingSecondaryCheck>> finished;
+  for (auto &ecu : checks) {
+    if (timeout.count() != 0 && ecu.check.wait_until(deadline) != std::future_status::ready) {
+      LOG_WARNING << "Secondary " << ecu.serial << " did not answer within "
+                  << config.uptane.secondary_manifest_timeout_sec << " seconds, its update remains pending";
       continue;
     }
+    auto check = ecu.check.get();
+    if (check.outcome == Outcome::kFailed || check.outcome == Outcome::kInstalled) {
+      finished.emplace_back(&ecu, check);
+    }
+  }
+  if (finished.empty()) {
+    return;
+  }
 
-    auto current_ecu_hash = manifest.installedImageHash();
-    if (pending_ecu.second == current_ecu_hash) {
-      LOG_INFO << "The pending update " << current_ecu_hash << " has been installed on " << pending_ecu.first;
-      boost::optional<Uptane::Target> pending_version;
-      Uptane::CorrelationId correlation_id;
-      if (storage->loadInstalledVersions(pending_ecu.first.ToString(), nullptr, &pending_version, &correlation_id)) {
-        storage->saveEcuInstallationResult(pending_ecu.first,
-                                           data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
-        storage->saveInstalledVersion(pending_ecu.first.ToString(), *pending_version,
-                                      InstalledVersionUpdateMode::kCurrent, correlation_id);
+  {
+    StorageBatch batch(*storage);
+    for (const auto &f : finished) {
+      const PendingEcu &ecu = *f.first;
+      if (f.second.outcome == Outcome::kFailed) {
+        storage->saveEcuInstallationResult(ecu.serial, f.second.install_result);
+        storage->saveInstalledVersion(ecu.serial.ToString(), ecu.pending_version, InstalledVersionUpdateMode::kNone,
+                                      ecu.correlation_id);
+      } else {
+        storage->saveEcuInstallationResult(ecu.serial, data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
+        storage->saveInstalledVersion(ecu.serial.ToString(), ecu.pending_version,
+                                      InstalledVersionUpdateMode::kCurrent, ecu.correlation_id);
+      }
+    }
 
-        report_queue->enqueue(
-            std_::make_unique<EcuInstallationCompletedReport>(pending_ecu.first, correlation_id, true));
+    data::InstallationResult ir;
+    std::string raw_report;
+    computeDeviceInstallationResult(&ir, &raw_report);
+    storage->storeDeviceInstallationResult(ir, raw_report, finished.back().first->correlation_id);
+    batch.commit();
+  }
 
-        data::InstallationResult ir;
-        std::string raw_report;
-        computeDeviceInstallationResult(&ir, &raw_report);
-        storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
-      }
-    } else {
-      LOG_DEBUG << "The pending update for ECU " << pending_ecu.first << " has not been installed ("
-                << pending_ecu.second << " != " << current_ecu_hash << ")";
+  // Outside of the batch: the report queue uses the storage from its own thread
+  for (const auto &f : finished) {
+    const PendingEcu &ecu = *f.first;
+    const bool success = f.second.outcome == Outcome::kInstalled;
+    report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(ecu.serial, ecu.correlation_id, success));
+    if (!success) {
+      ecu.sec->rollbackPendingInstall();
     }
   }
 }
@@ -1711,6 +2633,18 @@ std::ifstream SotaUptaneClient::openStoredTarget(const Uptane::Target &target) {
   }
 }
 
+int SotaUptaneClient::openStoredTargetFd(const Uptane::Target &target) {
+  const auto file = package_manager_->checkTargetFile(target);
+  if (!file || package_manager_->verifyTarget(target) != TargetStatus::kGood) {
+    throw std::runtime_error("Failed to open Target");
+  }
+  const int fd = open(file->second.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::system_category(), "open " + file->second);
+  }
+  return fd;
+}
+
 #ifdef BUILD_OFFLINE_UPDATES
 result::UpdateCheck SotaUptaneClient::fetchMetaOffUpd(const boost::filesystem::path &source_path) {
   result::UpdateCheck result;
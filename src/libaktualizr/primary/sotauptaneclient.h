@@ -1,6 +1,8 @@
 #ifndef SOTA_UPTANE_CLIENT_H_
 #define SOTA_UPTANE_CLIENT_H_
 
+#include <chrono>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -8,6 +10,7 @@
 #include <vector>
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 #include <boost/signals2.hpp>
 #include "gtest/gtest_prod.h"
 #include "json/json.h"
@@ -19,9 +22,12 @@
 #include "libaktualizr/packagemanagerinterface.h"
 #include "libaktualizr/results.h"
 #include "libaktualizr/secondaryinterface.h"
+#include "libaktualizr/target_download.h"
 
 #include "bootloader/bootloader.h"
 #include "http/httpclient.h"
+#include "primary/cycle_performance.h"
+#include "primary/download_progress.h"
 #include "primary/secondary_provider_builder.h"
 #include "provisioner.h"
 #include "reportqueue.h"
@@ -31,8 +37,10 @@
 #include "uptane/imagerepository.h"
 #include "uptane/iterator.h"
 #include "uptane/manifest.h"
+#include "uptane/repomirror.h"
 #include "uptane/tuf.h"
 #include "utilities/flow_control.h"
+#include "utilities/utils.h"
 
 class SotaUptaneClient {
  public:
@@ -60,7 +68,16 @@ class SotaUptaneClient {
   SotaUptaneClient(Config &config_in, const std::shared_ptr<INvStorage> &storage_in)
       : SotaUptaneClient(config_in, storage_in, std::make_shared<HttpClient>(), nullptr, nullptr) {}
 
-  void initialize();
+  /**
+   * Load keys and ECU serials. Unless startup is deferred, also run
+   * completeStartup() right away.
+   */
+  void initialize(bool defer_startup = false);
+  /**
+   * Clean up Secondaries, finish updates interrupted by a reboot and make a
+   * first provisioning attempt.
+   */
+  void completeStartup();
   void addSecondary(const std::shared_ptr<SecondaryInterface> &sec);
 
   /**
@@ -71,12 +88,39 @@ class SotaUptaneClient {
   bool attemptProvision();
 
   result::Download downloadImages(const std::vector<Uptane::Target> &targets, UpdateType utype = UpdateType::kOnline);
+  /**
+   * Download `targets` under the control of one handle per target, in the
+   * same order, see Aktualizr::Download(const std::vector<Uptane::Target>&, UpdateType,
+   * std::vector<api::TargetDownloadHandle>*).
+   */
+  result::Download downloadImages(const std::vector<Uptane::Target> &targets, UpdateType utype,
+                                  const std::vector<api::TargetDownloadHandle> &handles);
+  /**
+   * Download `targets` ahead of an update that may not be installed yet, at
+   * low CPU and I/O priority. Failures are not reported to the server. A
+   * cancelled handle stops its target, keeping what was fetched so far for
+   * the next attempt.
+   */
+  result::Download predownloadImages(const std::vector<Uptane::Target> &targets,
+                                     const std::vector<api::TargetDownloadHandle> &handles);
+  /**
+   * One handle per target, controlled by the token of the command queue, with
+   * the priority of downloadPriority().
+   */
+  std::vector<api::TargetDownloadHandle> makeDownloadHandles(const std::vector<Uptane::Target> &targets) const;
+  /**
+   * The initial download priority of `target`: the integer "downloadPriority"
+   * of its custom metadata, otherwise the highest of uptane.download_priorities
+   * for the hardware it is for, otherwise 0.
+   */
+  int downloadPriority(const Uptane::Target &target) const;
 
   /** See Aktualizr::SetCustomHardwareInfo(Json::Value) */
   void setCustomHardwareInfo(Json::Value hwinfo) { custom_hardware_info_ = std::move(hwinfo); }
   void reportPause();
   void reportResume();
-  void sendDeviceData();
+  // Returns false if some of the data could not be sent, and should be sent again later
+  bool sendDeviceData();
   result::UpdateCheck fetchMeta();
   bool putManifest(const Json::Value &custom = Json::nullValue);
   result::Install uptaneInstall(const std::vector<Uptane::Target> &updates, UpdateType utype = UpdateType::kOnline);
@@ -91,7 +135,12 @@ class SotaUptaneClient {
   std::vector<Uptane::Target> getStoredTargets() const { return package_manager_->getTargetFiles(); }
   void deleteStoredTarget(const Uptane::Target &target) { package_manager_->removeTargetFile(target); }
   std::ifstream openStoredTarget(const Uptane::Target &target);
+  int openStoredTargetFd(const Uptane::Target &target);
+  /** The downloads in progress and the storage statistics, see Aktualizr::Snapshot() */
+  Json::Value snapshot();
   bool getEcuSerials(EcuSerials *serials) const { return provisioner_.GetEcuSerials(serials); }
+  /** See Uptane::Fetcher::takePollHint() */
+  int64_t takePollHint() const { return uptane_fetcher->takePollHint(); }
 
 #ifdef BUILD_OFFLINE_UPDATES
   result::UpdateCheck fetchMetaOffUpd(const boost::filesystem::path &source_path);
@@ -112,9 +161,13 @@ class SotaUptaneClient {
   FRIEND_TEST(Aktualizr, DownloadNonOstreeBin);
   FRIEND_TEST(Uptane, AssembleManifestGood);
   FRIEND_TEST(Uptane, AssembleManifestBad);
+  FRIEND_TEST(Uptane, AssembleManifestSlowSecondary);
+  FRIEND_TEST(Uptane, WaitSecondariesReachable);
+  FRIEND_TEST(Uptane, PipelineSecondaryTransfer);
   FRIEND_TEST(Uptane, InstallFakeGood);
   FRIEND_TEST(Uptane, restoreVerify);
   FRIEND_TEST(Uptane, PutManifest);
+  FRIEND_TEST(Uptane, PutManifestHeartbeat);
   FRIEND_TEST(Uptane, offlineIteration);
   FRIEND_TEST(Uptane, IgnoreUnknownUpdate);
   FRIEND_TEST(Uptane, kRejectAllTest);
@@ -130,6 +183,8 @@ class SotaUptaneClient {
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationAfterInstallationAndBeforeReboot);
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationBeforeInstallation);
   FRIEND_TEST(Delegation, IterateAll);
+  FRIEND_TEST(Delegation, IterateFiltered);
+  FRIEND_TEST(Delegation, FetchOnlyChanged);
   friend class SecondaryEcuInstallationJob;
 
   /**
@@ -149,14 +204,21 @@ class SotaUptaneClient {
   result::UpdateCheck checkUpdates(UpdateType utype = UpdateType::kOnline);
   result::UpdateStatus checkUpdatesOffline(const std::vector<Uptane::Target> &targets,
                                            UpdateType utype = UpdateType::kOnline);
+  // With `reused` set, an unchanged update decision of the last online check is returned in it instead
   void uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count,
-                       UpdateType utype = UpdateType::kOnline);
+                       UpdateType utype = UpdateType::kOnline, boost::optional<result::UpdateCheck> *reused = nullptr);
   void uptaneOfflineIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count,
                               UpdateType utype = UpdateType::kOnline);
 
-  std::pair<bool, Uptane::Target> downloadImage(const Uptane::Target &target, UpdateType utype = UpdateType::kOnline);
+  /** `token` replaces the token of the command queue for this target if set. */
+  std::pair<bool, Uptane::Target> downloadImage(const Uptane::Target &target, UpdateType utype = UpdateType::kOnline,
+                                                const api::FlowControlToken *token = nullptr);
   data::InstallationResult PackageInstall(const Uptane::Target &target);
+  void requestSecondaryManifests();
   Json::Value AssembleManifest();
+  // The manifest with the Primary's version manifest still unsigned
+  Json::Value assembleManifestContent();
+  void signPrimaryManifest(Json::Value *manifest);
   std::exception_ptr getLastException() const { return last_exception; }
   Uptane::Target getCurrent() const { return package_manager_->getCurrent(); }
 
@@ -168,27 +230,57 @@ class SotaUptaneClient {
   data::InstallationResult PackageInstallSetResult(const Uptane::Target &target,
                                                    const Uptane::CorrelationId &correlation_id);
   void finalizeAfterReboot();
+  // Part of sendDeviceData(). Like the other report functions, returns false if its request failed.
+  bool reportHwInfo();
   // Part of sendDeviceData()
-  void reportHwInfo();
-  // Part of sendDeviceData()
-  void reportInstalledPackages();
+  bool reportInstalledPackages();
   // Called by sendDeviceData() and fetchMeta()
-  void reportNetworkInfo();
+  bool reportNetworkInfo();
+  // Part of sendDeviceData()
+  bool reportAktualizrConfiguration();
   // Part of sendDeviceData()
-  void reportAktualizrConfiguration();
+  void reportMetrics();
+  // Send the timings of the update cycle that just ended, or keep them until
+  // the reboot that completes it
+  void reportPerformance(const std::string &correlation_id, bool pending_reboot);
+  // Send the timings kept by reportPerformance() until the reboot
+  void reportPerformanceAfterReboot(const std::string &correlation_id);
   bool waitSecondariesReachable(const std::vector<Uptane::Target> &updates);
+  // Whether the image of `target` is left on the server and streamed to its Secondaries when it is installed
+  bool passesThroughSecondaries(const Uptane::Target &target, UpdateType utype);
+  // Send the metadata and firmware of a downloaded `target` to its Secondaries in the background
+  void presendFirmware(const Uptane::Target &target, UpdateType utype);
+  void waitPresends();
+  // The result of presendFirmware() for `ecu_serial`, if it sent `target` there
+  boost::optional<data::InstallationResult> takePresendResult(const Uptane::EcuSerial &ecu_serial,
+                                                              const Uptane::Target &target);
+  // Start removing stored Targets beyond images_max_bytes in the background, see images_prune_after_install
+  void pruneStoredTargetsInBackground();
+  // What each ECU runs, ran before and is about to run, kept when stored Targets are removed
+  std::vector<Uptane::Target> retainedTargets();
   void storeInstallationFailure(const data::InstallationResult &result);
   data::InstallationResult rotateSecondaryRoot(Uptane::RepositoryType repo, SecondaryInterface &secondary,
                                                UpdateType utype);
+  bool loadIntermediateRoot(std::string *root, Uptane::RepositoryType repo, int version, UpdateType utype);
+  data::InstallationResult sendMetadataToEcu(const Uptane::Target &target, SecondaryInterface &secondary,
+                                             UpdateType utype);
   void sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                           std::string *raw_installation_report, UpdateType utype);
 
   bool putManifestSimple(const Json::Value &custom = Json::nullValue);
   void getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count = nullptr);
   void updateDirectorMeta(UpdateType utype = UpdateType::kOnline);
+  bool checkDirectorMetaUnchanged();
+  boost::optional<result::UpdateCheck> reuseUpdateDecision();
+  result::UpdateCheck rememberUpdateDecision(UpdateType utype, uint64_t storage_generation,
+                                             result::UpdateCheck result);
   void updateImageMeta(UpdateType utype = UpdateType::kOnline);
+  // Fetches and verifies the Image repo metadata, from repo_server again if what the mirror had failed
+  void fetchImageMeta();
   void checkDirectorMetaOffline(UpdateType utype = UpdateType::kOnline);
   void checkImageMetaOffline(UpdateType utype = UpdateType::kOnline);
+  // Brings the Image repo mirror up to date, fetching the metadata first if `fetch`
+  void updateRepoMirror(bool fetch);
 
   void computeDeviceInstallationResult(data::InstallationResult *result, std::string *raw_installation_report);
   std::unique_ptr<Uptane::Target> findTargetInDelegationTree(const Uptane::Target &target, bool offline,
@@ -196,7 +288,7 @@ class SotaUptaneClient {
   std::unique_ptr<Uptane::Target> findTargetHelper(const Uptane::Targets &cur_targets,
                                                    const Uptane::Target &queried_target, int level, bool terminating,
                                                    bool offline, UpdateType utype);
-  Uptane::LazyTargetsList allTargets() const;
+  Uptane::LazyTargetsList allTargets(Uptane::TargetFilter filter = {}) const;
   void startupCleanSecondaries();
   void checkAndUpdatePendingSecondaries();
   Uptane::EcuSerial primaryEcuSerial() { return provisioner_.PrimaryEcuSerial(); }
@@ -222,16 +314,66 @@ class SotaUptaneClient {
   std::shared_ptr<KeyManager> key_manager_;
   std::shared_ptr<Uptane::Fetcher> uptane_fetcher;
   std::shared_ptr<Uptane::OfflineUpdateFetcher> uptane_fetcher_offupd;
+  // Set if UptaneConfig::repo_mirror_path is
+  std::unique_ptr<Uptane::RepoMirror> repo_mirror_;
   std::unique_ptr<ReportQueue> report_queue;
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   std::shared_ptr<event::Channel> events_channel;
   std::exception_ptr last_exception;
+  // Guards last_exception while several targets are downloaded in parallel
+  std::mutex last_exception_mutex;
   // ecu_serial => secondary*
   std::map<Uptane::EcuSerial, SecondaryInterface::Ptr> secondaries;
+  // Manifest requests to Secondaries, which may outlive one AssembleManifest()
+  std::map<Uptane::EcuSerial, std::future<Uptane::Manifest>> pending_manifests;
   std::mutex download_mutex;
+  // Intermediate Roots shared by all Secondaries during sendMetadataToEcus(),
+  // keyed by repository and version
+  std::map<std::pair<std::string, int>, std::string> intermediate_roots;
+  std::mutex intermediate_roots_mutex;
   Provisioner provisioner_;
   Json::Value custom_hardware_info_{Json::nullValue};
+  // Change indicators for the device data reported in the current session, so
+  // that unchanged data is not collected again
+  std::string reported_packages_version_;
+  NetworkChangeMonitor network_monitor_;
+  bool network_info_reported_{false};
+  bool config_reported_{false};
+  // Content of the last manifest the Director accepted, see putManifestSimple()
+  std::string acked_manifest_hash_;
+  std::chrono::steady_clock::time_point last_manifest_put_;
+  // Whether the stored Image repo metadata was fetched for the current Director Targets, see uptaneIteration()
+  bool image_meta_current_{false};
+  // Result of the last online checkUpdates() with updates or without, and what it was derived from. Reused while
+  // fast_update_check finds the Director Targets unchanged, see reuseUpdateDecision().
+  struct UpdateDecision {
+    int director_version{-1};
+    std::string director_hash;
+    uint64_t storage_generation{0};
+    int image_snapshot_version{-1};
+    result::UpdateCheck result;
+  };
+  boost::optional<UpdateDecision> update_decision_;
+  // Campaign list received last and when, see campaignCheck()
+  std::vector<campaign::Campaign> campaigns_;
+  std::chrono::steady_clock::time_point campaigns_fetched_;
+  bool campaigns_cached_{false};
+  DownloadProgressAggregator download_progress_;
+  // Timings of the current update cycle, see reportPerformance()
+  CyclePerformance performance_;
   const api::FlowControlToken *flow_control_;
+  // Parsed uptane.download_priorities, hardware ID => priority
+  std::map<std::string, int> download_priorities_;
+  // Started by pruneStoredTargetsInBackground(), waited for on destruction
+  std::future<void> prune_stored_targets_;
+  // Transfers started by presendFirmware(). Last, so that they are waited for
+  // before anything they use is destroyed.
+  struct Presend {
+    Uptane::Target target;
+    std::future<data::InstallationResult> result;
+  };
+  std::mutex presends_mutex_;
+  std::map<Uptane::EcuSerial, Presend> presends_;
 };
 
 #endif  // SOTA_UPTANE_CLIENT_H_
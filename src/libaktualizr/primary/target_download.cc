@@ -0,0 +1,38 @@
+#include "libaktualizr/target_download.h"
+
+#include "utilities/flow_control.h"
+
+namespace api {
+
+TargetDownload::TargetDownload(Uptane::Target target, const FlowControlToken* parent)
+    : target_{std::move(target)}, token_{new FlowControlToken(parent)} {}
+
+TargetDownload::~TargetDownload() = default;
+
+bool TargetDownload::Pause() {
+  if (!token_->setPause(true)) {
+    return false;
+  }
+  paused_ = true;
+  return true;
+}
+
+bool TargetDownload::Resume() {
+  if (!token_->setPause(false)) {
+    return false;
+  }
+  paused_ = false;
+  return true;
+}
+
+bool TargetDownload::Cancel() {
+  if (!token_->setAbort()) {
+    return false;
+  }
+  cancelled_ = true;
+  return true;
+}
+
+const FlowControlToken* TargetDownload::token() const { return token_.get(); }
+
+}  // namespace api
@@ -0,0 +1,147 @@
+#include "blob_store.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "storage_exception.h"
+#include "utilities/fault_injection.h"
+#include "utilities/utils.h"
+
+static bool writeAll(int fd, const std::string& data) {
+  fault_injection_throttle("storage_write", data.size());
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t res = write(fd, data.data() + written, data.size() - written);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+static constexpr const char* kCompressedSuffix = ".z";
+
+static std::string deflateBlob(const std::string& content) {
+  std::string out(compressBound(static_cast<uLong>(content.size())), '\0');
+  auto out_size = static_cast<uLongf>(out.size());
+  if (compress2(reinterpret_cast<Bytef*>(&out[0]), &out_size, reinterpret_cast<const Bytef*>(content.data()),
+                static_cast<uLong>(content.size()), Z_BEST_COMPRESSION) != Z_OK) {
+    throw StorageException("Could not compress metadata blob");
+  }
+  out.resize(out_size);
+  return out;
+}
+
+static bool inflateBlob(const std::string& data, std::string* content) {
+  z_stream stream{};
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  std::string out;
+  std::array<Bytef, 64 * 1024> buf{};
+  int res = Z_OK;
+  while (res == Z_OK) {
+    stream.next_out = buf.data();
+    stream.avail_out = buf.size();
+    res = inflate(&stream, Z_NO_FLUSH);
+    out.append(reinterpret_cast<const char*>(buf.data()), buf.size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+  if (res != Z_STREAM_END) {
+    return false;
+  }
+  *content = std::move(out);
+  return true;
+}
+
+std::string BlobStore::put(const std::string& content) const {
+  const std::string name = Crypto::sha256digestHex(content) + (compress_ ? kCompressedSuffix : "");
+  const boost::filesystem::path path = dir_ / name;
+  if (boost::filesystem::exists(path)) {
+    return name;
+  }
+  const std::string data = compress_ ? deflateBlob(content) : std::string();
+
+  Utils::createDirectories(dir_, S_IRWXU);
+  const boost::filesystem::path tmp_path = path.string() + ".tmp";
+  const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    throw StorageException("Could not create " + tmp_path.string());
+  }
+  const bool written = writeAll(fd, compress_ ? data : content) && fdatasync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    throw StorageException("Could not write " + path.string());
+  }
+  // Make the rename itself durable before a database row refers to the blob
+  const int dir_fd = ::open(dir_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return name;
+}
+
+bool BlobStore::get(const std::string& name, std::string* content) const {
+  const boost::filesystem::path path = dir_ / name;
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // Not an error yet if a newer row replaced the one naming it, see SQLStorage::readMeta()
+    LOG_DEBUG << "Could not open metadata blob " << path << ": " << std::strerror(errno);
+    return false;
+  }
+  const bool compressed = boost::algorithm::ends_with(name, kCompressedSuffix);
+  std::string data;
+  std::string* target = compressed ? &data : content;
+  struct stat st {};
+  bool ok = fstat(fd, &st) == 0;
+  if (ok && content != nullptr) {
+    target->resize(static_cast<size_t>(st.st_size));
+    size_t done = 0;
+    while (ok && done < target->size()) {
+      const ssize_t res = read(fd, &(*target)[done], target->size() - done);
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = res > 0;
+      done += ok ? static_cast<size_t>(res) : 0;
+    }
+  }
+  close(fd);
+  if (ok && compressed && content != nullptr) {
+    ok = inflateBlob(data, content);
+  }
+  if (!ok) {
+    LOG_ERROR << "Could not read metadata blob " << path;
+  }
+  return ok;
+}
+
+void BlobStore::removeUnused(const std::set<std::string>& used) const {
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+    const std::string name = it->path().filename().string();
+    if (used.count(name) == 0) {
+      boost::system::error_code remove_ec;
+      boost::filesystem::remove(it->path(), remove_ec);
+    }
+  }
+}
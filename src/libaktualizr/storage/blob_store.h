@@ -0,0 +1,40 @@
+#ifndef BLOB_STORE_H_
+#define BLOB_STORE_H_
+
+#include <set>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * Content-addressed files for metadata too large to keep in database rows.
+ *
+ * Every blob is a file named after the SHA-256 of its content. A blob is
+ * written to a temporary file that is synced and then renamed into place, so
+ * a crash never leaves a partial blob under its final name; a blob that is
+ * already there is not written again.
+ *
+ * Blobs written with compression on are zlib streams, and their name ends in
+ * ".z". Blobs of both kinds can be read whatever the setting.
+ */
+class BlobStore {
+ public:
+  explicit BlobStore(boost::filesystem::path dir, bool compress = false) : dir_(std::move(dir)), compress_(compress) {}
+
+  /** Durably stores `content` and returns its name. Throws on failure. */
+  std::string put(const std::string& content) const;
+
+  /** Reads the blob `name`. Returns false if it is missing or unreadable. */
+  bool get(const std::string& name, std::string* content) const;
+
+  /** Removes all files but the blobs named in `used`, e.g. leftovers of rolled back writes. */
+  void removeUnused(const std::set<std::string>& used) const;
+
+  const boost::filesystem::path& dir() const { return dir_; }
+
+ private:
+  const boost::filesystem::path dir_;
+  const bool compress_;
+};
+
+#endif  // BLOB_STORE_H_
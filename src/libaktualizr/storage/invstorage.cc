@@ -107,7 +107,7 @@ void INvStorage::importPrimaryKeys(const boost::filesystem::path& base_path, con
 void INvStorage::importInstalledVersions(const boost::filesystem::path& base_path) {
   std::vector<Uptane::Target> installed_versions;
   const boost::filesystem::path file_path = utils::BasedPath("installed_versions").get(base_path);
-  loadPrimaryInstallationLog(&installed_versions, false);
+  loadInstallationLogPage("", &installed_versions, false, 0, 1);
   if (!installed_versions.empty()) {
     return;
   }
@@ -36,6 +36,19 @@ struct MisconfiguredEcu {
 
 enum class InstalledVersionUpdateMode { kNone, kCurrent, kPending };
 
+// How far the installation of a Target on an ECU got, kept in the install journal
+enum class InstallStage { kNone = 0, kFirmwareSent = 1, kInstalled = 2 };
+
+// Digests of a downloaded Target file, and the file metadata they were computed for.
+struct TargetFileVerification {
+  uint64_t real_size{0};
+  std::string sha256;
+  std::string sha512;
+  int64_t mtime{0};  // nanoseconds
+  int64_t ctime{0};  // nanoseconds
+  uint64_t inode{0};
+};
+
 // Functions loading/storing multiple pieces of data are supposed to do so
 // atomically as far as implementation makes it possible.
 //
@@ -49,6 +62,12 @@ class INvStorage {
   INvStorage& operator=(const INvStorage&) = delete;
   INvStorage& operator=(INvStorage&&) = delete;
   virtual StorageType type() = 0;
+
+  // Run the operations until commitBatch() in one transaction, see StorageBatch
+  virtual void beginBatch() = 0;
+  virtual void commitBatch() = 0;
+  virtual void rollbackBatch() = 0;
+
   virtual void storePrimaryKeys(const std::string& public_key, const std::string& private_key) = 0;
   virtual bool loadPrimaryKeys(std::string* public_key, std::string* private_key) const = 0;
   virtual bool loadPrimaryPublic(std::string* public_key) const = 0;
@@ -85,6 +104,15 @@ class INvStorage {
   virtual bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const = 0;
   virtual void deleteDelegation(Uptane::Role role) = 0;
   virtual void clearDelegations() = 0;
+  // HTTP cache validators of the latest version of a role, and the sha256 of the metadata they refer to
+  virtual void storeMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, const std::string& etag,
+                                   const std::string& last_modified, const std::string& meta_sha256) = 0;
+  virtual bool loadMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, std::string* etag,
+                                  std::string* last_modified, std::string* meta_sha256) const = 0;
+  // The campaign list last received from the server, with its HTTP cache validators
+  virtual void storeCampaigns(const std::string& campaigns, const std::string& etag,
+                              const std::string& last_modified) = 0;
+  virtual bool loadCampaigns(std::string* campaigns, std::string* etag, std::string* last_modified) const = 0;
 
   virtual void storeDeviceId(const std::string& device_id) = 0;
   virtual bool loadDeviceId(std::string* device_id) const = 0;
@@ -120,6 +148,9 @@ class INvStorage {
                                      Uptane::CorrelationId* correlation_id) const = 0;
   virtual bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                                    bool only_installed) const = 0;
+  // Up to `limit` entries of the log, oldest first, skipping the first `offset`. All of them if `limit` is negative.
+  virtual bool loadInstallationLogPage(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                                       bool only_installed, int64_t offset, int64_t limit) const = 0;
   virtual bool hasPendingInstall() = 0;
   virtual void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) = 0;
   virtual void clearInstalledVersions() = 0;
@@ -134,12 +165,21 @@ class INvStorage {
   virtual bool loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
                                             std::string* correlation_id) const = 0;
   virtual void clearInstallationResults() = 0;
+  // The install journal, to resume an interrupted installation where it left off. Only the stage reached with the
+  // same Target is loaded, kNone otherwise.
+  virtual void saveInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target,
+                                InstallStage stage) = 0;
+  virtual InstallStage loadInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target) const = 0;
+  virtual void clearInstallJournal() = 0;
 
   virtual void saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) = 0;
   virtual bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const = 0;
 
-  virtual void saveReportEvent(const Json::Value& json_value) = 0;
-  virtual bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const = 0;
+  // Urgent events are loaded before all others, and are never dropped to stay
+  // within StorageConfig::report_events_max and report_events_max_bytes
+  virtual void saveReportEvent(const Json::Value& json_value, bool urgent = false) = 0;
+  virtual bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit,
+                                int64_t max_bytes = -1) const = 0;
   virtual void deleteReportEvents(int64_t id_max) = 0;
 
   virtual void storeDeviceDataHash(const std::string& data_type, const std::string& hash) = 0;
@@ -151,6 +191,15 @@ class INvStorage {
   virtual std::string getTargetFilename(const std::string& targetname) const = 0;
   virtual std::vector<std::string> getAllTargetNames() const = 0;
   virtual void deleteTargetInfo(const std::string& targetname) const = 0;
+  // Cleared by storeTargetFilename
+  virtual void storeTargetVerification(const std::string& targetname,
+                                       const TargetFileVerification& verification) const = 0;
+  virtual bool loadTargetVerification(const std::string& targetname, TargetFileVerification* verification) const = 0;
+
+  // Housekeeping of the underlying store, while the update loop is idle. Does nothing until it is due.
+  virtual void idleMaintenance() = 0;
+  // Changes whenever the installed versions or the ECUs may have changed, also through other connections
+  virtual uint64_t installedStateGeneration() const = 0;
 
   // Special constructors and utilities
   static std::shared_ptr<INvStorage> newStorage(const StorageConfig& config, bool readonly = false);
@@ -196,4 +245,37 @@ class INvStorage {
   const StorageConfig config_;
 };
 
+/**
+ * A batch of storage operations that are committed together, and therefore
+ * with a single sync to disk. The operations are rolled back unless commit()
+ * is called. While a batch is open, the storage is only available to the
+ * thread that opened it, so keep batches short and never wait on other
+ * threads inside one. Batches cannot be nested.
+ */
+class StorageBatch {
+ public:
+  explicit StorageBatch(INvStorage& storage) : storage_(storage) { storage_.beginBatch(); }
+  ~StorageBatch() {
+    if (!committed_) {
+      try {
+        storage_.rollbackBatch();
+      } catch (...) {
+      }
+    }
+  }
+  StorageBatch(const StorageBatch&) = delete;
+  StorageBatch(StorageBatch&&) = delete;
+  StorageBatch& operator=(const StorageBatch&) = delete;
+  StorageBatch& operator=(StorageBatch&&) = delete;
+
+  void commit() {
+    storage_.commitBatch();
+    committed_ = true;
+  }
+
+ private:
+  INvStorage& storage_;
+  bool committed_{false};
+};
+
 #endif  // INVSTORAGE_H_
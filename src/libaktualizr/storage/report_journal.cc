@@ -0,0 +1,497 @@
+#include "report_journal.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "logging/logging.h"
+#include "storage_exception.h"
+#include "utilities/utils.h"
+
+namespace {
+
+// File header: magic, format version and the number of the first record
+constexpr char kMagic[4] = {'A', 'K', 'R', 'J'};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 16;
+// Record frame: payload size, CRC-32 of the rest, number and size of the event as JSON
+constexpr size_t kFrameSize = 20;
+constexpr size_t kCrcOffset = 8;
+constexpr uint32_t kMaxPayloadSize = 16 * 1024 * 1024;
+constexpr int kMaxDepth = 64;
+
+enum Tag : uint8_t { kNull, kFalse, kTrue, kInt, kUInt, kReal, kString, kArray, kObject };
+
+template <typename T>
+void putRaw(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));  // NOLINT
+}
+
+template <typename T>
+T getRaw(const uint8_t* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+void putVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void putString(std::string* out, const char* begin, const char* end) {
+  putVarint(out, static_cast<uint64_t>(end - begin));
+  out->append(begin, end);
+}
+
+void encode(const Json::Value& value, std::string* out) {
+  switch (value.type()) {
+    case Json::booleanValue:
+      out->push_back(static_cast<char>(value.asBool() ? kTrue : kFalse));
+      break;
+    case Json::intValue: {
+      const int64_t i = value.asInt64();
+      out->push_back(static_cast<char>(kInt));
+      putVarint(out, (static_cast<uint64_t>(i) << 1) ^ static_cast<uint64_t>(i >> 63));
+      break;
+    }
+    case Json::uintValue:
+      out->push_back(static_cast<char>(kUInt));
+      putVarint(out, value.asUInt64());
+      break;
+    case Json::realValue:
+      out->push_back(static_cast<char>(kReal));
+      putRaw(out, value.asDouble());
+      break;
+    case Json::stringValue: {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      value.getString(&begin, &end);
+      out->push_back(static_cast<char>(kString));
+      putString(out, begin, end);
+      break;
+    }
+    case Json::arrayValue:
+      out->push_back(static_cast<char>(kArray));
+      putVarint(out, value.size());
+      for (const auto& item : value) {
+        encode(item, out);
+      }
+      break;
+    case Json::objectValue:
+      out->push_back(static_cast<char>(kObject));
+      putVarint(out, value.size());
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        const char* end = nullptr;
+        const char* begin = it.memberName(&end);
+        putString(out, begin, end);
+        encode(*it, out);
+      }
+      break;
+    case Json::nullValue:
+    default:
+      out->push_back(static_cast<char>(kNull));
+      break;
+  }
+}
+
+class Decoder {
+ public:
+  Decoder(const uint8_t* data, size_t size) : pos_(data), end_(data + size) {}
+
+  bool decode(Json::Value* value, int depth = 0) {
+    if (pos_ == end_ || depth > kMaxDepth) {
+      return false;
+    }
+    uint64_t n = 0;
+    switch (*pos_++) {
+      case kNull:
+        *value = Json::Value();
+        return true;
+      case kFalse:
+      case kTrue:
+        *value = Json::Value(*(pos_ - 1) == kTrue);
+        return true;
+      case kInt:
+        if (!varint(&n)) {
+          return false;
+        }
+        *value = Json::Value(static_cast<Json::Int64>((n >> 1) ^ (~(n & 1) + 1)));
+        return true;
+      case kUInt:
+        if (!varint(&n)) {
+          return false;
+        }
+        *value = Json::Value(static_cast<Json::UInt64>(n));
+        return true;
+      case kReal:
+        if (end_ - pos_ < static_cast<std::ptrdiff_t>(sizeof(double))) {
+          return false;
+        }
+        *value = Json::Value(getRaw<double>(pos_));
+        pos_ += sizeof(double);
+        return true;
+      case kString: {
+        std::string s;
+        if (!string(&s)) {
+          return false;
+        }
+        *value = Json::Value(s);
+        return true;
+      }
+      case kArray:
+        if (!varint(&n)) {
+          return false;
+        }
+        *value = Json::Value(Json::arrayValue);
+        for (uint64_t i = 0; i < n; ++i) {
+          if (!decode(&value->append(Json::Value()), depth + 1)) {
+            return false;
+          }
+        }
+        return true;
+      case kObject:
+        if (!varint(&n)) {
+          return false;
+        }
+        *value = Json::Value(Json::objectValue);
+        for (uint64_t i = 0; i < n; ++i) {
+          std::string key;
+          if (!string(&key) || !decode(&(*value)[key], depth + 1)) {
+            return false;
+          }
+        }
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool atEnd() const { return pos_ == end_; }
+
+ private:
+  bool varint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && pos_ != end_; shift += 7) {
+      const uint8_t byte = *pos_++;
+      *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool string(std::string* s) {
+    uint64_t size = 0;
+    if (!varint(&size) || size > static_cast<uint64_t>(end_ - pos_)) {
+      return false;
+    }
+    s->assign(reinterpret_cast<const char*>(pos_), size);  // NOLINT(cppcoreguidelines-pro-type-reinterpret-cast)
+    pos_ += size;
+    return true;
+  }
+
+  const uint8_t* pos_;
+  const uint8_t* end_;
+};
+
+uint32_t frameCrc(const uint8_t* frame, size_t payload_size) {
+  return static_cast<uint32_t>(
+      crc32(0L, frame + kCrcOffset, static_cast<uInt>(kFrameSize - kCrcOffset + payload_size)));
+}
+
+std::string header(int64_t first_seq) {
+  std::string out(kMagic, sizeof(kMagic));
+  putRaw(&out, kVersion);
+  putRaw(&out, first_seq);
+  return out;
+}
+
+bool writeAll(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t res = write(fd, data.data() + written, data.size() - written);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return false;
+    }
+    written += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+/** Read-only mapping of a whole file */
+class MappedFile {
+ public:
+  MappedFile(int fd, size_t size) : size_(size) {
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(data);
+      }
+    }
+  }
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(const_cast<uint8_t*>(data_), size_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    }
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile(MappedFile&&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&&) = delete;
+
+  const uint8_t* data() const { return data_; }
+
+ private:
+  const uint8_t* data_{nullptr};
+  size_t size_;
+};
+
+}  // namespace
+
+ReportJournal::ReportJournal(boost::filesystem::path path) : path_(std::move(path)) { open(); }
+
+ReportJournal::~ReportJournal() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void ReportJournal::open() {
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd_ < 0) {
+    throw StorageException("Could not open report journal " + path_.string() + ": " + std::strerror(errno));
+  }
+  // The destructor does not run when the constructor throws
+  try {
+    load();
+  } catch (...) {
+    close(fd_);
+    fd_ = -1;
+    throw;
+  }
+}
+
+void ReportJournal::load() {
+  struct stat st {};
+  if (fstat(fd_, &st) != 0) {
+    throw StorageException("Could not stat report journal " + path_.string() + ": " + std::strerror(errno));
+  }
+  file_size_ = static_cast<uint64_t>(st.st_size);
+  records_.clear();
+  json_bytes_ = 0;
+  next_seq_ = 1;
+
+  if (file_size_ < kHeaderSize) {
+    // New, or torn while being created
+    std::string empty = header(next_seq_);
+    if (ftruncate(fd_, 0) != 0 || !writeAll(fd_, empty) || fdatasync(fd_) != 0) {
+      throw StorageException("Could not initialize report journal " + path_.string());
+    }
+    file_size_ = empty.size();
+    return;
+  }
+
+  const MappedFile map(fd_, file_size_);
+  if (map.data() == nullptr) {
+    throw StorageException("Could not map report journal " + path_.string() + ": " + std::strerror(errno));
+  }
+  if (memcmp(map.data(), kMagic, sizeof(kMagic)) != 0 || getRaw<uint32_t>(map.data() + 4) != kVersion) {
+    throw StorageException("Report journal " + path_.string() + " has an unknown format");
+  }
+  next_seq_ = getRaw<int64_t>(map.data() + 8);
+  scan(map.data(), file_size_);
+}
+
+void ReportJournal::scan(const uint8_t* data, size_t size) {
+  uint64_t offset = kHeaderSize;
+  while (offset + kFrameSize <= size) {
+    const uint8_t* frame = data + offset;
+    const auto payload_size = getRaw<uint32_t>(frame);
+    if (payload_size > kMaxPayloadSize || offset + kFrameSize + payload_size > size ||
+        getRaw<uint32_t>(frame + 4) != frameCrc(frame, payload_size)) {
+      break;
+    }
+    const auto seq = getRaw<int64_t>(frame + 8);
+    records_.push_back(Record{seq, offset, payload_size, getRaw<uint32_t>(frame + 16)});
+    json_bytes_ += records_.back().json_size;
+    next_seq_ = std::max(next_seq_, seq + 1);
+    offset += kFrameSize + payload_size;
+  }
+
+  if (offset != size) {
+    LOG_WARNING << "Dropping " << (size - offset) << " bytes of a torn record at the end of report journal " << path_;
+    if (ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+      throw StorageException("Could not truncate report journal " + path_.string() + ": " + std::strerror(errno));
+    }
+    file_size_ = offset;
+  }
+}
+
+bool ReportJournal::append(const Json::Value& event) {
+  std::string frame(kFrameSize, '\0');
+  encode(event, &frame);
+  const auto payload_size = static_cast<uint32_t>(frame.size() - kFrameSize);
+  if (payload_size > kMaxPayloadSize) {
+    LOG_ERROR << "Report event of " << payload_size << " bytes is too large for the journal";
+    return false;
+  }
+  const auto json_size = static_cast<uint32_t>(Utils::jsonToCanonicalStr(event).size());
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (fd_ < 0) {
+    return false;
+  }
+  const int64_t seq = next_seq_;
+  memcpy(&frame[0], &payload_size, sizeof(payload_size));
+  memcpy(&frame[8], &seq, sizeof(seq));
+  memcpy(&frame[16], &json_size, sizeof(json_size));
+  const uint32_t crc = frameCrc(reinterpret_cast<const uint8_t*>(frame.data()),  // NOLINT
+                                payload_size);
+  memcpy(&frame[4], &crc, sizeof(crc));
+
+  if (lseek(fd_, static_cast<off_t>(file_size_), SEEK_SET) < 0 || !writeAll(fd_, frame) || fdatasync(fd_) != 0) {
+    LOG_ERROR << "Failed to append to report journal " << path_ << ": " << std::strerror(errno);
+    // Don't leave a partial record for the next one to be appended after
+    if (ftruncate(fd_, static_cast<off_t>(file_size_)) != 0) {
+      LOG_ERROR << "Failed to truncate report journal " << path_ << ": " << std::strerror(errno);
+    }
+    return false;
+  }
+  records_.push_back(Record{seq, file_size_, payload_size, json_size});
+  json_bytes_ += json_size;
+  file_size_ += frame.size();
+  ++next_seq_;
+  return true;
+}
+
+bool ReportJournal::load(Json::Value* report_array, int64_t* seq_max, int limit, int64_t max_bytes) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (records_.empty() || limit == 0) {
+    return false;
+  }
+  const MappedFile map(fd_, file_size_);
+  if (map.data() == nullptr) {
+    LOG_ERROR << "Failed to map report journal " << path_ << ": " << std::strerror(errno);
+    return false;
+  }
+
+  *seq_max = 0;
+  int64_t bytes = 0;
+  int count = 0;
+  for (const auto& record : records_) {
+    if (limit >= 0 && count >= limit) {
+      break;
+    }
+    bytes += record.json_size;
+    if (max_bytes >= 0 && bytes > max_bytes && count > 0) {
+      // Always return at least one event, even if it is over the limit
+      break;
+    }
+    ++count;
+    *seq_max = record.seq;
+    Decoder decoder(map.data() + record.offset + kFrameSize, record.payload_size);
+    Json::Value event;
+    if (decoder.decode(&event) && decoder.atEnd()) {
+      report_array->append(event);
+    } else {
+      LOG_ERROR << "Unable to decode report event " << record.seq << " of the journal";
+    }
+  }
+  return true;
+}
+
+void ReportJournal::acknowledge(int64_t seq_max) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto first = std::find_if(records_.cbegin(), records_.cend(),
+                                  [seq_max](const Record& record) { return record.seq > seq_max; });
+  if (first == records_.cbegin()) {
+    return;
+  }
+  if (!rewrite(first)) {
+    LOG_ERROR << "Failed to remove sent events from report journal " << path_;
+  }
+}
+
+size_t ReportJournal::trim(size_t max_records, uint64_t max_bytes) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if ((max_records == 0 || records_.size() <= max_records) && (max_bytes == 0 || json_bytes_ <= max_bytes)) {
+    return 0;
+  }
+  const size_t keep_records = max_records != 0 ? max_records * 3 / 4 : records_.size();
+  const uint64_t keep_bytes = max_bytes != 0 ? max_bytes * 3 / 4 : json_bytes_;
+  auto first = records_.cbegin();
+  uint64_t bytes = json_bytes_;
+  while (first != records_.cend() &&
+         (static_cast<size_t>(records_.cend() - first) > keep_records || bytes > keep_bytes)) {
+    bytes -= first->json_size;
+    ++first;
+  }
+  const auto removed = static_cast<size_t>(first - records_.cbegin());
+  if (!rewrite(first)) {
+    LOG_ERROR << "Failed to remove the oldest events from report journal " << path_;
+    return 0;
+  }
+  return removed;
+}
+
+bool ReportJournal::rewrite(std::vector<Record>::const_iterator first) {
+  const boost::filesystem::path tmp_path = path_.string() + ".tmp";
+  std::string content = header(next_seq_);
+  {
+    const MappedFile map(fd_, file_size_);
+    if (first != records_.cend()) {
+      if (map.data() == nullptr) {
+        return false;
+      }
+      content.append(reinterpret_cast<const char*>(map.data() + first->offset),  // NOLINT
+                     file_size_ - first->offset);
+    }
+  }
+
+  const int tmp_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (tmp_fd < 0) {
+    return false;
+  }
+  const bool written = writeAll(tmp_fd, content) && fdatasync(tmp_fd) == 0;
+  close(tmp_fd);
+  if (!written || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  // Make the rename itself durable
+  const int dir_fd = ::open(path_.parent_path().empty() ? "." : path_.parent_path().c_str(), O_RDONLY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  close(fd_);
+  fd_ = -1;
+  try {
+    open();
+  } catch (const StorageException& e) {
+    LOG_ERROR << e.what();
+    return false;
+  }
+  return true;
+}
+
+size_t ReportJournal::size() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return records_.size();
+}
@@ -0,0 +1,84 @@
+#ifndef REPORT_JOURNAL_H_
+#define REPORT_JOURNAL_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+/**
+ * Append-only file of report events waiting to be sent to the server.
+ *
+ * Every event is a single record of a compact binary encoding of its JSON,
+ * framed by its length and CRC-32. A record is written with one write() and
+ * synced, so a crash can at most leave a torn last record, which is dropped
+ * when the file is opened again. Acknowledged events are removed by writing
+ * the remaining records to a new file that is then renamed over the journal,
+ * so that the journal is never seen half rewritten.
+ *
+ * Records are numbered in the order they were appended; the numbering goes
+ * on across rewrites.
+ */
+class ReportJournal {
+ public:
+  /** Opens the journal at `path`, creating it if needed. Throws on failure. */
+  explicit ReportJournal(boost::filesystem::path path);
+  ~ReportJournal();
+  ReportJournal(const ReportJournal&) = delete;
+  ReportJournal(ReportJournal&&) = delete;
+  ReportJournal& operator=(const ReportJournal&) = delete;
+  ReportJournal& operator=(ReportJournal&&) = delete;
+
+  /** Durably appends an event. Returns false if it could not be written. */
+  bool append(const Json::Value& event);
+
+  /**
+   * Appends the oldest events to `report_array`, at most `limit` of them
+   * (none if negative) and at most `max_bytes` of serialized JSON (none if
+   * negative), but always at least one. `seq_max` is set to the number of the
+   * last one. Returns false if the journal is empty.
+   */
+  bool load(Json::Value* report_array, int64_t* seq_max, int limit, int64_t max_bytes = -1) const;
+
+  /** Removes all events numbered up to `seq_max`. */
+  void acknowledge(int64_t seq_max);
+
+  /**
+   * Once there are more than `max_records` events or `max_bytes` of serialized
+   * JSON (0 for no limit), removes the oldest ones until three quarters of the
+   * limits are left, so that the journal is not rewritten for every event
+   * appended. Returns the number of events removed.
+   */
+  size_t trim(size_t max_records, uint64_t max_bytes);
+
+  size_t size() const;
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  struct Record {
+    int64_t seq;
+    uint64_t offset;  // of the frame in the file
+    uint32_t payload_size;
+    uint32_t json_size;
+  };
+
+  void open();
+  void load();
+  void scan(const uint8_t* data, size_t size);
+  bool rewrite(std::vector<Record>::const_iterator first);
+
+  const boost::filesystem::path path_;
+  mutable std::mutex mutex_;
+  int fd_{-1};
+  uint64_t file_size_{0};
+  int64_t next_seq_{1};
+  std::vector<Record> records_;
+  // Sum of the json_size of records_
+  uint64_t json_bytes_{0};
+};
+
+#endif  // REPORT_JOURNAL_H_
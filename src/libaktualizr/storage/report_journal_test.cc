@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "storage/report_journal.h"
+#include "storage/sqlstorage.h"
+#include "utilities/utils.h"
+
+static Json::Value makeEvent(int i) {
+  Json::Value event;
+  event["id"] = "event-" + std::to_string(i);
+  event["deviceTime"] = "2026-01-01T00:00:00Z";
+  event["eventType"]["id"] = "EcuDownloadStarted";
+  event["eventType"]["version"] = 1;
+  event["event"]["correlationId"] = "urn:here-ota:campaign:test";
+  event["event"]["negative"] = -i;
+  event["event"]["ratio"] = 0.5;
+  event["event"]["success"] = (i % 2) == 0;
+  event["event"]["list"] = Json::Value(Json::arrayValue);
+  event["event"]["list"].append(Json::Value());
+  event["event"]["list"].append(Json::UInt64(i) << 40);
+  return event;
+}
+
+/* Events are read back as they were appended, in order. */
+TEST(ReportJournal, AppendAndLoad) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "journal";
+  {
+    ReportJournal journal(path);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_TRUE(journal.append(makeEvent(i)));
+    }
+  }
+
+  ReportJournal journal(path);
+  EXPECT_EQ(journal.size(), 5);
+  Json::Value events{Json::arrayValue};
+  int64_t seq_max = 0;
+  ASSERT_TRUE(journal.load(&events, &seq_max, -1));
+  ASSERT_EQ(events.size(), 5);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(events[i], makeEvent(i));
+  }
+  EXPECT_EQ(seq_max, 5);
+}
+
+/* Events are loaded up to a number and a byte budget, but never less than one. */
+TEST(ReportJournal, LoadLimits) {
+  TemporaryDirectory temp_dir;
+  ReportJournal journal(temp_dir / "journal");
+  const auto event_size = static_cast<int64_t>(Utils::jsonToCanonicalStr(makeEvent(0)).size());
+  for (int i = 0; i < 10; ++i) {
+    journal.append(makeEvent(0));
+  }
+
+  int64_t seq_max = 0;
+  {
+    Json::Value events{Json::arrayValue};
+    journal.load(&events, &seq_max, 4);
+    EXPECT_EQ(events.size(), 4);
+    EXPECT_EQ(seq_max, 4);
+  }
+  {
+    Json::Value events{Json::arrayValue};
+    journal.load(&events, &seq_max, -1, 3 * event_size);
+    EXPECT_EQ(events.size(), 3);
+  }
+  {
+    Json::Value events{Json::arrayValue};
+    journal.load(&events, &seq_max, -1, 1);
+    EXPECT_EQ(events.size(), 1);
+  }
+}
+
+/* Acknowledged events are removed, and the numbering goes on after them. */
+TEST(ReportJournal, Acknowledge) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "journal";
+  {
+    ReportJournal journal(path);
+    for (int i = 0; i < 3; ++i) {
+      journal.append(makeEvent(i));
+    }
+    journal.acknowledge(2);
+    EXPECT_EQ(journal.size(), 1);
+    journal.acknowledge(3);
+    EXPECT_EQ(journal.size(), 0);
+    Json::Value events{Json::arrayValue};
+    int64_t seq_max = 0;
+    EXPECT_FALSE(journal.load(&events, &seq_max, -1));
+    journal.append(makeEvent(3));
+  }
+  EXPECT_FALSE(boost::filesystem::exists(path.string() + ".tmp"));
+
+  ReportJournal journal(path);
+  Json::Value events{Json::arrayValue};
+  int64_t seq_max = 0;
+  ASSERT_TRUE(journal.load(&events, &seq_max, -1));
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0], makeEvent(3));
+  EXPECT_EQ(seq_max, 4);
+}
+
+/* A torn or corrupted last record is dropped, and appending goes on after the good ones. */
+TEST(ReportJournal, TornRecord) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "journal";
+  {
+    ReportJournal journal(path);
+    journal.append(makeEvent(0));
+    journal.append(makeEvent(1));
+  }
+  const auto full_size = boost::filesystem::file_size(path);
+  boost::filesystem::resize_file(path, full_size - 3);
+  {
+    ReportJournal journal(path);
+    EXPECT_EQ(journal.size(), 1);
+    journal.append(makeEvent(2));
+  }
+  {
+    // Flip the last byte
+    std::fstream f(path.string(), std::ios::in | std::ios::out | std::ios::binary);
+    f.seekg(-1, std::ios::end);
+    const char c = static_cast<char>(f.get() ^ 0xFF);
+    f.seekp(-1, std::ios::end);
+    f.put(c);
+  }
+
+  ReportJournal journal(path);
+  Json::Value events{Json::arrayValue};
+  int64_t seq_max = 0;
+  ASSERT_TRUE(journal.load(&events, &seq_max, -1));
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0], makeEvent(0));
+}
+
+/* A journal of an unknown format can't be opened, and doesn't leave its file open. */
+TEST(ReportJournal, UnknownFormat) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "journal";
+  Utils::writeFile(path, std::string(64, 'x'));
+  const auto open_fds = [] {
+    return std::distance(boost::filesystem::directory_iterator("/proc/self/fd"),
+                         boost::filesystem::directory_iterator());
+  };
+  const auto fds = open_fds();
+  EXPECT_THROW(ReportJournal journal(path), StorageException);
+  EXPECT_EQ(open_fds(), fds);
+}
+
+/* Beyond a limit, the oldest events are removed until three quarters of it are left. */
+TEST(ReportJournal, Trim) {
+  TemporaryDirectory temp_dir;
+  ReportJournal journal(temp_dir / "journal");
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(journal.append(makeEvent(i)));
+  }
+  EXPECT_EQ(journal.trim(8, 0), 0);
+  EXPECT_TRUE(journal.append(makeEvent(8)));
+  EXPECT_EQ(journal.trim(8, 0), 3);
+  EXPECT_EQ(journal.size(), 6);
+
+  Json::Value events{Json::arrayValue};
+  int64_t seq_max = 0;
+  ASSERT_TRUE(journal.load(&events, &seq_max, 1));
+  EXPECT_EQ(events[0], makeEvent(3));
+
+  // The largest of the events left
+  const auto event_size = static_cast<uint64_t>(Utils::jsonToCanonicalStr(makeEvent(7)).size());
+  EXPECT_EQ(journal.trim(0, 4 * event_size), 3);
+  EXPECT_EQ(journal.size(), 3);
+  EXPECT_EQ(ReportJournal(temp_dir / "journal").size(), 3);
+}
+
+/* Urgent events are loaded before the others, and are not dropped to stay within the limits. */
+TEST(ReportJournal, UrgentEvents) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.report_events_max = 4;
+  SQLStorage storage(config, false);
+  for (int i = 0; i < 6; ++i) {
+    storage.saveReportEvent(makeEvent(i), i == 2 || i == 5);
+  }
+
+  Json::Value events{Json::arrayValue};
+  int64_t max_id = 0;
+  ASSERT_TRUE(storage.loadReportEvents(&events, &max_id, -1));
+  ASSERT_EQ(events.size(), 2);
+  EXPECT_EQ(events[0], makeEvent(2));
+  EXPECT_EQ(events[1], makeEvent(5));
+  storage.deleteReportEvents(max_id);
+
+  events = Json::Value(Json::arrayValue);
+  ASSERT_TRUE(storage.loadReportEvents(&events, &max_id, -1));
+  ASSERT_EQ(events.size(), 4);
+  EXPECT_EQ(events[0], makeEvent(0));
+  EXPECT_EQ(events[3], makeEvent(4));
+  storage.deleteReportEvents(max_id);
+
+  for (int i = 0; i < 5; ++i) {
+    storage.saveReportEvent(makeEvent(i));
+  }
+  events = Json::Value(Json::arrayValue);
+  ASSERT_TRUE(storage.loadReportEvents(&events, &max_id, -1));
+  ASSERT_EQ(events.size(), 3);
+  EXPECT_EQ(events[0], makeEvent(2));
+}
+
+/* Events in the database are moved to the journal when storage is opened. */
+TEST(ReportJournal, MigrateFromDatabase) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  {
+    StorageConfig db_config = config;
+    db_config.report_journal_path = boost::filesystem::path();
+    SQLStorage storage(db_config, false);
+    for (int i = 0; i < 3; ++i) {
+      storage.saveReportEvent(makeEvent(i));
+    }
+  }
+
+  SQLStorage storage(config, false);
+  EXPECT_EQ(ReportJournal(config.report_journal_path.get(config.path)).size(), 3);
+  storage.saveReportEvent(makeEvent(3));
+  Json::Value events{Json::arrayValue};
+  int64_t max_id = 0;
+  ASSERT_TRUE(storage.loadReportEvents(&events, &max_id, -1));
+  ASSERT_EQ(events.size(), 4);
+  for (int i = 0; i < 4; ++i) {
+    // The events from the database went through JSON, which doesn't keep the integer types
+    EXPECT_EQ(Utils::jsonToCanonicalStr(events[i]), Utils::jsonToCanonicalStr(makeEvent(i)));
+  }
+  storage.deleteReportEvents(max_id);
+  events = Json::Value(Json::arrayValue);
+  EXPECT_FALSE(storage.loadReportEvents(&events, &max_id, -1));
+}
+
+/* Events are stored in the database if the journal can't be opened. */
+TEST(ReportJournal, DatabaseFallback) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.report_journal_path = temp_dir / "missing" / "journal";
+  SQLStorage storage(config, false);
+  storage.saveReportEvent(makeEvent(0));
+
+  Json::Value events{Json::arrayValue};
+  int64_t max_id = 0;
+  ASSERT_TRUE(storage.loadReportEvents(&events, &max_id, -1));
+  ASSERT_EQ(events.size(), 1);
+  storage.deleteReportEvents(max_id);
+  events = Json::Value(Json::arrayValue);
+  EXPECT_FALSE(storage.loadReportEvents(&events, &max_id, -1));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  return RUN_ALL_TESTS();
+}
+#endif
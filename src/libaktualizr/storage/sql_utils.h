@@ -1,11 +1,13 @@
 #ifndef SQL_UTILS_H_
 #define SQL_UTILS_H_
 
+#include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/optional.hpp>
@@ -13,9 +15,13 @@
 #include <sqlite3.h>
 
 #include "logging/logging.h"
+#include "logging/metrics.h"
+#include "logging/tracing.h"
+#include "utilities/fault_injection.h"
 
 // Unique ownership SQLite3 statement creation
 
+// Bound without a copy: the string must outlive the statement
 struct SQLBlob {
   const std::string& content;
   explicit SQLBlob(const std::string& str) : content(str) {}
@@ -33,6 +39,8 @@ class SQLInternalException : public SQLException {
 
 class SQLiteStatement {
  public:
+  using Deleter = std::function<void(sqlite3_stmt*)>;
+
   template <typename... Types>
   SQLiteStatement(sqlite3* db, const std::string& zSql, const Types&... args)
       : db_(db), stmt_(nullptr, sqlite3_finalize), bind_cnt_(1) {
@@ -47,6 +55,13 @@ class SQLiteStatement {
     bindArguments(args...);
   }
 
+  // Use an already prepared statement, which is handed back to `release` when done
+  template <typename... Types>
+  SQLiteStatement(sqlite3* db, sqlite3_stmt* statement, Deleter release, const Types&... args)
+      : db_(db), stmt_(statement, std::move(release)), bind_cnt_(1) {
+    bindArguments(args...);
+  }
+
   inline sqlite3_stmt* get() const { return stmt_.get(); }
   inline int step() const { return sqlite3_step(stmt_.get()); }
 
@@ -98,8 +113,7 @@ class SQLiteStatement {
   void bindArgument(const char* v) { bindArgument(std::string(v)); }
 
   void bindArgument(const SQLBlob& blob) {
-    owned_data_.emplace_back(blob.content);
-    const std::string& oe = owned_data_.back();
+    const std::string& oe = blob.content;
 
     if (sqlite3_bind_blob(stmt_.get(), bind_cnt_, oe.c_str(), static_cast<int>(oe.size()), SQLITE_STATIC) !=
         SQLITE_OK) {
@@ -119,25 +133,17 @@ class SQLiteStatement {
   }
 
   sqlite3* db_;
-  std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> stmt_;
+  std::unique_ptr<sqlite3_stmt, Deleter> stmt_;
   int bind_cnt_;
   // copies of data that need to persist for the object duration
   // (avoid vector because of resizing issues)
   std::list<std::string> owned_data_;
 };
 
-// Unique ownership SQLite3 connection
-const extern std::mutex sql_mutex;
-class SQLite3Guard {
+// SQLite3 connection, with a cache of the statements prepared on it
+class SQLiteConnection {
  public:
-  sqlite3* get() { return handle_.get(); }
-  int get_rc() const { return rc_; }
-
-  explicit SQLite3Guard(const char* path, bool readonly, std::shared_ptr<std::mutex> mutex = nullptr)
-      : handle_(nullptr, sqlite3_close), rc_(0), m_(std::move(mutex)) {
-    if (m_) {
-      m_->lock();
-    }
+  SQLiteConnection(const char* path, bool readonly) : handle_(nullptr, sqlite3_close), rc_(0) {
     if (sqlite3_threadsafe() == 0) {
       throw SQLInternalException("sqlite3 has been compiled without multitheading support");
     }
@@ -153,12 +159,112 @@ class SQLite3Guard {
 
     handle_.reset(h);
   }
+  ~SQLiteConnection() {
+    // statements must be finalized before the connection is closed
+    statements_.clear();
+  }
+  SQLiteConnection(const SQLiteConnection&) = delete;
+  SQLiteConnection(SQLiteConnection&&) = delete;
+  SQLiteConnection& operator=(const SQLiteConnection&) = delete;
+  SQLiteConnection& operator=(SQLiteConnection&&) = delete;
+
+  sqlite3* get() { return handle_.get(); }
+  int get_rc() const { return rc_; }
+
+  // Whether the last call on the connection failed in a way that a new
+  // connection may recover from, e.g. an I/O error
+  bool failed() const {
+    switch (sqlite3_errcode(handle_.get()) & 0xff) {
+      case SQLITE_IOERR:
+      case SQLITE_CORRUPT:
+      case SQLITE_NOTADB:
+      case SQLITE_CANTOPEN:
+      case SQLITE_PROTOCOL:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Prepare a statement, or reuse the one prepared earlier for the same SQL.
+  // A statement that is still in use, e.g. by an outer loop, is prepared
+  // anew.
+  template <typename... Types>
+  SQLiteStatement prepareStatement(const std::string& zSql, const Types&... args) {
+    auto& cached = statements_[zSql];
+    if (cached.in_use) {
+      return SQLiteStatement(handle_.get(), zSql, args...);
+    }
+    if (cached.statement == nullptr) {
+      sqlite3_stmt* statement;
+      if (sqlite3_prepare_v2(handle_.get(), zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
+        LOG_ERROR << "Could not prepare statement: " << sqlite3_errmsg(handle_.get());
+        throw SQLInternalException(std::string("Could not prepare statement: ") + sqlite3_errmsg(handle_.get()));
+      }
+      cached.statement.reset(statement);
+    }
+    cached.in_use = true;
+    CachedStatement* entry = &cached;
+    return SQLiteStatement(
+        handle_.get(), cached.statement.get(),
+        [entry](sqlite3_stmt* statement) {
+          sqlite3_reset(statement);
+          sqlite3_clear_bindings(statement);
+          entry->in_use = false;
+        },
+        args...);
+  }
+
+ private:
+  struct CachedStatement {
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> statement{nullptr, sqlite3_finalize};
+    bool in_use{false};
+  };
+
+  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle_;
+  int rc_;
+  // node-based, so that entries stay in place while their statement is in use
+  std::unordered_map<std::string, CachedStatement> statements_;
+};
+
+// Exclusive use of an SQLite3 connection: either a connection of its own, or
+// a shared one that is locked for the lifetime of the guard
+class SQLite3Guard {
+ public:
+  sqlite3* get() { return connection_->get(); }
+  int get_rc() const { return connection_->get_rc(); }
+
+  explicit SQLite3Guard(const char* path, bool readonly = false)
+      : connection_(std::make_shared<SQLiteConnection>(path, readonly)) {}
 
-  explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false,
-                        std::shared_ptr<std::mutex> mutex = nullptr)
-      : SQLite3Guard(path.c_str(), readonly, std::move(mutex)) {}
-  SQLite3Guard(SQLite3Guard&& guard) noexcept : handle_(std::move(guard.handle_)), rc_(guard.rc_) {}
+  explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false)
+      : SQLite3Guard(path.c_str(), readonly) {}
+
+  SQLite3Guard(std::shared_ptr<SQLiteConnection> connection, std::shared_ptr<std::recursive_mutex> mutex)
+      : m_(std::move(mutex)) {
+    if (m_) {
+      m_->lock();
+    }
+    connection_ = std::move(connection);
+  }
+  SQLite3Guard(SQLite3Guard&& guard) noexcept
+      : connection_(std::move(guard.connection_)),
+        m_(std::move(guard.m_)),
+        transaction_(guard.transaction_),
+        span_(std::move(guard.span_)),
+        latency_(std::move(guard.latency_)) {
+    guard.transaction_ = Transaction::kNone;
+  }
   ~SQLite3Guard() {
+    if (transaction_ != Transaction::kNone) {
+      // the connection may outlive the guard, so roll back explicitly
+      try {
+        rollbackTransaction();
+      } catch (...) {
+      }
+    }
+    // release the connection before unlocking it
+    connection_.reset();
     if (m_) {
       m_->unlock();
     }
@@ -168,7 +274,7 @@ class SQLite3Guard {
   SQLite3Guard& operator=(SQLite3Guard&&) = delete;
 
   int exec(const char* sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
-    return sqlite3_exec(handle_.get(), sql, callback, cb_arg, nullptr);
+    return sqlite3_exec(connection_->get(), sql, callback, cb_arg, nullptr);
   }
 
   int exec(const std::string& sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
@@ -177,46 +283,72 @@ class SQLite3Guard {
 
   template <typename... Types>
   SQLiteStatement prepareStatement(const std::string& zSql, const Types&... args) {
-    return SQLiteStatement(handle_.get(), zSql, args...);
+    // The first statement tells which storage call the span belongs to
+    if (!span_.annotated()) {
+      span_.annotate(zSql);
+    }
+    return connection_->prepareStatement(zSql, args...);
   }
 
-  std::string errmsg() const { return sqlite3_errmsg(handle_.get()); }
+  std::string errmsg() const { return sqlite3_errmsg(connection_->get()); }
+  // Whether the storage lock is held, i.e. this is not a reader of its own
+  bool locked() const { return m_ != nullptr; }
 
   // Transaction handling
   //
   // A transactional series of db operations should be realized between calls of
   // `beginTranscation()` and `commitTransaction()`. If no commit is done before
-  // the destruction of the `SQLite3Guard` (and thus the SQLite connection) or
-  // if `rollbackTransaction()` is called explicitely, the changes will be
-  // rolled back
+  // the destruction of the `SQLite3Guard` or if `rollbackTransaction()` is
+  // called explicitely, the changes will be rolled back.
+  //
+  // A transaction begun while the connection is already in one, e.g. in a
+  // batch of storage operations, is nested in it as a savepoint.
 
   void beginTransaction() {
-    // Note: transaction cannot be nested and this will fail if another
-    // transaction was open on the same connection
-    if (exec("BEGIN TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    // Note: transaction cannot be nested within the same guard
+    const bool nested = sqlite3_get_autocommit(connection_->get()) == 0;
+    if (exec(nested ? "SAVEPOINT guard;" : "BEGIN TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't begin transaction: " << errmsg();
       throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
     }
+    transaction_ = nested ? Transaction::kSavepoint : Transaction::kTransaction;
   }
 
   void commitTransaction() {
-    if (exec("COMMIT TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    const char* sql = transaction_ == Transaction::kSavepoint ? "RELEASE SAVEPOINT guard;" : "COMMIT TRANSACTION;";
+    fault_injection_throttle("storage_write", 0);
+    if (exec(sql, nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't commit transaction: " << errmsg();
       throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
     }
+    transaction_ = Transaction::kNone;
   }
 
   void rollbackTransaction() {
-    if (exec("ROLLBACK TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    const char* sql = transaction_ == Transaction::kSavepoint ? "ROLLBACK TO SAVEPOINT guard; RELEASE SAVEPOINT guard;"
+                                                              : "ROLLBACK TRANSACTION;";
+    transaction_ = Transaction::kNone;
+    if (exec(sql, nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't rollback transaction: " << errmsg();
       throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
     }
   }
 
  private:
-  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle_;
-  int rc_;
-  std::shared_ptr<std::mutex> m_ = nullptr;
+  enum class Transaction { kNone, kTransaction, kSavepoint };
+
+  std::shared_ptr<SQLiteConnection> connection_;
+  std::shared_ptr<std::recursive_mutex> m_ = nullptr;
+  Transaction transaction_{Transaction::kNone};
+  // Covers the wait for the connection and everything done while holding it
+  TraceSpan span_{"storage", "call"};
+  ScopedLatency latency_{storageLatency()};
+
+  static MetricHistogram& storageLatency() {
+    static auto& latency = Metrics::instance().histogram("aktualizr_storage_call_duration_seconds",
+                                                         "Duration of storage calls, with the wait for the lock");
+    return latency;
+  }
 };
 
 #endif  // SQL_UTILS_H_
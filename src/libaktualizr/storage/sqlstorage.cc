@@ -1,19 +1,26 @@
 #include "sqlstorage.h"
 
 #include <sys/stat.h>
+#include <ctime>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 
+#include <boost/filesystem.hpp>
+
 #include "logging/logging.h"
 #include "sql_utils.h"
+#include "utilities/resource_policy.h"
+#include "utilities/timer.h"
 #include "utilities/utils.h"
 
 // Find metadata with version set to -1 (e.g. after migration) and assign proper version to it.
 void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   db.beginTransaction();
 
@@ -61,14 +68,315 @@ void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Rol
 SQLStorage::SQLStorage(const StorageConfig& config, bool readonly)
     : SQLStorageBase(config.sqldb_path.get(config.path), readonly, libaktualizr_schema_migrations,
                      libaktualizr_schema_rollback_migrations, libaktualizr_current_schema,
-                     libaktualizr_current_schema_version),
-      INvStorage(config) {
+                     libaktualizr_current_schema_version, config.sqldb_journal_mode, config.sqldb_synchronous),
+      INvStorage(config),
+      cache_enabled_(config.sqldb_cache),
+      report_events_max_(config.report_events_max),
+      report_events_max_bytes_(config.report_events_max_bytes),
+      blobs_(config.sqldb_blob_path.get(config.path), config.sqldb_blob_compress),
+      blob_threshold_(config.sqldb_blob_threshold) {
   try {
     cleanMetaVersion(Uptane::RepositoryType::Director(), Uptane::Role::Root());
     cleanMetaVersion(Uptane::RepositoryType::Image(), Uptane::Role::Root());
   } catch (...) {
     LOG_ERROR << "SQLite database metadata version migration failed";
   }
+
+  if (!readonly && !config.report_journal_path.empty()) {
+    try {
+      report_journal_ = std::make_unique<ReportJournal>(config.report_journal_path.get(config.path));
+      migrateReportEvents();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Report events will be stored in the database: " << e.what();
+      report_journal_.reset();
+    }
+  }
+  if (report_journal_) {
+    try {
+      urgent_report_journal_ =
+          std::make_unique<ReportJournal>(config.report_journal_path.get(config.path).string() + ".urgent");
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Urgent report events will be stored with the others: " << e.what();
+    }
+  }
+
+  if (!readonly) {
+    // Moving the metadata of an old database can take a while, and is not needed to use it
+    meta_mover_ = std::thread([this]() {
+      try {
+        moveMetaToBlobs();
+      } catch (const std::exception& e) {
+        LOG_ERROR << "Could not move large metadata out of the database: " << e.what();
+      }
+    });
+  }
+}
+
+SQLStorage::~SQLStorage() {
+  stop_meta_move_ = true;
+  waitForMetaMove();
+}
+
+void SQLStorage::waitForMetaMove() {
+  if (meta_mover_.joinable()) {
+    meta_mover_.join();
+  }
+}
+
+void SQLStorage::idleMaintenance() {
+  if (readonly_ || config_.sqldb_maintenance_interval_sec == 0) {
+    return;
+  }
+  // The time of the last run is kept across restarts, e.g. when aktualizr exits while idle
+  const boost::filesystem::path stamp = dbPath().string() + ".maintenance";
+  boost::system::error_code ec;
+  const std::time_t last = boost::filesystem::last_write_time(stamp, ec);
+  const std::time_t now = std::time(nullptr);
+  if (!ec && last <= now && now - last < static_cast<std::time_t>(config_.sqldb_maintenance_interval_sec)) {
+    return;
+  }
+
+  {
+    ScopedResourcePolicy policy(ResourcePolicy::lowest());
+    dbMaintain();
+  }
+  try {
+    Utils::writeFile(stamp, std::string());
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not record the time of the database maintenance: " << e.what();
+  }
+}
+
+void SQLStorage::beginBatch() {
+  // waits for batches on other threads to end
+  SQLite3Guard db = dbConnection();
+  if (batch_ != nullptr) {
+    throw SQLException("Storage batches cannot be nested");
+  }
+  db.beginTransaction();
+  batch_ = std_::make_unique<SQLite3Guard>(std::move(db));
+}
+
+void SQLStorage::commitBatch() {
+  if (batch_ == nullptr) {
+    return;
+  }
+  // rolled back when destroyed if the commit fails
+  std::unique_ptr<SQLite3Guard> batch = std::move(batch_);
+  // values read within a failed batch must not outlive it
+  invalidateMetaCache();
+  invalidateInstalledVersionsCache();
+  invalidateEcuCache();
+  batch->commitTransaction();
+  removeUnusedMetaBlobs(*batch);
+}
+
+void SQLStorage::rollbackBatch() {
+  if (batch_ == nullptr) {
+    return;
+  }
+  std::unique_ptr<SQLite3Guard> batch = std::move(batch_);
+  invalidateMetaCache();
+  invalidateInstalledVersionsCache();
+  invalidateEcuCache();
+  batch->rollbackTransaction();
+  removeUnusedMetaBlobs(*batch);
+}
+
+void SQLStorage::validateCache(SQLite3Guard& db) const {
+  // data_version changes when another connection commits to the database
+  auto statement = db.prepareStatement("PRAGMA data_version;");
+  int64_t data_version = -1;
+  if (statement.step() == SQLITE_ROW) {
+    data_version = statement.get_result_col_int(0);
+  }
+  if (data_version < 0 || data_version != cache_data_version_ ||
+      connection_generation_ != cache_connection_generation_) {
+    invalidateMetaCache();
+    invalidateInstalledVersionsCache();
+    invalidateEcuCache();
+    cache_data_version_ = data_version;
+    cache_connection_generation_ = connection_generation_;
+  }
+}
+
+bool SQLStorage::loadCachedMeta(SQLite3Guard& db, const std::string& key, std::string* data,
+                                const std::function<bool(std::string*)>& load) const {
+  if (!cache_enabled_) {
+    return load(data);
+  }
+
+  validateCache(db);
+  auto cached = meta_cache_.find(key);
+  if (cached == meta_cache_.end()) {
+    std::string blob;
+    if (!load(&blob)) {
+      return false;
+    }
+    if (!meta_cache_budget_.tryGrow(blob.size())) {
+      // Not kept while the memory budget is short
+      if (data != nullptr) {
+        *data = std::move(blob);
+      }
+      return true;
+    }
+    cached = meta_cache_.emplace(key, std::move(blob)).first;
+  }
+  if (data != nullptr) {
+    *data = cached->second;
+  }
+  return true;
+}
+
+void SQLStorage::invalidateMetaCache() const {
+  meta_cache_.clear();
+  meta_cache_budget_.release();
+}
+
+void SQLStorage::invalidateInstalledVersionsCache() const {
+  installed_versions_cache_.clear();
+  ++installed_state_generation_;
+}
+
+const SQLStorage::CachedEcus* SQLStorage::cachedEcus(SQLite3Guard& db) const {
+  if (!cache_enabled_ || !db.locked()) {
+    return nullptr;
+  }
+  validateCache(db);
+  if (!ecus_cache_) {
+    CachedEcus ecus;
+    if (!readEcuSerials(db, &ecus.serials) || !readSecondariesInfo(db, &ecus.secondaries)) {
+      return nullptr;
+    }
+    for (size_t i = 0; i < ecus.secondaries.size(); ++i) {
+      ecus.secondary_index.emplace(ecus.secondaries[i].serial, i);
+    }
+    ecus_cache_ = std::move(ecus);
+  }
+  return &*ecus_cache_;
+}
+
+void SQLStorage::invalidateEcuCache() const {
+  ecus_cache_ = boost::none;
+  ++installed_state_generation_;
+}
+
+uint64_t SQLStorage::installedStateGeneration() const {
+  SQLite3Guard db = dbConnection();
+  // Picks up commits of other connections
+  validateCache(db);
+  return installed_state_generation_;
+}
+
+// Returns the name of the blob that now holds `data`, or an empty string if it
+// is to be stored in its row
+std::string SQLStorage::putMetaBlob(const std::string& data) {
+  if (blob_threshold_ == 0 || data.size() < blob_threshold_) {
+    return "";
+  }
+  try {
+    return blobs_.put(data);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Storing metadata in the database instead: " << e.what();
+    return "";
+  }
+}
+
+// A write of another connection can replace the row and remove its blob after
+// the row was read here. `blob_removed` tells the caller to read the row again
+// then, as it names a newer blob.
+bool SQLStorage::readMeta(SQLiteStatement& statement, int meta_col, int file_col, std::string* data,
+                          bool* blob_removed) const {
+  const auto meta_file = statement.get_result_col_str(file_col);
+  if (meta_file && !meta_file->empty()) {
+    if (blobs_.get(*meta_file, data)) {
+      return true;
+    }
+    if (blob_removed != nullptr) {
+      *blob_removed = !boost::filesystem::exists(blobs_.dir() / *meta_file);
+    }
+    return false;
+  }
+  if (data != nullptr) {
+    *data = statement.get_result_col_blob(meta_col).value_or("");
+  }
+  return true;
+}
+
+// Blobs can only be removed once no row refers to them. Within a transaction,
+// e.g. of a batch, a rollback could bring such a row back, so the removal waits
+// for the end of the batch.
+void SQLStorage::removeUnusedMetaBlobs(SQLite3Guard& db) {
+  if (readonly_ || sqlite3_get_autocommit(db.get()) == 0 || !boost::filesystem::is_directory(blobs_.dir())) {
+    return;
+  }
+  std::set<std::string> used;
+  auto statement = db.prepareStatement(
+      "SELECT meta_file FROM meta WHERE meta_file != '' "
+      "UNION SELECT meta_file FROM delegations WHERE meta_file != '';");
+  int result;
+  while ((result = statement.step()) == SQLITE_ROW) {
+    used.insert(statement.get_result_col_str(0).value());
+  }
+  if (result != SQLITE_DONE) {
+    LOG_ERROR << "Failed to list metadata blobs: " << db.errmsg();
+    return;
+  }
+  blobs_.removeUnused(used);
+}
+
+// Metadata stored before it was kept in blobs, or while blob_threshold_ was
+// higher, is moved out of the database. One row at a time, so that other
+// operations only wait for a single move. It is resumed on the next start if
+// the storage is destroyed before it is done.
+void SQLStorage::moveMetaToBlobs() {
+  if (blob_threshold_ > 0) {
+    const Timer timer;
+    for (const std::string table : {"meta", "delegations"}) {
+      std::vector<int64_t> rows;
+      {
+        SQLite3Guard db = dbReadConnection();
+        // Root metadata always stays in the database
+        auto statement = db.prepareStatement<int64_t>(
+            "SELECT rowid FROM " + table + " WHERE meta_file = '' AND length(meta) >= ?" +
+                (table == "meta" ? " AND meta_type != 0;" : ";"),
+            static_cast<int64_t>(blob_threshold_));
+        while (statement.step() == SQLITE_ROW) {
+          rows.push_back(statement.get_result_col_int(0));
+        }
+      }
+
+      size_t moved = 0;
+      for (const int64_t row : rows) {
+        if (stop_meta_move_) {
+          return;
+        }
+        SQLite3Guard db = dbConnection();
+        // The row may have been replaced since it was listed
+        std::string name;
+        {
+          auto statement = db.prepareStatement<int64_t>(
+              "SELECT meta FROM " + table + " WHERE rowid = ? AND meta_file = '';", row);
+          if (statement.step() != SQLITE_ROW) {
+            continue;
+          }
+          name = blobs_.put(statement.get_result_col_blob(0).value());
+        }
+        auto statement = db.prepareStatement<std::string, int64_t>(
+            "UPDATE " + table + " SET meta = x'', meta_file = ? WHERE rowid = ?;", name, row);
+        if (statement.step() != SQLITE_DONE) {
+          LOG_ERROR << "Failed to move metadata out of the database: " << db.errmsg();
+          return;
+        }
+        ++moved;
+      }
+      if (moved > 0) {
+        LOG_INFO << "Moved " << moved << " large metadata files out of the " << table << " table in " << timer;
+      }
+    }
+  }
+  SQLite3Guard db = dbConnection();
+  removeUnusedMetaBlobs(db);
 }
 
 void SQLStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
@@ -87,7 +395,7 @@ bool SQLStorage::loadPrimaryKeys(std::string* public_key, std::string* private_k
 }
 
 bool SQLStorage::loadPrimaryPublic(std::string* public_key) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT public FROM primary_keys LIMIT 1;");
 
@@ -113,7 +421,7 @@ bool SQLStorage::loadPrimaryPublic(std::string* public_key) const {
 }
 
 bool SQLStorage::loadPrimaryPrivate(std::string* private_key) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT private FROM primary_keys LIMIT 1;");
 
@@ -150,6 +458,7 @@ void SQLStorage::clearPrimaryKeys() {
 void SQLStorage::saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const std::string& sec_type,
                                    const PublicKey& public_key) {
   SQLite3Guard db = dbConnection();
+  invalidateEcuCache();
 
   std::stringstream key_type_ss;
   key_type_ss << public_key.Type();
@@ -185,6 +494,7 @@ void SQLStorage::saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const st
 
 void SQLStorage::saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const std::string& data) {
   SQLite3Guard db = dbConnection();
+  invalidateEcuCache();
 
   db.beginTransaction();
 
@@ -210,7 +520,20 @@ void SQLStorage::saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const st
 }
 
 bool SQLStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
+
+  const CachedEcus* cached = cachedEcus(db);
+  if (cached != nullptr) {
+    const auto it = cached->secondary_index.find(ecu_serial);
+    if (it == cached->secondary_index.end()) {
+      LOG_TRACE << "Secondary ECU " << ecu_serial << " not found in database";
+      return false;
+    }
+    if (secondary != nullptr) {
+      *secondary = cached->secondaries[it->second];
+    }
+    return true;
+  }
 
   SecondaryInfo new_sec{};
 
@@ -253,11 +576,26 @@ bool SQLStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, Secondar
 }
 
 bool SQLStorage::loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
+  const CachedEcus* cached = cachedEcus(db);
   std::vector<SecondaryInfo> new_secs;
+  if (cached != nullptr) {
+    new_secs = cached->secondaries;
+  } else {
+    readSecondariesInfo(db, &new_secs);
+  }
+  const bool empty = new_secs.empty();
 
-  bool empty = true;
+  if (secondaries != nullptr) {
+    *secondaries = std::move(new_secs);
+  }
+
+  return !empty;
+}
+
+bool SQLStorage::readSecondariesInfo(SQLite3Guard& db, std::vector<SecondaryInfo>* secondaries) const {
+  std::vector<SecondaryInfo> new_secs;
 
   int statement_state;
   auto statement = db.prepareStatement(
@@ -278,20 +616,17 @@ bool SQLStorage::loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) co
       }
       std::string extra = statement.get_result_col_str(5).value_or("");
       new_secs.emplace_back(SecondaryInfo{serial, hw_id, sec_type, key, extra});
-      empty = false;
     } catch (const boost::bad_optional_access&) {
       continue;
     }
   }
+  *secondaries = std::move(new_secs);
   if (statement_state != SQLITE_DONE) {
     LOG_ERROR << "Failed to load Secondary info" << db.errmsg();
+    return false;
   }
 
-  if (secondaries != nullptr) {
-    *secondaries = std::move(new_secs);
-  }
-
-  return !empty;
+  return true;
 }
 
 void SQLStorage::storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) {
@@ -382,7 +717,7 @@ void SQLStorage::storeTlsPkey(const std::string& pkey) {
 }
 
 bool SQLStorage::loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT ca_cert, client_cert, client_pkey FROM tls_creds LIMIT 1;");
 
@@ -429,7 +764,7 @@ void SQLStorage::clearTlsCreds() {
 }
 
 bool SQLStorage::loadTlsCa(std::string* ca) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT ca_cert FROM tls_creds LIMIT 1;");
 
@@ -455,7 +790,7 @@ bool SQLStorage::loadTlsCa(std::string* ca) const {
 }
 
 bool SQLStorage::loadTlsCert(std::string* cert) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT client_cert FROM tls_creds LIMIT 1;");
 
@@ -481,7 +816,7 @@ bool SQLStorage::loadTlsCert(std::string* cert) const {
 }
 
 bool SQLStorage::loadTlsPkey(std::string* pkey) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT client_pkey FROM tls_creds LIMIT 1;");
 
@@ -508,6 +843,7 @@ bool SQLStorage::loadTlsPkey(std::string* pkey) const {
 
 void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   db.beginTransaction();
 
@@ -520,9 +856,9 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
     return;
   }
 
-  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);",
-                                                                   SQLBlob(data), static_cast<int>(repo),
-                                                                   Uptane::Role::Root().ToInt(), version.version());
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int>(
+      "INSERT INTO meta(meta, repo, meta_type, version) VALUES (?, ?, ?, ?);", SQLBlob(data), static_cast<int>(repo),
+      Uptane::Role::Root().ToInt(), version.version());
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store Root metadata: " << db.errmsg();
@@ -534,6 +870,7 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
 
 void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, const Uptane::Role role) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   db.beginTransaction();
 
@@ -545,9 +882,12 @@ void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType re
     return;
   }
 
-  auto ins_statement =
-      db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);", SQLBlob(data),
-                                                  static_cast<int>(repo), role.ToInt(), Uptane::Version().version());
+  const std::string meta_file = putMetaBlob(data);
+  const std::string no_data;
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int, std::string>(
+      "INSERT INTO meta(meta, repo, meta_type, version, meta_file) VALUES (?, ?, ?, ?, ?);",
+      SQLBlob(meta_file.empty() ? data : no_data), static_cast<int>(repo), role.ToInt(), Uptane::Version().version(),
+      meta_file);
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to add " << role << "metadata: " << db.errmsg();
@@ -555,11 +895,17 @@ void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType re
   }
 
   db.commitTransaction();
+  removeUnusedMetaBlobs(db);
 }
 
 bool SQLStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
   SQLite3Guard db = dbConnection();
+  const std::string key = "root/" + repo.ToString() + "/" + std::to_string(version.version());
+  return loadCachedMeta(db, key, data, [&](std::string* blob) { return readRoot(db, blob, repo, version); });
+}
 
+bool SQLStorage::readRoot(SQLite3Guard& db, std::string* data, Uptane::RepositoryType repo,
+                          Uptane::Version version) const {
   // version < 0 => latest metadata requested
   if (version.version() < 0) {
     auto statement = db.prepareStatement<int, int>(
@@ -608,28 +954,41 @@ bool SQLStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane
 
 bool SQLStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, const Uptane::Role role) const {
   SQLite3Guard db = dbConnection();
+  const std::string key = "meta/" + repo.ToString() + "/" + role.ToString();
+  return loadCachedMeta(db, key, data, [&](std::string* blob) { return readNonRoot(db, blob, repo, role); });
+}
 
-  auto statement = db.prepareStatement<int, int>(
-      "SELECT meta FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;", static_cast<int>(repo),
-      role.ToInt());
-  int result = statement.step();
+bool SQLStorage::readNonRoot(SQLite3Guard& db, std::string* data, Uptane::RepositoryType repo,
+                             const Uptane::Role role) const {
+  for (int attempt = 1;; ++attempt) {
+    auto statement = db.prepareStatement<int, int>(
+        "SELECT meta, meta_file FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;",
+        static_cast<int>(repo), role.ToInt());
+    int result = statement.step();
 
-  if (result == SQLITE_DONE) {
-    LOG_TRACE << role << " metadata not found in database";
-    return false;
-  } else if (result != SQLITE_ROW) {
-    LOG_ERROR << "Failed to get " << role << " metadata: " << db.errmsg();
-    return false;
-  }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
-  }
+    if (result == SQLITE_DONE) {
+      LOG_TRACE << role << " metadata not found in database";
+      return false;
+    } else if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get " << role << " metadata: " << db.errmsg();
+      return false;
+    }
 
-  return true;
+    bool blob_removed = false;
+    if (readMeta(statement, 0, 1, data, &blob_removed)) {
+      return true;
+    }
+    if (!blob_removed || attempt == kMetaBlobReadAttempts) {
+      LOG_ERROR << "Failed to get " << role << " metadata: its blob is missing or unreadable";
+      return false;
+    }
+    LOG_DEBUG << role << " metadata was replaced while it was read, reading it again";
+  }
 }
 
 void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   auto del_statement =
       db.prepareStatement<int>("DELETE FROM meta WHERE (repo=? AND meta_type != 0);", static_cast<int>(repo));
@@ -637,74 +996,114 @@ void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
   if (del_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
   }
+  removeUnusedMetaBlobs(db);
 }
 
 void SQLStorage::clearMetadata() {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   if (db.exec("DELETE FROM meta;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
     return;
   }
+  if (db.exec("DELETE FROM meta_validators;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear metadata validators: " << db.errmsg();
+  }
+  removeUnusedMetaBlobs(db);
 }
 
 void SQLStorage::storeDelegation(const std::string& data, const Uptane::Role role) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
-  auto statement = db.prepareStatement<SQLBlob, std::string>("INSERT OR REPLACE INTO delegations VALUES (?, ?);",
-                                                             SQLBlob(data), role.ToString());
+  const std::string meta_file = putMetaBlob(data);
+  const std::string no_data;
+  auto statement = db.prepareStatement<SQLBlob, std::string, std::string>(
+      "INSERT OR REPLACE INTO delegations(meta, role_name, meta_file) VALUES (?, ?, ?);",
+      SQLBlob(meta_file.empty() ? data : no_data), role.ToString(), meta_file);
   if (statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store delegation metadata: " << db.errmsg();
     return;
   }
+  removeUnusedMetaBlobs(db);
 }
 
 bool SQLStorage::loadDelegation(std::string* data, const Uptane::Role role) const {
   SQLite3Guard db = dbConnection();
+  return loadCachedMeta(db, "delegation/" + role.ToString(), data,
+                        [&](std::string* blob) { return readDelegation(db, blob, role); });
+}
 
-  auto statement =
-      db.prepareStatement<std::string>("SELECT meta FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
-  int result = statement.step();
+bool SQLStorage::readDelegation(SQLite3Guard& db, std::string* data, const Uptane::Role role) const {
+  for (int attempt = 1;; ++attempt) {
+    auto statement = db.prepareStatement<std::string>(
+        "SELECT meta, meta_file FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
+    int result = statement.step();
 
-  if (result == SQLITE_DONE) {
-    LOG_TRACE << "Delegations metadata not found in database";
-    return false;
-  } else if (result != SQLITE_ROW) {
-    LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
-    return false;
-  }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
-  }
+    if (result == SQLITE_DONE) {
+      LOG_TRACE << "Delegations metadata not found in database";
+      return false;
+    } else if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
+      return false;
+    }
 
-  return true;
+    bool blob_removed = false;
+    if (readMeta(statement, 0, 1, data, &blob_removed)) {
+      return true;
+    }
+    if (!blob_removed || attempt == kMetaBlobReadAttempts) {
+      LOG_ERROR << "Failed to get delegations metadata: its blob is missing or unreadable";
+      return false;
+    }
+    LOG_DEBUG << "Delegation " << role << " was replaced while it was read, reading it again";
+  }
 }
 
 bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const {
   bool result = false;
 
   try {
-    SQLite3Guard db = dbConnection();
+    SQLite3Guard db = dbReadConnection();
 
-    auto statement = db.prepareStatement("SELECT meta, role_name FROM delegations;");
-    auto statement_state = statement.step();
-
-    if (statement_state == SQLITE_DONE) {
-      LOG_TRACE << "Delegations metadata not found in database";
-      return true;
-    } else if (statement_state != SQLITE_ROW) {
-      LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
-      return false;
-    }
+    for (int attempt = 1;; ++attempt) {
+      auto statement = db.prepareStatement("SELECT meta, role_name, meta_file FROM delegations;");
+      auto statement_state = statement.step();
 
-    do {
-      data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()),
-                        statement.get_result_col_blob(0).value());
-    } while ((statement_state = statement.step()) == SQLITE_ROW);
+      if (statement_state == SQLITE_DONE) {
+        LOG_TRACE << "Delegations metadata not found in database";
+        return true;
+      } else if (statement_state != SQLITE_ROW) {
+        LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
+        return false;
+      }
 
-    if (statement_state != SQLITE_DONE) {
-      LOG_ERROR << "Error reading delegations metadata: " << db.errmsg();
-      return false;
+      const size_t first = data.size();
+      bool blob_removed = false;
+      do {
+        std::string meta;
+        if (!readMeta(statement, 0, 2, &meta, &blob_removed)) {
+          break;
+        }
+        data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()), std::move(meta));
+      } while ((statement_state = statement.step()) == SQLITE_ROW);
+
+      if (statement_state == SQLITE_ROW) {
+        // A blob could not be read
+        data.erase(data.begin() + static_cast<std::ptrdiff_t>(first), data.end());
+        if (!blob_removed || attempt == kMetaBlobReadAttempts) {
+          LOG_ERROR << "Failed to get delegations metadata: a blob is missing or unreadable";
+          return false;
+        }
+        LOG_DEBUG << "Delegations were replaced while they were read, reading them again";
+        continue;
+      }
+      if (statement_state != SQLITE_DONE) {
+        LOG_ERROR << "Error reading delegations metadata: " << db.errmsg();
+        return false;
+      }
+      break;
     }
 
     result = true;
@@ -717,17 +1116,105 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
 
 void SQLStorage::deleteDelegation(const Uptane::Role role) {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   auto statement = db.prepareStatement<std::string>("DELETE FROM delegations WHERE role_name=?;", role.ToString());
   statement.step();
+  removeUnusedMetaBlobs(db);
 }
 
 void SQLStorage::clearDelegations() {
   SQLite3Guard db = dbConnection();
+  invalidateMetaCache();
 
   if (db.exec("DELETE FROM delegations;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear delegations metadata: " << db.errmsg();
   }
+  removeUnusedMetaBlobs(db);
+}
+
+void SQLStorage::storeMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, const std::string& etag,
+                                     const std::string& last_modified, const std::string& meta_sha256) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, std::string, std::string, std::string, std::string>(
+      "INSERT OR REPLACE INTO meta_validators(repo, role_name, etag, last_modified, meta_sha256) "
+      "VALUES (?, ?, ?, ?, ?);",
+      static_cast<int>(repo), role.ToString(), etag, last_modified, meta_sha256);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store " << role << " metadata validators: " << db.errmsg();
+  }
+}
+
+bool SQLStorage::loadMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, std::string* etag,
+                                    std::string* last_modified, std::string* meta_sha256) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement<int, std::string>(
+      "SELECT etag, last_modified, meta_sha256 FROM meta_validators WHERE repo = ? AND role_name = ?;",
+      static_cast<int>(repo), role.ToString());
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get " << role << " metadata validators: " << db.errmsg();
+    return false;
+  }
+
+  try {
+    if (etag != nullptr) {
+      *etag = statement.get_result_col_str(0).value();
+    }
+    if (last_modified != nullptr) {
+      *last_modified = statement.get_result_col_str(1).value();
+    }
+    if (meta_sha256 != nullptr) {
+      *meta_sha256 = statement.get_result_col_str(2).value();
+    }
+  } catch (const boost::bad_optional_access&) {
+    return false;
+  }
+  return true;
+}
+
+void SQLStorage::storeCampaigns(const std::string& campaigns, const std::string& etag,
+                                const std::string& last_modified) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string, std::string, std::string>(
+      "INSERT OR REPLACE INTO campaigns(unique_mark, campaigns, etag, last_modified) VALUES (0, ?, ?, ?);", campaigns,
+      etag, last_modified);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store campaigns: " << db.errmsg();
+  }
+}
+
+bool SQLStorage::loadCampaigns(std::string* campaigns, std::string* etag, std::string* last_modified) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement("SELECT campaigns, etag, last_modified FROM campaigns LIMIT 1;");
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get campaigns: " << db.errmsg();
+    return false;
+  }
+
+  try {
+    if (campaigns != nullptr) {
+      *campaigns = statement.get_result_col_str(0).value();
+    }
+    if (etag != nullptr) {
+      *etag = statement.get_result_col_str(1).value();
+    }
+    if (last_modified != nullptr) {
+      *last_modified = statement.get_result_col_str(2).value();
+    }
+  } catch (const boost::bad_optional_access&) {
+    return false;
+  }
+  return true;
 }
 
 void SQLStorage::storeDeviceId(const std::string& device_id) {
@@ -742,7 +1229,7 @@ void SQLStorage::storeDeviceId(const std::string& device_id) {
 }
 
 bool SQLStorage::loadDeviceId(std::string* device_id) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT device_id FROM device_info LIMIT 1;");
 
@@ -800,7 +1287,7 @@ void SQLStorage::storeEcuRegistered() {
 }
 
 bool SQLStorage::loadEcuRegistered() const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT is_registered FROM device_info LIMIT 1;");
 
@@ -838,7 +1325,7 @@ void SQLStorage::storeNeedReboot() {
 }
 
 bool SQLStorage::loadNeedReboot(bool* need_reboot) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT flag FROM need_reboot LIMIT 1;");
 
@@ -873,6 +1360,8 @@ void SQLStorage::clearNeedReboot() {
 void SQLStorage::storeEcuSerials(const EcuSerials& serials) {
   if (!serials.empty()) {
     SQLite3Guard db = dbConnection();
+    invalidateInstalledVersionsCache();
+    invalidateEcuCache();
 
     db.beginTransaction();
 
@@ -918,19 +1407,34 @@ void SQLStorage::storeEcuSerials(const EcuSerials& serials) {
 }
 
 bool SQLStorage::loadEcuSerials(EcuSerials* serials) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
+  const CachedEcus* cached = cachedEcus(db);
+  EcuSerials new_serials;
+  if (cached != nullptr) {
+    new_serials = cached->serials;
+  } else if (!readEcuSerials(db, &new_serials)) {
+    return false;
+  }
+  const bool empty = new_serials.empty();
+
+  if (serials != nullptr) {
+    *serials = std::move(new_serials);
+  }
+
+  return !empty;
+}
+
+bool SQLStorage::readEcuSerials(SQLite3Guard& db, EcuSerials* serials) const {
   // order by auto-incremented Primary key so that the ECU order is kept constant
   auto statement = db.prepareStatement("SELECT serial, hardware_id FROM ecus ORDER BY id;");
   int statement_state;
 
   EcuSerials new_serials;
-  bool empty = true;
   while ((statement_state = statement.step()) == SQLITE_ROW) {
     try {
       new_serials.emplace_back(Uptane::EcuSerial(statement.get_result_col_str(0).value()),
                                Uptane::HardwareIdentifier(statement.get_result_col_str(1).value()));
-      empty = false;
     } catch (const boost::bad_optional_access&) {
       return false;
     }
@@ -941,15 +1445,14 @@ bool SQLStorage::loadEcuSerials(EcuSerials* serials) const {
     return false;
   }
 
-  if (serials != nullptr) {
-    *serials = std::move(new_serials);
-  }
-
-  return !empty;
+  *serials = std::move(new_serials);
+  return true;
 }
 
 void SQLStorage::clearEcuSerials() {
   SQLite3Guard db = dbConnection();
+  invalidateInstalledVersionsCache();
+  invalidateEcuCache();
 
   db.beginTransaction();
 
@@ -1028,7 +1531,7 @@ void SQLStorage::saveMisconfiguredEcu(const MisconfiguredEcu& ecu) {
 }
 
 bool SQLStorage::loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT serial, hardware_id, state FROM misconfigured_ecus;");
   int statement_state;
@@ -1071,6 +1574,7 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
                                       InstalledVersionUpdateMode update_mode,
                                       const Uptane::CorrelationId& correlation_id) {
   SQLite3Guard db = dbConnection();
+  invalidateInstalledVersionsCache();
 
   db.beginTransaction();
 
@@ -1190,30 +1694,34 @@ static void loadEcuMap(SQLite3Guard& db, std::string& ecu_serial, Uptane::EcuMap
 
 bool SQLStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                                      bool only_installed) const {
-  SQLite3Guard db = dbConnection();
+  return loadInstallationLogPage(ecu_serial, log, only_installed, 0, -1);
+}
+
+bool SQLStorage::loadInstallationLogPage(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                                         bool only_installed, int64_t offset, int64_t limit) const {
+  SQLite3Guard db = dbReadConnection();
 
   std::string ecu_serial_real = ecu_serial;
   Uptane::EcuMap ecu_map;
   loadEcuMap(db, ecu_serial_real, ecu_map);
 
+  // A negative LIMIT means no limit in SQLite
   std::string query =
       "SELECT id, sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
-      "ecu_serial = ? ORDER BY id;";
+      "ecu_serial = ? ORDER BY id LIMIT ? OFFSET ?;";
   if (only_installed) {
     query =
         "SELECT id, sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
-        "ecu_serial = ? AND was_installed = 1 ORDER BY id;";
+        "ecu_serial = ? AND was_installed = 1 ORDER BY id LIMIT ? OFFSET ?;";
   }
 
-  auto statement = db.prepareStatement<std::string>(query, ecu_serial_real);
+  auto statement =
+      db.prepareStatement<std::string, int64_t, int64_t>(query, ecu_serial_real, limit, std::max<int64_t>(offset, 0));
   int statement_state;
 
   std::vector<Uptane::Target> new_log;
-  std::map<int64_t, size_t> ids_map;
-  size_t k = 0;
   while ((statement_state = statement.step()) == SQLITE_ROW) {
     try {
-      auto id = statement.get_result_col_int(0);
       auto sha256 = statement.get_result_col_str(1).value();
       auto filename = statement.get_result_col_str(2).value();
       auto hashes_str = statement.get_result_col_str(3).value();
@@ -1243,10 +1751,7 @@ bool SQLStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<
           LOG_ERROR << "Unable to parse custom data: " << errs;
         }
       }
-      new_log.emplace_back(t);
-
-      ids_map[id] = k;
-      k++;
+      new_log.emplace_back(std::move(t));
     } catch (const boost::bad_optional_access&) {
       LOG_ERROR << "Incomplete installed version list; keeping previous entries.";
       return false;
@@ -1272,6 +1777,41 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
                                        Uptane::CorrelationId* correlation_id) const {
   SQLite3Guard db = dbConnection();
 
+  CachedInstalledVersions versions;
+  auto cached = installed_versions_cache_.end();
+  if (cache_enabled_) {
+    validateCache(db);
+    cached = installed_versions_cache_.find(ecu_serial);
+  }
+  if (cached != installed_versions_cache_.end()) {
+    versions = cached->second;
+  } else {
+    if (!readInstalledVersions(db, ecu_serial, &versions)) {
+      return false;
+    }
+    if (cache_enabled_) {
+      installed_versions_cache_.emplace(ecu_serial, versions);
+    }
+  }
+
+  if (current_version != nullptr) {
+    *current_version = versions.current;
+    if (!!versions.current && correlation_id != nullptr) {
+      *correlation_id = versions.current_correlation_id;
+    }
+  }
+  if (pending_version != nullptr) {
+    *pending_version = versions.pending;
+    if (!!versions.pending && correlation_id != nullptr) {
+      *correlation_id = versions.pending_correlation_id;
+    }
+  }
+
+  return true;
+}
+
+bool SQLStorage::readInstalledVersions(SQLite3Guard& db, const std::string& ecu_serial,
+                                       CachedInstalledVersions* versions) const {
   std::string ecu_serial_real = ecu_serial;
   Uptane::EcuMap ecu_map;
   loadEcuMap(db, ecu_serial_real, ecu_map);
@@ -1308,7 +1848,7 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
     return t;
   };
 
-  if (current_version != nullptr) {
+  {
     auto statement = db.prepareStatement<std::string>(
         "SELECT sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
         "ecu_serial = ? AND is_current = 1 LIMIT 1;",
@@ -1316,21 +1856,19 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 
     if (statement.step() == SQLITE_ROW) {
       try {
-        *current_version = read_target(statement);
-        if (correlation_id != nullptr) {
-          *correlation_id = statement.get_result_col_str(4).value();
-        }
+        versions->current = read_target(statement);
+        versions->current_correlation_id = statement.get_result_col_str(4).value();
       } catch (const boost::bad_optional_access&) {
         LOG_ERROR << "Could not read current installed version";
         return false;
       }
     } else {
       LOG_TRACE << "Failed to get current installed version: " << db.errmsg();
-      *current_version = boost::none;
+      versions->current = boost::none;
     }
   }
 
-  if (pending_version != nullptr) {
+  {
     auto statement = db.prepareStatement<std::string>(
         "SELECT sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
         "ecu_serial = ? AND is_pending = 1 LIMIT 1;",
@@ -1338,17 +1876,15 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 
     if (statement.step() == SQLITE_ROW) {
       try {
-        *pending_version = read_target(statement);
-        if (correlation_id != nullptr) {
-          *correlation_id = statement.get_result_col_str(4).value();
-        }
+        versions->pending = read_target(statement);
+        versions->pending_correlation_id = statement.get_result_col_str(4).value();
       } catch (const boost::bad_optional_access&) {
         LOG_ERROR << "Could not read pending installed version";
         return false;
       }
     } else {
       LOG_TRACE << "Failed to get pending installed version: " << db.errmsg();
-      *pending_version = boost::none;
+      versions->pending = boost::none;
     }
   }
 
@@ -1356,7 +1892,7 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 }
 
 bool SQLStorage::hasPendingInstall() {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT count(*) FROM installed_versions where is_pending = 1");
   if (statement.step() != SQLITE_ROW) {
@@ -1368,7 +1904,7 @@ bool SQLStorage::hasPendingInstall() {
 }
 
 void SQLStorage::getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT ecu_serial, sha256 FROM installed_versions where is_pending = 1");
   int statement_result = statement.step();
@@ -1396,6 +1932,7 @@ void SQLStorage::getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>*
 
 void SQLStorage::clearInstalledVersions() {
   SQLite3Guard db = dbConnection();
+  invalidateInstalledVersionsCache();
 
   if (db.exec("DELETE FROM installed_versions;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear installed versions: " << db.errmsg();
@@ -1419,7 +1956,7 @@ void SQLStorage::saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial,
 
 bool SQLStorage::loadEcuInstallationResults(
     std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>> ecu_res;
 
@@ -1485,7 +2022,7 @@ bool SQLStorage::storeDeviceInstallationRawReport(const std::string& raw_report)
 
 bool SQLStorage::loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
                                               std::string* correlation_id) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   data::InstallationResult dev_res;
   std::string raw_report_res;
@@ -1543,7 +2080,7 @@ void SQLStorage::saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, const
 }
 
 bool SQLStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::vector<std::pair<Uptane::EcuSerial, int64_t>> ecu_cnt;
 
@@ -1580,7 +2117,17 @@ bool SQLStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, i
   return true;
 }
 
-void SQLStorage::saveReportEvent(const Json::Value& json_value) {
+void SQLStorage::saveReportEvent(const Json::Value& json_value, bool urgent) {
+  if (urgent && urgent_report_journal_ && urgent_report_journal_->append(json_value)) {
+    return;
+  }
+  if (report_journal_ && report_journal_->append(json_value)) {
+    const size_t dropped = report_journal_->trim(report_events_max_, report_events_max_bytes_);
+    if (dropped > 0) {
+      LOG_WARNING << "Dropped the " << dropped << " oldest report events to stay within the limits of storage";
+    }
+    return;
+  }
   std::string json_string = Utils::jsonToCanonicalStr(json_value);
   SQLite3Guard db = dbConnection();
   auto statement = db.prepareStatement<std::string>(
@@ -1591,9 +2138,41 @@ void SQLStorage::saveReportEvent(const Json::Value& json_value) {
   }
 }
 
-bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const {
-  SQLite3Guard db = dbConnection();
-  auto statement = db.prepareStatement<int>("SELECT id, json_string FROM report_events LIMIT ?;", limit);
+bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit, int64_t max_bytes) const {
+  // Events left in the database go first, then the urgent ones
+  if (loadDbReportEvents(report_array, id_max, limit, max_bytes)) {
+    return true;
+  }
+  if (urgent_report_journal_ && urgent_report_journal_->load(report_array, id_max, limit, max_bytes)) {
+    *id_max += kUrgentReportJournalIdBase;
+    return true;
+  }
+  if (!report_journal_ || !report_journal_->load(report_array, id_max, limit, max_bytes)) {
+    return false;
+  }
+  *id_max += kReportJournalIdBase;
+  return true;
+}
+
+void SQLStorage::deleteReportEvents(int64_t id_max) {
+  if (id_max >= kUrgentReportJournalIdBase) {
+    if (urgent_report_journal_) {
+      urgent_report_journal_->acknowledge(id_max - kUrgentReportJournalIdBase);
+    }
+    return;
+  }
+  if (id_max >= kReportJournalIdBase) {
+    if (report_journal_) {
+      report_journal_->acknowledge(id_max - kReportJournalIdBase);
+    }
+    return;
+  }
+  deleteDbReportEvents(id_max);
+}
+
+bool SQLStorage::loadDbReportEvents(Json::Value* report_array, int64_t* id_max, int limit, int64_t max_bytes) const {
+  SQLite3Guard db = dbReadConnection();
+  auto statement = db.prepareStatement<int>("SELECT id, json_string FROM report_events ORDER BY id LIMIT ?;", limit);
   int statement_result = statement.step();
   if (statement_result != SQLITE_DONE && statement_result != SQLITE_ROW) {
     LOG_ERROR << "Failed to get report events: " << db.errmsg();
@@ -1604,16 +2183,23 @@ bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, in
     return false;
   }
   *id_max = 0;
+  int64_t bytes = 0;
   for (; statement_result != SQLITE_DONE; statement_result = statement.step()) {
     try {
       int64_t id = statement.get_result_col_int(0);
       std::string json_string = statement.get_result_col_str(1).value();
+      bytes += static_cast<int64_t>(json_string.size());
+      if (max_bytes >= 0 && bytes > max_bytes && !report_array->empty()) {
+        // Always return at least one event, even if it is over the limit
+        break;
+      }
+      // Rows that can't be parsed are deleted with the others
+      *id_max = (*id_max) > id ? (*id_max) : id;
       std::istringstream jss(json_string);
       Json::Value event_json;
       std::string errs;
       if (Json::parseFromStream(Json::CharReaderBuilder(), jss, &event_json, &errs)) {
         report_array->append(event_json);
-        *id_max = (*id_max) > id ? (*id_max) : id;
       } else {
         LOG_ERROR << "Unable to parse event data: " << errs;
       }
@@ -1625,7 +2211,7 @@ bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, in
   return true;
 }
 
-void SQLStorage::deleteReportEvents(int64_t id_max) {
+void SQLStorage::deleteDbReportEvents(int64_t id_max) {
   SQLite3Guard db = dbConnection();
 
   auto statement = db.prepareStatement<int64_t>("DELETE FROM report_events WHERE id <= ?;", id_max);
@@ -1634,6 +2220,32 @@ void SQLStorage::deleteReportEvents(int64_t id_max) {
   }
 }
 
+/* Move the events stored in the database by earlier versions into the journal,
+ * one at a time, so that an interruption can at most send one of them twice. */
+void SQLStorage::migrateReportEvents() {
+  size_t moved = 0;
+  int64_t last_id = 0;
+  for (;;) {
+    Json::Value events{Json::arrayValue};
+    int64_t id = 0;
+    if (!loadDbReportEvents(&events, &id, 1, -1) || id <= last_id) {
+      // Nothing left, or the last one could not be deleted
+      break;
+    }
+    last_id = id;
+    if (!events.empty() && !report_journal_->append(events[0])) {
+      // The rest stays in the database, and is still sent from there
+      LOG_ERROR << "Failed to move report events to the journal";
+      break;
+    }
+    deleteDbReportEvents(id);
+    ++moved;
+  }
+  if (moved > 0) {
+    LOG_INFO << "Moved " << moved << " report events to " << report_journal_->path();
+  }
+}
+
 void SQLStorage::clearInstallationResults() {
   SQLite3Guard db = dbConnection();
 
@@ -1652,6 +2264,46 @@ void SQLStorage::clearInstallationResults() {
   db.commitTransaction();
 }
 
+void SQLStorage::saveInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target,
+                                  InstallStage stage) {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string, std::string, std::string, int>(
+      "INSERT OR REPLACE INTO install_journal(ecu_serial, filename, sha256, stage) VALUES (?,?,?,?);",
+      ecu_serial.ToString(), target.filename(), target.sha256Hash(), static_cast<int>(stage));
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to save the install stage: " << db.errmsg();
+  }
+}
+
+InstallStage SQLStorage::loadInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement<std::string, std::string, std::string>(
+      "SELECT stage FROM install_journal WHERE ecu_serial = ? AND filename = ? AND sha256 = ? LIMIT 1;",
+      ecu_serial.ToString(), target.filename(), target.sha256Hash());
+  const int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return InstallStage::kNone;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to load the install stage: " << db.errmsg();
+    return InstallStage::kNone;
+  }
+  const auto stage = statement.get_result_col_int(0);
+  if (stage < static_cast<int64_t>(InstallStage::kNone) || stage > static_cast<int64_t>(InstallStage::kInstalled)) {
+    return InstallStage::kNone;
+  }
+  return static_cast<InstallStage>(stage);
+}
+
+void SQLStorage::clearInstallJournal() {
+  SQLite3Guard db = dbConnection();
+
+  if (db.exec("DELETE FROM install_journal;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear the install journal: " << db.errmsg();
+  }
+}
+
 void SQLStorage::storeDeviceDataHash(const std::string& data_type, const std::string& hash) {
   SQLite3Guard db = dbConnection();
 
@@ -1664,7 +2316,7 @@ void SQLStorage::storeDeviceDataHash(const std::string& data_type, const std::st
 }
 
 bool SQLStorage::loadDeviceDataHash(const std::string& data_type, std::string* hash) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement =
       db.prepareStatement<std::string>("SELECT hash FROM device_data WHERE data_type = ? LIMIT 1;", data_type);
@@ -1706,7 +2358,7 @@ void SQLStorage::storeTargetFilename(const std::string& targetname, const std::s
 }
 
 std::string SQLStorage::getTargetFilename(const std::string& targetname) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement =
       db.prepareStatement<std::string>("SELECT filename FROM target_images WHERE targetname = ?;", targetname);
@@ -1722,7 +2374,7 @@ std::string SQLStorage::getTargetFilename(const std::string& targetname) const {
 }
 
 std::vector<std::string> SQLStorage::getAllTargetNames() const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement<>("SELECT targetname FROM target_images;");
 
@@ -1740,6 +2392,56 @@ std::vector<std::string> SQLStorage::getAllTargetNames() const {
   return names;
 }
 
+void SQLStorage::storeTargetVerification(const std::string& targetname,
+                                         const TargetFileVerification& verification) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int64_t, std::string, std::string, int64_t, int64_t, int64_t, std::string>(
+      "UPDATE target_images SET real_size = ?, sha256 = ?, sha512 = ?, mtime = ?, ctime = ?, inode = ? "
+      "WHERE targetname = ?;",
+      static_cast<int64_t>(verification.real_size), verification.sha256, verification.sha512, verification.mtime,
+      verification.ctime, static_cast<int64_t>(verification.inode), targetname);
+
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store Target verification: " << db.errmsg();
+    throw SQLException(std::string("Failed to store Target verification: ") + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadTargetVerification(const std::string& targetname, TargetFileVerification* verification) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT real_size, sha256, sha512, mtime, ctime, inode FROM target_images WHERE targetname = ?;", targetname);
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get Target verification: " << db.errmsg();
+    return false;
+  }
+
+  TargetFileVerification res;
+  try {
+    res.real_size = static_cast<uint64_t>(statement.get_result_col_int(0));
+    res.sha256 = statement.get_result_col_str(1).value();
+    res.sha512 = statement.get_result_col_str(2).value();
+    res.mtime = statement.get_result_col_int(3);
+    res.ctime = statement.get_result_col_int(4);
+    res.inode = static_cast<uint64_t>(statement.get_result_col_int(5));
+  } catch (const boost::bad_optional_access&) {
+    return false;
+  }
+  if (res.sha256.empty() && res.sha512.empty()) {
+    return false;
+  }
+  if (verification != nullptr) {
+    *verification = res;
+  }
+  return true;
+}
+
 void SQLStorage::deleteTargetInfo(const std::string& targetname) const {
   SQLite3Guard db = dbConnection();
 
@@ -1,12 +1,20 @@
 #ifndef SQLSTORAGE_H_
 #define SQLSTORAGE_H_
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
+
 #include <boost/optional.hpp>
 
 #include <sqlite3.h>
 
+#include "blob_store.h"
 #include "invstorage.h"
+#include "report_journal.h"
 #include "sqlstorage_base.h"
+#include "utilities/memory_budget.h"
 
 extern const std::vector<std::string> libaktualizr_schema_migrations;
 extern const std::vector<std::string> libaktualizr_schema_rollback_migrations;
@@ -19,11 +27,14 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   friend class SQLTargetWHandle;
   friend class SQLTargetRHandle;
   explicit SQLStorage(const StorageConfig& config, bool readonly);
-  ~SQLStorage() override = default;
+  ~SQLStorage() override;
   SQLStorage(const SQLStorage&) = delete;
   SQLStorage(SQLStorage&&) = delete;
   SQLStorage& operator=(const SQLStorage&) = delete;
   SQLStorage& operator=(SQLStorage&&) = delete;
+  void beginBatch() override;
+  void commitBatch() override;
+  void rollbackBatch() override;
   void storePrimaryKeys(const std::string& public_key, const std::string& private_key) override;
   bool loadPrimaryKeys(std::string* public_key, std::string* private_key) const override;
   bool loadPrimaryPublic(std::string* public_key) const override;
@@ -57,6 +68,12 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const override;
   void deleteDelegation(Uptane::Role role) override;
   void clearDelegations() override;
+  void storeMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, const std::string& etag,
+                           const std::string& last_modified, const std::string& meta_sha256) override;
+  void storeCampaigns(const std::string& campaigns, const std::string& etag, const std::string& last_modified) override;
+  bool loadCampaigns(std::string* campaigns, std::string* etag, std::string* last_modified) const override;
+  bool loadMetaValidators(Uptane::RepositoryType repo, const Uptane::Role& role, std::string* etag,
+                          std::string* last_modified, std::string* meta_sha256) const override;
 
   void storeDeviceId(const std::string& device_id) override;
   bool loadDeviceId(std::string* device_id) const override;
@@ -85,6 +102,8 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
                              Uptane::CorrelationId* correlation_id) const override;
   bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                            bool only_installed) const override;
+  bool loadInstallationLogPage(const std::string& ecu_serial, std::vector<Uptane::Target>* log, bool only_installed,
+                               int64_t offset, int64_t limit) const override;
   bool hasPendingInstall() override;
   void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) override;
   void clearInstalledVersions() override;
@@ -99,10 +118,14 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
                                     std::string* correlation_id) const override;
   void saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) override;
   bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const override;
-  void saveReportEvent(const Json::Value& json_value) override;
-  bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const override;
+  void saveReportEvent(const Json::Value& json_value, bool urgent = false) override;
+  bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit, int64_t max_bytes = -1) const override;
   void deleteReportEvents(int64_t id_max) override;
   void clearInstallationResults() override;
+  void saveInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target,
+                        InstallStage stage) override;
+  InstallStage loadInstallStage(const Uptane::EcuSerial& ecu_serial, const Uptane::Target& target) const override;
+  void clearInstallJournal() override;
 
   void storeDeviceDataHash(const std::string& data_type, const std::string& hash) override;
   bool loadDeviceDataHash(const std::string& data_type, std::string* hash) const override;
@@ -112,13 +135,95 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   std::string getTargetFilename(const std::string& targetname) const override;
   std::vector<std::string> getAllTargetNames() const override;
   void deleteTargetInfo(const std::string& targetname) const override;
+  void storeTargetVerification(const std::string& targetname,
+                               const TargetFileVerification& verification) const override;
+  bool loadTargetVerification(const std::string& targetname, TargetFileVerification* verification) const override;
 
   StorageType type() override { return StorageType::kSqlite; };
 
+  void idleMaintenance() override;
+  uint64_t installedStateGeneration() const override;
+
+  // Large metadata already in the database is moved out in the background after the storage is opened
+  void waitForMetaMove();
+
  private:
+  struct CachedInstalledVersions {
+    boost::optional<Uptane::Target> current;
+    boost::optional<Uptane::Target> pending;
+    Uptane::CorrelationId current_correlation_id;
+    Uptane::CorrelationId pending_correlation_id;
+  };
+  struct CachedEcus {
+    EcuSerials serials;
+    std::vector<SecondaryInfo> secondaries;
+    std::map<Uptane::EcuSerial, size_t> secondary_index;
+  };
+
   void cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role);
+  bool readRoot(SQLite3Guard& db, std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const;
+  bool readNonRoot(SQLite3Guard& db, std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const;
+  bool readDelegation(SQLite3Guard& db, std::string* data, Uptane::Role role) const;
+  bool readInstalledVersions(SQLite3Guard& db, const std::string& ecu_serial, CachedInstalledVersions* versions) const;
+  bool readEcuSerials(SQLite3Guard& db, EcuSerials* serials) const;
+  bool readSecondariesInfo(SQLite3Guard& db, std::vector<SecondaryInfo>* secondaries) const;
+
+  // Large metadata is kept in blobs_, and its row only holds the blob's name
+  std::string putMetaBlob(const std::string& data);
+  bool readMeta(SQLiteStatement& statement, int meta_col, int file_col, std::string* data,
+                bool* blob_removed = nullptr) const;
+  static constexpr int kMetaBlobReadAttempts{3};
+  void removeUnusedMetaBlobs(SQLite3Guard& db);
+  void moveMetaToBlobs();
+
+  // The cache is only accessed with the storage mutex held
+  void validateCache(SQLite3Guard& db) const;
+  bool loadCachedMeta(SQLite3Guard& db, const std::string& key, std::string* data,
+                      const std::function<bool(std::string*)>& load) const;
+  void invalidateMetaCache() const;
+  void invalidateInstalledVersionsCache() const;
+  // Null if the ECUs are not cached, e.g. when `db` is a reader of its own
+  const CachedEcus* cachedEcus(SQLite3Guard& db) const;
+  void invalidateEcuCache() const;
+
+  // Report events in the database, written before the journal was enabled or
+  // when it could not be written to
+  bool loadDbReportEvents(Json::Value* report_array, int64_t* id_max, int limit, int64_t max_bytes) const;
+  void deleteDbReportEvents(int64_t id_max);
+  void migrateReportEvents();
 
   EcuSerials stashed_ecu_serials_;
+  // Holds the connection, and thus the storage lock, while a batch is open
+  std::unique_ptr<SQLite3Guard> batch_;
+
+  // Metadata blobs, installed versions and ECUs read from the database,
+  // dropped when they are written or when another connection changes the
+  // database
+  const bool cache_enabled_;
+  mutable std::map<std::string, std::string> meta_cache_;
+  mutable MemoryBudget::Reservation meta_cache_budget_;
+  mutable std::map<std::string, CachedInstalledVersions> installed_versions_cache_;
+  mutable boost::optional<CachedEcus> ecus_cache_;
+  mutable int64_t cache_data_version_{-1};
+  mutable uint64_t cache_connection_generation_{0};
+  // Counts the invalidations of the installed versions and ECU caches
+  mutable uint64_t installed_state_generation_{0};
+
+  // Events from the journal are numbered from kReportJournalIdBase, so that
+  // they can be told apart from those in the database
+  static constexpr int64_t kReportJournalIdBase = int64_t{1} << 40;
+  std::unique_ptr<ReportJournal> report_journal_;
+  // Urgent events, in a journal of their own so that they can be sent and
+  // acknowledged ahead of the others
+  static constexpr int64_t kUrgentReportJournalIdBase = int64_t{1} << 41;
+  std::unique_ptr<ReportJournal> urgent_report_journal_;
+  const uint64_t report_events_max_;
+  const uint64_t report_events_max_bytes_;
+
+  const BlobStore blobs_;
+  const uint64_t blob_threshold_;
+  std::atomic<bool> stop_meta_move_{false};
+  std::thread meta_mover_;
 };
 
 #endif  // SQLSTORAGE_H_
@@ -2,9 +2,12 @@
 #include "storage_exception.h"
 
 #include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <fstream>
 
+#include "utilities/timer.h"
 #include "utilities/utils.h"
 
 boost::filesystem::path SQLStorageBase::dbPath() const { return sqldb_path_; }
@@ -33,14 +36,16 @@ StorageLock::~StorageLock() {
 SQLStorageBase::SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly,
                                std::vector<std::string> schema_migrations,
                                std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                               int current_schema_version)
+                               int current_schema_version, std::string journal_mode, std::string synchronous)
     : sqldb_path_(std::move(sqldb_path)),
       readonly_(readonly),
-      mutex_(new std::mutex()),
+      mutex_(new std::recursive_mutex()),
       schema_migrations_(std::move(schema_migrations)),
       schema_rollback_migrations_(std::move(schema_rollback_migrations)),
       current_schema_(std::move(current_schema)),
-      current_schema_version_(current_schema_version) {
+      current_schema_version_(current_schema_version),
+      journal_mode_(std::move(journal_mode)),
+      synchronous_(std::move(synchronous)) {
   boost::filesystem::path db_parent_path = dbPath().parent_path();
   if (!boost::filesystem::is_directory(db_parent_path)) {
     Utils::createDirectories(db_parent_path, S_IRWXU);
@@ -79,11 +84,124 @@ SQLStorageBase::SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly
 }
 
 SQLite3Guard SQLStorageBase::dbConnection() const {
-  SQLite3Guard db(dbPath(), readonly_, mutex_);
-  if (db.get_rc() != SQLITE_OK) {
-    throw SQLInternalException(std::string("Can't open database: ") + db.errmsg());
+  std::lock_guard<std::recursive_mutex> guard(*mutex_);
+  if (connection_ != nullptr && connection_pid_ != getpid()) {
+    // A connection inherited across fork() must not be used, nor closed: closing it could release the locks held by
+    // the parent. Leave it to the parent.
+    new std::shared_ptr<SQLiteConnection>(std::move(connection_));  // NOLINT(cppcoreguidelines-owning-memory)
   }
-  return db;
+  struct stat st {};
+  if (connection_ == nullptr || connection_->failed() || stat(dbPath().c_str(), &st) != 0 ||
+      st.st_ino != connection_inode_) {
+    openConnection();
+  }
+  return SQLite3Guard(connection_, mutex_);
+}
+
+SQLite3Guard SQLStorageBase::dbReadConnection() const {
+  if (readonly_ || journal_mode_ != "wal") {
+    return dbConnection();
+  }
+  {
+    // Free, or held by this thread, e.g. in a batch whose changes the read must see
+    std::unique_lock<std::recursive_mutex> available(*mutex_, std::try_to_lock);
+    if (available.owns_lock()) {
+      return dbConnection();
+    }
+  }
+  return SQLite3Guard(readConnection(), nullptr);
+}
+
+std::shared_ptr<SQLiteConnection> SQLStorageBase::readConnection() const {
+  std::lock_guard<std::mutex> guard(readers_mutex_);
+  if (readers_pid_ != getpid()) {
+    // Same as for the main connection, see dbConnection()
+    new std::vector<std::shared_ptr<SQLiteConnection>>(std::move(readers_));  // NOLINT(cppcoreguidelines-owning-memory)
+    readers_.clear();
+    readers_pid_ = getpid();
+  }
+  struct stat st {};
+  const ino_t inode = stat(dbPath().c_str(), &st) == 0 ? st.st_ino : 0;
+  if (inode != readers_inode_) {
+    readers_.clear();
+    readers_inode_ = inode;
+  }
+
+  for (auto it = readers_.begin(); it != readers_.end();) {
+    if (it->use_count() > 1) {
+      ++it;
+    } else if ((*it)->failed()) {
+      it = readers_.erase(it);
+    } else {
+      return *it;
+    }
+  }
+
+  auto connection = std::make_shared<SQLiteConnection>(dbPath().c_str(), true);
+  if (connection->get_rc() != SQLITE_OK) {
+    throw SQLInternalException(std::string("Can't open database: ") + sqlite3_errmsg(connection->get()));
+  }
+  // When all are in use, the new one is closed again after this read
+  if (readers_.size() < kMaxReaders) {
+    readers_.push_back(connection);
+  }
+  return connection;
+}
+
+// Must be called with mutex_ held
+void SQLStorageBase::openConnection() const {
+  // Close the old connection first, so that its journal is cleaned up.
+  connection_.reset();
+  auto connection = std::make_shared<SQLiteConnection>(dbPath().c_str(), readonly_);
+  if (connection->get_rc() != SQLITE_OK) {
+    throw SQLInternalException(std::string("Can't open database: ") + sqlite3_errmsg(connection->get()));
+  }
+
+  if (!readonly_) {
+    static const std::vector<std::string> journal_modes{"delete", "truncate", "persist", "memory", "wal", "off"};
+    static const std::vector<std::string> synchronous_levels{"off", "normal", "full", "extra"};
+    const auto pragma = [&connection](const std::string& name, const std::string& value,
+                                      const std::vector<std::string>& allowed) {
+      if (value.empty()) {
+        return;
+      }
+      if (std::find(allowed.cbegin(), allowed.cend(), value) == allowed.cend()) {
+        LOG_WARNING << "Ignoring unsupported SQLite " << name << ": " << value;
+        return;
+      }
+      const std::string sql = "PRAGMA " + name + "=" + value + ";";
+      if (sqlite3_exec(connection->get(), sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+        LOG_WARNING << "Could not set SQLite " << name << " to " << value << ": " << sqlite3_errmsg(connection->get());
+      }
+    };
+    pragma("journal_mode", journal_mode_, journal_modes);
+    pragma("synchronous", synchronous_, synchronous_levels);
+  } else if (!journal_mode_checked_) {
+    // Readers of a WAL database read a snapshot, and neither wait for nor hold up the writer. With a rollback
+    // journal, reads by tools like aktualizr-info take turns with the writes of aktualizr.
+    journal_mode_checked_ = true;
+    std::string mode;
+    sqlite3_exec(
+        connection->get(), "PRAGMA journal_mode;",
+        [](void* out, int cols, char** values, char**) {
+          if (cols > 0 && values[0] != nullptr) {
+            *static_cast<std::string*>(out) = values[0];
+          }
+          return 0;
+        },
+        &mode, nullptr);
+    if (!mode.empty() && mode != "wal") {
+      LOG_WARNING << "The database at " << dbPath() << " uses the " << mode
+                  << " journal mode, reading it can delay aktualizr. Set storage.sqldb_journal_mode to wal to "
+                     "avoid this.";
+    }
+  }
+
+  struct stat st {};
+  connection_inode_ = stat(dbPath().c_str(), &st) == 0 ? st.st_ino : 0;
+  connection_pid_ = getpid();
+  connection_ = std::move(connection);
+  ++connection_generation_;
 }
 
 std::string SQLStorageBase::getTableSchemaFromDb(const std::string& tablename) {
@@ -147,12 +265,17 @@ bool SQLStorageBase::dbMigrateForward(int version_from, int version_to) {
     return false;
   }
 
+  // All the steps are applied in one transaction, so that the database is synced once, and a failed step leaves it at
+  // version_from
+  const Timer total;
   for (int32_t k = version_from + 1; k <= version_to; k++) {
+    const Timer step;
     auto result_code = db.exec(schema_migrations_.at(static_cast<size_t>(k)), nullptr, nullptr);
     if (result_code != SQLITE_OK) {
       LOG_ERROR << "Can't migrate DB from version " << (k - 1) << " to version " << k << ": " << db.errmsg();
       return false;
     }
+    LOG_DEBUG << "Migrated DB to version " << k << " in " << step;
   }
 
   if (!dbInsertBackMigrations(db, version_to)) {
@@ -160,6 +283,7 @@ bool SQLStorageBase::dbMigrateForward(int version_from, int version_to) {
   }
 
   db.commitTransaction();
+  LOG_INFO << "Migrated DB to version " << version_to << " in " << total;
 
   return true;
 }
@@ -172,7 +296,15 @@ bool SQLStorageBase::dbMigrateBackward(int version_from, int version_to) {
   LOG_INFO << "Migrating DB backward from version " << version_from << " to version " << version_to;
 
   SQLite3Guard db = dbConnection();
+  try {
+    db.beginTransaction();
+  } catch (const SQLException& e) {
+    return false;
+  }
+
+  const Timer total;
   for (int ver = version_from; ver > version_to; --ver) {
+    const Timer step;
     std::string migration;
     {
       // make sure the statement is destroyed before the next database operation
@@ -193,7 +325,11 @@ bool SQLStorageBase::dbMigrateBackward(int version_from, int version_to) {
       LOG_ERROR << "Can't clear old migration script: " << db.errmsg();
       return false;
     }
+    LOG_DEBUG << "Migrated DB back to version " << ver - 1 << " in " << step;
   }
+
+  db.commitTransaction();
+  LOG_INFO << "Migrated DB back to version " << version_to << " in " << total;
   return true;
 }
 
@@ -225,6 +361,11 @@ bool SQLStorageBase::dbMigrate() {
       return false;
     }
 
+    // Only takes effect before the first table is created, as migrated databases get it with a VACUUM in dbMaintain()
+    if (db.exec("PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr) != SQLITE_OK) {
+      LOG_WARNING << "Could not enable incremental vacuum: " << db.errmsg();
+    }
+
     auto result_code = db.exec(current_schema_, nullptr, nullptr);
     if (result_code != SQLITE_OK) {
       LOG_ERROR << "Can't bootstrap DB to version " << current_schema_version_ << ": " << db.errmsg();
@@ -236,13 +377,13 @@ bool SQLStorageBase::dbMigrate() {
     }
 
     db.commitTransaction();
-  } else if (schema_num_version > current_schema_version_) {
-    dbMigrateBackward(schema_num_version);
-  } else {
-    dbMigrateForward(schema_num_version);
+    return true;
   }
 
-  return true;
+  if (schema_num_version > current_schema_version_) {
+    return dbMigrateBackward(schema_num_version);
+  }
+  return dbMigrateForward(schema_num_version);
 }
 
 DbVersion SQLStorageBase::getVersion() {
@@ -275,3 +416,50 @@ DbVersion SQLStorageBase::getVersion() {
     return DbVersion::kInvalid;
   }
 }
+
+bool SQLStorageBase::dbMaintain() {
+  if (readonly_) {
+    return false;
+  }
+  SQLite3Guard db = dbConnection();
+  const auto pragma = [&db](const std::string& sql) -> int64_t {
+    auto statement = db.prepareStatement(sql);
+    if (statement.step() != SQLITE_ROW) {
+      return -1;
+    }
+    return statement.get_result_col_int(0);
+  };
+  const auto exec = [this, &db](const std::string& sql) {
+    if (db.exec(sql, nullptr, nullptr) != SQLITE_OK) {
+      LOG_WARNING << "Could not run " << sql << " on " << dbPath() << ": " << db.errmsg();
+      return false;
+    }
+    return true;
+  };
+
+  try {
+    const int64_t size_before = pragma("PRAGMA page_count;") * pragma("PRAGMA page_size;");
+    // 2 is incremental
+    if (pragma("PRAGMA auto_vacuum;") != 2) {
+      // Rebuilds the whole file, once, after which free pages are returned with incremental_vacuum
+      LOG_INFO << "Enabling incremental vacuum of " << dbPath();
+      if (!exec("PRAGMA auto_vacuum = INCREMENTAL; VACUUM;")) {
+        return false;
+      }
+    } else if (pragma("PRAGMA freelist_count;") > 0) {
+      // Frees a page per step, which exec() runs to the end
+      exec("PRAGMA incremental_vacuum;");
+    }
+    exec("PRAGMA optimize;");
+    if (journal_mode_ == "wal") {
+      // Also truncates the WAL file, which otherwise keeps the size of the largest transaction
+      exec("PRAGMA wal_checkpoint(TRUNCATE);");
+    }
+    const int64_t size_after = pragma("PRAGMA page_count;") * pragma("PRAGMA page_size;");
+    LOG_DEBUG << "Database maintenance done, " << size_before << " -> " << size_after << " bytes";
+  } catch (const SQLException& e) {
+    LOG_WARNING << "Database maintenance failed: " << e.what();
+    return false;
+  }
+  return true;
+}
@@ -1,6 +1,10 @@
 #ifndef SQLSTORAGE_BASE_H_
 #define SQLSTORAGE_BASE_H_
 
+#include <sys/types.h>
+#include <mutex>
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
@@ -34,12 +38,16 @@ class SQLStorageBase {
  public:
   explicit SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly, std::vector<std::string> schema_migrations,
                           std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                          int current_schema_version);
+                          int current_schema_version, std::string journal_mode = "",
+                          std::string synchronous = "");
   std::string getTableSchemaFromDb(const std::string &tablename);
   bool dbMigrateForward(int version_from, int version_to = 0);
   bool dbMigrateBackward(int version_from, int version_to = 0);
   bool dbMigrate();
   DbVersion getVersion();  // non-negative integer on success or -1 on error
+  // Returns the free pages of the file to the filesystem, checkpoints the WAL and updates the query planner
+  // statistics. Converts the file to incremental vacuum the first time, which rewrites it.
+  bool dbMaintain();
   boost::filesystem::path dbPath() const;
 
  protected:
@@ -47,15 +55,41 @@ class SQLStorageBase {
   bool readonly_{false};
 
   StorageLock lock;
-  std::shared_ptr<std::mutex> mutex_;
+  // Recursive, so that a batch of operations can hold it across calls
+  std::shared_ptr<std::recursive_mutex> mutex_;
 
   const std::vector<std::string> schema_migrations_;
   std::vector<std::string> schema_rollback_migrations_;
   const std::string current_schema_;
   const int current_schema_version_;
+  const std::string journal_mode_;
+  const std::string synchronous_;
+  // Incremented each time the connection is (re)opened
+  mutable uint64_t connection_generation_{0};
 
   SQLite3Guard dbConnection() const;
+  // For calls that only read. In WAL mode, a read does not wait while another thread holds the connection, e.g. for
+  // a write or a batch, but reads the last commit through a read-only connection of its own.
+  SQLite3Guard dbReadConnection() const;
   bool dbInsertBackMigrations(SQLite3Guard &db, int version_latest);
+
+ private:
+  void openConnection() const;
+  std::shared_ptr<SQLiteConnection> readConnection() const;
+
+  // Kept open across operations, and reopened if the database file is replaced, after a fork or after an
+  // error that a new connection may recover from
+  mutable std::shared_ptr<SQLiteConnection> connection_;
+  mutable ino_t connection_inode_{0};
+  mutable pid_t connection_pid_{0};
+
+  // Read-only connections for dbReadConnection(), in use while referenced by a guard
+  static constexpr size_t kMaxReaders{4};
+  mutable std::mutex readers_mutex_;
+  mutable std::vector<std::shared_ptr<SQLiteConnection>> readers_;
+  mutable ino_t readers_inode_{0};
+  mutable pid_t readers_pid_{0};
+  mutable bool journal_mode_checked_{false};
 };
 
 #endif  // SQLSTORAGE_BASE_H_
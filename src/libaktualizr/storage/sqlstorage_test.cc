@@ -1,8 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 #include <boost/tokenizer.hpp>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "storage/sql_utils.h"
 #include "storage/sqlstorage.h"
@@ -17,7 +25,16 @@ typedef boost::tokenizer<boost::char_separator<char> > sql_tokenizer;
 static std::map<std::string, std::string> parseSchema() {
   std::map<std::string, std::string> result;
   std::vector<std::string> tokens;
-  enum { STATE_INIT, STATE_CREATE, STATE_INSERT, STATE_TABLE, STATE_NAME, STATE_TRIGGER, STATE_TRIGGER_END };
+  enum {
+    STATE_INIT,
+    STATE_CREATE,
+    STATE_INSERT,
+    STATE_TABLE,
+    STATE_NAME,
+    STATE_TRIGGER,
+    STATE_TRIGGER_END,
+    STATE_INDEX
+  };
   boost::char_separator<char> sep(" \"\t\r\n", "(),;");
   std::string schema(libaktualizr_current_schema);
   sql_tokenizer tok(schema, sep);
@@ -47,11 +64,14 @@ static std::map<std::string, std::string> parseSchema() {
           parsing_state = STATE_TABLE;
         } else if (token == "TRIGGER") {
           parsing_state = STATE_TRIGGER;
+        } else if (token == "INDEX") {
+          parsing_state = STATE_INDEX;
         } else {
           return {};
         }
         break;
       case STATE_INSERT:
+      case STATE_INDEX:
         // do not take these into account
         if (token == ";") {
           key.clear();
@@ -203,6 +223,24 @@ TEST(sqlstorage, migrate_back) {
   EXPECT_TRUE(dbSchemaCheck(storage));
 }
 
+/* A failed migration step leaves the database at the version it started from. */
+TEST(sqlstorage, migrate_failure) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+
+  SQLStorage storage(config, false);
+  const auto ver = static_cast<int>(storage.getVersion());
+  {
+    // The last migrations can't be applied again: their indexes and columns are already there
+    SQLite3Guard db(temp_dir / "sql.db");
+    db.exec("DELETE FROM version; INSERT INTO version VALUES(" + std::to_string(ver - 2) + ");", nullptr, nullptr);
+  }
+
+  EXPECT_FALSE(storage.dbMigrate());
+  EXPECT_EQ(static_cast<int>(storage.getVersion()), ver - 2);
+}
+
 TEST(sqlstorage, rollback_to_15) {
   TemporaryDirectory temp_dir;
   StorageConfig config;
@@ -543,6 +581,452 @@ TEST(sqlstorage, store_and_load_report_events) {
   }
 }
 
+/* Report events are loaded up to a byte budget, but never less than one. */
+TEST(sqlstorage, load_report_events_max_bytes) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+
+  const Json::Value event = Utils::parseJSON(R"({"id": "some ID", "eventType": "some Event"})");
+  const auto event_size = static_cast<int64_t>(Utils::jsonToCanonicalStr(event).size());
+  for (int ii = 0; ii < 10; ++ii) {
+    storage->saveReportEvent(event);
+  }
+  int64_t max_id;
+  {
+    Json::Value events{Json::arrayValue};
+    storage->loadReportEvents(&events, &max_id, -1, 3 * event_size);
+    EXPECT_EQ(events.size(), 3);
+  }
+  {
+    Json::Value events{Json::arrayValue};
+    storage->loadReportEvents(&events, &max_id, 2, 3 * event_size);
+    EXPECT_EQ(events.size(), 2);
+  }
+  {
+    Json::Value events{Json::arrayValue};
+    storage->loadReportEvents(&events, &max_id, -1, 1);
+    EXPECT_EQ(events.size(), 1);
+  }
+}
+
+/* Commit the operations of a batch together, or roll them back. */
+TEST(sqlstorage, batch) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+
+  {
+    StorageBatch batch(*storage);
+    storage->storeDeviceId("device");
+    storage->storeEcuRegistered();
+    batch.commit();
+  }
+  std::string device_id;
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device");
+  EXPECT_TRUE(storage->loadEcuRegistered());
+
+  {
+    StorageBatch batch(*storage);
+    storage->clearDeviceId();
+    storage->clearEcuRegistered();
+    EXPECT_FALSE(storage->loadDeviceId(&device_id));
+    EXPECT_THROW(StorageBatch nested(*storage), SQLException);
+  }
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_TRUE(storage->loadEcuRegistered());
+
+  // Other connections see the committed data
+  SQLite3Guard db(config.sqldb_path.get(config.path));
+  auto statement = db.prepareStatement("SELECT device_id FROM device_info;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_str(0).value(), "device");
+}
+
+/* Use the configured journal mode. */
+TEST(sqlstorage, journal_mode) {
+  for (const std::string mode : {"wal", "delete"}) {
+    TemporaryDirectory temp_dir;
+    StorageConfig config;
+    config.path = temp_dir.Path();
+    config.sqldb_journal_mode = mode;
+    auto storage = INvStorage::newStorage(config);
+    storage->storeDeviceId("device");
+
+    SQLite3Guard db(config.sqldb_path.get(config.path));
+    auto statement = db.prepareStatement("PRAGMA journal_mode;");
+    ASSERT_EQ(statement.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_str(0).value(), mode);
+  }
+}
+
+/* Read-only storage reads the last commit while a write is in progress. */
+TEST(sqlstorage, readonly_during_write) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+  storage->storeDeviceId("device");
+
+  SQLite3Guard writer(config.sqldb_path.get(config.path));
+  writer.beginTransaction();
+  ASSERT_EQ(writer.exec("UPDATE device_info SET device_id = 'other';", nullptr, nullptr), SQLITE_OK);
+
+  auto reader = INvStorage::newStorage(config, true);
+  const auto start = std::chrono::steady_clock::now();
+  std::string device_id;
+  EXPECT_TRUE(reader->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "device");
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+  writer.commitTransaction();
+  EXPECT_TRUE(reader->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "other");
+}
+
+/* Reads on other threads do not wait for a batch, and see the last commit. */
+TEST(sqlstorage, read_during_batch) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+  storage->storeDeviceId("device");
+
+  const auto load_device_id = [&storage]() {
+    std::string device_id;
+    storage->loadDeviceId(&device_id);
+    return device_id;
+  };
+  {
+    // declared first, so that a reader that waits for the batch after all is not waited for before the batch ends
+    std::future<std::string> reader;
+    StorageBatch batch(*storage);
+    storage->storeDeviceId("other");
+    EXPECT_EQ(load_device_id(), "other");
+
+    reader = std::async(std::launch::async, load_device_id);
+    ASSERT_EQ(reader.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    EXPECT_EQ(reader.get(), "device");
+    batch.commit();
+  }
+  EXPECT_EQ(std::async(std::launch::async, load_device_id).get(), "other");
+}
+
+/* A forked child opens a connection of its own, and the parent keeps using its one. */
+TEST(sqlstorage, connection_after_fork) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+  storage->storeDeviceId("parent");
+
+  const pid_t pid = fork();
+  ASSERT_NE(pid, -1);
+  if (pid == 0) {
+    std::string device_id;
+    const bool ok = storage->loadDeviceId(&device_id) && device_id == "parent";
+    storage->storeDeviceId("child");
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+
+  std::string device_id;
+  EXPECT_TRUE(storage->loadDeviceId(&device_id));
+  EXPECT_EQ(device_id, "child");
+}
+
+/* Cached metadata follows writes from this storage and from other connections. */
+TEST(sqlstorage, metadata_cache) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+
+  std::string data;
+  EXPECT_FALSE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  storage->storeNonRoot("targets1", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets1");
+  storage->storeNonRoot("targets2", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets2");
+
+  storage->storeDelegation("delegation", Uptane::Role::Delegation("role"));
+  EXPECT_TRUE(storage->loadDelegation(&data, Uptane::Role::Delegation("role")));
+  storage->clearDelegations();
+  EXPECT_FALSE(storage->loadDelegation(&data, Uptane::Role::Delegation("role")));
+
+  // A write through another storage object is seen by this one
+  auto other = INvStorage::newStorage(config);
+  other->storeNonRoot("targets3", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets3");
+
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director());
+  EXPECT_FALSE(other->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_FALSE(storage->loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+}
+
+/* Cached ECUs follow writes from this storage and from other connections. */
+TEST(sqlstorage, ecu_cache) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+  const Uptane::EcuSerial primary("primary");
+  const Uptane::EcuSerial secondary("secondary");
+
+  EcuSerials serials;
+  EXPECT_FALSE(storage->loadEcuSerials(&serials));
+  storage->storeEcuSerials({{primary, Uptane::HardwareIdentifier("primary_hw")},
+                            {secondary, Uptane::HardwareIdentifier("secondary_hw")}});
+  ASSERT_TRUE(storage->loadEcuSerials(&serials));
+  ASSERT_EQ(serials.size(), 2);
+  EXPECT_EQ(serials[1].first, secondary);
+
+  SecondaryInfo info;
+  EXPECT_TRUE(storage->loadSecondaryInfo(secondary, &info));
+  EXPECT_EQ(info.type, "");
+  EXPECT_FALSE(storage->loadSecondaryInfo(primary, &info));
+  storage->saveSecondaryInfo(secondary, "IP", PublicKey("key", KeyType::kED25519));
+  ASSERT_TRUE(storage->loadSecondaryInfo(secondary, &info));
+  EXPECT_EQ(info.type, "IP");
+  EXPECT_EQ(info.hw_id, Uptane::HardwareIdentifier("secondary_hw"));
+  storage->saveSecondaryData(secondary, "data");
+  std::vector<SecondaryInfo> secondaries;
+  ASSERT_TRUE(storage->loadSecondariesInfo(&secondaries));
+  ASSERT_EQ(secondaries.size(), 1);
+  EXPECT_EQ(secondaries[0].extra, "data");
+
+  // A write through another storage object is seen by this one
+  auto other = INvStorage::newStorage(config);
+  other->storeEcuSerials({{primary, Uptane::HardwareIdentifier("primary_hw")},
+                          {Uptane::EcuSerial("other"), Uptane::HardwareIdentifier("other_hw")}});
+  ASSERT_TRUE(storage->loadEcuSerials(&serials));
+  EXPECT_EQ(serials[1].first, Uptane::EcuSerial("other"));
+  EXPECT_FALSE(storage->loadSecondaryInfo(secondary, &info));
+
+  storage->clearEcuSerials();
+  EXPECT_FALSE(storage->loadEcuSerials(&serials));
+  EXPECT_FALSE(other->loadSecondariesInfo(&secondaries));
+}
+
+/* The installed state generation changes with the installed versions and the
+ * ECUs, also when they are written through other connections, but not with
+ * the metadata. */
+TEST(sqlstorage, installed_state_generation) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+
+  const uint64_t initial = storage->installedStateGeneration();
+  EXPECT_EQ(storage->installedStateGeneration(), initial);
+  storage->storeNonRoot("targets", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_EQ(storage->installedStateGeneration(), initial);
+
+  const Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const Uptane::Target target{"update.bin", primary_ecu, {Hash{Hash::Type::kSha256, "2561"}}, 1};
+  storage->savePrimaryInstalledVersion(target, InstalledVersionUpdateMode::kCurrent, "corrid");
+  const uint64_t installed = storage->installedStateGeneration();
+  EXPECT_NE(installed, initial);
+
+  auto other = INvStorage::newStorage(config);
+  other->storeEcuSerials({{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}});
+  EXPECT_NE(storage->installedStateGeneration(), installed);
+}
+
+/* Large metadata is kept in files named after their hash, and only while in use. */
+TEST(sqlstorage, metadata_blobs) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_blob_threshold = 16;
+  const boost::filesystem::path blobs = config.sqldb_blob_path.get(config.path);
+  const std::string large1 = "{\"signed\": \"large targets 1\"}";
+  const std::string large2 = "{\"signed\": \"large targets 2\"}";
+  const auto count_blobs = [&blobs]() {
+    return std::distance(boost::filesystem::directory_iterator(blobs), boost::filesystem::directory_iterator());
+  };
+  {
+    auto storage = INvStorage::newStorage(config);
+    storage->storeNonRoot(large1, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    EXPECT_TRUE(boost::filesystem::exists(blobs / Crypto::sha256digestHex(large1)));
+    storage->storeNonRoot(large2, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    EXPECT_FALSE(boost::filesystem::exists(blobs / Crypto::sha256digestHex(large1)));
+    EXPECT_TRUE(boost::filesystem::exists(blobs / Crypto::sha256digestHex(large2)));
+    storage->storeNonRoot("{}", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+    storage->storeDelegation(large1, Uptane::Role::Delegation("role"));
+    EXPECT_EQ(count_blobs(), 2);
+
+    // A rolled back batch leaves no blob behind
+    {
+      StorageBatch batch(*storage);
+      storage->storeDelegation("{\"signed\": \"rolled back\"}", Uptane::Role::Delegation("other"));
+    }
+    EXPECT_EQ(count_blobs(), 2);
+  }
+
+  SQLite3Guard db(config.sqldb_path.get(config.path));
+  auto statement = db.prepareStatement("SELECT length(meta), meta_file FROM meta WHERE meta_type = 2 ORDER BY repo;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 2);
+  EXPECT_EQ(statement.get_result_col_str(1).value(), "");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 0);
+  EXPECT_EQ(statement.get_result_col_str(1).value(), Crypto::sha256digestHex(large2));
+
+  auto storage = INvStorage::newStorage(config, true);
+  std::string data;
+  EXPECT_TRUE(storage->loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, large2);
+  EXPECT_TRUE(storage->loadDelegation(&data, Uptane::Role::Delegation("role")));
+  EXPECT_EQ(data, large1);
+  std::vector<std::pair<Uptane::Role, std::string>> delegations;
+  EXPECT_TRUE(storage->loadAllDelegations(delegations));
+  ASSERT_EQ(delegations.size(), 1);
+  EXPECT_EQ(delegations[0].second, large1);
+}
+
+/* Metadata files can be compressed, and are read whatever the setting. */
+TEST(sqlstorage, metadata_blobs_compressed) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_blob_threshold = 16;
+  config.sqldb_blob_compress = true;
+  const std::string large = "{\"signed\": \"" + std::string(4096, 't') + "\"}";
+  const boost::filesystem::path blob =
+      config.sqldb_blob_path.get(config.path) / (Crypto::sha256digestHex(large) + ".z");
+  INvStorage::newStorage(config)->storeNonRoot(large, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  ASSERT_TRUE(boost::filesystem::exists(blob));
+  EXPECT_LT(boost::filesystem::file_size(blob), large.size() / 10);
+
+  config.sqldb_blob_compress = false;
+  std::string data;
+  EXPECT_TRUE(
+      INvStorage::newStorage(config)->loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, large);
+}
+
+/* A reader of another storage instance reads the metadata again when a write removes the blob it was about to read,
+ * and gives up after a few attempts on a blob that stays missing. */
+TEST(sqlstorage, metadata_blobs_concurrent_write) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_blob_threshold = 16;
+  const std::string large1 = "{\"signed\": \"large targets 1\"}";
+  const std::string large2 = "{\"signed\": \"large targets 2\"}";
+  auto writer = INvStorage::newStorage(config);
+  writer->storeNonRoot(large1, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  writer->storeDelegation(large1, Uptane::Role::Delegation("role"));
+  auto reader = INvStorage::newStorage(config, true);
+
+  std::atomic<bool> stop{false};
+  std::thread writes([&]() {
+    for (int i = 0; !stop; ++i) {
+      const std::string& data = i % 2 == 0 ? large2 : large1;
+      writer->storeNonRoot(data, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+      writer->storeDelegation(data, Uptane::Role::Delegation("role"));
+    }
+  });
+  for (int i = 0; i < 200; ++i) {
+    std::string data;
+    EXPECT_TRUE(reader->loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+    EXPECT_TRUE(data == large1 || data == large2);
+    std::vector<std::pair<Uptane::Role, std::string>> delegations;
+    EXPECT_TRUE(reader->loadAllDelegations(delegations));
+    EXPECT_EQ(delegations.size(), 1U);
+  }
+  stop = true;
+  writes.join();
+
+  // A row naming a blob that is gone for good
+  {
+    SQLite3Guard db(config.sqldb_path.get(config.path));
+    EXPECT_EQ(db.exec("UPDATE meta SET meta_file = 'missing' WHERE meta_file != '';", nullptr, nullptr), SQLITE_OK);
+  }
+  std::string data;
+  EXPECT_FALSE(reader->loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+}
+
+/* Metadata already in the database is moved to files in the background when it is large enough. */
+TEST(sqlstorage, metadata_blobs_migration) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_blob_threshold = 0;
+  const std::string large = "{\"signed\": \"large targets\"}";
+  const boost::filesystem::path blob = config.sqldb_blob_path.get(config.path) / Crypto::sha256digestHex(large);
+  INvStorage::newStorage(config)->storeNonRoot(large, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  INvStorage::newStorage(config)->storeRoot(large, Uptane::RepositoryType::Image(), Uptane::Version(1));
+  EXPECT_FALSE(boost::filesystem::exists(blob));
+
+  config.sqldb_blob_threshold = 16;
+  SQLStorage storage(config, false);
+  storage.waitForMetaMove();
+  EXPECT_TRUE(boost::filesystem::exists(blob));
+  std::string data;
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, large);
+
+  // Root metadata stays in the database
+  SQLite3Guard db(config.sqldb_path.get(config.path));
+  auto statement = db.prepareStatement("SELECT meta_file FROM meta WHERE meta_type = 0;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_str(0).value(), "");
+}
+
+/* Free pages are returned to the filesystem while idle, and databases without
+ * incremental vacuum are converted once. */
+TEST(sqlstorage, idle_maintenance) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_blob_threshold = 0;
+  const boost::filesystem::path db_path = config.sqldb_path.get(config.path);
+  const boost::filesystem::path stamp = db_path.string() + ".maintenance";
+  const auto pragma = [&db_path](const std::string& sql) {
+    SQLite3Guard db(db_path);
+    auto statement = db.prepareStatement(sql);
+    EXPECT_EQ(statement.step(), SQLITE_ROW);
+    return statement.get_result_col_int(0);
+  };
+
+  {
+    auto storage = INvStorage::newStorage(config);
+    EXPECT_EQ(pragma("PRAGMA auto_vacuum;"), 2);
+    storage->storeNonRoot(std::string(1024 * 1024, 'x'), Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    storage->storeNonRoot("{}", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    EXPECT_GT(pragma("PRAGMA freelist_count;"), 0);
+    storage->idleMaintenance();
+    EXPECT_EQ(pragma("PRAGMA freelist_count;"), 0);
+    EXPECT_TRUE(boost::filesystem::exists(stamp));
+  }
+
+  {
+    SQLite3Guard db(db_path);
+    EXPECT_EQ(db.exec("PRAGMA auto_vacuum = NONE; VACUUM;", nullptr, nullptr), SQLITE_OK);
+  }
+  EXPECT_EQ(pragma("PRAGMA auto_vacuum;"), 0);
+  {
+    // Not due yet
+    auto storage = INvStorage::newStorage(config);
+    storage->idleMaintenance();
+    EXPECT_EQ(pragma("PRAGMA auto_vacuum;"), 0);
+    boost::filesystem::remove(stamp);
+    storage->idleMaintenance();
+    EXPECT_EQ(pragma("PRAGMA auto_vacuum;"), 2);
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -222,6 +222,25 @@ TEST(StorageCommon, LoadStoreDeviceId) {
   EXPECT_FALSE(storage->loadDeviceId(nullptr));
 }
 
+/* Load and store the campaign list with its validators. */
+TEST(StorageCommon, LoadStoreCampaigns) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  EXPECT_FALSE(storage->loadCampaigns(nullptr, nullptr, nullptr));
+
+  storage->storeCampaigns("{\"campaigns\": []}", "\"v1\"", "");
+  storage->storeCampaigns("{\"campaigns\": [1]}", "\"v2\"", "Wed, 21 Oct 2015 07:28:00 GMT");
+
+  std::string campaigns;
+  std::string etag;
+  std::string last_modified;
+  EXPECT_TRUE(storage->loadCampaigns(&campaigns, &etag, &last_modified));
+  EXPECT_EQ(campaigns, "{\"campaigns\": [1]}");
+  EXPECT_EQ(etag, "\"v2\"");
+  EXPECT_EQ(last_modified, "Wed, 21 Oct 2015 07:28:00 GMT");
+}
+
 /* Load and store ECU serials.
  * Preserve ECU ordering between store and load calls.
  */
@@ -398,6 +417,21 @@ TEST(StorageCommon, LoadStoreInstalledVersions) {
     EXPECT_EQ(log.size(), 4);
     EXPECT_EQ(log.back().filename(), "update3.bin");
     EXPECT_EQ(log[0].custom_data()["foo"], "bar");
+
+    // Pages of the same log
+    std::vector<Uptane::Target> page;
+    EXPECT_TRUE(storage->loadInstallationLogPage("primary", &page, true, 1, 2));
+    ASSERT_EQ(page.size(), 2);
+    EXPECT_EQ(page[0].filename(), log[1].filename());
+    EXPECT_EQ(page[1].filename(), log[2].filename());
+    EXPECT_TRUE(storage->loadInstallationLogPage("primary", &page, true, 3, -1));
+    ASSERT_EQ(page.size(), 1);
+    EXPECT_EQ(page[0].filename(), "update3.bin");
+    EXPECT_TRUE(storage->loadInstallationLogPage("primary", &page, true, 4, 10));
+    EXPECT_TRUE(page.empty());
+    // Including the versions that were only pending
+    EXPECT_TRUE(storage->loadInstallationLogPage("primary", &page, false, 0, -1));
+    EXPECT_EQ(page.size(), 6);
   }
 
   // Add a Secondary installed version
@@ -463,6 +497,32 @@ TEST(StorageCommon, LoadStoreInstallationResults) {
       "This call will return a negative value since the installation report was cleaned!"));
 }
 
+/* The install journal only answers for the Target it was saved with. */
+TEST(StorageCommon, LoadStoreInstallStage) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  const Uptane::EcuSerial secondary("secondary_1");
+  Uptane::EcuMap ecus{{secondary, Uptane::HardwareIdentifier("secondary_hw")}};
+  Uptane::Target t1{"update.bin", ecus, {Hash{Hash::Type::kSha256, "2561"}}, 1};
+  Uptane::Target t2{"update.bin", ecus, {Hash{Hash::Type::kSha256, "2562"}}, 1};
+
+  EXPECT_EQ(storage->loadInstallStage(secondary, t1), InstallStage::kNone);
+  storage->saveInstallStage(secondary, t1, InstallStage::kFirmwareSent);
+  EXPECT_EQ(storage->loadInstallStage(secondary, t1), InstallStage::kFirmwareSent);
+  EXPECT_EQ(storage->loadInstallStage(Uptane::EcuSerial("secondary_2"), t1), InstallStage::kNone);
+  EXPECT_EQ(storage->loadInstallStage(secondary, t2), InstallStage::kNone);
+
+  storage->saveInstallStage(secondary, t1, InstallStage::kInstalled);
+  EXPECT_EQ(storage->loadInstallStage(secondary, t1), InstallStage::kInstalled);
+  storage->saveInstallStage(secondary, t2, InstallStage::kFirmwareSent);
+  EXPECT_EQ(storage->loadInstallStage(secondary, t1), InstallStage::kNone);
+  EXPECT_EQ(storage->loadInstallStage(secondary, t2), InstallStage::kFirmwareSent);
+
+  storage->clearInstallJournal();
+  EXPECT_EQ(storage->loadInstallStage(secondary, t2), InstallStage::kNone);
+}
+
 TEST(StorageCommon, DownloadedFilesInfo) {
   TemporaryDirectory temp_dir;
   std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
@@ -481,6 +541,27 @@ TEST(StorageCommon, DownloadedFilesInfo) {
   names = storage->getAllTargetNames();
   ASSERT_EQ(names.size(), 1);
   ASSERT_EQ(names.at(0), "target2");
+
+  TargetFileVerification verification;
+  EXPECT_FALSE(storage->loadTargetVerification("target2", &verification));
+  verification.real_size = 42;
+  verification.sha256 = "ab12";
+  verification.mtime = 1234567890123456789;
+  verification.ctime = 1234567890123456790;
+  verification.inode = 7;
+  storage->storeTargetVerification("target2", verification);
+  TargetFileVerification loaded;
+  ASSERT_TRUE(storage->loadTargetVerification("target2", &loaded));
+  EXPECT_EQ(loaded.real_size, 42);
+  EXPECT_EQ(loaded.sha256, "ab12");
+  EXPECT_EQ(loaded.sha512, "");
+  EXPECT_EQ(loaded.mtime, verification.mtime);
+  EXPECT_EQ(loaded.ctime, verification.ctime);
+  EXPECT_EQ(loaded.inode, 7);
+
+  // A new download of the target clears the verification
+  storage->storeTargetFilename("target2", "file2");
+  EXPECT_FALSE(storage->loadTargetVerification("target2", &loaded));
 }
 
 TEST(StorageCommon, LoadStoreSecondaryInfo) {
@@ -5,6 +5,16 @@ void StorageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
   CopyFromConfig(type, "type", pt);
   CopyFromConfig(path, "path", pt);
   CopyFromConfig(sqldb_path, "sqldb_path", pt);
+  CopyFromConfig(sqldb_journal_mode, "sqldb_journal_mode", pt);
+  CopyFromConfig(sqldb_synchronous, "sqldb_synchronous", pt);
+  CopyFromConfig(sqldb_cache, "sqldb_cache", pt);
+  CopyFromConfig(sqldb_blob_threshold, "sqldb_blob_threshold", pt);
+  CopyFromConfig(sqldb_blob_path, "sqldb_blob_path", pt);
+  CopyFromConfig(sqldb_blob_compress, "sqldb_blob_compress", pt);
+  CopyFromConfig(sqldb_maintenance_interval_sec, "sqldb_maintenance_interval_sec", pt);
+  CopyFromConfig(report_journal_path, "report_journal_path", pt);
+  CopyFromConfig(report_events_max, "report_events_max", pt);
+  CopyFromConfig(report_events_max_bytes, "report_events_max_bytes", pt);
   CopyFromConfig(uptane_metadata_path, "uptane_metadata_path", pt);
   CopyFromConfig(uptane_private_key_path, "uptane_private_key_path", pt);
   CopyFromConfig(uptane_public_key_path, "uptane_public_key_path", pt);
@@ -17,6 +27,16 @@ void StorageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, type, "type");
   writeOption(out_stream, path, "path");
   writeOption(out_stream, sqldb_path.get(""), "sqldb_path");
+  writeOption(out_stream, sqldb_journal_mode, "sqldb_journal_mode");
+  writeOption(out_stream, sqldb_synchronous, "sqldb_synchronous");
+  writeOption(out_stream, sqldb_cache, "sqldb_cache");
+  writeOption(out_stream, sqldb_blob_threshold, "sqldb_blob_threshold");
+  writeOption(out_stream, sqldb_blob_path.get(""), "sqldb_blob_path");
+  writeOption(out_stream, sqldb_blob_compress, "sqldb_blob_compress");
+  writeOption(out_stream, sqldb_maintenance_interval_sec, "sqldb_maintenance_interval_sec");
+  writeOption(out_stream, report_journal_path.get(""), "report_journal_path");
+  writeOption(out_stream, report_events_max, "report_events_max");
+  writeOption(out_stream, report_events_max_bytes, "report_events_max_bytes");
   writeOption(out_stream, uptane_metadata_path.get(""), "uptane_metadata_path");
   writeOption(out_stream, uptane_private_key_path.get(""), "uptane_private_key_path");
   writeOption(out_stream, uptane_public_key_path.get(""), "uptane_public_key_path");
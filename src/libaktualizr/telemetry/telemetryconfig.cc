@@ -5,9 +5,21 @@
 void TelemetryConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(report_network, "report_network", pt);
   CopyFromConfig(report_config, "report_config", pt);
+  CopyFromConfig(report_metrics, "report_metrics", pt);
+  CopyFromConfig(report_performance, "report_performance", pt);
+  CopyFromConfig(metrics_file, "metrics_file", pt);
+  CopyFromConfig(hw_info_source, "hw_info_source", pt);
+  CopyFromConfig(hw_info_fields, "hw_info_fields", pt);
+  CopyFromConfig(hw_info_lshw_fallback, "hw_info_lshw_fallback", pt);
 }
 
 void TelemetryConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, report_network, "report_network");
   writeOption(out_stream, report_config, "report_config");
+  writeOption(out_stream, report_metrics, "report_metrics");
+  writeOption(out_stream, report_performance, "report_performance");
+  writeOption(out_stream, metrics_file, "metrics_file");
+  writeOption(out_stream, hw_info_source, "hw_info_source");
+  writeOption(out_stream, hw_info_fields, "hw_info_fields");
+  writeOption(out_stream, hw_info_lshw_fallback, "hw_info_lshw_fallback");
 }
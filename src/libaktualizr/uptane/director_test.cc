@@ -1,8 +1,18 @@
 #include <gtest/gtest.h>
 
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
 #include "directorrepository.h"
+#include "fetcher.h"
+#include "imagerepository.h"
 #include "logging/logging.h"
+#include "repomirror.h"
+#include "storage/invstorage.h"
 #include "test_utils.h"
+#include "uptane/exceptions.h"
 #include "utilities/utils.h"
 
 boost::filesystem::path uptane_generator_path;
@@ -45,6 +55,296 @@ TEST(Director, EmptyTargets) {
   EXPECT_EQ(director.getCorrelationId(), "cid2");
 }
 
+/*
+ * Verify that unchanged Targets metadata is not parsed again, unless the Root
+ * it was verified with has changed.
+ */
+TEST(Director, VerifiedTargetsReused) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory other_meta_dir;
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  uptane_gen.run({"generate", "--path", other_meta_dir.PathString(), "--correlationid", "cid1"});
+  const std::string targets_raw = Utils::readFile(meta_dir.Path() / "repo/director/targets.json");
+
+  DirectorRepository director;
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR),
+                    Utils::readFile(meta_dir.Path() / "repo/director/root.json"));
+  EXPECT_NO_THROW(director.verifyTargets(targets_raw));
+  const auto verified = director.verified_targets_.meta;
+  ASSERT_NE(verified, nullptr);
+  EXPECT_NO_THROW(director.verifyTargets(targets_raw));
+  EXPECT_EQ(director.verified_targets_.meta, verified);
+
+  // Signed with keys the other Root does not trust
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR),
+                    Utils::readFile(other_meta_dir.Path() / "repo/director/root.json"));
+  EXPECT_THROW(director.verifyTargets(targets_raw), Uptane::Exception);
+}
+
+/*
+ * Verify that the Root is only verified against itself again when it changed.
+ */
+TEST(Director, VerifiedRootReused) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory other_meta_dir;
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  uptane_gen.run({"generate", "--path", other_meta_dir.PathString(), "--correlationid", "cid1"});
+  const std::string root_raw = Utils::readFile(meta_dir.Path() / "repo/director/root.json");
+
+  DirectorRepository director;
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR), root_raw);
+  const auto verified = director.verified_root_.meta;
+  ASSERT_NE(verified, nullptr);
+  director.resetMeta();
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR), root_raw);
+  EXPECT_EQ(director.verified_root_.meta, verified);
+  EXPECT_NO_THROW(director.verifyTargets(Utils::readFile(meta_dir.Path() / "repo/director/targets.json")));
+
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR),
+                    Utils::readFile(other_meta_dir.Path() / "repo/director/root.json"));
+  EXPECT_NE(director.verified_root_.meta, verified);
+  EXPECT_THROW(director.verifyTargets(Utils::readFile(meta_dir.Path() / "repo/director/targets.json")),
+               Uptane::Exception);
+}
+
+/* Serves the metadata written by uptane-generator, and counts the requests. */
+class DirectoryFetcher : public IMetadataFetcher {
+ public:
+  explicit DirectoryFetcher(boost::filesystem::path path) : path_(std::move(path)) {}
+  void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role, Version version,
+                 const api::FlowControlToken* flow_control) const override {
+    (void)maxsize;
+    (void)flow_control;
+    ++fetches;
+    const auto file = path_ / version.RoleFileName(role);
+    if (!boost::filesystem::exists(file)) {
+      throw Uptane::MetadataFetchFailure(repo.ToString(), role.ToString());
+    }
+    *result = Utils::readFile(file);
+  }
+
+  mutable int fetches{0};
+
+ private:
+  boost::filesystem::path path_;
+};
+
+/*
+ * Verify that unchanged Director Targets are recognized with a single request,
+ * and that changed ones are not fetched twice.
+ */
+TEST(Director, UnchangedTargets) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory storage_dir;
+  StorageConfig storage_config;
+  storage_config.path = storage_dir.Path();
+  auto storage = INvStorage::newStorage(storage_config);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  DirectoryFetcher fetcher(meta_dir.Path() / "repo/director");
+
+  DirectorRepository director;
+  // Nothing has been checked yet
+  EXPECT_FALSE(director.checkMetaUnchanged(*storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.fetches, 1);
+  // Root 1, Root 2 (missing) and the Targets fetched above
+  director.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(fetcher.fetches, 3);
+
+  EXPECT_TRUE(director.checkMetaUnchanged(*storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.fetches, 4);
+  EXPECT_TRUE(director.getTargets().targets.empty());
+
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename", "tests/test_data/firmware.txt",
+                  "--targetname", "firmware.txt", "--hwid", "primary_hw"});
+  uptane_gen.run({"addtarget", "--path", meta_dir.PathString(), "--targetname", "firmware.txt", "--hwid", "primary_hw",
+                  "--serial", "CA:FE:A6:D2:84:9D"});
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+
+  EXPECT_FALSE(director.checkMetaUnchanged(*storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.fetches, 5);
+  director.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(fetcher.fetches, 6);
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  EXPECT_TRUE(director.checkMetaUnchanged(*storage, fetcher, nullptr));
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  // Dropped Targets are checked in full again
+  director.dropTargets(*storage);
+  EXPECT_FALSE(director.checkMetaUnchanged(*storage, fetcher, nullptr));
+}
+
+/* Serves all Root metadata newer than a version in one request. */
+class ChainFetcher : public DirectoryFetcher {
+ public:
+  explicit ChainFetcher(boost::filesystem::path path) : DirectoryFetcher(path), path_(std::move(path)) {}
+  bool fetchRootChain(std::vector<std::string>* roots, RepositoryType repo, int version) const override {
+    (void)repo;
+    ++chain_fetches;
+    roots->clear();
+    for (auto file = path_ / Version(++version).RoleFileName(Role::Root()); boost::filesystem::exists(file);
+         file = path_ / Version(++version).RoleFileName(Role::Root())) {
+      roots->push_back(Utils::readFile(file));
+    }
+    return true;
+  }
+
+  mutable int chain_fetches{0};
+
+ private:
+  boost::filesystem::path path_;
+};
+
+/*
+ * Verify that several Root rotations are caught up with in a single request
+ * when the server offers the whole chain, and that a broken chain is rejected.
+ */
+TEST(Director, RootChain) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory storage_dir;
+  StorageConfig storage_config;
+  storage_config.path = storage_dir.Path();
+  auto storage = INvStorage::newStorage(storage_config);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  ChainFetcher fetcher(meta_dir.Path() / "repo/director");
+
+  DirectorRepository director;
+  director.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(director.rootVersion(), 1);
+  EXPECT_EQ(fetcher.chain_fetches, 1);
+
+  for (int i = 0; i < 3; ++i) {
+    uptane_gen.run({"rotate", "--path", meta_dir.PathString(), "--repotype", "director", "--keytype", "ED25519"});
+  }
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+  const int fetches = fetcher.fetches;
+  director.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(director.rootVersion(), 4);
+  EXPECT_EQ(fetcher.chain_fetches, 2);
+  // Only the Targets
+  EXPECT_EQ(fetcher.fetches, fetches + 1);
+
+  std::string root;
+  EXPECT_TRUE(storage->loadLatestRoot(&root, RepositoryType::Director()));
+  EXPECT_EQ(Utils::parseJSON(root)["signed"]["version"].asInt(), 4);
+
+  // A chain with a version missing does not verify
+  uptane_gen.run({"rotate", "--path", meta_dir.PathString(), "--repotype", "director", "--keytype", "ED25519"});
+  uptane_gen.run({"rotate", "--path", meta_dir.PathString(), "--repotype", "director", "--keytype", "ED25519"});
+  boost::filesystem::copy_file(meta_dir.Path() / "repo/director/6.root.json",
+                               meta_dir.Path() / "repo/director/5.root.json",
+                               boost::filesystem::copy_option::overwrite_if_exists);
+  EXPECT_THROW(director.updateMeta(*storage, fetcher, nullptr), Uptane::Exception);
+  EXPECT_TRUE(storage->loadLatestRoot(&root, RepositoryType::Director()));
+  EXPECT_EQ(Utils::parseJSON(root)["signed"]["version"].asInt(), 4);
+}
+
+/*
+ * Verify that Director Targets are matched with Image repo Targets, including
+ * those in delegations if they can be loaded.
+ */
+TEST(Director, MatchImageTargets) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory images_dir;
+  Utils::writeFile(images_dir.Path() / "primary.txt", std::string("primary"));
+  Utils::writeFile(images_dir.Path() / "secondary.txt", std::string("secondary"));
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  uptane_gen.run({"adddelegation", "--path", meta_dir.PathString(), "--dname", "new-role", "--dpattern", "abc/*",
+                  "--keytype", "ed25519"});
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename", (images_dir.Path() / "primary.txt").string(),
+                  "--targetname", "primary.txt", "--hwid", "primary_hw"});
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename",
+                  (images_dir.Path() / "secondary.txt").string(), "--targetname", "abc/secondary.txt", "--dname",
+                  "new-role", "--hwid", "secondary_hw"});
+  uptane_gen.run({"addtarget", "--path", meta_dir.PathString(), "--targetname", "primary.txt", "--hwid", "primary_hw",
+                  "--serial", "CA:FE:A6:D2:84:9D"});
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+
+  DirectorRepository director;
+  director.initRoot(Uptane::RepositoryType(Uptane::RepositoryType::DIRECTOR),
+                    Utils::readFile(meta_dir.Path() / "repo/director/root.json"));
+  director.verifyTargets(Utils::readFile(meta_dir.Path() / "repo/director/targets.json"));
+  const auto image_targets =
+      std::make_shared<const Targets>(Utils::parseJSONFile(meta_dir.Path() / "repo/image/targets.json"));
+  EXPECT_FALSE(director.matchTargetsWithImageTargets(nullptr));
+  EXPECT_TRUE(director.matchTargetsWithImageTargets(image_targets));
+
+  // Only in the delegation
+  uptane_gen.run({"addtarget", "--path", meta_dir.PathString(), "--targetname", "abc/secondary.txt", "--hwid",
+                  "secondary_hw", "--serial", "secondary_ecu_serial"});
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+  director.verifyTargets(Utils::readFile(meta_dir.Path() / "repo/director/targets.json"));
+  EXPECT_FALSE(director.matchTargetsWithImageTargets(image_targets));
+
+  int loads = 0;
+  auto load_delegation = [&meta_dir, &loads](const Role& role,
+                                             const Targets& parent) -> std::shared_ptr<const Targets> {
+    ++loads;
+    return ImageRepository::verifyDelegation(
+        Utils::readFile(meta_dir.Path() / "repo/image/delegations" / (role.ToString() + ".json")), role, parent);
+  };
+  EXPECT_TRUE(director.matchTargetsWithImageTargets(image_targets, load_delegation));
+  // Not for primary.txt, which does not match the path of the delegation
+  EXPECT_EQ(loads, 1);
+
+  auto no_delegation = [](const Role& role, const Targets& parent) -> std::shared_ptr<const Targets> {
+    (void)role;
+    (void)parent;
+    return nullptr;
+  };
+  EXPECT_FALSE(director.matchTargetsWithImageTargets(image_targets, no_delegation));
+}
+
+/*
+ * Verify that the Image repo metadata put into a mirror can be used like the
+ * Image repo itself, and that targets can not be put outside of it.
+ */
+TEST(RepoMirror, ServesVerifiedMetadata) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory storage_dir;
+  TemporaryDirectory mirror_dir;
+  StorageConfig storage_config;
+  storage_config.path = storage_dir.Path() / "gateway";
+  auto storage = INvStorage::newStorage(storage_config);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename", "tests/test_data/firmware.txt",
+                  "--targetname", "firmware.txt", "--hwid", "primary_hw"});
+
+  ImageRepository image;
+  image.updateMeta(*storage, DirectoryFetcher(meta_dir.Path() / "repo/repo"), nullptr);
+  RepoMirror mirror(mirror_dir.Path());
+  mirror.storeMetadata(*storage);
+
+  storage_config.path = storage_dir.Path() / "device";
+  auto device_storage = INvStorage::newStorage(storage_config);
+  ImageRepository device_image;
+  EXPECT_NO_THROW(device_image.updateMeta(*device_storage, DirectoryFetcher(mirror_dir.Path()), nullptr));
+  ASSERT_NE(device_image.getTargets(), nullptr);
+  EXPECT_NE(device_image.getTargets()->findTarget("firmware.txt"), nullptr);
+
+  Json::Value target_json;
+  target_json["length"] = 4;
+  target_json["hashes"]["sha256"] = Crypto::sha256digestHex("test");
+  std::istringstream content("test");
+  mirror.storeTarget(Target("../escape.txt", target_json), content);
+  EXPECT_FALSE(boost::filesystem::exists(mirror_dir.Path() / "escape.txt"));
+  std::istringstream content2("test");
+  mirror.storeTarget(Target("dir/firmware.bin", target_json), content2);
+  EXPECT_EQ(Utils::readFile(mirror_dir.Path() / "targets/dir/firmware.bin"), "test");
+}
+
 }  // namespace Uptane
 
 #ifndef __NO_MAIN__
@@ -1,11 +1,16 @@
 #include "directorrepository.h"
 
+#include "crypto/crypto.h"
 #include "fetcher.h"
+#include "imagerepository.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
+#include "utilities/json_reader.h"
 #include "utilities/utils.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 namespace Uptane {
@@ -31,7 +36,7 @@ void DirectorRepository::checkTargetsExpired(UpdateType utype) {
 void DirectorRepository::targetsSanityCheck(UpdateType utype) {
   //  5.4.4.6.6. If checking Targets metadata from the Director repository,
   //  verify that there are no delegations.
-  if (!targets.delegated_role_names_.empty()) {
+  if (targets.delegationCount() != 0) {
     if (utype == UpdateType::kOffline) {
       throw Uptane::InvalidMetadata(type.ToString(), Role::OFFLINEUPDATES, "Found unexpected delegation.");
     } else {
@@ -60,9 +65,13 @@ void DirectorRepository::targetsSanityCheck(UpdateType utype) {
 
 void DirectorRepository::verifyTargets(const std::string& targets_raw) {
   try {
-    // Verify the signature:
-    targets = Targets(RepositoryType::Director(), Role::Targets(), Utils::parseJSON(targets_raw),
-                      std::make_shared<MetaWithKeys>(root));
+    Json::Value targets_json;
+    if (!findVerified(targets_raw, &verified_targets_, &targets_json)) {
+      // Verify the signature:
+      setVerified(&verified_targets_, std::make_shared<Targets>(RepositoryType::Director(), Role::Targets(),
+                                                                targets_json, std::make_shared<MetaWithKeys>(root)));
+    }
+    targets = *verified_targets_.meta;
     correlation_id_ = targets.correlation_id();
   } catch (const Uptane::Exception& e) {
     LOG_ERROR << "Signature verification for Director Targets metadata failed";
@@ -70,21 +79,23 @@ void DirectorRepository::verifyTargets(const std::string& targets_raw) {
   }
 }
 
-void DirectorRepository::checkMetaOffline(INvStorage& storage) {
-  resetMeta();
-  // Load Director Root Metadata
-  {
-    std::string director_root;
-    if (!storage.loadLatestRoot(&director_root, RepositoryType::Director())) {
-      throw Uptane::SecurityException(RepositoryType::DIRECTOR, "Could not load latest root");
-    }
+void DirectorRepository::loadStoredRoot(INvStorage& storage) {
+  std::string director_root;
+  if (!storage.loadLatestRoot(&director_root, RepositoryType::Director())) {
+    throw Uptane::SecurityException(RepositoryType::DIRECTOR, "Could not load latest root");
+  }
 
-    initRoot(RepositoryType(RepositoryType::DIRECTOR), director_root);
+  initRoot(RepositoryType(RepositoryType::DIRECTOR), director_root);
 
-    if (rootExpired()) {
-      throw Uptane::ExpiredMetadata(RepositoryType::DIRECTOR, Role::ROOT);
-    }
+  if (rootExpired()) {
+    throw Uptane::ExpiredMetadata(RepositoryType::DIRECTOR, Role::ROOT);
   }
+}
+
+void DirectorRepository::checkMetaOffline(INvStorage& storage) {
+  resetMeta();
+  // Load Director Root Metadata
+  loadStoredRoot(storage);
 
   // Load Director Targets Metadata
   {
@@ -107,6 +118,11 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
   // Uptane step 2 (download time) is not implemented yet.
   // Uptane step 3 (download metadata)
 
+  std::string director_targets = std::move(prefetched_targets_);
+  prefetched_targets_.clear();
+  accepted_targets_.clear();
+  accepted_targets_hash_.clear();
+
   // reset Director repo to initial state before starting Uptane iteration
   resetMeta();
 
@@ -118,10 +134,10 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
 
   // Update Director Targets Metadata
   {
-    std::string director_targets;
-
-    fetcher.fetchLatestRole(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(), Role::Targets(),
-                            flow_control);
+    if (director_targets.empty()) {
+      fetcher.fetchLatestRole(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(), Role::Targets(),
+                              flow_control);
+    }
     int remote_version = extractVersionUntrusted(director_targets);
 
     int local_version;
@@ -151,11 +167,40 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
     checkTargetsExpired(UpdateType::kOnline);
 
     targetsSanityCheck(UpdateType::kOnline);
+    accepted_targets_hash_ = Crypto::sha256digestHex(director_targets);
+    accepted_targets_ = std::move(director_targets);
+  }
+}
+
+bool DirectorRepository::checkMetaUnchanged(INvStorage& storage, const IMetadataFetcher& fetcher,
+                                            const api::FlowControlToken* flow_control) {
+  prefetched_targets_.clear();
+  std::string director_targets;
+  fetcher.fetchLatestRole(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(), Role::Targets(),
+                          flow_control);
+  if (accepted_targets_.empty() || director_targets != accepted_targets_) {
+    prefetched_targets_ = std::move(director_targets);
+    return false;
+  }
+
+  try {
+    resetMeta();
+    loadStoredRoot(storage);
+    verifyTargets(director_targets);
+    checkTargetsExpired(UpdateType::kOnline);
+    targetsSanityCheck(UpdateType::kOnline);
+  } catch (const std::exception& e) {
+    LOG_DEBUG << "Unchanged Director Targets metadata needs a full check: " << e.what();
+    prefetched_targets_ = std::move(director_targets);
+    return false;
   }
+  return true;
 }
 
 void DirectorRepository::dropTargets(INvStorage& storage) {
   try {
+    accepted_targets_.clear();
+    accepted_targets_hash_.clear();
     storage.clearNonRootMeta(RepositoryType::Director());
     resetMeta();
   } catch (const Uptane::Exception& ex) {
@@ -163,31 +208,47 @@ void DirectorRepository::dropTargets(INvStorage& storage) {
   }
 }
 
-bool DirectorRepository::matchTargetsWithImageTargets(
-    const std::shared_ptr<const Uptane::Targets>& image_targets) const {
+namespace {
+// NOLINTNEXTLINE(misc-no-recursion)
+bool findMatchingImageTarget(const Target& director_target, const Targets& image_targets, int level, bool terminating,
+                             const DirectorRepository::DelegationLoader& load_delegation) {
+  const Target* found = image_targets.findTarget(director_target.filename());
+  if (found != nullptr && director_target.MatchTarget(*found)) {
+    return true;
+  }
+  if (!load_delegation || terminating || level >= kDelegationsMaxDepth) {
+    return false;
+  }
+
+  for (const auto& role : image_targets.delegationsForPath(director_target.filename())) {
+    const auto delegation = load_delegation(role, image_targets);
+    if (delegation == nullptr || delegation->isExpired(TimeStamp::Now())) {
+      continue;
+    }
+    const bool is_terminating = image_targets.delegationTerminates(role);
+    // NOLINTNEXTLINE(misc-no-recursion)
+    if (findMatchingImageTarget(director_target, *delegation, level + 1, is_terminating, load_delegation)) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+bool DirectorRepository::matchTargetsWithImageTargets(const std::shared_ptr<const Uptane::Targets>& image_targets,
+                                                      const DelegationLoader& load_delegation) const {
   // step 10 of https://uptane.github.io/papers/ieee-isto-6100.1.0.0.uptane-standard.html#rfc.section.5.4.4.2
-  // TODO(OTA-4800): support delegations. Consider reusing findTargetInDelegationTree(),
-  // but it would need to be moved into a common place to be resued by Primary and Secondary.
   // Currently this is only used by aktualizr-secondary, but according to the
   // Standard, "A Secondary ECU MAY elect to perform this check only on the
   // metadata for the image it will install".
   if (image_targets == nullptr) {
     return false;
   }
-  const auto& image_target_array = image_targets->targets;
-  const auto& director_target_array = targets.targets;
-
-  for (const auto& director_target : director_target_array) {
-    auto found_it = std::find_if(
-        image_target_array.begin(), image_target_array.end(),
-        [&director_target](const Target& image_target) { return director_target.MatchTarget(image_target); });
-
-    if (found_it == image_target_array.end()) {
-      return false;
-    }
-  }
 
-  return true;
+  return std::all_of(targets.targets.begin(), targets.targets.end(),
+                     [&image_targets, &load_delegation](const Target& director_target) {
+                       return findMatchingImageTarget(director_target, *image_targets, 0, false, load_delegation);
+                     });
 }
 
 #ifdef BUILD_OFFLINE_UPDATES
@@ -262,16 +323,12 @@ void DirectorRepository::updateMetaOffUpd(INvStorage& storage, const OfflineUpda
   // PURE-2 step 3(iv)
   checkOfflineSnapshotExpired();
 
-  // TODO: [OFFUPD] This access to the file here may need a review when this method is called for a secondary.
   // Update Director Offline Updates(Targets) Metadata
   // PURE-2 step 4
-  boost::filesystem::path offline_target_file;
   Version offline_snapshot_version = Version(-1);
   std::string offline_target_name;
   for (const auto& role_name : offline_snapshot_.role_names()) {
-    std::string filename = role_name + ".json";
-    offline_target_file = fetcher.getMetadataPath() / "director" / filename;
-    if (boost::filesystem::exists(offline_target_file)) {
+    if (fetcher.hasMetadataFile(RepositoryType::Director(), role_name + ".json")) {
       Role role(role_name, !Role::IsReserved(role_name));
       offline_snapshot_version = Version(offline_snapshot_.role_version(role));
       offline_target_name = role_name;
@@ -319,15 +376,15 @@ void DirectorRepository::verifyOfflineSnapshot(const std::string& snapshot_raw_n
   // PURE-2 step 3(ii)
   try {
     offline_snapshot_ = Snapshot(RepositoryType::Image(), Uptane::Role::OfflineSnapshot(),
-                                 Utils::parseJSON(snapshot_raw_new), std::make_shared<MetaWithKeys>(root));
+                                 JsonReader::parse(snapshot_raw_new), std::make_shared<MetaWithKeys>(root));
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for Offline Snapshot metadata failed";
     throw;
   }
 
   // PURE-2 step 3(iii)
-  Json::Value target_list_new = Utils::parseJSON(snapshot_raw_new)["signed"]["meta"];
-  Json::Value target_list_old = Utils::parseJSON(snapshot_raw_old)["signed"]["meta"];
+  Json::Value target_list_new = JsonReader::parse(snapshot_raw_new)["signed"]["meta"];
+  Json::Value target_list_old = JsonReader::parse(snapshot_raw_old)["signed"]["meta"];
   if (target_list_old.isObject()) {
     for (auto next = target_list_new.begin(); next != target_list_new.end(); ++next) {
       for (auto old = target_list_old.begin(); old != target_list_old.end(); ++old) {
@@ -351,7 +408,7 @@ void DirectorRepository::checkOfflineSnapshotExpired() {
 void DirectorRepository::verifyOfflineTargets(const std::string& targets_raw, INvStorage& storage) {
   // PURE-2 step 4(ii)
   try {
-    targets = Targets(RepositoryType::Director(), Role::OfflineUpdates(), Utils::parseJSON(targets_raw),
+    targets = Targets(RepositoryType::Director(), Role::OfflineUpdates(), JsonReader::parse(targets_raw),
                       std::make_shared<MetaWithKeys>(root));
     transformOfflineTargets(storage);
   } catch (const Uptane::Exception& e) {
@@ -384,6 +441,7 @@ void DirectorRepository::transformOfflineTargets(INvStorage& storage) {
       }
     }
   }
+  targets.reindex();
 }
 #endif
 
@@ -1,6 +1,9 @@
 #ifndef DIRECTOR_REPOSITORY_H_
 #define DIRECTOR_REPOSITORY_H_
 
+#include <functional>
+#include <memory>
+
 #include "gtest/gtest_prod.h"
 
 #include "uptanerepository.h"
@@ -21,12 +24,30 @@ class DirectorRepository : public RepositoryCommon {
     return targets.getTargets(ecu_id, hw_id);
   }
   Uptane::CorrelationId getCorrelationId() const { return correlation_id_; }
+  // SHA256 of the Director Targets accepted by the last successful updateMeta(), empty if there are none
+  const std::string& acceptedTargetsHash() const { return accepted_targets_hash_; }
   void checkMetaOffline(INvStorage& storage);
   void dropTargets(INvStorage& storage);
 
   void updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
                   const api::FlowControlToken* flow_control) override;
-  bool matchTargetsWithImageTargets(const std::shared_ptr<const Uptane::Targets>& image_targets) const;
+  /**
+   * Fetch only the latest Director Targets metadata. If it is the same as on
+   * the last successful updateMeta(), verify it again with the stored Root and
+   * return true. Otherwise return false: updateMeta() then has to be run, and
+   * uses the Targets fetched here.
+   */
+  bool checkMetaUnchanged(INvStorage& storage, const IMetadataFetcher& fetcher,
+                          const api::FlowControlToken* flow_control);
+  // Verified delegated Targets of the Image repo for a role delegated by `parent`, or nullptr if they are not available
+  using DelegationLoader = std::function<std::shared_ptr<const Targets>(const Role& role, const Targets& parent)>;
+  /**
+   * Check that every Director Target is in the Image repo Targets. They are
+   * looked up by filename in the index of each Targets, and in the delegations
+   * whose paths match it if `load_delegation` is set.
+   */
+  bool matchTargetsWithImageTargets(const std::shared_ptr<const Uptane::Targets>& image_targets,
+                                    const DelegationLoader& load_delegation = DelegationLoader()) const;
 
 #ifdef BUILD_OFFLINE_UPDATES
   void checkMetaOfflineOffUpd(INvStorage& storage);
@@ -41,12 +62,23 @@ class DirectorRepository : public RepositoryCommon {
 
  private:
   FRIEND_TEST(Director, EmptyTargets);
+  FRIEND_TEST(Director, VerifiedRootReused);
+  FRIEND_TEST(Director, VerifiedTargetsReused);
+  FRIEND_TEST(Director, UnchangedTargets);
 
   void resetMeta();
+  void loadStoredRoot(INvStorage& storage);
   void checkTargetsExpired(UpdateType utype);
   void targetsSanityCheck(UpdateType utype);
 
   Uptane::Targets targets;
+  // Kept across resetMeta(), so that Targets which have not changed are not parsed again
+  VerifiedMeta<Uptane::Targets> verified_targets_;
+  // The Director Targets of the last successful updateMeta()
+  std::string accepted_targets_;
+  std::string accepted_targets_hash_;
+  // Fetched by checkMetaUnchanged() for the updateMeta() that follows
+  std::string prefetched_targets_;
   /**
    * The correlation id of the currently running update.
    * This is set when the targets are first downloaded from the server, and
@@ -1,61 +1,206 @@
 #include "fetcher.h"
 
+#include "crypto/crypto.h"
+#include "storage/invstorage.h"
 #include "uptane/exceptions.h"
+#include "utilities/utils.h"
 
 #include <boost/filesystem.hpp>
-#include <fstream>
 
 namespace Uptane {
 
-void Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
-                        Version version, const api::FlowControlToken* flow_control) const {
-  std::string url = (repo == RepositoryType::Director()) ? director_server : repo_server;
+namespace {
+std::string roleUrl(std::string url, const Uptane::Role& role, Version version) {
   if (role.IsDelegation()) {
     url += "/delegations";
   }
-  url += "/" + version.RoleFileName(role);
-  HttpResponse response = http->get(url, maxsize, flow_control);
+  return url + "/" + version.RoleFileName(role);
+}
+}  // namespace
+
+void Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                        Version version, const api::FlowControlToken* flow_control) const {
+  if (repo == RepositoryType::Image() && !repo_mirror_.empty() &&
+      fetchFromMirror(result, maxsize, role, version, flow_control)) {
+    return;
+  }
+  const std::string url = roleUrl((repo == RepositoryType::Director()) ? director_server : repo_server, role, version);
+
+  // Only the latest version of a role can change
+  if (storage == nullptr || version != Version()) {
+    HttpResponse response = http->get(url, maxsize, flow_control);
+    if (version == Version()) {
+      notePollHint(response);
+    }
+    if (flow_control != nullptr && flow_control->hasAborted()) {
+      throw Uptane::LocallyAborted(repo);
+    }
+    if (!response.isOk()) {
+      throw Uptane::MetadataFetchFailure(repo.ToString(), role.ToString());
+    }
+
+    *result = std::move(response.body);
+    return;
+  }
+
+  std::string stored;
+  HttpValidators validators;
+  const bool have_stored = loadStored(&stored, repo, role, &validators);
+  HttpResponse response = http->getConditional(url, maxsize, &validators, flow_control);
+  notePollHint(response);
   if (flow_control != nullptr && flow_control->hasAborted()) {
     throw Uptane::LocallyAborted(repo);
   }
+  if (response.isNotModified()) {
+    if (!have_stored) {
+      throw Uptane::MetadataFetchFailure(repo.ToString(), role.ToString());
+    }
+    LOG_DEBUG << repo << " " << role << " metadata not modified, using the stored copy";
+    *result = std::move(stored);
+    return;
+  }
   if (!response.isOk()) {
     throw Uptane::MetadataFetchFailure(repo.ToString(), role.ToString());
   }
 
-  *result = response.body;
+  *result = std::move(response.body);
+  // The validators are only used once this exact metadata has been verified and stored
+  if (!validators.empty()) {
+    storage->storeMetaValidators(repo, role, validators.etag, validators.last_modified,
+                                 Crypto::sha256digestHex(*result));
+  }
+}
+
+// The mirror is a plain copy of the Image repo, e.g. on a gateway in the same
+// network. Anything it does not have comes from the Image repo itself; what it
+// has is verified like metadata from the Image repo.
+bool Fetcher::fetchFromMirror(std::string* result, int64_t maxsize, const Uptane::Role& role, Version version,
+                              const api::FlowControlToken* flow_control) const {
+  HttpResponse response = http->get(roleUrl(repo_mirror_, role, version), maxsize, flow_control);
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    throw Uptane::LocallyAborted(RepositoryType::IMAGE);
+  }
+  if (!response.isOk()) {
+    LOG_DEBUG << role << " metadata is not available from the Image repo mirror: " << response.getStatusStr();
+    return false;
+  }
+  *result = std::move(response.body);
+  return true;
+}
+
+// The server answers GET <repo>/root-chain?since=N with a JSON array of the
+// Root metadata of versions N+1 to the latest, or with an error if it does not
+// support that.
+bool Fetcher::fetchRootChain(std::vector<std::string>* roots, RepositoryType repo, int version) const {
+  if (!root_chain_) {
+    return false;
+  }
+  const std::string url = ((repo == RepositoryType::Director()) ? director_server : repo_server) +
+                          "/root-chain?since=" + std::to_string(version);
+  const HttpResponse response = http->get(url, kMaxRootChainSize, nullptr);
+  if (!response.isOk()) {
+    LOG_DEBUG << "No " << repo << " Root metadata chain available, fetching it one version at a time";
+    return false;
+  }
+  Json::Value chain;
+  try {
+    chain = Utils::parseJSON(response.body);
+  } catch (const std::exception& e) {
+    chain = Json::nullValue;
+  }
+  if (!chain.isArray()) {
+    LOG_WARNING << "Invalid " << repo << " Root metadata chain, fetching it one version at a time";
+    return false;
+  }
+  roots->clear();
+  for (const auto& root : chain) {
+    roots->push_back(Utils::jsonToCanonicalStr(root));
+  }
+  return true;
+}
+
+// Only the answers for the latest version of a role say anything about when to
+// poll again; numbered versions never change and may be cached for long.
+void Fetcher::notePollHint(const HttpResponse& response) const {
+  int64_t hint = poll_hint_sec_.load();
+  while (response.retry_after_sec > hint && !poll_hint_sec_.compare_exchange_weak(hint, response.retry_after_sec)) {
+  }
+}
+
+bool Fetcher::loadStored(std::string* result, RepositoryType repo, const Uptane::Role& role,
+                         HttpValidators* validators) const {
+  const bool found =
+      role.IsDelegation() ? storage->loadDelegation(result, role) : storage->loadNonRoot(result, repo, role);
+  std::string meta_sha256;
+  if (!found || !storage->loadMetaValidators(repo, role, &validators->etag, &validators->last_modified, &meta_sha256) ||
+      meta_sha256 != Crypto::sha256digestHex(*result)) {
+    *validators = HttpValidators();
+    return false;
+  }
+  return true;
+}
+
+boost::filesystem::path OfflineUpdateFetcher::repoMetadataPath(RepositoryType repo) const {
+  return getMetadataPath() / (repo == RepositoryType::Director() ? "director" : "image-repo");
+}
+
+OfflineUpdateFetcher::MetadataIndex& OfflineUpdateFetcher::index(RepositoryType repo) const {
+  auto it = indexes_.find(repo.ToString());
+  if (it != indexes_.end()) {
+    return it->second;
+  }
+  MetadataIndex& index = indexes_[repo.ToString()];
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator entry(repoMetadataPath(repo), ec), end; !ec && entry != end;
+       entry.increment(ec)) {
+    if (boost::filesystem::is_regular_file(entry->status())) {
+      const uintmax_t size = boost::filesystem::file_size(entry->path(), ec);
+      if (!ec) {
+        index.sizes.emplace(entry->path().filename().string(), size);
+      }
+      ec.clear();
+    }
+  }
+  LOG_DEBUG << "Found " << index.sizes.size() << " " << repo << " metadata files in " << repoMetadataPath(repo);
+  return index;
+}
+
+bool OfflineUpdateFetcher::hasMetadataFile(RepositoryType repo, const std::string& filename) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return index(repo).sizes.count(filename) != 0;
 }
 
 void OfflineUpdateFetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo,
                                      const Uptane::Role& role, Version version,
                                      const api::FlowControlToken* flow_control) const {
   (void)flow_control;  // Safe, we are only looking at the local file system
-  boost::filesystem::path path;
-  if (repo == RepositoryType::Director()) {
-    path = getMetadataPath() / "director" / version.RoleFileName(role);
-  } else {
-    path = getMetadataPath() / "image-repo" / version.RoleFileName(role);
-  }
+  const std::string filename = version.RoleFileName(role);
+  const boost::filesystem::path path = repoMetadataPath(repo) / filename;
 
-  boost::system::error_code ec;
-  if (!boost::filesystem::exists(path, ec)) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  MetadataIndex& metadata = index(repo);
+  const auto size = metadata.sizes.find(filename);
+  if (size == metadata.sizes.end() || size->second > static_cast<uintmax_t>(maxsize)) {
     throw Uptane::MetadataFetchFailure(repo.ToString(), path.string());
   }
 
-  std::ifstream file_input(path.c_str());
-  file_input.seekg(0, std::ifstream::end);
-  int64_t file_size = file_input.tellg();
-  // [OFFUPD] We may need improvements here especially for unreliable media like NFS:
-  // - Maybe throw a better error;
-  // - Handle the case where tellg() returns -1;
-  // - Handle the case where an error happens during read() (if (!file_input)).
-  if (file_size > maxsize) {
+  auto content = metadata.contents.find(filename);
+  if (content == metadata.contents.end()) {
+    std::string data;
+    try {
+      data = Utils::readFile(path);
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Could not read " << path << ": " << e.what();
+      throw Uptane::MetadataFetchFailure(repo.ToString(), path.string());
+    }
+    // The file may have changed since it was listed
+    if (data.size() > static_cast<size_t>(maxsize)) {
+      throw Uptane::MetadataFetchFailure(repo.ToString(), path.string());
+    }
+    content = metadata.contents.emplace(filename, std::move(data)).first;
+  } else if (content->second.size() > static_cast<size_t>(maxsize)) {
     throw Uptane::MetadataFetchFailure(repo.ToString(), path.string());
   }
-
-  file_input.seekg(0, std::ifstream::beg);
-  std::vector<char> buffer(static_cast<size_t>(file_size));
-
-  file_input.read(buffer.data(), file_size);
-  *result = std::string(buffer.begin(), buffer.end());
+  *result = content->second;
 }
 }  // namespace Uptane
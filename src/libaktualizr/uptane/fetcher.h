@@ -1,6 +1,12 @@
 #ifndef UPTANE_FETCHER_H_
 #define UPTANE_FETCHER_H_
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 
 #include "http/httpinterface.h"
@@ -8,9 +14,12 @@
 #include "tuf.h"
 #include "utilities/flow_control.h"
 
+class INvStorage;
+
 namespace Uptane {
 
 constexpr int64_t kMaxRootSize = 64 * 1024;
+constexpr int64_t kMaxRootChainSize = 64 * kMaxRootSize;
 constexpr int64_t kMaxDirectorTargetsSize = 64 * 1024;
 constexpr int64_t kMaxTimestampSize = 64 * 1024;
 constexpr int64_t kMaxSnapshotSize = 64 * 1024;
@@ -49,30 +58,90 @@ class IMetadataFetcher {
     fetchRole(result, maxsize, repo, role, Version(), flow_control);
   }
 
+  /**
+   * Fetch all Root metadata newer than `version` at once, in version order.
+   *
+   * Returns false if that is not supported, and the Root metadata has to be
+   * fetched one version at a time.
+   */
+  virtual bool fetchRootChain(std::vector<std::string>* roots, RepositoryType repo, int version) const {
+    (void)roots;
+    (void)repo;
+    (void)version;
+    return false;
+  }
+
  protected:
   IMetadataFetcher() = default;
   IMetadataFetcher(IMetadataFetcher&&) = default;
 };
 
+/**
+ * Fetches metadata from the Director and Image repository servers.
+ *
+ * Given a storage, the latest version of a role is requested conditionally,
+ * with the cache validators of the stored copy. When the server answers that
+ * the role has not changed, the stored copy is returned instead.
+ */
 class Fetcher : public IMetadataFetcher {
  public:
-  Fetcher(const Config& config_in, std::shared_ptr<HttpInterface> http_in)
-      : Fetcher(config_in.uptane.repo_server, config_in.uptane.director_server, std::move(http_in)) {}
-  Fetcher(std::string repo_server_in, std::string director_server_in, std::shared_ptr<HttpInterface> http_in)
+  Fetcher(const Config& config_in, std::shared_ptr<HttpInterface> http_in,
+          std::shared_ptr<INvStorage> storage_in = nullptr)
+      : Fetcher(config_in.uptane.repo_server, config_in.uptane.director_server, std::move(http_in),
+                std::move(storage_in)) {
+    root_chain_ = config_in.uptane.fetch_root_chain;
+    repo_mirror_ = config_in.uptane.repo_mirror_url;
+  }
+  Fetcher(std::string repo_server_in, std::string director_server_in, std::shared_ptr<HttpInterface> http_in,
+          std::shared_ptr<INvStorage> storage_in = nullptr)
       : http(std::move(http_in)),
+        storage(std::move(storage_in)),
         repo_server(std::move(repo_server_in)),
         director_server(std::move(director_server_in)) {}
   void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role, Version version,
                  const api::FlowControlToken* flow_control) const override;
+  bool fetchRootChain(std::vector<std::string>* roots, RepositoryType repo, int version) const override;
 
   std::string getRepoServer() const { return repo_server; }
+  // Mirror of the Image repo that is tried first, or empty
+  std::string getRepoMirror() const { return repo_mirror_; }
+  // A fetcher like this one that goes to the Image repo directly, e.g. when what the mirror had failed verification
+  std::unique_ptr<Fetcher> withoutMirror() const {
+    auto fetcher = std::unique_ptr<Fetcher>(new Fetcher(repo_server, director_server, http, storage));
+    fetcher->root_chain_ = root_chain_;
+    return fetcher;
+  }
+
+  /**
+   * The longest interval until the next poll that the servers asked for
+   * since the last call, in seconds, or -1 if they did not ask for any.
+   */
+  int64_t takePollHint() const { return poll_hint_sec_.exchange(-1); }
 
  private:
+  void notePollHint(const HttpResponse& response) const;
+  bool fetchFromMirror(std::string* result, int64_t maxsize, const Uptane::Role& role, Version version,
+                       const api::FlowControlToken* flow_control) const;
+
+  bool loadStored(std::string* result, RepositoryType repo, const Uptane::Role& role,
+                  HttpValidators* validators) const;
+
   std::shared_ptr<HttpInterface> http;
+  std::shared_ptr<INvStorage> storage;
   std::string repo_server;
   std::string director_server;
+  mutable std::atomic<int64_t> poll_hint_sec_{-1};
+  bool root_chain_{false};
+  std::string repo_mirror_;
 };
 
+/**
+ * Fetches metadata from the lockbox of an offline update.
+ *
+ * The metadata directories of the lockbox are listed once, and every file is
+ * read at most once, as the same roles are requested several times in an
+ * update and the lockbox is usually on slow removable media.
+ */
 class OfflineUpdateFetcher : public IMetadataFetcher {
  public:
   explicit OfflineUpdateFetcher(boost::filesystem::path source_path) : source_path_(std::move(source_path)) {
@@ -87,8 +156,22 @@ class OfflineUpdateFetcher : public IMetadataFetcher {
   boost::filesystem::path getImagesPath() const { return source_path_ / "images"; }
   boost::filesystem::path getMetadataPath() const { return source_path_ / "metadata"; }
 
+  /** Whether the lockbox has a metadata file `filename`, e.g. "1.root.json", for `repo`. */
+  bool hasMetadataFile(RepositoryType repo, const std::string& filename) const;
+
  private:
+  struct MetadataIndex {
+    std::map<std::string, uintmax_t> sizes;
+    std::map<std::string, std::string> contents;
+  };
+
+  boost::filesystem::path repoMetadataPath(RepositoryType repo) const;
+  // Called with mutex_ held
+  MetadataIndex& index(RepositoryType repo) const;
+
   boost::filesystem::path source_path_;
+  mutable std::mutex mutex_;
+  mutable std::map<std::string, MetadataIndex> indexes_;
 };
 
 }  // namespace Uptane
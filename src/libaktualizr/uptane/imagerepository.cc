@@ -5,6 +5,7 @@
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
+#include "utilities/json_reader.h"
 
 namespace Uptane {
 
@@ -17,9 +18,13 @@ void ImageRepository::resetMeta() {
 
 void ImageRepository::verifyTimestamp(const std::string& timestamp_raw) {
   try {
-    // Verify the signature:
-    timestamp =
-        TimestampMeta(RepositoryType::Image(), Utils::parseJSON(timestamp_raw), std::make_shared<MetaWithKeys>(root));
+    Json::Value timestamp_json;
+    if (!findVerified(timestamp_raw, &verified_timestamp_, &timestamp_json)) {
+      // Verify the signature:
+      setVerified(&verified_timestamp_, std::make_shared<TimestampMeta>(RepositoryType::Image(), timestamp_json,
+                                                                        std::make_shared<MetaWithKeys>(root)));
+    }
+    timestamp = *verified_timestamp_.meta;
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for Timestamp metadata failed";
     throw;
@@ -33,10 +38,28 @@ void ImageRepository::checkTimestampExpired() {
 }
 
 void ImageRepository::fetchSnapshot(INvStorage& storage, const IMetadataFetcher& fetcher, const int local_version,
-                                    const api::FlowControlToken* flow_control) {
+                                    const api::FlowControlToken* flow_control,
+                                    std::future<std::string>* speculative) {
   std::string image_snapshot;
   const int64_t snapshot_size = (snapshotSize() > 0) ? snapshotSize() : kMaxSnapshotSize;
-  fetcher.fetchLatestRole(&image_snapshot, snapshot_size, RepositoryType::Image(), Role::Snapshot(), flow_control);
+  bool fetched = false;
+  if (speculative != nullptr) {
+    // It was requested before the Timestamp was known, and may be older if the repo changed in between
+    try {
+      image_snapshot = speculative->get();
+      if (static_cast<int64_t>(image_snapshot.size()) <= snapshot_size) {
+        verifySnapshot(image_snapshot, true);
+        fetched = true;
+      }
+    } catch (const Uptane::LocallyAborted&) {
+      throw;
+    } catch (const std::exception& e) {
+      LOG_DEBUG << "Image repo Snapshot requested with the Timestamp can not be used: " << e.what();
+    }
+  }
+  if (!fetched) {
+    fetcher.fetchLatestRole(&image_snapshot, snapshot_size, RepositoryType::Image(), Role::Snapshot(), flow_control);
+  }
   const int remote_version = extractVersionUntrusted(image_snapshot);
 
   // 6. Check that each Targets metadata filename listed in the previous Snapshot metadata file is also listed in this
@@ -55,12 +78,13 @@ void ImageRepository::fetchSnapshot(INvStorage& storage, const IMetadataFetcher&
 }
 
 void ImageRepository::verifySnapshot(const std::string& snapshot_raw, bool prefetch) {
-  const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(snapshot_raw));
+  Json::Value snapshot_json;
+  const bool verified = findVerified(snapshot_raw, &verified_snapshot_, &snapshot_json);
   bool hash_exists = false;
   for (const auto& it : timestamp.snapshot_hashes()) {
     switch (it.type()) {
       case Hash::Type::kSha256:
-        if (Hash(Hash::Type::kSha256, Crypto::sha256digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha256, verified_snapshot_.canonical_sha256) != it) {
           if (!prefetch) {
             LOG_ERROR << "Hash verification for Snapshot metadata failed";
           }
@@ -69,7 +93,7 @@ void ImageRepository::verifySnapshot(const std::string& snapshot_raw, bool prefe
         hash_exists = true;
         break;
       case Hash::Type::kSha512:
-        if (Hash(Hash::Type::kSha512, Crypto::sha512digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha512, verified_snapshot_.canonical_sha512) != it) {
           if (!prefetch) {
             LOG_ERROR << "Hash verification for Snapshot metadata failed";
           }
@@ -87,14 +111,18 @@ void ImageRepository::verifySnapshot(const std::string& snapshot_raw, bool prefe
     throw Uptane::SecurityException(RepositoryType::IMAGE, "Snapshot metadata hash verification failed");
   }
 
-  try {
-    // Verify the signature:
-    snapshot = Snapshot(RepositoryType::Image(), Uptane::Role::Snapshot(), Utils::parseJSON(snapshot_raw),
-                        std::make_shared<MetaWithKeys>(root));
-  } catch (const Exception& e) {
-    LOG_ERROR << "Signature verification for Snapshot metadata failed";
-    throw;
+  if (!verified) {
+    try {
+      // Verify the signature:
+      setVerified(&verified_snapshot_,
+                  std::make_shared<Snapshot>(RepositoryType::Image(), Uptane::Role::Snapshot(), snapshot_json,
+                                             std::make_shared<MetaWithKeys>(root)));
+    } catch (const Exception& e) {
+      LOG_ERROR << "Signature verification for Snapshot metadata failed";
+      throw;
+    }
   }
+  snapshot = *verified_snapshot_.meta;
 
   if (snapshot.version() != timestamp.snapshot_version()) {
     throw Uptane::VersionMismatch(RepositoryType::IMAGE, Uptane::Role::SNAPSHOT);
@@ -119,9 +147,10 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 
   fetcher.fetchLatestRole(&image_targets, targets_size, RepositoryType::Image(), targets_role, flow_control);
 
-  const int remote_version = extractVersionUntrusted(image_targets);
-
+  // The version is taken from the verified metadata: parsing all of it once more only for the version would double
+  // the work on large Targets metadata
   verifyTargets(image_targets, false);
+  const int remote_version = targets->version();
 
   if (local_version > remote_version) {
     throw Uptane::SecurityException(RepositoryType::IMAGE, "Rollback attempt");
@@ -131,13 +160,18 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 }
 
 void ImageRepository::verifyRoleHashes(const std::string& role_data, const Uptane::Role& role, bool prefetch) const {
-  const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(role_data));
+  const std::string canonical = Utils::jsonToCanonicalStr(JsonReader::parse(role_data));
+  checkRoleHashes(Crypto::sha256digestHex(canonical), Crypto::sha512digestHex(canonical), role, prefetch);
+}
+
+void ImageRepository::checkRoleHashes(const std::string& sha256, const std::string& sha512, const Uptane::Role& role,
+                                      bool prefetch) const {
   // Hashes are not required in snapshot metadata. If present, however, we may as well check them.
   // This provides no security benefit, but may help with fault detection.
   for (const auto& it : snapshot.role_hashes(role)) {
     switch (it.type()) {
       case Hash::Type::kSha256:
-        if (Hash(Hash::Type::kSha256, Crypto::sha256digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha256, sha256) != it) {
           // If prefetch is true, it means we're checking a local copy of the metadata.
           // Failures in that case just indicate we need to refresh it from the server, so
           // we only actually log the error if the metadata comes directly from the server.
@@ -149,7 +183,7 @@ void ImageRepository::verifyRoleHashes(const std::string& role_data, const Uptan
         }
         break;
       case Hash::Type::kSha512:
-        if (Hash(Hash::Type::kSha512, Crypto::sha512digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha512, sha512) != it) {
           if (!prefetch) {
             LOG_ERROR << "Hash verification for " << role << " metadata failed";
           }
@@ -169,16 +203,21 @@ int64_t ImageRepository::getRoleSize(const Uptane::Role& role) const { return sn
 
 void ImageRepository::verifyTargets(const std::string& targets_raw, bool prefetch) {
   try {
-    // Checking hashes not required by PURE-2 but does not hurt to check
-    verifyRoleHashes(targets_raw, Uptane::Role::Targets(), prefetch);
-
-    auto targets_json = Utils::parseJSON(targets_raw);
+    Json::Value targets_json;
+    const bool verified = findVerified(targets_raw, &verified_targets_, &targets_json);
 
-    // Verify the signature:
-    // PURE-2 step 8(iii.a)
-    auto signer = std::make_shared<MetaWithKeys>(root);
-    targets = std::make_shared<Uptane::Targets>(
-        Targets(RepositoryType::Image(), Uptane::Role::Targets(), targets_json, signer));
+    // Checking hashes not required by PURE-2 but does not hurt to check
+    checkRoleHashes(verified_targets_.canonical_sha256, verified_targets_.canonical_sha512, Uptane::Role::Targets(),
+                    prefetch);
+
+    if (!verified) {
+      // Verify the signature:
+      // PURE-2 step 8(iii.a)
+      auto signer = std::make_shared<MetaWithKeys>(root);
+      setVerified(&verified_targets_, std::make_shared<Uptane::Targets>(RepositoryType::Image(),
+                                                                        Uptane::Role::Targets(), targets_json, signer));
+    }
+    targets = verified_targets_.meta;
 
     // PURE-2 step 8(ii)
     if (targets->version() != snapshot.role_version(Uptane::Role::Targets())) {
@@ -198,7 +237,7 @@ std::shared_ptr<Uptane::Targets> ImageRepository::verifyDelegation(const std::st
                                                                    const Uptane::Role& role,
                                                                    const Targets& parent_target) {
   try {
-    const Json::Value delegation_json = Utils::parseJSON(delegation_raw);
+    const Json::Value delegation_json = JsonReader::parse(delegation_raw);
     const std::string canonical = Utils::jsonToCanonicalStr(delegation_json);
 
     // Verify the signature:
@@ -223,6 +262,15 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
                                  const api::FlowControlToken* flow_control) {
   resetMeta();
 
+  std::future<std::string> speculative_snapshot;
+  if (speculative_snapshot_) {
+    speculative_snapshot = std::async(std::launch::async, [&fetcher, flow_control]() {
+      std::string data;
+      fetcher.fetchLatestRole(&data, kMaxSnapshotSize, RepositoryType::Image(), Role::Snapshot(), flow_control);
+      return data;
+    });
+  }
+
   updateRoot(storage, fetcher, RepositoryType::Image());
 
   // Update Image repo Timestamp metadata
@@ -278,7 +326,8 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
 
     // If we don't, attempt to fetch the latest.
     if (fetch_snapshot) {
-      fetchSnapshot(storage, fetcher, local_version, flow_control);
+      fetchSnapshot(storage, fetcher, local_version, flow_control,
+                    speculative_snapshot.valid() ? &speculative_snapshot : nullptr);
     }
 
     checkSnapshotExpired();
@@ -469,7 +518,7 @@ void ImageRepository::updateMetaOffUpd(INvStorage& storage, const OfflineUpdateF
 void ImageRepository::verifySnapshotOffline(const std::string& snapshot_raw) {
   // PURE-2 step 7(ii)
   try {
-    snapshot = Snapshot(RepositoryType::Image(), Uptane::Role::Snapshot(), Utils::parseJSON(snapshot_raw),
+    snapshot = Snapshot(RepositoryType::Image(), Uptane::Role::Snapshot(), JsonReader::parse(snapshot_raw),
                         std::make_shared<MetaWithKeys>(root));
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for Snapshot metadata failed";
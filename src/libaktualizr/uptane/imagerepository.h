@@ -1,6 +1,7 @@
 #ifndef IMAGE_REPOSITORY_H_
 #define IMAGE_REPOSITORY_H_
 
+#include <future>
 #include <memory>
 #include <string>
 
@@ -28,8 +29,14 @@ class ImageRepository : public RepositoryCommon {
 
   void verifyRoleHashes(const std::string& role_data, const Uptane::Role& role, bool prefetch) const;
   int getRoleVersion(const Uptane::Role& role) const;
+  // Changes with the Targets and with any of the delegations
+  int getSnapshotVersion() const { return snapshot.version(); }
   int64_t getRoleSize(const Uptane::Role& role) const;
 
+  // Request the latest Snapshot together with the Timestamp in updateMeta(). It is dropped if the Timestamp shows
+  // that the stored Snapshot is still current.
+  void setSpeculativeSnapshot(bool enabled) { speculative_snapshot_ = enabled; }
+
   void checkMetaOffline(INvStorage& storage);
   void updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
                   const api::FlowControlToken* flow_control) override;
@@ -45,14 +52,22 @@ class ImageRepository : public RepositoryCommon {
   void checkSnapshotExpired();
   int64_t snapshotSize() const { return timestamp.snapshot_size(); }
   void fetchSnapshot(INvStorage& storage, const IMetadataFetcher& fetcher, int local_version,
-                     const api::FlowControlToken* flow_control);
+                     const api::FlowControlToken* flow_control, std::future<std::string>* speculative = nullptr);
   void fetchTargets(INvStorage& storage, const IMetadataFetcher& fetcher, int local_version,
                     const api::FlowControlToken* flow_control);
   void checkTargetsExpired();
+  void checkRoleHashes(const std::string& sha256, const std::string& sha512, const Uptane::Role& role,
+                       bool prefetch) const;
 
   std::shared_ptr<Uptane::Targets> targets;
   Uptane::TimestampMeta timestamp;
   Uptane::Snapshot snapshot;
+
+  // Kept across resetMeta(), so that metadata which has not changed is not parsed again
+  VerifiedMeta<Uptane::TimestampMeta> verified_timestamp_;
+  VerifiedMeta<Uptane::Snapshot> verified_snapshot_;
+  VerifiedMeta<Uptane::Targets> verified_targets_;
+  bool speculative_snapshot_{false};
 };
 
 }  // namespace Uptane
@@ -1,5 +1,9 @@
 #include "iterator.h"
 
+#include <algorithm>
+
+#include <boost/algorithm/string/predicate.hpp>
+
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
 
@@ -11,30 +15,54 @@ Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_ta
   std::string delegation_meta;
   auto version_in_snapshot = image_repo.getRoleVersion(delegate_role);
 
+  // Use the stored copy if it matches the version and hashes in the Snapshot,
+  // so that only the delegations which changed are fetched.
   if (storage.loadDelegation(&delegation_meta, delegate_role)) {
     auto version = extractVersionUntrusted(delegation_meta);
 
     if (version > version_in_snapshot) {
       throw SecurityException("image", "Rollback attempt on delegated targets");
-    } else if (version < version_in_snapshot) {
-      delegation_meta.clear();
-      storage.deleteDelegation(delegate_role);
+    } else if (version == version_in_snapshot) {
+      bool hashes_match = true;
+      try {
+        image_repo.verifyRoleHashes(delegation_meta, delegate_role, true);
+      } catch (const std::exception &e) {
+        if (offline) {
+          LOG_ERROR << "Role hashes error: " << e.what();
+          throw Uptane::DelegationHashMismatch(delegate_role.ToString());
+        }
+        LOG_INFO << "Downloading new " << delegate_role << " metadata because the stored copy does not match the "
+                 << "Snapshot: " << e.what();
+        hashes_match = false;
+      }
+
+      if (hashes_match) {
+        try {
+          return *ImageRepository::verifyDelegation(delegation_meta, delegate_role, parent_targets);
+        } catch (const Uptane::Exception &e) {
+          if (offline) {
+            throw;
+          }
+          LOG_INFO << "Downloading new " << delegate_role << " metadata because verification of local copy failed: "
+                   << e.what();
+        }
+      }
     }
+
+    delegation_meta.clear();
+    storage.deleteDelegation(delegate_role);
   }
 
-  bool delegation_remote = delegation_meta.empty();
-  if (delegation_remote) {
-    // Don't fetch anything remote if we are supposed to already have it.
-    if (offline) {
-      throw Uptane::DelegationMissing(delegate_role.ToString());
-    }
-    try {
-      fetcher.fetchLatestRole(&delegation_meta, Uptane::kMaxImageTargetsSize, RepositoryType::Image(), delegate_role,
-                              flow_control);
-    } catch (const std::exception &e) {
-      LOG_ERROR << "Fetch role error: " << e.what();
-      throw Uptane::DelegationMissing(delegate_role.ToString());
-    }
+  // Don't fetch anything remote if we are supposed to already have it.
+  if (offline) {
+    throw Uptane::DelegationMissing(delegate_role.ToString());
+  }
+  try {
+    fetcher.fetchLatestRole(&delegation_meta, Uptane::kMaxImageTargetsSize, RepositoryType::Image(), delegate_role,
+                            flow_control);
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Fetch role error: " << e.what();
+    throw Uptane::DelegationMissing(delegate_role.ToString());
   }
 
   try {
@@ -49,156 +77,128 @@ Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_ta
     throw SecurityException("image", "Delegation verification failed");
   }
 
-  if (delegation_remote) {
-    if (delegation->version() != version_in_snapshot) {
-      throw VersionMismatch("image", delegate_role.ToString());
-    }
-    storage.storeDelegation(delegation_meta, delegate_role);
+  if (delegation->version() != version_in_snapshot) {
+    throw VersionMismatch("image", delegate_role.ToString());
   }
+  storage.storeDelegation(delegation_meta, delegate_role);
 
   return *delegation;
 }
 
+bool TargetFilter::matches(const Target &target) const {
+  if (!boost::starts_with(target.filename(), name_prefix)) {
+    return false;
+  }
+  if (hardware_ids.empty()) {
+    return true;
+  }
+  const auto &target_hwids = target.hardwareIds();
+  return std::any_of(hardware_ids.cbegin(), hardware_ids.cend(), [&target_hwids](const HardwareIdentifier &hwid) {
+    return std::find(target_hwids.cbegin(), target_hwids.cend(), hwid) != target_hwids.cend();
+  });
+}
+
+bool TargetFilter::mayMatchPaths(const std::vector<std::string> &patterns) const {
+  if (name_prefix.empty() || patterns.empty()) {
+    return true;
+  }
+  return std::any_of(patterns.cbegin(), patterns.cend(), [this](const std::string &pattern) {
+    // Only the part before the first wildcard has to agree with the prefix
+    const auto wildcard = pattern.find_first_of("*?[\\");
+    if (wildcard == std::string::npos) {
+      return boost::starts_with(pattern, name_prefix);
+    }
+    const std::string literal = pattern.substr(0, wildcard);
+    return boost::starts_with(name_prefix, literal) || boost::starts_with(literal, name_prefix);
+  });
+}
+
 LazyTargetsList::DelegationIterator::DelegationIterator(const ImageRepository &repo,
                                                         std::shared_ptr<INvStorage> storage,
                                                         std::shared_ptr<Fetcher> fetcher,
-                                                        const api::FlowControlToken *flow_control, bool is_end)
+                                                        const api::FlowControlToken *flow_control,
+                                                        std::shared_ptr<const TargetFilter> filter, bool is_end)
     : repo_{repo},
       storage_{std::move(storage)},
       fetcher_{std::move(fetcher)},
       flow_control_{flow_control},
+      filter_{std::move(filter)},
       is_end_{is_end} {
-  tree_ = std::make_shared<DelegatedTargetTreeNode>();
-  tree_node_ = tree_.get();
-
-  tree_node_->role = Role::Targets();
-  cur_targets_ = repo_.getTargets();
+  if (is_end_) {
+    return;
+  }
+  auto targets = repo_.getTargets();
+  if (targets == nullptr) {
+    is_end_ = true;
+    return;
+  }
+  path_.push_back({std::move(targets), 0, false});
+  findNext();
 }
 
-void LazyTargetsList::DelegationIterator::renewTargetsData() {
-  auto role = tree_node_->role;
-
-  if (role == Role::Targets()) {
-    cur_targets_ = repo_.getTargets();
-  } else {
-    // go to the top of the delegation tree
-    std::stack<std::vector<std::shared_ptr<DelegatedTargetTreeNode>>::size_type> indices;
-    auto *node = tree_node_->parent;
-    while (node->parent != nullptr) {
-      indices.push(node->parent_idx);
-      node = node->parent;
+// Depth-first: first the Targets of a role, then those of each of its delegations in turn
+void LazyTargetsList::DelegationIterator::findNext() {
+  while (!path_.empty()) {
+    Level &level = path_.back();
+    const auto &targets = level.targets->targets;
+    for (; target_idx_ < targets.size(); ++target_idx_) {
+      if (filter_ == nullptr || filter_->matches(targets[target_idx_])) {
+        return;
+      }
     }
 
-    auto parent_targets = repo_.getTargets();
-    while (!indices.empty()) {
-      auto idx = indices.top();
-      indices.pop();
+    // Like the search for a Target, do not go deeper than a terminating delegation
+    const bool descend = !level.terminating && static_cast<int>(path_.size()) <= kDelegationsMaxDepth;
+    if (descend && level.next_child < level.targets->delegationCount()) {
+      const Role role = level.targets->delegationAt(level.next_child++);
+      auto paths_it = level.targets->paths_for_role_.find(role);
+      if (filter_ != nullptr && paths_it != level.targets->paths_for_role_.end() &&
+          !filter_->mayMatchPaths(paths_it->second)) {
+        continue;
+      }
+      const bool terminating = level.targets->delegationTerminates(role);
+
+      auto delegation = std::make_shared<const Targets>(
+          getTrustedDelegation(role, *level.targets, repo_, *storage_, *fetcher_, false, flow_control_));
+      // Invalidates `level`
+      path_.push_back({std::move(delegation), 0, terminating});
+      target_idx_ = 0;
+      continue;
+    }
 
-      auto fetched_role = Role(parent_targets->delegated_role_names_[idx], true);
-      parent_targets = std::make_shared<const Targets>(
-          getTrustedDelegation(fetched_role, *parent_targets, repo_, *storage_, *fetcher_, false, flow_control_));
+    // Done with this delegation and all below it, go on with the rest of its parent
+    path_.pop_back();
+    if (!path_.empty()) {
+      target_idx_ = path_.back().targets->targets.size();
     }
-    cur_targets_ = std::make_shared<Targets>(
-        getTrustedDelegation(role, *parent_targets, repo_, *storage_, *fetcher_, false, flow_control_));
   }
+  is_end_ = true;
 }
 
 bool LazyTargetsList::DelegationIterator::operator==(const LazyTargetsList::DelegationIterator &other) const {
-  if (is_end_ && other.is_end_) {
-    return true;
+  if (is_end_ || other.is_end_) {
+    return is_end_ == other.is_end_;
   }
 
-  return is_end_ == other.is_end_ && tree_node_->role == other.tree_node_->role && target_idx_ == other.target_idx_;
+  return path_.size() == other.path_.size() && path_.back().targets == other.path_.back().targets &&
+         target_idx_ == other.target_idx_;
 }
 
-const Target &LazyTargetsList::DelegationIterator::operator*() {
-  if (is_end_) {
+const Target &LazyTargetsList::DelegationIterator::operator*() const {
+  if (is_end_ || path_.empty() || target_idx_ >= path_.back().targets->targets.size()) {
     throw std::runtime_error("Inconsistent delegation iterator");
   }
 
-  if (!cur_targets_) {
-    renewTargetsData();
-  }
-
-  if (!cur_targets_ || target_idx_ >= cur_targets_->targets.size()) {
-    throw std::runtime_error("Inconsistent delegation iterator");
-  }
-
-  return cur_targets_->targets[target_idx_];
+  return path_.back().targets->targets[target_idx_];
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-LazyTargetsList::DelegationIterator LazyTargetsList::DelegationIterator::operator++() {
+LazyTargetsList::DelegationIterator &LazyTargetsList::DelegationIterator::operator++() {
   if (is_end_) {
     return *this;
   }
 
-  if (!cur_targets_) {
-    renewTargetsData();
-  }
-
-  // first iterate over current role's targets
-  if (target_idx_ + 1 < cur_targets_->targets.size()) {
-    ++target_idx_;
-    return *this;
-  }
-
-  // then go to children delegations
-  if (terminating_ || level_ >= kDelegationsMaxDepth) {
-    // but only if this delegation is not terminating
-    is_end_ = true;
-    return *this;
-  }
-
-  // populate the next level of the delegation tree if it's not populated yet
-  if (cur_targets_->delegated_role_names_.size() != tree_node_->children.size()) {
-    tree_node_->children.clear();
-
-    for (std::vector<std::shared_ptr<DelegatedTargetTreeNode>>::size_type i = 0;
-         i < cur_targets_->delegated_role_names_.size(); ++i) {
-      auto new_node = std::make_shared<DelegatedTargetTreeNode>();
-
-      new_node->role = Role(cur_targets_->delegated_role_names_[i], true);
-      new_node->parent = tree_node_;
-      new_node->parent_idx = i;
-
-      tree_node_->children.push_back(new_node);
-    }
-  }
-
-  if (children_idx_ < tree_node_->children.size()) {
-    auto *new_tree_node = tree_node_->children[children_idx_].get();
-    target_idx_ = 0;
-    children_idx_ = 0;
-    ++level_;
-
-    auto terminating_it = cur_targets_->terminating_role_.find(new_tree_node->role);
-    if (terminating_it == cur_targets_->terminating_role_.end()) {
-      throw std::runtime_error("Inconsistent delegation tree");
-    }
-    terminating_ = terminating_it->second;
-
-    cur_targets_.reset();
-    tree_node_ = new_tree_node;
-    return *this;
-  }
-
-  // then go to the parent delegation
-  if (tree_node_->parent != nullptr) {
-    auto *new_tree_node = tree_node_->parent;
-    children_idx_ = tree_node_->parent_idx + 1;
-    --level_;
-    terminating_ = false;
-
-    cur_targets_.reset();
-    tree_node_ = new_tree_node;
-    renewTargetsData();
-    target_idx_ = cur_targets_->targets.size();  // mark targets as exhausted
-    return ++(*this);                            // reiterate to find the next target
-  }
-
-  // then give up
-  is_end_ = true;
+  ++target_idx_;
+  findNext();
   return *this;
 }
 
@@ -11,15 +11,29 @@ Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_ta
                              const ImageRepository &image_repo, INvStorage &storage, IMetadataFetcher &fetcher,
                              bool offline, const api::FlowControlToken *flow_control);
 
+/**
+ * Selects the Targets returned by LazyTargetsList. Delegations whose path
+ * patterns can not match name_prefix are not fetched at all.
+ */
+struct TargetFilter {
+  // Only Targets with a filename that starts with this
+  std::string name_prefix;
+  // Only Targets for one of these hardware IDs, or for any if empty
+  std::vector<HardwareIdentifier> hardware_ids;
+
+  bool matches(const Target &target) const;
+  // Whether a delegation with these path patterns can list matching Targets
+  bool mayMatchPaths(const std::vector<std::string> &patterns) const;
+};
+
+/**
+ * All Targets of the Image repo, including delegations, in depth-first order.
+ * Delegations are fetched and verified as the iteration reaches them, and only
+ * the delegations on the path from the top-level Targets to the current one
+ * are kept in memory.
+ */
 class LazyTargetsList {
  public:
-  struct DelegatedTargetTreeNode {
-    Role role{Role::Targets()};
-    DelegatedTargetTreeNode *parent{nullptr};
-    std::vector<std::shared_ptr<DelegatedTargetTreeNode>>::size_type parent_idx{0};
-    std::vector<std::shared_ptr<DelegatedTargetTreeNode>> children;
-  };
-
   class DelegationIterator {
     using iterator_category = std::input_iterator_tag;
     using value_type = Uptane::Target;
@@ -30,40 +44,50 @@ class LazyTargetsList {
    public:
     explicit DelegationIterator(const ImageRepository &repo, std::shared_ptr<INvStorage> storage,
                                 std::shared_ptr<Uptane::Fetcher> fetcher, const api::FlowControlToken *flow_control,
-                                bool is_end = false);
-    DelegationIterator operator++();
+                                std::shared_ptr<const TargetFilter> filter, bool is_end = false);
+    DelegationIterator &operator++();
     bool operator==(const DelegationIterator &other) const;
     bool operator!=(const DelegationIterator &other) const { return !(*this == other); }
-    const Uptane::Target &operator*();
+    const Uptane::Target &operator*() const;
 
    private:
-    void renewTargetsData();
+    struct Level {
+      std::shared_ptr<const Targets> targets;
+      std::vector<std::string>::size_type next_child{0};
+      bool terminating{false};
+    };
+
+    // Moves to the first Target from target_idx_ on that passes the filter
+    void findNext();
 
-    std::shared_ptr<DelegatedTargetTreeNode> tree_;
-    DelegatedTargetTreeNode *tree_node_;
     const ImageRepository &repo_;
     std::shared_ptr<INvStorage> storage_;
     std::shared_ptr<Fetcher> fetcher_;
     const api::FlowControlToken *flow_control_;
-    std::shared_ptr<const Targets> cur_targets_;
-    std::vector<Targets>::size_type target_idx_{0};
-    std::vector<std::shared_ptr<DelegatedTargetTreeNode>>::size_type children_idx_{0};
-    bool terminating_{false};
-    int level_{0};
+    std::shared_ptr<const TargetFilter> filter_;
+    // From the top-level Targets down to the current delegation
+    std::vector<Level> path_;
+    std::vector<Target>::size_type target_idx_{0};
     bool is_end_;
   };
 
   explicit LazyTargetsList(const ImageRepository &repo, std::shared_ptr<INvStorage> storage,
-                           std::shared_ptr<Fetcher> fetcher, const api::FlowControlToken *flow_control)
-      : repo_{repo}, storage_{std::move(storage)}, fetcher_{std::move(fetcher)}, flow_control_{flow_control} {}
-  DelegationIterator begin() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_); }
-  DelegationIterator end() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, true); }
+                           std::shared_ptr<Fetcher> fetcher, const api::FlowControlToken *flow_control,
+                           TargetFilter filter = {})
+      : repo_{repo},
+        storage_{std::move(storage)},
+        fetcher_{std::move(fetcher)},
+        flow_control_{flow_control},
+        filter_{std::make_shared<const TargetFilter>(std::move(filter))} {}
+  DelegationIterator begin() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, filter_); }
+  DelegationIterator end() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, filter_, true); }
 
  private:
   const ImageRepository &repo_;
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<Uptane::Fetcher> fetcher_;
   const api::FlowControlToken *flow_control_;
+  std::shared_ptr<const TargetFilter> filter_;
 };
 }  // namespace Uptane
 
@@ -1,5 +1,10 @@
 #include "uptane/tuf.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include "logging/logging.h"
@@ -8,6 +13,37 @@
 
 using Uptane::MetaWithKeys;
 
+namespace {
+struct SignatureCheck {
+  const PublicKey *key;
+  std::string keyid;
+  std::string signature;
+};
+
+// Verifies the signatures on up to one thread per core. The results are in
+// the order of the checks, so that what is logged and decided from them does
+// not depend on the scheduling.
+std::vector<char> verifySignatures(const std::vector<SignatureCheck> &checks, const std::string &canonical) {
+  std::vector<char> valid(checks.size(), 0);
+  std::atomic<size_t> next{0};
+  auto worker = [&checks, &canonical, &valid, &next]() {
+    for (size_t i = next++; i < checks.size(); i = next++) {
+      valid[i] = checks[i].key->VerifySignature(checks[i].signature, canonical) ? 1 : 0;
+    }
+  };
+  const size_t workers = std::min<size_t>(checks.size(), std::max(std::thread::hardware_concurrency(), 1U));
+  std::vector<std::future<void>> helpers;
+  for (size_t i = 1; i < workers; ++i) {
+    helpers.push_back(std::async(std::launch::async, worker));
+  }
+  worker();
+  for (auto &helper : helpers) {
+    helper.get();
+  }
+  return valid;
+}
+}  // namespace
+
 MetaWithKeys::MetaWithKeys(const Json::Value &json) : BaseMeta(json) {}
 MetaWithKeys::MetaWithKeys(RepositoryType repo, const Role &role, const Json::Value &json,
                            const std::shared_ptr<MetaWithKeys> &signer)
@@ -27,13 +63,18 @@ void Uptane::MetaWithKeys::ParseKeys(const RepositoryType repo, const Json::Valu
 
 void Uptane::MetaWithKeys::ParseRole(const RepositoryType repo, const Json::ValueConstIterator &it, const Role &role,
                                      const std::string &meta_role) {
+  ParseRole(repo, *it, role, meta_role);
+}
+
+void Uptane::MetaWithKeys::ParseRole(const RepositoryType repo, const Json::Value &role_json, const Role &role,
+                                     const std::string &meta_role) {
   if (role == Role::InvalidRole()) {
     LOG_WARNING << "Invalid role in " << meta_role << ".json";
     LOG_TRACE << "Role name:" << role;
     return;
   }
   // Threshold
-  const int64_t requiredThreshold = (*it)["threshold"].asInt64();
+  const int64_t requiredThreshold = role_json["threshold"].asInt64();
   if (requiredThreshold < kMinSignatures) {
     // static_cast<int64_t> is to stop << taking a reference to kMinSignatures
     // http://www.stroustrup.com/bs_faq2.html#in-class
@@ -53,12 +94,30 @@ void Uptane::MetaWithKeys::ParseRole(const RepositoryType repo, const Json::Valu
   thresholds_for_role_[role] = requiredThreshold;
 
   // KeyIds
-  const Json::Value keyids = (*it)["keyids"];
+  const Json::Value &keyids = role_json["keyids"];
   for (auto itk = keyids.begin(); itk != keyids.end(); ++itk) {
     keys_for_role_.insert(std::make_pair(role, (*itk).asString()));
   }
 }
 
+Uptane::Role Uptane::MetaWithKeys::KeyRole(const Role &role) const {
+  if (bin_bits_ == 0 || !role.IsDelegation()) {
+    return role;
+  }
+  // Only accept the exact names of the bins, with the suffix in lower case and of full width
+  const std::string name = role.ToString();
+  const std::string last = Targets::binName(bin_prefix_, bin_bits_, (uint64_t{1} << bin_bits_) - 1);
+  if (name.size() != last.size() || name.compare(0, bin_prefix_.size() + 1, bin_prefix_ + "-") != 0) {
+    return role;
+  }
+  const std::string suffix = name.substr(bin_prefix_.size() + 1);
+  if (suffix.find_first_not_of("0123456789abcdef") != std::string::npos ||
+      suffix > last.substr(bin_prefix_.size() + 1)) {
+    return role;
+  }
+  return Role::Delegation(bin_prefix_);
+}
+
 void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const Role &role,
                                               const Json::Value &signed_object) {
   const std::string repository = repo;
@@ -75,10 +134,12 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
                             "Metadata type " + type.ToString() + " does not match expected role " + role.ToString());
   }
 
+  const Role key_role = KeyRole(role);
   const std::string canonical = Utils::jsonToCanonicalStr(signed_object["signed"]);
-  const Json::Value signatures = signed_object["signatures"];
+  const Json::Value &signatures = signed_object["signatures"];
   int valid_signatures = 0;
 
+  std::vector<SignatureCheck> checks;
   std::set<std::string> used_keyids;
   for (auto sig = signatures.begin(); sig != signatures.end(); ++sig) {
     const std::string keyid = (*sig)["keyid"].asString();
@@ -99,18 +160,23 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
       continue;
     }
 
-    if (keys_for_role_.count(std::make_pair(role, keyid)) == 0U) {
+    if (keys_for_role_.count(std::make_pair(key_role, keyid)) == 0U) {
       LOG_WARNING << "KeyId " << keyid << " is not valid to sign for this role (" << role << ").";
       continue;
     }
-    const std::string signature = (*sig)["sig"].asString();
-    if (keys_[keyid].VerifySignature(signature, canonical)) {
+    checks.push_back({&keys_[keyid], keyid, (*sig)["sig"].asString()});
+  }
+
+  // The signatures are independent, so metadata signed by many keys is checked in parallel
+  const std::vector<char> valid = verifySignatures(checks, canonical);
+  for (size_t i = 0; i < checks.size(); ++i) {
+    if (valid[i] != 0) {
       valid_signatures++;
     } else {
-      LOG_WARNING << "Signature was present but invalid: " << signature << " with KeyId: " << keyid;
+      LOG_WARNING << "Signature was present but invalid: " << checks[i].signature << " with KeyId: " << checks[i].keyid;
     }
   }
-  const int64_t threshold = thresholds_for_role_[role];
+  const int64_t threshold = thresholds_for_role_[key_role];
   if (threshold < kMinSignatures || kMaxSignatures < threshold) {
     throw IllegalThreshold(repository, "Invalid signature threshold");
   }
@@ -0,0 +1,94 @@
+#include "uptane/repomirror.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "storage/invstorage.h"
+#include "utilities/utils.h"
+
+namespace {
+// Names from the metadata must not lead out of the mirror
+bool isPlainName(const std::string& name) {
+  return !name.empty() && name.find('/') == std::string::npos && name != "." && name != "..";
+}
+
+bool isRelativePath(const std::string& path) {
+  if (path.empty() || path.front() == '/') {
+    return false;
+  }
+  for (const auto& part : boost::filesystem::path(path)) {
+    if (part == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+namespace Uptane {
+
+void RepoMirror::storeMetadata(const INvStorage& storage) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const RepositoryType repo = RepositoryType::Image();
+
+  std::string latest_root;
+  if (!storage.loadLatestRoot(&latest_root, repo)) {
+    return;
+  }
+  // Numbered Root metadata never changes once it is in the mirror
+  const int root_version = extractVersionUntrusted(latest_root);
+  for (int version = 1; version <= root_version; ++version) {
+    const boost::filesystem::path file = path_ / Version(version).RoleFileName(Role::Root());
+    std::string root;
+    if (!boost::filesystem::exists(file) && storage.loadRoot(&root, repo, Version(version))) {
+      Utils::writeFile(file, root);
+    }
+  }
+  Utils::writeFile(path_ / "root.json", latest_root);
+
+  // Stored delegations are only refreshed when they are needed, so leave out
+  // those that the Snapshot does not list with the same hash
+  std::string snapshot;
+  if (!storage.loadNonRoot(&snapshot, repo, Role::Snapshot())) {
+    return;
+  }
+  const Json::Value snapshot_meta = Utils::parseJSON(snapshot)["signed"]["meta"];
+  std::vector<std::pair<Role, std::string>> delegations;
+  storage.loadAllDelegations(delegations);
+  for (const auto& delegation : delegations) {
+    const std::string filename = Version().RoleFileName(delegation.first);
+    if (!isPlainName(filename)) {
+      continue;
+    }
+    const boost::filesystem::path file = path_ / "delegations" / filename;
+    if (boost::algorithm::to_lower_copy(snapshot_meta[filename]["hashes"]["sha256"].asString()) ==
+        Crypto::sha256digestHex(delegation.second)) {
+      Utils::writeFile(file, delegation.second);
+    } else {
+      boost::filesystem::remove(file);
+    }
+  }
+
+  for (const auto& role : {Role::Targets(), Role::Snapshot(), Role::Timestamp()}) {
+    std::string meta;
+    if (storage.loadNonRoot(&meta, repo, role)) {
+      Utils::writeFile(path_ / Version().RoleFileName(role), meta);
+    }
+  }
+}
+
+void RepoMirror::storeTarget(const Target& target, std::istream& content) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!isRelativePath(target.filename())) {
+    LOG_WARNING << "Not adding " << target.filename() << " to the Image repo mirror";
+    return;
+  }
+  const boost::filesystem::path file = path_ / "targets" / target.filename();
+  boost::filesystem::create_directories(file.parent_path());
+  Utils::writeFile(file, std::move(content));
+  LOG_DEBUG << "Added " << target.filename() << " to the Image repo mirror";
+}
+
+}  // namespace Uptane
@@ -0,0 +1,42 @@
+#ifndef UPTANE_REPOMIRROR_H_
+#define UPTANE_REPOMIRROR_H_
+
+#include <istream>
+#include <mutex>
+
+#include <boost/filesystem/path.hpp>
+
+#include "uptane/tuf.h"
+
+class INvStorage;
+
+namespace Uptane {
+
+/**
+ * A copy of the Image repo in a directory, laid out like the repo itself, so
+ * that a static web server can offer it to other devices on the local network
+ * (see UptaneConfig::repo_mirror_url).
+ *
+ * Only metadata that this device has verified and targets whose hashes it has
+ * checked are put into the mirror. The devices using it still verify
+ * everything themselves. Files are replaced atomically, and the Timestamp
+ * last, so that clients never see a Timestamp referring to metadata that is
+ * not there yet.
+ */
+class RepoMirror {
+ public:
+  explicit RepoMirror(boost::filesystem::path path) : path_(std::move(path)) {}
+
+  /** Copy the verified Image repo metadata in `storage` into the mirror. */
+  void storeMetadata(const INvStorage& storage);
+  /** Copy a downloaded and verified target into the mirror. */
+  void storeTarget(const Target& target, std::istream& content);
+
+ private:
+  boost::filesystem::path path_;
+  std::mutex mutex_;
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_REPOMIRROR_H_
@@ -1,6 +1,8 @@
 #include "uptane/tuf.h"
 
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 
 #include "uptane/exceptions.h"
 
@@ -14,6 +16,16 @@ const std::string Role::TIMESTAMP = "timestamp";
 const std::string Role::OFFLINESNAPSHOT = "offline-snapshot";
 const std::string Role::OFFLINEUPDATES = "offline-updates";
 
+namespace {
+// The same number for every delegation of this name, so that roles are compared without comparing names
+uint32_t internDelegation(const std::string &name) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, uint32_t> ids;
+  std::lock_guard<std::mutex> lock(mutex);
+  return ids.emplace(name, static_cast<uint32_t>(ids.size())).first->second;
+}
+}  // namespace
+
 Role::Role(const std::string &role_name, const bool delegation) {
   std::string role_name_lower;
   std::transform(role_name.begin(), role_name.end(), std::back_inserter(role_name_lower), ::tolower);
@@ -40,6 +52,11 @@ Role::Role(const std::string &role_name, const bool delegation) {
     role_ = RoleEnum::kInvalidRole;
     name_ = "invalidrole";
   }
+  if (role_ == RoleEnum::kDelegation) {
+    id_ = kFirstDelegationId + internDelegation(name_);
+  } else {
+    id_ = static_cast<uint32_t>(static_cast<int>(role_) + 1);
+  }
 }
 
 std::string Role::ToString() const { return name_; }
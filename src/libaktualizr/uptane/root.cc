@@ -1,3 +1,6 @@
+#include <exception>
+#include <future>
+
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
 #include "uptane/tuf.h"
@@ -5,8 +8,22 @@
 using Uptane::Root;
 
 Root::Root(const RepositoryType repo, const Json::Value &json, Root &root) : Root(repo, json) {
-  root.UnpackSignedObject(repo, Role::Root(), json);
-  this->Root::UnpackSignedObject(repo, Role::Root(), json);
+  // The checks against the keys of the previous and of the new Root are
+  // independent, so they run at the same time. If both fail, the error of the
+  // previous Root is reported, as when they ran one after the other.
+  auto previous = std::async(std::launch::async, [&root, &repo, &json]() {
+    root.UnpackSignedObject(repo, Role::Root(), json);
+  });
+  std::exception_ptr error;
+  try {
+    this->Root::UnpackSignedObject(repo, Role::Root(), json);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  previous.get();
+  if (error) {
+    std::rethrow_exception(error);
+  }
 }
 
 Root::Root(const RepositoryType repo, const Json::Value &json) : MetaWithKeys(json), policy_(Policy::kCheck) {
@@ -16,10 +33,10 @@ Root::Root(const RepositoryType repo, const Json::Value &json) : MetaWithKeys(js
     throw InvalidMetadata(repo, "root", "missing roles field");
   }
 
-  const Json::Value keys = json["signed"]["keys"];
+  const Json::Value &keys = json["signed"]["keys"];
   ParseKeys(repo, keys);
 
-  const Json::Value roles = json["signed"]["roles"];
+  const Json::Value &roles = json["signed"]["roles"];
   for (auto it = roles.begin(); it != roles.end(); it++) {
     const Role role = Role(it.key().asString());
     ParseRole(repo, it, role, "root");
@@ -2,16 +2,20 @@
 
 namespace Uptane {
 
-SecondaryMetadata::SecondaryMetadata(MetaBundle meta_bundle_in) : meta_bundle_(std::move(meta_bundle_in)) {
+SecondaryMetadata::SecondaryMetadata(MetaBundle meta_bundle_in)
+    : SecondaryMetadata(std::make_shared<const MetaBundle>(std::move(meta_bundle_in))) {}
+
+SecondaryMetadata::SecondaryMetadata(std::shared_ptr<const MetaBundle> meta_bundle_in)
+    : meta_bundle_(std::move(meta_bundle_in)) {
   try {
     director_root_version_ =
-        Version(extractVersionUntrusted(getMetaFromBundle(meta_bundle_, RepositoryType::Director(), Role::Root())));
+        Version(extractVersionUntrusted(getMetaFromBundle(*meta_bundle_, RepositoryType::Director(), Role::Root())));
   } catch (const std::exception& e) {
     LOG_DEBUG << "Failed to read Director Root version: " << e.what();
   }
   try {
     image_root_version_ =
-        Version(extractVersionUntrusted(getMetaFromBundle(meta_bundle_, RepositoryType::Image(), Role::Root())));
+        Version(extractVersionUntrusted(getMetaFromBundle(*meta_bundle_, RepositoryType::Image(), Role::Root())));
   } catch (const std::exception& e) {
     LOG_DEBUG << "Failed to read Image repo Root version: " << e.what();
   }
@@ -41,7 +45,7 @@ void SecondaryMetadata::getRoleMetadata(std::string* result, const RepositoryTyp
     }
   }
 
-  *result = getMetaFromBundle(meta_bundle_, repo, role);
+  *result = getMetaFromBundle(*meta_bundle_, repo, role);
 }
 
 }  // namespace Uptane
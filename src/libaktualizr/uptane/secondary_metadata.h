@@ -1,6 +1,8 @@
 #ifndef AKTUALIZR_SECONDARY_METADATA_H_
 #define AKTUALIZR_SECONDARY_METADATA_H_
 
+#include <memory>
+
 #include "uptane/fetcher.h"
 #include "uptane/tuf.h"
 
@@ -9,6 +11,9 @@ namespace Uptane {
 class SecondaryMetadata : public IMetadataFetcher {
  public:
   explicit SecondaryMetadata(MetaBundle meta_bundle_in);
+  // Shares the bundle instead of copying it, e.g. the one SecondaryProvider
+  // hands to all Secondaries during an update
+  explicit SecondaryMetadata(std::shared_ptr<const MetaBundle> meta_bundle_in);
 
   void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Role& role, Version version,
                  const api::FlowControlToken* flow_control) const override;
@@ -18,7 +23,7 @@ class SecondaryMetadata : public IMetadataFetcher {
                                Version version) const;
 
  private:
-  const MetaBundle meta_bundle_;
+  const std::shared_ptr<const MetaBundle> meta_bundle_;
   Version director_root_version_;
   Version image_root_version_;
 };
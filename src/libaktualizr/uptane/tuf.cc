@@ -1,8 +1,15 @@
 #include "uptane/tuf.h"
 
+#include <fnmatch.h>
+
 #include <ctime>
+#include <iomanip>
+#include <map>
+#include <mutex>
 #include <ostream>
+#include <set>
 #include <sstream>
+#include <unordered_map>
 
 #include <boost/algorithm/string/case_conv.hpp>
 #include <utility>
@@ -11,6 +18,7 @@
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
+#include "utilities/json_reader.h"
 
 using Uptane::Target;
 using Uptane::Version;
@@ -45,37 +53,64 @@ std::string Hash::encodeVector(const std::vector<Hash> &hashes) {
 std::vector<Hash> Hash::decodeVector(std::string hashes_str) {
   std::vector<Hash> hash_v;
 
-  std::string cs = std::move(hashes_str);
-  while (!cs.empty()) {
-    size_t scp = cs.find(';');
-    std::string hash_token = cs.substr(0, scp);
+  size_t pos = 0;
+  while (pos < hashes_str.size()) {
+    size_t scp = hashes_str.find(';', pos);
     if (scp == std::string::npos) {
-      cs = "";
-    } else {
-      cs = cs.substr(scp + 1);
+      scp = hashes_str.size();
     }
-    if (hash_token.empty()) {
+    if (scp == pos) {
       break;
     }
 
-    size_t cp = hash_token.find(':');
-    std::string hash_type_str = hash_token.substr(0, cp);
-    if (cp == std::string::npos) {
+    const size_t cp = hashes_str.find(':', pos);
+    if (cp == std::string::npos || cp > scp) {
       break;
     }
-    std::string hash_value_str = hash_token.substr(cp + 1);
 
-    if (!hash_value_str.empty()) {
-      Hash h{hash_type_str, hash_value_str};
+    if (cp + 1 < scp) {
+      Hash h{hashes_str.substr(pos, cp - pos), hashes_str.substr(cp + 1, scp - cp - 1)};
       if (h.type() != Hash::Type::kUnknownAlgorithm) {
         hash_v.push_back(std::move(h));
       }
     }
+    pos = scp + 1;
   }
 
   return hash_v;
 }
 
+namespace {
+// Image repos list the same few sets of hardware IDs for thousands of Targets.
+std::shared_ptr<const std::vector<Uptane::HardwareIdentifier>> internHardwareIds(
+    std::vector<Uptane::HardwareIdentifier> hwids) {
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<const std::vector<Uptane::HardwareIdentifier>>> pool;
+  static size_t sweep_at = 64;
+
+  std::string key;
+  for (const auto &hwid : hwids) {
+    key += hwid.ToString();
+    key += '\n';
+  }
+
+  std::lock_guard<std::mutex> guard(mutex);
+  auto &entry = pool[key];
+  auto interned = entry.lock();
+  if (interned == nullptr) {
+    interned = std::make_shared<const std::vector<Uptane::HardwareIdentifier>>(std::move(hwids));
+    entry = interned;
+    if (pool.size() >= sweep_at) {
+      for (auto it = pool.begin(); it != pool.end();) {
+        it = it->second.expired() ? pool.erase(it) : std::next(it);
+      }
+      sweep_at = std::max<size_t>(64, 2 * pool.size());
+    }
+  }
+  return interned;
+}
+}  // namespace
+
 Target::Target(std::string filename, const Json::Value &content) : filename_(std::move(filename)) {
   if (content.isMember("custom")) {
     updateCustom(content["custom"]);
@@ -83,7 +118,7 @@ Target::Target(std::string filename, const Json::Value &content) : filename_(std
 
   length_ = content["length"].asUInt64();
 
-  const Json::Value hashes = content["hashes"];
+  const Json::Value &hashes = content["hashes"];
   for (auto i = hashes.begin(); i != hashes.end(); ++i) {
     Hash h(i.key().asString(), (*i).asString());
     if (h.HaveAlgorithm()) {
@@ -95,32 +130,34 @@ Target::Target(std::string filename, const Json::Value &content) : filename_(std
 }
 
 void Target::updateCustom(const Json::Value &custom) {
-  custom_ = custom;
+  custom_ = std::make_shared<const Json::Value>(custom);
 
   // Image repo provides an array of hardware IDs.
-  if (custom_.isMember("hardwareIds")) {
-    Json::Value hwids = custom_["hardwareIds"];
-    hwids_.clear();
+  if (custom.isMember("hardwareIds")) {
+    const Json::Value &hwids = custom["hardwareIds"];
+    std::vector<HardwareIdentifier> hwid_list;
+    hwid_list.reserve(hwids.size());
     for (auto i = hwids.begin(); i != hwids.end(); ++i) {
-      hwids_.emplace_back(HardwareIdentifier((*i).asString()));
+      hwid_list.emplace_back((*i).asString());
     }
+    hwids_ = internHardwareIds(std::move(hwid_list));
   }
 
   // Director provides a map of ECU serials to hardware IDs.
-  if (custom_.isMember("ecuIdentifiers")) {
-    Json::Value ecus = custom_["ecuIdentifiers"];
+  if (custom.isMember("ecuIdentifiers")) {
+    const Json::Value &ecus = custom["ecuIdentifiers"];
     ecus_.clear();
     for (auto i = ecus.begin(); i != ecus.end(); ++i) {
       ecus_.insert({EcuSerial(i.key().asString()), HardwareIdentifier((*i)["hardwareId"].asString())});
     }
   }
 
-  if (custom_.isMember("targetFormat")) {
-    type_ = custom_["targetFormat"].asString();
+  if (custom.isMember("targetFormat")) {
+    type_ = custom["targetFormat"].asString();
   }
 
-  if (custom_.isMember("uri")) {
-    std::string custom_uri = custom_["uri"].asString();
+  if (custom.isMember("uri")) {
+    std::string custom_uri = custom["uri"].asString();
     // Ignore this exact URL for backwards compatibility with old defaults that inserted it.
     if (custom_uri != "https://example.com/") {
       uri_ = std::move(custom_uri);
@@ -168,9 +205,19 @@ std::string Target::sha256Hash() const { return hashString(Hash::Type::kSha256);
 
 std::string Target::sha512Hash() const { return hashString(Hash::Type::kSha512); }
 
+const std::vector<Uptane::HardwareIdentifier> &Target::hardwareIds() const {
+  static const std::vector<HardwareIdentifier> none;
+  return hwids_ != nullptr ? *hwids_ : none;
+}
+
+const Json::Value &Target::custom_data() const {
+  static const Json::Value none;
+  return custom_ != nullptr ? *custom_ : none;
+}
+
 std::string Target::custom_version() const {
   try {
-    return custom_["version"].asString();
+    return custom_data()["version"].asString();
   } catch (const std::exception &ex) {
     LOG_ERROR << "Unable to parse custom version: " << ex.what();
     return "";
@@ -212,15 +259,15 @@ bool Target::MatchTarget(const Target &t2) const {
   // and a Target from the Image repo (HWID vector populated,
   // ECU->HWID map empty). Figure out which Target has the map, and then for
   // every item in the map, make sure it's in the other Target's HWID vector.
-  if (hwids_ != t2.hwids_ || ecus_ != t2.ecus_) {
-    std::shared_ptr<EcuMap> ecu_map;                               // Director
-    std::shared_ptr<std::vector<HardwareIdentifier>> hwid_vector;  // Image repo
+  if (hardwareIds() != t2.hardwareIds() || ecus_ != t2.ecus_) {
+    const EcuMap *ecu_map;                               // Director
+    const std::vector<HardwareIdentifier> *hwid_vector;  // Image repo
     if (ecus_.empty() && !t2.ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(t2.ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(hwids_);
+      ecu_map = &t2.ecus_;
+      hwid_vector = &hardwareIds();
     } else if (t2.ecus_.empty() && !ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(t2.hwids_);
+      ecu_map = &ecus_;
+      hwid_vector = &t2.hardwareIds();
     } else {
       return false;
     }
@@ -254,10 +301,11 @@ Json::Value Target::toDebugJson() const {
   for (const auto &ecu : ecus_) {
     res["custom"]["ecuIdentifiers"][ecu.first.ToString()]["hardwareId"] = ecu.second.ToString();
   }
-  if (!hwids_.empty()) {
+  const std::vector<HardwareIdentifier> &hwid_list = hardwareIds();
+  if (!hwid_list.empty()) {
     Json::Value hwids;
-    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(hwids_.size()); ++i) {
-      hwids[i] = hwids_[i].ToString();
+    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(hwid_list.size()); ++i) {
+      hwids[i] = hwid_list[i].ToString();
     }
     res["custom"]["hardwareIds"] = hwids;
   }
@@ -278,7 +326,7 @@ std::ostream &Uptane::operator<<(std::ostream &os, const Target &t) {
   }
   os << ")"
      << " hw_ids: (";
-  for (const auto &hwid : t.hwids_) {
+  for (const auto &hwid : t.hardwareIds()) {
     os << hwid << ", ";
   }
   os << ")"
@@ -345,24 +393,24 @@ void Uptane::Targets::init(const Json::Value &json) {
     throw Uptane::InvalidMetadata("", "targets", "invalid targets.json");
   }
 
-  const Json::Value target_list = json["signed"]["targets"];
+  const Json::Value &target_list = json["signed"]["targets"];
+  targets.reserve(target_list.size());
   for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
-    Target t(t_it.key().asString(), *t_it);
-    targets.push_back(t);
+    targets.emplace_back(t_it.key().asString(), *t_it);
   }
 
   if (json["signed"]["delegations"].isObject()) {
-    const Json::Value key_list = json["signed"]["delegations"]["keys"];
+    const Json::Value &key_list = json["signed"]["delegations"]["keys"];
     ParseKeys(Uptane::RepositoryType::Image(), key_list);
 
-    const Json::Value role_list = json["signed"]["delegations"]["roles"];
+    const Json::Value &role_list = json["signed"]["delegations"]["roles"];
     for (auto it = role_list.begin(); it != role_list.end(); it++) {
       const std::string role_name = (*it)["name"].asString();
       const Role role = Role::Delegation(role_name);
       delegated_role_names_.push_back(role_name);
       ParseRole(Uptane::RepositoryType::Image(), it, role, name_);
 
-      const Json::Value paths_list = (*it)["paths"];
+      const Json::Value &paths_list = (*it)["paths"];
       std::vector<std::string> paths;
       for (auto p_it = paths_list.begin(); p_it != paths_list.end(); p_it++) {
         paths.emplace_back((*p_it).asString());
@@ -371,6 +419,23 @@ void Uptane::Targets::init(const Json::Value &json) {
 
       terminating_role_[role] = (*it)["terminating"].asBool();
     }
+
+    // TAP-15: the targets are spread over bins by the hash of their names, so
+    // a client only fetches the one bin that can hold the target it looks for
+    const Json::Value &succinct = json["signed"]["delegations"]["succinct_roles"];
+    if (succinct.isObject()) {
+      if (!role_list.empty()) {
+        throw Uptane::InvalidMetadata("", name_, "delegations have both roles and succinct_roles");
+      }
+      const Json::Value &bit_length = succinct["bit_length"];
+      const std::string prefix = succinct["name_prefix"].asString();
+      if (!bit_length.isUInt() || bit_length.asUInt() < 1 || bit_length.asUInt() > 32 || prefix.empty()) {
+        throw Uptane::InvalidMetadata("", name_, "invalid succinct_roles");
+      }
+      bin_prefix_ = prefix;
+      bin_bits_ = bit_length.asUInt();
+      ParseRole(Uptane::RepositoryType::Image(), succinct, Role::Delegation(bin_prefix_), name_);
+    }
   }
 
   if (json["signed"]["custom"].isObject()) {
@@ -378,6 +443,140 @@ void Uptane::Targets::init(const Json::Value &json) {
   } else {
     correlation_id_ = "";
   }
+
+  reindex();
+}
+
+struct Uptane::Targets::Index {
+  std::unordered_map<std::string, size_t> by_filename;
+  std::map<std::pair<std::string, std::string>, std::vector<size_t>> by_ecu;
+  // Delegation path patterns, keyed by their literal prefix, i.e. everything
+  // before the first wildcard. A filename can only match a pattern whose
+  // prefix it starts with.
+  std::unordered_map<std::string, std::vector<std::pair<size_t, std::string>>> patterns_by_prefix;
+  std::set<size_t> prefix_lengths;
+};
+
+void Uptane::Targets::reindex() {
+  auto index = std::make_shared<Index>();
+  for (size_t i = 0; i < targets.size(); ++i) {
+    index->by_filename.emplace(targets[i].filename(), i);
+    for (const auto &ecu : targets[i].ecus()) {
+      index->by_ecu[{ecu.first.ToString(), ecu.second.ToString()}].push_back(i);
+    }
+  }
+  for (size_t i = 0; i < delegated_role_names_.size(); ++i) {
+    const auto paths = paths_for_role_.find(Role::Delegation(delegated_role_names_[i]));
+    if (paths == paths_for_role_.end()) {
+      continue;
+    }
+    for (const auto &pattern : paths->second) {
+      const std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+      index->patterns_by_prefix[prefix].emplace_back(i, pattern);
+      index->prefix_lengths.insert(prefix.size());
+    }
+  }
+  index_ = std::move(index);
+}
+
+std::vector<Uptane::Target> Uptane::Targets::getTargets(const Uptane::EcuSerial &ecu_id,
+                                                        const Uptane::HardwareIdentifier &hw_id) const {
+  std::vector<Uptane::Target> result;
+  if (index_ == nullptr) {
+    return result;
+  }
+  const auto found = index_->by_ecu.find({ecu_id.ToString(), hw_id.ToString()});
+  if (found != index_->by_ecu.end()) {
+    for (const auto i : found->second) {
+      if (i < targets.size()) {
+        result.push_back(targets[i]);
+      }
+    }
+  }
+  return result;
+}
+
+const Target *Uptane::Targets::findTarget(const std::string &filename) const {
+  if (index_ == nullptr) {
+    return nullptr;
+  }
+  const auto found = index_->by_filename.find(filename);
+  if (found == index_->by_filename.end() || found->second >= targets.size()) {
+    return nullptr;
+  }
+  return &targets[found->second];
+}
+
+std::vector<Uptane::Role> Uptane::Targets::delegationsForPath(const std::string &filename) const {
+  std::vector<Role> result;
+  if (bin_bits_ != 0) {
+    result.push_back(Role::Delegation(binForPath(bin_prefix_, bin_bits_, filename)));
+    return result;
+  }
+  if (index_ == nullptr) {
+    return result;
+  }
+  std::set<size_t> matched;
+  for (const auto length : index_->prefix_lengths) {
+    if (length > filename.size()) {
+      break;
+    }
+    const auto candidates = index_->patterns_by_prefix.find(filename.substr(0, length));
+    if (candidates == index_->patterns_by_prefix.end()) {
+      continue;
+    }
+    for (const auto &candidate : candidates->second) {
+      if (matched.count(candidate.first) == 0 && fnmatch(candidate.second.c_str(), filename.c_str(), 0) == 0) {
+        matched.insert(candidate.first);
+      }
+    }
+  }
+  for (const auto i : matched) {
+    result.push_back(Role::Delegation(delegated_role_names_[i]));
+  }
+  return result;
+}
+
+size_t Uptane::Targets::delegationCount() const {
+  if (bin_bits_ != 0) {
+    return static_cast<size_t>(uint64_t{1} << bin_bits_);
+  }
+  return delegated_role_names_.size();
+}
+
+Uptane::Role Uptane::Targets::delegationAt(const size_t i) const {
+  if (bin_bits_ != 0) {
+    return Role::Delegation(binName(bin_prefix_, bin_bits_, i));
+  }
+  return Role::Delegation(delegated_role_names_.at(i));
+}
+
+bool Uptane::Targets::delegationTerminates(const Role &role) const {
+  // Bins hold the targets themselves and never delegate further
+  if (bin_bits_ != 0 && KeyRole(role) != role) {
+    return true;
+  }
+  const auto found = terminating_role_.find(role);
+  if (found == terminating_role_.end()) {
+    throw Uptane::Exception("image", "Inconsistent delegations");
+  }
+  return found->second;
+}
+
+std::string Uptane::Targets::binName(const std::string &prefix, const uint32_t bits, const uint64_t bin) {
+  const int width = static_cast<int>((bits + 3) / 4);
+  std::ostringstream name;
+  name << prefix << '-' << std::hex << std::setw(width) << std::setfill('0') << bin;
+  return name.str();
+}
+
+std::string Uptane::Targets::binForPath(const std::string &prefix, const uint32_t bits, const std::string &filename) {
+  const std::string digest = Crypto::sha256digest(filename);
+  uint32_t head = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    head = (head << 8U) | static_cast<uint8_t>(digest[i]);
+  }
+  return binName(prefix, bits, static_cast<uint64_t>(head) >> (32U - bits));
 }
 
 Uptane::Targets::Targets(const Json::Value &json) : MetaWithKeys(json) { init(json); }
@@ -389,9 +588,9 @@ Uptane::Targets::Targets(RepositoryType repo, const Role &role, const Json::Valu
 }
 
 void Uptane::TimestampMeta::init(const Json::Value &json) {
-  Json::Value hashes_list = json["signed"]["meta"]["snapshot.json"]["hashes"];
-  Json::Value meta_size = json["signed"]["meta"]["snapshot.json"]["length"];
-  Json::Value meta_version = json["signed"]["meta"]["snapshot.json"]["version"];
+  const Json::Value &hashes_list = json["signed"]["meta"]["snapshot.json"]["hashes"];
+  const Json::Value &meta_size = json["signed"]["meta"]["snapshot.json"]["length"];
+  const Json::Value &meta_version = json["signed"]["meta"]["snapshot.json"]["version"];
   if (!json.isObject() || json["signed"]["_type"] != "Timestamp" || !hashes_list.isObject() ||
       !meta_size.isIntegral() || !meta_version.isIntegral()) {
     throw Uptane::InvalidMetadata("", "timestamp", "invalid timestamp.json");
@@ -414,16 +613,16 @@ Uptane::TimestampMeta::TimestampMeta(RepositoryType repo, const Json::Value &jso
 }
 
 void Uptane::Snapshot::init(const Json::Value &json) {
-  Json::Value meta_list = json["signed"]["meta"];
+  const Json::Value &meta_list = json["signed"]["meta"];
   if ((!json.isObject() || !meta_list.isObject()) ||
       (json["signed"]["_type"] != "Snapshot" && json["signed"]["_type"] != "Offline-Snapshot")) {
     throw Uptane::InvalidMetadata("", "snapshot", "invalid snapshot.json");
   }
 
   for (auto it = meta_list.begin(); it != meta_list.end(); ++it) {
-    Json::Value hashes_list = (*it)["hashes"];
-    Json::Value meta_size = (*it)["length"];
-    Json::Value meta_version = (*it)["version"];
+    const Json::Value &hashes_list = (*it)["hashes"];
+    const Json::Value &meta_size = (*it)["length"];
+    const Json::Value &meta_version = (*it)["version"];
 
     if (!meta_version.isIntegral()) {
       throw Uptane::InvalidMetadata("", "snapshot", "invalid snapshot.json");
@@ -492,7 +691,7 @@ int Uptane::Snapshot::role_version(const Uptane::Role &role) const {
 };
 
 int Uptane::extractVersionUntrusted(const std::string &meta) {
-  auto version_json = Utils::parseJSON(meta)["signed"]["version"];
+  auto version_json = JsonReader::parse(meta)["signed"]["version"];
   if (!version_json.isIntegral()) {
     return -1;
   } else {
@@ -500,11 +699,60 @@ int Uptane::extractVersionUntrusted(const std::string &meta) {
   }
 }
 
+int Uptane::MetaBundle::fixedIndex(const RepositoryType repo, const Role &role) {
+  const int repo_index = static_cast<int>(repo);
+  if (role.IsDelegation() || repo_index < 0 || repo_index >= static_cast<int>(kRepoTypes) ||
+      role.Id() >= kFixedRoles) {
+    return -1;
+  }
+  return repo_index * static_cast<int>(kFixedRoles) + static_cast<int>(role.Id());
+}
+
+bool Uptane::MetaBundle::emplace(const Key &key, std::string meta) {
+  const int index = fixedIndex(key.first, key.second);
+  if (index < 0) {
+    if (!delegations_.emplace(std::make_pair(static_cast<int>(key.first), key.second.Id()), std::move(meta)).second) {
+      return false;
+    }
+  } else {
+    const auto i = static_cast<size_t>(index);
+    if (fixed_set_[i]) {
+      return false;
+    }
+    fixed_[i] = std::move(meta);
+    fixed_set_[i] = true;
+  }
+  ++size_;
+  return true;
+}
+
+const std::string *Uptane::MetaBundle::find(const RepositoryType repo, const Role &role) const {
+  const int index = fixedIndex(repo, role);
+  if (index < 0) {
+    const auto it = delegations_.find(std::make_pair(static_cast<int>(repo), role.Id()));
+    return it == delegations_.end() ? nullptr : &it->second;
+  }
+  const auto i = static_cast<size_t>(index);
+  return fixed_set_[i] ? &fixed_[i] : nullptr;
+}
+
+bool Uptane::MetaBundle::operator==(const MetaBundle &other) const {
+  if (size_ != other.size_ || fixed_set_ != other.fixed_set_ || delegations_ != other.delegations_) {
+    return false;
+  }
+  for (size_t i = 0; i < fixed_.size(); ++i) {
+    if (fixed_set_[i] && fixed_[i] != other.fixed_[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::string Uptane::getMetaFromBundle(const MetaBundle &bundle, const RepositoryType repo, const Role &role) {
-  auto it = bundle.find(std::make_pair(repo, role));
-  if (it == bundle.end()) {
+  const std::string *meta = bundle.find(repo, role);
+  if (meta == nullptr) {
     throw std::runtime_error("Metadata not found for " + role.ToString() + " role from the " + repo.ToString() +
                              " repository.");
   }
-  return it->second;
+  return *meta;
 }
@@ -5,6 +5,8 @@
  * Base data types that are used in The Update Framework (TUF), part of Uptane.
  */
 
+#include <array>
+#include <bitset>
 #include <functional>
 #include <map>
 #include <ostream>
@@ -93,9 +95,11 @@ class Role {
   std::string ToString() const;
   int ToInt() const { return static_cast<int>(role_); }
   bool IsDelegation() const { return role_ == RoleEnum::kDelegation; }
-  bool operator==(const Role &other) const { return name_ == other.name_; }
+  // Equal for equal names, without comparing them
+  uint32_t Id() const { return id_; }
+  bool operator==(const Role &other) const { return id_ == other.id_; }
   bool operator!=(const Role &other) const { return !(*this == other); }
-  bool operator<(const Role &other) const { return name_ < other.name_; }
+  bool operator<(const Role &other) const { return id_ != other.id_ && name_ < other.name_; }
 
   friend std::ostream &operator<<(std::ostream &os, const Role &role);
 
@@ -112,6 +116,8 @@ class Role {
     kOfflineUpdates = 6,
     kInvalidRole = -1
   };
+  // IDs of delegations start after those of the other roles, which are their enum value plus one
+  static constexpr uint32_t kFirstDelegationId = 16;
 
   explicit Role(RoleEnum role) : role_(role) {
     if (role_ == RoleEnum::kRoot) {
@@ -130,10 +136,12 @@ class Role {
       role_ = RoleEnum::kInvalidRole;
       name_ = "invalidrole";
     }
+    id_ = static_cast<uint32_t>(static_cast<int>(role_) + 1);
   }
 
   RoleEnum role_;
   std::string name_;
+  uint32_t id_{0};
 };
 
 std::ostream &operator<<(std::ostream &os, const Role &role);
@@ -169,7 +177,7 @@ class BaseMeta {
   int version() const { return version_; }
   TimeStamp expiry() const { return expiry_; }
   bool isExpired(const TimeStamp &now) const { return expiry_.IsExpiredAt(now); }
-  Json::Value original() const { return original_object_; }
+  const Json::Value &original() const { return original_object_; }
   /**
    * Get the first signature of a given meta.
    *
@@ -213,6 +221,7 @@ class MetaWithKeys : public BaseMeta {
   // meta_role is the name of this object's role.
   void ParseRole(RepositoryType repo, const Json::ValueConstIterator &it, const Role &role,
                  const std::string &meta_role);
+  void ParseRole(RepositoryType repo, const Json::Value &role_json, const Role &role, const std::string &meta_role);
 
   /**
    * Take a JSON blob that contains a signatures/signed component that is supposedly for a given role, and check that is
@@ -232,7 +241,8 @@ class MetaWithKeys : public BaseMeta {
 
   bool operator==(const MetaWithKeys &rhs) const {
     return version_ == rhs.version_ && expiry_ == rhs.expiry_ && keys_ == rhs.keys_ &&
-           keys_for_role_ == rhs.keys_for_role_ && thresholds_for_role_ == rhs.thresholds_for_role_;
+           keys_for_role_ == rhs.keys_for_role_ && thresholds_for_role_ == rhs.thresholds_for_role_ &&
+           bin_prefix_ == rhs.bin_prefix_ && bin_bits_ == rhs.bin_bits_;
   }
 
  protected:
@@ -240,12 +250,21 @@ class MetaWithKeys : public BaseMeta {
   MetaWithKeys &operator=(const MetaWithKeys &guard) = default;
   MetaWithKeys &operator=(MetaWithKeys &&) = default;
 
+  // The role whose keys and threshold apply to `role`: for a bin of a hashed-bin
+  // delegation the role named after the bins' prefix, otherwise `role` itself.
+  Role KeyRole(const Role &role) const;
+
   static const int64_t kMinSignatures = 1;
   static const int64_t kMaxSignatures = 1000;
 
   std::map<KeyId, PublicKey> keys_;
   std::set<std::pair<Role, KeyId>> keys_for_role_;
   std::map<Role, int64_t> thresholds_for_role_;
+  // Hashed-bin delegation (TAP-15 "succinct_roles"): 2^bin_bits_ bins named
+  // "<bin_prefix_>-<hex>", all signed with the same keys. bin_bits_ is 0 if
+  // there is none.
+  std::string bin_prefix_;
+  uint32_t bin_bits_{0};
 };
 
 // Implemented in uptane/root.cc
@@ -326,25 +345,32 @@ class Targets : public MetaWithKeys {
     delegated_role_names_.clear();
     paths_for_role_.clear();
     terminating_role_.clear();
+    bin_prefix_.clear();
+    bin_bits_ = 0;
+    index_.reset();
   }
 
   // Only makes sense for Targets from the Director repo; the Image repo doesn't
   // specify ECU serials.
   std::vector<Uptane::Target> getTargets(const Uptane::EcuSerial &ecu_id,
-                                         const Uptane::HardwareIdentifier &hw_id) const {
-    std::vector<Uptane::Target> result;
-    for (auto it = targets.begin(); it != targets.end(); ++it) {
-      auto found_loc = std::find_if(it->ecus().begin(), it->ecus().end(),
-                                    [ecu_id, hw_id](const std::pair<EcuSerial, HardwareIdentifier> &val) {
-                                      return ((ecu_id == val.first) && (hw_id == val.second));
-                                    });
-
-      if (found_loc != it->ecus().end()) {
-        result.push_back(*it);
-      }
-    }
-    return result;
-  }
+                                         const Uptane::HardwareIdentifier &hw_id) const;
+  // The target with this filename, or nullptr
+  const Uptane::Target *findTarget(const std::string &filename) const;
+  // Delegated roles with a path pattern matching this filename, in delegation order;
+  // with hashed bins, the single bin the filename hashes to
+  std::vector<Role> delegationsForPath(const std::string &filename) const;
+  // Number of delegated roles, counting every bin of a hashed-bin delegation
+  size_t delegationCount() const;
+  // The delegated role at this position, in delegation order
+  Role delegationAt(size_t i) const;
+  // Whether a delegation to this role is terminating; throws if there is no such delegation
+  bool delegationTerminates(const Role &role) const;
+  // Name of the bin with this number, zero-padded to the width of the last bin as in TAP-15
+  static std::string binName(const std::string &prefix, uint32_t bits, uint64_t bin);
+  // Name of the bin for this filename: the first `bits` bits of its SHA-256 pick the bin
+  static std::string binForPath(const std::string &prefix, uint32_t bits, const std::string &filename);
+  // Rebuilds the lookup index; needed after `targets` is modified
+  void reindex();
 
   std::vector<Uptane::Target> targets;
   std::vector<std::string> delegated_role_names_;
@@ -352,10 +378,14 @@ class Targets : public MetaWithKeys {
   std::map<Role, bool> terminating_role_;
 
  private:
+  struct Index;
+
   void init(const Json::Value &json);
 
   std::string name_;
   std::string correlation_id_;  // custom non-tuf
+  // Built once per parsed metadata, and shared by copies
+  std::shared_ptr<const Index> index_;
 };
 
 class TimestampMeta : public BaseMeta {
@@ -397,10 +427,37 @@ class Snapshot : public BaseMeta {
   std::vector<std::string> role_names_;
 };
 
-struct MetaPairHash {
-  std::size_t operator()(const std::pair<RepositoryType, Role> &pair) const {
-    return std::hash<std::string>()(pair.first.ToString()) ^ std::hash<std::string>()(pair.second.ToString());
-  }
+/**
+ * Metadata for a Secondary by repository and role. The fixed roles of both
+ * repositories are kept in an array indexed by the repository type and role,
+ * and delegations by the ID of their role, so that lookups neither hash nor
+ * build strings.
+ */
+class MetaBundle {
+ public:
+  using Key = std::pair<RepositoryType, Role>;
+
+  // Keeps metadata already stored for the role and returns false, as std::unordered_map::emplace() does
+  bool emplace(const Key &key, std::string meta);
+  bool insert(std::pair<Key, std::string> entry) { return emplace(entry.first, std::move(entry.second)); }
+  // The metadata for the role, or nullptr
+  const std::string *find(RepositoryType repo, const Role &role) const;
+  size_t count(const Key &key) const { return find(key.first, key.second) != nullptr ? 1 : 0; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool operator==(const MetaBundle &other) const;
+  bool operator!=(const MetaBundle &other) const { return !(*this == other); }
+
+ private:
+  static constexpr size_t kRepoTypes = 2;
+  static constexpr size_t kFixedRoles = 8;
+  // Index into fixed_, or -1 for delegations and unknown repositories
+  static int fixedIndex(RepositoryType repo, const Role &role);
+
+  std::array<std::string, kRepoTypes * kFixedRoles> fixed_;
+  std::bitset<kRepoTypes * kFixedRoles> fixed_set_;
+  std::map<std::pair<int, uint32_t>, std::string> delegations_;
+  size_t size_{0};
 };
 
 std::string getMetaFromBundle(const MetaBundle &bundle, RepositoryType repo, const Role &role);
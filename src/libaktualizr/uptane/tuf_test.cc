@@ -5,6 +5,7 @@
 
 #include <json/json.h>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
 #include "uptane/tuf.h"
@@ -21,6 +22,46 @@ TEST(Root, RootValidates) {
   EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), initial_root, root));
 }
 
+/*
+ * Count the valid signatures of Root metadata signed by many keys, which are
+ * checked in parallel, against the threshold.
+ */
+TEST(Root, ManySignatures) {
+  Json::Value json;
+  json["signed"]["_type"] = "Root";
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["version"] = 1;
+  json["signed"]["roles"]["root"]["threshold"] = 5;
+  std::vector<std::pair<std::string, std::string>> keys;
+  for (int i = 0; i < 8; ++i) {
+    std::string public_key;
+    std::string private_key;
+    ASSERT_TRUE(Crypto::generateKeyPair(KeyType::kED25519, &public_key, &private_key));
+    const PublicKey key(public_key, KeyType::kED25519);
+    json["signed"]["keys"][key.KeyId()] = key.ToUptane();
+    json["signed"]["roles"]["root"]["keyids"].append(key.KeyId());
+    keys.emplace_back(key.KeyId(), private_key);
+  }
+  const std::string canonical = Utils::jsonToCanonicalStr(json["signed"]);
+  for (const auto& key : keys) {
+    Json::Value signature;
+    signature["keyid"] = key.first;
+    signature["method"] = "ed25519";
+    signature["sig"] = Utils::toBase64(Crypto::ED25519Sign(key.second, canonical));
+    json["signatures"].append(signature);
+  }
+
+  // Three bad signatures still leave enough good ones
+  for (Json::ArrayIndex i = 0; i < 3; ++i) {
+    json["signatures"][i]["sig"] = json["signatures"][7]["sig"];
+  }
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), json, accept_all));
+
+  json["signatures"][3]["sig"] = json["signatures"][7]["sig"];
+  EXPECT_THROW(Uptane::Root(Uptane::RepositoryType::Director(), json, accept_all), Uptane::UnmetThreshold);
+}
+
 /* Throw an exception if Root metadata is unsigned. */
 TEST(Root, RootJsonNoKeys) {
   Uptane::Root root1(Uptane::Root::Policy::kAcceptAll);
@@ -98,6 +139,46 @@ TEST(Role, InvalidDelegationName) {
   EXPECT_THROW(Uptane::Role::Delegation("timestamp"), Uptane::Exception);
 }
 
+/* Roles of the same name are equal, however they were made. */
+TEST(Role, Equality) {
+  EXPECT_EQ(Uptane::Role("Targets"), Uptane::Role::Targets());
+  EXPECT_NE(Uptane::Role::Root(), Uptane::Role::Targets());
+  EXPECT_EQ(Uptane::Role::Delegation("abc"), Uptane::Role::Delegation("abc"));
+  EXPECT_NE(Uptane::Role::Delegation("abc"), Uptane::Role::Delegation("ABC"));
+  EXPECT_NE(Uptane::Role::Delegation("abc"), Uptane::Role::Targets());
+  EXPECT_EQ(Uptane::Role("unknown"), Uptane::Role::InvalidRole());
+
+  // Ordered by name
+  EXPECT_LT(Uptane::Role::Delegation("abc"), Uptane::Role::Root());
+  EXPECT_LT(Uptane::Role::Root(), Uptane::Role::Delegation("zzz"));
+  EXPECT_FALSE(Uptane::Role::Delegation("abc") < Uptane::Role::Delegation("abc"));
+}
+
+/* Metadata of fixed and delegated roles is found by repository and role. */
+TEST(MetaBundle, Lookup) {
+  Uptane::MetaBundle bundle;
+  EXPECT_TRUE(bundle.empty());
+  EXPECT_TRUE(bundle.emplace(std::make_pair(Uptane::RepositoryType::Director(), Uptane::Role::Root()), "d-root"));
+  EXPECT_TRUE(bundle.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Root()), "i-root"));
+  EXPECT_TRUE(bundle.insert({std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Delegation("abc")), "abc"}));
+  // Already there
+  EXPECT_FALSE(bundle.emplace(std::make_pair(Uptane::RepositoryType::Director(), Uptane::Role::Root()), "other"));
+  EXPECT_EQ(bundle.size(), 3);
+
+  EXPECT_EQ(Uptane::getMetaFromBundle(bundle, Uptane::RepositoryType::Director(), Uptane::Role::Root()), "d-root");
+  EXPECT_EQ(Uptane::getMetaFromBundle(bundle, Uptane::RepositoryType::Image(), Uptane::Role::Root()), "i-root");
+  EXPECT_EQ(Uptane::getMetaFromBundle(bundle, Uptane::RepositoryType::Image(), Uptane::Role::Delegation("abc")), "abc");
+  EXPECT_EQ(bundle.find(Uptane::RepositoryType::Director(), Uptane::Role::Delegation("abc")), nullptr);
+  EXPECT_EQ(bundle.count(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Targets())), 0);
+  EXPECT_THROW(Uptane::getMetaFromBundle(bundle, Uptane::RepositoryType::Director(), Uptane::Role::Targets()),
+               std::runtime_error);
+
+  Uptane::MetaBundle copy = bundle;
+  EXPECT_EQ(copy, bundle);
+  copy.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Targets()), "i-targets");
+  EXPECT_NE(copy, bundle);
+}
+
 Json::Value generateTarget(const std::string& hash, const int length) {
   Json::Value target;
   Json::Value hashes;
@@ -283,6 +364,120 @@ TEST(Target, HashMismatch) {
   EXPECT_FALSE(target2.MatchTarget(target1));
 }
 
+/* Targets with the same hardware IDs share them, and copies share the custom metadata. */
+TEST(Target, SharedData) {
+  const std::vector<Uptane::HardwareIdentifier> hardwareIds{Uptane::HardwareIdentifier("fake-test"),
+                                                            Uptane::HardwareIdentifier("extra")};
+  Json::Value json1 = generateImageTarget("hash_good", 739, hardwareIds);
+  json1["custom"]["version"] = "1";
+  Uptane::Target target1("abc", json1);
+  Uptane::Target target2("def", generateImageTarget("hash_good", 42, hardwareIds));
+  Uptane::Target target3("ghi", generateImageTarget("hash_good", 42, {hardwareIds[0]}));
+  EXPECT_EQ(target1.hardwareIds(), hardwareIds);
+  EXPECT_EQ(&target1.hardwareIds(), &target2.hardwareIds());
+  EXPECT_NE(&target1.hardwareIds(), &target3.hardwareIds());
+
+  Uptane::Target copy = target1;
+  EXPECT_EQ(&copy.custom_data(), &target1.custom_data());
+  Json::Value custom = copy.custom_data();
+  custom["version"] = "2";
+  copy.updateCustom(custom);
+  EXPECT_EQ(copy.custom_version(), "2");
+  EXPECT_EQ(target1.custom_version(), "1");
+  EXPECT_EQ(copy.hardwareIds(), hardwareIds);
+
+  EXPECT_TRUE(Uptane::Target::Unknown().hardwareIds().empty());
+  EXPECT_TRUE(Uptane::Target::Unknown().custom_data().isNull());
+}
+
+/* Look up targets and delegations through the index. */
+TEST(Targets, Index) {
+  Uptane::HardwareIdentifier hwid("fake-test");
+  Uptane::EcuMap ecu_map;
+  ecu_map.insert({Uptane::EcuSerial("serial"), hwid});
+
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["targets"]["abc"] = generateDirectorTarget("hash_good", 739, ecu_map);
+  json["signed"]["targets"]["def"] = generateImageTarget("hash_good", 42, {hwid});
+  Json::Value roles(Json::arrayValue);
+  const std::vector<std::pair<std::string, std::vector<std::string>>> delegations = {
+      {"prefixed", {"abc/*"}}, {"suffixed", {"*.txt"}}, {"exact", {"abc/file.txt", "other/[ab]"}}};
+  for (const auto& delegation : delegations) {
+    Json::Value role;
+    role["name"] = delegation.first;
+    role["keyids"] = Json::Value(Json::arrayValue);
+    role["threshold"] = 1;
+    role["terminating"] = false;
+    for (const auto& path : delegation.second) {
+      role["paths"].append(path);
+    }
+    roles.append(role);
+  }
+  json["signed"]["delegations"]["keys"] = Json::Value(Json::objectValue);
+  json["signed"]["delegations"]["roles"] = roles;
+  const Uptane::Targets targets(json);
+
+  ASSERT_NE(targets.findTarget("abc"), nullptr);
+  EXPECT_EQ(targets.findTarget("abc")->length(), 739);
+  EXPECT_EQ(targets.findTarget("ghi"), nullptr);
+
+  const auto ecu_targets = targets.getTargets(Uptane::EcuSerial("serial"), hwid);
+  ASSERT_EQ(ecu_targets.size(), 1);
+  EXPECT_EQ(ecu_targets[0].filename(), "abc");
+  EXPECT_TRUE(targets.getTargets(Uptane::EcuSerial("other"), hwid).empty());
+
+  const std::vector<Uptane::Role> all{Uptane::Role::Delegation("prefixed"), Uptane::Role::Delegation("suffixed"),
+                                      Uptane::Role::Delegation("exact")};
+  EXPECT_EQ(targets.delegationsForPath("abc/file.txt"), all);
+  EXPECT_EQ(targets.delegationsForPath("abc/file"), std::vector<Uptane::Role>{Uptane::Role::Delegation("prefixed")});
+  EXPECT_EQ(targets.delegationsForPath("other/b"), std::vector<Uptane::Role>{Uptane::Role::Delegation("exact")});
+  EXPECT_TRUE(targets.delegationsForPath("other/c").empty());
+
+  // Copies share the index
+  const Uptane::Targets copy = targets;
+  ASSERT_NE(copy.findTarget("def"), nullptr);
+  EXPECT_EQ(copy.findTarget("def")->length(), 42);
+}
+
+/*
+ * Hashed-bin delegations pick the bin from the hash of the target name, with
+ * the same bin names as other TAP-15 implementations.
+ */
+TEST(Targets, HashedBins) {
+  EXPECT_EQ(Uptane::Targets::binName("bin", 1, 1), "bin-1");
+  EXPECT_EQ(Uptane::Targets::binName("bin", 10, 5), "bin-005");
+  EXPECT_EQ(Uptane::Targets::binForPath("bin", 4, "abc/file.txt"), "bin-6");
+  EXPECT_EQ(Uptane::Targets::binForPath("bin", 10, "abc/file.txt"), "bin-188");
+  EXPECT_EQ(Uptane::Targets::binForPath("bin", 32, "abc/file.txt"), "bin-623dbc37");
+
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["targets"] = Json::Value(Json::objectValue);
+  json["signed"]["delegations"]["keys"] = Json::Value(Json::objectValue);
+  json["signed"]["delegations"]["succinct_roles"]["keyids"] = Json::Value(Json::arrayValue);
+  json["signed"]["delegations"]["succinct_roles"]["threshold"] = 1;
+  json["signed"]["delegations"]["succinct_roles"]["bit_length"] = 8;
+  json["signed"]["delegations"]["succinct_roles"]["name_prefix"] = "bin";
+  const Uptane::Targets targets(json);
+
+  EXPECT_EQ(targets.delegationCount(), 256);
+  EXPECT_EQ(targets.delegationAt(0), Uptane::Role::Delegation("bin-00"));
+  EXPECT_EQ(targets.delegationAt(255), Uptane::Role::Delegation("bin-ff"));
+  EXPECT_EQ(targets.delegationsForPath("abc/file.txt"), std::vector<Uptane::Role>{Uptane::Role::Delegation("bin-62")});
+  EXPECT_TRUE(targets.delegationTerminates(Uptane::Role::Delegation("bin-62")));
+  EXPECT_THROW(targets.delegationTerminates(Uptane::Role::Delegation("bin-100")), Uptane::Exception);
+
+  // Bins and explicitly named roles are mutually exclusive
+  Json::Value role;
+  role["name"] = "other";
+  role["threshold"] = 1;
+  json["signed"]["delegations"]["roles"].append(role);
+  EXPECT_THROW(Uptane::Targets{json}, Uptane::InvalidMetadata);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
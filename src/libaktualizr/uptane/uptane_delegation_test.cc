@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -50,7 +51,16 @@ class HttpFakeDelegation : public HttpFake {
     return HttpResponse("", 200, CURLE_OK, "");
   }
 
+  HttpResponse get(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control) override {
+    if (url.find("/delegations/") != std::string::npos) {
+      ++delegations_fetched;
+    }
+    return HttpFake::get(url, maxsize, flow_control);
+  }
+
   unsigned int events_seen{0};
+  // Atomic, as delegations can be fetched in parallel
+  std::atomic<unsigned int> delegations_fetched{0};
 };
 
 /* Validate first-order target delegations.
@@ -92,6 +102,29 @@ TEST(Delegation, Basic) {
   }
 }
 
+/* Sibling delegations fetched ahead give the same result as when fetched one
+ * at a time. */
+TEST(Delegation, ParallelFetch) {
+  for (auto generate_fun : {delegation_basic, delegation_nested}) {
+    TemporaryDirectory temp_dir;
+    auto delegation_path = temp_dir.Path() / "delegation_test";
+    generate_fun(delegation_path, false);
+    auto http = std::make_shared<HttpFakeDelegation>(temp_dir.Path());
+    Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+    conf.uptane.delegation_fetch_concurrency = 4;
+
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.Initialize();
+    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+    EXPECT_GT(http->delegations_fetched, 0);
+
+    result::Download download_result = aktualizr.Download(update_result.updates).get();
+    EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  }
+}
+
 TEST(Delegation, RevokeAfterCheckUpdates) {
   for (auto generate_fun : {delegation_basic, delegation_nested}) {
     TemporaryDirectory temp_dir;
@@ -237,6 +270,95 @@ TEST(Delegation, IterateAll) {
   EXPECT_TRUE(expected_target_names.empty());
 }
 
+/* Iterate over the targets that pass a filter, without fetching delegations that can not match it. */
+TEST(Delegation, IterateFiltered) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_nested(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegation>(temp_dir.Path());
+
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  Uptane::TargetFilter by_prefix;
+  by_prefix.name_prefix = "abc/";
+  std::vector<std::string> target_names;
+  http->delegations_fetched = 0;
+  for (const auto& target : aktualizr.uptane_client()->allTargets(by_prefix)) {
+    target_names.push_back(target.filename());
+  }
+  EXPECT_EQ(target_names, std::vector<std::string>({"abc/secondary.txt", "abc/target0", "abc/target1", "abc/target2"}));
+  // delegation-top and role-abc, but not role-bcd, role-cde or role-def
+  EXPECT_EQ(http->delegations_fetched, 2);
+
+  Uptane::TargetFilter by_hwid;
+  by_hwid.hardware_ids.emplace_back("primary_hw");
+  target_names.clear();
+  for (const auto& target : aktualizr.uptane_client()->allTargets(by_hwid)) {
+    target_names.push_back(target.filename());
+  }
+  EXPECT_EQ(target_names, std::vector<std::string>({"primary.txt"}));
+
+  EXPECT_TRUE(by_prefix.mayMatchPaths({"ab*"}));
+  EXPECT_TRUE(by_prefix.mayMatchPaths({"abc/*"}));
+  EXPECT_TRUE(by_prefix.mayMatchPaths({"abc/file.txt"}));
+  EXPECT_FALSE(by_prefix.mayMatchPaths({"bcd/*", "ab"}));
+  EXPECT_TRUE(by_prefix.mayMatchPaths({"bcd/*", "*.txt"}));
+}
+
+/* Only fetch the delegations that do not match the Snapshot. */
+TEST(Delegation, FetchOnlyChanged) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_nested(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegation>(temp_dir.Path());
+
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  size_t targets_count = 0;
+  for (const auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+    ++targets_count;
+  }
+  EXPECT_EQ(targets_count, 10);
+  EXPECT_GT(http->delegations_fetched, 0);
+
+  // Everything is stored now
+  http->delegations_fetched = 0;
+  for (const auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+  }
+  EXPECT_EQ(http->delegations_fetched, 0);
+
+  // A stored delegation that no longer matches the Snapshot is fetched again
+  std::vector<std::pair<Uptane::Role, std::string>> delegations;
+  ASSERT_TRUE(storage->loadAllDelegations(delegations));
+  ASSERT_FALSE(delegations.empty());
+  Json::Value tampered = Utils::parseJSON(delegations[0].second);
+  tampered["signed"]["targets"]["tampered"]["length"] = 1;
+  storage->storeDelegation(Utils::jsonToCanonicalStr(tampered), delegations[0].first);
+
+  targets_count = 0;
+  for (const auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+    ++targets_count;
+  }
+  EXPECT_EQ(targets_count, 10);
+  EXPECT_EQ(http->delegations_fetched, 1);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
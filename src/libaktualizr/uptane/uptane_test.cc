@@ -4,10 +4,13 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -16,6 +19,7 @@
 #include "crypto/crypto.h"
 #include "crypto/p11engine.h"
 #include "httpfake.h"
+#include "metafake.h"
 #include "libaktualizr/secondaryinterface.h"
 #include "primary/provisioner.h"
 #include "primary/provisioner_test_utils.h"
@@ -244,6 +248,43 @@ TEST(Uptane, PutManifest) {
             "test-package");
 }
 
+/* An unchanged manifest is not sent again before the heartbeat interval. */
+TEST(Uptane, PutManifestHeartbeat) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config = config_common();
+  config.storage.path = temp_dir.Path();
+  boost::filesystem::copy_file("tests/test_data/cred.zip", (temp_dir / "cred.zip").string());
+  config.provision.provision_path = temp_dir / "cred.zip";
+  config.provision.mode = ProvisionMode::kSharedCred;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.provision.primary_ecu_serial = "testecuserial";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.uptane.manifest_heartbeat_sec = 3600;
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+
+  auto report_counter = [&http]() {
+    return http->last_manifest["signed"]["ecu_version_manifests"]["testecuserial"]["signed"]["report_counter"]
+        .asString();
+  };
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  const std::string first = report_counter();
+  EXPECT_FALSE(first.empty());
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_EQ(report_counter(), first);
+
+  // Changed content is sent right away
+  Json::Value custom;
+  custom["key"] = "value";
+  EXPECT_TRUE(sota_client->putManifestSimple(custom));
+  EXPECT_NE(report_counter(), first);
+  EXPECT_EQ(http->last_manifest["signed"]["custom"]["key"].asString(), "value");
+}
+
 class HttpPutManifestFail : public HttpFake {
  public:
   HttpPutManifestFail(const boost::filesystem::path &test_dir_in, std::string flavor = "")
@@ -677,6 +718,282 @@ TEST(Uptane, SendMetadataToSecondary) {
   EXPECT_TRUE(EcuInstallationStartedReportGot);
 }
 
+class CountingSecondaryMock : public SecondaryInterfaceMock {
+ public:
+  explicit CountingSecondaryMock(Primary::VirtualSecondaryConfig &sconfig_in) : SecondaryInterfaceMock(sconfig_in) {}
+  data::InstallationResult sendFirmware(const Uptane::Target &target, const InstallInfo &info,
+                                        const api::FlowControlToken *flow_control) override {
+    ++firmware_sent;
+    return SecondaryInterfaceMock::sendFirmware(target, info, flow_control);
+  }
+  data::InstallationResult install(const Uptane::Target &target, const InstallInfo &info,
+                                   const api::FlowControlToken *flow_control) override {
+    ++installed;
+    return SecondaryInterfaceMock::install(target, info, flow_control);
+  }
+  std::atomic<int> firmware_sent{0};
+  std::atomic<int> installed{0};
+};
+
+/*
+ * Send the firmware to Secondaries as soon as it is downloaded
+ * Don't send it again when installing
+ */
+TEST(Uptane, PipelineSecondaryTransfer) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeEvents>(temp_dir.Path(), "hasupdates");
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.uptane.pipeline_secondary_transfer = true;
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  Primary::VirtualSecondaryConfig ecu_config;
+  ecu_config.ecu_serial = "secondary_ecu_serial";
+  ecu_config.ecu_hardware_id = "secondary_hw";
+  auto sec = std::make_shared<::testing::NiceMock<CountingSecondaryMock>>(ecu_config);
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  up->addSecondary(sec);
+  EXPECT_NO_THROW(up->initialize());
+  result::UpdateCheck update_result = up->fetchMeta();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  EXPECT_CALL(*sec, putMetadataMock(::testing::_)).Times(2);
+  result::Download download_result = up->downloadImages(update_result.updates);
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  up->waitPresends();
+  EXPECT_EQ(sec->firmware_sent, 1);
+
+  result::Install install_result = up->uptaneInstall(download_result.updates);
+  EXPECT_TRUE(install_result.dev_report.isSuccess());
+  EXPECT_EQ(sec->firmware_sent, 1);
+}
+
+/*
+ * Install on the Secondaries and the Primary at the same time
+ * Install on the Secondaries even though the Primary install fails
+ * Report the results of all of them
+ */
+TEST(Uptane, ConcurrentPrimaryInstall) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeEvents>(temp_dir.Path(), "hasupdates");
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.uptane.concurrent_primary_install = true;
+  conf.pacman.fake_fail_install = true;
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  Primary::VirtualSecondaryConfig ecu_config;
+  ecu_config.ecu_serial = "secondary_ecu_serial";
+  ecu_config.ecu_hardware_id = "secondary_hw";
+  auto sec = std::make_shared<::testing::NiceMock<CountingSecondaryMock>>(ecu_config);
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  up->addSecondary(sec);
+  EXPECT_NO_THROW(up->initialize());
+  result::UpdateCheck update_result = up->fetchMeta();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  result::Download download_result = up->downloadImages(update_result.updates);
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  result::Install install_result = up->uptaneInstall(download_result.updates);
+  EXPECT_FALSE(install_result.dev_report.isSuccess());
+  ASSERT_EQ(install_result.ecu_reports.size(), 2);
+  EXPECT_EQ(install_result.ecu_reports[0].serial.ToString(), "CA:FE:A6:D2:84:9D");
+  EXPECT_EQ(install_result.ecu_reports[0].install_res.result_code.num_code,
+            data::ResultCode::Numeric::kInstallFailed);
+  EXPECT_EQ(install_result.ecu_reports[1].serial.ToString(), "secondary_ecu_serial");
+  EXPECT_TRUE(install_result.ecu_reports[1].install_res.isSuccess());
+  EXPECT_EQ(sec->firmware_sent, 1);
+  EXPECT_EQ(sec->installed, 1);
+}
+
+// Like a Secondary that restarted after receiving the firmware: it only has it once it is sent again
+class ForgetfulSecondaryMock : public CountingSecondaryMock {
+ public:
+  explicit ForgetfulSecondaryMock(Primary::VirtualSecondaryConfig &sconfig_in) : CountingSecondaryMock(sconfig_in) {}
+  data::InstallationResult install(const Uptane::Target &target, const InstallInfo &info,
+                                   const api::FlowControlToken *flow_control) override {
+    if (firmware_sent == 0) {
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Firmware has not been received");
+    }
+    return CountingSecondaryMock::install(target, info, flow_control);
+  }
+};
+
+/*
+ * Resume an interrupted installation without sending the firmware again
+ * Send it again if the Secondary lost it meanwhile
+ */
+TEST(Uptane, ResumeSecondaryInstall) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeEvents>(temp_dir.Path(), "hasupdates");
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  Primary::VirtualSecondaryConfig ecu_config;
+  ecu_config.ecu_serial = "secondary_ecu_serial";
+  ecu_config.ecu_hardware_id = "secondary_hw";
+  auto sec = std::make_shared<::testing::NiceMock<ForgetfulSecondaryMock>>(ecu_config);
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  up->addSecondary(sec);
+  EXPECT_NO_THROW(up->initialize());
+  result::UpdateCheck update_result = up->fetchMeta();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  result::Download download_result = up->downloadImages(update_result.updates);
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+
+  // An earlier attempt was interrupted once the Secondary had received the firmware
+  const Uptane::EcuSerial serial("secondary_ecu_serial");
+  for (const auto &target : download_result.updates) {
+    if (target.ecus().count(serial) != 0) {
+      storage->saveInstallStage(serial, target, InstallStage::kFirmwareSent);
+    }
+  }
+  result::Install install_result = up->uptaneInstall(download_result.updates);
+  EXPECT_TRUE(install_result.dev_report.isSuccess());
+  for (const auto &report : install_result.ecu_reports) {
+    EXPECT_TRUE(report.install_res.isSuccess());
+  }
+  EXPECT_EQ(sec->firmware_sent, 1);
+}
+
+class SlowSecondaryMock : public SecondaryInterfaceMock {
+ public:
+  explicit SlowSecondaryMock(Primary::VirtualSecondaryConfig &sconfig_in) : SecondaryInterfaceMock(sconfig_in) {}
+  Uptane::Manifest getManifest() const override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    return manifest_;
+  }
+  std::atomic<int> delay_ms{0};
+};
+
+/* Request Secondary manifests in parallel.
+ * Use the cached manifest of a Secondary that misses the deadline. */
+TEST(Uptane, AssembleManifestSlowSecondary) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.uptane.secondary_manifest_timeout_sec = 1;
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  std::vector<std::shared_ptr<SlowSecondaryMock>> secs;
+  for (const auto &serial : {"secondary_ecu_serial1", "secondary_ecu_serial2"}) {
+    Primary::VirtualSecondaryConfig ecu_config;
+    ecu_config.ecu_serial = serial;
+    ecu_config.ecu_hardware_id = "secondary_hw";
+    secs.push_back(std::make_shared<SlowSecondaryMock>(ecu_config));
+  }
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  for (const auto &sec : secs) {
+    up->addSecondary(sec);
+  }
+  EXPECT_NO_THROW(up->initialize());
+
+  // The first manifest fills the cache.
+  EXPECT_EQ(up->AssembleManifest()["ecu_version_manifests"].size(), 3);
+
+  secs[0]->delay_ms = 3000;
+  secs[1]->delay_ms = 500;
+  const auto start = std::chrono::steady_clock::now();
+  Json::Value manifest = up->AssembleManifest()["ecu_version_manifests"];
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_LT(elapsed, std::chrono::seconds(2));
+  EXPECT_EQ(manifest.size(), 3);
+  EXPECT_TRUE(manifest.isMember("secondary_ecu_serial1"));
+  EXPECT_TRUE(manifest.isMember("secondary_ecu_serial2"));
+}
+
+class BootingSecondaryMock : public SecondaryInterfaceMock {
+ public:
+  explicit BootingSecondaryMock(Primary::VirtualSecondaryConfig &sconfig_in) : SecondaryInterfaceMock(sconfig_in) {}
+  // Every ping takes as long as a connect timeout, the first pings fail
+  bool ping() const override {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    return ++pings > failed_pings;
+  }
+  int failed_pings{1};
+  mutable std::atomic<int> pings{0};
+};
+
+/* Wait for the targeted Secondaries by pinging them in parallel.
+ * Fail when a Secondary doesn't answer before the deadline. */
+TEST(Uptane, WaitSecondariesReachable) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.uptane.secondary_preinstall_wait_sec = 3;
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  std::vector<std::shared_ptr<BootingSecondaryMock>> secs;
+  Uptane::EcuMap ecus;
+  for (const auto &serial : {"secondary_ecu_serial1", "secondary_ecu_serial2", "secondary_ecu_serial3"}) {
+    Primary::VirtualSecondaryConfig ecu_config;
+    ecu_config.ecu_serial = serial;
+    ecu_config.ecu_hardware_id = "secondary_hw";
+    secs.push_back(std::make_shared<BootingSecondaryMock>(ecu_config));
+    ecus.emplace(Uptane::EcuSerial(serial), Uptane::HardwareIdentifier("secondary_hw"));
+  }
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  for (const auto &sec : secs) {
+    up->addSecondary(sec);
+  }
+  EXPECT_NO_THROW(up->initialize());
+  const std::vector<Uptane::Target> updates{Uptane::Target("firmware.bin", ecus, {}, 0)};
+
+  for (auto &sec : secs) {
+    sec->pings = 0;
+  }
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(up->waitSecondariesReachable(updates));
+  // Two rounds of pings in parallel, where one after the other would take six seconds
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(3500));
+  for (const auto &sec : secs) {
+    EXPECT_EQ(sec->pings, 2);
+  }
+
+  for (auto &sec : secs) {
+    sec->pings = 0;
+  }
+  secs[2]->failed_pings = 100;
+  start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(up->waitSecondariesReachable(updates));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(6));
+  EXPECT_EQ(secs[0]->pings, 2);
+  EXPECT_EQ(secs[1]->pings, 2);
+}
+
 /* Register Secondary ECUs with Director. */
 TEST(Uptane, UptaneSecondaryAdd) {
   TemporaryDirectory temp_dir;
@@ -1375,6 +1692,39 @@ TEST(Uptane, offlineIteration) {
   EXPECT_TRUE(Uptane::MatchTargetVector(targets_online, targets_offline));
 }
 
+/*
+ * Fetch the Image repo metadata from repo_server if what the Image repo mirror
+ * has fails verification.
+ */
+TEST(Uptane, RepoMirrorRejected) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  CreateFakeRepoMetaData(meta_dir.Path());
+  Utils::copyDir(meta_dir.Path() / "repo", meta_dir.Path() / "mirror");
+  Json::Value timestamp = Utils::parseJSONFile(meta_dir.Path() / "repo/timestamp_hasupdates.json");
+  timestamp["signed"]["version"] = timestamp["signed"]["version"].asInt() + 1;
+  Utils::writeFile(meta_dir.Path() / "mirror/timestamp.json", timestamp);
+  Utils::copyFile(meta_dir.Path() / "repo/targets_hasupdates.json", meta_dir.Path() / "mirror/targets.json");
+
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", meta_dir.Path());
+  Config config("tests/config/basic.toml");
+  config.storage.path = temp_dir.Path();
+  config.uptane.director_server = http->tls_server + "director";
+  config.uptane.repo_server = http->tls_server + "repo";
+  config.uptane.repo_mirror_url = http->tls_server + "mirror";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  config.provision.primary_ecu_hardware_id = "primary_hw";
+  UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hw");
+  config.postUpdateValues();
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+  result::UpdateCheck result = sota_client->fetchMeta();
+  EXPECT_EQ(result.status, result::UpdateStatus::kUpdatesAvailable);
+}
+
 /*
  * Ignore updates for unrecognized ECUs.
  * Reject targets which do not match a known ECU.
@@ -15,8 +15,18 @@ const std::string RepositoryType::IMAGE = "image";
 
 void RepositoryCommon::initRoot(RepositoryType repo_type, const std::string& root_raw) {
   try {
-    root = Root(type, Utils::parseJSON(root_raw));        // initialization and format check
-    root = Root(type, Utils::parseJSON(root_raw), root);  // signature verification against itself
+    root_digest_.clear();
+    const std::string raw_digest = Crypto::sha256digest(root_raw);
+    // The stored Root is loaded again for every update, and rarely changes
+    if (verified_root_.meta == nullptr || verified_root_.raw_digest != raw_digest) {
+      verified_root_ = VerifiedMeta<Root>();
+      const Json::Value root_json = Utils::parseJSON(root_raw);
+      Root self_signed(type, root_json);  // initialization and format check
+      verified_root_.meta = std::make_shared<Root>(type, root_json, self_signed);  // signature verification
+      verified_root_.raw_digest = raw_digest;
+    }
+    root = *verified_root_.meta;
+    root_digest_ = raw_digest;
   } catch (const std::exception& e) {
     LOG_ERROR << "Loading initial " << repo_type << " Root metadata failed: " << e.what();
     throw;
@@ -26,6 +36,7 @@ void RepositoryCommon::initRoot(RepositoryType repo_type, const std::string& roo
 void RepositoryCommon::verifyRoot(const std::string& root_raw) {
   try {
     int prev_version = rootVersion();
+    root_digest_.clear();
     // 5.4.4.3.2.3. Version N+1 of the Root metadata file MUST have been signed
     // by the following: (1) a threshold of keys specified in the latest Root
     // metadata file (version N), and (2) a threshold of keys specified in the
@@ -40,13 +51,17 @@ void RepositoryCommon::verifyRoot(const std::string& root_raw) {
                 << prev_version + 1;
       throw Uptane::RootRotationError(type.ToString());
     }
+    root_digest_ = Crypto::sha256digest(root_raw);
   } catch (const std::exception& e) {
     LOG_ERROR << "Signature verification for Root metadata failed: " << e.what();
     throw;
   }
 }
 
-void RepositoryCommon::resetRoot() { root = Root(Root::Policy::kAcceptAll); }
+void RepositoryCommon::resetRoot() {
+  root = Root(Root::Policy::kAcceptAll);
+  root_digest_.clear();
+}
 
 void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& fetcher,
                                   const RepositoryType repo_type) {
@@ -63,7 +78,17 @@ void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& f
   }
 
   // 5.4.4.3.2. Update to the latest Root metadata file.
-  for (int version = rootVersion() + 1; version < kMaxRotations; ++version) {
+  std::vector<std::string> chain;
+  const bool chained = fetcher.fetchRootChain(&chain, repo_type, rootVersion());
+  if (chained) {
+    // Every version is verified against the one before, just as when fetched one at a time
+    for (const auto& root_raw : chain) {
+      verifyRoot(root_raw);
+      storage.storeRoot(root_raw, repo_type, Version(rootVersion()));
+      storage.clearNonRootMeta(repo_type);
+    }
+  }
+  for (int version = rootVersion() + 1; !chained && version < kMaxRotations; ++version) {
     // 5.4.4.3.2.2. Try downloading a new version N+1 of the Root metadata file.
     std::string root_raw;
     try {
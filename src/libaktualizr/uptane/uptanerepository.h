@@ -2,11 +2,18 @@
 #define UPTANE_REPOSITORY_H_
 
 #include <cstdint>  // for int64_t
+#include <memory>   // for shared_ptr
 #include <string>   // for string
+
+#include "gtest/gtest_prod.h"
+
+#include "crypto/crypto.h"
 #include "fetcher.h"
 #include "libaktualizr/types.h"  // for TimeStamp
 #include "uptane/tuf.h"          // for Root, RepositoryType
 #include "utilities/flow_control.h"
+#include "utilities/json_reader.h"
+#include "utilities/utils.h"
 
 class INvStorage;
 
@@ -34,13 +41,60 @@ class RepositoryCommon {
 #endif
 
  protected:
+  /* Metadata parsed from some raw content, and verified against some Root.
+   * Lets unchanged metadata be checked again without parsing it again. */
+  template <typename T>
+  struct VerifiedMeta {
+    std::string raw_digest;
+    // Lower case hex digests of the canonical JSON, as listed in Snapshot and Timestamp
+    std::string canonical_sha256;
+    std::string canonical_sha512;
+    // Digest of the Root the signatures were verified with, empty if not verified
+    std::string root_digest;
+    std::shared_ptr<T> meta;
+  };
+
   void resetRoot();
   void updateRoot(INvStorage &storage, const IMetadataFetcher &fetcher, RepositoryType repo_type);
 
+  // Returns true if `cache` holds `raw` as verified against the current Root.
+  // Otherwise parses `raw` into `json`, and updates the digests in `cache`.
+  template <typename T>
+  bool findVerified(const std::string &raw, VerifiedMeta<T> *cache, Json::Value *json) const {
+    const std::string raw_digest = Crypto::sha256digest(raw);
+    if (cache->raw_digest == raw_digest && cache->meta != nullptr && !root_digest_.empty() &&
+        cache->root_digest == root_digest_) {
+      return true;
+    }
+    *json = JsonReader::parse(raw);
+    if (cache->raw_digest != raw_digest) {
+      const std::string canonical = Utils::jsonToCanonicalStr(*json);
+      *cache = VerifiedMeta<T>();
+      cache->raw_digest = raw_digest;
+      cache->canonical_sha256 = Crypto::sha256digestHex(canonical);
+      cache->canonical_sha512 = Crypto::sha512digestHex(canonical);
+    }
+    return false;
+  }
+
+  template <typename T>
+  void setVerified(VerifiedMeta<T> *cache, std::shared_ptr<T> meta) const {
+    cache->meta = std::move(meta);
+    cache->root_digest = root_digest_;
+  }
+
   static const int64_t kMaxRotations = 1000;
 
   Root root;
   RepositoryType type;
+
+ private:
+  FRIEND_TEST(Director, VerifiedRootReused);
+
+  // Digest of the raw current Root, empty if there is none
+  std::string root_digest_;
+  // The last Root verified against itself by initRoot(), kept across resetRoot()
+  VerifiedMeta<Root> verified_root_;
 };
 }  // namespace Uptane
 
@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 
 #include <chrono>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "utilities/apiqueue.h"
 
 using std::cout;
@@ -46,6 +48,120 @@ TEST(ApiQueue, Simple) {
   EXPECT_EQ(result.get(), 100);
 }
 
+/* Control commands overtake waiting commands and run alongside a bulk
+ * command; other commands wait for it. */
+TEST(ApiQueue, Lanes) {
+  api::CommandQueue dut;
+  std::promise<void> bulk_started;
+  std::promise<void> release_bulk;
+  std::shared_future<void> released = release_bulk.get_future().share();
+  std::vector<std::string> order;
+  std::mutex order_m;
+  auto record = [&order, &order_m](const std::string& name) {
+    std::lock_guard<std::mutex> guard(order_m);
+    order.push_back(name);
+  };
+
+  std::function<void()> bulk([&] {
+    bulk_started.set_value();
+    released.wait();
+    record("bulk");
+  });
+  std::function<void()> metadata([&] { record("metadata"); });
+  std::function<void()> control([&] { record("control"); });
+  auto bulk_done = dut.enqueue(std::move(bulk), api::Lane::kBulk);
+  dut.run();
+  bulk_started.get_future().wait();
+
+  auto metadata_done = dut.enqueue(std::move(metadata));
+  auto control_done = dut.enqueue(std::move(control), api::Lane::kControl);
+  ASSERT_EQ(control_done.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(metadata_done.wait_for(std::chrono::milliseconds(100)), future_status::timeout);
+
+  release_bulk.set_value();
+  ASSERT_EQ(metadata_done.wait_for(std::chrono::seconds(10)), future_status::ready);
+  bulk_done.get();
+  const std::vector<std::string> expected{"control", "bulk", "metadata"};
+  EXPECT_EQ(order, expected);
+}
+
+/* A paused queue does not run control commands next to a bulk command. */
+TEST(ApiQueue, LanesPaused) {
+  api::CommandQueue dut;
+  std::promise<void> bulk_started;
+  std::promise<void> release_bulk;
+  std::shared_future<void> released = release_bulk.get_future().share();
+  std::function<void()> bulk([&] {
+    bulk_started.set_value();
+    released.wait();
+  });
+  std::function<int()> control([] { return 1; });
+  auto bulk_done = dut.enqueue(std::move(bulk), api::Lane::kBulk);
+  dut.run();
+  bulk_started.get_future().wait();
+
+  dut.pause(true);
+  auto control_done = dut.enqueue(std::move(control), api::Lane::kControl);
+  EXPECT_EQ(control_done.wait_for(std::chrono::milliseconds(100)), future_status::timeout);
+  dut.pause(false);
+  ASSERT_EQ(control_done.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(control_done.get(), 1);
+  release_bulk.set_value();
+  bulk_done.get();
+}
+
+/* Commands enqueued with a completion hand their future to it, also when
+ * abort() drops them before they run. */
+TEST(ApiQueue, Completion) {
+  api::CommandQueue dut;
+  std::promise<int> done;
+  std::function<int()> task([] { return 42; });
+  dut.enqueue(std::move(task), api::Lane::kMetadata,
+              std::function<void(future<int>)>([&done](future<int> result) { done.set_value(result.get()); }));
+  dut.run();
+  auto done_future = done.get_future();
+  ASSERT_EQ(done_future.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(done_future.get(), 42);
+
+  dut.pause(true);
+  std::promise<bool> dropped;
+  std::function<int()> never([] { return 0; });
+  dut.enqueue(std::move(never), api::Lane::kMetadata, std::function<void(future<int>)>([&dropped](future<int> result) {
+                try {
+                  result.get();
+                  dropped.set_value(false);
+                } catch (const std::future_error&) {
+                  dropped.set_value(true);
+                }
+              }));
+  dut.abort();
+  auto dropped_future = dropped.get_future();
+  ASSERT_EQ(dropped_future.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_TRUE(dropped_future.get());
+}
+
+/* Delayed commands wait without holding up other commands, and are dropped
+ * by abort(). */
+TEST(ApiQueue, Delayed) {
+  api::CommandQueue dut;
+  dut.run();
+  const auto start = std::chrono::steady_clock::now();
+  std::function<std::chrono::steady_clock::time_point()> later([] { return std::chrono::steady_clock::now(); });
+  auto later_result = dut.enqueueAfter(std::chrono::milliseconds(300), std::move(later));
+  std::function<int()> now([] { return 1; });
+  auto now_result = dut.enqueue(std::move(now));
+  ASSERT_EQ(now_result.wait_for(std::chrono::milliseconds(200)), future_status::ready);
+  EXPECT_EQ(dut.snapshot()["delayed"].asUInt(), 1);
+  ASSERT_EQ(later_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_GE(later_result.get() - start, std::chrono::milliseconds(300));
+
+  std::function<int()> never([] { return 0; });
+  auto never_result = dut.enqueueAfter(std::chrono::hours(1), std::move(never), api::Lane::kControl);
+  dut.abort();
+  ASSERT_EQ(never_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_THROW(never_result.get(), std::future_error);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -13,6 +13,45 @@ CommandQueue::~CommandQueue() {
   }
 }
 
+bool CommandQueue::hasPending() const {
+  for (const auto& queue : queues_) {
+    if (!queue.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ICommand::Ptr CommandQueue::takeNext(Lane* lane) {
+  for (size_t i = 0; i < kLanes; ++i) {
+    if (!queues_[i].empty()) {
+      auto task = std::move(queues_[i].front());
+      queues_[i].pop();
+      *lane = static_cast<Lane>(i);
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void CommandQueue::promoteDelayed() {
+  const auto now = Clock::now();
+  while (!delayed_.empty() && delayed_.begin()->first <= now) {
+    auto& entry = delayed_.begin()->second;
+    queues_[static_cast<size_t>(entry.second)].push(std::move(entry.first));
+    delayed_.erase(delayed_.begin());
+  }
+}
+
+void CommandQueue::waitForWork(std::unique_lock<std::mutex>& lock) {
+  if (delayed_.empty()) {
+    cv_.wait(lock);
+  } else {
+    cv_.wait_until(lock, delayed_.begin()->first);
+  }
+  promoteDelayed();
+}
+
 void CommandQueue::run() {
   std::lock_guard<std::mutex> g(thread_m_);
   if (!thread_.joinable()) {
@@ -20,15 +59,50 @@ void CommandQueue::run() {
       Context ctx{.flow_control = &token_};
       std::unique_lock<std::mutex> lock(m_);
       for (;;) {
-        cv_.wait(lock, [this] { return (!queue_.empty() && !paused_) || shutdown_; });
+        promoteDelayed();
+        while (!((hasPending() && !paused_) || shutdown_)) {
+          waitForWork(lock);
+        }
+        if (shutdown_) {
+          break;
+        }
+        Lane lane{Lane::kMetadata};
+        auto task = takeNext(&lane);
+        const bool bulk = (lane == Lane::kBulk);
+        bulk_running_ = bulk;
+        ++running_;
+        lock.unlock();
+        if (bulk) {
+          cv_.notify_all();
+        }
+        task->PerformTask(&ctx);
+        lock.lock();
+        --running_;
+        bulk_running_ = false;
+      }
+    });
+  }
+  if (!control_thread_.joinable()) {
+    // Keeps control commands from waiting for a bulk transfer to finish
+    control_thread_ = std::thread([this] {
+      Context ctx{.flow_control = &token_};
+      auto& control = queues_[static_cast<size_t>(Lane::kControl)];
+      std::unique_lock<std::mutex> lock(m_);
+      for (;;) {
+        promoteDelayed();
+        while (!((bulk_running_ && !control.empty() && !paused_) || shutdown_)) {
+          waitForWork(lock);
+        }
         if (shutdown_) {
           break;
         }
-        auto task = std::move(queue_.front());
-        queue_.pop();
+        auto task = std::move(control.front());
+        control.pop();
+        ++running_;
         lock.unlock();
         task->PerformTask(&ctx);
         lock.lock();
+        --running_;
       }
     });
   }
@@ -59,10 +133,16 @@ void CommandQueue::abort(bool restart_thread) {
     if (thread_.joinable()) {
       thread_.join();
     }
+    if (control_thread_.joinable()) {
+      control_thread_.join();
+    }
     {
       // Flush the queue and reset to initial state
       std::lock_guard<std::mutex> g(m_);
-      std::queue<ICommand::Ptr>().swap(queue_);
+      for (auto& queue : queues_) {
+        std::queue<ICommand::Ptr>().swap(queue);
+      }
+      delayed_.clear();
       token_.reset();
       shutdown_ = false;
     }
@@ -72,12 +152,35 @@ void CommandQueue::abort(bool restart_thread) {
   }
 }
 
-void CommandQueue::enqueue(ICommand::Ptr&& task) {
+void CommandQueue::enqueue(ICommand::Ptr&& task, Lane lane) {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    queues_[static_cast<size_t>(lane)].push(std::move(task));
+  }
+  cv_.notify_all();
+}
+
+void CommandQueue::enqueueAfter(std::chrono::milliseconds delay, ICommand::Ptr&& task, Lane lane) {
   {
     std::lock_guard<std::mutex> lock(m_);
-    queue_.push(std::move(task));
+    delayed_.emplace(Clock::now() + delay, std::make_pair(std::move(task), lane));
   }
+  // Workers wake up for the earliest delayed command
   cv_.notify_all();
 }
 
+Json::Value CommandQueue::snapshot() {
+  static const std::array<const char*, kLanes> lanes{"control", "metadata", "bulk"};
+  Json::Value snapshot;
+  std::lock_guard<std::mutex> lock(m_);
+  for (size_t i = 0; i < kLanes; ++i) {
+    snapshot["pending"][lanes[i]] = static_cast<Json::UInt64>(queues_[i].size());
+  }
+  snapshot["delayed"] = static_cast<Json::UInt64>(delayed_.size());
+  snapshot["running"] = static_cast<Json::UInt64>(running_);
+  snapshot["bulkRunning"] = bulk_running_;
+  snapshot["paused"] = paused_.load();
+  return snapshot;
+}
+
 }  // namespace api
@@ -1,15 +1,20 @@
 #ifndef AKTUALIZR_APIQUEUE_H
 #define AKTUALIZR_APIQUEUE_H
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <future>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
 #include <utility>
 
+#include "json/json.h"
+
 #include "utilities/flow_control.h"
 
 namespace api {
@@ -32,28 +37,66 @@ class ICommand {
   virtual void PerformTask(Context* ctx) = 0;
 };
 
+/**
+ * Runs a callback once the result of a command is set, or when the command is
+ * dropped without running, in which case its future holds a broken_promise
+ * error.
+ */
 template <class T>
-class CommandBase : public ICommand {
+class CompletionHook : public ICommand {
  public:
-  void PerformTask(Context* ctx) override {
-    try {
-      result_.set_value(TaskImplementation(ctx));
-    } catch (...) {
-      result_.set_exception(std::current_exception());
+  ~CompletionHook() override {
+    if (!completed_ && on_complete_) {
+      try {
+        result_.set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        on_complete_();
+      } catch (...) {
+      }
     }
   }
+  CompletionHook(const CompletionHook&) = delete;
+  CompletionHook(CompletionHook&&) = delete;
+  CompletionHook& operator=(const CompletionHook&) = delete;
+  CompletionHook& operator=(CompletionHook&&) = delete;
 
   std::future<T> GetFuture() { return result_.get_future(); }
+  void OnComplete(std::function<void()>&& on_complete) { on_complete_ = std::move(on_complete); }
 
  protected:
-  virtual T TaskImplementation(Context*) = 0;
+  CompletionHook() = default;
+
+  void complete() {
+    completed_ = true;
+    if (on_complete_) {
+      on_complete_();
+    }
+  }
 
- private:
   std::promise<T> result_;
+
+ private:
+  bool completed_{false};
+  std::function<void()> on_complete_;
+};
+
+template <class T>
+class CommandBase : public CompletionHook<T> {
+ public:
+  void PerformTask(Context* ctx) override {
+    try {
+      this->result_.set_value(TaskImplementation(ctx));
+    } catch (...) {
+      this->result_.set_exception(std::current_exception());
+    }
+    this->complete();
+  }
+
+ protected:
+  virtual T TaskImplementation(Context*) = 0;
 };
 
 template <>
-class CommandBase<void> : public ICommand {
+class CommandBase<void> : public CompletionHook<void> {
  public:
   void PerformTask(Context* ctx) override {
     try {
@@ -62,15 +105,11 @@ class CommandBase<void> : public ICommand {
     } catch (...) {
       result_.set_exception(std::current_exception());
     }
+    complete();
   }
 
-  std::future<void> GetFuture() { return result_.get_future(); }
-
  protected:
   virtual void TaskImplementation(Context*) = 0;
-
- private:
-  std::promise<void> result_;
 };
 
 template <class T>
@@ -96,6 +135,19 @@ class CommandFlowControl : public CommandBase<T> {
   std::function<T(const api::FlowControlToken*)> f_;
 };
 
+/**
+ * Lanes of the command queue, from the most to the least urgent. A waiting
+ * command runs before any command waiting in a less urgent lane.
+ */
+enum class Lane {
+  /** Short requests that may run alongside a bulk transfer. */
+  kControl = 0,
+  /** Everything else; the default. */
+  kMetadata,
+  /** Long-running transfers, such as downloading targets. */
+  kBulk,
+};
+
 class CommandQueue {
  public:
   CommandQueue() = default;
@@ -105,6 +157,11 @@ class CommandQueue {
   CommandQueue(CommandQueue&&) = delete;
   CommandQueue& operator=(const CommandQueue&) = delete;
   CommandQueue& operator=(CommandQueue&&) = delete;
+  /**
+   * Start the worker threads. Commands run one at a time on the main worker,
+   * except that while a kBulk command runs, kControl commands are picked up
+   * by a second worker.
+   */
   void run();
   bool pause(bool do_pause);  // returns true iff pause→resume or resume→pause
   /**
@@ -117,29 +174,78 @@ class CommandQueue {
   const api::FlowControlToken* FlowControlToken() const { return &token_; }
 
   template <class R>
-  std::future<R> enqueue(std::function<R()>&& function) {
+  std::future<R> enqueue(std::function<R()>&& function, Lane lane = Lane::kMetadata) {
     auto task = std::make_shared<Command<R>>(std::move(function));
-    enqueue(task);
+    enqueue(task, lane);
     return task->GetFuture();
   }
 
   template <class R>
-  std::future<R> enqueue(std::function<R(const api::FlowControlToken*)>&& function) {
+  std::future<R> enqueue(std::function<R(const api::FlowControlToken*)>&& function, Lane lane = Lane::kMetadata) {
     auto task = std::make_shared<CommandFlowControl<R>>(std::move(function));
-    enqueue(task);
+    enqueue(task, lane);
+    return task->GetFuture();
+  }
+
+  /**
+   * Like enqueue(), but hands the future to `done` once it is ready instead
+   * of returning it. That is also the case if abort() drops the command
+   * before it runs. `done` is called on a worker thread, so it would usually
+   * pass the result on with CompletionQueue::post().
+   */
+  template <class R>
+  void enqueue(std::function<R()>&& function, Lane lane, std::function<void(std::future<R>)>&& done) {
+    auto task = std::make_shared<Command<R>>(std::move(function));
+    auto future = std::make_shared<std::future<R>>(task->GetFuture());
+    task->OnComplete([future, done]() { done(std::move(*future)); });
+    enqueue(task, lane);
+  }
+
+  void enqueue(ICommand::Ptr&& task, Lane lane = Lane::kMetadata);
+
+  /**
+   * Like enqueue(), but the command only joins its lane once `delay` has
+   * passed, e.g. to retry an operation later. No thread waits for it
+   * meanwhile, and abort() drops it like the other waiting commands.
+   */
+  template <class R>
+  std::future<R> enqueueAfter(std::chrono::milliseconds delay, std::function<R()>&& function,
+                              Lane lane = Lane::kMetadata) {
+    auto task = std::make_shared<Command<R>>(std::move(function));
+    enqueueAfter(delay, task, lane);
     return task->GetFuture();
   }
 
-  void enqueue(ICommand::Ptr&& task);
+  void enqueueAfter(std::chrono::milliseconds delay, ICommand::Ptr&& task, Lane lane = Lane::kMetadata);
+
+  /**
+   * The number of commands waiting in each lane and running, and whether the
+   * queue is paused, for diagnostics.
+   */
+  Json::Value snapshot();
 
  private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kLanes = 3;
+  bool hasPending() const;
+  ICommand::Ptr takeNext(Lane* lane);
+  // Moves the delayed commands that are due to their lanes; called with m_ held
+  void promoteDelayed();
+  // Waits for a notification or for the next delayed command to be due; called with m_ held
+  void waitForWork(std::unique_lock<std::mutex>& lock);
+
   std::atomic_bool shutdown_{false};
   std::atomic_bool paused_{false};
 
   std::thread thread_;
+  std::thread control_thread_;
   std::mutex thread_m_;
 
-  std::queue<ICommand::Ptr> queue_;
+  std::array<std::queue<ICommand::Ptr>, kLanes> queues_;
+  std::multimap<Clock::time_point, std::pair<ICommand::Ptr, Lane>> delayed_;
+  bool bulk_running_{false};
+  // Commands running on either worker
+  size_t running_{0};
   std::mutex m_;
   std::condition_variable cv_;
   class api::FlowControlToken token_;
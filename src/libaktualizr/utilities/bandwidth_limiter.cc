@@ -0,0 +1,172 @@
+#include "utilities/bandwidth_limiter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+constexpr std::chrono::seconds BandwidthLimiter::kRefreshInterval;
+
+BandwidthLimiter::BandwidthLimiter(const UptaneConfig& config)
+    : default_rate_{static_cast<int64_t>(config.download_bandwidth_limit)},
+      metered_rate_{static_cast<int64_t>(config.metered_bandwidth_limit)},
+      pause_on_metered_{config.pause_downloads_on_metered} {
+  try {
+    windows_ = parseWindows(config.download_bandwidth_windows);
+  } catch (const std::invalid_argument& e) {
+    LOG_ERROR << "Ignoring uptane.download_bandwidth_windows: " << e.what();
+  }
+
+  boost::split(metered_interfaces_, config.metered_interfaces, boost::is_any_of(", "), boost::token_compress_on);
+  metered_interfaces_.erase(std::remove(metered_interfaces_.begin(), metered_interfaces_.end(), ""),
+                            metered_interfaces_.end());
+  if (!metered_interfaces_.empty() && (metered_rate_ > 0 || pause_on_metered_)) {
+    metered_check_ = [this]() {
+      const std::string interface = Utils::getDefaultRouteInterface();
+      return std::any_of(metered_interfaces_.cbegin(), metered_interfaces_.cend(),
+                         [&interface](const std::string& prefix) { return boost::starts_with(interface, prefix); });
+    };
+  }
+}
+
+std::vector<BandwidthLimiter::Window> BandwidthLimiter::parseWindows(const std::string& spec, bool with_rate) {
+  std::vector<std::string> entries;
+  boost::split(entries, spec, boost::is_any_of(","));
+  std::vector<Window> windows;
+  for (auto entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    int start_hour = 0;
+    int start_min = 0;
+    int end_hour = 0;
+    int end_min = 0;
+    long long rate = 0;  // NOLINT(google-runtime-int)
+    int consumed = 0;
+    const int fields = with_rate ? std::sscanf(entry.c_str(), "%d:%d-%d:%d=%lld%n", &start_hour, &start_min, &end_hour,
+                                               &end_min, &rate, &consumed)
+                                 : std::sscanf(entry.c_str(), "%d:%d-%d:%d%n", &start_hour, &start_min, &end_hour,
+                                               &end_min, &consumed) + 1;
+    if (fields != 5 || static_cast<size_t>(consumed) != entry.size() || start_hour < 0 || start_hour > 24 ||
+        end_hour < 0 || end_hour > 24 || start_min < 0 || start_min > 59 || end_min < 0 || end_min > 59 || rate < 0 ||
+        (start_hour == 24 && start_min != 0) || (end_hour == 24 && end_min != 0)) {
+      throw std::invalid_argument(with_rate ? "Invalid bandwidth window \"" + entry +
+                                                  "\", expected HH:MM-HH:MM=bytes_per_sec"
+                                            : "Invalid time window \"" + entry + "\", expected HH:MM-HH:MM");
+    }
+    // 24:00 is the start of the next day, or the end of this one
+    windows.push_back({(start_hour * 60 + start_min) % (24 * 60), end_hour * 60 + end_min, static_cast<int64_t>(rate)});
+  }
+  return windows;
+}
+
+void BandwidthLimiter::setMeteredCheck(std::function<bool()> check) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  metered_check_ = std::move(check);
+  next_refresh_ = Clock::time_point{};
+}
+
+const BandwidthLimiter::Window* BandwidthLimiter::findWindow(const std::vector<Window>& windows, int minute_of_day) {
+  for (const auto& window : windows) {
+    const bool inside = window.start_minute <= window.end_minute
+                            ? minute_of_day >= window.start_minute && minute_of_day < window.end_minute
+                            : minute_of_day >= window.start_minute || minute_of_day < window.end_minute;
+    if (inside) {
+      return &window;
+    }
+  }
+  return nullptr;
+}
+
+int BandwidthLimiter::localMinuteOfDay() {
+  const std::time_t t = std::time(nullptr);
+  struct tm local {};
+  localtime_r(&t, &local);
+  return local.tm_hour * 60 + local.tm_min;
+}
+
+int64_t BandwidthLimiter::rateAt(int minute_of_day, bool metered) const {
+  const Window* window = findWindow(windows_, minute_of_day);
+  int64_t rate = window != nullptr ? window->bytes_per_sec : default_rate_;
+  if (metered && metered_rate_ > 0) {
+    rate = rate == 0 ? metered_rate_ : std::min(rate, metered_rate_);
+  }
+  return rate;
+}
+
+void BandwidthLimiter::refresh(Clock::time_point now) {
+  if (now < next_refresh_) {
+    return;
+  }
+  next_refresh_ = now + kRefreshInterval;
+
+  const bool metered = metered_check_ ? metered_check_() : false;
+  if (metered != metered_) {
+    LOG_INFO << "Network link is " << (metered ? "metered" : "not metered");
+    metered_ = metered;
+  }
+
+  const int64_t rate = rateAt(localMinuteOfDay(), metered_);
+  if (rate != rate_) {
+    if (rate > 0) {
+      LOG_INFO << "Limiting downloads to " << rate << " bytes per second";
+    } else {
+      LOG_INFO << "Not limiting the download bandwidth";
+    }
+    rate_ = rate;
+    tokens_ = std::min(tokens_, static_cast<double>(rate_));
+  }
+}
+
+bool BandwidthLimiter::paused() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  refresh(Clock::now());
+  return pause_on_metered_ && metered_;
+}
+
+bool BandwidthLimiter::waitUntilResumed(const api::FlowControlToken* token) {
+  bool waiting = false;
+  while (paused()) {
+    if (!waiting) {
+      LOG_INFO << "Downloads are paused until the network link is not metered";
+      waiting = true;
+    }
+    // Also sleeps while the token is paused
+    if (token != nullptr && !token->canContinue()) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  return true;
+}
+
+void BandwidthLimiter::acquire(size_t bytes) {
+  std::chrono::duration<double> wait{0.0};
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const auto now = Clock::now();
+    refresh(now);
+    if (rate_ <= 0) {
+      return;
+    }
+    const auto rate = static_cast<double>(rate_);
+    // Up to one second worth of bytes can be taken at once
+    tokens_ = std::min(tokens_ + std::chrono::duration<double>(now - last_fill_).count() * rate, rate);
+    last_fill_ = now;
+    tokens_ -= static_cast<double>(bytes);
+    if (tokens_ < 0) {
+      wait = std::chrono::duration<double>(-tokens_ / rate);
+    }
+  }
+  if (wait.count() > 0) {
+    std::this_thread::sleep_for(wait);
+  }
+}
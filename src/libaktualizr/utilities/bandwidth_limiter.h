@@ -0,0 +1,85 @@
+#ifndef BANDWIDTH_LIMITER_H_
+#define BANDWIDTH_LIMITER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "utilities/flow_control.h"
+
+struct UptaneConfig;
+
+/**
+ * Token bucket shared by all concurrent Target downloads.
+ *
+ * The rate is uptane.download_bandwidth_limit, or that of the first of the
+ * uptane.download_bandwidth_windows that contains the local time of day. On a
+ * metered link, the lower uptane.metered_bandwidth_limit applies, and with
+ * uptane.pause_downloads_on_metered downloads wait for another link instead.
+ * A link is metered if the name of the interface with the default route starts
+ * with one of uptane.metered_interfaces, unless a different check is set with
+ * setMeteredCheck(). Both are evaluated again every few seconds.
+ */
+class BandwidthLimiter {
+ public:
+  struct Window {
+    int start_minute;       // Minute of the day, in local time
+    int end_minute;         // Exclusive, up to 24 * 60; lower than start_minute if the window spans midnight
+    int64_t bytes_per_sec;  // 0 for no limit
+  };
+
+  explicit BandwidthLimiter(const UptaneConfig& config);
+
+  /**
+   * Parse a comma-separated list of windows like "08:00-18:00=262144", or
+   * like "22:00-06:00" without `with_rate`.
+   * @throws std::invalid_argument on a malformed window
+   */
+  static std::vector<Window> parseWindows(const std::string& spec, bool with_rate = true);
+
+  /** The first of `windows` that contains `minute_of_day`, or nullptr. */
+  static const Window* findWindow(const std::vector<Window>& windows, int minute_of_day);
+
+  /** The current minute of the day, in local time. */
+  static int localMinuteOfDay();
+
+  /** Replace the check for metered links, e.g. with one that asks the network manager. */
+  void setMeteredCheck(std::function<bool()> check);
+
+  /** The rate limit at `minute_of_day`, in bytes per second, 0 for none. */
+  int64_t rateAt(int minute_of_day, bool metered) const;
+
+  /** Whether downloads should wait for a link that is not metered. */
+  bool paused();
+  /** Wait while paused(). Returns false if `token` is aborted in the meantime. */
+  bool waitUntilResumed(const api::FlowControlToken* token);
+  /** Take `bytes` from the bucket, waiting until they are available. */
+  void acquire(size_t bytes);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::seconds kRefreshInterval{5};
+
+  // Called with mutex_ held
+  void refresh(Clock::time_point now);
+
+  int64_t default_rate_;
+  int64_t metered_rate_;
+  bool pause_on_metered_;
+  std::vector<std::string> metered_interfaces_;
+  std::vector<Window> windows_;
+  std::function<bool()> metered_check_;
+
+  std::mutex mutex_;
+  Clock::time_point next_refresh_{};
+  bool metered_{false};
+  int64_t rate_{0};
+  // May go negative: the debt is paid off by whoever takes bytes next
+  double tokens_{0.0};
+  Clock::time_point last_fill_{};
+};
+
+#endif  // BANDWIDTH_LIMITER_H_
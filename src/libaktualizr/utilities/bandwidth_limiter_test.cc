@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/bandwidth_limiter.h"
+
+TEST(BandwidthLimiter, ParseWindows) {
+  auto windows = BandwidthLimiter::parseWindows(" 08:00-18:30=1000, 22:00-06:00=0,,00:00-24:00=5");
+  ASSERT_EQ(windows.size(), 3);
+  EXPECT_EQ(windows[0].start_minute, 8 * 60);
+  EXPECT_EQ(windows[0].end_minute, 18 * 60 + 30);
+  EXPECT_EQ(windows[0].bytes_per_sec, 1000);
+  EXPECT_EQ(windows[1].start_minute, 22 * 60);
+  EXPECT_EQ(windows[1].end_minute, 6 * 60);
+  EXPECT_EQ(windows[2].end_minute, 24 * 60);
+
+  EXPECT_TRUE(BandwidthLimiter::parseWindows("").empty());
+  EXPECT_THROW(BandwidthLimiter::parseWindows("08:00-18:00"), std::invalid_argument);
+  EXPECT_THROW(BandwidthLimiter::parseWindows("08:00-18:00=10kB"), std::invalid_argument);
+  EXPECT_THROW(BandwidthLimiter::parseWindows("08:60-18:00=10"), std::invalid_argument);
+  EXPECT_THROW(BandwidthLimiter::parseWindows("24:30-18:00=10"), std::invalid_argument);
+  EXPECT_THROW(BandwidthLimiter::parseWindows("08:00-18:00=-1"), std::invalid_argument);
+}
+
+/* Windows without a rate, like uptane.predownload_windows, may span midnight. */
+TEST(BandwidthLimiter, TimeWindows) {
+  auto windows = BandwidthLimiter::parseWindows("22:00-06:00, 12:00-13:00", false);
+  ASSERT_EQ(windows.size(), 2);
+  EXPECT_EQ(BandwidthLimiter::findWindow(windows, 23 * 60), &windows[0]);
+  EXPECT_EQ(BandwidthLimiter::findWindow(windows, 5 * 60 + 59), &windows[0]);
+  EXPECT_EQ(BandwidthLimiter::findWindow(windows, 12 * 60 + 30), &windows[1]);
+  EXPECT_EQ(BandwidthLimiter::findWindow(windows, 6 * 60), nullptr);
+  EXPECT_EQ(BandwidthLimiter::findWindow(windows, 13 * 60), nullptr);
+
+  EXPECT_THROW(BandwidthLimiter::parseWindows("22:00-06:00=10", false), std::invalid_argument);
+  EXPECT_THROW(BandwidthLimiter::parseWindows("22:00", false), std::invalid_argument);
+}
+
+/* The first window that contains the time applies, the metered limit only if it is lower. */
+TEST(BandwidthLimiter, Rates) {
+  UptaneConfig config;
+  config.download_bandwidth_limit = 100;
+  config.download_bandwidth_windows = "08:00-18:00=1000,22:00-06:00=0,00:00-24:00=7";
+  config.metered_bandwidth_limit = 50;
+  BandwidthLimiter limiter(config);
+
+  EXPECT_EQ(limiter.rateAt(8 * 60, false), 1000);
+  EXPECT_EQ(limiter.rateAt(18 * 60 - 1, false), 1000);
+  EXPECT_EQ(limiter.rateAt(18 * 60, false), 7);
+  EXPECT_EQ(limiter.rateAt(23 * 60, false), 0);
+  EXPECT_EQ(limiter.rateAt(3 * 60, false), 0);
+  EXPECT_EQ(limiter.rateAt(12 * 60, true), 50);
+  EXPECT_EQ(limiter.rateAt(23 * 60, true), 50);
+  EXPECT_EQ(limiter.rateAt(19 * 60, true), 7);
+
+  config.download_bandwidth_windows.clear();
+  BandwidthLimiter plain(config);
+  EXPECT_EQ(plain.rateAt(12 * 60, false), 100);
+}
+
+/* Concurrent users share one budget. */
+TEST(BandwidthLimiter, SharedBudget) {
+  UptaneConfig config;
+  config.download_bandwidth_limit = 100 * 1000;
+  BandwidthLimiter limiter(config);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&limiter]() {
+      for (int j = 0; j < 10; ++j) {
+        limiter.acquire(10 * 1000);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // 400 kB, of which the first 100 kB need not wait
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(2900));
+}
+
+/* A metered link pauses downloads until it goes away, or the token is aborted. */
+TEST(BandwidthLimiter, PauseOnMetered) {
+  UptaneConfig config;
+  config.pause_downloads_on_metered = true;
+  BandwidthLimiter limiter(config);
+  EXPECT_FALSE(limiter.paused());
+
+  std::atomic<bool> metered{true};
+  limiter.setMeteredCheck([&metered]() { return metered.load(); });
+  EXPECT_TRUE(limiter.paused());
+  // No rate limit, so not slowed down
+  limiter.acquire(1000 * 1000);
+
+  api::FlowControlToken token;
+  token.setAbort();
+  EXPECT_FALSE(limiter.waitUntilResumed(&token));
+
+  metered = false;
+  limiter.setMeteredCheck([&metered]() { return metered.load(); });
+  EXPECT_TRUE(limiter.waitUntilResumed(nullptr));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,43 @@
+#include "utilities/block_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+BlockReader::BlockReader(const boost::filesystem::path &file, uint64_t offset, uint64_t length)
+    : fd_(::open(file.c_str(), O_RDONLY | O_CLOEXEC)), offset_(offset), remaining_(length) {
+  if (fd_ < 0) {
+    throw std::runtime_error("Can't open file " + file.string() + ": " + std::strerror(errno));
+  }
+  posix_fadvise(fd_, static_cast<off_t>(offset_), static_cast<off_t>(remaining_), POSIX_FADV_SEQUENTIAL);
+}
+
+BlockReader::~BlockReader() { close(fd_); }
+
+size_t BlockReader::read(uint8_t *buf, size_t size) {
+  const auto chunk = static_cast<size_t>(std::min<uint64_t>(remaining_, size));
+  if (chunk == 0) {
+    return 0;
+  }
+  // Hint at most one block beyond this read: the next reads come soon
+  if (remaining_ > chunk && (offset_ % kBlockSize) + chunk >= kBlockSize) {
+    posix_fadvise(fd_, static_cast<off_t>(offset_ + chunk),
+                  static_cast<off_t>(std::min<uint64_t>(remaining_ - chunk, kBlockSize)), POSIX_FADV_WILLNEED);
+  }
+  ssize_t count;
+  do {
+    count = pread(fd_, buf, chunk, static_cast<off_t>(offset_));
+  } while (count < 0 && errno == EINTR);
+  if (count < 0) {
+    throw std::runtime_error(std::string("Could not read file: ") + std::strerror(errno));
+  }
+  if (count == 0) {
+    throw std::runtime_error("File ended " + std::to_string(remaining_) + " bytes early");
+  }
+  offset_ += static_cast<uint64_t>(count);
+  remaining_ -= static_cast<uint64_t>(count);
+  return static_cast<size_t>(count);
+}
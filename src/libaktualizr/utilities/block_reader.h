@@ -0,0 +1,40 @@
+#ifndef BLOCK_READER_H_
+#define BLOCK_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * Reads a range of a file front to back with pread(). The kernel is asked to
+ * read the next block ahead while the caller hashes or sends the current one,
+ * so that reading slow storage overlaps with the processing.
+ */
+class BlockReader {
+ public:
+  static constexpr size_t kBlockSize{1024 * 1024};
+
+  /** Throws std::runtime_error if the file can not be opened. */
+  BlockReader(const boost::filesystem::path &file, uint64_t offset, uint64_t length);
+  ~BlockReader();
+  BlockReader(const BlockReader &) = delete;
+  BlockReader(BlockReader &&) = delete;
+  BlockReader &operator=(const BlockReader &) = delete;
+  BlockReader &operator=(BlockReader &&) = delete;
+
+  /**
+   * Read up to `size` bytes of the range into `buf`. Returns 0 at the end of
+   * the range. Throws std::runtime_error if the file can not be read or ends
+   * before the range does.
+   */
+  size_t read(uint8_t *buf, size_t size);
+  uint64_t remaining() const { return remaining_; }
+
+ private:
+  int fd_;
+  uint64_t offset_;
+  uint64_t remaining_;
+};
+
+#endif  // BLOCK_READER_H_
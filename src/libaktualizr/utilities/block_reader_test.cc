@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "logging/logging.h"
+#include "utilities/block_reader.h"
+#include "utilities/utils.h"
+
+/* A range is read in reads of any size, across block boundaries, and nothing beyond it. */
+TEST(BlockReader, ReadRange) {
+  TemporaryFile file;
+  std::string data;
+  for (size_t i = 0; data.size() < 3 * BlockReader::kBlockSize; ++i) {
+    data += std::to_string(i) + ",";
+  }
+  file.PutContents(data);
+
+  const uint64_t offset = 1000;
+  const uint64_t length = 2 * BlockReader::kBlockSize + 12345;
+  BlockReader reader(file.Path(), offset, length);
+  std::vector<uint8_t> buf(64 * 1024 + 7);
+  std::string read;
+  while (const size_t count = reader.read(buf.data(), buf.size())) {
+    read.append(reinterpret_cast<const char *>(buf.data()), count);
+  }
+  EXPECT_EQ(read, data.substr(offset, length));
+  EXPECT_EQ(reader.remaining(), 0U);
+  EXPECT_EQ(reader.read(buf.data(), buf.size()), 0U);
+}
+
+/* A file that is missing or shorter than the range is an error. */
+TEST(BlockReader, ReadErrors) {
+  TemporaryDirectory temp_dir;
+  EXPECT_THROW(BlockReader(temp_dir / "missing", 0, 1), std::runtime_error);
+
+  TemporaryFile file;
+  file.PutContents("0123456789");
+  BlockReader reader(file.Path(), 5, 10);
+  std::vector<uint8_t> buf(16);
+  EXPECT_EQ(reader.read(buf.data(), buf.size()), 5U);
+  EXPECT_THROW(reader.read(buf.data(), buf.size()), std::runtime_error);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,57 @@
+#include "libaktualizr/completion_queue.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include "logging/logging.h"
+
+namespace api {
+
+CompletionQueue::CompletionQueue() : fd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "eventfd");
+  }
+}
+
+CompletionQueue::~CompletionQueue() { close(fd_); }
+
+void CompletionQueue::post(std::function<void()> function) {
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    queue_.push_back(std::move(function));
+  }
+  const uint64_t one = 1;
+  if (write(fd_, &one, sizeof(one)) != sizeof(one)) {
+    LOG_ERROR << "Failed to signal a completion: " << std::strerror(errno);
+  }
+}
+
+size_t CompletionQueue::dispatch() {
+  // Reset the eventfd first: a function posted after this makes it readable
+  // again, at worst for a dispatch() that finds nothing to do.
+  uint64_t count = 0;
+  if (read(fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    LOG_ERROR << "Failed to read the completion eventfd: " << std::strerror(errno);
+  }
+
+  std::vector<std::function<void()>> ready;
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    ready.swap(queue_);
+  }
+  for (auto& function : ready) {
+    try {
+      function();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Completion handler failed: " << e.what();
+    }
+  }
+  return ready.size();
+}
+
+}  // namespace api
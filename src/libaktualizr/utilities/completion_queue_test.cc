@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <poll.h>
+
+#include <thread>
+#include <vector>
+
+#include "libaktualizr/completion_queue.h"
+#include "logging/logging.h"
+
+static bool readable(int fd, int timeout_ms) {
+  struct pollfd pfd {};
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, timeout_ms) == 1 && (static_cast<unsigned int>(pfd.revents) & POLLIN) != 0;
+}
+
+/* Posted functions run in order on the dispatching thread, which the fd wakes up. */
+TEST(CompletionQueue, Dispatch) {
+  api::CompletionQueue queue;
+  EXPECT_FALSE(readable(queue.fd(), 0));
+  EXPECT_EQ(queue.dispatch(), 0);
+
+  std::vector<int> order;
+  const auto loop_thread = std::this_thread::get_id();
+  std::thread poster([&queue, &order, loop_thread]() {
+    for (int i = 0; i < 3; ++i) {
+      queue.post([&order, i, loop_thread]() {
+        EXPECT_EQ(std::this_thread::get_id(), loop_thread);
+        order.push_back(i);
+      });
+    }
+  });
+  poster.join();
+
+  ASSERT_TRUE(readable(queue.fd(), 1000));
+  EXPECT_EQ(queue.dispatch(), 3);
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2}));
+  EXPECT_FALSE(readable(queue.fd(), 0));
+}
+
+/* A failing function does not keep the others from running. */
+TEST(CompletionQueue, HandlerThrows) {
+  api::CompletionQueue queue;
+  int ran = 0;
+  queue.post([]() { throw std::runtime_error("expected failure"); });
+  queue.post([&ran]() { ++ran; });
+  EXPECT_EQ(queue.dispatch(), 2);
+  EXPECT_EQ(ran, 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
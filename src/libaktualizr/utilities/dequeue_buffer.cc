@@ -1,9 +1,12 @@
 #include "utilities/dequeue_buffer.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
 
+DequeueBuffer::DequeueBuffer(size_t capacity) : buffer_(capacity, 0) { budget_.grow(capacity); }
+
 char* DequeueBuffer::Head() {
   assert(sentinel_ == kSentinel);
   return buffer_.data();
@@ -24,12 +27,17 @@ void DequeueBuffer::Consume(size_t bytes) {
     throw std::logic_error("Attempt to DequeueBuffer::Consume() more bytes than are valid");
   }
   // Shuffle up the buffer
-  auto* next_unconsumed_byte = buffer_.begin() + bytes;
-  auto* end_of_written_area = buffer_.begin() + written_bytes_;
+  auto next_unconsumed_byte = buffer_.begin() + static_cast<std::ptrdiff_t>(bytes);
+  auto end_of_written_area = buffer_.begin() + static_cast<std::ptrdiff_t>(written_bytes_);
   std::copy(next_unconsumed_byte, end_of_written_area, buffer_.begin());
   written_bytes_ -= bytes;
 }
 
+size_t DequeueBuffer::Capacity() const {
+  assert(sentinel_ == kSentinel);
+  return buffer_.size();
+}
+
 char* DequeueBuffer::Tail() {
   assert(sentinel_ == kSentinel);
   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
@@ -1,8 +1,10 @@
 #ifndef UPTANE_DEQUEUE_BUFFER_H_
 #define UPTANE_DEQUEUE_BUFFER_H_
 
-#include <array>
 #include <cstddef>
+#include <vector>
+
+#include "utilities/memory_budget.h"
 
 /**
  * A dequeue based on a contiguous buffer in memory. Used for buffering
@@ -10,6 +12,14 @@
  */
 class DequeueBuffer {
  public:
+  static constexpr size_t kDefaultCapacity{4096};
+
+  /**
+   * A buffer for up to `capacity` bytes. A buffer that outlives one message
+   * can be sized to hold a whole message, so that it can be decoded in place.
+   */
+  explicit DequeueBuffer(size_t capacity = kDefaultCapacity);
+
   /**
    * A pointer to the first element that has not been Consumed().
    */
@@ -26,6 +36,11 @@ class DequeueBuffer {
    */
   void Consume(size_t bytes);
 
+  /**
+   * The total number of bytes this buffer can hold.
+   */
+  size_t Capacity() const;
+
   /**
    * A pointer to the next place to write data to
    */
@@ -49,7 +64,8 @@ class DequeueBuffer {
    * buffer_[0..written_bytes_] contains to contents of this dequeue
    */
   size_t written_bytes_{0};
-  std::array<char, 4096> buffer_{};  // Zero initialise as a security pesimisation
+  std::vector<char> buffer_;  // Zero initialise as a security pesimisation
+  MemoryBudget::Reservation budget_;
   // NOLINTNEXTLINE (should be just for clang-diagnostic-unused-private-field but it won't work)
   int sentinel_{kSentinel};  // Sentinel to check for writers overflowing buffer_
 };
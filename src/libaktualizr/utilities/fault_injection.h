@@ -18,6 +18,7 @@
 #ifndef FAULT_INJECTION_H_
 #define FAULT_INJECTION_H_
 
+#include <cstddef>
 #include <string>
 
 /* Only define the stubs when fiu is disabled, otherwise use the real fiu.h
@@ -35,14 +36,22 @@
 // NOLINTNEXTLINE(clang-diagnostic-unused-function)
 static inline std::string fault_injection_last_info() { return ""; }
 
+// NOLINTNEXTLINE(clang-diagnostic-unused-function)
+static inline void fault_injection_throttle(const char *name, size_t bytes) {
+  (void)name;
+  (void)bytes;
+}
+
 #else
 
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <mutex>
+#include <thread>
 
 #include <fiu-control.h>
 #include <fiu.h>
@@ -132,6 +141,35 @@ static inline void fault_injection_init() {
   }
 }
 
+// Slow down the caller while the fail point `name` is enabled, to simulate a
+// slow network or slow flash. The failinfo is "<delay ms>[:<bytes per second>]":
+// every call waits for the delay, plus the time `bytes` take at that rate.
+// NOLINTNEXTLINE(clang-diagnostic-unused-function)
+static inline void fault_injection_throttle(const char *name, size_t bytes) {
+  if (fiu_fail(name) == 0) {
+    return;
+  }
+  const std::string info = fault_injection_last_info();
+  const size_t colon = info.find(':');
+  uint64_t delay_ms = 0;
+  uint64_t rate = 0;
+  try {
+    if (colon != 0 && !info.empty()) {
+      delay_ms = std::stoull(info.substr(0, colon));
+    }
+    if (colon != std::string::npos) {
+      rate = std::stoull(info.substr(colon + 1));
+    }
+  } catch (const std::exception &e) {
+    return;
+  }
+  auto wait = std::chrono::microseconds(delay_ms * 1000);
+  if (rate > 0) {
+    wait += std::chrono::microseconds(bytes * 1000000 / rate);
+  }
+  std::this_thread::sleep_for(wait);
+}
+
 #define fault_injection_disable fiu_disable
 
 #endif /* FIU_ENABLE */
@@ -0,0 +1,90 @@
+#include "utilities/file_digest_cache.h"
+
+#include <sys/stat.h>
+#include <fstream>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "libaktualizr/types.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+FileDigestCache::FileDigestCache(boost::filesystem::path file, boost::filesystem::path cache_file)
+    : file_(std::move(file)), cache_file_(std::move(cache_file)) {}
+
+Json::Value FileDigestCache::key() const {
+  struct stat st {};
+  if (stat(file_.c_str(), &st) != 0) {
+    return Json::nullValue;
+  }
+  Json::Value key;
+  key["path"] = file_.string();
+  key["inode"] = static_cast<Json::UInt64>(st.st_ino);
+  key["size"] = static_cast<Json::UInt64>(st.st_size);
+  key["mtime_ns"] = static_cast<Json::Int64>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return key;
+}
+
+bool FileDigestCache::get(std::string *sha256, uint64_t *length) const {
+  std::ifstream source(file_.string(), std::ios::in | std::ios::binary);
+  const Json::Value key = this->key();
+  if (!source || key.isNull()) {
+    return false;
+  }
+  auto matches = [&key](const Json::Value &cached) {
+    return cached.isObject() && cached["sha256"].isString() && cached["path"] == key["path"] &&
+           cached["inode"] == key["inode"] && cached["size"] == key["size"] && cached["mtime_ns"] == key["mtime_ns"];
+  };
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!matches(digest_) && boost::filesystem::exists(cache_file_)) {
+    try {
+      digest_ = Utils::parseJSONFile(cache_file_);
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Could not read " << cache_file_ << ": " << e.what();
+      digest_ = Json::nullValue;
+    }
+  }
+  if (!matches(digest_)) {
+    ssize_t nread = 0;
+    const std::string computed =
+        boost::algorithm::to_lower_copy(Hash::generate(Hash::Type::kSha256, source, &nread).HashString());
+    if (static_cast<Json::UInt64>(nread) != key["size"].asUInt64()) {
+      // The file changed while it was read: do not keep the digest around
+      digest_ = Json::nullValue;
+      *sha256 = computed;
+      *length = static_cast<uint64_t>(nread);
+      return true;
+    }
+    storeLocked(key, computed, static_cast<uint64_t>(nread));
+  }
+  *sha256 = digest_["sha256"].asString();
+  *length = digest_["size"].asUInt64();
+  return true;
+}
+
+void FileDigestCache::store(const std::string &sha256, uint64_t length) const {
+  const Json::Value key = this->key();
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (key.isNull()) {
+    digest_ = Json::nullValue;
+    return;
+  }
+  storeLocked(key, boost::algorithm::to_lower_copy(sha256), length);
+}
+
+void FileDigestCache::reset() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  digest_ = Json::nullValue;
+}
+
+void FileDigestCache::storeLocked(const Json::Value &key, const std::string &sha256, uint64_t length) const {
+  digest_ = key;
+  digest_["sha256"] = sha256;
+  digest_["size"] = static_cast<Json::UInt64>(length);
+  try {
+    Utils::writeFile(cache_file_, digest_);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not store the digest of " << file_ << ": " << e.what();
+  }
+}
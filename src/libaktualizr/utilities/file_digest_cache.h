@@ -0,0 +1,42 @@
+#ifndef FILE_DIGEST_CACHE_H_
+#define FILE_DIGEST_CACHE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include "json/json.h"
+
+/**
+ * SHA-256 digest and length of a file that rarely changes, like an installed
+ * image. It is kept in memory and in `cache_file`, so that it is only
+ * computed again, also after a restart, when the inode, size or modification
+ * time of the file change.
+ */
+class FileDigestCache {
+ public:
+  FileDigestCache(boost::filesystem::path file, boost::filesystem::path cache_file);
+
+  /** Inode, size and modification time of the file, null if there is none. */
+  Json::Value key() const;
+  /**
+   * Set the lowercase hex SHA-256 and the length of the file. Returns false
+   * if it cannot be read.
+   */
+  bool get(std::string *sha256, uint64_t *length) const;
+  /** Take `sha256` and `length` as the digest of the file as it is now, e.g. one verified as it was written. */
+  void store(const std::string &sha256, uint64_t length) const;
+  /** Forget the digest kept in memory. */
+  void reset() const;
+
+ private:
+  void storeLocked(const Json::Value &key, const std::string &sha256, uint64_t length) const;
+
+  const boost::filesystem::path file_;
+  const boost::filesystem::path cache_file_;
+  mutable std::mutex mutex_;
+  mutable Json::Value digest_;
+};
+
+#endif  // FILE_DIGEST_CACHE_H_
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "libaktualizr/types.h"
+#include "logging/logging.h"
+#include "utilities/file_digest_cache.h"
+#include "utilities/utils.h"
+
+static std::string sha256(const std::string &data) {
+  return boost::algorithm::to_lower_copy(Hash::generate(Hash::Type::kSha256, data).HashString());
+}
+
+/* The digest is computed once, kept across instances and computed again when the file changes. */
+TEST(FileDigestCache, Cache) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path file = temp_dir / "image";
+  const boost::filesystem::path cache_file = temp_dir / "image.digest";
+  std::string hash;
+  uint64_t length = 0;
+
+  FileDigestCache cache(file, cache_file);
+  EXPECT_TRUE(cache.key().isNull());
+  EXPECT_FALSE(cache.get(&hash, &length));
+
+  Utils::writeFile(file, std::string("image-v1"));
+  ASSERT_TRUE(cache.get(&hash, &length));
+  EXPECT_EQ(hash, sha256("image-v1"));
+  EXPECT_EQ(length, 8U);
+  ASSERT_TRUE(boost::filesystem::exists(cache_file));
+
+  // A digest stored for the same file state is used as it is, also by a new instance.
+  Json::Value stored = Utils::parseJSONFile(cache_file);
+  stored["sha256"] = "cached";
+  Utils::writeFile(cache_file, stored);
+  cache.reset();
+  ASSERT_TRUE(cache.get(&hash, &length));
+  EXPECT_EQ(hash, "cached");
+  ASSERT_TRUE(FileDigestCache(file, cache_file).get(&hash, &length));
+  EXPECT_EQ(hash, "cached");
+
+  Utils::writeFile(file, std::string("image-v2 is longer"));
+  ASSERT_TRUE(cache.get(&hash, &length));
+  EXPECT_EQ(hash, sha256("image-v2 is longer"));
+  EXPECT_EQ(length, 18U);
+
+  // A known digest is taken without reading the file.
+  cache.store("ABCDEF", 18);
+  ASSERT_TRUE(cache.get(&hash, &length));
+  EXPECT_EQ(hash, "abcdef");
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
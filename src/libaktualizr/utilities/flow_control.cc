@@ -36,15 +36,39 @@ bool FlowControlToken::setAbort() {
   return true;
 }
 
+constexpr std::chrono::milliseconds FlowControlToken::kParentPollInterval;
+
 bool FlowControlToken::canContinue(bool blocking) const {
   assert(IsValid());
+  if (parent_ != nullptr && !parent_->canContinue(blocking)) {
+    return false;
+  }
   std::unique_lock<std::mutex> lk(m_);
   if (blocking) {
-    cv_.wait(lk, [this] { return state_ != State::kPaused; });
+    if (parent_ == nullptr) {
+      cv_.wait(lk, [this] { return state_ != State::kPaused; });
+    } else {
+      // The parent doesn't notify this token, so look at it from time to time
+      while (!cv_.wait_for(lk, kParentPollInterval, [this] { return state_ != State::kPaused; })) {
+        if (parent_->abortRequested()) {
+          return false;
+        }
+      }
+    }
   }
   return state_ == State::kRunning;
 }
 
+bool FlowControlToken::abortRequested() const {
+  {
+    std::lock_guard<std::mutex> g(m_);
+    if (state_ == State::kAborted) {
+      return true;
+    }
+  }
+  return parent_ != nullptr && parent_->abortRequested();
+}
+
 bool FlowControlToken::hasAborted() const {
   assert(IsValid());
   return !canContinue(false);
@@ -1,6 +1,7 @@
 #ifndef AKTUALIZR_FLOW_CONTROL_H
 #define AKTUALIZR_FLOW_CONTROL_H
 
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 
@@ -13,6 +14,11 @@ namespace api {
 class FlowControlToken {
  public:
   FlowControlToken() = default;
+  ///
+  /// A token that also stops when `parent` is paused or aborted, for
+  /// controlling one part of a larger task on its own.
+  ///
+  explicit FlowControlToken(const FlowControlToken* parent) : parent_{parent} {}
   ~FlowControlToken() = default;
 
   // Non-copyable, non,moveable
@@ -40,7 +46,8 @@ class FlowControlToken {
 
   ///
   /// Called by the controlled thread to query the currently requested state.
-  /// Sleeps if the state is `Paused` and `blocking == true`.
+  /// Sleeps if the state is `Paused` and `blocking == true`. The state of the
+  /// parent token, if any, takes precedence.
   /// @return `true` for `Running` state, `false` for `Aborted`,
   /// and also `false` for the `Paused` state, if the call is non-blocking.
   ///
@@ -56,6 +63,11 @@ class FlowControlToken {
   void reset();
 
  private:
+  // Unlike hasAborted(), `false` for a paused token
+  bool abortRequested() const;
+
+  // How often a paused child token checks whether its parent was aborted
+  static constexpr std::chrono::milliseconds kParentPollInterval{100};
   static const uint32_t SENTINEL = 0xced53470;
   const uint32_t sentinel_{SENTINEL};
   enum class State {
@@ -65,6 +77,7 @@ class FlowControlToken {
   } state_{State::kRunning};
   mutable std::mutex m_;
   mutable std::condition_variable cv_;
+  const FlowControlToken* const parent_{nullptr};
 };
 
 }  // namespace api
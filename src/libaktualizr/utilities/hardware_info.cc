@@ -0,0 +1,293 @@
+#include "utilities/hardware_info.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// Content of a small kernel file without surrounding whitespace or the NUL bytes of device tree strings
+std::string readValue(const fs::path& path) {
+  std::ifstream stream(path.c_str());
+  if (!stream) {
+    return "";
+  }
+  std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  boost::trim_if(content, boost::is_any_of(std::string(" \t\r\n\0", 5)));
+  return content;
+}
+
+// Sets `key` to the value of the file, unless it is empty. Returns whether it was set.
+bool setFromFile(Json::Value& node, const char* key, const fs::path& path) {
+  const std::string value = readValue(path);
+  if (value.empty()) {
+    return false;
+  }
+  node[key] = value;
+  return true;
+}
+
+// Sorted names in a directory, so that the inventory does not change with the order of the kernel
+std::vector<std::string> dirNames(const fs::path& dir) {
+  std::vector<std::string> names;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    names.push_back(it->path().filename().string());
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+bool toUInt64(const std::string& value, uint64_t* result) {
+  try {
+    size_t pos = 0;
+    *result = std::stoull(value, &pos);
+    return pos > 0;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+bool collectBoard(Json::Value& system, const fs::path& root) {
+  const fs::path dmi = root / "sys/class/dmi/id";
+  bool found = setFromFile(system, "product", dmi / "product_name");
+  found = setFromFile(system, "vendor", dmi / "sys_vendor") || found;
+  found = setFromFile(system, "version", dmi / "product_version") || found;
+  found = setFromFile(system, "serial", dmi / "product_serial") || found;
+
+  const fs::path device_tree = root / "proc/device-tree";
+  if (!system.isMember("product")) {
+    found = setFromFile(system, "product", device_tree / "model") || found;
+  }
+  if (!system.isMember("serial")) {
+    found = setFromFile(system, "serial", device_tree / "serial-number") || found;
+  }
+  return found;
+}
+
+bool collectCpus(Json::Value& children, const fs::path& root) {
+  std::ifstream cpuinfo((root / "proc/cpuinfo").c_str());
+  if (!cpuinfo) {
+    return false;
+  }
+
+  // Blocks of "key : value" lines, one per processor, and on some ARM kernels one for the whole SoC
+  std::vector<std::map<std::string, std::string>> blocks(1);
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      if (!blocks.back().empty()) {
+        blocks.emplace_back();
+      }
+      continue;
+    }
+    blocks.back()[boost::trim_copy(line.substr(0, colon))] = boost::trim_copy(line.substr(colon + 1));
+  }
+
+  std::string soc_model;
+  for (const auto& block : blocks) {
+    if (block.count("processor") == 0) {
+      auto it = block.find("Hardware");
+      if (it == block.end()) {
+        it = block.find("Processor");
+      }
+      if (it != block.end()) {
+        soc_model = it->second;
+      }
+    }
+  }
+
+  bool found = false;
+  for (const auto& block : blocks) {
+    const auto processor = block.find("processor");
+    if (processor == block.end()) {
+      continue;
+    }
+    Json::Value cpu;
+    cpu["id"] = "cpu:" + processor->second;
+    cpu["class"] = "processor";
+    for (const char* key : {"model name", "cpu model", "Processor"}) {
+      const auto it = block.find(key);
+      if (it != block.end()) {
+        cpu["product"] = it->second;
+        break;
+      }
+    }
+    if (!cpu.isMember("product") && !soc_model.empty()) {
+      cpu["product"] = soc_model;
+    }
+    const auto vendor = block.find("vendor_id");
+    if (vendor != block.end()) {
+      cpu["vendor"] = vendor->second;
+    }
+    uint64_t max_khz = 0;
+    const fs::path freq = root / "sys/devices/system/cpu" / ("cpu" + processor->second) / "cpufreq/cpuinfo_max_freq";
+    if (toUInt64(readValue(freq), &max_khz)) {
+      cpu["capacity"] = Json::Value(static_cast<Json::UInt64>(max_khz * 1000));
+      cpu["units"] = "Hz";
+    }
+    children.append(cpu);
+    found = true;
+  }
+  return found;
+}
+
+bool collectMemory(Json::Value& children, const fs::path& root) {
+  std::ifstream meminfo((root / "proc/meminfo").c_str());
+  std::string line;
+  while (std::getline(meminfo, line)) {
+    uint64_t total_kb = 0;
+    if (line.compare(0, 9, "MemTotal:") == 0 && toUInt64(boost::trim_copy(line.substr(9)), &total_kb)) {
+      Json::Value memory;
+      memory["id"] = "memory";
+      memory["class"] = "memory";
+      memory["description"] = "System memory";
+      memory["units"] = "bytes";
+      memory["size"] = Json::Value(static_cast<Json::UInt64>(total_kb * 1024));
+      children.append(memory);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool collectFirmware(Json::Value& children, const fs::path& root) {
+  const fs::path dmi = root / "sys/class/dmi/id";
+  Json::Value firmware;
+  firmware["id"] = "firmware";
+  firmware["class"] = "memory";
+  firmware["description"] = "BIOS";
+  bool found = setFromFile(firmware, "vendor", dmi / "bios_vendor");
+  found = setFromFile(firmware, "version", dmi / "bios_version") || found;
+  found = setFromFile(firmware, "date", dmi / "bios_date") || found;
+  if (found) {
+    children.append(firmware);
+  }
+  return found;
+}
+
+// Name of the driver bound to a device, empty if there is none
+std::string driverName(const fs::path& device) {
+  boost::system::error_code ec;
+  const fs::path driver = fs::read_symlink(device / "driver", ec);
+  return ec ? std::string() : driver.filename().string();
+}
+
+bool collectNetwork(Json::Value& children, const fs::path& root) {
+  const fs::path net = root / "sys/class/net";
+  bool found = false;
+  for (const auto& name : dirNames(net)) {
+    // Virtual interfaces have no device
+    if (!fs::exists(net / name / "device")) {
+      continue;
+    }
+    Json::Value network;
+    network["id"] = "network";
+    network["class"] = "network";
+    network["logicalname"] = name;
+    setFromFile(network, "serial", net / name / "address");
+    const std::string driver = driverName(net / name / "device");
+    if (!driver.empty()) {
+      network["configuration"]["driver"] = driver;
+    }
+    children.append(network);
+    found = true;
+  }
+  return found;
+}
+
+bool collectStorage(Json::Value& children, const fs::path& root) {
+  const fs::path block = root / "sys/block";
+  bool found = false;
+  for (const auto& name : dirNames(block)) {
+    // Loop, RAM and other virtual block devices have no device
+    const fs::path device = block / name / "device";
+    if (!fs::exists(device)) {
+      continue;
+    }
+    Json::Value disk;
+    disk["id"] = "disk";
+    disk["class"] = "disk";
+    disk["logicalname"] = "/dev/" + name;
+    if (!setFromFile(disk, "product", device / "model")) {
+      setFromFile(disk, "product", device / "name");
+    }
+    setFromFile(disk, "vendor", device / "vendor");
+    uint64_t sectors = 0;
+    if (toUInt64(readValue(block / name / "size"), &sectors)) {
+      // Always in 512-byte sectors, whatever the block size of the device
+      disk["size"] = Json::Value(static_cast<Json::UInt64>(sectors * 512));
+      disk["units"] = "bytes";
+    }
+    children.append(disk);
+    found = true;
+  }
+  return found;
+}
+
+}  // namespace
+
+Json::Value HardwareInfo::collect(const std::string& fields, const boost::filesystem::path& root) {
+  std::vector<std::string> parts;
+  boost::split(parts, fields, boost::is_any_of(", "), boost::token_compress_on);
+  const std::set<std::string> wanted(parts.begin(), parts.end());
+
+  Json::Value system;
+  system["id"] = readValue(root / "proc/sys/kernel/hostname");
+  system["class"] = "system";
+  Json::Value children(Json::arrayValue);
+
+  bool found = false;
+  for (const auto& part : wanted) {
+    if (part.empty()) {
+      continue;
+    }
+    bool collected = false;
+    if (part == "board") {
+      collected = collectBoard(system, root);
+    } else if (part == "cpu") {
+      collected = collectCpus(children, root);
+    } else if (part == "memory") {
+      collected = collectMemory(children, root);
+    } else if (part == "firmware") {
+      collected = collectFirmware(children, root);
+    } else if (part == "network") {
+      collected = collectNetwork(children, root);
+    } else if (part == "storage") {
+      collected = collectStorage(children, root);
+    } else {
+      LOG_WARNING << "Unknown hardware information field " << part;
+      continue;
+    }
+    if (!collected) {
+      LOG_DEBUG << "No hardware information found for " << part;
+    }
+    found = found || collected;
+  }
+  if (!found) {
+    return Json::Value();
+  }
+
+  if (!children.empty()) {
+    system["children"] = children;
+  }
+  return system;
+}
+
+std::string HardwareInfo::bootId(const boost::filesystem::path& root) {
+  return readValue(root / "proc/sys/kernel/random/boot_id");
+}
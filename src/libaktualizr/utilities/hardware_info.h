@@ -0,0 +1,33 @@
+#ifndef HARDWARE_INFO_H_
+#define HARDWARE_INFO_H_
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+/**
+ * Collects the hardware inventory of the device from sysfs, procfs and the
+ * device tree, in the layout of `lshw -json` but limited to the parts
+ * requested. Reading these files takes a few milliseconds, where lshw probes
+ * every bus of the system.
+ */
+class HardwareInfo {
+ public:
+  // Every part that can be collected
+  static constexpr const char* kAllFields = "board,cpu,memory,firmware,network,storage";
+
+  /**
+   * Collect the comma-separated parts in `fields`: `board`, `cpu`, `memory`,
+   * `firmware`, `network` and `storage`. Files are read below `root`, so that
+   * tests can use a directory tree of their own. Missing files are skipped, and
+   * the result is empty if nothing at all could be read.
+   */
+  static Json::Value collect(const std::string& fields, const boost::filesystem::path& root = "/");
+
+  // Identifies the current boot of the system, empty if the kernel does not tell
+  static std::string bootId(const boost::filesystem::path& root = "/");
+};
+
+#endif  // HARDWARE_INFO_H_
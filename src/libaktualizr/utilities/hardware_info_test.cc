@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+#include "utilities/hardware_info.h"
+#include "utilities/utils.h"
+
+namespace {
+// A device with two CPUs, an interface with a device, the loopback, a disk and a loop device
+void writeSystem(const boost::filesystem::path& root) {
+  Utils::writeFile(root / "proc/sys/kernel/hostname", std::string("board-1\n"));
+  Utils::writeFile(root / "proc/sys/kernel/random/boot_id", std::string("2f1d0f52-9b43-4c0b-a51e-52baf4e3d2b6\n"));
+  Utils::writeFile(root / "proc/device-tree/model", std::string("Example Board v2\0", 17));
+  Utils::writeFile(root / "proc/cpuinfo", std::string("processor\t: 0\nmodel name\t: ARMv8 Processor rev 4 (v8l)\n\n"
+                                                      "processor\t: 1\nmodel name\t: ARMv8 Processor rev 4 (v8l)\n\n"
+                                                      "Hardware\t: Example SoC\n"));
+  Utils::writeFile(root / "sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", std::string("1500000\n"));
+  Utils::writeFile(root / "proc/meminfo", std::string("MemTotal:        1000 kB\nMemFree:          500 kB\n"));
+  Utils::writeFile(root / "sys/class/net/eth0/address", std::string("02:00:00:00:00:01\n"));
+  boost::filesystem::create_directories(root / "sys/class/net/eth0/device");
+  Utils::writeFile(root / "sys/class/net/lo/address", std::string("00:00:00:00:00:00\n"));
+  Utils::writeFile(root / "sys/block/mmcblk0/size", std::string("2048\n"));
+  Utils::writeFile(root / "sys/block/mmcblk0/device/name", std::string("SD16G\n"));
+  Utils::writeFile(root / "sys/block/loop0/size", std::string("0\n"));
+}
+}  // namespace
+
+/* The native inventory is read from procfs, sysfs and the device tree. */
+TEST(HardwareInfo, Collect) {
+  TemporaryDirectory temp_dir;
+  writeSystem(temp_dir.Path());
+
+  const Json::Value hwinfo = HardwareInfo::collect(HardwareInfo::kAllFields, temp_dir.Path());
+  EXPECT_EQ(hwinfo["id"].asString(), "board-1");
+  EXPECT_EQ(hwinfo["class"].asString(), "system");
+  EXPECT_EQ(hwinfo["product"].asString(), "Example Board v2");
+
+  const Json::Value& children = hwinfo["children"];
+  ASSERT_EQ(children.size(), 5);
+  EXPECT_EQ(children[0]["id"].asString(), "cpu:0");
+  EXPECT_EQ(children[0]["product"].asString(), "ARMv8 Processor rev 4 (v8l)");
+  EXPECT_EQ(children[0]["capacity"].asUInt64(), 1500000000);
+  EXPECT_EQ(children[1]["id"].asString(), "cpu:1");
+  EXPECT_FALSE(children[1].isMember("capacity"));
+  EXPECT_EQ(children[2]["id"].asString(), "memory");
+  EXPECT_EQ(children[2]["size"].asUInt64(), 1024000);
+  EXPECT_EQ(children[3]["logicalname"].asString(), "eth0");
+  EXPECT_EQ(children[3]["serial"].asString(), "02:00:00:00:00:01");
+  EXPECT_EQ(children[4]["logicalname"].asString(), "/dev/mmcblk0");
+  EXPECT_EQ(children[4]["product"].asString(), "SD16G");
+  EXPECT_EQ(children[4]["size"].asUInt64(), 2048 * 512);
+
+  // The same system gives the same inventory, so that its hash is stable
+  EXPECT_EQ(HardwareInfo::collect(HardwareInfo::kAllFields, temp_dir.Path()), hwinfo);
+  EXPECT_EQ(HardwareInfo::bootId(temp_dir.Path()), "2f1d0f52-9b43-4c0b-a51e-52baf4e3d2b6");
+}
+
+/* Only the configured parts are collected, and nothing is found on a system without them. */
+TEST(HardwareInfo, Fields) {
+  TemporaryDirectory temp_dir;
+  writeSystem(temp_dir.Path());
+
+  const Json::Value hwinfo = HardwareInfo::collect("memory, network", temp_dir.Path());
+  EXPECT_FALSE(hwinfo.isMember("product"));
+  ASSERT_EQ(hwinfo["children"].size(), 2);
+  EXPECT_EQ(hwinfo["children"][0]["id"].asString(), "memory");
+  EXPECT_EQ(hwinfo["children"][1]["id"].asString(), "network");
+
+  EXPECT_EQ(HardwareInfo::collect("firmware", temp_dir.Path()), Json::Value());
+  TemporaryDirectory empty_dir;
+  EXPECT_EQ(HardwareInfo::collect(HardwareInfo::kAllFields, empty_dir.Path()), Json::Value());
+  EXPECT_EQ(HardwareInfo::bootId(empty_dir.Path()), "");
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,342 @@
+#include "utilities/json_reader.h"
+
+#include <cstdint>
+#include <limits>
+
+#include "utilities/utils.h"
+
+namespace {
+
+// As Json::CharReaderBuilder's default stackLimit
+constexpr int kMaxDepth = 1000;
+
+class Parser {
+ public:
+  Parser(const char *begin, const char *end) : cur_(begin), end_(end) {}
+
+  bool parseDocument(Json::Value *value) {
+    skipWhitespace();
+    if (!parseValue(value, 0)) {
+      return false;
+    }
+    skipWhitespace();
+    return cur_ == end_;
+  }
+
+ private:
+  void skipWhitespace() {
+    while (cur_ != end_ && (*cur_ == ' ' || *cur_ == '\n' || *cur_ == '\r' || *cur_ == '\t')) {
+      ++cur_;
+    }
+  }
+
+  bool parseValue(Json::Value *value, int depth) {
+    if (cur_ == end_) {
+      return false;
+    }
+    switch (*cur_) {
+      case '{':
+        return parseObject(value, depth + 1);
+      case '[':
+        return parseArray(value, depth + 1);
+      case '"':
+        return parseString(value);
+      case 't':
+        return parseLiteral("true", Json::Value(true), value);
+      case 'f':
+        return parseLiteral("false", Json::Value(false), value);
+      case 'n':
+        return parseLiteral("null", Json::Value(), value);
+      default:
+        return parseNumber(value);
+    }
+  }
+
+  bool parseObject(Json::Value *value, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    ++cur_;
+    *value = Json::Value(Json::objectValue);
+    skipWhitespace();
+    if (cur_ != end_ && *cur_ == '}') {
+      ++cur_;
+      return true;
+    }
+    for (;;) {
+      if (cur_ == end_ || *cur_ != '"') {
+        return false;
+      }
+      const char *key_begin = nullptr;
+      const char *key_end = nullptr;
+      if (!parseStringContent(&key_begin, &key_end)) {
+        return false;
+      }
+      // A repeated key replaces the previous value, as with jsoncpp
+      Json::Value *member = value->demand(key_begin, key_end);
+      skipWhitespace();
+      if (cur_ == end_ || *cur_ != ':') {
+        return false;
+      }
+      ++cur_;
+      skipWhitespace();
+      if (!parseValue(member, depth)) {
+        return false;
+      }
+      skipWhitespace();
+      if (cur_ == end_) {
+        return false;
+      }
+      if (*cur_ == '}') {
+        ++cur_;
+        return true;
+      }
+      if (*cur_ != ',') {
+        return false;
+      }
+      ++cur_;
+      skipWhitespace();
+    }
+  }
+
+  bool parseArray(Json::Value *value, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    ++cur_;
+    *value = Json::Value(Json::arrayValue);
+    skipWhitespace();
+    if (cur_ != end_ && *cur_ == ']') {
+      ++cur_;
+      return true;
+    }
+    for (;;) {
+      if (!parseValue(&value->append(Json::Value()), depth)) {
+        return false;
+      }
+      skipWhitespace();
+      if (cur_ == end_) {
+        return false;
+      }
+      if (*cur_ == ']') {
+        ++cur_;
+        return true;
+      }
+      if (*cur_ != ',') {
+        return false;
+      }
+      ++cur_;
+      skipWhitespace();
+    }
+  }
+
+  bool parseString(Json::Value *value) {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    if (!parseStringContent(&begin, &end)) {
+      return false;
+    }
+    *value = Json::Value(begin, end);
+    return true;
+  }
+
+  // Points [begin, end) to the content of the string at cur_: to the input
+  // itself if it has no escape sequences, else to the decoded scratch_.
+  bool parseStringContent(const char **begin, const char **end) {
+    ++cur_;
+    const char *start = cur_;
+    while (cur_ != end_ && *cur_ != '"' && *cur_ != '\\') {
+      if (static_cast<unsigned char>(*cur_) < 0x20) {
+        return false;
+      }
+      ++cur_;
+    }
+    if (cur_ == end_) {
+      return false;
+    }
+    if (*cur_ == '"') {
+      *begin = start;
+      *end = cur_++;
+      return true;
+    }
+
+    scratch_.assign(start, cur_);
+    while (cur_ != end_ && *cur_ != '"') {
+      const char c = *cur_++;
+      if (static_cast<unsigned char>(c) < 0x20) {
+        return false;
+      }
+      if (c != '\\') {
+        scratch_ += c;
+        continue;
+      }
+      if (cur_ == end_) {
+        return false;
+      }
+      switch (*cur_++) {
+        case '"':
+          scratch_ += '"';
+          break;
+        case '\\':
+          scratch_ += '\\';
+          break;
+        case '/':
+          scratch_ += '/';
+          break;
+        case 'b':
+          scratch_ += '\b';
+          break;
+        case 'f':
+          scratch_ += '\f';
+          break;
+        case 'n':
+          scratch_ += '\n';
+          break;
+        case 'r':
+          scratch_ += '\r';
+          break;
+        case 't':
+          scratch_ += '\t';
+          break;
+        case 'u':
+          if (!parseCodePoint()) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+    if (cur_ == end_) {
+      return false;
+    }
+    ++cur_;
+    *begin = scratch_.data();
+    *end = scratch_.data() + scratch_.size();
+    return true;
+  }
+
+  bool parseHex4(uint32_t *code) {
+    if (end_ - cur_ < 4) {
+      return false;
+    }
+    *code = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char c = *cur_++;
+      *code *= 16;
+      if (c >= '0' && c <= '9') {
+        *code += static_cast<uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        *code += static_cast<uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        *code += static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Appends the \u escape sequence at cur_ to scratch_ in UTF-8. Only
+  // complete surrogate pairs are accepted, jsoncpp handles the others in its
+  // own way.
+  bool parseCodePoint() {
+    uint32_t code = 0;
+    if (!parseHex4(&code)) {
+      return false;
+    }
+    if (code >= 0xDC00 && code <= 0xDFFF) {
+      return false;
+    }
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      uint32_t low = 0;
+      if (end_ - cur_ < 6 || *cur_++ != '\\' || *cur_++ != 'u' || !parseHex4(&low) || low < 0xDC00 || low > 0xDFFF) {
+        return false;
+      }
+      code = 0x10000 + ((code & 0x3FF) << 10) + (low & 0x3FF);
+    }
+    if (code < 0x80) {
+      scratch_ += static_cast<char>(code);
+    } else if (code < 0x800) {
+      scratch_ += static_cast<char>(0xC0 | (code >> 6));
+      scratch_ += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      scratch_ += static_cast<char>(0xE0 | (code >> 12));
+      scratch_ += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      scratch_ += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      scratch_ += static_cast<char>(0xF0 | (code >> 18));
+      scratch_ += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      scratch_ += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      scratch_ += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    return true;
+  }
+
+  bool parseLiteral(const char *literal, Json::Value &&literal_value, Json::Value *value) {
+    for (const char *l = literal; *l != '\0'; ++l, ++cur_) {
+      if (cur_ == end_ || *cur_ != *l) {
+        return false;
+      }
+    }
+    *value = std::move(literal_value);
+    return true;
+  }
+
+  // Integers only, typed as jsoncpp does: Int64 if they fit, else UInt64.
+  // Fractions, exponents, leading zeros and overflows are left to jsoncpp.
+  bool parseNumber(Json::Value *value) {
+    const bool negative = *cur_ == '-';
+    if (negative) {
+      ++cur_;
+    }
+    const char *digits = cur_;
+    uint64_t magnitude = 0;
+    while (cur_ != end_ && *cur_ >= '0' && *cur_ <= '9') {
+      const auto digit = static_cast<uint64_t>(*cur_ - '0');
+      if (magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+        return false;
+      }
+      magnitude = magnitude * 10 + digit;
+      ++cur_;
+    }
+    if (cur_ == digits || (*digits == '0' && cur_ - digits > 1)) {
+      return false;
+    }
+    if (cur_ != end_ && (*cur_ == '.' || *cur_ == 'e' || *cur_ == 'E')) {
+      return false;
+    }
+
+    constexpr auto max_int = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+    if (negative) {
+      if (magnitude > max_int + 1) {
+        return false;
+      }
+      *value = magnitude == max_int + 1 ? Json::Value(std::numeric_limits<Json::Int64>::min())
+                                        : Json::Value(-static_cast<Json::Int64>(magnitude));
+    } else if (magnitude <= max_int) {
+      *value = Json::Value(static_cast<Json::Int64>(magnitude));
+    } else {
+      *value = Json::Value(static_cast<Json::UInt64>(magnitude));
+    }
+    return true;
+  }
+
+  const char *cur_;
+  const char *end_;
+  std::string scratch_;
+};
+
+}  // namespace
+
+bool JsonReader::tryParse(const char *begin, const char *end, Json::Value *value) {
+  return Parser(begin, end).parseDocument(value);
+}
+
+Json::Value JsonReader::parse(const std::string &json) {
+  Json::Value value;
+  if (tryParse(json.data(), json.data() + json.size(), &value)) {
+    return value;
+  }
+  return Utils::parseJSON(json);
+}
@@ -0,0 +1,30 @@
+#ifndef JSON_READER_H_
+#define JSON_READER_H_
+
+#include <string>
+
+#include "json/json.h"
+
+/**
+ * A fast reader for the large JSON documents received on every update check:
+ * the Targets, Snapshot and delegated metadata and the Secondary manifests.
+ *
+ * It handles the strict subset of JSON that these are made of and builds the
+ * same Json::Value as jsoncpp, without its tokenizer, comment collection or
+ * error bookkeeping. Anything outside of that subset (comments, trailing
+ * commas, floating point numbers, invalid escapes...) is handed over to
+ * Utils::parseJSON(), so the result never differs from it. Configuration and
+ * other small documents keep using Utils::parseJSON() directly.
+ */
+class JsonReader {
+ public:
+  static Json::Value parse(const std::string &json);
+
+  /**
+   * Parses the whole of [begin, end) into `value`. Returns false, leaving
+   * `value` unspecified, if the input is not in the supported subset.
+   */
+  static bool tryParse(const char *begin, const char *end, Json::Value *value);
+};
+
+#endif  // JSON_READER_H_
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "utilities/json_reader.h"
+#include "utilities/utils.h"
+
+static void expectSameAsJsoncpp(const std::string &json, bool fast) {
+  Json::Value value;
+  EXPECT_EQ(JsonReader::tryParse(json.data(), json.data() + json.size(), &value), fast) << json;
+  const Json::Value expected = Utils::parseJSON(json);
+  EXPECT_EQ(JsonReader::parse(json), expected) << json;
+  if (fast) {
+    EXPECT_EQ(value, expected) << json;
+  }
+}
+
+/* The strict subset used by metadata is read without jsoncpp, to the same values. */
+TEST(JsonReader, Supported) {
+  const std::vector<std::string> inputs{
+      "{}",
+      "[]",
+      " \r\n\t{ \"a\" : [ 1 , -2, true, false, null, \"x\", {}, [] ] }\n",
+      "\"string\"",
+      "0",
+      "-0",
+      "9223372036854775807",
+      "9223372036854775808",
+      "18446744073709551615",
+      "-9223372036854775808",
+      R"({"escapes": "\"\\\/\b\f\n\r\tAé€😀\u0000end"})",
+      R"({"key": 1, "key": 2})",
+      R"({"a": 1, "a": {"b": 2}})",
+      "{\"utf8\": \"\xc3\xa9\xe2\x82\xac\"}",
+  };
+  for (const auto &json : inputs) {
+    expectSameAsJsoncpp(json, true);
+  }
+  Json::Value value;
+  const std::string json = "{\"pad\":\"a\\u0000b\"}";
+  ASSERT_TRUE(JsonReader::tryParse(json.data(), json.data() + json.size(), &value));
+  EXPECT_EQ(value["pad"].asString(), std::string("a\0b", 3));
+  EXPECT_TRUE(JsonReader::parse("-1").isInt64());
+  EXPECT_TRUE(JsonReader::parse("18446744073709551615").isUInt64());
+  EXPECT_FALSE(JsonReader::parse("18446744073709551615").isInt64());
+}
+
+/* Everything else goes through jsoncpp, with the same result as before. */
+TEST(JsonReader, Fallback) {
+  const std::vector<std::string> inputs{
+      "",
+      "   ",
+      "{",
+      "[1, 2",
+      "{\"a\" 1}",
+      "{\"a\": 1,}",
+      "[1, 2,]",
+      "1.5",
+      "{\"a\": -1e3}",
+      "18446744073709551616",
+      "-9223372036854775809",
+      "012",
+      "{} trailing",
+      "// comment\n{\"a\": 1}",
+      "{\"a\": /* comment */ 1}",
+      "\xef\xbb\xbf{\"bom\": true}",
+      R"({"bad": "\x"})",
+      R"({"lone": "\udc00"})",
+      R"({"half": "\ud83d"})",
+      R"({"short": "\u12"})",
+      "{\"ctrl\": \"a\tb\"}",
+      "tru",
+      "nul",
+      "{'single': 1}",
+      std::string(2000, '[') + std::string(2000, ']'),
+  };
+  for (const auto &json : inputs) {
+    SCOPED_TRACE(json.substr(0, 50));
+    try {
+      const Json::Value expected = Utils::parseJSON(json);
+      Json::Value value;
+      EXPECT_FALSE(JsonReader::tryParse(json.data(), json.data() + json.size(), &value));
+      EXPECT_EQ(JsonReader::parse(json), expected);
+    } catch (const std::exception &) {
+      EXPECT_THROW(JsonReader::parse(json), std::exception);
+    }
+  }
+}
+
+/* Real metadata is read without jsoncpp. */
+TEST(JsonReader, Metadata) {
+  for (const auto &file : {"tests/tuf/sample1/targets.json", "tests/test_data/prov/metadata/director/targets.json",
+                           "tests/test_data/prov/metadata/repo/snapshot.json"}) {
+    expectSameAsJsoncpp(Utils::readFile(file), true);
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,83 @@
+#include "utilities/memory_budget.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "logging/metrics.h"
+
+MemoryBudget& MemoryBudget::instance() {
+  static MemoryBudget budget;
+  return budget;
+}
+
+MemoryBudget::MemoryBudget()
+    : in_use_gauge_(Metrics::instance().gauge("aktualizr_buffer_bytes", "Bytes in budgeted buffers")),
+      high_water_gauge_(
+          Metrics::instance().gauge("aktualizr_buffer_bytes_high_water", "Most bytes ever in budgeted buffers")) {}
+
+uint64_t MemoryBudget::available() const {
+  const uint64_t limit = this->limit();
+  if (limit == 0) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  const uint64_t in_use = inUse();
+  return in_use < limit ? limit - in_use : 0;
+}
+
+bool MemoryBudget::tryAdd(uint64_t bytes) {
+  const uint64_t limit = this->limit();
+  uint64_t in_use = in_use_.load(std::memory_order_relaxed);
+  do {
+    if (limit != 0 && in_use + bytes > limit) {
+      return false;
+    }
+  } while (!in_use_.compare_exchange_weak(in_use, in_use + bytes, std::memory_order_relaxed));
+  noteInUse(in_use + bytes);
+  return true;
+}
+
+void MemoryBudget::add(uint64_t bytes) { noteInUse(in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes); }
+
+void MemoryBudget::remove(uint64_t bytes) {
+  const uint64_t in_use = in_use_.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+  in_use_gauge_.set(static_cast<int64_t>(in_use));
+}
+
+void MemoryBudget::noteInUse(uint64_t in_use) {
+  in_use_gauge_.set(static_cast<int64_t>(in_use));
+  uint64_t high_water = high_water_.load(std::memory_order_relaxed);
+  while (in_use > high_water && !high_water_.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed)) {
+  }
+  high_water_gauge_.set(static_cast<int64_t>(high_water_.load(std::memory_order_relaxed)));
+}
+
+MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(Reservation&& other) noexcept {
+  if (this != &other) {
+    release();
+    bytes_ = other.bytes_;
+    other.bytes_ = 0;
+  }
+  return *this;
+}
+
+bool MemoryBudget::Reservation::tryGrow(uint64_t bytes) {
+  if (!MemoryBudget::instance().tryAdd(bytes)) {
+    return false;
+  }
+  bytes_ += bytes;
+  return true;
+}
+
+void MemoryBudget::Reservation::grow(uint64_t bytes) {
+  MemoryBudget::instance().add(bytes);
+  bytes_ += bytes;
+}
+
+void MemoryBudget::Reservation::shrink(uint64_t bytes) {
+  bytes = std::min(bytes, bytes_);
+  if (bytes == 0) {
+    return;
+  }
+  MemoryBudget::instance().remove(bytes);
+  bytes_ -= bytes;
+}
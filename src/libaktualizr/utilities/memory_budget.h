@@ -0,0 +1,66 @@
+#ifndef MEMORY_BUDGET_H_
+#define MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <cstdint>
+
+class MetricGauge;
+
+/**
+ * Process-wide budget for the larger in-flight buffers: HTTP response bodies,
+ * streamed downloads, report batches, cached metadata and Secondary RPC
+ * buffers. Buffers that can wait or be done without ask for their bytes with
+ * Reservation::tryGrow(), others only count them with Reservation::grow(). The
+ * most bytes ever in use are exported as the aktualizr_buffer_bytes_high_water
+ * metric, to tell how much memory a device needs.
+ */
+class MemoryBudget {
+ public:
+  static MemoryBudget& instance();
+
+  /** Bytes all reservations may hold together; 0 for no limit. */
+  void setLimit(uint64_t bytes) { limit_.store(bytes, std::memory_order_relaxed); }
+  uint64_t limit() const { return limit_.load(std::memory_order_relaxed); }
+  uint64_t inUse() const { return in_use_.load(std::memory_order_relaxed); }
+  uint64_t highWater() const { return high_water_.load(std::memory_order_relaxed); }
+  /** Bytes left in the budget, UINT64_MAX without a limit. */
+  uint64_t available() const;
+
+  /** Bytes held by one buffer, given back when it is destroyed. */
+  class Reservation {
+   public:
+    Reservation() = default;
+    ~Reservation() { release(); }
+    Reservation(const Reservation&) = delete;
+    Reservation& operator=(const Reservation&) = delete;
+    Reservation(Reservation&& other) noexcept : bytes_(other.bytes_) { other.bytes_ = 0; }
+    Reservation& operator=(Reservation&& other) noexcept;
+
+    /** Add `bytes` if they fit into the budget. */
+    bool tryGrow(uint64_t bytes);
+    /** Add `bytes` whether they fit or not, for buffers that cannot wait. */
+    void grow(uint64_t bytes);
+    void shrink(uint64_t bytes);
+    void release() { shrink(bytes_); }
+    uint64_t bytes() const { return bytes_; }
+
+   private:
+    uint64_t bytes_{0};
+  };
+
+ private:
+  MemoryBudget();
+
+  bool tryAdd(uint64_t bytes);
+  void add(uint64_t bytes);
+  void remove(uint64_t bytes);
+  void noteInUse(uint64_t in_use);
+
+  std::atomic<uint64_t> limit_{0};
+  std::atomic<uint64_t> in_use_{0};
+  std::atomic<uint64_t> high_water_{0};
+  MetricGauge& in_use_gauge_;
+  MetricGauge& high_water_gauge_;
+};
+
+#endif  // MEMORY_BUDGET_H_
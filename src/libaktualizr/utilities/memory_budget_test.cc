@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include <limits>
+
+#include "logging/logging.h"
+#include "utilities/memory_budget.h"
+
+/* Reservations only grow within the limit and give their bytes back when destroyed. */
+TEST(MemoryBudget, Limit) {
+  MemoryBudget& budget = MemoryBudget::instance();
+  const uint64_t base = budget.inUse();
+  budget.setLimit(base + 100);
+  EXPECT_EQ(budget.available(), 100);
+  {
+    MemoryBudget::Reservation first;
+    EXPECT_TRUE(first.tryGrow(60));
+    MemoryBudget::Reservation second;
+    EXPECT_FALSE(second.tryGrow(50));
+    EXPECT_TRUE(second.tryGrow(40));
+    EXPECT_EQ(budget.available(), 0);
+    EXPECT_EQ(budget.inUse(), base + 100);
+
+    first.shrink(30);
+    EXPECT_EQ(first.bytes(), 30);
+    EXPECT_EQ(budget.available(), 30);
+
+    // Moving a reservation moves its bytes
+    MemoryBudget::Reservation moved(std::move(second));
+    EXPECT_EQ(second.bytes(), 0);
+    EXPECT_EQ(moved.bytes(), 40);
+
+    // Buffers that cannot wait go over the limit
+    moved.grow(50);
+    EXPECT_EQ(budget.available(), 0);
+    EXPECT_GE(budget.highWater(), base + 120);
+  }
+  EXPECT_EQ(budget.inUse(), base);
+  EXPECT_EQ(budget.available(), 100);
+
+  budget.setLimit(0);
+  EXPECT_EQ(budget.available(), std::numeric_limits<uint64_t>::max());
+  MemoryBudget::Reservation unlimited;
+  EXPECT_TRUE(unlimited.tryGrow(1000000));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,224 @@
+#include "utilities/process_runner.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <thread>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include "logging/logging.h"
+
+extern char** environ;  // NOLINT(readability-redundant-declaration)
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr std::chrono::seconds kSigtermDelay{5};
+constexpr std::chrono::seconds kSigkillDelay{30};
+constexpr int kPollIntervalMs = 100;
+
+// Sends the signals of an abort, escalating the longer the program takes to exit
+class AbortSignaller {
+ public:
+  AbortSignaller(pid_t pid, bool process_group) : target_(process_group ? -pid : pid) {}
+
+  void update() {
+    const auto now = Clock::now();
+    if (sent_ == 0) {
+      LOG_INFO << "Killing child process due to flow_control abort";
+      aborted_at_ = now;
+      send(SIGINT);
+    } else if (sent_ == 1 && now - aborted_at_ >= kSigtermDelay) {
+      LOG_WARNING << "Process didn't respond to SIGINT, sending SIGTERM";
+      send(SIGTERM);
+    } else if (sent_ == 2 && now - aborted_at_ >= kSigkillDelay) {
+      LOG_WARNING << "Process didn't respond to SIGTERM, sending SIGKILL";
+      send(SIGKILL);
+    }
+  }
+
+ private:
+  void send(int sig) {
+    if (kill(target_, sig) != 0) {
+      LOG_WARNING << "Attempt to send signal " << sig << " to pid " << target_ << " failed with "
+                  << std::strerror(errno);
+    }
+    ++sent_;
+  }
+
+  pid_t target_;
+  int sent_{0};
+  Clock::time_point aborted_at_;
+};
+}  // namespace
+
+std::vector<std::string> ProcessRunner::commandArgs(const std::string& command) {
+  static const char* const kShellSyntax = "|&;<>()$`\\\"'*?[]#~={}!\n";
+  if (command.find_first_of(kShellSyntax) != std::string::npos) {
+    return {"/bin/sh", "-c", command};
+  }
+  std::vector<std::string> words;
+  boost::split(words, command, boost::is_any_of(" \t"), boost::token_compress_on);
+  words.erase(std::remove(words.begin(), words.end(), ""), words.end());
+  if (words.empty()) {
+    return {"/bin/sh", "-c", command};
+  }
+  return words;
+}
+
+ProcessRunner::Result ProcessRunner::run(const std::string& command, const Options& options) {
+  return run(commandArgs(command), options);
+}
+
+ProcessRunner::Result ProcessRunner::run(const std::vector<std::string>& argv, const Options& options) {
+  Result result;
+  if (argv.empty()) {
+    return result;
+  }
+  const auto started = Clock::now();
+
+  std::array<int, 2> fds{-1, -1};
+  if (options.capture_output && pipe2(fds.data(), O_CLOEXEC) != 0) {
+    LOG_WARNING << "Could not create a pipe for " << argv[0] << ": " << std::strerror(errno);
+    return result;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (options.capture_output) {
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    if (options.include_stderr) {
+      posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    }
+  }
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  // Neither the signal mask of this thread nor ignored signals like SIGPIPE are passed on
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  for (const int sig : {SIGPIPE, SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGCHLD}) {
+    sigaddset(&defaults, sig);
+  }
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  int flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  if (options.process_group) {
+    posix_spawnattr_setpgroup(&attr, 0);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attr, static_cast<short>(flags));  // NOLINT(google-runtime-int)
+
+  std::vector<char*> args;
+  args.reserve(argv.size() + 1);
+  for (const auto& arg : argv) {
+    args.push_back(const_cast<char*>(arg.c_str()));
+  }
+  args.push_back(nullptr);
+
+  pid_t pid = -1;
+  const int spawn_error = posix_spawnp(&pid, argv[0].c_str(), &actions, &attr, args.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (options.capture_output) {
+    close(fds[1]);
+  }
+  if (spawn_error != 0) {
+    if (options.capture_output) {
+      close(fds[0]);
+    }
+    LOG_WARNING << "Failed to start " << argv[0] << ": " << std::strerror(spawn_error);
+    return result;
+  }
+  result.started = true;
+
+  auto consume = [&options, &result](const char* data, size_t size) {
+    if (options.output_cb) {
+      options.output_cb(data, size);
+    }
+    const size_t room = options.max_output - std::min(options.max_output, result.output.size());
+    result.output.append(data, std::min(size, room));
+    result.truncated = result.truncated || size > room;
+  };
+  // Reads what is available, returns false at the end of the output
+  std::array<char, 64 * 1024> buffer{};
+  auto read_output = [&fds, &buffer, &consume]() {
+    const ssize_t n = read(fds[0], buffer.data(), buffer.size());
+    if (n > 0) {
+      consume(buffer.data(), static_cast<size_t>(n));
+      return true;
+    }
+    return n < 0 && (errno == EINTR || errno == EAGAIN);
+  };
+
+  AbortSignaller signaller(pid, options.process_group);
+  bool output_open = options.capture_output;
+  int status = 0;
+  for (;;) {
+    if (options.flow_control != nullptr && options.flow_control->hasAborted()) {
+      result.aborted = true;
+      signaller.update();
+    }
+    if (output_open) {
+      pollfd pfd{fds[0], POLLIN, 0};
+      if (poll(&pfd, 1, kPollIntervalMs) > 0) {
+        output_open = read_output();
+      }
+      if (output_open) {
+        // The output stays open while the program runs, unless it is passed on to a program left behind
+        const pid_t waited = waitpid(pid, &status, WNOHANG);
+        if (waited == pid) {
+          break;
+        }
+      }
+      continue;
+    }
+    if (options.flow_control == nullptr) {
+      if (waitpid(pid, &status, 0) == pid || errno != EINTR) {
+        break;
+      }
+      continue;
+    }
+    const pid_t waited = waitpid(pid, &status, WNOHANG);
+    if (waited == pid || (waited < 0 && errno != EINTR)) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  if (output_open) {
+    // Only take what the program wrote before it exited
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    for (;;) {
+      const ssize_t n = read(fds[0], buffer.data(), buffer.size());
+      if (n > 0) {
+        consume(buffer.data(), static_cast<size_t>(n));
+      } else if (n == 0 || errno != EINTR) {
+        break;
+      }
+    }
+  }
+  if (options.capture_output) {
+    close(fds[0]);
+  }
+
+  if (WIFEXITED(status)) {
+    result.exit_code = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result.signal = WTERMSIG(status);
+  }
+  result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - started);
+  LOG_DEBUG << argv[0] << " finished with exit code " << result.exit_code << " after " << result.duration.count()
+            << " ms";
+  return result;
+}
@@ -0,0 +1,65 @@
+#ifndef PROCESS_RUNNER_H_
+#define PROCESS_RUNNER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "utilities/flow_control.h"
+
+/**
+ * Runs programs with posix_spawn(), which unlike fork() does not copy the page
+ * tables of this process, so that starting a command stays cheap however much
+ * memory aktualizr uses.
+ *
+ * The output of the program is read through a pipe as it is written, kept up
+ * to a limit and optionally passed on to a callback. If the flow control token
+ * is aborted, the program gets SIGINT, then SIGTERM after 5 seconds and
+ * SIGKILL after another 25 seconds.
+ */
+class ProcessRunner {
+ public:
+  using OutputCb = std::function<void(const char* data, size_t size)>;
+
+  struct Options {
+    // Read stdout through a pipe. Otherwise it is inherited, like stderr.
+    bool capture_output{true};
+    // Also capture stderr, interleaved with stdout
+    bool include_stderr{false};
+    // Bytes of output kept in Result::output; later output is only passed to output_cb
+    size_t max_output{1024 * 1024};
+    OutputCb output_cb;
+    const api::FlowControlToken* flow_control{nullptr};
+    // Run the program in a process group of its own and signal the whole group on abort
+    bool process_group{false};
+  };
+
+  struct Result {
+    bool started{false};
+    // Exit code of the program, -1 if it did not start or was killed by a signal
+    int exit_code{-1};
+    int signal{0};
+    bool aborted{false};
+    std::string output;
+    bool truncated{false};
+    std::chrono::milliseconds duration{0};
+  };
+
+  /**
+   * Run the program argv[0], looked up in PATH if it contains no slash, and
+   * wait for it to finish.
+   */
+  static Result run(const std::vector<std::string>& argv, const Options& options);
+  /** Run a command line, see commandArgs(). */
+  static Result run(const std::string& command, const Options& options);
+
+  /**
+   * The words of a command line without any shell syntax, so that it can be
+   * run without a shell. Anything else is run with /bin/sh -c.
+   */
+  static std::vector<std::string> commandArgs(const std::string& command);
+};
+
+#endif  // PROCESS_RUNNER_H_
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "logging/logging.h"
+#include "utilities/process_runner.h"
+
+TEST(ProcessRunner, CommandArgs) {
+  EXPECT_EQ(ProcessRunner::commandArgs("fw_setenv  bootcount 0"),
+            std::vector<std::string>({"fw_setenv", "bootcount", "0"}));
+  EXPECT_EQ(ProcessRunner::commandArgs("echo $HOME"), std::vector<std::string>({"/bin/sh", "-c", "echo $HOME"}));
+  EXPECT_EQ(ProcessRunner::commandArgs("a | b"), std::vector<std::string>({"/bin/sh", "-c", "a | b"}));
+  EXPECT_EQ(ProcessRunner::commandArgs("echo 'a b'"), std::vector<std::string>({"/bin/sh", "-c", "echo 'a b'"}));
+}
+
+TEST(ProcessRunner, Output) {
+  ProcessRunner::Options options;
+  auto result = ProcessRunner::run("echo hello", options);
+  EXPECT_TRUE(result.started);
+  EXPECT_EQ(result.exit_code, 0);
+  EXPECT_EQ(result.output, "hello\n");
+
+  result = ProcessRunner::run("echo out; echo err >&2; exit 3", options);
+  EXPECT_EQ(result.exit_code, 3);
+  EXPECT_EQ(result.output, "out\n");
+
+  options.include_stderr = true;
+  result = ProcessRunner::run("echo out; echo err >&2", options);
+  EXPECT_EQ(result.output, "out\nerr\n");
+}
+
+/* Output beyond max_output is only passed to the callback. */
+TEST(ProcessRunner, OutputLimit) {
+  ProcessRunner::Options options;
+  options.max_output = 10;
+  size_t streamed = 0;
+  options.output_cb = [&streamed](const char* data, size_t size) {
+    (void)data;
+    streamed += size;
+  };
+  const auto result = ProcessRunner::run("head -c 100000 /dev/zero", options);
+  EXPECT_EQ(result.exit_code, 0);
+  EXPECT_EQ(result.output.size(), 10);
+  EXPECT_TRUE(result.truncated);
+  EXPECT_EQ(streamed, 100000);
+}
+
+TEST(ProcessRunner, CantStart) {
+  const auto result = ProcessRunner::run("/xxx/not/a/process", ProcessRunner::Options());
+  EXPECT_FALSE(result.started);
+  EXPECT_EQ(result.exit_code, -1);
+}
+
+TEST(ProcessRunner, Signal) {
+  const auto result = ProcessRunner::run("kill -TERM $$", ProcessRunner::Options());
+  EXPECT_EQ(result.exit_code, -1);
+  EXPECT_EQ(result.signal, SIGTERM);
+}
+
+/* The program and, in a process group, the programs it starts are stopped on abort. */
+TEST(ProcessRunner, Cancellation) {
+  api::FlowControlToken token;
+  std::thread abort_thread([&token] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    token.setAbort();
+  });
+
+  ProcessRunner::Options options;
+  options.flow_control = &token;
+  options.process_group = true;
+  const auto result = ProcessRunner::run("sleep 100 | cat", options);
+  abort_thread.join();
+
+  EXPECT_TRUE(result.aborted);
+  EXPECT_NE(result.exit_code, 0);
+  EXPECT_LT(result.duration, std::chrono::seconds(5));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,92 @@
+#include "utilities/process_stats.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+static std::string readLine(const fs::path& path) {
+  std::ifstream file(path.c_str());
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+// Fields of /proc/<pid>/task/<tid>/stat, see proc(5). The name in parentheses
+// may contain spaces, so the fields are counted from the closing one.
+static void parseStat(const std::string& stat, Json::Value* thread) {
+  const auto name_end = stat.rfind(')');
+  if (name_end == std::string::npos) {
+    return;
+  }
+  std::istringstream fields(stat.substr(name_end + 1));
+  std::string state;
+  fields >> state;
+  (*thread)["state"] = state;
+  // utime and stime are fields 14 and 15, the state is field 3
+  std::string skipped;
+  for (int i = 4; i < 14; ++i) {
+    fields >> skipped;
+  }
+  Json::UInt64 utime = 0;
+  Json::UInt64 stime = 0;
+  if (fields >> utime >> stime) {
+    (*thread)["utime"] = utime;
+    (*thread)["stime"] = stime;
+  }
+}
+
+Json::Value ProcessStats::threads(const fs::path& root) {
+  Json::Value threads{Json::arrayValue};
+  const fs::path tasks = root / "proc/self/task";
+  boost::system::error_code ec;
+  if (!fs::is_directory(tasks, ec)) {
+    return threads;
+  }
+  // Sorted by thread id, which is the order they were started in
+  std::map<Json::UInt64, fs::path> sorted;
+  for (fs::directory_iterator it(tasks, ec), end; !ec && it != end; it.increment(ec)) {
+    try {
+      sorted.emplace(std::stoull(it->path().filename().string()), it->path());
+    } catch (const std::exception&) {
+      continue;
+    }
+  }
+  for (const auto& task : sorted) {
+    Json::Value thread;
+    thread["tid"] = task.first;
+    thread["name"] = readLine(task.second / "comm");
+    parseStat(readLine(task.second / "stat"), &thread);
+    threads.append(thread);
+  }
+  return threads;
+}
+
+Json::Value ProcessStats::memory(const fs::path& root) {
+  static const std::map<std::string, std::string> fields{
+      {"VmPeak", "virtualPeak"}, {"VmSize", "virtual"}, {"VmHWM", "residentPeak"}, {"VmRSS", "resident"}};
+  Json::Value memory{Json::objectValue};
+  std::ifstream status((root / "proc/self/status").c_str());
+  std::string line;
+  while (std::getline(status, line)) {
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    const auto field = fields.find(line.substr(0, colon));
+    if (field == fields.end()) {
+      continue;
+    }
+    // Such as "VmHWM:	    5120 kB"
+    std::istringstream value(line.substr(colon + 1));
+    Json::UInt64 kb = 0;
+    if (value >> kb) {
+      memory[field->second] = kb * 1024;
+    }
+  }
+  return memory;
+}
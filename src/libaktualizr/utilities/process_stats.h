@@ -0,0 +1,28 @@
+#ifndef PROCESS_STATS_H_
+#define PROCESS_STATS_H_
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+/**
+ * Reads the state of the running process from procfs, for the diagnostic
+ * snapshot of Aktualizr::Snapshot(). Files are read below `root`, so that
+ * tests can use a directory tree of their own, and missing ones are skipped.
+ */
+class ProcessStats {
+ public:
+  /**
+   * The threads of the process: their id, name, scheduler state (`R`, `S`,
+   * `D`...) and CPU time in clock ticks.
+   */
+  static Json::Value threads(const boost::filesystem::path& root = "/");
+
+  /**
+   * The current and peak virtual and resident memory of the process in
+   * bytes, from the `Vm*` lines of /proc/self/status.
+   */
+  static Json::Value memory(const boost::filesystem::path& root = "/");
+};
+
+#endif  // PROCESS_STATS_H_
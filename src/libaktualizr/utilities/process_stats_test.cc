@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "utilities/process_stats.h"
+#include "utilities/utils.h"
+
+/* Threads are listed in the order of their ids, with their name, state and CPU time. */
+TEST(ProcessStats, Threads) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path tasks = temp_dir / "proc/self/task";
+  Utils::writeFile(tasks / "812/comm", std::string("aktualizr\n"));
+  Utils::writeFile(tasks / "812/stat", std::string("812 (aktualizr) S 1 812 812 0 -1 4194560 1200 0 3 0 150 42 0 0\n"));
+  Utils::writeFile(tasks / "830/comm", std::string("worker (1)\n"));
+  Utils::writeFile(tasks / "830/stat", std::string("830 (worker (1)) D 1 812 812 0 -1 4194624 60 0 0 0 7 2 0 0\n"));
+  Utils::writeFile(tasks / "93/comm", std::string("early\n"));
+
+  const Json::Value threads = ProcessStats::threads(temp_dir.Path());
+  ASSERT_EQ(threads.size(), 3);
+  EXPECT_EQ(threads[0]["tid"].asUInt64(), 93);
+  EXPECT_EQ(threads[0]["name"].asString(), "early");
+  EXPECT_FALSE(threads[0].isMember("state"));
+  EXPECT_EQ(threads[1]["tid"].asUInt64(), 812);
+  EXPECT_EQ(threads[1]["state"].asString(), "S");
+  EXPECT_EQ(threads[1]["utime"].asUInt64(), 150);
+  EXPECT_EQ(threads[1]["stime"].asUInt64(), 42);
+  EXPECT_EQ(threads[2]["name"].asString(), "worker (1)");
+  EXPECT_EQ(threads[2]["state"].asString(), "D");
+  EXPECT_EQ(threads[2]["utime"].asUInt64(), 7);
+}
+
+/* Memory figures come from the Vm lines of the status file, in bytes. */
+TEST(ProcessStats, Memory) {
+  TemporaryDirectory temp_dir;
+  Utils::writeFile(temp_dir / "proc/self/status", std::string("Name:\taktualizr\n"
+                                                              "VmPeak:\t   20480 kB\n"
+                                                              "VmSize:\t   16384 kB\n"
+                                                              "VmHWM:\t    5120 kB\n"
+                                                              "VmRSS:\t    4096 kB\n"
+                                                              "Threads:\t6\n"));
+
+  const Json::Value memory = ProcessStats::memory(temp_dir.Path());
+  EXPECT_EQ(memory["virtualPeak"].asUInt64(), 20480 * 1024);
+  EXPECT_EQ(memory["virtual"].asUInt64(), 16384 * 1024);
+  EXPECT_EQ(memory["residentPeak"].asUInt64(), 5120 * 1024);
+  EXPECT_EQ(memory["resident"].asUInt64(), 4096 * 1024);
+  EXPECT_EQ(memory.size(), 4);
+}
+
+/* The running process can be read as well. */
+TEST(ProcessStats, Self) {
+  EXPECT_GE(ProcessStats::threads().size(), 1);
+  EXPECT_GT(ProcessStats::memory()["residentPeak"].asUInt64(), 0);
+  EXPECT_TRUE(ProcessStats::threads("/nonexistent").empty());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,137 @@
+#include "utilities/resource_policy.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+
+namespace {
+// See ioprio_set(2)
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioClassBestEffort = 2;
+constexpr int kIoprioClassIdle = 3;
+
+id_t threadId() { return static_cast<id_t>(syscall(SYS_gettid)); }
+
+[[noreturn]] void invalid(const std::string& spec) {
+  throw std::invalid_argument("Invalid resource policy \"" + spec + "\", expected e.g. nice=10,io=best-effort:7");
+}
+
+int parseInt(const std::string& value, int min, int max, const std::string& spec) {
+  size_t consumed = 0;
+  int result = 0;
+  try {
+    result = std::stoi(value, &consumed);
+  } catch (const std::exception&) {
+    invalid(spec);
+  }
+  if (consumed != value.size() || result < min || result > max) {
+    invalid(spec);
+  }
+  return result;
+}
+}  // namespace
+
+ResourcePolicy ResourcePolicy::parse(const std::string& spec) {
+  ResourcePolicy policy;
+  std::vector<std::string> entries;
+  boost::split(entries, spec, boost::is_any_of(","));
+  for (auto entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    const auto separator = entry.find('=');
+    if (separator == std::string::npos) {
+      invalid(spec);
+    }
+    const std::string key = entry.substr(0, separator);
+    const std::string value = entry.substr(separator + 1);
+    if (key == "nice") {
+      policy.nice = parseInt(value, -20, 19, spec);
+    } else if (key == "io" && value == "idle") {
+      policy.ioprio = kIoprioClassIdle << kIoprioClassShift;
+    } else if (key == "io" && value == "best-effort") {
+      // The level the kernel derives from the CPU priority by default
+      policy.ioprio = kIoprioClassBestEffort << kIoprioClassShift | 4;
+    } else if (key == "io" && boost::starts_with(value, "best-effort:")) {
+      const int level = parseInt(value.substr(std::string("best-effort:").size()), 0, 7, spec);
+      policy.ioprio = kIoprioClassBestEffort << kIoprioClassShift | level;
+    } else {
+      invalid(spec);
+    }
+  }
+  return policy;
+}
+
+ResourcePolicy ResourcePolicy::lowest() {
+  ResourcePolicy policy;
+  policy.nice = 19;
+  policy.ioprio = kIoprioClassIdle << kIoprioClassShift;
+  return policy;
+}
+
+ResourcePolicies& ResourcePolicies::instance() {
+  static ResourcePolicies policies;
+  return policies;
+}
+
+void ResourcePolicies::configure(const ResourcesConfig& config) {
+  const std::array<const std::string*, 5> specs{&config.metadata, &config.download, &config.hash, &config.deploy,
+                                                &config.container_load};
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (size_t i = 0; i < specs.size(); ++i) {
+    try {
+      policies_[i] = ResourcePolicy::parse(*specs[i]);
+    } catch (const std::invalid_argument&) {
+      policies_[i] = ResourcePolicy();
+    }
+  }
+}
+
+ResourcePolicy ResourcePolicies::get(ResourcePhase phase) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return policies_[static_cast<size_t>(phase)];
+}
+
+ScopedResourcePolicy::ScopedResourcePolicy(ResourcePhase phase)
+    : ScopedResourcePolicy(ResourcePolicies::instance().get(phase)) {}
+
+ScopedResourcePolicy::ScopedResourcePolicy(const ResourcePolicy& policy) {
+  // Both priorities apply to this thread only, and are inherited by the processes it starts
+  if (policy.nice) {
+    errno = 0;
+    const int previous = getpriority(PRIO_PROCESS, threadId());
+    if (errno == 0 && setpriority(PRIO_PROCESS, threadId(), *policy.nice) == 0) {
+      previous_nice_ = previous;
+    } else {
+      LOG_DEBUG << "Could not set the CPU priority to " << *policy.nice << ": " << std::strerror(errno);
+    }
+  }
+  if (policy.ioprio) {
+    const auto previous = syscall(SYS_ioprio_get, kIoprioWhoProcess, 0);
+    if (previous >= 0 && syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, *policy.ioprio) == 0) {
+      previous_ioprio_ = static_cast<int>(previous);
+    } else {
+      LOG_DEBUG << "Could not set the I/O priority: " << std::strerror(errno);
+    }
+  }
+}
+
+ScopedResourcePolicy::~ScopedResourcePolicy() {
+  if (previous_ioprio_ && syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, *previous_ioprio_) != 0) {
+    LOG_DEBUG << "Could not restore the I/O priority: " << std::strerror(errno);
+  }
+  if (previous_nice_ && setpriority(PRIO_PROCESS, threadId(), *previous_nice_) != 0) {
+    LOG_DEBUG << "Could not restore the CPU priority: " << std::strerror(errno);
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef RESOURCE_POLICY_H_
+#define RESOURCE_POLICY_H_
+
+#include <array>
+#include <mutex>
+#include <string>
+
+#include <boost/optional.hpp>
+
+struct ResourcesConfig;
+
+/** The phases of an update cycle with their own CPU and I/O priorities. */
+enum class ResourcePhase { kMetadata = 0, kDownload, kHash, kDeploy, kContainerLoad };
+
+/**
+ * CPU and I/O priorities of the threads working on one phase, and of the
+ * processes they start. Unset priorities are left as they are.
+ */
+struct ResourcePolicy {
+  boost::optional<int> nice;    // -20 to 19
+  boost::optional<int> ioprio;  // As for ioprio_set(2), i.e. class << 13 | level
+
+  /**
+   * Parse a policy like "nice=10,io=idle" or "nice=5,io=best-effort:7".
+   * @throws std::invalid_argument on a malformed policy
+   */
+  static ResourcePolicy parse(const std::string& spec);
+  /** The lowest CPU priority and the idle I/O class, for work that may take as long as it needs. */
+  static ResourcePolicy lowest();
+};
+
+/**
+ * The process-wide policies of the phases, as configured in the [resources]
+ * section.
+ */
+class ResourcePolicies {
+ public:
+  static ResourcePolicies& instance();
+
+  /** Malformed policies are ignored, Config::postUpdateValues() warns about them. */
+  void configure(const ResourcesConfig& config);
+  ResourcePolicy get(ResourcePhase phase) const;
+
+ private:
+  ResourcePolicies() = default;
+
+  mutable std::mutex mutex_;
+  std::array<ResourcePolicy, 5> policies_;
+};
+
+/**
+ * Apply a policy to the calling thread, and to the processes it starts, until
+ * destroyed. The previous priorities are restored then, as far as the process
+ * is allowed to raise them again.
+ */
+class ScopedResourcePolicy {
+ public:
+  explicit ScopedResourcePolicy(ResourcePhase phase);
+  explicit ScopedResourcePolicy(const ResourcePolicy& policy);
+  ~ScopedResourcePolicy();
+  ScopedResourcePolicy(const ScopedResourcePolicy&) = delete;
+  ScopedResourcePolicy(ScopedResourcePolicy&&) = delete;
+  ScopedResourcePolicy& operator=(const ScopedResourcePolicy&) = delete;
+  ScopedResourcePolicy& operator=(ScopedResourcePolicy&&) = delete;
+
+ private:
+  boost::optional<int> previous_nice_;
+  boost::optional<int> previous_ioprio_;
+};
+
+#endif  // RESOURCE_POLICY_H_
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <thread>
+
+#include <boost/optional/optional_io.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/resource_policy.h"
+
+namespace {
+int threadNice() {
+  errno = 0;
+  return getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+}
+}  // namespace
+
+/* Policies set a CPU priority, an I/O class or both. */
+TEST(ResourcePolicy, Parse) {
+  auto policy = ResourcePolicy::parse(" nice=10, io=idle");
+  EXPECT_EQ(policy.nice, 10);
+  EXPECT_EQ(policy.ioprio, 3 << 13);
+  policy = ResourcePolicy::parse("io=best-effort:7");
+  EXPECT_FALSE(policy.nice);
+  EXPECT_EQ(policy.ioprio, 2 << 13 | 7);
+  policy = ResourcePolicy::parse("nice=-5,io=best-effort");
+  EXPECT_EQ(policy.nice, -5);
+  EXPECT_EQ(policy.ioprio, 2 << 13 | 4);
+
+  policy = ResourcePolicy::parse("");
+  EXPECT_FALSE(policy.nice);
+  EXPECT_FALSE(policy.ioprio);
+  EXPECT_THROW(ResourcePolicy::parse("nice=20"), std::invalid_argument);
+  EXPECT_THROW(ResourcePolicy::parse("nice=1x"), std::invalid_argument);
+  EXPECT_THROW(ResourcePolicy::parse("nice"), std::invalid_argument);
+  EXPECT_THROW(ResourcePolicy::parse("io=realtime:0"), std::invalid_argument);
+  EXPECT_THROW(ResourcePolicy::parse("io=best-effort:8"), std::invalid_argument);
+  EXPECT_THROW(ResourcePolicy::parse("weight=100"), std::invalid_argument);
+}
+
+/* A policy applies to the calling thread only, until it goes out of scope. */
+TEST(ResourcePolicy, Scoped) {
+  // Run in a thread of its own, since lowering a priority may not be undone without CAP_SYS_NICE
+  std::thread([]() {
+    const int before = threadNice();
+    ResourcesConfig config;
+    config.download = "nice=19";
+    config.deploy = "broken";
+    ResourcePolicies::instance().configure(config);
+    EXPECT_EQ(ResourcePolicies::instance().get(ResourcePhase::kDownload).nice, 19);
+    EXPECT_FALSE(ResourcePolicies::instance().get(ResourcePhase::kDeploy).nice);
+    {
+      ScopedResourcePolicy policy(ResourcePhase::kDownload);
+      EXPECT_EQ(threadNice(), 19);
+      int other = 0;
+      std::thread([&other]() { other = threadNice(); }).join();
+      EXPECT_EQ(other, 19);  // Threads and processes started meanwhile take it over
+    }
+    if (geteuid() == 0) {
+      EXPECT_EQ(threadNice(), before);
+    }
+    ResourcePolicies::instance().configure(ResourcesConfig());
+  }).join();
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
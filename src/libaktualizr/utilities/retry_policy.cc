@@ -0,0 +1,91 @@
+#include "retry_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+
+std::chrono::milliseconds RetryPolicy::baseDelay(int retry) const {
+  const double factor = std::pow(multiplier, std::max(retry - 1, 0));
+  const double base = std::min(static_cast<double>(initial_delay.count()) * factor,
+                               static_cast<double>(max_delay.count()));
+  return std::chrono::milliseconds(static_cast<int64_t>(base));
+}
+
+std::chrono::milliseconds RetryPolicy::delay(int retry, int64_t retry_after_sec) const {
+  static thread_local std::mt19937_64 generator{std::random_device{}()};
+  const auto base = baseDelay(retry);
+  const double spread = std::min(std::max(jitter, 0.0), 1.0);
+  std::uniform_real_distribution<double> distribution(1.0 - spread, 1.0);
+  auto result =
+      std::chrono::milliseconds(static_cast<int64_t>(static_cast<double>(base.count()) * distribution(generator)));
+  if (retry_after_sec >= 0) {
+    const auto requested = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(
+        std::min<int64_t>(retry_after_sec, std::chrono::duration_cast<std::chrono::seconds>(max_delay).count())));
+    result = std::max(result, requested);
+  }
+  return result;
+}
+
+bool CircuitBreaker::allow() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!open_) {
+    return true;
+  }
+  if (trial_ || Clock::now() < open_until_) {
+    return false;
+  }
+  trial_ = true;
+  return true;
+}
+
+void CircuitBreaker::success() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  failures_ = 0;
+  open_ = false;
+  trial_ = false;
+  open_time_ = initial_open_time_;
+}
+
+void CircuitBreaker::failure() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (trial_) {
+    trial_ = false;
+    open_time_ = std::min(open_time_ * 2, max_open_time_);
+  } else if (++failures_ < threshold_ || open_) {
+    return;
+  }
+  open_ = true;
+  open_until_ = Clock::now() + open_time_;
+}
+
+void CircuitBreaker::release() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  // The next call may be the trial then
+  trial_ = false;
+}
+
+bool CircuitBreaker::isOpen() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return open_;
+}
+
+std::string CircuitBreaker::endpointOf(const std::string& url) {
+  const auto scheme_end = url.find("://");
+  const auto authority = scheme_end == std::string::npos ? 0 : scheme_end + 3;
+  const auto path = url.find_first_of("/?#", authority);
+  return url.substr(0, path);
+}
+
+CircuitBreaker& CircuitBreaker::forEndpoint(const std::string& url) {
+  static std::mutex mutex;
+  // Never removed, so that references stay valid; a device talks to a handful of endpoints
+  static std::map<std::string, std::unique_ptr<CircuitBreaker>> breakers;
+  std::lock_guard<std::mutex> guard(mutex);
+  auto& breaker = breakers[endpointOf(url)];
+  if (breaker == nullptr) {
+    breaker = std::make_unique<CircuitBreaker>();
+  }
+  return *breaker;
+}
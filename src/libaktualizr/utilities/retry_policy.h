@@ -0,0 +1,115 @@
+#ifndef RETRY_POLICY_H_
+#define RETRY_POLICY_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * When to try a failed operation again: exponential backoff with jitter, so
+ * that the devices that lost the server at the same time do not all come back
+ * at the same time, and the delay the server asked for with Retry-After.
+ */
+struct RetryPolicy {
+  /** Attempts in total, including the first one; 0 for no limit. */
+  int max_attempts{3};
+  std::chrono::milliseconds initial_delay{500};
+  std::chrono::milliseconds max_delay{std::chrono::seconds(60)};
+  double multiplier{2.0};
+  /** Share of each delay that is random, from 0 (none) to 1 (anywhere from zero to the full delay). */
+  double jitter{0.5};
+
+  /** Whether to try again after `attempts` failed attempts. */
+  bool shouldRetry(int attempts) const { return max_attempts == 0 || attempts < max_attempts; }
+
+  /**
+   * The delay before retry number `retry`, starting at 1. A Retry-After of
+   * the server, in seconds, replaces the backoff if it is longer, up to
+   * max_delay; a negative value means there was none.
+   */
+  std::chrono::milliseconds delay(int retry, int64_t retry_after_sec = -1) const;
+  /** delay() without the jitter. */
+  std::chrono::milliseconds baseDelay(int retry) const;
+};
+
+/**
+ * Stops calls to an endpoint that keeps failing, so that they fail at once
+ * instead of waiting for their timeouts and retries. After `threshold`
+ * failures in a row, calls are refused for `open_time`. Then one trial call
+ * is let through: if it succeeds, calls go through again, otherwise they are
+ * refused for twice as long, up to `max_open_time`.
+ */
+class CircuitBreaker {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit CircuitBreaker(int threshold = 5, std::chrono::milliseconds open_time = std::chrono::seconds(30),
+                          std::chrono::milliseconds max_open_time = std::chrono::minutes(10))
+      : threshold_{threshold}, initial_open_time_{open_time}, open_time_{open_time}, max_open_time_{max_open_time} {}
+
+  /**
+   * Whether a call may go ahead. A call that was let through must report
+   * success(), failure() or release().
+   */
+  bool allow();
+  void success();
+  void failure();
+  /** End a call that says nothing about the endpoint, e.g. a cancelled one. */
+  void release();
+  bool isOpen() const;
+
+  /**
+   * A call that was let through by allow(), released when it goes out of
+   * scope without a success() or failure(), so that an early return or an
+   * exception can't leave a trial call holding the breaker open.
+   */
+  class Call {
+   public:
+    explicit Call(CircuitBreaker& breaker) : breaker_{breaker} {}
+    ~Call() {
+      if (!done_) {
+        breaker_.release();
+      }
+    }
+    Call(const Call&) = delete;
+    Call(Call&&) = delete;
+    Call& operator=(const Call&) = delete;
+    Call& operator=(Call&&) = delete;
+
+    void success() {
+      done_ = true;
+      breaker_.success();
+    }
+    void failure() {
+      done_ = true;
+      breaker_.failure();
+    }
+
+   private:
+    CircuitBreaker& breaker_;
+    bool done_{false};
+  };
+
+  /**
+   * The breaker of the scheme, host and port of `url`, shared by the whole
+   * process.
+   */
+  static CircuitBreaker& forEndpoint(const std::string& url);
+  /** The scheme, host and port of a URL, e.g. "https://example.com:8443". */
+  static std::string endpointOf(const std::string& url);
+
+ private:
+  const int threshold_;
+  const std::chrono::milliseconds initial_open_time_;
+  std::chrono::milliseconds open_time_;
+  const std::chrono::milliseconds max_open_time_;
+
+  mutable std::mutex mutex_;
+  int failures_{0};
+  bool open_{false};
+  bool trial_{false};
+  Clock::time_point open_until_;
+};
+
+#endif  // RETRY_POLICY_H_
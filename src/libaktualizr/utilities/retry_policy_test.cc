@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "logging/logging.h"
+#include "utilities/retry_policy.h"
+
+using std::chrono::milliseconds;
+
+/* Delays grow exponentially up to the maximum, less a random share of them. */
+TEST(RetryPolicy, Backoff) {
+  RetryPolicy policy;
+  policy.initial_delay = milliseconds(100);
+  policy.max_delay = milliseconds(1000);
+  EXPECT_EQ(policy.baseDelay(1), milliseconds(100));
+  EXPECT_EQ(policy.baseDelay(2), milliseconds(200));
+  EXPECT_EQ(policy.baseDelay(4), milliseconds(800));
+  EXPECT_EQ(policy.baseDelay(5), milliseconds(1000));
+  EXPECT_EQ(policy.baseDelay(100), milliseconds(1000));
+
+  for (int i = 0; i < 100; ++i) {
+    const auto delay = policy.delay(3);
+    EXPECT_GE(delay, milliseconds(200));
+    EXPECT_LE(delay, milliseconds(400));
+  }
+  policy.jitter = 0.0;
+  EXPECT_EQ(policy.delay(3), milliseconds(400));
+
+  EXPECT_TRUE(policy.shouldRetry(2));
+  EXPECT_FALSE(policy.shouldRetry(3));
+  policy.max_attempts = 0;
+  EXPECT_TRUE(policy.shouldRetry(1000));
+}
+
+/* A Retry-After of the server wins over a shorter backoff, up to the maximum delay. */
+TEST(RetryPolicy, RetryAfter) {
+  RetryPolicy policy;
+  policy.initial_delay = milliseconds(100);
+  policy.max_delay = milliseconds(5000);
+  policy.jitter = 0.0;
+  EXPECT_EQ(policy.delay(1, 2), milliseconds(2000));
+  EXPECT_EQ(policy.delay(1, 0), milliseconds(100));
+  EXPECT_EQ(policy.delay(1, 3600), milliseconds(5000));
+}
+
+/* A breaker opens after repeated failures, then lets one trial through. */
+TEST(CircuitBreaker, OpenAndClose) {
+  CircuitBreaker breaker(3, milliseconds(50), milliseconds(200));
+  breaker.failure();
+  breaker.failure();
+  EXPECT_TRUE(breaker.allow());
+  breaker.failure();
+  EXPECT_TRUE(breaker.isOpen());
+  EXPECT_FALSE(breaker.allow());
+
+  std::this_thread::sleep_for(milliseconds(60));
+  EXPECT_TRUE(breaker.allow());
+  // Only one trial at a time
+  EXPECT_FALSE(breaker.allow());
+  breaker.failure();
+  // Open for longer now
+  std::this_thread::sleep_for(milliseconds(60));
+  EXPECT_FALSE(breaker.allow());
+  std::this_thread::sleep_for(milliseconds(60));
+  EXPECT_TRUE(breaker.allow());
+  breaker.success();
+  EXPECT_FALSE(breaker.isOpen());
+  EXPECT_TRUE(breaker.allow());
+}
+
+/* A trial call that ends without a verdict, e.g. because it was cancelled,
+ * lets the next call be the trial instead of keeping the breaker open. */
+TEST(CircuitBreaker, ReleasedTrial) {
+  CircuitBreaker breaker(1, milliseconds(50), milliseconds(200));
+  breaker.failure();
+  EXPECT_FALSE(breaker.allow());
+  std::this_thread::sleep_for(milliseconds(60));
+
+  ASSERT_TRUE(breaker.allow());
+  { CircuitBreaker::Call call(breaker); }
+  EXPECT_TRUE(breaker.isOpen());
+  ASSERT_TRUE(breaker.allow());
+  EXPECT_FALSE(breaker.allow());
+  breaker.release();
+
+  // A call that reports its result isn't released again
+  ASSERT_TRUE(breaker.allow());
+  {
+    CircuitBreaker::Call call(breaker);
+    call.failure();
+  }
+  EXPECT_FALSE(breaker.allow());
+  std::this_thread::sleep_for(milliseconds(110));
+  ASSERT_TRUE(breaker.allow());
+  {
+    CircuitBreaker::Call call(breaker);
+    call.success();
+  }
+  EXPECT_FALSE(breaker.isOpen());
+}
+
+/* Breakers are shared per scheme, host and port. */
+TEST(CircuitBreaker, Endpoints) {
+  EXPECT_EQ(CircuitBreaker::endpointOf("https://example.com:8443/api/v1?x=1"), "https://example.com:8443");
+  EXPECT_EQ(CircuitBreaker::endpointOf("http://example.com"), "http://example.com");
+  EXPECT_EQ(&CircuitBreaker::forEndpoint("https://example.com/a"), &CircuitBreaker::forEndpoint("https://example.com/b"));
+  EXPECT_NE(&CircuitBreaker::forEndpoint("https://example.com/a"), &CircuitBreaker::forEndpoint("http://example.com/a"));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
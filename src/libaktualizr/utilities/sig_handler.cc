@@ -5,6 +5,10 @@ std::atomic_uint SigHandler::signal_marker_;   // NOLINT(cppcoreguidelines-avoid
 std::mutex SigHandler::exit_m_;                // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 std::condition_variable SigHandler::exit_cv_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 bool SigHandler::exit_flag_;                   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<uint64_t> SigHandler::handled_mask_;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<uint64_t> SigHandler::handled_marker_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+std::mutex SigHandler::handlers_m_;                 // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+std::map<int, std::function<void()>> SigHandler::handlers_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
 SigHandler& SigHandler::get() {
   static SigHandler handler;
@@ -41,6 +45,24 @@ void SigHandler::start(const std::function<void()>& on_signal) {
         return;
       }
 
+      const uint64_t handled = handled_marker_.exchange(0);
+      if (handled != 0) {
+        std::map<int, std::function<void()>> handlers;
+        {
+          std::lock_guard<std::mutex> g(handlers_m_);
+          handlers = handlers_;
+        }
+        for (const auto& handler : handlers) {
+          if ((handled & (uint64_t{1} << handler.first)) != 0) {
+            try {
+              handler.second();
+            } catch (const std::exception& e) {
+              LOG_ERROR << "Handling signal " << handler.first << " failed: " << e.what();
+            }
+          }
+        }
+      }
+
       if (exit_cv_.wait_for(l, std::chrono::seconds(1), [] { return exit_flag_; })) {
         break;
       }
@@ -50,8 +72,24 @@ void SigHandler::start(const std::function<void()>& on_signal) {
 
 void SigHandler::signal(int sig) { ::signal(sig, signal_handler); }
 
+void SigHandler::signal(int sig, const std::function<void()>& handler) {
+  if (sig <= 0 || sig >= 64) {
+    throw std::invalid_argument("Signal number out of range: " + std::to_string(sig));
+  }
+  {
+    std::lock_guard<std::mutex> g(handlers_m_);
+    handlers_[sig] = handler;
+  }
+  handled_mask_ |= uint64_t{1} << sig;
+  ::signal(sig, signal_handler);
+}
+
 void SigHandler::signal_handler(int sig) {
-  (void)sig;
+  const uint64_t bit = (sig > 0 && sig < 64) ? uint64_t{1} << sig : 0;
+  if ((handled_mask_.load() & bit) != 0) {
+    handled_marker_ |= bit;
+    return;
+  }
   unsigned int v = 0;
   // put true if currently set to false
   SigHandler::signal_marker_.compare_exchange_strong(v, 1);
@@ -5,6 +5,7 @@
 #include <condition_variable>
 #include <csignal>
 #include <functional>
+#include <map>
 #include <mutex>
 
 #include <boost/thread.hpp>
@@ -23,6 +24,9 @@ class SigHandler {
   void start(const std::function<void()>& on_signal);
   // add hook on signal `sig`
   static void signal(int sig);
+  // run `handler` on the handling thread whenever `sig` arrives, without
+  // stopping it like the signals hooked with signal(int). `sig` must be below 64.
+  static void signal(int sig, const std::function<void()>& handler);
 
   bool masked();
   void mask(int secs);  // send 0 to unmask
@@ -34,6 +38,11 @@ class SigHandler {
 
   boost::thread polling_thread_;
   static std::atomic_uint signal_marker_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+  // One bit per signal with a handler of its own, and per such signal that arrived
+  static std::atomic<uint64_t> handled_mask_;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+  static std::atomic<uint64_t> handled_marker_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+  static std::mutex handlers_m_;                 // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+  static std::map<int, std::function<void()>> handlers_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
   static std::mutex exit_m_;                // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
   static std::condition_variable exit_cv_;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
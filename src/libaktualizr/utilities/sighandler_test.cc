@@ -57,6 +57,58 @@ TEST(SigHandler, Catch) {
   }
 }
 
+/* A signal with a handler of its own is handled every time it arrives, and doesn't stop the handling. */
+TEST(SigHandler, Repeat) {
+  pid_t child_pid;
+  int pipefd[2];
+
+  ASSERT_EQ(pipe(pipefd), 0);
+  if ((child_pid = fork()) == 0) {
+    // child
+    std::atomic<bool> do_exit{false};
+    std::atomic<int> handled{0};
+
+    close(pipefd[0]);
+
+    SigHandler::get().start([&do_exit]() { do_exit.store(true); });
+    SigHandler::signal(SIGINT);
+    SigHandler::signal(SIGUSR1, [&handled, pipefd]() {
+      ++handled;
+      if (write(pipefd[1], "h", 1) != 1) {
+        exit(1);
+      }
+    });
+
+    if (write(pipefd[1], "r", 1) != 1) {
+      exit(1);
+    }
+
+    while (!do_exit.load()) {
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(20));
+    }
+    exit(handled.load());
+  } else {
+    // parent
+    close(pipefd[1]);
+
+    char b = 0;
+    EXPECT_EQ(read(pipefd[0], &b, 1), 1);
+    EXPECT_EQ(b, 'r');
+
+    for (int i = 0; i < 2; ++i) {
+      kill(child_pid, SIGUSR1);
+      EXPECT_EQ(read(pipefd[0], &b, 1), 1);
+      EXPECT_EQ(b, 'h');
+    }
+    kill(child_pid, SIGINT);
+
+    int status;
+    waitpid(child_pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 2);
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,4 +1,6 @@
 #include <array>
+#include <cstdio>
+#include <ctime>
 #include <sstream>
 #include <stdexcept>
 #include <utility>
@@ -59,13 +61,30 @@ std::ostream &operator<<(std::ostream &os, UpdateType utype) {
   return os;
 }
 
-std::string TimeToString(struct tm time) {
-  std::array<char, 22> formatted{};
-  strftime(formatted.data(), 22, "%Y-%m-%dT%H:%M:%SZ", &time);
-  return std::string(formatted.data());
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar, and
+// back, after http://howardhinnant.github.io/date_algorithms.html
+static int64_t DaysFromCivil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2 ? 1 : 0;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+static void CivilFromDays(int64_t days, int64_t *year, int64_t *month, int64_t *day) {
+  days += 719468;
+  const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64_t day_of_era = days - era * 146097;
+  const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const int64_t month_index = (5 * day_of_year + 2) / 153;
+  *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  *month = month_index + (month_index < 10 ? 3 : -9);
+  *year = year_of_era + era * 400 + (*month <= 2 ? 1 : 0);
 }
 
-TimeStamp TimeStamp::Now() { return TimeStamp(CurrentTime()); }
+TimeStamp TimeStamp::Now() { return TimeStamp(static_cast<int64_t>(time(nullptr))); }
 
 struct tm TimeStamp::CurrentTime() {
   time_t raw_time;
@@ -76,16 +95,59 @@ struct tm TimeStamp::CurrentTime() {
   return time_struct;
 }
 
-TimeStamp::TimeStamp(std::string rfc3339) {
-  if (rfc3339.length() != 20 || rfc3339[19] != 'Z') {
+// Only the form used by Uptane metadata, e.g. "2038-01-19T03:14:07Z"
+TimeStamp::TimeStamp(const std::string &rfc3339) {
+  static const std::string format = "dddd-dd-ddTdd:dd:ddZ";
+  if (rfc3339.length() != format.length()) {
     throw TimeStamp::InvalidTimeStamp();
   }
-  time_ = rfc3339;
+  for (size_t i = 0; i < format.length(); ++i) {
+    if (format[i] == 'd' ? (rfc3339[i] < '0' || rfc3339[i] > '9') : rfc3339[i] != format[i]) {
+      throw TimeStamp::InvalidTimeStamp();
+    }
+  }
+  const auto field = [&rfc3339](size_t pos, size_t len) {
+    int64_t value = 0;
+    for (size_t i = pos; i < pos + len; ++i) {
+      value = value * 10 + (rfc3339[i] - '0');
+    }
+    return value;
+  };
+  const int64_t year = field(0, 4);
+  const int64_t month = field(5, 2);
+  const int64_t day = field(8, 2);
+  const int64_t hour = field(11, 2);
+  const int64_t minute = field(14, 2);
+  const int64_t second = field(17, 2);
+  if (month < 1 || month > 12 || day < 1 || hour > 23 || minute > 59 || second > 59 ||
+      DaysFromCivil(year, month, day) >= DaysFromCivil(month == 12 ? year + 1 : year, month % 12 + 1, 1)) {
+    throw TimeStamp::InvalidTimeStamp();
+  }
+  seconds_ = DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  valid_ = true;
 }
 
-TimeStamp::TimeStamp(struct tm time) : TimeStamp(TimeToString(time)) {}
+TimeStamp::TimeStamp(struct tm time)
+    : TimeStamp(DaysFromCivil(time.tm_year + 1900LL, time.tm_mon + 1LL, time.tm_mday) * 86400 + time.tm_hour * 3600LL +
+                time.tm_min * 60LL + time.tm_sec) {}
 
-bool TimeStamp::IsValid() const { return time_.length() != 0; }
+std::string TimeStamp::ToString() const {
+  if (!valid_) {
+    return std::string();
+  }
+  const int64_t days = (seconds_ >= 0 ? seconds_ : seconds_ - 86399) / 86400;
+  const int64_t second_of_day = seconds_ - days * 86400;
+  int64_t year = 0;
+  int64_t month = 0;
+  int64_t day = 0;
+  CivilFromDays(days, &year, &month, &day);
+  std::array<char, 32> formatted{};
+  snprintf(formatted.data(), formatted.size(), "%04lld-%02lld-%02lldT%02lld:%02lld:%02lldZ",
+           static_cast<long long>(year), static_cast<long long>(month), static_cast<long long>(day),
+           static_cast<long long>(second_of_day / 3600), static_cast<long long>(second_of_day / 60 % 60),
+           static_cast<long long>(second_of_day % 60));
+  return std::string(formatted.data());
+}
 
 bool TimeStamp::IsExpiredAt(const TimeStamp &now) const {
   if (!IsValid()) {
@@ -97,12 +159,12 @@ bool TimeStamp::IsExpiredAt(const TimeStamp &now) const {
   return *this < now;
 }
 
-bool TimeStamp::operator<(const TimeStamp &other) const { return IsValid() && other.IsValid() && time_ < other.time_; }
+bool TimeStamp::operator<(const TimeStamp &other) const { return valid_ && other.valid_ && seconds_ < other.seconds_; }
 
 bool TimeStamp::operator>(const TimeStamp &other) const { return (other < *this); }
 
 std::ostream &operator<<(std::ostream &os, const TimeStamp &t) {
-  os << t.time_;
+  os << t.ToString();
   return os;
 }
 
@@ -19,7 +19,37 @@ TEST(Types, TimeStampParsing) {
 }
 
 /* Throw an exception if an Uptane timestamp is invalid. */
-TEST(Types, TimeStampParsingInvalid) { EXPECT_THROW(TimeStamp("2038-01-19T0"), TimeStamp::InvalidTimeStamp); }
+TEST(Types, TimeStampParsingInvalid) {
+  EXPECT_THROW(TimeStamp("2038-01-19T0"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-19T03:14:06+"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-19 03:14:06Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-13-19T03:14:06Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-02-29T03:14:06Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-19T24:00:00Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-x9T03:14:06Z"), TimeStamp::InvalidTimeStamp);
+}
+
+/* Timestamps are formatted back as they were parsed, and as from a struct tm. */
+TEST(Types, TimeStampFormatting) {
+  for (const std::string time :
+       {"1970-01-01T00:00:00Z", "1969-12-31T23:59:59Z", "2000-02-29T12:30:45Z", "2038-01-19T03:14:08Z",
+        "2100-03-01T00:00:00Z", "9999-12-31T23:59:59Z", "0000-01-01T00:00:00Z"}) {
+    EXPECT_EQ(TimeStamp(time).ToString(), time);
+  }
+  EXPECT_EQ(TimeStamp().ToString(), "");
+
+  struct tm time_struct {};
+  time_struct.tm_year = 2024 - 1900;
+  time_struct.tm_mon = 1;
+  time_struct.tm_mday = 29;
+  time_struct.tm_hour = 23;
+  time_struct.tm_min = 5;
+  time_struct.tm_sec = 9;
+  EXPECT_EQ(TimeStamp(time_struct), TimeStamp("2024-02-29T23:05:09Z"));
+  EXPECT_EQ(TimeStamp(time_struct).ToString(), "2024-02-29T23:05:09Z");
+  EXPECT_FALSE(TimeStamp("2024-02-29T23:05:09Z").IsExpiredAt(TimeStamp("2024-02-29T23:05:09Z")));
+  EXPECT_TRUE(TimeStamp("2024-02-29T23:05:09Z").IsExpiredAt(TimeStamp("2024-02-29T23:05:10Z")));
+}
 
 /* Get current time. */
 TEST(Types, TimeStampNow) {
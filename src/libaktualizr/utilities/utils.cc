@@ -7,6 +7,7 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <sstream>
 #include <stdexcept>
@@ -18,21 +19,27 @@
 #include <fcntl.h>
 #include <glob.h>
 #include <ifaddrs.h>
+#include <linux/fs.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <netinet/in.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/remove_whitespace.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
+#include <boost/archive/iterators/dataflow_exception.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 #include "aktualizr_version.h"
 #include "logging/logging.h"
+#include "utilities/process_runner.h"
 
 static const std::array<const char *, 132> adverbs = {
     "adorable", "acidic",     "ample",        "aromatic",   "artistic", "attractive", "basic",    "beautiful",
@@ -182,28 +189,163 @@ static const std::array<const char *, 128> names = {"Allerlei",
                                                     "Zwetschkenroester",
                                                     "Zwiebelkuchen"};
 
-using base64_text = boost::archive::iterators::base64_from_binary<
-    boost::archive::iterators::transform_width<std::string::const_iterator, 6, 8> >;
+namespace {
+constexpr char kBase64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-using base64_to_bin = boost::archive::iterators::transform_width<
-    boost::archive::iterators::binary_from_base64<
-        boost::archive::iterators::remove_whitespace<std::string::const_iterator> >,
-    8, 6>;
+// Values of the base64 and hex digits for decoding, indexed by character.
+// Everything else has the top bit set, so that whole groups of digits can be
+// checked at once.
+constexpr uint8_t kInvalidDigit = 0x80;
+constexpr uint8_t kBase64Space = 0x81;
+constexpr uint8_t kBase64Padding = 0x82;
 
-std::string Utils::fromBase64(std::string base64_string) {
-  std::ptrdiff_t paddingChars = std::count(base64_string.begin(), base64_string.end(), '=');
-  std::replace(base64_string.begin(), base64_string.end(), '=', 'A');
-  std::string result(base64_to_bin(base64_string.begin()), base64_to_bin(base64_string.end()));
-  result.erase(result.end() - paddingChars, result.end());
+struct DigitValues {
+  constexpr explicit DigitValues(bool hex) : value() {
+    for (auto &v : value) {
+      v = kInvalidDigit;
+    }
+    if (hex) {
+      for (int i = 0; i < 10; ++i) {
+        value['0' + i] = static_cast<uint8_t>(i);
+      }
+      for (int i = 0; i < 6; ++i) {
+        value['a' + i] = static_cast<uint8_t>(10 + i);
+        value['A' + i] = static_cast<uint8_t>(10 + i);
+      }
+    } else {
+      for (int i = 0; i < 64; ++i) {
+        value[static_cast<unsigned char>(kBase64Chars[i])] = static_cast<uint8_t>(i);
+      }
+      for (const char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        value[static_cast<unsigned char>(c)] = kBase64Space;
+      }
+      value['='] = kBase64Padding;
+    }
+  }
+  uint8_t value[256];
+};
+
+constexpr DigitValues kBase64Values(false);
+constexpr DigitValues kHexValues(true);
+
+[[noreturn]] void throwInvalidBase64() {
+  throw boost::archive::iterators::dataflow_exception(
+      boost::archive::iterators::dataflow_exception::invalid_base64_character);
+}
+}  // namespace
+
+std::string Utils::fromBase64(std::string_view base64_string) {
+  const auto *in = reinterpret_cast<const unsigned char *>(base64_string.data());
+  const auto *const end = in + base64_string.size();
+  std::string result;
+  result.reserve(base64_string.size() / 4 * 3 + 2);
+
+  // Whole groups of four digits, as long as there is no whitespace or padding
+  while (end - in >= 4) {
+    const uint8_t a = kBase64Values.value[in[0]];
+    const uint8_t b = kBase64Values.value[in[1]];
+    const uint8_t c = kBase64Values.value[in[2]];
+    const uint8_t d = kBase64Values.value[in[3]];
+    if (((a | b | c | d) & 0x80) != 0) {
+      break;
+    }
+    const uint32_t group = (uint32_t{a} << 18) | (uint32_t{b} << 12) | (uint32_t{c} << 6) | d;
+    result += static_cast<char>(group >> 16);
+    result += static_cast<char>((group >> 8) & 0xFF);
+    result += static_cast<char>(group & 0xFF);
+    in += 4;
+  }
+
+  uint32_t group = 0;
+  int digits = 0;
+  int padding = 0;
+  for (; in != end; ++in) {
+    const uint8_t value = kBase64Values.value[*in];
+    if (value == kBase64Space) {
+      continue;
+    }
+    if (value == kBase64Padding) {
+      ++padding;
+      continue;
+    }
+    if (value == kInvalidDigit || padding != 0) {
+      throwInvalidBase64();
+    }
+    group = (group << 6) | value;
+    if (++digits == 4) {
+      result += static_cast<char>(group >> 16);
+      result += static_cast<char>((group >> 8) & 0xFF);
+      result += static_cast<char>(group & 0xFF);
+      group = 0;
+      digits = 0;
+    }
+  }
+  // The padding is optional, but must complete the last group if present
+  if (digits == 1 || (padding != 0 && (digits == 0 || digits + padding != 4))) {
+    throwInvalidBase64();
+  }
+  if (digits == 2) {
+    result += static_cast<char>(group >> 4);
+  } else if (digits == 3) {
+    result += static_cast<char>(group >> 10);
+    result += static_cast<char>((group >> 2) & 0xFF);
+  }
   return result;
 }
 
-std::string Utils::toBase64(const std::string &tob64) {
-  std::string b64sig(base64_text(tob64.begin()), base64_text(tob64.end()));
-  b64sig.append((3 - tob64.length() % 3) % 3, '=');
+std::string Utils::toBase64(std::string_view tob64) {
+  const auto *in = reinterpret_cast<const unsigned char *>(tob64.data());
+  std::string b64sig((tob64.size() + 2) / 3 * 4, '=');
+  char *out = &b64sig[0];
+  size_t i = 0;
+  for (; i + 3 <= tob64.size(); i += 3, out += 4) {
+    const uint32_t group = (uint32_t{in[i]} << 16) | (uint32_t{in[i + 1]} << 8) | in[i + 2];
+    out[0] = kBase64Chars[group >> 18];
+    out[1] = kBase64Chars[(group >> 12) & 0x3F];
+    out[2] = kBase64Chars[(group >> 6) & 0x3F];
+    out[3] = kBase64Chars[group & 0x3F];
+  }
+  if (i < tob64.size()) {
+    const bool two = i + 1 < tob64.size();
+    const uint32_t group = (uint32_t{in[i]} << 16) | (two ? uint32_t{in[i + 1]} << 8 : 0);
+    out[0] = kBase64Chars[group >> 18];
+    out[1] = kBase64Chars[(group >> 12) & 0x3F];
+    if (two) {
+      out[2] = kBase64Chars[(group >> 6) & 0x3F];
+    }
+  }
   return b64sig;
 }
 
+std::string Utils::toHex(std::string_view data, bool lower_case) {
+  const char *digits = lower_case ? "0123456789abcdef" : "0123456789ABCDEF";
+  std::string hex(2 * data.size(), '\0');
+  char *out = &hex[0];
+  for (const char c : data) {
+    const auto byte = static_cast<unsigned char>(c);
+    *out++ = digits[byte >> 4];
+    *out++ = digits[byte & 0x0F];
+  }
+  return hex;
+}
+
+std::string Utils::fromHex(std::string_view hex) {
+  if (hex.size() % 2 != 0) {
+    throw std::invalid_argument("Odd number of hex digits");
+  }
+  std::string data(hex.size() / 2, '\0');
+  const auto *in = reinterpret_cast<const unsigned char *>(hex.data());
+  for (auto &byte : data) {
+    const uint8_t high = kHexValues.value[*in++];
+    const uint8_t low = kHexValues.value[*in++];
+    if (((high | low) & 0x80) != 0) {
+      throw std::invalid_argument("Invalid hex digit");
+    }
+    byte = static_cast<char>((high << 4) | low);
+  }
+  return data;
+}
+
 // Strip leading and trailing quotes
 std::string Utils::stripQuotes(const std::string &value) {
   std::string res = value;
@@ -242,9 +384,11 @@ std::string Utils::extractField(const std::string &in, unsigned int field_id) {
 }
 
 Json::Value Utils::parseJSON(const std::string &json_str) {
-  std::istringstream strs(json_str);
+  // Parse the string in place: going through a stream would copy large metadata twice
+  static const Json::CharReaderBuilder rbuilder;
+  const std::unique_ptr<Json::CharReader> reader(rbuilder.newCharReader());
   Json::Value json_value;
-  parseFromStream(Json::CharReaderBuilder(), strs, &json_value, nullptr);
+  reader->parse(json_str.data(), json_str.data() + json_str.size(), &json_value, nullptr);
   return json_value;
 }
 
@@ -371,13 +515,46 @@ std::string Utils::jsonToStr(const Json::Value &json) {
   return ss.str();
 }
 
+namespace {
+// Stream buffer appending everything written to it to a string, without an intermediate copy
+class StringAppendBuf : public std::streambuf {
+ public:
+  explicit StringAppendBuf(std::string *out) : out_(out) {}
+
+ protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    out_->append(s, static_cast<size_t>(n));
+    return n;
+  }
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      out_->push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+
+ private:
+  std::string *out_;
+};
+}  // namespace
+
 std::string Utils::jsonToCanonicalStr(const Json::Value &json) {
+  std::string res;
+  jsonToCanonicalStr(json, &res);
+  return res;
+}
+
+void Utils::jsonToCanonicalStr(const Json::Value &json, std::string *out) {
   static Json::StreamWriterBuilder wbuilder = []() {
     Json::StreamWriterBuilder w;
     wbuilder["indentation"] = "";
     return w;
   }();
-  return Json::writeString(wbuilder, json);
+  out->clear();
+  StringAppendBuf buf(out);
+  std::ostream os(&buf);
+  const std::unique_ptr<Json::StreamWriter> writer(wbuilder.newStreamWriter());
+  writer->write(json, &os);
 }
 
 Json::Value Utils::getHardwareInfo() {
@@ -392,16 +569,10 @@ Json::Value Utils::getHardwareInfo() {
   return (parsed.isArray()) ? parsed[0] : parsed;
 }
 
-Json::Value Utils::getNetworkInfo() {
-  // get interface with default route
+std::string Utils::getDefaultRouteInterface() {
   std::ifstream path_stream("/proc/net/route");
   std::string route_content((std::istreambuf_iterator<char>(path_stream)), std::istreambuf_iterator<char>());
 
-  struct Itf {
-    std::string name = std::string();
-    std::string ip = std::string();
-    std::string mac = std::string();
-  } itf;
   std::istringstream route_stream(route_content);
   std::array<char, 200> line{};
 
@@ -411,11 +582,21 @@ Json::Value Utils::getNetworkInfo() {
     std::string itfn = Utils::extractField(&line[0], 0);
     std::string droute = Utils::extractField(&line[0], 1);
     if (droute == "00000000") {
-      itf.name = itfn;
       // take the first routing to 0
-      break;
+      return itfn;
     }
   }
+  return "";
+}
+
+Json::Value Utils::getNetworkInfo() {
+  struct Itf {
+    std::string name = std::string();
+    std::string ip = std::string();
+    std::string mac = std::string();
+  } itf;
+  // get interface with default route
+  itf.name = getDefaultRouteInterface();
 
   if (!itf.name.empty()) {
     {
@@ -470,9 +651,19 @@ std::string Utils::getHostname() {
   return std::string(hostname.data());
 }
 
+void Utils::releaseFreeMemory() {
+#ifdef __GLIBC__
+  // Unlike free(), this also gives back free pages in the middle of the heap and in the arenas of other threads,
+  // which the many small allocations of parsed metadata would otherwise pin
+  if (malloc_trim(0) != 0) {
+    LOG_TRACE << "Returned free heap memory to the system";
+  }
+#endif
+}
+
 std::string Utils::randomUuid() {
-  std::random_device urandom;
-  boost::uuids::basic_random_generator<std::random_device> uuid_gen(urandom);
+  // Constructing a generator opens the entropy source, so each thread keeps one
+  thread_local boost::uuids::random_generator uuid_gen;
   return boost::uuids::to_string(uuid_gen());
 }
 
@@ -493,6 +684,73 @@ void Utils::copyDir(const boost::filesystem::path &from, const boost::filesystem
   }
 }
 
+void Utils::copyFile(const boost::filesystem::path &from, const boost::filesystem::path &to) {
+  boost::filesystem::path tmp_path = to;
+  tmp_path += ".copy";
+
+  const int in_fd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in_fd < 0) {
+    throw std::runtime_error(std::string("Error opening file ") + from.string() + ": " + std::strerror(errno));
+  }
+  const int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (out_fd < 0) {
+    const int err = errno;
+    close(in_fd);
+    throw std::runtime_error(std::string("Error opening file ") + tmp_path.string() + ": " + std::strerror(err));
+  }
+
+  int err = 0;
+  if (ioctl(out_fd, FICLONE, in_fd) != 0) {
+    // No reflinks here: let the kernel copy, which still avoids going through user space
+    bool kernel_copy = true;
+    static constexpr size_t kChunk = 1 << 20;
+    std::array<char, 64 * 1024> buf{};
+    while (err == 0) {
+      if (kernel_copy) {
+        const ssize_t n = copy_file_range(in_fd, nullptr, out_fd, nullptr, kChunk, 0);
+        if (n == 0) {
+          break;
+        }
+        if (n < 0 && errno != EINTR) {
+          if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+            // Not supported between these filesystems; carry on from the current offsets
+            kernel_copy = false;
+          } else {
+            err = errno;
+          }
+        }
+        continue;
+      }
+
+      const ssize_t n = read(in_fd, buf.data(), buf.size());
+      if (n == 0) {
+        break;
+      }
+      if (n < 0) {
+        err = (errno == EINTR) ? 0 : errno;
+        continue;
+      }
+      for (ssize_t written = 0; written < n;) {
+        const ssize_t w = write(out_fd, buf.data() + written, static_cast<size_t>(n - written));
+        if (w < 0 && errno != EINTR) {
+          err = errno;
+          break;
+        }
+        written += std::max<ssize_t>(w, 0);
+      }
+    }
+  }
+  close(in_fd);
+  if (close(out_fd) != 0 && err == 0) {
+    err = errno;
+  }
+  if (err != 0) {
+    boost::filesystem::remove(tmp_path);
+    throw std::runtime_error("Error copying " + from.string() + " to " + to.string() + ": " + std::strerror(err));
+  }
+  boost::filesystem::rename(tmp_path, to);
+}
+
 std::string Utils::readFileFromArchive(std::istream &as, const std::string &filename, const bool trim) {
   StructGuardInt<struct archive> a(archive_read_new(), archive_read_free);
   if (a == nullptr) {
@@ -746,23 +1004,19 @@ int Utils::ipPort(const sockaddr_storage &saddr) {
 }
 
 int Utils::shell(const std::string &command, std::string *output, bool include_stderr) {
-  std::array<char, 128> buffer{};
-  std::string full_command(command);
-  if (include_stderr) {
-    full_command += " 2>&1";
-  }
-  FILE *pipe = popen(full_command.c_str(), "r");
-  if (pipe == nullptr) {
-    *output = "popen() failed!";
-    return -1;
-  }
-  while (feof(pipe) == 0) {
-    if (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-      *output += buffer.data();
-    }
-  }
-  int exitcode = pclose(pipe);
-  return WEXITSTATUS(exitcode);
+  ProcessRunner::Options options;
+  options.include_stderr = include_stderr;
+  options.max_output = std::numeric_limits<size_t>::max();
+  const ProcessRunner::Result result = ProcessRunner::run(command, options);
+  *output += result.output;
+  // Exit codes as a shell would report them
+  if (!result.started) {
+    return 127;
+  }
+  if (result.signal != 0) {
+    return 128 + result.signal;
+  }
+  return result.exit_code;
 }
 
 boost::filesystem::path Utils::absolutePath(const boost::filesystem::path &root, const boost::filesystem::path &file) {
@@ -1012,6 +1266,53 @@ int ConnectionSocket::connect() {
                    sizeof(remote_sock_address_));
 }
 
+NetworkChangeMonitor::NetworkChangeMonitor() {
+  socket_fd_ = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (socket_fd_ < 0) {
+    LOG_DEBUG << "Network change notifications unavailable: " << std::strerror(errno);
+    return;
+  }
+  sockaddr_nl sa{};
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_IFADDR;
+  if (::bind(socket_fd_, reinterpret_cast<const struct sockaddr *>(&sa), sizeof(sa)) < 0) {
+    LOG_DEBUG << "Network change notifications unavailable: " << std::strerror(errno);
+    ::close(socket_fd_);
+    socket_fd_ = -1;
+  }
+}
+
+NetworkChangeMonitor::~NetworkChangeMonitor() {
+  if (socket_fd_ >= 0) {
+    ::close(socket_fd_);
+  }
+}
+
+bool NetworkChangeMonitor::changed() {
+  bool result = first_ || socket_fd_ < 0;
+  first_ = false;
+  if (socket_fd_ < 0) {
+    return result;
+  }
+  // Only the arrival of notifications matters, not their content
+  std::array<char, 4096> buf{};
+  for (;;) {
+    const ssize_t len = ::recv(socket_fd_, buf.data(), buf.size(), MSG_DONTWAIT);
+    if (len > 0) {
+      result = true;
+    } else if (len < 0 && errno == EINTR) {
+      continue;
+    } else {
+      // ENOBUFS means that notifications were dropped
+      if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        result = true;
+      }
+      break;
+    }
+  }
+  return result;
+}
+
 CurlEasyWrapper::CurlEasyWrapper() {
   handle = curl_easy_init();
   if (handle == nullptr) {
@@ -4,6 +4,7 @@
 #include <boost/filesystem/path.hpp>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include <curl/curl.h>
 #include <netinet/in.h>
@@ -11,8 +12,12 @@
 #include "json/json.h"
 
 struct Utils {
-  static std::string fromBase64(std::string base64_string);
-  static std::string toBase64(const std::string &tob64);
+  // Whitespace is skipped, anything else outside of the alphabet throws
+  static std::string fromBase64(std::string_view base64_string);
+  static std::string toBase64(std::string_view tob64);
+  static std::string toHex(std::string_view data, bool lower_case = false);
+  // Throws std::invalid_argument on odd lengths and non-hex digits
+  static std::string fromHex(std::string_view hex);
   static std::string stripQuotes(const std::string &value);
   static std::string addQuotes(const std::string &value);
   static std::string extractField(const std::string &in, unsigned int field_id);
@@ -20,6 +25,8 @@ struct Utils {
   static Json::Value parseJSONFile(const boost::filesystem::path &filename);
   static std::string jsonToStr(const Json::Value &json);
   static std::string jsonToCanonicalStr(const Json::Value &json);
+  // Writes the canonical form into `out`, reusing its capacity
+  static void jsonToCanonicalStr(const Json::Value &json, std::string *out);
   static std::string genPrettyName();
   static std::string readFile(const boost::filesystem::path &filename, bool trim = false);
 
@@ -30,13 +37,28 @@ struct Utils {
                         bool create_directories = true);
   static void writeFile(const boost::filesystem::path &filename, std::istream &&content);
   static void copyDir(const boost::filesystem::path &from, const boost::filesystem::path &to);
+  /**
+   * Replace `to` atomically with a copy of `from`. The copy shares the data
+   * blocks of `from` where the filesystem supports reflinks, and is otherwise
+   * done by the kernel or in fixed-size chunks, so memory use does not depend
+   * on the size of the file.
+   */
+  static void copyFile(const boost::filesystem::path &from, const boost::filesystem::path &to);
   static std::string readFileFromArchive(std::istream &as, const std::string &filename, bool trim = false);
   static void writeArchive(const std::map<std::string, std::string> &entries, std::ostream &as);
   static void removeFileFromArchive(const boost::filesystem::path &archive_path, const std::string &filename);
   static Json::Value getHardwareInfo();
   static Json::Value getNetworkInfo();
+  // Name of the network interface with the default route, empty if there is none
+  static std::string getDefaultRouteInterface();
   static std::string getHostname();
   static std::string randomUuid();
+  /**
+   * Return the free memory of the heap to the system, e.g. once an update
+   * cycle has dropped the metadata it parsed. Does nothing with C libraries
+   * other than glibc.
+   */
+  static void releaseFreeMemory();
   static sockaddr_storage ipGetSockaddr(int fd);
   static std::string ipDisplayName(const sockaddr_storage &saddr);
   static int ipPort(const sockaddr_storage &saddr);
@@ -150,6 +172,26 @@ class ListenSocket : public Socket {
   in_port_t _port;
 };
 
+// Tells whether the network configuration may have changed, from the link,
+// address and route notifications the kernel sends on a netlink socket.
+class NetworkChangeMonitor {
+ public:
+  NetworkChangeMonitor();
+  ~NetworkChangeMonitor();
+  NetworkChangeMonitor(const NetworkChangeMonitor &) = delete;
+  NetworkChangeMonitor(NetworkChangeMonitor &&) = delete;
+  NetworkChangeMonitor &operator=(const NetworkChangeMonitor &) = delete;
+  NetworkChangeMonitor &operator=(NetworkChangeMonitor &&) = delete;
+
+  // True if a notification arrived since the previous call. Also true on the
+  // first call, and always if notifications are unavailable or were lost.
+  bool changed();
+
+ private:
+  int socket_fd_{-1};
+  bool first_{true};
+};
+
 // wrapper for curl handles
 class CurlEasyWrapper {
  public:
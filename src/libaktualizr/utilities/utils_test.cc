@@ -65,6 +65,16 @@ TEST(Utils, jsonToCanonicalStr) {
   EXPECT_EQ(Utils::jsonToCanonicalStr(parsed), "0");
 }
 
+/* Canonical JSON written into a buffer replaces its previous content. */
+TEST(Utils, jsonToCanonicalStrBuffer) {
+  std::string buffer = "previous content that is longer than the result";
+  Utils::jsonToCanonicalStr(Utils::parseJSON(" { \"b\": 0, \"a\": [1, 2, {}], \"0\": \"x\"}"), &buffer);
+  EXPECT_EQ(buffer, "{\"0\":\"x\",\"a\":[1,2,{}],\"b\":0}");
+
+  Utils::jsonToCanonicalStr(Utils::parseJSON("0"), &buffer);
+  EXPECT_EQ(buffer, "0");
+}
+
 /* Read hardware info from the system. */
 TEST(Utils, getHardwareInfo) {
   Json::Value hwinfo = Utils::getHardwareInfo();
@@ -80,6 +90,14 @@ TEST(Utils, getNetworkInfo) {
   EXPECT_NE(netinfo["hostname"].asString(), "");
 }
 
+/* The network counts as changed until the first time it was looked at. */
+TEST(Utils, NetworkChangeMonitor) {
+  NetworkChangeMonitor monitor;
+  EXPECT_TRUE(monitor.changed());
+  // Must not block, whatever the answer is
+  monitor.changed();
+}
+
 /* Read the hostname from the system. */
 TEST(Utils, getHostname) { EXPECT_NE(Utils::getHostname(), ""); }
 
@@ -130,12 +148,18 @@ TEST(Utils, FromBase64) {
   EXPECT_EQ(Utils::fromBase64(""), "");
   EXPECT_EQ(Utils::fromBase64("YWI="), "ab");
   EXPECT_EQ(Utils::fromBase64("YWJj"), "abc");
+  // Unpadded and with whitespace
+  EXPECT_EQ(Utils::fromBase64("YWI"), "ab");
+  EXPECT_EQ(Utils::fromBase64("YW\nJj ZA==\n"), "abcd");
 }
 
 TEST(Utils, FromBase64Wrong) {
   EXPECT_THROW(Utils::fromBase64("Привіт"), boost::archive::iterators::dataflow_exception);
   EXPECT_THROW(Utils::fromBase64("aGVsbG8=="), boost::archive::iterators::dataflow_exception);
   EXPECT_THROW(Utils::fromBase64("CQ==="), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(Utils::fromBase64("Y"), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(Utils::fromBase64("YW=I"), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(Utils::fromBase64("===="), boost::archive::iterators::dataflow_exception);
 }
 
 TEST(Utils, Base64RoundTrip) {
@@ -156,6 +180,16 @@ TEST(Utils, Base64RoundTrip) {
   }
 }
 
+TEST(Utils, Hex) {
+  EXPECT_EQ(Utils::toHex(""), "");
+  EXPECT_EQ(Utils::toHex(std::string("\x00\x7f\x80\xab\xff", 5)), "007F80ABFF");
+  EXPECT_EQ(Utils::toHex("\xab\xcd", true), "abcd");
+  EXPECT_EQ(Utils::fromHex("007F80abFF"), std::string("\x00\x7f\x80\xab\xff", 5));
+  EXPECT_EQ(Utils::fromHex(""), "");
+  EXPECT_THROW(Utils::fromHex("ABC"), std::invalid_argument);
+  EXPECT_THROW(Utils::fromHex("0g"), std::invalid_argument);
+}
+
 /* Extract credentials from a provided archive. */
 TEST(Utils, ArchiveRead) {
   const std::string archive_path = "tests/test_data/credentials.zip";
@@ -283,6 +317,24 @@ TEST(Utils, copyDir) {
   EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to/1/2/baz"), "baz");
 }
 
+TEST(Utils, copyFile) {
+  TemporaryDirectory temp_dir;
+
+  std::string content(3 * 1024 * 1024 + 17, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 31);
+  }
+  Utils::writeFile(temp_dir.Path() / "from", content);
+  Utils::writeFile(temp_dir.Path() / "to", std::string("old"));
+
+  Utils::copyFile(temp_dir.Path() / "from", temp_dir.Path() / "to");
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to"), content);
+  EXPECT_FALSE(boost::filesystem::exists(temp_dir.Path() / "to.copy"));
+
+  EXPECT_THROW(Utils::copyFile(temp_dir.Path() / "missing", temp_dir.Path() / "to"), std::runtime_error);
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to"), content);
+}
+
 TEST(Utils, writeFileWithoutDirAutoCreation) {
   TemporaryDirectory temp_dir;
 
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
+
 #include <curl/curl.h>
 
 #include "authenticate.h"
@@ -8,6 +13,7 @@
 #include "logging/logging.h"
 #include "ostree_http_repo.h"
 #include "ostree_object.h"
+#include "presence_cache.h"
 #include "rate_controller.h"
 #include "request_pool.h"
 #include "treehub_server.h"
@@ -25,9 +31,15 @@ static size_t writeString(void *contents, size_t size, size_t nmemb, void *userp
 
 int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode, int max_curl_requests,
                   const boost::filesystem::path &tree_dir) {
-  // Check if the ref is present on treehub. The traditional use case is that it
-  // should be a commit object, but we allow walking the tree given any OSTree
-  // ref.
+  return CheckRefsValid(treehub, {ref}, mode, max_curl_requests, tree_dir);
+}
+
+int CheckRefsValid(TreehubServer &treehub, const std::vector<std::string> &refs, RunMode mode, int max_curl_requests,
+                   const boost::filesystem::path &tree_dir, const boost::filesystem::path &presence_cache_dir,
+                   TransferStats *stats) {
+  // Check if the refs are present on treehub. The traditional use case is that
+  // they should be commit objects, but we allow walking the tree given any
+  // OSTree ref.
   CurlEasyWrapper curl;
   if (curl.get() == nullptr) {
     LOG_FATAL << "Error initializing curl";
@@ -36,42 +48,53 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
   curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
   curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 1L);  // HEAD
 
-  treehub.InjectIntoCurl("objects/" + ref.substr(0, 2) + "/" + ref.substr(2) + ".commit", curl.get());
+  long http_code;  // NOLINT(google-runtime-int)
+  std::vector<OstreeObjectType> types;
+  for (const auto &ref : refs) {
+    treehub.InjectIntoCurl("objects/" + ref.substr(0, 2) + "/" + ref.substr(2) + ".commit", curl.get());
 
-  CURLcode result = curl_easy_perform(curl.get());
-  if (result != CURLE_OK) {
-    LOG_FATAL << "Error connecting to treehub: " << result << ": " << curl_easy_strerror(result);
-    return EXIT_FAILURE;
-  }
+    CURLcode result = curl_easy_perform(curl.get());
+    if (result != CURLE_OK) {
+      LOG_FATAL << "Error connecting to treehub: " << result << ": " << curl_easy_strerror(result);
+      return EXIT_FAILURE;
+    }
 
-  long http_code;  // NOLINT(google-runtime-int)
-  OstreeObjectType type = OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT;
-  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
-  if (http_code == 404) {
-    if (mode != RunMode::kWalkTree) {
-      LOG_FATAL << "OSTree commit " << ref << " is missing in treehub";
+    OstreeObjectType type = OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT;
+    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 404) {
+      if (mode != RunMode::kWalkTree) {
+        LOG_FATAL << "OSTree commit " << ref << " is missing in treehub";
+        return EXIT_FAILURE;
+      } else {
+        type = OSTREE_OBJECT_TYPE_UNKNOWN;
+      }
+    } else if (http_code != 200) {
+      LOG_FATAL << "Error " << http_code << " getting OSTree ref " << ref << " from treehub";
       return EXIT_FAILURE;
-    } else {
-      type = OSTREE_OBJECT_TYPE_UNKNOWN;
     }
-  } else if (http_code != 200) {
-    LOG_FATAL << "Error " << http_code << " getting OSTree ref " << ref << " from treehub";
-    return EXIT_FAILURE;
-  }
-  if (mode != RunMode::kWalkTree) {
-    LOG_INFO << "OSTree commit " << ref << " is found on treehub";
+    if (mode != RunMode::kWalkTree) {
+      LOG_INFO << "OSTree commit " << ref << " is found on treehub";
+    }
+    types.push_back(type);
   }
 
   if (mode == RunMode::kWalkTree) {
-    // Walk the entire tree and check for all objects.
+    // Walk the entire trees and check for all objects.
     OSTreeHttpRepo dest_repo(&treehub, tree_dir);
-    OSTreeHash hash = OSTreeHash::Parse(ref);
-    OSTreeObject::ptr input_object = dest_repo.GetObject(hash, type);
+    std::unique_ptr<PresenceCache> presence_cache;
+    if (!presence_cache_dir.empty()) {
+      presence_cache = std_::make_unique<PresenceCache>(presence_cache_dir, treehub.root_url());
+    }
 
-    RequestPool request_pool(treehub, max_curl_requests, mode, false);
+    RequestPool request_pool(treehub, max_curl_requests, mode, false, presence_cache.get());
+    request_pool.stats(stats);
 
-    // Add input object to the queue.
-    request_pool.AddQuery(input_object);
+    // Add input objects to the queue.
+    std::vector<OSTreeObject::ptr> input_objects;
+    for (size_t i = 0; i < refs.size(); ++i) {
+      input_objects.push_back(dest_repo.GetObject(OSTreeHash::Parse(refs[i]), types[i]));
+      request_pool.AddQuery(input_objects.back());
+    }
 
     // Main curl event loop.
     // request_pool takes care of holding number of outstanding requests below.
@@ -81,56 +104,73 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
       request_pool.Loop();
     } while (!request_pool.is_idle() && !request_pool.is_stopped());
 
-    if (input_object->is_on_server() == PresenceOnServer::kObjectPresent) {
-      LOG_INFO << "Dry run. No objects uploaded.";
-    } else {
-      LOG_ERROR << "One or more errors while pushing";
+    for (size_t i = 0; i < refs.size(); ++i) {
+      if (input_objects[i]->is_on_server() == PresenceOnServer::kObjectPresent) {
+        LOG_INFO << "Dry run. No objects uploaded for " << refs[i] << ".";
+      } else {
+        LOG_ERROR << "One or more errors while pushing " << refs[i];
+      }
+    }
+    if (presence_cache) {
+      request_pool.FinishWalk();
+      presence_cache->Save();
+    }
+  }
+
+  // If we have commit objects, check if the refs are present in targets.json.
+  if (std::find(types.cbegin(), types.cend(), OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) == types.cend()) {
+    for (const auto &ref : refs) {
+      LOG_INFO << "OSTree ref " << ref << " is not a commit object. Skipping targets.json check.";
     }
+    return EXIT_SUCCESS;
   }
 
-  // If we have a commit object, check if the ref is present in targets.json.
-  if (type == OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) {
-    curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
-    curlEasySetoptWrapper(curl.get(), CURLOPT_HTTPGET, 1L);
-    curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 0L);
-    treehub.InjectIntoCurl("/api/v1/user_repo/targets.json", curl.get(), true);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  curlEasySetoptWrapper(curl.get(), CURLOPT_HTTPGET, 1L);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 0L);
+  treehub.InjectIntoCurl("/api/v1/user_repo/targets.json", curl.get(), true);
 
-    std::string targets_str;
-    curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
-    curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, static_cast<void *>(&targets_str));
-    result = curl_easy_perform(curl.get());
+  std::string targets_str;
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, static_cast<void *>(&targets_str));
+  CURLcode result = curl_easy_perform(curl.get());
 
-    if (result != CURLE_OK) {
-      LOG_FATAL << "Error connecting to TUF repo: " << result << ": " << curl_easy_strerror(result);
-      return EXIT_FAILURE;
-    }
+  if (result != CURLE_OK) {
+    LOG_FATAL << "Error connecting to TUF repo: " << result << ": " << curl_easy_strerror(result);
+    return EXIT_FAILURE;
+  }
 
-    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code != 200) {
-      LOG_FATAL << "Error " << http_code << " getting targets.json from TUF repo: " << targets_str;
-      return EXIT_FAILURE;
-    }
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code != 200) {
+    LOG_FATAL << "Error " << http_code << " getting targets.json from TUF repo: " << targets_str;
+    return EXIT_FAILURE;
+  }
 
-    Json::Value targets_json = Utils::parseJSON(targets_str);
-    std::string expiry_time_str = targets_json["signed"]["expires"].asString();
-    TimeStamp timestamp(expiry_time_str);
+  Json::Value targets_json = Utils::parseJSON(targets_str);
+  std::string expiry_time_str = targets_json["signed"]["expires"].asString();
+  TimeStamp timestamp(expiry_time_str);
 
-    if (timestamp.IsExpiredAt(TimeStamp::Now())) {
-      LOG_FATAL << "targets.json has been expired.";
-      return EXIT_FAILURE;
-    }
+  if (timestamp.IsExpiredAt(TimeStamp::Now())) {
+    LOG_FATAL << "targets.json has been expired.";
+    return EXIT_FAILURE;
+  }
 
-    Json::Value target_list = targets_json["signed"]["targets"];
-    for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
-      if ((*t_it)["hashes"]["sha256"].asString() == ref) {
-        LOG_INFO << "OSTree commit " << ref << " is found in targets.json";
-        return EXIT_SUCCESS;
-      }
+  std::set<std::string> target_hashes;
+  const Json::Value &target_list = targets_json["signed"]["targets"];
+  for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
+    target_hashes.insert((*t_it)["hashes"]["sha256"].asString());
+  }
+
+  int ret = EXIT_SUCCESS;
+  for (size_t i = 0; i < refs.size(); ++i) {
+    if (types[i] != OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) {
+      LOG_INFO << "OSTree ref " << refs[i] << " is not a commit object. Skipping targets.json check.";
+    } else if (target_hashes.count(refs[i]) != 0) {
+      LOG_INFO << "OSTree commit " << refs[i] << " is found in targets.json";
+    } else {
+      LOG_FATAL << "OSTree ref " << refs[i] << " was not found in targets.json";
+      ret = EXIT_FAILURE;
     }
-    LOG_FATAL << "OSTree ref " << ref << " was not found in targets.json";
-    return EXIT_FAILURE;
-  } else {
-    LOG_INFO << "OSTree ref " << ref << " is not a commit object. Skipping targets.json check.";
-    return EXIT_SUCCESS;
   }
+  return ret;
 }
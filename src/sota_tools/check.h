@@ -2,11 +2,13 @@
 #define SOTA_CLIENT_TOOLS_CHECK_H_
 
 #include <string>
+#include <vector>
 
 #include "garage_common.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
 #include "server_credentials.h"
+#include "transfer_stats.h"
 
 /**
  * Check if the ref is present on the server and in targets.json
@@ -14,4 +16,15 @@
 int CheckRefValid(TreehubServer& treehub, const std::string& ref, RunMode mode, int max_curl_requests,
                   const boost::filesystem::path& tree_dir = "");
 
+/**
+ * Check several refs at once. With RunMode::kWalkTree, their trees are walked
+ * concurrently through a single RequestPool, so objects shared between them
+ * are only checked once, and objects recorded in presence_cache_dir (see
+ * PresenceCache) are not checked again at all. The requests of the walk are
+ * added to stats, if not null.
+ */
+int CheckRefsValid(TreehubServer& treehub, const std::vector<std::string>& refs, RunMode mode, int max_curl_requests,
+                   const boost::filesystem::path& tree_dir = "", const boost::filesystem::path& presence_cache_dir = "",
+                   TransferStats* stats = nullptr);
+
 #endif
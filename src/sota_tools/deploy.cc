@@ -1,13 +1,17 @@
 #include "deploy.h"
 
+#include <memory>
+
 #include <boost/filesystem.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "authenticate.h"
 #include "logging/logging.h"
 #include "ostree_object.h"
+#include "presence_cache.h"
 #include "rate_controller.h"
 #include "request_pool.h"
+#include "server_copy.h"
 #include "treehub_server.h"
 #include "utilities/utils.h"
 
@@ -24,7 +28,9 @@ bool CheckPoolState(const OSTreeObject::ptr &root_object, const RequestPool &req
 }
 
 bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server, const OSTreeHash &ostree_commit,
-                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload) {
+                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload,
+                     const boost::filesystem::path &presence_cache_dir, const std::string &copy_from,
+                     TransferStats *stats) {
   assert(max_curl_requests > 0);
 
   OSTreeObject::ptr root_object;
@@ -35,7 +41,26 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     return false;
   }
 
-  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload);
+  std::unique_ptr<PresenceCache> presence_cache;
+  if (!presence_cache_dir.empty()) {
+    if (mode == RunMode::kWalkTree || mode == RunMode::kPushTree) {
+      // Walking the tree is meant to find objects missing on the server, so
+      // it always asks the server itself.
+      LOG_INFO << "Not using the presence cache while walking the tree";
+    } else {
+      presence_cache = std_::make_unique<PresenceCache>(presence_cache_dir, push_server.root_url());
+    }
+  }
+
+  std::unique_ptr<ServerCopy> server_copy;
+  if (!copy_from.empty() && (mode == RunMode::kDefault || mode == RunMode::kPushTree)) {
+    server_copy = std_::make_unique<ServerCopy>(push_server, copy_from);
+    src_repo->defer_file_objects(true);
+  }
+
+  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload, presence_cache.get(),
+                           server_copy.get());
+  request_pool.stats(stats);
 
   // Add commit object to the queue.
   request_pool.AddQuery(root_object);
@@ -48,6 +73,16 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     request_pool.Loop();
   } while (CheckPoolState(root_object, request_pool));
 
+  if (presence_cache) {
+    LOG_INFO << request_pool.cached_presence_hits() << " objects were known to be present from the presence cache.";
+    presence_cache->Save();
+  }
+  if (server_copy) {
+    src_repo->defer_file_objects(false);
+    LOG_INFO << server_copy->objects_copied() << " objects were copied by the server in "
+             << server_copy->requests_made() << " requests.";
+  }
+
   if (root_object->is_on_server() == PresenceOnServer::kObjectPresent) {
     if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
       LOG_INFO << "Upload to Treehub complete after " << request_pool.head_requests_made() << " HEAD requests and "
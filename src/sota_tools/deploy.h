@@ -3,10 +3,13 @@
 
 #include <string>
 
+#include <boost/filesystem/path.hpp>
+
 #include "garage_common.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
 #include "server_credentials.h"
+#include "transfer_stats.h"
 
 /*
  * Check current state of the request pool depending on the run mode.
@@ -26,9 +29,21 @@ bool CheckPoolState(const OSTreeObject::ptr& root_object, const RequestPool& req
  * \param mode
  * \param max_curl_requests
  * \param fsck_on_upload Validate objects on disk before uploading them
+ * \param presence_cache_dir Directory of PresenceCache files. Objects known
+ *                           to be on push_server are not queried, and the
+ *                           objects confirmed or uploaded by this push are
+ *                           added. Empty to always query.
+ * \param copy_from URL of src_repo on a Treehub that shares its backend with
+ *                  push_server. Objects missing on push_server are then
+ *                  copied by the server in batches (see ServerCopy), and only
+ *                  the ones it can't copy are fetched and uploaded. Empty to
+ *                  always upload.
+ * \param stats Statistics to add the transfers to, none if null.
  */
 bool UploadToTreehub(const OSTreeRepo::ptr& src_repo, TreehubServer& push_server, const OSTreeHash& ostree_commit,
-                     RunMode mode, int max_curl_requests, bool fsck_on_upload);
+                     RunMode mode, int max_curl_requests, bool fsck_on_upload,
+                     const boost::filesystem::path& presence_cache_dir = "", const std::string& copy_from = "",
+                     TransferStats* stats = nullptr);
 
 /**
  * Use the garage-sign tool and the Image repo targets.json keys in credentials.zip
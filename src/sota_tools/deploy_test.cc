@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <array>
+#include <vector>
+
 #include <boost/process.hpp>
 
 #include "authenticate.h"
@@ -9,6 +12,7 @@
 #include "ostree_dir_repo.h"
 #include "ostree_http_repo.h"
 #include "ostree_ref.h"
+#include "presence_cache.h"
 #include "test_utils.h"
 
 std::string port = "2443";
@@ -43,6 +47,107 @@ TEST(deploy, UploadToTreehub) {
   EXPECT_EQ(result, 0) << "Diff between the source repo refs and the destination repos refs is nonzero.";
 }
 
+/* Objects confirmed on the server are remembered by the presence cache of
+ * that server only. */
+TEST(deploy, PresenceCache) {
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>("tests/sota_tools/repo");
+  auto server_creds = ServerCredentials(temp_dir.Path() / "auth.json");
+  TreehubServer push_server;
+  EXPECT_EQ(authenticate("tests/fake_http_server/server.crt", server_creds, push_server), EXIT_SUCCESS);
+  const OSTreeHash commit = src_repo->GetRef("master").GetHash();
+
+  TemporaryDirectory cache_dir;
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, commit, RunMode::kDefault, 2, true, cache_dir.Path()));
+  {
+    PresenceCache cache(cache_dir.Path(), push_server.root_url());
+    EXPECT_TRUE(cache.Contains(commit, OSTREE_OBJECT_TYPE_COMMIT));
+    EXPECT_FALSE(cache.Contains(commit, OSTREE_OBJECT_TYPE_DIR_TREE));
+  }
+
+  // The commit is answered from the cache this time.
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, commit, RunMode::kDefault, 2, true, cache_dir.Path()));
+
+  PresenceCache other_server(cache_dir.Path(), "https://example.com/");
+  EXPECT_FALSE(other_server.Contains(commit, OSTREE_OBJECT_TYPE_COMMIT));
+  EXPECT_EQ(other_server.size(), 0U);
+}
+
+/* Objects missing on the destination are copied by the server when asked to,
+ * and only those it can't copy are fetched and uploaded. */
+TEST(deploy, ServerCopy) {
+  // The server can copy every other file object only.
+  TemporaryDirectory copy_dir;
+  ASSERT_EQ(system(("cp -r tests/sota_tools/bigger_repo/objects " + copy_dir.PathString()).c_str()), 0);
+  int filez = 0;
+  std::vector<boost::filesystem::path> uncopyable;
+  for (const auto &entry : boost::filesystem::recursive_directory_iterator(copy_dir.Path())) {
+    if (entry.path().extension() == ".filez" && (filez++ % 2) == 0) {
+      uncopyable.push_back(entry.path());
+    }
+  }
+  for (const auto &path : uncopyable) {
+    boost::filesystem::remove(path);
+  }
+
+  const std::string src_port = TestUtils::getFreePort();
+  boost::process::child src_process("tests/sota_tools/treehub_server.py", std::string("-p"), src_port,
+                                    std::string("-d"), std::string("tests/sota_tools/bigger_repo"));
+  TestUtils::waitForServer("http://localhost:" + src_port + "/");
+  TemporaryDirectory dst_dir;
+  const std::string dst_port = TestUtils::getFreePort();
+  boost::process::child dst_process("tests/sota_tools/treehub_server.py", std::string("-p"), dst_port,
+                                    std::string("-d"), dst_dir.PathString(), std::string("--copy-from"),
+                                    copy_dir.PathString());
+  TestUtils::waitForServer("http://localhost:" + dst_port + "/");
+
+  TreehubServer fetch_server;
+  fetch_server.root_url("http://localhost:" + src_port);
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + dst_port);
+  const OSTreeHash commit = src_repo->GetRef("master").GetHash();
+
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, commit, RunMode::kDefault, 4, false, "", fetch_server.root_url()));
+  int result = system(
+      (std::string("diff -r ") + (dst_dir.Path() / "objects/").string() + " tests/sota_tools/bigger_repo/objects/")
+          .c_str());
+  EXPECT_EQ(result, 0) << "Diff between the source repo objects and the destination repo objects is nonzero.";
+}
+
+/* Records added to a mapped cache file are merged in sorted order. */
+TEST(deploy, PresenceCacheMerge) {
+  TemporaryDirectory cache_dir;
+  std::vector<OSTreeHash> hashes;
+  for (uint8_t i = 0; i < 6; ++i) {
+    std::array<uint8_t, 32> bytes{};
+    bytes[0] = static_cast<uint8_t>(50 - 7 * i);
+    bytes[31] = i;
+    hashes.emplace_back(bytes);
+  }
+  {
+    PresenceCache cache(cache_dir.Path(), "https://treehub/");
+    for (size_t i = 0; i < hashes.size(); i += 2) {
+      cache.Add(hashes[i], OSTREE_OBJECT_TYPE_DIR_TREE);
+    }
+    cache.Save();
+  }
+  {
+    PresenceCache cache(cache_dir.Path(), "https://treehub/");
+    EXPECT_EQ(cache.size(), 3U);
+    for (size_t i = 1; i < hashes.size(); i += 2) {
+      cache.Add(hashes[i], OSTREE_OBJECT_TYPE_DIR_TREE);
+    }
+    cache.Add(hashes[0], OSTREE_OBJECT_TYPE_DIR_TREE);
+    cache.Save();
+  }
+  PresenceCache cache(cache_dir.Path(), "https://treehub/");
+  EXPECT_EQ(cache.size(), hashes.size());
+  for (const auto &hash : hashes) {
+    EXPECT_TRUE(cache.Contains(hash, OSTREE_OBJECT_TYPE_DIR_TREE));
+    EXPECT_FALSE(cache.Contains(hash, OSTREE_OBJECT_TYPE_DIR_META));
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,55 @@
+#include "fsck_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+FsckPool::FsckPool(unsigned int threads) {
+  if (threads == 0) {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  workers_.reserve(threads);
+  for (unsigned int i = 0; i < threads; ++i) {
+    workers_.emplace_back(&FsckPool::Run, this);
+  }
+}
+
+FsckPool::~FsckPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+    jobs_.clear();
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+std::future<bool> FsckPool::Submit(std::function<bool()> job) {
+  std::packaged_task<bool()> task(std::move(job));
+  auto result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void FsckPool::Run() {
+  for (;;) {
+    std::packaged_task<bool()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return shutdown_ || !jobs_.empty(); });
+      if (shutdown_) {
+        return;
+      }
+      task = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    task();
+  }
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,44 @@
+#ifndef SOTA_CLIENT_TOOLS_FSCK_POOL_H_
+#define SOTA_CLIENT_TOOLS_FSCK_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker threads that verify local objects ahead of the upload queue.
+ * Checksumming is CPU bound and would otherwise stall the single thread that
+ * drives all curl transfers. Reading the object also leaves it in the page
+ * cache, so the upload itself is then limited by the network only.
+ */
+class FsckPool {
+ public:
+  /* \param threads Number of workers, 0 for one per core. */
+  explicit FsckPool(unsigned int threads = 0);
+  /* Pending jobs are dropped, running ones are finished. */
+  ~FsckPool();
+  FsckPool(const FsckPool&) = delete;
+  FsckPool(FsckPool&&) = delete;
+  FsckPool& operator=(const FsckPool&) = delete;
+  FsckPool& operator=(FsckPool&&) = delete;
+
+  /* Queue a check. Jobs must not refer to data that may be freed before they
+   * run. */
+  std::future<bool> Submit(std::function<bool()> job);
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::packaged_task<bool()>> jobs_;
+  bool shutdown_{false};
+  std::vector<std::thread> workers_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_FSCK_POOL_H_
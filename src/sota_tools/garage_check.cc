@@ -1,4 +1,5 @@
 #include <string>
+#include <vector>
 
 #include <curl/curl.h>
 #include <boost/filesystem.hpp>
@@ -13,6 +14,7 @@
 #include "ostree_http_repo.h"
 #include "ostree_object.h"
 #include "request_pool.h"
+#include "transfer_stats.h"
 #include "treehub_server.h"
 #include "utilities/utils.h"
 
@@ -21,12 +23,14 @@ namespace po = boost::program_options;
 int main(int argc, char **argv) {
   logger_init();
 
-  std::string ref;
+  std::vector<std::string> refs;
   boost::filesystem::path credentials_path;
   std::string cacerts;
   int max_curl_requests;
   RunMode mode = RunMode::kDefault;
   boost::filesystem::path tree_dir;
+  boost::filesystem::path presence_cache_dir;
+  boost::filesystem::path stats_file;
   po::options_description desc("garage-check command line options");
   // clang-format off
   desc.add_options()
@@ -35,12 +39,14 @@ int main(int argc, char **argv) {
     ("verbose,v", "Verbose logging (loglevel 1)")
     ("quiet,q", "Quiet mode (loglevel 3)")
     ("loglevel", po::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
-    ("ref,r", po::value<std::string>(&ref)->required(), "refhash to check")
+    ("ref,r", po::value<std::vector<std::string>>(&refs)->required()->multitoken(), "refhash to check (may be given several times)")
     ("credentials,j", po::value<boost::filesystem::path>(&credentials_path)->required(), "credentials (json or zip containing json)")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests (only relevant with --walk-tree)")
     ("walk-tree,w", "walk entire tree and check presence of all objects")
-    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)");
+    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)")
+    ("presence-cache", po::value<boost::filesystem::path>(&presence_cache_dir), "directory remembering which objects each server already has; they are not checked again (only used with --walk-tree)")
+    ("stats-file", po::value<boost::filesystem::path>(&stats_file), "write statistics of the transfers to this file as JSON (only used with --walk-tree)");
   // clang-format on
 
   po::variables_map vm;
@@ -95,7 +101,12 @@ int main(int argc, char **argv) {
       return EXIT_FAILURE;
     }
 
-    if (CheckRefValid(treehub, ref, mode, max_curl_requests, tree_dir) != EXIT_SUCCESS) {
+    TransferStats stats;
+    const int checked = CheckRefsValid(treehub, refs, mode, max_curl_requests, tree_dir, presence_cache_dir, &stats);
+    if (!stats_file.empty()) {
+      stats.Save(stats_file);
+    }
+    if (checked != EXIT_SUCCESS) {
       LOG_FATAL << "Check if the ref is present on the server or in targets.json failed";
       return EXIT_FAILURE;
     }
@@ -11,6 +11,7 @@
 #include "garage_tools_version.h"
 #include "logging/logging.h"
 #include "ostree_http_repo.h"
+#include "transfer_stats.h"
 
 namespace po = boost::program_options;
 
@@ -26,6 +27,8 @@ int main(int argc, char **argv) {
   std::string hardwareids;
   std::string cacerts;
   int max_curl_requests;
+  boost::filesystem::path presence_cache_dir;
+  boost::filesystem::path stats_file;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-deploy command line options");
   // clang-format off
@@ -42,8 +45,11 @@ int main(int argc, char **argv) {
     ("hardwareids,h", po::value<std::string>(&hardwareids)->required(), "list of hardware ids")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
+    ("presence-cache", po::value<boost::filesystem::path>(&presence_cache_dir), "directory remembering which objects each server already has; they are not queried again")
+    ("stats-file", po::value<boost::filesystem::path>(&stats_file), "write statistics of the transfers to this file as JSON")
     ("dry-run,n", "check arguments and authenticate but don't upload")
-    ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
+    ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them")
+    ("server-copy", "ask the destination server to copy objects from the source repository (proposed Treehub API); objects it can't copy are transferred as usual");
   // clang-format on
 
   po::variables_map vm;
@@ -110,14 +116,28 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
-  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  auto http_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  http_repo->max_concurrent_fetches(max_curl_requests);
+  OSTreeRepo::ptr src_repo = http_repo;
+  // A server that shares its backend with the source can copy objects from
+  // it, rather than have them go through here.
+  std::string copy_from;
+  if (vm.count("server-copy") != 0) {
+    LOG_INFO << "Asking the destination server to copy the objects from the source repository";
+    copy_from = fetch_server.root_url();
+  }
   try {
     OSTreeHash commit(OSTreeHash::Parse(ostree_commit));
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    // Since the fetches happen on a single thread in OSTreeHttpRepo, there
-    // isn't much reason to upload in parallel, but why hold the system back if
-    // the fetching is faster than the uploading?
-    if (!UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck)) {
+    // The children of each object are fetched in parallel (up to --jobs at a
+    // time) as soon as it is parsed, and uploaded in parallel as well.
+    TransferStats stats;
+    const bool uploaded = UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck,
+                                          presence_cache_dir, copy_from, &stats);
+    if (!stats_file.empty()) {
+      stats.Save(stats_file);
+    }
+    if (!uploaded) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
@@ -10,6 +10,7 @@
 #include "logging/logging.h"
 #include "ostree_dir_repo.h"
 #include "ostree_repo.h"
+#include "transfer_stats.h"
 #include "utilities/xml2json.h"
 
 namespace po = boost::program_options;
@@ -23,6 +24,8 @@ int main(int argc, char **argv) {
   std::string cacerts;
   boost::filesystem::path manifest_path;
   int max_curl_requests;
+  boost::filesystem::path presence_cache_dir;
+  boost::filesystem::path stats_file;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-push command line options");
   // clang-format off
@@ -38,8 +41,10 @@ int main(int argc, char **argv) {
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("repo-manifest", po::value<boost::filesystem::path>(&manifest_path), "manifest describing repository branches used in the image, to be sent as attached metadata")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
+    ("presence-cache", po::value<boost::filesystem::path>(&presence_cache_dir), "directory remembering which objects each server already has; they are not queried again")
     ("dry-run,n", "check arguments and authenticate but don't upload")
     ("walk-tree,w", "walk entire tree and upload all missing objects")
+    ("stats-file", po::value<boost::filesystem::path>(&stats_file), "write statistics of the transfers to this file as JSON")
     ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
   // clang-format on
 
@@ -137,7 +142,13 @@ int main(int argc, char **argv) {
       return EXIT_FAILURE;
     }
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    if (!UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck)) {
+    TransferStats stats;
+    const bool uploaded =
+        UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck, presence_cache_dir, "", &stats);
+    if (!stats_file.empty()) {
+      stats.Save(stats_file);
+    }
+    if (!uploaded) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
@@ -1,6 +1,8 @@
 #include "ostree_http_repo.h"
 
 #include <fcntl.h>
+#include <deque>
+#include <list>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -34,6 +36,11 @@ bool OSTreeHttpRepo::LooksValid() const {
 OSTreeRef OSTreeHttpRepo::GetRef(const std::string &refname) const { return OSTreeRef(*server_, refname); }
 
 bool OSTreeHttpRepo::FetchObject(const boost::filesystem::path &path) const {
+  if (boost::filesystem::exists(root_ / path)) {
+    // Already fetched, e.g. by Prefetch()
+    return true;
+  }
+
   CURLcode err = CURLE_OK;
   server_->InjectIntoCurl(path.string(), easy_handle_.get());
   boost::filesystem::create_directories((root_ / path).parent_path());
@@ -67,6 +74,96 @@ bool OSTreeHttpRepo::FetchObject(const boost::filesystem::path &path) const {
   return true;
 }
 
+namespace {
+struct Fetch {
+  CurlEasyWrapper curl;
+  int fd{-1};
+  boost::filesystem::path file;
+};
+}  // namespace
+
+void OSTreeHttpRepo::Prefetch(const std::vector<boost::filesystem::path> &paths) const {
+  if (max_concurrent_fetches_ < 2 || paths.size() < 2) {
+    // FetchObject() is just as fast
+    return;
+  }
+
+  std::deque<boost::filesystem::path> pending(paths.cbegin(), paths.cend());
+  std::list<Fetch> active;
+  size_t fetched = 0;
+  auto finish = [this, &active](Fetch *fetch, const bool ok) {
+    close(fetch->fd);
+    if (!ok) {
+      // FetchObject() will try again and report the error
+      remove(fetch->file.c_str());
+    }
+    curl_multi_remove_handle(multi_, fetch->curl.get());
+    active.remove_if([fetch](const Fetch &f) { return &f == fetch; });
+  };
+
+  while (!pending.empty() || !active.empty()) {
+    while (!pending.empty() && active.size() < static_cast<size_t>(max_concurrent_fetches_)) {
+      const boost::filesystem::path path = pending.front();
+      pending.pop_front();
+      const boost::filesystem::path file = root_ / path;
+      if (boost::filesystem::exists(file)) {
+        continue;
+      }
+      boost::filesystem::create_directories(file.parent_path());
+      const int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+      if (fd == -1) {
+        continue;
+      }
+      active.emplace_back();
+      Fetch &fetch = active.back();
+      fetch.fd = fd;
+      fetch.file = file;
+      CURL *handle = fetch.curl.get();
+      curlEasySetoptWrapper(handle, CURLOPT_VERBOSE, get_curlopt_verbose());
+      curlEasySetoptWrapper(handle, CURLOPT_WRITEFUNCTION, &OSTreeHttpRepo::curl_handle_write);
+      curlEasySetoptWrapper(handle, CURLOPT_WRITEDATA, &fetch.fd);
+      curlEasySetoptWrapper(handle, CURLOPT_FAILONERROR, true);
+      curlEasySetoptWrapper(handle, CURLOPT_PRIVATE, &fetch);
+      server_->InjectIntoCurl(path.string(), handle);
+      if (curl_multi_add_handle(multi_, handle) != CURLM_OK) {
+        finish(&fetch, false);
+      }
+    }
+
+    int running = 0;
+    if (curl_multi_perform(multi_, &running) != CURLM_OK) {
+      break;
+    }
+    int msgs_in_queue = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi_, &msgs_in_queue)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      char *fetch = nullptr;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &fetch);
+      const bool ok = msg->data.result == CURLE_OK;
+      fetched += ok ? 1 : 0;
+      finish(reinterpret_cast<Fetch *>(fetch), ok);
+    }
+    if (running > 0 && curl_multi_wait(multi_, nullptr, 0, 1000, nullptr) != CURLM_OK) {
+      break;
+    }
+  }
+
+  while (!active.empty()) {
+    finish(&active.front(), false);
+  }
+  LOG_DEBUG << "Prefetched " << fetched << " of " << paths.size() << " objects";
+}
+
+void OSTreeHttpRepo::ReleaseObject(const boost::filesystem::path &path) const {
+  if (!scratch_root_) {
+    return;
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove(root_ / path, ec);
+}
+
 size_t OSTreeHttpRepo::curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
   return static_cast<size_t>(write(*static_cast<int *>(userp), buffer, nmemb * size));
 }
@@ -12,27 +12,43 @@
 class OSTreeHttpRepo : public OSTreeRepo {
  public:
   explicit OSTreeHttpRepo(TreehubServer* server, boost::filesystem::path root_in = "")
-      : server_(server), root_(std::move(root_in)) {
-    if (root_.empty()) {
+      : server_(server), root_(std::move(root_in)), scratch_root_(root_.empty()) {
+    if (scratch_root_) {
       root_ = root_tmp_.Path();
     }
     curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
     curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_WRITEFUNCTION, &OSTreeHttpRepo::curl_handle_write);
     curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_FAILONERROR, true);
+    multi_ = curl_multi_init();
   }
+  ~OSTreeHttpRepo() override { curl_multi_cleanup(multi_); }
+  OSTreeHttpRepo(const OSTreeHttpRepo&) = delete;
+  OSTreeHttpRepo(OSTreeHttpRepo&&) = delete;
+  OSTreeHttpRepo& operator=(const OSTreeHttpRepo&) = delete;
+  OSTreeHttpRepo& operator=(OSTreeHttpRepo&&) = delete;
 
   bool LooksValid() const override;
   OSTreeRef GetRef(const std::string& refname) const override;
   boost::filesystem::path root() const override { return root_; }
+  void ReleaseObject(const boost::filesystem::path& path) const override;
+  /* Upper bound of parallel requests when prefetching the children of an
+   * object. */
+  void max_concurrent_fetches(int fetches) { max_concurrent_fetches_ = fetches; }
 
  private:
   bool FetchObject(const boost::filesystem::path& path) const override;
+  void Prefetch(const std::vector<boost::filesystem::path>& paths) const override;
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
 
   TreehubServer* server_;
   boost::filesystem::path root_;
+  // Objects are only dropped from a temporary directory, not from a
+  // directory the caller wants the tree written to.
+  bool scratch_root_;
   const TemporaryDirectory root_tmp_;
   mutable CurlEasyWrapper easy_handle_;
+  CURLM* multi_;
+  int max_concurrent_fetches_{8};
 };
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -99,13 +99,16 @@ TEST(http_repo, bad_connection) {
 
   std::string diff("diff -r ");
   std::string src_path((src_dir.Path() / "objects").string() + " ");
-  std::string repo_path((src_repo->root() / "objects").string() + " ");
   std::string dst_path((dst_dir.Path() / "objects").string() + " ");
 
-  int result = system((diff + src_path + repo_path).c_str());
-  result |= system((diff + repo_path + dst_path).c_str());
+  int result = system((diff + src_path + dst_path).c_str());
 
   EXPECT_EQ(result, 0) << "Diff between source and destination repos is nonzero.";
+
+  // Objects are dropped from the scratch directory once they have been pushed.
+  for (const auto &entry : boost::filesystem::recursive_directory_iterator(src_repo->root() / "objects")) {
+    EXPECT_FALSE(boost::filesystem::is_regular_file(entry.path())) << entry.path();
+  }
 }
 
 TEST(http_repo, root) {
@@ -4,6 +4,7 @@
 #include <ostree.h>
 #include <sys/stat.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -15,16 +16,18 @@
 
 using std::string;
 
-OSTreeObject::OSTreeObject(const OSTreeRepo &repo, OSTreeHash hash, OstreeObjectType object_type)
+OSTreeObject::OSTreeObject(const OSTreeRepo &repo, OSTreeHash hash, OstreeObjectType object_type,
+                           const bool deferred)
     : hash_(hash),
       type_(object_type),
       repo_(repo),
       refcount_(0),
       is_on_server_(PresenceOnServer::kObjectStateUnknown),
+      deferred_(deferred),
       curl_handle_(nullptr),
       fd_(nullptr) {
   auto file_path = PathOnDisk();
-  if (!boost::filesystem::is_regular_file(file_path)) {
+  if (!deferred_ && !boost::filesystem::is_regular_file(file_path)) {
     throw std::runtime_error(file_path.native() + " is not a valid OSTree object.");
   }
 }
@@ -36,30 +39,33 @@ OSTreeObject::~OSTreeObject() {
   }
 }
 
-void OSTreeObject::AddParent(OSTreeObject *parent, std::list<OSTreeObject::ptr>::iterator parent_it) {
-  parentref par;
+void OSTreeObject::AddParent(OSTreeObject *parent) { parents_.push_back(parent); }
 
-  par.first = parent;
-  par.second = parent_it;
-  parents_.push_back(par);
-}
-
-void OSTreeObject::ChildNotify(std::list<OSTreeObject::ptr>::iterator child_it) {
-  assert((*child_it)->is_on_server() == PresenceOnServer::kObjectPresent);
-  children_.erase(child_it);
+void OSTreeObject::ChildNotify() {
+  assert(pending_children_ > 0);
+  if (--pending_children_ == 0) {
+    std::vector<OSTreeObject::ptr>().swap(children_);
+  }
 }
 
 void OSTreeObject::NotifyParents(RequestPool &pool) {
   assert(is_on_server_ == PresenceOnServer::kObjectPresent);
 
-  for (parentref parent : parents_) {
-    parent.first->ChildNotify(parent.second);
-    if (parent.first->children_ready()) {
-      pool.AddUpload(parent.first);
+  // Parents added from now on see this object as present and don't wait for
+  // it, so the list is not needed any more.
+  std::vector<OSTreeObject *> parents;
+  parents.swap(parents_);
+  for (OSTreeObject *parent : parents) {
+    parent->ChildNotify();
+    if (parent->children_ready()) {
+      pool.AddUpload(parent);
     }
   }
+  ReleaseLocalCopy();
 }
 
+void OSTreeObject::ReleaseLocalCopy() const { repo_.ReleaseObject(Url()); }
+
 void OSTreeObject::AppendChild(const OSTreeObject::ptr &child) {
   // the child could be already queried/uploaded by another parent
   if (child->is_on_server() == PresenceOnServer::kObjectPresent) {
@@ -67,9 +73,8 @@ void OSTreeObject::AppendChild(const OSTreeObject::ptr &child) {
   }
 
   children_.push_back(child);
-  auto last = children_.end();
-  last--;
-  child->AddParent(this, last);
+  pending_children_++;
+  child->AddParent(this);
 }
 
 // Can throw OSTreeObjectMissing if the repo is corrupt
@@ -100,6 +105,7 @@ void OSTreeObject::PopulateChildren() {
                               reinterpret_cast<GDestroyNotify>(g_mapped_file_unref), mfile);
   g_variant_ref_sink(contents);
 
+  std::vector<std::pair<OSTreeHash, OstreeObjectType>> children;
   if (is_commit) {
     // * - ay - Root tree contents
     GVariant *content_csum_variant = nullptr;
@@ -108,14 +114,14 @@ void OSTreeObject::PopulateChildren() {
     gsize n_elts;
     const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
     assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
+    children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE);
 
     // * - ay - Root tree metadata
     GVariant *meta_csum_variant = nullptr;
     g_variant_get_child(contents, 7, "@ay", &meta_csum_variant);
     csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
     assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
+    children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META);
 
     g_variant_unref(meta_csum_variant);
     g_variant_unref(content_csum_variant);
@@ -138,7 +144,7 @@ void OSTreeObject::PopulateChildren() {
       gsize n_elts;
       const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_FILE));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_FILE);
 
       g_variant_unref(csum_variant);
     }
@@ -153,12 +159,12 @@ void OSTreeObject::PopulateChildren() {
       // First the .dirtree:
       const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE);
 
       // Then the .dirmeta:
       csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META);
 
       g_variant_unref(meta_csum_variant);
       g_variant_unref(content_csum_variant);
@@ -168,6 +174,11 @@ void OSTreeObject::PopulateChildren() {
     g_variant_unref(files_variant);
   }
   g_variant_unref(contents);
+
+  repo_.PrefetchObjects(children);
+  for (const auto &child : children) {
+    AppendChild(repo_.GetObject(child.first, child.second));
+  }
 }
 
 void OSTreeObject::QueryChildren(RequestPool &pool) {
@@ -209,7 +220,7 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
-  http_response_.str("");                                      // Empty the response buffer
+  http_response_.clear();                                      // Empty the response buffer
 
   const CURLMcode err = curl_multi_add_handle(curl_multi_handle, curl_handle_);
   if (err != 0) {
@@ -219,9 +230,12 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   request_start_time_ = std::chrono::steady_clock::now();
 }
 
-void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode) {
+void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode,
+                          const uintmax_t chunk_size) {
   if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
-    LOG_INFO << "Uploading " << *this;
+    if (upload_offset_ == 0) {
+      LOG_INFO << "Uploading " << *this;
+    }
   } else {
     LOG_INFO << "Would upload " << *this;
     is_on_server_ = PresenceOnServer::kObjectPresent;
@@ -236,11 +250,10 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
   curlEasySetoptWrapper(curl_handle_, CURLOPT_VERBOSE, get_curlopt_verbose());
   current_operation_ = CurrentOp::kOstreeObjectUploading;
   push_target.SetContentType("Content-Type: application/octet-stream");
-  push_target.InjectIntoCurl(Url(), curl_handle_);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_USERAGENT, Utils::getUserAgent());
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
-  http_response_.str("");  // Empty the response buffer
+  http_response_.clear();  // Empty the response buffer
 
   struct stat file_info {};
   auto file_path = PathOnDisk();
@@ -252,8 +265,30 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
       throw std::runtime_error("Could not get file information");
     }
   }
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, fd_);
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, file_info.st_size);
+  const auto size = static_cast<uintmax_t>(file_info.st_size);
+
+  chunk_size_ = chunk_size;
+  if (chunk_size_ == 0) {
+    upload_offset_ = 0;
+    upload_length_ = size;
+    push_target.InjectIntoCurl(Url(), curl_handle_);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, fd_);
+  } else {
+    assert(upload_offset_ < size);
+    upload_length_ = std::min(chunk_size_, size - upload_offset_);
+    LOG_DEBUG << "Uploading bytes " << upload_offset_ << "-" << upload_offset_ + upload_length_ << " of " << size
+              << " of " << *this;
+    if (fseeko(fd_, static_cast<off_t>(upload_offset_), SEEK_SET) != 0) {
+      throw std::runtime_error("Could not seek in file to be uploaded");
+    }
+    chunk_remaining_ = upload_length_;
+    push_target.InjectIntoCurl(
+        "uploads/" + Url() + "?offset=" + std::to_string(upload_offset_) + "&size=" + std::to_string(size),
+        curl_handle_);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READFUNCTION, &OSTreeObject::curl_handle_read);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, this);
+  }
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, static_cast<long>(upload_length_));  // NOLINT
   curlEasySetoptWrapper(curl_handle_, CURLOPT_POST, 1);
 
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
@@ -266,10 +301,38 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
   request_start_time_ = std::chrono::steady_clock::now();
 }
 
+void OSTreeObject::MarkPresent(RequestPool &pool) {
+  LOG_DEBUG << "Known to be present: " << *this;
+  is_on_server_ = PresenceOnServer::kObjectPresent;
+  last_operation_result_ = ServerResponse::kOk;
+  if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
+    // Like a present object whose children turn out to be present as well:
+    // nothing below it needs to be walked, and its parents are not waiting
+    // for it.
+    ReleaseLocalCopy();
+  } else {
+    NotifyParents(pool);
+  }
+}
+
+void OSTreeObject::MarkCopied(RequestPool &pool) {
+  LOG_INFO << "Copied on the server: " << *this;
+  is_on_server_ = PresenceOnServer::kObjectPresent;
+  last_operation_result_ = ServerResponse::kOk;
+  pool.RecordPresent(*this);
+  NotifyParents(pool);
+}
+
 void OSTreeObject::CheckChildren(RequestPool &pool, const long rescode) {  // NOLINT(google-runtime-int)
   try {
+    const auto walk_start = std::chrono::steady_clock::now();
     PopulateChildren();
+    pool.RecordWalk(std::chrono::steady_clock::now() - walk_start);
     LOG_TRACE << "Children of " << *this << ": " << children_.size();
+    if (rescode == 200) {
+      // Already on the server, this was only read to walk the tree.
+      ReleaseLocalCopy();
+    }
     if (children_ready()) {
       if (rescode != 200) {
         pool.AddUpload(this);
@@ -287,7 +350,7 @@ void OSTreeObject::PresenceError(RequestPool &pool, const int64_t rescode) {
   is_on_server_ = PresenceOnServer::kObjectStateUnknown;
   LOG_WARNING << "OSTree query reported an error code: " << rescode << " retrying...";
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << http_response_;
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddQuery(this);
 }
@@ -295,12 +358,31 @@ void OSTreeObject::PresenceError(RequestPool &pool, const int64_t rescode) {
 void OSTreeObject::UploadError(RequestPool &pool, const int64_t rescode) {
   LOG_WARNING << "OSTree upload reported an error code:" << rescode << " retrying...";
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << http_response_;
   is_on_server_ = PresenceOnServer::kObjectMissing;
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddUpload(this);
 }
 
+void OSTreeObject::ChunkError(RequestPool &pool, const int64_t rescode) {
+  LOG_WARNING << "OSTree chunk upload reported an error code: " << rescode << ", retrying from byte "
+              << upload_offset_ << " of " << *this;
+  LOG_DEBUG << http_response_;
+  is_on_server_ = PresenceOnServer::kObjectMissing;
+  last_operation_result_ = ServerResponse::kTemporaryFailure;
+  // Only the chunk is sent again, and the object has been checked already.
+  pool.ContinueUpload(this);
+}
+
+void OSTreeObject::RestartChunkedUpload(RequestPool &pool, const int64_t rescode) {
+  upload_offset_ = 0;
+  if (++chunked_restarts_ > kMaxChunkedRestarts) {
+    LOG_WARNING << "The server lost the chunks of " << *this << " " << chunked_restarts_
+                << " times, uploading it whole";
+  }
+  ChunkError(pool, rescode);
+}
+
 void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
   refcount_--;            // Because curl now doesn't have a reference to us
   assert(refcount_ > 0);  // At least our parent should have a reference to us
@@ -319,6 +401,7 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
       LOG_INFO << "Already present: " << *this;
       is_on_server_ = PresenceOnServer::kObjectPresent;
       last_operation_result_ = ServerResponse::kOk;
+      pool.RecordPresent(*this);
       if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
         CheckChildren(pool, rescode);
       } else {
@@ -327,6 +410,7 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
     } else if (rescode == 404) {
       is_on_server_ = PresenceOnServer::kObjectMissing;
       last_operation_result_ = ServerResponse::kOk;
+      pool.RecordMissing();
       CheckChildren(pool, rescode);
     } else {
       PresenceError(pool, rescode);
@@ -342,14 +426,37 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
       LOG_TRACE << "OSTree upload successful";
       is_on_server_ = PresenceOnServer::kObjectPresent;
       last_operation_result_ = ServerResponse::kOk;
+      upload_offset_ = 0;
+      pool.RecordPresent(*this);
       NotifyParents(pool);
     } else if (rescode == 409) {
       LOG_DEBUG << "OSTree upload reported a 409 Conflict, possibly due to concurrent uploads";
       is_on_server_ = PresenceOnServer::kObjectPresent;
       last_operation_result_ = ServerResponse::kOk;
+      upload_offset_ = 0;
+      pool.RecordPresent(*this);
       NotifyParents(pool);
-    } else {
+    } else if (chunk_size_ == 0) {
       UploadError(pool, rescode);
+    } else if (rescode == 202) {
+      upload_offset_ += upload_length_;
+      if (upload_offset_ < GetSize()) {
+        last_operation_result_ = ServerResponse::kOk;
+        pool.ContinueUpload(this);
+      } else {
+        // All of it was sent, but the server doesn't think it is complete
+        RestartChunkedUpload(pool, rescode);
+      }
+    } else if (upload_offset_ == 0 && (rescode == 404 || rescode == 405 || rescode == 501)) {
+      LOG_INFO << "Treehub does not support chunked uploads, uploading whole objects";
+      last_operation_result_ = ServerResponse::kOk;
+      pool.DisableChunkedUploads();
+      pool.ContinueUpload(this);
+    } else if (rescode == 416) {
+      // The server doesn't have the chunks before this one (any more)
+      RestartChunkedUpload(pool, rescode);
+    } else {
+      ChunkError(pool, rescode);
     }
     fclose(fd_);
   } else {
@@ -359,14 +466,26 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
   curl_multi_remove_handle(curl_multi_handle, curl_handle_);
   curl_easy_cleanup(curl_handle_);
   curl_handle_ = nullptr;
+  std::string().swap(http_response_);
 }
 
 size_t OSTreeObject::curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
   auto *that = static_cast<OSTreeObject *>(userp);
-  that->http_response_.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(size * nmemb));
+  that->http_response_.append(static_cast<const char *>(buffer), size * nmemb);
   return size * nmemb;
 }
 
+size_t OSTreeObject::curl_handle_read(char *buffer, size_t size, size_t nitems, void *userp) {
+  auto *that = static_cast<OSTreeObject *>(userp);
+  const size_t wanted = std::min(static_cast<uintmax_t>(size * nitems), that->chunk_remaining_);
+  const size_t read = fread(buffer, 1, wanted, that->fd_);
+  if (read < wanted && ferror(that->fd_) != 0) {
+    return CURL_READFUNC_ABORT;
+  }
+  that->chunk_remaining_ -= read;
+  return read;
+}
+
 OSTreeObject::ptr ostree_object_from_curl(CURL *curlhandle) {
   void *p;
   curl_easy_getinfo(curlhandle, CURLINFO_PRIVATE, &p);
@@ -375,8 +494,9 @@ OSTreeObject::ptr ostree_object_from_curl(CURL *curlhandle) {
   return boost::intrusive_ptr<OSTreeObject>(h);
 }
 
-bool OSTreeObject::Fsck() const {
-  GFile *repo_path_file = g_file_new_for_path(repo_.root().c_str());  // Never fails
+namespace {
+bool FsckObject(const boost::filesystem::path &repo_root, const OSTreeHash &hash, const OstreeObjectType type) {
+  GFile *repo_path_file = g_file_new_for_path(repo_root.c_str());  // Never fails
   OstreeRepo *repo = ostree_repo_new(repo_path_file);
   GError *err = nullptr;
   auto ok = ostree_repo_open(repo, nullptr, &err);
@@ -392,13 +512,13 @@ bool OSTreeObject::Fsck() const {
     return false;
   }
 
-  ok = ostree_repo_fsck_object(repo, type_, hash_.string().c_str(), nullptr, &err);
+  ok = ostree_repo_fsck_object(repo, type, hash.string().c_str(), nullptr, &err);
 
   g_object_unref(repo_path_file);
   g_object_unref(repo);
 
   if (ok == FALSE) {
-    LOG_WARNING << "Object " << *this << " is corrupt";
+    LOG_WARNING << "Object " << OSTreeRepo::GetPathForHash(hash, type).string() << " is corrupt";
     if (err != nullptr) {
       LOG_WARNING << "err:" << err->message;
       g_error_free(err);
@@ -409,6 +529,13 @@ bool OSTreeObject::Fsck() const {
   LOG_DEBUG << "Object is OK";
   return true;
 }
+}  // namespace
+
+bool OSTreeObject::Fsck() const { return FsckObject(repo_.root(), hash_, type_); }
+
+std::function<bool()> OSTreeObject::FsckJob() const {
+  return [root = repo_.root(), hash = hash_, type = type_]() { return FsckObject(root, hash, type); };
+}
 
 void intrusive_ptr_add_ref(OSTreeObject *h) { h->refcount_++; }
 
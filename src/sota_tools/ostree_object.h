@@ -2,8 +2,10 @@
 #define SOTA_CLIENT_TOOLS_OSTREE_OBJECT_H_
 
 #include <chrono>
+#include <functional>
 #include <iostream>
-#include <sstream>
+#include <string>
+#include <vector>
 
 #include <curl/curl.h>
 #include <boost/filesystem/path.hpp>
@@ -38,7 +40,12 @@ enum class ServerResponse {
 class OSTreeObject {
  public:
   using ptr = boost::intrusive_ptr<OSTreeObject>;
-  OSTreeObject(const OSTreeRepo& repo, OSTreeHash hash, OstreeObjectType object_type);
+  /* Times a chunked upload may start over because the server lost its chunks,
+   * before the object is uploaded whole instead. */
+  static constexpr int kMaxChunkedRestarts = 3;
+  /* A deferred object is not on the local file system yet: see
+   * OSTreeRepo::defer_file_objects(). */
+  OSTreeObject(const OSTreeRepo& repo, OSTreeHash hash, OstreeObjectType object_type, bool deferred = false);
   OSTreeObject(const OSTreeObject&) = delete;
   OSTreeObject(OSTreeObject&&) = delete;
   OSTreeObject operator=(const OSTreeObject&) = delete;
@@ -54,32 +61,59 @@ class OSTreeObject {
    * present there. */
   void MakeTestRequest(const TreehubServer& push_target, CURLM* curl_multi_handle);
 
-  /* Upload this object to the destination server. */
-  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode);
+  /* The object is known to be on the destination server without asking it
+   * (see PresenceCache): handle it like a successful presence check. */
+  void MarkPresent(RequestPool& pool);
+
+  /* The destination server copied this object from the source repository
+   * (see ServerCopy): handle it like a successful upload. */
+  void MarkCopied(RequestPool& pool);
+
+  /* Upload this object to the destination server. With a chunk_size, only the
+   * next chunk of that size is uploaded, starting where the previous chunk
+   * ended, to uploads/objects/... with the offset and total size in the query
+   * string. The server answers 202 to a chunk and 204 once it has the whole
+   * object; a chunk that failed is uploaded again on its own.
+   *
+   * The chunk protocol is a proposal that Treehub does not implement yet. A
+   * server without it answers 404, 405 or 501 to the first chunk, and whole
+   * objects are uploaded from then on. */
+  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode, uintmax_t chunk_size = 0);
 
   /* Process a completed curl transaction (presence check or upload). */
   void CurlDone(CURLM* curl_multi_handle, RequestPool& pool);
 
   uintmax_t GetSize() const;
 
+  const OSTreeHash& hash() const { return hash_; }
+  OstreeObjectType type() const { return type_; }
+  const OSTreeRepo& repo() const { return repo_; }
+  bool is_deferred() const { return deferred_; }
   PresenceOnServer is_on_server() const { return is_on_server_; }
   CurrentOp operation() const { return current_operation_; }
-  bool children_ready() const { return children_.empty(); }
+  bool children_ready() const { return pending_children_ == 0; }
   void LaunchNotify() { is_on_server_ = PresenceOnServer::kObjectInProgress; }
   std::chrono::steady_clock::time_point RequestStartTime() const { return request_start_time_; }
   ServerResponse LastOperationResult() const { return last_operation_result_; }
+  /* Bytes of this object already on the server in a chunked upload. */
+  uintmax_t upload_offset() const { return upload_offset_; }
+  /* Bytes sent by the last upload request: the whole object, or one chunk. */
+  uintmax_t upload_length() const { return upload_length_; }
+  /* The chunked upload started over too often: upload the whole object. */
+  bool chunked_upload_failed() const { return chunked_restarts_ > kMaxChunkedRestarts; }
 
   bool Fsck() const;
+  /* The same check as Fsck(), as a job that doesn't refer to this object and
+   * can be run on another thread. */
+  std::function<bool()> FsckJob() const;
 
  private:
-  using childiter = std::list<OSTreeObject::ptr>::iterator;
-  using parentref = std::pair<OSTreeObject*, childiter>;
-
   /* Add parent to this object. */
-  void AddParent(OSTreeObject* parent, std::list<OSTreeObject::ptr>::iterator parent_it);
+  void AddParent(OSTreeObject* parent);
 
-  /* Child object of this object has been uploaded, remove it from the list. */
-  void ChildNotify(std::list<OSTreeObject::ptr>::iterator child_it);
+  /* A child object of this object has been uploaded. Once all of them are, the
+   * list of children is released. */
+  void ChildNotify();
 
   /* If the child has is not already on the server, add it to this object's list
    * of children and add this object as the parent of the new child. */
@@ -94,6 +128,9 @@ class OSTreeObject {
 
   std::string Url() const;
 
+  /* Let the repository drop its local copy once nothing will read it again. */
+  void ReleaseLocalCopy() const;
+
   /* Check for children. If they are all present and this object isn't present,
    * upload it. If any children are missing, query them. */
   void CheckChildren(RequestPool& pool, long rescode);  // NOLINT(google-runtime-int)
@@ -104,7 +141,13 @@ class OSTreeObject {
   /* Handle an error from an upload. */
   void UploadError(RequestPool& pool, int64_t rescode);
 
+  /* Handle an error from the upload of a chunk. */
+  void ChunkError(RequestPool& pool, int64_t rescode);
+  /* The server lost the chunks sent so far: send them all again. */
+  void RestartChunkedUpload(RequestPool& pool, int64_t rescode);
+
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
+  static size_t curl_handle_read(char* buffer, size_t size, size_t nitems, void* userp);
 
   /** Full path on disk to this object */
   boost::filesystem::path PathOnDisk() const;
@@ -113,6 +156,7 @@ class OSTreeObject {
   FRIEND_TEST(OstreeObject, UploadDryRun);
   FRIEND_TEST(OstreeObject, UploadFail);
   FRIEND_TEST(OstreeObject, UploadSuccess);
+  friend class OSTreeRepo;  // Clears deferred_ once the object has been fetched
   friend void intrusive_ptr_add_ref(OSTreeObject* /*h*/);
   friend void intrusive_ptr_release(OSTreeObject* /*h*/);
   friend std::ostream& operator<<(std::ostream& stream, const OSTreeObject& o);
@@ -125,13 +169,28 @@ class OSTreeObject {
   int refcount_;  // refcounts and intrusive_ptr are used to simplify
                   // interaction with curl
   PresenceOnServer is_on_server_;
+  bool deferred_;
   CurrentOp current_operation_{};
 
-  std::stringstream http_response_;
+  // Every object of the repository stays in memory until the push is done, so
+  // only keep what is needed: the response buffer is empty unless a request
+  // is in flight, and the parent and child lists are released as soon as they
+  // have served their purpose.
+  std::string http_response_;
   CURL* curl_handle_;
   FILE* fd_;
-  std::list<parentref> parents_;
-  std::list<OSTreeObject::ptr> children_;
+  std::vector<OSTreeObject*> parents_;
+  std::vector<OSTreeObject::ptr> children_;
+  size_t pending_children_{0};
+
+  // Chunked uploads: the chunk size of the upload in flight (0 if it sends the
+  // whole object), where its chunk starts and what is left of it to be read.
+  uintmax_t chunk_size_{0};
+  uintmax_t upload_offset_{0};
+  uintmax_t upload_length_{0};
+  uintmax_t chunk_remaining_{0};
+  // Times the chunked upload started over, see kMaxChunkedRestarts
+  int chunked_restarts_{0};
 
   std::chrono::steady_clock::time_point request_start_time_;
   ServerResponse last_operation_result_{ServerResponse::kNoResponse};
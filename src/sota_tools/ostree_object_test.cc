@@ -4,6 +4,8 @@
 #include <boost/process.hpp>
 
 #include "authenticate.h"
+#include "deploy.h"
+#include "fsck_pool.h"
 #include "garage_common.h"
 #include "ostree_dir_repo.h"
 #include "ostree_object.h"
@@ -61,6 +63,23 @@ TEST(OstreeObject, Fsck) {
   EXPECT_FALSE(corrupt_object->Fsck());
 }
 
+/* Objects can be checked on the fsck pool threads. */
+TEST(OstreeObject, FsckPool) {
+  OSTreeDirRepo repo("tests/sota_tools/corrupt-repo");
+  auto good_object =
+      repo.GetObject(OSTreeHash::Parse("2ee758031340b51db1c0229bddd8f64bca4b131728d2bfb20c0c8671b1259a38"),
+                     OstreeObjectType::OSTREE_OBJECT_TYPE_FILE);
+  auto corrupt_object =
+      repo.GetObject(OSTreeHash::Parse("4145b1a9bade30efb28ff921f7a555ff82ba7d3b7b83b968084436167912fa83"),
+                     OstreeObjectType::OSTREE_OBJECT_TYPE_FILE);
+
+  FsckPool pool(2);
+  auto good = pool.Submit(good_object->FsckJob());
+  auto corrupt = pool.Submit(corrupt_object->FsckJob());
+  EXPECT_TRUE(good.get());
+  EXPECT_FALSE(corrupt.get());
+}
+
 // This is a class solely for the purpose of being a FRIEND_TEST to
 // OSTreeObject. The name is carefully constructed for this purpose.
 class OstreeObject_Request_Test {
@@ -221,6 +240,63 @@ TEST(OstreeObject, UploadSuccess) {
   curl_global_cleanup();
 }
 
+/* Upload large objects in chunks, and send only the chunk again when one
+ * fails. */
+TEST(OstreeObject, UploadChunked) {
+  TemporaryDirectory temp_dir;
+  const std::string dp = TestUtils::getFreePort();
+  boost::process::child deploy_server_process("tests/sota_tools/treehub_server.py", std::string("-p"), dp,
+                                              std::string("-d"), temp_dir.PathString(), std::string("-f5"),
+                                              std::string("--fail-chunks"));
+  TestUtils::waitForServer("http://localhost:" + dp + "/");
+
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + dp);
+  // The files of the generated repo are 256 KiB each.
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>(repo_path);
+  OSTreeHash hash = src_repo->GetRef("master").GetHash();
+  OSTreeObject::ptr root = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+
+  RequestPool pool(push_server, 4, RunMode::kDefault, false);
+  pool.chunked_uploads(100 * 1024, 64 * 1024);
+  pool.AddQuery(root);
+  do {
+    pool.Loop();
+  } while (CheckPoolState(root, pool));
+
+  EXPECT_EQ(root->is_on_server(), PresenceOnServer::kObjectPresent);
+  EXPECT_GE(pool.put_requests_made(), 10 * 4);
+  int result = system(("diff -r " + (temp_dir.Path() / "objects/").string() + " " + repo_path + "/objects/").c_str());
+  EXPECT_EQ(result, 0) << "Diff between the source repo objects and the destination repo objects is nonzero.";
+}
+
+/* A server that keeps losing the chunks of an upload gets the whole object
+ * after a few attempts. */
+TEST(OstreeObject, UploadChunkedLost) {
+  TemporaryDirectory temp_dir;
+  const std::string dp = TestUtils::getFreePort();
+  boost::process::child deploy_server_process("tests/sota_tools/treehub_server.py", std::string("-p"), dp,
+                                              std::string("-d"), temp_dir.PathString(), std::string("--lose-chunks"));
+  TestUtils::waitForServer("http://localhost:" + dp + "/");
+
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + dp);
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>(repo_path);
+  OSTreeHash hash = src_repo->GetRef("master").GetHash();
+  OSTreeObject::ptr root = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+
+  RequestPool pool(push_server, 4, RunMode::kDefault, false);
+  pool.chunked_uploads(100 * 1024, 64 * 1024);
+  pool.AddQuery(root);
+  do {
+    pool.Loop();
+  } while (CheckPoolState(root, pool));
+
+  EXPECT_EQ(root->is_on_server(), PresenceOnServer::kObjectPresent);
+  int result = system(("diff -r " + (temp_dir.Path() / "objects/").string() + " " + repo_path + "/objects/").c_str());
+  EXPECT_EQ(result, 0) << "Diff between the source repo objects and the destination repo objects is nonzero.";
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
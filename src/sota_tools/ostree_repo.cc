@@ -1,5 +1,7 @@
 #include "ostree_repo.h"
 
+#include <set>
+
 #include "logging/logging.h"
 
 // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
@@ -16,6 +18,13 @@ OSTreeObject::ptr OSTreeRepo::GetObject(const OSTreeHash hash, const OstreeObjec
 
   OSTreeObject::ptr object;
 
+  if (defer_files_ && type == OSTREE_OBJECT_TYPE_FILE) {
+    // Whether it really exists is only found out in FetchDeferred()
+    object = OSTreeObject::ptr(new OSTreeObject(*this, hash, type, true));
+    ObjectTable[hash] = object;
+    return object;
+  }
+
   for (int i = 0; i < 3; ++i) {
     if (i > 0) {
       LOG_WARNING << "OSTree hash " << hash << " not found. Retrying (attempt " << i << " of 3)";
@@ -45,6 +54,60 @@ OSTreeObject::ptr OSTreeRepo::GetObject(const OSTreeHash hash, const OstreeObjec
   throw OSTreeObjectMissing(hash);
 }
 
+void OSTreeRepo::PrefetchObjects(const std::vector<std::pair<OSTreeHash, OstreeObjectType>> &objects) const {
+  std::set<boost::filesystem::path> seen;
+  std::vector<boost::filesystem::path> paths;
+  for (const auto &object : objects) {
+    if (ObjectTable.count(object.first) != 0) {
+      continue;
+    }
+    if (defer_files_ && object.second == OSTREE_OBJECT_TYPE_FILE) {
+      continue;
+    }
+    boost::filesystem::path path("objects");
+    path /= GetPathForHash(object.first, object.second);
+    if (seen.insert(path).second) {
+      paths.push_back(path);
+    }
+  }
+  if (!paths.empty()) {
+    Prefetch(paths);
+  }
+}
+
+bool OSTreeRepo::FetchDeferred(const std::vector<OSTreeObject::ptr> &objects) const {
+  std::vector<boost::filesystem::path> paths;
+  for (const auto &object : objects) {
+    if (object->is_deferred()) {
+      paths.push_back(boost::filesystem::path("objects") / GetPathForHash(object->hash(), object->type()));
+    }
+  }
+  if (paths.empty()) {
+    return true;
+  }
+  Prefetch(paths);
+
+  bool all_fetched = true;
+  for (const auto &object : objects) {
+    if (!object->is_deferred()) {
+      continue;
+    }
+    const auto path = boost::filesystem::path("objects") / GetPathForHash(object->hash(), object->type());
+    bool fetched = false;
+    for (int i = 0; i < 3 && !fetched; ++i) {
+      fetched = FetchObject(path);
+    }
+    if (fetched) {
+      object->deferred_ = false;
+      LOG_DEBUG << "Fetched OSTree object " << path;
+    } else {
+      LOG_ERROR << "Source OSTree repo does not contain object " << object->hash();
+      all_fetched = false;
+    }
+  }
+  return all_fetched;
+}
+
 bool OSTreeRepo::CheckForObject(const OSTreeHash &hash, OstreeObjectType type, OSTreeObject::ptr *object_out) const {
   boost::filesystem::path path("objects");
   path /= GetPathForHash(hash, type);
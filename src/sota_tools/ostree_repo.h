@@ -3,6 +3,8 @@
 
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem/path.hpp>
 
@@ -37,6 +39,34 @@ class OSTreeRepo {
 
   static boost::filesystem::path GetPathForHash(OSTreeHash hash, OstreeObjectType type);
 
+  /**
+   * Announce objects that are about to be requested with GetObject(), so that
+   * repositories with slow access can fetch them in parallel beforehand.
+   */
+  void PrefetchObjects(const std::vector<std::pair<OSTreeHash, OstreeObjectType>>& objects) const;
+
+  /**
+   * Called once an object is on the destination server and its local copy
+   * will not be read again. Repositories that fetched the object into scratch
+   * space can drop it there, so a push needs space only for the objects in
+   * progress.
+   */
+  virtual void ReleaseObject(const boost::filesystem::path& path) const { (void)path; }
+
+  /**
+   * Don't fetch file objects in GetObject(), only in FetchDeferred() once it
+   * is clear that they have to be uploaded. Used when the destination server
+   * may copy them from this repository on its own (see ServerCopy), so that
+   * they are never downloaded.
+   */
+  void defer_file_objects(bool defer) { defer_files_ = defer; }
+
+  /**
+   * Fetch objects whose fetching GetObject() deferred, in parallel where
+   * possible. Returns false if any of them is not available.
+   */
+  bool FetchDeferred(const std::vector<OSTreeObject::ptr>& objects) const;
+
  protected:
   /**
    * Look for an object with a given path, downloading it if necessary and
@@ -49,11 +79,18 @@ class OSTreeRepo {
    * FetchObject() returns true => The object is on the local file system.
    * */
   virtual bool FetchObject(const boost::filesystem::path& path) const = 0;
+  /**
+   * Fetch several objects ahead of FetchObject(), on a best-effort basis: any
+   * object that could not be prefetched is fetched (and its failure reported)
+   * by FetchObject() later.
+   */
+  virtual void Prefetch(const std::vector<boost::filesystem::path>& paths) const { (void)paths; }
 
   bool CheckForObject(const OSTreeHash& hash, OstreeObjectType type, OSTreeObject::ptr* object) const;
 
   using otable = std::map<OSTreeHash, OSTreeObject::ptr>;
   mutable otable ObjectTable;  // Makes sure that the same commit object is not added twice
+  bool defer_files_{false};
 };
 
 /**
@@ -0,0 +1,133 @@
+#include "presence_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace {
+const char kMagic[] = "TRHBPC1\n";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+}  // namespace
+
+PresenceCache::PresenceCache(const boost::filesystem::path &cache_dir, const std::string &server_url)
+    : path_(cache_dir / Crypto::sha256digestHex(server_url)) {
+  const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) == 0 && st.st_size > static_cast<off_t>(kMagicSize)) {
+    const auto size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      mapped_ = static_cast<const uint8_t *>(data);
+      mapped_size_ = size;
+    }
+  }
+  close(fd);
+
+  if (mapped_ == nullptr) {
+    return;
+  }
+  if (memcmp(mapped_, kMagic, kMagicSize) != 0 || (mapped_size_ - kMagicSize) % kRecordSize != 0) {
+    LOG_WARNING << "Presence cache " << path_ << " is malformed, ignoring it";
+    Unmap();
+    return;
+  }
+  mapped_count_ = (mapped_size_ - kMagicSize) / kRecordSize;
+  LOG_DEBUG << "Loaded " << mapped_count_ << " known objects from presence cache " << path_;
+}
+
+PresenceCache::~PresenceCache() { Unmap(); }
+
+void PresenceCache::Unmap() {
+  if (mapped_ != nullptr) {
+    munmap(const_cast<uint8_t *>(mapped_), mapped_size_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+  }
+  mapped_ = nullptr;
+  mapped_size_ = 0;
+  mapped_count_ = 0;
+}
+
+PresenceCache::Record PresenceCache::MakeRecord(const OSTreeHash &hash, const OstreeObjectType type) {
+  Record record{};
+  std::copy(hash.bytes().cbegin(), hash.bytes().cend(), record.begin());
+  record[kRecordSize - 1] = static_cast<uint8_t>(type);
+  return record;
+}
+
+bool PresenceCache::MappedContains(const Record &record) const {
+  size_t low = 0;
+  size_t high = mapped_count_;
+  while (low < high) {
+    const size_t mid = low + (high - low) / 2;
+    const int cmp = memcmp(mapped_ + kMagicSize + mid * kRecordSize, record.data(), kRecordSize);
+    if (cmp == 0) {
+      return true;
+    }
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+bool PresenceCache::Contains(const OSTreeHash &hash, const OstreeObjectType type) const {
+  const Record record = MakeRecord(hash, type);
+  return added_.count(record) != 0 || MappedContains(record);
+}
+
+void PresenceCache::Add(const OSTreeHash &hash, const OstreeObjectType type) {
+  const Record record = MakeRecord(hash, type);
+  if (!MappedContains(record)) {
+    added_.insert(record);
+  }
+}
+
+void PresenceCache::Save() {
+  if (added_.empty()) {
+    return;
+  }
+
+  // Both the mapped records and added_ are sorted, so a single merge pass
+  // produces the new file.
+  std::string contents(kMagic, kMagicSize);
+  contents.reserve(kMagicSize + size() * kRecordSize);
+  auto mapped_record = [this](size_t i) { return mapped_ + kMagicSize + i * kRecordSize; };
+  size_t i = 0;
+  for (const auto &record : added_) {
+    while (i < mapped_count_ && memcmp(mapped_record(i), record.data(), kRecordSize) < 0) {
+      contents.append(reinterpret_cast<const char *>(mapped_record(i)), kRecordSize);
+      ++i;
+    }
+    contents.append(reinterpret_cast<const char *>(record.data()), kRecordSize);
+  }
+  if (i < mapped_count_) {
+    contents.append(reinterpret_cast<const char *>(mapped_record(i)), (mapped_count_ - i) * kRecordSize);
+  }
+
+  try {
+    Utils::writeFile(path_, contents);
+  } catch (const std::exception &e) {
+    // The cache is only an optimization; losing it costs extra HEAD requests
+    // on the next push.
+    LOG_WARNING << "Could not write presence cache " << path_ << ": " << e.what();
+    return;
+  }
+  LOG_DEBUG << "Stored " << size() << " known objects in presence cache " << path_;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,58 @@
+#ifndef SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
+#define SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
+
+#include <array>
+#include <cstdint>
+#include <set>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+
+/**
+ * On-disk set of objects that are known to be present on a Treehub server,
+ * recorded by previous pushes.
+ * Treehub has no bulk presence query, so the only way to avoid one HEAD
+ * request per object is to remember what a server has already confirmed.
+ * Every server gets its own file in the cache directory, named after the
+ * digest of its root URL. The file is a sorted array of (hash, object type)
+ * records that is mapped into memory and binary searched, so opening a cache
+ * of a large repository costs no parsing. Objects are never removed from
+ * Treehub, so entries do not expire.
+ */
+class PresenceCache {
+ public:
+  PresenceCache(const boost::filesystem::path& cache_dir, const std::string& server_url);
+  ~PresenceCache();
+  PresenceCache(const PresenceCache&) = delete;
+  PresenceCache(PresenceCache&&) = delete;
+  PresenceCache& operator=(const PresenceCache&) = delete;
+  PresenceCache& operator=(PresenceCache&&) = delete;
+
+  bool Contains(const OSTreeHash& hash, OstreeObjectType type) const;
+  void Add(const OSTreeHash& hash, OstreeObjectType type);
+  size_t size() const { return mapped_count_ + added_.size(); }
+  const boost::filesystem::path& path() const { return path_; }
+
+  /* Merge the added objects into the file on disk. */
+  void Save();
+
+ private:
+  static constexpr size_t kRecordSize = 33;
+  using Record = std::array<uint8_t, kRecordSize>;
+
+  static Record MakeRecord(const OSTreeHash& hash, OstreeObjectType type);
+  bool MappedContains(const Record& record) const;
+  void Unmap();
+
+  const boost::filesystem::path path_;
+  const uint8_t* mapped_{nullptr};
+  size_t mapped_size_{0};
+  size_t mapped_count_{0};
+  std::set<Record> added_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
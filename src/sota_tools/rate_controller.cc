@@ -12,12 +12,30 @@ const RateController::clock::duration RateController::kInitialSleepTime = std::c
 RateController::RateController(const int concurrency_cap) : concurrency_cap_(concurrency_cap) { CheckInvariants(); }
 
 void RateController::RequestCompleted(const clock::time_point start_time, const clock::time_point end_time,
-                                      const bool succeeded) {
+                                      const bool succeeded, const uintmax_t bytes) {
+  if (succeeded) {
+    bytes_since_update_ += bytes;
+  }
   if (last_concurrency_update_ < start_time) {
     const int prev_concurrency = max_concurrency_;
+    // Throughput can only be measured over a full round trip since the last
+    // change, and only if any payload moved at all.
+    double throughput = 0;
+    if (last_concurrency_update_ != clock::time_point() && bytes_since_update_ > 0) {
+      const std::chrono::duration<double> elapsed = end_time - last_concurrency_update_;
+      if (elapsed.count() > 0) {
+        throughput = static_cast<double>(bytes_since_update_) / elapsed.count();
+      }
+    }
     last_concurrency_update_ = end_time;
+    bytes_since_update_ = 0;
     if (succeeded) {
-      max_concurrency_ = std::min(max_concurrency_ + 1, concurrency_cap_);
+      if (throughput > 0 && throughput < last_throughput_ * kThroughputDropRatio && max_concurrency_ >= 2) {
+        // More parallel requests made things slower; give one back.
+        max_concurrency_--;
+      } else {
+        max_concurrency_ = std::min(max_concurrency_ + 1, concurrency_cap_);
+      }
       sleep_time_ = clock::duration(0);
     } else {
       if (max_concurrency_ >= 2) {
@@ -26,6 +44,9 @@ void RateController::RequestCompleted(const clock::time_point start_time, const
         sleep_time_ = std::max(sleep_time_ * 2, kInitialSleepTime);
       }
     }
+    if (throughput > 0) {
+      last_throughput_ = throughput;
+    }
     if (prev_concurrency != max_concurrency_) {
       LOG_DEBUG << "Concurrency limit is now: " << max_concurrency_;
     }
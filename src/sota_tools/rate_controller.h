@@ -2,6 +2,7 @@
 #define SOTA_CLIENT_TOOLS_RATE_CONTROLLER_H_
 
 #include <chrono>
+#include <cstdint>
 
 /**
  * Control the rate of outgoing requests.
@@ -10,6 +11,8 @@
  *    MaxConcurrency - The current estimate of the number of parallel requests that can be opened
  *    Sleep() - The number of seconds to sleep before sending the next request. 0.0 if MaxConcurrency is > 1
  *    Failed() - A boolean indicating that the server is broken, and to report an error up to the user.
+ * When requests report how many bytes they transferred, the additive increase is also bounded by throughput: if the
+ * bytes/s achieved after raising the concurrency drop noticeably, the extra connection is given back.
  * The congestion control is loosely based on the original TCP AIMD scheme. Better performance might be available by
  * Stealing ideas from the later TCP conjection control algorithms
  */
@@ -23,7 +26,8 @@ class RateController {
   RateController operator=(const RateController&) = delete;
   RateController operator=(RateController&&) = delete;
 
-  void RequestCompleted(clock::time_point start_time, clock::time_point end_time, bool succeeded);
+  void RequestCompleted(clock::time_point start_time, clock::time_point end_time, bool succeeded,
+                        uintmax_t bytes = 0);
 
   int MaxConcurrency() const;
 
@@ -44,6 +48,12 @@ class RateController {
    */
   static const clock::duration kInitialSleepTime;
 
+  /**
+   * Throughput has dropped if it falls below this fraction of the throughput
+   * measured before the last change in concurrency.
+   */
+  static constexpr double kThroughputDropRatio = 0.75;
+
   const int concurrency_cap_;
   /**
    * After making a change to the system, we wait a full round-trip time to
@@ -54,6 +64,10 @@ class RateController {
   clock::time_point last_concurrency_update_;
   int max_concurrency_{1};
   clock::duration sleep_time_{0};
+  /** Bytes transferred by successful requests since last_concurrency_update_ */
+  uintmax_t bytes_since_update_{0};
+  /** Bytes/s measured before the last change in concurrency, 0 if unknown */
+  double last_throughput_{0};
 
   void CheckInvariants() const;
 };
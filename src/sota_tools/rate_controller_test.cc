@@ -48,6 +48,25 @@ TEST(control, good_results_improve_concurrency) {
   EXPECT_GT(dut.MaxConcurrency(), initial_concurrency);
 }
 
+/* Rate controller gives connections back when more of them lower the throughput. */
+TEST(control, throughput_drop_reduces_concurrency) {
+  RateController dut;
+  RateController::clock::time_point t = RateController::clock::now();
+  RateController::clock::duration interval = std::chrono::seconds(2);
+  for (int i = 0; i < 10; i++) {
+    dut.RequestCompleted(t, t + interval, true, 1000000);
+    t += interval + std::chrono::milliseconds(1);
+  }
+  const int peak_concurrency = dut.MaxConcurrency();
+  dut.RequestCompleted(t, t + interval, true, 100000);
+  t += interval + std::chrono::milliseconds(1);
+  EXPECT_EQ(dut.MaxConcurrency(), peak_concurrency - 1);
+
+  // Steady throughput at the new level lets it probe upwards again.
+  dut.RequestCompleted(t, t + interval, true, 100000);
+  EXPECT_EQ(dut.MaxConcurrency(), peak_concurrency);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,19 +1,30 @@
 #include "request_pool.h"
 
-#include <algorithm>  // min
+#include <algorithm>  // min, max
 #include <chrono>
 #include <exception>
+#include <set>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "logging/logging.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
 
-RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload)
+RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload,
+                         PresenceCache* presence_cache, ServerCopy* server_copy)
     : rate_controller_(max_curl_requests),
       running_requests_(0),
       server_(server),
       mode_(mode),
       fsck_on_upload_(fsck_on_upload),
+      presence_cache_(presence_cache),
+      server_copy_(server_copy),
       stopped_(false) {
+  if (fsck_on_upload_) {
+    fsck_pool_ = std_::make_unique<FsckPool>();
+  }
   curl_global_init(CURL_GLOBAL_DEFAULT);
   multi_ = curl_multi_init();
   curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_HTTP1 | CURLPIPE_MULTIPLEX);
@@ -46,47 +57,189 @@ void RequestPool::AddQuery(const OSTreeObject::ptr& request) {
 }
 
 void RequestPool::AddUpload(const OSTreeObject::ptr& request) {
+  request->LaunchNotify();
+  if (!stopped_ && request->is_deferred()) {
+    // Not downloaded yet, so maybe it doesn't have to be
+    copy_queue_.push_back(request);
+  } else if (!stopped_) {
+    // Check object's integrity before uploading them, but after we know they
+    // are not present on the server. This runs ahead on the fsck pool, so
+    // the objects are ready by the time they reach the front of the queue.
+    PendingUpload pending{request, {}};
+    if (fsck_pool_) {
+      pending.fsck = fsck_pool_->Submit(request->FsckJob());
+    }
+    if (request->GetSize() >= kLargeObjectSize) {
+      large_upload_queue_.push_back(std::move(pending));
+    } else {
+      upload_queue_.push_back(std::move(pending));
+    }
+  }
+}
+
+void RequestPool::ContinueUpload(const OSTreeObject::ptr& request) {
   request->LaunchNotify();
   if (!stopped_) {
-    upload_queue_.push_back(request);
+    PendingUpload pending{request, {}};
+    if (request->GetSize() >= kLargeObjectSize) {
+      large_upload_queue_.push_front(std::move(pending));
+    } else {
+      upload_queue_.push_front(std::move(pending));
+    }
   }
 }
 
-void RequestPool::LoopLaunch() {
-  while (running_requests_ < rate_controller_.MaxConcurrency() && (!query_queue_.empty() || !upload_queue_.empty())) {
-    OSTreeObject::ptr cur;
+void RequestPool::RecordPresent(const OSTreeObject& object) {
+  if (presence_cache_ == nullptr) {
+    return;
+  }
+  const bool walking = mode_ == RunMode::kWalkTree || mode_ == RunMode::kPushTree;
+  if (walking &&
+      (object.type() == OSTREE_OBJECT_TYPE_COMMIT || object.type() == OSTREE_OBJECT_TYPE_DIR_TREE)) {
+    // Its children haven't been checked yet.
+    walk_present_.emplace_back(object.hash(), object.type());
+  } else {
+    presence_cache_->Add(object.hash(), object.type());
+  }
+}
 
-    // Queries first, uploads second
-    if (query_queue_.empty()) {
-      // Uploads
-      cur = upload_queue_.front();
-      upload_queue_.pop_front();
-      // Check object's integrity before uploading them, but after we know they
-      // are not present on the server
-      if (fsck_on_upload_) {
-        if (!cur->Fsck()) {
-          LOG_ERROR << "Local object " << cur << " is corrupt. Aborting upload.";
-          Abort();
-          continue;
-        }
-      }
-      cur->Upload(server_, multi_, mode_);
-      put_requests_made_++;
-      total_object_size_ += cur->GetSize();
-      if (mode_ == RunMode::kDryRun || mode_ == RunMode::kWalkTree) {
-        // Don't send an actual upload message, just skip to the part where we
-        // acknowledge that the object has been uploaded.
-        cur->NotifyParents(*this);
+void RequestPool::FinishWalk() {
+  if (presence_cache_ != nullptr && !stopped_ && walk_complete_) {
+    for (const auto& object : walk_present_) {
+      presence_cache_->Add(object.first, object.second);
+    }
+  }
+  walk_present_.clear();
+}
+
+bool RequestPool::KnownPresent(const OSTreeObject& object) const {
+  if (presence_cache_ == nullptr) {
+    return false;
+  }
+  return presence_cache_->Contains(object.hash(), object.type());
+}
+
+void RequestPool::CopyOnServer() {
+  const size_t count = std::min(copy_queue_.size(), ServerCopy::kBatchSize);
+  std::vector<OSTreeObject::ptr> batch(copy_queue_.begin(), copy_queue_.begin() + static_cast<std::ptrdiff_t>(count));
+  copy_queue_.erase(copy_queue_.begin(), copy_queue_.begin() + static_cast<std::ptrdiff_t>(count));
+
+  std::set<std::string> copied;
+  if (server_copy_ != nullptr) {
+    std::vector<std::string> paths;
+    paths.reserve(batch.size());
+    for (const auto& object : batch) {
+      paths.push_back(OSTreeRepo::GetPathForHash(object->hash(), object->type()).string());
+    }
+    copied = server_copy_->Copy(paths);
+  }
+
+  std::vector<OSTreeObject::ptr> to_upload;
+  for (const auto& object : batch) {
+    if (copied.count(OSTreeRepo::GetPathForHash(object->hash(), object->type()).string()) != 0) {
+      if (stats_ != nullptr) {
+        stats_->ObjectCopied(object->type());
       }
+      object->MarkCopied(*this);
     } else {
-      // Queries
+      to_upload.push_back(object);
+    }
+  }
+  if (to_upload.empty()) {
+    return;
+  }
+  if (!to_upload.front()->repo().FetchDeferred(to_upload)) {
+    Abort();
+    return;
+  }
+  for (const auto& object : to_upload) {
+    AddUpload(object);
+  }
+}
+
+int RequestPool::LargeUploadSlots() const { return std::max(1, rate_controller_.MaxConcurrency() / 2); }
+
+bool RequestPool::TakeUpload(std::list<PendingUpload>& queue, OSTreeObject::ptr* request) {
+  PendingUpload& pending = queue.front();
+  if (pending.fsck.valid()) {
+    if (pending.fsck.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      return false;
+    }
+    if (!pending.fsck.get()) {
+      LOG_ERROR << "Local object " << pending.object << " is corrupt. Aborting upload.";
+      Abort();
+      return false;
+    }
+  }
+  *request = pending.object;
+  queue.pop_front();
+  return true;
+}
+
+void RequestPool::WaitForFsck() {
+  for (auto* queue : {&upload_queue_, &large_upload_queue_}) {
+    if (!queue->empty() && queue->front().fsck.valid()) {
+      queue->front().fsck.wait_for(std::chrono::milliseconds(100));
+      return;
+    }
+  }
+}
+
+void RequestPool::LaunchUpload(const OSTreeObject::ptr& request) {
+  const uintmax_t size = request->GetSize();
+  if (request->upload_offset() == 0) {
+    total_object_size_ += size;
+  }
+  const bool chunked = upload_chunk_size_ > 0 && size >= chunked_upload_size_ && !request->chunked_upload_failed();
+  request->Upload(server_, multi_, mode_, chunked ? upload_chunk_size_ : 0);
+  put_requests_made_++;
+  if (mode_ == RunMode::kDryRun || mode_ == RunMode::kWalkTree) {
+    // Don't send an actual upload message, just skip to the part where we
+    // acknowledge that the object has been uploaded.
+    request->NotifyParents(*this);
+  } else if (request->GetSize() >= kLargeObjectSize) {
+    large_uploads_running_++;
+  }
+  running_requests_++;
+}
+
+void RequestPool::LoopLaunch() {
+  // Copies go out in batches: once a batch is full, or when there are no
+  // more queries that could add to it for now.
+  while (!stopped_ &&
+         (copy_queue_.size() >= ServerCopy::kBatchSize || (!copy_queue_.empty() && query_queue_.empty()))) {
+    CopyOnServer();
+  }
+  // Queries first, small uploads second and large uploads last, as long as
+  // they leave room for the others.
+  while (running_requests_ < rate_controller_.MaxConcurrency()) {
+    OSTreeObject::ptr cur;
+    if (!query_queue_.empty()) {
       cur = query_queue_.front();
       query_queue_.pop_front();
+      if (KnownPresent(*cur)) {
+        // Answered locally, so it doesn't count against the running requests.
+        cached_presence_hits_++;
+        if (stats_ != nullptr) {
+          stats_->ObjectPresent(cur->type(), true);
+        }
+        cur->MarkPresent(*this);
+        continue;
+      }
       cur->MakeTestRequest(server_, multi_);
       head_requests_made_++;
+      running_requests_++;
+    } else if (!upload_queue_.empty() && TakeUpload(upload_queue_, &cur)) {
+      LaunchUpload(cur);
+    } else if (!large_upload_queue_.empty() && large_uploads_running_ < LargeUploadSlots() &&
+               TakeUpload(large_upload_queue_, &cur)) {
+      LaunchUpload(cur);
+    } else {
+      break;
     }
-
-    running_requests_++;
+  }
+  if (running_requests_ == 0 && !stopped_) {
+    WaitForFsck();
   }
 }
 
@@ -155,11 +308,32 @@ void RequestPool::LoopListen() {
     CURLMsg* msg = curl_multi_info_read(multi_, &msgs_in_queue);
     if ((msg != nullptr) && msg->msg == CURLMSG_DONE) {
       OSTreeObject::ptr completed_object = ostree_object_from_curl(msg->easy_handle);
+      uintmax_t bytes = 0;
+      if (completed_object->operation() == CurrentOp::kOstreeObjectUploading) {
+        // Each chunk of a large object counts as it completes, so throughput
+        // measurements don't wait for the whole object.
+        bytes = completed_object->upload_length();
+        if (completed_object->GetSize() >= kLargeObjectSize) {
+          large_uploads_running_--;
+        }
+      }
+      const CurrentOp operation = completed_object->operation();
       completed_object->CurlDone(multi_, *this);
       auto start_time = completed_object->RequestStartTime();
       auto end_time = RateController::clock::now();
       bool server_responded_ok = completed_object->LastOperationResult() == ServerResponse::kOk;
-      rate_controller_.RequestCompleted(start_time, end_time, server_responded_ok);
+      rate_controller_.RequestCompleted(start_time, end_time, server_responded_ok, bytes);
+      if (stats_ != nullptr) {
+        stats_->RequestCompleted(operation, start_time, end_time, server_responded_ok, bytes);
+        stats_->Concurrency(rate_controller_.MaxConcurrency(), end_time);
+        if (completed_object->is_on_server() == PresenceOnServer::kObjectPresent) {
+          if (operation == CurrentOp::kOstreeObjectUploading) {
+            stats_->ObjectUploaded(completed_object->type(), completed_object->GetSize());
+          } else {
+            stats_->ObjectPresent(completed_object->type(), false);
+          }
+        }
+      }
 
       if (rate_controller_.ServerHasFailed()) {
         Abort();
@@ -169,6 +343,9 @@ void RequestPool::LoopListen() {
           LOG_DEBUG << "Sleeping for " << std::chrono::duration_cast<std::chrono::seconds>(duration).count()
                     << " seconds due to server congestion.";
           std::this_thread::sleep_for(duration);
+          if (stats_ != nullptr) {
+            stats_->Slept(duration);
+          }
         }
       }
     }
@@ -1,17 +1,33 @@
 #ifndef SOTA_CLIENT_TOOLS_REQUEST_POOL_H_
 #define SOTA_CLIENT_TOOLS_REQUEST_POOL_H_
 
+#include <future>
 #include <list>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <curl/curl.h>
 
+#include "fsck_pool.h"
 #include "garage_common.h"
 #include "ostree_object.h"
+#include "presence_cache.h"
 #include "rate_controller.h"
+#include "server_copy.h"
+#include "transfer_stats.h"
 
 class RequestPool {
  public:
-  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload);
+  static constexpr uintmax_t kLargeObjectSize = 1024 * 1024;
+  /* Objects of at least this size are uploaded in chunks of kUploadChunkSize,
+   * so that a dropped connection only costs the chunk it interrupted. The
+   * chunk protocol is a proposal, see OSTreeObject::Upload(). */
+  static constexpr uintmax_t kChunkedUploadSize = 64 * 1024 * 1024;
+  static constexpr uintmax_t kUploadChunkSize = 16 * 1024 * 1024;
+
+  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload,
+              PresenceCache* presence_cache = nullptr, ServerCopy* server_copy = nullptr);
   ~RequestPool();
   // Non-Copyable, Non-Movable
   RequestPool(const RequestPool&) = delete;
@@ -21,15 +37,49 @@ class RequestPool {
 
   void AddQuery(const OSTreeObject::ptr& request);
   void AddUpload(const OSTreeObject::ptr& request);
+  /* Queue the next chunk of an upload (or a failed chunk again), ahead of the
+   * uploads that haven't started yet and without checking the object again. */
+  void ContinueUpload(const OSTreeObject::ptr& request);
+  /* The server rejected a chunked upload: send whole objects from now on. */
+  void DisableChunkedUploads() { upload_chunk_size_ = 0; }
+  void chunked_uploads(uintmax_t min_object_size, uintmax_t chunk_size) {
+    chunked_upload_size_ = min_object_size;
+    upload_chunk_size_ = chunk_size;
+  }
   void Abort() {
     stopped_ = true;
     query_queue_.clear();
     upload_queue_.clear();
+    large_upload_queue_.clear();
+    copy_queue_.clear();
   };
-  bool is_idle() const { return query_queue_.empty() && upload_queue_.empty() && running_requests_ == 0; }
+  bool is_idle() const {
+    return query_queue_.empty() && upload_queue_.empty() && large_upload_queue_.empty() && copy_queue_.empty() &&
+           running_requests_ == 0;
+  }
   bool is_stopped() const { return stopped_; }
   RunMode run_mode() const { return mode_; }
 
+  /* Record that an object was confirmed to be on the server, so later pushes
+   * using the same presence cache don't have to query it again. While walking
+   * a tree, a cached commit or dirtree stands for its whole subtree, so those
+   * are only kept aside until FinishWalk(). */
+  void RecordPresent(const OSTreeObject& object);
+  /* Record that an object is missing on the server during a walk. */
+  void RecordMissing() { walk_complete_ = false; }
+  /* Add the commits and dirtrees confirmed during the walk to the presence
+   * cache, unless the walk was aborted or found anything missing. */
+  void FinishWalk();
+  /* Record the time spent reading an object for its children. */
+  void RecordWalk(RateController::clock::duration spent) {
+    if (stats_ != nullptr) {
+      stats_->Walked(spent);
+    }
+  }
+
+  /* Statistics to add the transfers of this pool to, none if null. */
+  void stats(TransferStats* stats) { stats_ = stats; }
+
   /**
    * One iteration of request-listen loop, launches multiple requests, then
    * listens for the result.
@@ -41,23 +91,60 @@ class RequestPool {
    */
   int put_requests_made() const { return put_requests_made_; }
   int head_requests_made() const { return head_requests_made_; }
+  /* The number of presence queries answered by the presence cache. */
+  int cached_presence_hits() const { return cached_presence_hits_; }
   uintmax_t total_object_size() const { return total_object_size_; }
 
  private:
   void LoopLaunch();  // launches multiple requests from the queues
   void LoopListen();  // listens to the result of launched requests
+  struct PendingUpload {
+    OSTreeObject::ptr object;
+    // Integrity check running in fsck_pool_, invalid if not requested
+    std::future<bool> fsck;
+  };
+
+  /* Take the upload at the front of queue if its integrity check is done. */
+  bool TakeUpload(std::list<PendingUpload>& queue, OSTreeObject::ptr* request);
+  /* With nothing on the wire, block briefly until the next check finishes. */
+  void WaitForFsck();
+  void LaunchUpload(const OSTreeObject::ptr& request);
+  /* The number of connections large uploads may occupy at the same time. */
+  int LargeUploadSlots() const;
+  bool KnownPresent(const OSTreeObject& object) const;
+  /* Ask the server to copy a batch of the objects not fetched yet, then fetch
+   * and queue for upload the ones it didn't copy. */
+  void CopyOnServer();
 
   RateController rate_controller_;
   int running_requests_;
   int head_requests_made_{0};
   int put_requests_made_{0};
+  int cached_presence_hits_{0};
   uintmax_t total_object_size_{0};
   TreehubServer& server_;
   CURLM* multi_;
   std::list<OSTreeObject::ptr> query_queue_;
-  std::list<OSTreeObject::ptr> upload_queue_;
+  std::list<PendingUpload> upload_queue_;
+  // Objects of at least kLargeObjectSize are kept apart, so a few huge files
+  // can't hold up the many small metadata and file objects of a tree.
+  std::list<PendingUpload> large_upload_queue_;
+  int large_uploads_running_{0};
+  uintmax_t chunked_upload_size_{kChunkedUploadSize};
+  // 0 if chunked uploads are off
+  uintmax_t upload_chunk_size_{kUploadChunkSize};
   RunMode mode_;
   bool fsck_on_upload_;
+  std::unique_ptr<FsckPool> fsck_pool_;
+  PresenceCache* presence_cache_;
+  ServerCopy* server_copy_;
+  TransferStats* stats_{nullptr};
+  // Objects the source repository deferred fetching of (see
+  // OSTreeRepo::defer_file_objects()), waiting for a server-side copy.
+  std::vector<OSTreeObject::ptr> copy_queue_;
+  // Tree objects confirmed present during a walk, see RecordPresent().
+  std::vector<std::pair<OSTreeHash, OstreeObjectType>> walk_present_;
+  bool walk_complete_{true};
   bool stopped_;
 };
 // vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,80 @@
+#include "server_copy.h"
+
+#include <curl/curl.h>
+
+#include "json/json.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace {
+size_t writeString(void *contents, size_t size, size_t nmemb, void *userp) {
+  (static_cast<std::string *>(userp))->append(static_cast<char *>(contents), size * nmemb);
+  return size * nmemb;
+}
+}  // namespace
+
+std::set<std::string> ServerCopy::Copy(const std::vector<std::string> &objects) {
+  std::set<std::string> copied;
+  if (!supported_ || objects.empty()) {
+    return copied;
+  }
+
+  Json::Value request;
+  request["source"] = source_url_;
+  request["objects"] = Json::Value(Json::arrayValue);
+  for (const auto &object : objects) {
+    request["objects"].append(object);
+  }
+  const std::string body = Utils::jsonToStr(request);
+
+  CurlEasyWrapper curl;
+  std::string response;
+  curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  push_server_.SetContentType("Content-Type: application/json");
+  push_server_.InjectIntoCurl("objects/copy", curl.get());
+  curlEasySetoptWrapper(curl.get(), CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(curl.get(), CURLOPT_POSTFIELDS, body.c_str());
+  curlEasySetoptWrapper(curl.get(), CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));  // NOLINT
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, &response);
+  const CURLcode err = curl_easy_perform(curl.get());
+  // Uploads set their own content type, but don't leave them a surprise.
+  push_server_.SetContentType("Content-Type: application/octet-stream");
+  requests_made_++;
+
+  if (err != CURLE_OK) {
+    LOG_WARNING << "Server-side copy failed: " << curl_easy_strerror(err) << ", uploading the objects instead";
+    return copied;
+  }
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &rescode);
+  if (rescode == 404 || rescode == 405 || rescode == 501) {
+    LOG_INFO << "Treehub does not support server-side copies, uploading objects instead";
+    supported_ = false;
+    return copied;
+  }
+  if (rescode != 200) {
+    LOG_WARNING << "Server-side copy reported an error code: " << rescode << ", uploading the objects instead";
+    LOG_DEBUG << response;
+    return copied;
+  }
+
+  try {
+    const Json::Value result = Utils::parseJSON(response);
+    const std::set<std::string> requested(objects.cbegin(), objects.cend());
+    for (const auto &object : result["copied"]) {
+      // Only trust the server about what was asked for.
+      if (object.isString() && requested.count(object.asString()) != 0) {
+        copied.insert(object.asString());
+      }
+    }
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Invalid answer to a server-side copy: " << e.what();
+    copied.clear();
+  }
+  objects_copied_ += static_cast<int>(copied.size());
+  LOG_DEBUG << "Server copied " << copied.size() << " of " << objects.size() << " objects";
+  return copied;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,54 @@
+#ifndef SOTA_CLIENT_TOOLS_SERVER_COPY_H_
+#define SOTA_CLIENT_TOOLS_SERVER_COPY_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "treehub_server.h"
+
+/**
+ * Asks the destination Treehub to copy objects straight from the source
+ * repository, so that a push between two repositories on the same backend
+ * doesn't download every object only to upload it again.
+ *
+ * This is a proposed API that Treehub does not implement yet, so it is only
+ * used when asked for with --server-copy. A server without it answers 404,
+ * 405 or 501 and all objects are transferred as usual.
+ *
+ * A batch of objects is sent as a POST to objects/copy of the destination:
+ *   {"source": "<source repository URL>", "objects": ["ab/cdef....filez", ...]}
+ * and the server answers with the objects it now has:
+ *   {"copied": ["ab/cdef....filez", ...]}
+ * Objects that were not copied, e.g. because the caller can't read them in
+ * the source repository, have to be uploaded as usual.
+ */
+class ServerCopy {
+ public:
+  /* Objects per copy request. */
+  static constexpr size_t kBatchSize = 100;
+
+  ServerCopy(TreehubServer &push_server, std::string source_url)
+      : push_server_(push_server), source_url_(std::move(source_url)) {}
+
+  /**
+   * Copy a batch of objects, given by their paths below objects/, and return
+   * those that are on the destination server now. Once the server turns out
+   * not to support copies, it isn't asked again and nothing is copied.
+   */
+  std::set<std::string> Copy(const std::vector<std::string> &objects);
+
+  bool supported() const { return supported_; }
+  int requests_made() const { return requests_made_; }
+  int objects_copied() const { return objects_copied_; }
+
+ private:
+  TreehubServer &push_server_;
+  const std::string source_url_;
+  bool supported_{true};
+  int requests_made_{0};
+  int objects_copied_{0};
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_SERVER_COPY_H_
@@ -0,0 +1,137 @@
+#include "transfer_stats.h"
+
+#include <exception>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+constexpr std::chrono::seconds TransferStats::kThroughputInterval;
+
+namespace {
+const char *TypeName(const OstreeObjectType type) {
+  switch (type) {
+    case OSTREE_OBJECT_TYPE_FILE:
+      return "file";
+    case OSTREE_OBJECT_TYPE_DIR_TREE:
+      return "dirtree";
+    case OSTREE_OBJECT_TYPE_DIR_META:
+      return "dirmeta";
+    case OSTREE_OBJECT_TYPE_COMMIT:
+      return "commit";
+    default:
+      return "unknown";
+  }
+}
+}  // namespace
+
+void TransferStats::RequestCompleted(const CurrentOp operation, const clock::time_point start,
+                                     const clock::time_point end, const bool succeeded, const uintmax_t bytes) {
+  Phase &phase = operation == CurrentOp::kOstreeObjectUploading ? uploads_ : queries_;
+  if (phase.requests == 0 || start < phase.first) {
+    phase.first = start;
+  }
+  if (phase.requests == 0 || end > phase.last) {
+    phase.last = end;
+  }
+  phase.requests++;
+  phase.busy_sec += std::chrono::duration<double>(end - start).count();
+  if (!succeeded) {
+    phase.retries++;
+    return;
+  }
+  if (bytes > 0 && end >= start_) {
+    const auto bucket = static_cast<size_t>((end - start_) / kThroughputInterval);
+    if (throughput_.size() <= bucket) {
+      throughput_.resize(bucket + 1, 0);
+    }
+    throughput_[bucket] += bytes;
+  }
+}
+
+void TransferStats::ObjectPresent(const OstreeObjectType type, const bool from_cache) {
+  PerType &stats = types_[type];
+  stats.present++;
+  if (from_cache) {
+    stats.cached++;
+  }
+}
+
+void TransferStats::ObjectUploaded(const OstreeObjectType type, const uintmax_t size) {
+  PerType &stats = types_[type];
+  stats.uploaded++;
+  stats.bytes += size;
+}
+
+void TransferStats::ObjectCopied(const OstreeObjectType type) { types_[type].copied++; }
+
+void TransferStats::Walked(const clock::duration spent) {
+  walked_++;
+  walk_sec_ += std::chrono::duration<double>(spent).count();
+}
+
+void TransferStats::Slept(const clock::duration spent) { sleep_sec_ += std::chrono::duration<double>(spent).count(); }
+
+void TransferStats::Concurrency(const int max_concurrency, const clock::time_point when) {
+  if (concurrency_.empty() || concurrency_.back().second != max_concurrency) {
+    concurrency_.emplace_back(Since(when), max_concurrency);
+  }
+}
+
+Json::Value TransferStats::PhaseToJson(const Phase &phase) const {
+  Json::Value result;
+  result["requests"] = phase.requests;
+  result["retries"] = phase.retries;
+  result["busy_sec"] = phase.busy_sec;
+  if (phase.requests > 0) {
+    result["first_sec"] = Since(phase.first);
+    result["last_sec"] = Since(phase.last);
+  }
+  return result;
+}
+
+Json::Value TransferStats::ToJson(const clock::time_point now) const {
+  Json::Value result;
+  result["duration_sec"] = Since(now);
+  result["phases"]["walk"]["objects"] = walked_;
+  result["phases"]["walk"]["sec"] = walk_sec_;
+  result["phases"]["queries"] = PhaseToJson(queries_);
+  result["phases"]["uploads"] = PhaseToJson(uploads_);
+  result["sleep_sec"] = sleep_sec_;
+
+  result["objects"] = Json::Value(Json::objectValue);
+  for (const auto &entry : types_) {
+    Json::Value &type = result["objects"][TypeName(entry.first)];
+    type["present"] = entry.second.present;
+    type["cached"] = entry.second.cached;
+    type["uploaded"] = entry.second.uploaded;
+    type["copied"] = entry.second.copied;
+    type["bytes"] = static_cast<Json::UInt64>(entry.second.bytes);
+  }
+
+  result["throughput"]["interval_sec"] = static_cast<Json::Int64>(kThroughputInterval.count());
+  result["throughput"]["bytes"] = Json::Value(Json::arrayValue);
+  for (const auto bytes : throughput_) {
+    result["throughput"]["bytes"].append(static_cast<Json::UInt64>(bytes));
+  }
+
+  result["concurrency"] = Json::Value(Json::arrayValue);
+  for (const auto &change : concurrency_) {
+    Json::Value entry;
+    entry["sec"] = change.first;
+    entry["max"] = change.second;
+    result["concurrency"].append(entry);
+  }
+  return result;
+}
+
+bool TransferStats::Save(const boost::filesystem::path &path) const {
+  try {
+    Utils::writeFile(path, ToJson());
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Could not write transfer statistics to " << path << ": " << e.what();
+    return false;
+  }
+  return true;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
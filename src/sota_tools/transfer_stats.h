@@ -0,0 +1,85 @@
+#ifndef SOTA_CLIENT_TOOLS_TRANSFER_STATS_H_
+#define SOTA_CLIENT_TOOLS_TRANSFER_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include "json/json.h"
+
+#include "garage_common.h"
+#include "ostree_object.h"
+
+/**
+ * Statistics of the transfers of a garage tool run, for machines rather than
+ * people: how long each phase took, what was found on the server, uploaded or
+ * copied per object type, the throughput over time, the retries and how the
+ * RateController changed the concurrency. Fed by RequestPool (see
+ * RequestPool::stats()); a run with several pools adds them up.
+ */
+class TransferStats {
+ public:
+  using clock = std::chrono::steady_clock;
+  /* Width of the throughput buckets. */
+  static constexpr std::chrono::seconds kThroughputInterval{1};
+
+  explicit TransferStats(clock::time_point start = clock::now()) : start_(start) {}
+
+  /* A presence query or upload request completed. Requests that failed are
+   * retried, so they count as retries. bytes is the payload uploaded. */
+  void RequestCompleted(CurrentOp operation, clock::time_point start, clock::time_point end, bool succeeded,
+                        uintmax_t bytes);
+  /* An object turned out to be on the server already, by asking it or from the
+   * presence cache. */
+  void ObjectPresent(OstreeObjectType type, bool from_cache);
+  void ObjectUploaded(OstreeObjectType type, uintmax_t size);
+  void ObjectCopied(OstreeObjectType type);
+  /* Time spent reading an object for its children, including fetching them
+   * from the source repository. */
+  void Walked(clock::duration spent);
+  /* The pool slept because the server was struggling. */
+  void Slept(clock::duration spent);
+  /* The RateController's concurrency limit, recorded whenever it changes. */
+  void Concurrency(int max_concurrency, clock::time_point when = clock::now());
+
+  Json::Value ToJson(clock::time_point now = clock::now()) const;
+  /* Write ToJson() to a file. Returns false on failure. */
+  bool Save(const boost::filesystem::path &path) const;
+
+ private:
+  struct Phase {
+    int requests{0};
+    int retries{0};
+    double busy_sec{0};
+    clock::time_point first;
+    clock::time_point last;
+  };
+  struct PerType {
+    int present{0};
+    int cached{0};
+    int uploaded{0};
+    int copied{0};
+    uintmax_t bytes{0};
+  };
+
+  double Since(clock::time_point t) const { return std::chrono::duration<double>(t - start_).count(); }
+  Json::Value PhaseToJson(const Phase &phase) const;
+
+  const clock::time_point start_;
+  Phase queries_;
+  Phase uploads_;
+  int walked_{0};
+  double walk_sec_{0};
+  double sleep_sec_{0};
+  std::map<OstreeObjectType, PerType> types_;
+  // Bytes uploaded per kThroughputInterval since start_
+  std::vector<uintmax_t> throughput_;
+  // (seconds since start_, concurrency limit)
+  std::vector<std::pair<double, int>> concurrency_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_TRANSFER_STATS_H_
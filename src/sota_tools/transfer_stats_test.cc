@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include "transfer_stats.h"
+
+/* Requests are summed up per phase, and failed ones count as retries. */
+TEST(TransferStats, Phases) {
+  const auto start = TransferStats::clock::now();
+  TransferStats stats(start);
+  const auto second = std::chrono::seconds(1);
+  stats.RequestCompleted(CurrentOp::kOstreeObjectPresenceCheck, start, start + second, true, 0);
+  stats.RequestCompleted(CurrentOp::kOstreeObjectPresenceCheck, start + second, start + 3 * second, false, 0);
+  stats.RequestCompleted(CurrentOp::kOstreeObjectUploading, start + 2 * second, start + 4 * second, true, 100);
+  stats.Walked(std::chrono::milliseconds(500));
+
+  const Json::Value json = stats.ToJson(start + 5 * second);
+  EXPECT_DOUBLE_EQ(json["duration_sec"].asDouble(), 5.0);
+  EXPECT_EQ(json["phases"]["queries"]["requests"].asInt(), 2);
+  EXPECT_EQ(json["phases"]["queries"]["retries"].asInt(), 1);
+  EXPECT_DOUBLE_EQ(json["phases"]["queries"]["busy_sec"].asDouble(), 3.0);
+  EXPECT_DOUBLE_EQ(json["phases"]["queries"]["first_sec"].asDouble(), 0.0);
+  EXPECT_DOUBLE_EQ(json["phases"]["queries"]["last_sec"].asDouble(), 3.0);
+  EXPECT_EQ(json["phases"]["uploads"]["requests"].asInt(), 1);
+  EXPECT_EQ(json["phases"]["uploads"]["retries"].asInt(), 0);
+  EXPECT_EQ(json["phases"]["walk"]["objects"].asInt(), 1);
+  EXPECT_DOUBLE_EQ(json["phases"]["walk"]["sec"].asDouble(), 0.5);
+}
+
+/* Objects are counted per type, and bytes per interval of their completion. */
+TEST(TransferStats, ObjectsAndThroughput) {
+  const auto start = TransferStats::clock::now();
+  TransferStats stats(start);
+  stats.ObjectPresent(OSTREE_OBJECT_TYPE_COMMIT, false);
+  stats.ObjectPresent(OSTREE_OBJECT_TYPE_FILE, true);
+  stats.ObjectUploaded(OSTREE_OBJECT_TYPE_FILE, 1000);
+  stats.ObjectUploaded(OSTREE_OBJECT_TYPE_FILE, 24);
+  stats.ObjectCopied(OSTREE_OBJECT_TYPE_FILE);
+  stats.RequestCompleted(CurrentOp::kOstreeObjectUploading, start, start + std::chrono::milliseconds(200), true, 1000);
+  stats.RequestCompleted(CurrentOp::kOstreeObjectUploading, start, start + std::chrono::milliseconds(2500), true, 24);
+
+  const Json::Value json = stats.ToJson(start + std::chrono::seconds(3));
+  EXPECT_EQ(json["objects"]["commit"]["present"].asInt(), 1);
+  EXPECT_EQ(json["objects"]["file"]["present"].asInt(), 1);
+  EXPECT_EQ(json["objects"]["file"]["cached"].asInt(), 1);
+  EXPECT_EQ(json["objects"]["file"]["uploaded"].asInt(), 2);
+  EXPECT_EQ(json["objects"]["file"]["bytes"].asUInt64(), 1024U);
+  EXPECT_EQ(json["objects"]["file"]["copied"].asInt(), 1);
+  EXPECT_FALSE(json["objects"].isMember("dirtree"));
+
+  ASSERT_EQ(json["throughput"]["bytes"].size(), 3U);
+  EXPECT_EQ(json["throughput"]["bytes"][0].asUInt64(), 1000U);
+  EXPECT_EQ(json["throughput"]["bytes"][1].asUInt64(), 0U);
+  EXPECT_EQ(json["throughput"]["bytes"][2].asUInt64(), 24U);
+}
+
+/* Only changes of the concurrency limit are recorded. */
+TEST(TransferStats, Concurrency) {
+  const auto start = TransferStats::clock::now();
+  TransferStats stats(start);
+  stats.Concurrency(1, start);
+  stats.Concurrency(2, start + std::chrono::seconds(1));
+  stats.Concurrency(2, start + std::chrono::seconds(2));
+  stats.Concurrency(1, start + std::chrono::seconds(3));
+
+  const Json::Value json = stats.ToJson(start + std::chrono::seconds(4));
+  ASSERT_EQ(json["concurrency"].size(), 3U);
+  EXPECT_EQ(json["concurrency"][1]["max"].asInt(), 2);
+  EXPECT_DOUBLE_EQ(json["concurrency"][1]["sec"].asDouble(), 1.0);
+  EXPECT_EQ(json["concurrency"][2]["max"].asInt(), 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
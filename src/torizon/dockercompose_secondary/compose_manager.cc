@@ -1,35 +1,252 @@
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <sstream>
+#include <thread>
+
 #include "compose_manager.h"
+#include "dockerofflineloader.h"
+#include "http/httpclient.h"
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
+#include "utilities/utils.h"
 
 static const char *const compose_cmd_prefix = "/usr/bin/docker-compose --file ";
 static const char *const docker_cmd_prefix = "/usr/bin/docker ";
 static const char *const check_rollback_cmd = "/usr/bin/fw_printenv rollback";
+static const char *const ionice_cmd = "/usr/bin/ionice";
 
 // In the future we may want to override the commands for testing.
-ComposeManager::ComposeManager()
-    : compose_cmd_{compose_cmd_prefix}, docker_cmd_{docker_cmd_prefix}, check_rollback_cmd_{check_rollback_cmd} {}
+ComposeManager::ComposeManager(size_t pull_concurrency, std::string docker_socket)
+    : compose_cmd_{compose_cmd_prefix},
+      docker_cmd_{docker_cmd_prefix},
+      check_rollback_cmd_{check_rollback_cmd},
+      pull_concurrency_{pull_concurrency},
+      docker_socket_{std::move(docker_socket)} {}
+
+ComposeManager::~ComposeManager() { stopCleanup(); }
 
 bool ComposeManager::pull(const boost::filesystem::path &compose_file, const api::FlowControlToken *flow_control) {
+  // A cleanup still running would not know about the images pulled now
+  stopCleanup();
+  if (pull_concurrency_ > 1) {
+    return pullParallel(compose_file, flow_control);
+  }
   LOG_INFO << "Running docker-compose pull";
   return CommandRunner::run(compose_cmd_ + compose_file.string() + " pull --no-parallel", flow_control);
 }
 
+/**
+ * Pull one image with POST /images/create. The daemon answers 200 right away
+ * and then streams one JSON object per line, so a failed pull shows up as an
+ * object with an "error" member.
+ */
+static bool pullImage(HttpClient &http, const std::string &image, const std::string &platform) {
+  std::string url = "http://localhost/images/create?fromImage=" + Utils::urlEncode(image);
+  // Without a tag or digest the daemon would pull every tag of the repository
+  const auto name_start = image.rfind('/');
+  const auto tag_pos = image.find_first_of(":@", name_start == std::string::npos ? 0 : name_start);
+  if (tag_pos == std::string::npos) {
+    url += "&tag=latest";
+  }
+  if (!platform.empty()) {
+    url += "&platform=" + Utils::urlEncode(platform);
+  }
+
+  LOG_INFO << "Pulling image " << image;
+  const HttpResponse response = http.post(url, "application/json", "");
+  if (!response.isOk()) {
+    LOG_ERROR << "Could not pull image " << image << ": " << response.getStatusStr();
+    return false;
+  }
+
+  std::set<std::string> downloaded;
+  std::set<std::string> present;
+  std::istringstream stream(response.body);
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    const Json::Value message = Utils::parseJSON(line);
+    if (message.isMember("error")) {
+      LOG_ERROR << "Could not pull image " << image << ": " << message["error"].asString();
+      return false;
+    }
+    const std::string status = message["status"].asString();
+    if (status == "Pull complete") {
+      downloaded.insert(message["id"].asString());
+    } else if (status == "Already exists") {
+      present.insert(message["id"].asString());
+    }
+  }
+  LOG_INFO << "Pulled image " << image << ": " << downloaded.size() << " layers downloaded, " << present.size()
+           << " already present";
+  return true;
+}
+
+bool ComposeManager::pullParallel(const boost::filesystem::path &compose_file,
+                                  const api::FlowControlToken *flow_control) const {
+  DockerComposeFile compose(compose_file);
+  StringToImagePlatformPair services;
+  if (!compose || !compose.getServices(services, false)) {
+    LOG_ERROR << "Could not read the services of " << compose_file;
+    return false;
+  }
+
+  // Services sharing an image pull it once. Layers shared between different
+  // images are only downloaded once by the daemon itself.
+  std::set<std::pair<std::string, std::string>> unique_images;
+  for (auto &service : services) {
+    unique_images.emplace(service.second.getImage(), service.second.getPlatform());
+  }
+  const std::vector<std::pair<std::string, std::string>> images(unique_images.begin(), unique_images.end());
+
+  LOG_INFO << "Pulling " << images.size() << " images, " << pull_concurrency_ << " at a time";
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto worker = [&]() {
+    HttpClient http(docker_socket_);
+    for (size_t i = next++; i < images.size(); i = next++) {
+      if (failed || (flow_control != nullptr && flow_control->hasAborted())) {
+        return;
+      }
+      if (!pullImage(http, images[i].first, images[i].second)) {
+        failed = true;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  const size_t num_workers = std::min(pull_concurrency_, images.size());
+  workers.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    LOG_INFO << "Image pull aborted";
+    return false;
+  }
+  return !failed;
+}
+
 bool ComposeManager::up(const boost::filesystem::path &compose_file) {
   LOG_INFO << "Running docker-compose up";
   return CommandRunner::run(compose_cmd_ + compose_file.string() + " -p torizon up --detach --remove-orphans");
 }
 
-bool ComposeManager::down(const boost::filesystem::path &compose_file) {
-  LOG_INFO << "Running docker-compose down";
-  return CommandRunner::run(compose_cmd_ + compose_file.string() + " -p torizon down");
+bool ComposeManager::update(const boost::filesystem::path &old_file, const boost::filesystem::path &new_file) {
+  DockerComposeFile old_compose(old_file);
+  DockerComposeFile new_compose(new_file);
+  StringToImagePlatformPair old_services;
+  StringToImagePlatformPair new_services;
+  if (old_compose && new_compose && old_compose.getServices(old_services, false) &&
+      new_compose.getServices(new_services, false)) {
+    // Only informative: the decision of what to recreate is left to docker-compose, which also compares the
+    // configuration of each service and the image each container was created from.
+    std::string changed;
+    size_t unchanged = 0;
+    for (auto &service : new_services) {
+      auto old_it = old_services.find(service.first);
+      if (old_it != old_services.end() && old_it->second.getImage() == service.second.getImage() &&
+          old_it->second.getPlatform() == service.second.getPlatform()) {
+        ++unchanged;
+      } else {
+        changed += " " + service.first;
+      }
+    }
+    for (const auto &service : old_services) {
+      if (new_services.count(service.first) == 0) {
+        changed += " " + service.first + "(removed)";
+      }
+    }
+    LOG_INFO << "Services with a new image:" << (changed.empty() ? " none" : changed) << "; " << unchanged
+             << " with the same image";
+  }
+  return up(new_file);
 }
 
-bool ComposeManager::cleanup() {
-  LOG_INFO << "Removing not used containers, networks and images";
-  return CommandRunner::run(docker_cmd_ + "system prune -a --force");
+bool ComposeManager::cleanup(const std::vector<boost::filesystem::path> &compose_files) {
+  // The compose files may be renamed or removed right after this call, so
+  // they are read before going to the background
+  std::set<std::string> keep_images;
+  for (const auto &compose_file : compose_files) {
+    if (!boost::filesystem::exists(compose_file)) {
+      continue;
+    }
+    DockerComposeFile compose(compose_file);
+    StringToImagePlatformPair services;
+    if (!compose || !compose.getServices(services, false)) {
+      // Better keep everything than remove images that are still needed
+      LOG_ERROR << "Could not read the services of " << compose_file << ", not removing any images";
+      return false;
+    }
+    for (auto &service : services) {
+      keep_images.insert(service.second.getImage());
+    }
+  }
+
+  stopCleanup();
+  std::lock_guard<std::mutex> guard(gc_mutex_);
+  gc_stop_ = false;
+  gc_thread_ = std::thread([this, keep_images]() { collectGarbage(keep_images); });
+  return true;
+}
+
+void ComposeManager::waitForCleanup() {
+  if (gc_thread_.joinable()) {
+    gc_thread_.join();
+  }
+}
+
+void ComposeManager::stopCleanup() {
+  {
+    std::lock_guard<std::mutex> guard(gc_mutex_);
+    gc_stop_ = true;
+  }
+  gc_cv_.notify_all();
+  waitForCleanup();
+}
+
+void ComposeManager::collectGarbage(const std::set<std::string> &keep_images) {
+  // Docker commands run in the idle I/O scheduling class where available
+  const std::string docker_cmd =
+      boost::filesystem::exists(ionice_cmd) ? std::string(ionice_cmd) + " -c3 " + docker_cmd_ : docker_cmd_;
+
+  LOG_INFO << "Removing not used containers and networks";
+  CommandRunner::run(docker_cmd + "container prune --force");
+  CommandRunner::run(docker_cmd + "network prune --force");
+
+  std::set<std::string> keep_ids;
+  for (const auto &image : keep_images) {
+    for (const auto &id : CommandRunner::runResult(docker_cmd + "image inspect --format {{.Id}} " + image)) {
+      keep_ids.insert(id);
+    }
+  }
+
+  size_t removed = 0;
+  for (const auto &id : CommandRunner::runResult(docker_cmd + "image ls --quiet --no-trunc")) {
+    if (keep_ids.count(id) != 0) {
+      continue;
+    }
+    {
+      std::unique_lock<std::mutex> lock(gc_mutex_);
+      if (gc_cv_.wait_for(lock, kImageRemovalInterval, [this]() { return gc_stop_; })) {
+        LOG_DEBUG << "Image cleanup interrupted";
+        return;
+      }
+    }
+    // Images still used by a container are refused by the daemon, which is fine
+    if (CommandRunner::run(docker_cmd + "image rm " + id)) {
+      ++removed;
+    }
+  }
+  LOG_INFO << "Removed " << removed << " unused images, kept " << keep_ids.size();
 }
 
 bool ComposeManager::checkRollback() {
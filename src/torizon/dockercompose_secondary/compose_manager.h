@@ -2,25 +2,69 @@
 #define COMPOSE_MANAGER_H_
 
 #include <boost/filesystem/path.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 #include "command_runner.h"
 #include "libaktualizr/types.h"
 #include "utilities/flow_control.h"
 
 class ComposeManager {
  public:
-  ComposeManager();
+  static constexpr const char *const kDefaultDockerSocket = "/var/run/docker.sock";
+
+  /**
+   * With a pull concurrency above 1, images are pulled through the Docker
+   * Engine API on `docker_socket`, that many at a time. Otherwise
+   * docker-compose pulls them one after another.
+   */
+  explicit ComposeManager(size_t pull_concurrency = 1, std::string docker_socket = kDefaultDockerSocket);
+  ~ComposeManager();
+  ComposeManager(const ComposeManager &) = delete;
+  ComposeManager(ComposeManager &&) = delete;
+  ComposeManager &operator=(const ComposeManager &) = delete;
+  ComposeManager &operator=(ComposeManager &&) = delete;
 
   bool pull(const boost::filesystem::path &compose_file, const api::FlowControlToken *flow_control);
   bool up(const boost::filesystem::path &compose_file);
-  bool down(const boost::filesystem::path &compose_file);
-  bool cleanup();
+  /**
+   * Switch the running project from `old_file` to `new_file` without taking
+   * it down first: docker-compose only recreates the services whose image or
+   * configuration changed and removes the ones that are gone, so the other
+   * services keep running.
+   */
+  bool update(const boost::filesystem::path &old_file, const boost::filesystem::path &new_file);
+  /**
+   * Remove stopped containers, unused networks and every image that is not
+   * referenced by one of `compose_files`. The removal runs in the background,
+   * one image at a time, and a new call cancels a cleanup still in progress.
+   */
+  bool cleanup(const std::vector<boost::filesystem::path> &compose_files);
+  /** Wait for a background cleanup to finish. */
+  void waitForCleanup();
   bool checkRollback();
 
  private:
   const std::string compose_cmd_;
   const std::string docker_cmd_;
   const std::string check_rollback_cmd_;
+  const size_t pull_concurrency_;
+  const std::string docker_socket_;
+
+  bool pullParallel(const boost::filesystem::path &compose_file, const api::FlowControlToken *flow_control) const;
+  void collectGarbage(const std::set<std::string> &keep_images);
+  void stopCleanup();
+
+  // Pause between two image removals, so that cleanup does not compete with the applications for I/O
+  static constexpr std::chrono::seconds kImageRemovalInterval{1};
+  std::thread gc_thread_;
+  std::mutex gc_mutex_;
+  std::condition_variable gc_cv_;
+  bool gc_stop_{false};
 };
 
 #endif  // COMPOSE_MANAGER_H_
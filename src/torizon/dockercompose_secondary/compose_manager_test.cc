@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "compose_manager.h"
+#include "http/httpclient.h"
+#include "logging/logging.h"
+#include "utilities/flow_control.h"
+#include "utilities/utils.h"
+
+/**
+ * A fake Docker daemon answering image pulls on a Unix socket, which each
+ * take 300 ms.
+ */
+class FakeDockerEngine {
+ public:
+  FakeDockerEngine()
+      : socket_{(temp_dir_ / "docker.sock").string()},
+        process_{"tests/fake_http_server/fake_docker_engine.py", socket_} {
+    for (int i = 0; i < 100 && !boost::filesystem::exists(socket_); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+  ~FakeDockerEngine() {
+    process_.terminate();
+    process_.wait_for(std::chrono::seconds(10));
+  }
+  FakeDockerEngine(const FakeDockerEngine &) = delete;
+  FakeDockerEngine(FakeDockerEngine &&) = delete;
+  FakeDockerEngine &operator=(const FakeDockerEngine &) = delete;
+  FakeDockerEngine &operator=(FakeDockerEngine &&) = delete;
+
+  const std::string &socket() const { return socket_; }
+  /** The images pulled so far, sorted, and the most pulls that ran at the same time. */
+  Json::Value stats() const {
+    HttpClient http(socket_);
+    return http.get("http://localhost/stats", HttpInterface::kNoLimit, nullptr).getJson();
+  }
+
+ private:
+  TemporaryDirectory temp_dir_;
+  const std::string socket_;
+  boost::process::child process_;
+};
+
+static boost::filesystem::path writeCompose(const TemporaryDirectory &dir, const std::string &services) {
+  const boost::filesystem::path path = dir / "docker-compose.yml";
+  Utils::writeFile(path, "version: '3'\nservices:\n" + services);
+  return path;
+}
+
+/* Each image is pulled once, through the Engine API, up to the pull concurrency at a time. */
+TEST(ComposeManager, PullParallel) {
+  FakeDockerEngine engine;
+  TemporaryDirectory temp_dir;
+  const auto compose = writeCompose(temp_dir,
+                                    "  a:\n    image: registry/a:1\n"
+                                    "  b:\n    image: registry/b:1\n"
+                                    "  c:\n    image: registry/c:1\n"
+                                    "  d:\n    image: registry/a:1\n");
+
+  ComposeManager manager(2, engine.socket());
+  EXPECT_TRUE(manager.pull(compose, nullptr));
+  const Json::Value stats = engine.stats();
+  ASSERT_EQ(stats["pulled"].size(), 3U);
+  EXPECT_EQ(stats["pulled"][0].asString(), "registry/a:1");
+  EXPECT_EQ(stats["pulled"][1].asString(), "registry/b:1");
+  EXPECT_EQ(stats["pulled"][2].asString(), "registry/c:1");
+  EXPECT_EQ(stats["max_active"].asInt(), 2);
+}
+
+/* An image that fails to pull, reported in the stream of the daemon, fails the whole pull. */
+TEST(ComposeManager, PullParallelFailure) {
+  FakeDockerEngine engine;
+  TemporaryDirectory temp_dir;
+  const auto compose = writeCompose(temp_dir,
+                                    "  a:\n    image: registry/a:1\n"
+                                    "  b:\n    image: registry/broken:1\n");
+
+  ComposeManager manager(2, engine.socket());
+  EXPECT_FALSE(manager.pull(compose, nullptr));
+}
+
+/* Nothing is pulled once the pull is aborted. */
+TEST(ComposeManager, PullParallelAborted) {
+  FakeDockerEngine engine;
+  TemporaryDirectory temp_dir;
+  const auto compose = writeCompose(temp_dir,
+                                    "  a:\n    image: registry/a:1\n"
+                                    "  b:\n    image: registry/b:1\n");
+
+  api::FlowControlToken token;
+  token.setAbort();
+  ComposeManager manager(2, engine.socket());
+  EXPECT_FALSE(manager.pull(compose, &token));
+  EXPECT_EQ(engine.stats()["pulled"].size(), 0U);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  return RUN_ALL_TESTS();
+}
+#endif
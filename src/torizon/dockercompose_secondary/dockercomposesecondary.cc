@@ -27,6 +27,15 @@ DockerComposeSecondaryConfig::DockerComposeSecondaryConfig(const Json::Value& js
   firmware_path = json_config["firmware_path"].asString();
   target_name_path = json_config["target_name_path"].asString();
   metadata_path = json_config["metadata_path"].asString();
+  if (json_config.isMember("pull_concurrency")) {
+    pull_concurrency = json_config["pull_concurrency"].asUInt();
+  }
+  if (json_config.isMember("load_concurrency")) {
+    load_concurrency = json_config["load_concurrency"].asUInt();
+  }
+  if (json_config.isMember("docker_socket")) {
+    docker_socket = json_config["docker_socket"].asString();
+  }
 }
 
 std::vector<DockerComposeSecondaryConfig> DockerComposeSecondaryConfig::create_from_file(
@@ -57,6 +66,9 @@ void DockerComposeSecondaryConfig::dump(const boost::filesystem::path& file_full
   json_config["firmware_path"] = firmware_path.string();
   json_config["target_name_path"] = target_name_path.string();
   json_config["metadata_path"] = metadata_path.string();
+  json_config["pull_concurrency"] = static_cast<Json::UInt>(pull_concurrency);
+  json_config["load_concurrency"] = static_cast<Json::UInt>(load_concurrency);
+  json_config["docker_socket"] = docker_socket;
 
   Json::Value root;
   root[Type].append(json_config);
@@ -72,7 +84,9 @@ void DockerComposeSecondaryConfig::dump(const boost::filesystem::path& file_full
 }
 
 DockerComposeSecondary::DockerComposeSecondary(Primary::DockerComposeSecondaryConfig sconfig_in)
-    : ManagedSecondary(std::move(sconfig_in)) {}
+    : ManagedSecondary(sconfig_in),
+      compose_manager_(sconfig_in.pull_concurrency, sconfig_in.docker_socket),
+      load_concurrency_(sconfig_in.load_concurrency) {}
 
 data::InstallationResult DockerComposeSecondary::sendFirmware(const Uptane::Target& target,
                                                               const InstallInfo& install_info,
@@ -139,14 +153,10 @@ data::InstallationResult DockerComposeSecondary::install(const Uptane::Target& t
     return {data::ResultCode::Numeric::kNeedCompletion, ""};
   }
 
-  if (boost::filesystem::exists(composeFile())) {
-    if (!compose_manager_.down(composeFile())) {
-      LOG_ERROR << "docker-compose down of old image failed";
-      return {data::ResultCode::Numeric::kInstallFailed, "Docker compose down failed"};
-    }
-  }
-
-  if (!compose_manager_.up(composeFileNew())) {
+  // Services that did not change keep running while the others are recreated.
+  const bool up_ok = boost::filesystem::exists(composeFile()) ? compose_manager_.update(composeFile(), composeFileNew())
+                                                               : compose_manager_.up(composeFileNew());
+  if (!up_ok) {
     // Attempt recovery
     const char* description;
     if (!boost::filesystem::exists(composeFile())) {
@@ -165,13 +175,13 @@ data::InstallationResult DockerComposeSecondary::install(const Uptane::Target& t
       LOG_WARNING << "docker-compose up of new image failed, recovered via docker-compose up on the old image";
       description = "Docker compose up failed (restore ok)";
       // Only clean up old images on this somewhat-happy path.
-      compose_manager_.cleanup();
+      compose_manager_.cleanup({composeFile(), composeFileNew()});
     }
     boost::filesystem::remove(composeFileNew());
     return {data::ResultCode::Numeric::kInstallFailed, description};
   }
 
-  compose_manager_.cleanup();
+  compose_manager_.cleanup({composeFile(), composeFileNew()});
   // Rename after cleanup, because the temporary file existence tells us that cleanup() is needed.
   boost::filesystem::rename(composeFileNew(), composeFile());
   Utils::writeFile(sconfig.target_name_path, target.filename());
@@ -218,7 +228,7 @@ boost::optional<data::InstallationResult> DockerComposeSecondary::completePendin
   }
 
   // Install was OK
-  compose_manager_.cleanup();
+  compose_manager_.cleanup({composeFile(), composeFileNew()});
   // Rename after cleanup, because the temporary file existence tells us that cleanup() is needed.
   boost::filesystem::rename(composeFileNew(), composeFile());
   Utils::writeFile(sconfig.target_name_path, target.filename());
@@ -250,7 +260,7 @@ void DockerComposeSecondary::rollbackPendingInstall() {
     // delete composeFileNew() so systemd will start docker-compose
     // automatically next time.
     compose_manager_.up(composeFile());
-    compose_manager_.cleanup();
+    compose_manager_.cleanup({composeFile(), composeFileNew()});
     boost::filesystem::remove(composeFileNew());
   } else {
     // In this case (following on from above):
@@ -284,7 +294,7 @@ void DockerComposeSecondary::cleanStartup() {
     if (boost::filesystem::exists(composeFile())) {  // A fresh image won't have an old compose file
       compose_manager_.up(composeFile());
     }
-    compose_manager_.cleanup();
+    compose_manager_.cleanup({composeFile(), composeFileNew()});
     // Remove after cleanup, because its existence tells us that cleanup() is needed.
     boost::filesystem::remove(composeFileNew());
   }
@@ -303,9 +313,14 @@ bool DockerComposeSecondary::loadDockerImages(const boost::filesystem::path& com
   compose_new.replace_extension(".off");
 
   try {
-    auto dmcache = std::make_shared<DockerManifestsCache>(manifests_path);
+    // Manifests are content-addressed, so one cache serves all updates and retries
+    if (manifests_cache_ == nullptr) {
+      manifests_cache_ = std::make_shared<DockerManifestsCache>(manifests_path);
+    } else {
+      manifests_cache_->setManifestsDir(manifests_path);
+    }
 
-    DockerComposeOfflineLoader dcloader(images_path, dmcache);
+    DockerComposeOfflineLoader dcloader(images_path, manifests_cache_, load_concurrency_);
     dcloader.loadCompose(compose_in, compose_sha256);
     dcloader.dumpReferencedImages();
     dcloader.dumpImageMapping();
@@ -2,12 +2,15 @@
 #define PRIMARY_DOCKERCOMPOSESECONDARY_H_
 
 #include <boost/filesystem.hpp>
+#include <memory>
 #include <string>
 
 #include "compose_manager.h"
 #include "libaktualizr/types.h"
 #include "managedsecondary.h"
 
+class DockerManifestsCache;
+
 namespace Primary {
 
 class DockerComposeSecondaryConfig : public ManagedSecondaryConfig {
@@ -19,6 +22,12 @@ class DockerComposeSecondaryConfig : public ManagedSecondaryConfig {
 
   static std::vector<DockerComposeSecondaryConfig> create_from_file(const boost::filesystem::path& file_full_path);
   void dump(const boost::filesystem::path& file_full_path) const;
+
+  // Images pulled in parallel through the Docker Engine API (1 to let docker-compose pull them one by one)
+  size_t pull_concurrency{1};
+  // Images of an offline update fed to `docker load` in parallel
+  size_t load_concurrency{1};
+  std::string docker_socket{ComposeManager::kDefaultDockerSocket};
 };
 
 /**
@@ -53,10 +62,9 @@ class DockerComposeSecondary : public ManagedSecondary {
   /**
    * Load Docker images from an offline-update image.
    */
-  static bool loadDockerImages(const boost::filesystem::path& compose_in, const std::string& compose_sha256,
-                               const boost::filesystem::path& images_path,
-                               const boost::filesystem::path& manifests_path,
-                               boost::filesystem::path* compose_out = nullptr);
+  bool loadDockerImages(const boost::filesystem::path& compose_in, const std::string& compose_sha256,
+                        const boost::filesystem::path& images_path, const boost::filesystem::path& manifests_path,
+                        boost::filesystem::path* compose_out = nullptr);
 
   /**
    * The name of the docker-compose file that we are managing
@@ -76,7 +84,9 @@ class DockerComposeSecondary : public ManagedSecondary {
     return res;
   }
 
-  ComposeManager compose_manager_{};
+  ComposeManager compose_manager_;
+  const size_t load_concurrency_;
+  std::shared_ptr<DockerManifestsCache> manifests_cache_;
 };
 
 }  // namespace Primary
@@ -6,19 +6,27 @@
 
 #include <sys/utsname.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <exception>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <regex>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/process.hpp>
 
+namespace bp = boost::process;
+
+static const std::string DOCKER_PROGRAM = "/usr/bin/docker";
 static const std::string SHA256_PREFIX = "sha256:";
 static const std::string JSON_EXT = ".json";
 static const std::string TAR_EXT = ".tar";
@@ -427,28 +435,147 @@ DockerManifestsCache::ManifestSharedPtr DockerManifestsCache::loadByDigest(const
   return manifest_ptr;
 }
 
+void DockerManifestsCache::findBestPlatform(const std::string &digest, const std::string &req_platform,
+                                            std::string *sel_platform, std::string *sel_digest) {
+  const PlatformKey key{removeDigestPrefix(digest), req_platform};
+  auto pit = platform_cache_.find(key);
+  if (pit == platform_cache_.end()) {
+    PlatformSelection selection;
+    loadByDigest(digest)->findBestPlatform(req_platform, &selection.first, &selection.second);
+    pit = platform_cache_.emplace(key, selection).first;
+  } else {
+    LOG_TRACE << "cache: hit for platform " << req_platform << " of manifest with digest " << key.first;
+  }
+  *sel_platform = pit->second.first;
+  *sel_digest = pit->second.second;
+}
+
 // ---
 // DockerComposeFile class
 // ---
 
-// Strings and regexes for basic parsing of a docker-compose file.
+// Strings for basic parsing of a docker-compose file.
 const std::string DockerComposeFile::services_section_name{"services"};
 const std::string DockerComposeFile::offline_mode_header{"# mode=offline"};
 const std::string DockerComposeFile::image_tag{"image"};
 const std::string DockerComposeFile::image_tag_old{"x-old-image"};
+static const std::string platform_tag{"platform"};
+static const std::string offline_mode_marker{"mode=offline"};
+
+// Character classes used by the line scanner; isSpace() matches the same
+// characters as "\s" in the ECMAScript regex grammar (ASCII subset).
+static bool isSpace(char ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+}
+
+static bool isKeyChar(char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' ||
+         ch == '.' || ch == '_';
+}
+
+static bool isWordChar(char ch) { return isKeyChar(ch) && ch != '-' && ch != '.'; }
+
+static bool onlySpacesFrom(const std::string &line, std::string::size_type pos) {
+  for (; pos < line.size(); pos++) {
+    if (!isSpace(line[pos])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+DockerComposeFile::ScannedLine DockerComposeFile::scanLine(const std::string &line) {
+  ScannedLine res;
 
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::offline_mode_header_re{"^#.*\\bmode=offline\\b.*\\s*$"};
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::level1_key_re{"^([-._a-zA-Z0-9]+):\\s*$"};
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::level2_key_re{"^  ([-._a-zA-Z0-9]+):\\s*$"};
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::image_name_re{"^    (image):\\s*(\"?)(\\S+)(\\2)\\s*$"};
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::image_name_old_re{"^    (x-old-image):\\s*(\"?)(\\S+)(\\2)\\s*$"};
-// NOLINTNEXTLINE(modernize-raw-string-literal)
-const std::regex DockerComposeFile::plat_name_re{"^    (?:platform):\\s*(\"?)(\\S+)(\\1)\\s*$"};
+  // Determine the indentation level: only 0, 2 and 4 spaces are relevant.
+  std::string::size_type indent = 0;
+  while (indent < line.size() && line[indent] == ' ' && indent < 5) {
+    indent++;
+  }
+
+  if (indent == 0 || indent == 2) {
+    // Matches "^([-._a-zA-Z0-9]+):\s*$" (optionally indented by 2 spaces).
+    std::string::size_type pos = indent;
+    while (pos < line.size() && isKeyChar(line[pos])) {
+      pos++;
+    }
+    if (pos > indent && pos < line.size() && line[pos] == ':' && onlySpacesFrom(line, pos + 1)) {
+      res.kind = (indent == 0) ? ScannedLine::Kind::kLevel1Key : ScannedLine::Kind::kLevel2Key;
+      res.key_pos = indent;
+      res.key_len = pos - indent;
+    }
+    return res;
+  }
+
+  if (indent != 4) {
+    return res;
+  }
+
+  // Matches "^    (key):\s*("?)(\S+)(\2)\s*$" for the keys of interest.
+  auto has_key = [&line](const std::string &key) {
+    const std::string::size_type colon = 4 + key.size();
+    return colon < line.size() && line[colon] == ':' && line.compare(4, key.size(), key) == 0;
+  };
+  ScannedLine::Kind kind;
+  std::string::size_type key_len;
+  if (has_key(image_tag)) {
+    kind = ScannedLine::Kind::kImage;
+    key_len = image_tag.size();
+  } else if (has_key(image_tag_old)) {
+    kind = ScannedLine::Kind::kImageOld;
+    key_len = image_tag_old.size();
+  } else if (has_key(platform_tag)) {
+    kind = ScannedLine::Kind::kPlatform;
+    key_len = platform_tag.size();
+  } else {
+    return res;
+  }
+
+  std::string::size_type val_beg = 4 + key_len + 1;
+  while (val_beg < line.size() && isSpace(line[val_beg])) {
+    val_beg++;
+  }
+  std::string::size_type val_end = val_beg;
+  while (val_end < line.size() && !isSpace(line[val_end])) {
+    val_end++;
+  }
+  if (val_end == val_beg || !onlySpacesFrom(line, val_end)) {
+    return res;
+  }
+  // The value may be enclosed in double quotes; these are only stripped when
+  // there is something in between them (a lone `""` is kept as the value).
+  if (val_end - val_beg >= 3 && line[val_beg] == '"' && line[val_end - 1] == '"') {
+    val_beg++;
+    val_end--;
+  }
+
+  res.kind = kind;
+  res.key_pos = 4;
+  res.key_len = key_len;
+  res.value_pos = val_beg;
+  res.value_len = val_end - val_beg;
+  return res;
+}
+
+bool DockerComposeFile::isOfflineModeHeader(const std::string &line) {
+  // Matches "^#.*\bmode=offline\b.*\s*$": the marker must appear as a whole
+  // word before the line terminator, with nothing but spaces after it.
+  if (line.empty() || line[0] != '#') {
+    return false;
+  }
+  const std::string::size_type eol = std::min(line.find_first_of("\r\n"), line.size());
+  if (!onlySpacesFrom(line, eol)) {
+    return false;
+  }
+  for (std::string::size_type pos = line.find(offline_mode_marker); pos != std::string::npos && pos < eol;
+       pos = line.find(offline_mode_marker, pos + 1)) {
+    const std::string::size_type after = pos + offline_mode_marker.size();
+    if (after <= eol && (pos == 0 || !isWordChar(line[pos - 1])) && (after == eol || !isWordChar(line[after]))) {
+      return true;
+    }
+  }
+  return false;
+}
 
 /**
  * Special version of getline() that reads text from input including the
@@ -537,12 +664,12 @@ bool DockerComposeFile::getServices(StringToImagePlatformPair &dest, bool verbos
     }
   };
 
-  std::smatch mres;
   for (const auto &line : compose_lines_) {
     // LOG_INFO << "LINE: " << line;
+    const ScannedLine scan = scanLine(line);
     // Check if we are entering a new top-level (L1) section.
-    if (std::regex_match(line, mres, level1_key_re)) {
-      in_svc_section = (mres[1] == services_section_name);
+    if (scan.kind == ScannedLine::Kind::kLevel1Key) {
+      in_svc_section = (line.compare(scan.key_pos, scan.key_len, services_section_name) == 0);
       if (in_svc_section) {
         // Entering the services section: clean up so that the last one
         // wins in case there is more than one (this should never happen
@@ -565,17 +692,17 @@ bool DockerComposeFile::getServices(StringToImagePlatformPair &dest, bool verbos
     }
 
     // In the service section the level-2 key is the service name.
-    if (std::regex_match(line, mres, level2_key_re)) {
+    if (scan.kind == ScannedLine::Kind::kLevel2Key) {
       store_current();
-      curr_service = mres[1];
+      curr_service = line.substr(scan.key_pos, scan.key_len);
       curr_platform.clear();
       curr_image.clear();
 
-    } else if (std::regex_match(line, mres, image_name_re)) {
-      curr_image = mres[3];
+    } else if (scan.kind == ScannedLine::Kind::kImage) {
+      curr_image = line.substr(scan.value_pos, scan.value_len);
 
-    } else if (std::regex_match(line, mres, plat_name_re)) {
-      curr_platform = mres[2];
+    } else if (scan.kind == ScannedLine::Kind::kPlatform) {
+      curr_platform = line.substr(scan.value_pos, scan.value_len);
     }
   }
 
@@ -604,12 +731,12 @@ void DockerComposeFile::forwardTransform(const ServiceToImageMapping &service_im
   };
 
   std::string curr_service;
-  std::smatch mres;
   for (const auto &line : compose_lines_) {
     // LOG_INFO << "LINE: " << line;
+    const ScannedLine scan = scanLine(line);
     // Check if we are entering a new top-level (L1) section.
-    if (std::regex_match(line, mres, level1_key_re)) {
-      in_svc_section = (mres[1] == services_section_name);
+    if (scan.kind == ScannedLine::Kind::kLevel1Key) {
+      in_svc_section = (line.compare(scan.key_pos, scan.key_len, services_section_name) == 0);
       if (in_svc_section) {
         // Entering the services section.
         curr_service.clear();
@@ -624,11 +751,11 @@ void DockerComposeFile::forwardTransform(const ServiceToImageMapping &service_im
     }
 
     // In the service section the level-2 key is the service name.
-    if (std::regex_match(line, mres, level2_key_re)) {
-      curr_service = mres[1];
+    if (scan.kind == ScannedLine::Kind::kLevel2Key) {
+      curr_service = line.substr(scan.key_pos, scan.key_len);
       save(line);
 
-    } else if (std::regex_match(line, mres, image_name_re)) {
+    } else if (scan.kind == ScannedLine::Kind::kImage) {
       // Handle the image name tag.
       auto it = service_image_mapping.find(curr_service);
       if (it != service_image_mapping.end()) {
@@ -637,10 +764,8 @@ void DockerComposeFile::forwardTransform(const ServiceToImageMapping &service_im
         // Create modified versions of the line: one with the old image and
         // another with the new one (in this order) and we rely on that order
         // in backwardTransform().
-        new_line1.replace(static_cast<std::string::size_type>(mres.position(1)),
-                          static_cast<std::string::size_type>(mres.length(1)), image_tag_old);
-        new_line2.replace(static_cast<std::string::size_type>(mres.position(3)),
-                          static_cast<std::string::size_type>(mres.length(3)), it->second);
+        new_line1.replace(scan.key_pos, scan.key_len, image_tag_old);
+        new_line2.replace(scan.value_pos, scan.value_len, it->second);
         save(new_line1);
         save(new_line2);
       } else {
@@ -656,9 +781,9 @@ void DockerComposeFile::forwardTransform(const ServiceToImageMapping &service_im
   // Add a marker to indicate this file is in "offline-mode".
   if (!new_compose_lines.empty()) {
     // Use the first line as a template (so newline ending is kept).
-    std::regex non_spaces{"^[^\\r\\n]*"};
-    std::string first_line = std::regex_replace(new_compose_lines.front(), non_spaces, offline_mode_header);
-    new_compose_lines.push_front(first_line);
+    const std::string &front = new_compose_lines.front();
+    const std::string::size_type eol = std::min(front.find_first_of("\r\n"), front.size());
+    new_compose_lines.push_front(offline_mode_header + front.substr(eol));
   }
 
   compose_lines_ = std::move(new_compose_lines);
@@ -670,7 +795,7 @@ void DockerComposeFile::backwardTransform() {
   // Check marker at first line.
   if (!compose_lines_.empty()) {
     const std::string first_line = compose_lines_.front();
-    if (!std::regex_match(first_line, offline_mode_header_re)) {
+    if (!isOfflineModeHeader(first_line)) {
       LOG_DEBUG << "Offline-mode header not found: skipping backward transform";
       return;
     }
@@ -685,14 +810,14 @@ void DockerComposeFile::backwardTransform() {
 
   std::string curr_service;
   std::string curr_image;
-  std::smatch mres;
   assert(compose_lines_.begin() != compose_lines_.end());
   for (auto it = std::next(compose_lines_.begin()); it != compose_lines_.end(); it++) {
     const auto &line = *it;
     // LOG_INFO << "LINE: " << line;
+    const ScannedLine scan = scanLine(line);
     // Check if we are entering a new top-level (L1) section.
-    if (std::regex_match(line, mres, level1_key_re)) {
-      in_svc_section = (mres[1] == services_section_name);
+    if (scan.kind == ScannedLine::Kind::kLevel1Key) {
+      in_svc_section = (line.compare(scan.key_pos, scan.key_len, services_section_name) == 0);
       if (in_svc_section) {
         // Entering the services section.
         curr_service.clear();
@@ -708,20 +833,19 @@ void DockerComposeFile::backwardTransform() {
     }
 
     // In the service section the level-2 key is the service name.
-    if (std::regex_match(line, mres, level2_key_re)) {
-      curr_service = mres[1];
+    if (scan.kind == ScannedLine::Kind::kLevel2Key) {
+      curr_service = line.substr(scan.key_pos, scan.key_len);
       curr_image.clear();
       save(line);
 
-    } else if (std::regex_match(line, mres, image_name_old_re)) {
-      curr_image = mres[3];
+    } else if (scan.kind == ScannedLine::Kind::kImageOld) {
+      curr_image = line.substr(scan.value_pos, scan.value_len);
       // Save a modified version of the line.
       std::string new_line1 = line;
-      new_line1.replace(static_cast<std::string::size_type>(mres.position(1)),
-                        static_cast<std::string::size_type>(mres.length(1)), image_tag);
+      new_line1.replace(scan.key_pos, scan.key_len, image_tag);
       save(new_line1);
 
-    } else if (std::regex_match(line, mres, image_name_re)) {
+    } else if (scan.kind == ScannedLine::Kind::kImage) {
       if (curr_image.empty()) {
         // This deals with the case where there was not "old" image in this
         // service section which is something that shouldn't happen in practice.
@@ -776,10 +900,12 @@ std::string DockerComposeFile::getSHA256() {
 DockerComposeOfflineLoader::DockerComposeOfflineLoader() : default_platform_(getDockerPlatform()) {}
 
 DockerComposeOfflineLoader::DockerComposeOfflineLoader(boost::filesystem::path images_dir,
-                                                       std::shared_ptr<DockerManifestsCache> manifests_cache)
+                                                       std::shared_ptr<DockerManifestsCache> manifests_cache,
+                                                       size_t load_concurrency)
     : default_platform_(getDockerPlatform()),
       images_dir_(std::move(images_dir)),
-      manifests_cache_(std::move(manifests_cache)) {}
+      manifests_cache_(std::move(manifests_cache)),
+      load_concurrency_(std::max<size_t>(1, load_concurrency)) {}
 
 void DockerComposeOfflineLoader::setUp(boost::filesystem::path images_dir,
                                        const std::shared_ptr<DockerManifestsCache> &manifests_cache) {
@@ -822,8 +948,8 @@ void DockerComposeOfflineLoader::updateImageMapping() {
 
     if (main_manifest->hasChildren()) {
       // Multi-platform image: load the most appropriate manifest.
-      main_manifest->findBestPlatform(req_platform.empty() ? default_platform_ : req_platform, &best_platform,
-                                      &best_digest);
+      manifests_cache_->findBestPlatform(req_digest, req_platform.empty() ? default_platform_ : req_platform,
+                                         &best_platform, &best_digest);
       best_manifest = manifests_cache_->loadByDigest(best_digest);
     }
 
@@ -872,39 +998,70 @@ void DockerComposeOfflineLoader::loadCompose(const boost::filesystem::path &comp
   updateImageMapping();
 }
 
-static void doInstallImage(const boost::filesystem::path &tarball,
-                           DockerTarballLoader::StringToStringSet expected_contents) {
+void DockerComposeOfflineLoader::loadImage(const boost::filesystem::path &tarball,
+                                           DockerTarballLoader::StringToStringSet expected_contents) const {
   // LOG_INFO << "Preparing to install " << tarball;
   // Run actual tarball loader.
   DockerTarballLoader tbloader(tarball);
-  if (!tbloader.loadMetadata() || !tbloader.validateMetadata(&expected_contents) || !tbloader.loadImages()) {
+  if (!tbloader.loadAndValidateImages(&expected_contents)) {
     LOG_WARNING << "Loading of tarballs aborted!";
     throw std::runtime_error("Failed to load docker tarball " + tarball.filename().string());
   }
   // LOG_INFO << "Finished installing " << tarball;
 }
 
+// The ID is the digest of the image's config, which holds the digests of all
+// of its layers, so the image is the one the tarball would have loaded.
+bool DockerComposeOfflineLoader::tagPresentImage(const std::string &cfg_digest, const std::string &image) const {
+  const std::string image_id = SHA256_PREFIX + cfg_digest;
+  if (bp::system(DOCKER_PROGRAM, "image", "inspect", image_id, bp::std_out > bp::null, bp::std_err > bp::null) != 0) {
+    return false;
+  }
+  if (bp::system(DOCKER_PROGRAM, "tag", image_id, image, bp::std_out > bp::null) != 0) {
+    LOG_WARNING << "Could not tag present image " << image_id << " as " << image << ", loading it";
+    return false;
+  }
+  return true;
+}
+
 void DockerComposeOfflineLoader::installImages(bool make_copy) {
-  std::list<std::string> loaded_digests;
+  struct LoadJob {
+    std::string man_digest;
+    std::string cfg_digest;
+    std::string image;
+    double seconds{0};
+    bool present{false};
+  };
+  std::vector<LoadJob> jobs;
 
   for (const auto &im : per_service_image_mapping_) {
     // const std::string &svc_name = im.first;
     const ImageMappingEntry &mapping = im.second;
 
     const std::string man_digest = removeDigestPrefix(mapping.getSelManDigest());
-    const std::string cfg_digest = removeDigestPrefix(mapping.getSelCfgDigest());
 
     // Avoid loading same image more than once.
-    if (std::find(loaded_digests.begin(), loaded_digests.end(), man_digest) != loaded_digests.end()) {
+    if (std::find_if(jobs.begin(), jobs.end(), [&man_digest](const LoadJob &job) {
+          return job.man_digest == man_digest;
+        }) != jobs.end()) {
       LOG_INFO << "Tarball for manifest '" << man_digest << "' already loaded";
       continue;
     }
+    jobs.push_back({man_digest, removeDigestPrefix(mapping.getSelCfgDigest()), mapping.getSelImage()});
+  }
+
+  auto install = [this, make_copy](LoadJob &job) {
+    if (tagPresentImage(job.cfg_digest, job.image)) {
+      LOG_INFO << "Image " << job.image << " already present, tagged it";
+      job.present = true;
+      return;
+    }
 
     // Define expected contents of tarball.
     DockerTarballLoader::StringToStringSet expected;
-    expected[cfg_digest].insert(mapping.getSelImage());
+    expected[job.cfg_digest].insert(job.image);
 
-    boost::filesystem::path org_tarball = images_dir_ / (man_digest + TAR_EXT);
+    boost::filesystem::path org_tarball = images_dir_ / (job.man_digest + TAR_EXT);
 
     if (make_copy) {
       // Copy tarball to a secure place.
@@ -917,13 +1074,60 @@ void DockerComposeOfflineLoader::installImages(bool make_copy) {
         LOG_WARNING << "Could not copy Docker tarball to secure location: aborting";
         throw std::runtime_error("Failed to copy docker tarball " + tarball.filename().string());
       }
-      doInstallImage(tarball, expected);
+      loadImage(tarball, expected);
     } else {
-      doInstallImage(org_tarball, expected);
+      loadImage(org_tarball, expected);
     }
+  };
+
+  LOG_INFO << "Loading " << jobs.size() << " images, " << load_concurrency_ << " at a time";
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next{0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      {
+        std::lock_guard<std::mutex> guard(error_mutex);
+        if (error) {
+          return;
+        }
+      }
+      const auto job_start = std::chrono::steady_clock::now();
+      try {
+        install(jobs[i]);
+      } catch (...) {
+        // Rethrown on the calling thread, an exception escaping a worker would terminate aktualizr.
+        std::lock_guard<std::mutex> guard(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        return;
+      }
+      jobs[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job_start).count();
+    }
+  };
+  std::vector<std::thread> workers;
+  const size_t num_workers = std::min(load_concurrency_, jobs.size());
+  // This thread is one of the workers.
+  for (size_t i = 1; i < num_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : workers) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
 
-    loaded_digests.push_back(man_digest);
+  size_t present = 0;
+  for (const auto &job : jobs) {
+    LOG_INFO << "Image " << job.image << ": " << (job.present ? "tagged" : "loaded") << " in " << job.seconds << " s";
+    present += job.present ? 1 : 0;
   }
+  LOG_INFO << "Installed " << jobs.size() << " images (" << present << " already present) in "
+           << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s";
 }
 
 void DockerComposeOfflineLoader::writeOfflineComposeFile(const boost::filesystem::path &compose_name, bool verbose) {
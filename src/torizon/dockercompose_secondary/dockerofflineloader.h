@@ -3,10 +3,13 @@
 
 #include <json/value.h>
 #include <boost/filesystem/path.hpp>
+#include <list>
+#include <map>
 #include <memory>
-#include <regex>
 #include <string>
 
+#include "dockertarballloader.h"
+
 // TODO: Should we put this in some specific namespace?
 
 /**
@@ -104,9 +107,16 @@ class DockerManifestsCache {
   using ManifestCacheElem = std::pair<size_t, ManifestSharedPtr>;
   using DigestToManifestCacheElemMap = std::map<std::string, ManifestCacheElem>;
 
-  explicit DockerManifestsCache(boost::filesystem::path manifests_dir, size_t max_manifests = 32)
+  explicit DockerManifestsCache(boost::filesystem::path manifests_dir, size_t max_manifests = 256)
       : manifests_dir_(std::move(manifests_dir)), max_manifests_(max_manifests), access_counter_(0) {}
 
+  /**
+   * Change the directory manifests missing from the cache are loaded from.
+   * Manifests are only cached after their digest was checked, so entries
+   * loaded from other directories remain valid.
+   */
+  void setManifestsDir(boost::filesystem::path manifests_dir) { manifests_dir_ = std::move(manifests_dir); }
+
   /**
    * Load the manifest (specified by its digest) from the manifest directory
    * storing it into the cache.
@@ -115,11 +125,23 @@ class DockerManifestsCache {
    */
   ManifestSharedPtr loadByDigest(const std::string &digest);
 
+  /**
+   * Select the manifest appropriate for a platform from the manifest list
+   * with the given digest, see DockerManifestWrapper::findBestPlatform().
+   * Results are remembered per (digest, platform) pair.
+   */
+  void findBestPlatform(const std::string &digest, const std::string &req_platform, std::string *sel_platform,
+                        std::string *sel_digest);
+
  protected:
+  using PlatformKey = std::pair<std::string, std::string>;
+  using PlatformSelection = std::pair<std::string, std::string>;
+
   boost::filesystem::path manifests_dir_;
   size_t max_manifests_;
   size_t access_counter_;
   DigestToManifestCacheElemMap manifests_cache_;
+  std::map<PlatformKey, PlatformSelection> platform_cache_;
 };
 
 /**
@@ -162,12 +184,26 @@ class DockerComposeFile {
   static const std::string image_tag;
   static const std::string image_tag_old;
 
-  static const std::regex offline_mode_header_re;
-  static const std::regex level1_key_re;
-  static const std::regex level2_key_re;
-  static const std::regex image_name_re;
-  static const std::regex image_name_old_re;
-  static const std::regex plat_name_re;
+  /**
+   * Result of classifying a single line of the compose file; positions are
+   * offsets into the line (which includes its line terminator).
+   */
+  struct ScannedLine {
+    enum class Kind { kOther, kLevel1Key, kLevel2Key, kImage, kImageOld, kPlatform };
+    Kind kind{Kind::kOther};
+    std::string::size_type key_pos{0};
+    std::string::size_type key_len{0};
+    std::string::size_type value_pos{0};
+    std::string::size_type value_len{0};
+  };
+
+  /**
+   * Classify a line in a single scan of its characters; this recognizes the
+   * keys in the canonical layout ("key:", "  key:", "    image: value", etc.)
+   * and leaves everything else as Kind::kOther.
+   */
+  static ScannedLine scanLine(const std::string &line);
+  static bool isOfflineModeHeader(const std::string &line);
 
  public:
   using ServiceToImageMapping = std::map<std::string, std::string>;
@@ -301,7 +337,17 @@ class DockerComposeOfflineLoader {
 
  public:
   DockerComposeOfflineLoader();
-  DockerComposeOfflineLoader(boost::filesystem::path images_dir, std::shared_ptr<DockerManifestsCache> manifests_cache);
+  /**
+   * @param load_concurrency number of images fed to the Docker daemon at the
+   *  same time by `installImages()`.
+   */
+  DockerComposeOfflineLoader(boost::filesystem::path images_dir, std::shared_ptr<DockerManifestsCache> manifests_cache,
+                             size_t load_concurrency = 1);
+  DockerComposeOfflineLoader(const DockerComposeOfflineLoader &) = delete;
+  DockerComposeOfflineLoader(DockerComposeOfflineLoader &&) = delete;
+  DockerComposeOfflineLoader &operator=(const DockerComposeOfflineLoader &) = delete;
+  DockerComposeOfflineLoader &operator=(DockerComposeOfflineLoader &&) = delete;
+  virtual ~DockerComposeOfflineLoader() = default;
 
   /**
    * Configure what images directory and manifest cache object to be
@@ -321,7 +367,13 @@ class DockerComposeOfflineLoader {
   void loadCompose(const boost::filesystem::path &compose_name, const std::string &compose_sha256);
 
   /**
-   * Install images defined by the docker-compose file last "loaded".
+   * Install images defined by the docker-compose file last "loaded", up to
+   * the load concurrency at a time. Images the daemon already has under their
+   * ID (the digest of their config, which pins all of their layers) are only
+   * tagged instead of being loaded again from their tarball.
+   *
+   * An exception thrown while installing any of the images is rethrown here,
+   * after the images being installed at that moment are done.
    */
   void installImages(bool make_copy = false);
 
@@ -346,11 +398,24 @@ class DockerComposeOfflineLoader {
   void updateReferencedImages();
   void updateImageMapping();
 
+  /**
+   * Give the image with the ID `cfg_digest` the tag `image`, if the daemon
+   * has it. Returns whether it did.
+   */
+  virtual bool tagPresentImage(const std::string &cfg_digest, const std::string &image) const;
+  /**
+   * Feed a tarball to `docker load`, checking that it holds the expected
+   * images; throws `std::runtime_error` on failure.
+   */
+  virtual void loadImage(const boost::filesystem::path &tarball,
+                         DockerTarballLoader::StringToStringSet expected_contents) const;
+
   // TODO: Allow configuring this attribute (FUTURE)?
   std::string default_platform_;
   boost::filesystem::path images_dir_;
   std::shared_ptr<DockerManifestsCache> manifests_cache_;
   std::shared_ptr<DockerComposeFile> compose_file_;
+  size_t load_concurrency_{1};
 
   StringToImagePlatformPair referenced_images_;
   PerServiceImageMapping per_service_image_mapping_;
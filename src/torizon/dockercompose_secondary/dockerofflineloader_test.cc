@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "dockerofflineloader.h"
+#include "logging/logging.h"
+
+/**
+ * Offline loader with a fixed image mapping that records what it would have
+ * asked the Docker daemon to do instead of running the docker CLI.
+ */
+class FakeOfflineLoader : public DockerComposeOfflineLoader {
+ public:
+  explicit FakeOfflineLoader(size_t load_concurrency)
+      : DockerComposeOfflineLoader("/nonexistent", nullptr, load_concurrency) {}
+
+  void addImage(const std::string &service, const std::string &image, const std::string &man_digest,
+                const std::string &cfg_digest) {
+    per_service_image_mapping_[service] = ImageMappingEntry(image, "linux/amd64", image, "linux/amd64",
+                                                            "sha256:" + man_digest, "sha256:" + cfg_digest);
+  }
+
+  std::set<std::string> present;
+  std::string failing;
+  mutable std::mutex mutex;
+  mutable std::set<std::string> tagged;
+  mutable std::multiset<std::string> loaded;
+  mutable std::atomic<int> loading{0};
+  mutable std::atomic<int> max_loading{0};
+
+ protected:
+  bool tagPresentImage(const std::string &cfg_digest, const std::string &image) const override {
+    if (present.count(cfg_digest) == 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> guard(mutex);
+    tagged.insert(image);
+    return true;
+  }
+
+  void loadImage(const boost::filesystem::path &tarball,
+                 DockerTarballLoader::StringToStringSet expected_contents) const override {
+    (void)expected_contents;
+    const int now = ++loading;
+    int max = max_loading;
+    while (now > max && !max_loading.compare_exchange_weak(max, now)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    --loading;
+    if (tarball.stem().string() == failing) {
+      throw std::logic_error("cannot load " + failing);
+    }
+    std::lock_guard<std::mutex> guard(mutex);
+    loaded.insert(tarball.stem().string());
+  }
+};
+
+/* Images are loaded up to the load concurrency at a time, each tarball once. */
+TEST(DockerOfflineLoader, ParallelLoad) {
+  FakeOfflineLoader loader(2);
+  loader.addImage("a", "registry/a@sha256:0a", "m1", "c1");
+  loader.addImage("b", "registry/b@sha256:0b", "m2", "c2");
+  loader.addImage("c", "registry/c@sha256:0c", "m3", "c3");
+  loader.addImage("d", "registry/d@sha256:0d", "m4", "c4");
+  // Same image as "a"
+  loader.addImage("e", "registry/a@sha256:0a", "m1", "c1");
+
+  loader.installImages();
+  EXPECT_EQ(loader.loaded, (std::multiset<std::string>{"m1", "m2", "m3", "m4"}));
+  EXPECT_EQ(loader.max_loading, 2);
+}
+
+/* An image the daemon already has is tagged instead of being loaded from its tarball. */
+TEST(DockerOfflineLoader, TagPresentImage) {
+  FakeOfflineLoader loader(2);
+  loader.addImage("a", "registry/a@sha256:0a", "m1", "c1");
+  loader.addImage("b", "registry/b@sha256:0b", "m2", "c2");
+  loader.present.insert("c2");
+
+  loader.installImages();
+  EXPECT_EQ(loader.loaded, (std::multiset<std::string>{"m1"}));
+  EXPECT_EQ(loader.tagged, (std::set<std::string>{"registry/b@sha256:0b"}));
+}
+
+/* An exception thrown by a worker is rethrown on the calling thread, and no more images are loaded after it. */
+TEST(DockerOfflineLoader, LoadFailure) {
+  FakeOfflineLoader loader(2);
+  loader.addImage("a", "registry/a@sha256:0a", "m1", "c1");
+  loader.addImage("b", "registry/b@sha256:0b", "m2", "c2");
+  loader.addImage("c", "registry/c@sha256:0c", "m3", "c3");
+  loader.addImage("d", "registry/d@sha256:0d", "m4", "c4");
+  loader.failing = "m1";
+
+  EXPECT_THROW(loader.installImages(), std::logic_error);
+  EXPECT_EQ(loader.loaded.count("m1"), 0U);
+  EXPECT_LT(loader.loaded.size(), 3U);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,6 +1,7 @@
 #include "dockertarballloader.h"
 #include "crypto/crypto.h"
 #include "logging/logging.h"
+#include "utilities/resource_policy.h"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -112,6 +113,103 @@ std::ostream &operator<<(std::ostream &stream, const std::set<std::string> &valu
   return stream;
 }
 
+/**
+ * Helper class for feeding a tarball to `docker load`. The most recent data
+ * is held back in a circular buffer, so that the load can still be aborted by
+ * truncating the stream once everything else was sent.
+ */
+class DockerLoadStream {
+ protected:
+  static constexpr const size_t num_blocks_power = 4;
+  static constexpr const size_t num_blocks = (1U << num_blocks_power);
+  static constexpr const size_t num_blocks_mask = num_blocks - 1U;
+
+  struct Block {
+    std::array<uint8_t, 16 * 1024> buf{};
+    size_t len{0};
+    void clear() { len = 0; }
+  };
+  using Blocks = std::array<Block, num_blocks>;
+
+  std::unique_ptr<Blocks> blocks_ = std_::make_unique<Blocks>();
+  unsigned block_index_{0};
+  bp::opstream docker_stdin_;
+  bp::child docker_proc_;
+
+  void send(Block &block) {
+    if (block.len > 0) {
+      docker_stdin_.write(reinterpret_cast<char *>(block.buf.data()), static_cast<std::streamsize>(block.len));
+      block.clear();
+    }
+  }
+
+  int finish() {
+    docker_stdin_.flush();
+    docker_stdin_.pipe().close();
+    docker_stdin_.close();
+    docker_proc_.wait();
+    return docker_proc_.exit_code();
+  }
+
+ public:
+  // TODO: Handle the program output if more control is needed. See:
+  // https://stackoverflow.com/questions/48678012/simultaneous-read-and-write-to-childs-stdio-using-boost-process
+  DockerLoadStream() : docker_proc_(DOCKER_PROGRAM, "load", bp::std_in < docker_stdin_) {}
+  DockerLoadStream(const DockerLoadStream &other) = delete;
+  DockerLoadStream(DockerLoadStream &&other) = delete;
+  DockerLoadStream &operator=(const DockerLoadStream &other) = delete;
+  DockerLoadStream &operator=(DockerLoadStream &&other) = delete;
+  virtual ~DockerLoadStream() {
+    if (docker_proc_.running()) {
+      finish();
+    }
+  }
+
+  void write(const uint8_t *data, size_t len) {
+    while (len > 0) {
+      auto *cur_block = &blocks_->at(block_index_);
+      if (cur_block->len == cur_block->buf.size()) {
+        // Current block is full: advance, sending the oldest block to the external process.
+        block_index_ = (block_index_ + 1) & num_blocks_mask;
+        cur_block = &blocks_->at(block_index_);
+        send(*cur_block);
+      }
+      const size_t count = std::min(len, cur_block->buf.size() - cur_block->len);
+      std::copy(data, data + count, cur_block->buf.begin() + static_cast<std::ptrdiff_t>(cur_block->len));
+      cur_block->len += count;
+      data += count;
+      len -= count;
+    }
+  }
+
+  // Number of bytes not sent to the external process yet.
+  uint64_t held() const {
+    uint64_t total = 0;
+    for (const auto &block : *blocks_) {
+      total += block.len;
+    }
+    return total;
+  }
+
+  // Send the outstanding blocks and wait for `docker load` to finish.
+  bool commit() {
+    for (unsigned cnt = 0; cnt < num_blocks; cnt++) {
+      block_index_ = (block_index_ + 1) & num_blocks_mask;
+      send(blocks_->at(block_index_));
+    }
+    const bool sent = !docker_stdin_.fail();
+    return finish() == 0 && sent;
+  }
+
+  // Truncate the stream so that `docker load` fails, and wait for it.
+  int abort() {
+    for (auto &block : *blocks_) {
+      block.clear();
+    }
+    return finish();
+  }
+};
+
 static constexpr std::size_t ARCHIVE_CTRL_BUFFER_SIZE = DEFAULT_BLOCK_BUFFER_SIZE_BYTES;
 
 /**
@@ -124,9 +222,11 @@ struct ArchiveCtrl {
   uint64_t nread_{0};
   BufferType buffer_{};
   MultiPartHasher::Ptr hasher_ = MultiPartHasher::create(Hash::Type::kSha256);
+  DockerLoadStream *tee_;
 
  public:
-  explicit ArchiveCtrl(const boost::filesystem::path &tarball) : infile_(tarball.string(), std::ios::binary) {
+  explicit ArchiveCtrl(const boost::filesystem::path &tarball, DockerLoadStream *tee = nullptr)
+      : infile_(tarball.string(), std::ios::binary), tee_(tee) {
     if (!infile_) {
       throw std::runtime_error("Could not open '" + tarball.string() + "'");
     }
@@ -142,6 +242,9 @@ struct ArchiveCtrl {
     infile_.read(reinterpret_cast<char *>(buffer_.data()), static_cast<std::streamsize>(buffer_.size()));
     hasher_->update(buffer_.data(), static_cast<uint64_t>(infile_.gcount()));
     nread_ += static_cast<uint64_t>(infile_.gcount());
+    if (tee_ != nullptr) {
+      tee_->write(buffer_.data(), static_cast<size_t>(infile_.gcount()));
+    }
     return infile_.gcount();
   }
 
@@ -351,24 +454,35 @@ bool DockerTarballLoader::loadMetadataEntry(archive *arch, archive_entry *entry)
 }
 
 bool DockerTarballLoader::loadMetadata() {
-  archive *arch;
-  archive_entry *entry;
-
   LOG_INFO << "Loading metadata from tarball: " << tarball_;
   auto archctrl = std_::make_unique<ArchiveCtrl>(tarball_);
+  int64_t manifest_offset = -1;
+  return readMetadata(archctrl.get(), &manifest_offset);
+}
+
+bool DockerTarballLoader::readMetadata(ArchiveCtrl *archctrl, int64_t *manifest_offset) {
+  archive *arch;
+  archive_entry *entry;
 
   arch = archive_read_new();
   archive_read_support_filter_none(arch);
   archive_read_support_format_tar(arch);
-  archive_read_open(arch, archctrl.get(), nullptr, arch_reader, nullptr);
+  archive_read_open(arch, archctrl, nullptr, arch_reader, nullptr);
 
   metamap_.clear();
   metastats_.clear();
   while (archive_read_next_header(arch, &entry) == ARCHIVE_OK) {
+    if (tar_fpath_to_key(archive_entry_pathname(entry)) == "manifest.json") {
+      *manifest_offset = archive_read_header_position(arch);
+    }
     loadMetadataEntry(arch, entry);
   }
   archive_read_free(arch);
 
+  // Anything after the end of the archive is part of the tarball as well.
+  while (archctrl->read() > 0) {
+  }
+
   // Save original digest so we can check it upon loading the images.
   org_tarball_digest_ = archctrl->getHexDigest();
   org_tarball_length_ = archctrl->nread();
@@ -547,67 +661,37 @@ bool DockerTarballLoader::loadImages() {
     return false;
   }
 
-  // Define a circular buffer of data blocks.
-  static constexpr const size_t num_blocks_power = 4;
-  static constexpr const size_t num_blocks = (1U << num_blocks_power);
-  static constexpr const size_t num_blocks_mask = num_blocks - 1U;
-
-  struct Block {
-    std::array<uint8_t, 16 * 1024> buf{};
-    size_t len{0};
-    bool used{false};
-    Block() = default;
-    void clear() {
-      len = 0;
-      used = false;
-    }
-  };
-  using Blocks = std::array<Block, num_blocks>;
-
-  auto blocks = std_::make_unique<Blocks>();
-  unsigned block_index = 0;
-
+  using BufferType = std::array<uint8_t, 16 * 1024>;
+  auto buffer = std_::make_unique<BufferType>();
   auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
 
   // Prevent SIGPIPE in case the child program exits unexpectedly.
   SignalBlocker blocker(SIGPIPE);
 
-  bp::opstream docker_stdin;
-  // Run the `docker load` external program.
-  // bp::child docker_proc("/usr/bin/ls", bp::std_in < docker_stdin);
-  // bp::child docker_proc("/usr/bin/sha256sum", bp::std_in < docker_stdin);
-  bp::child docker_proc(DOCKER_PROGRAM, "load", bp::std_in < docker_stdin);
-
-  // TODO: Handle the program output if more control is needed. See:
-  // https://stackoverflow.com/questions/48678012/simultaneous-read-and-write-to-childs-stdio-using-boost-process
+  // Run the `docker load` external program, which takes over the priorities of this thread. The images are
+  // unpacked by the Docker daemon though, which keeps its own priorities.
+  ScopedResourcePolicy policy(ResourcePhase::kContainerLoad);
+  DockerLoadStream docker;
 
   // Read tarball, send it to `docker load` and determine its digest.
   uint64_t nread = 0;
+  bool size_changed = false;
   for (;;) {
-    auto &cur_block = blocks->at(block_index);
-    if (cur_block.used) {
-      // Block already used: send all data to external process.
-      docker_stdin.write(reinterpret_cast<char *>(cur_block.buf.data()), static_cast<std::streamsize>(cur_block.len));
-      cur_block.clear();
-    }
-
-    infile.read(reinterpret_cast<char *>(cur_block.buf.data()), static_cast<std::streamsize>(cur_block.buf.size()));
-    cur_block.len = static_cast<size_t>(infile.gcount());
-    cur_block.used = true;
+    infile.read(reinterpret_cast<char *>(buffer->data()), static_cast<std::streamsize>(buffer->size()));
+    const auto count = static_cast<size_t>(infile.gcount());
 
     // Prevent modifications of file size: this is very important to avoid attacks
     // where extraneous data is appended to the end marker of the tarball.
-    nread += static_cast<uint64_t>(infile.gcount());
+    nread += count;
     if (nread > org_tarball_length_) {
       LOG_WARNING << "Size of tarball has changed (aborting)";
+      size_changed = true;
       break;
     }
 
     // Update digest.
-    hasher->update(cur_block.buf.data(), static_cast<uint64_t>(cur_block.len));
-
-    // Advance.
-    block_index = (block_index + 1) & num_blocks_mask;
+    hasher->update(buffer->data(), count);
+    docker.write(buffer->data(), count);
     if (!infile) {
       break;
     }
@@ -619,37 +703,52 @@ bool DockerTarballLoader::loadImages() {
   LOG_TRACE << "2nd pass: tarball sha256=" << new_digest << ", len=" << nread;
 
   bool success = false;
-  if (org_tarball_digest_ == new_digest) {
+  if (!size_changed && org_tarball_digest_ == new_digest) {
     // Send outstanding blocks if everything is good.
-    for (unsigned cnt = 0; cnt < num_blocks; cnt++) {
-      auto &cur_block = blocks->at(block_index);
-      if (cur_block.used) {
-        // Block already used: send all data to external process.
-        docker_stdin.write(reinterpret_cast<char *>(cur_block.buf.data()), static_cast<std::streamsize>(cur_block.len));
-        cur_block.clear();
-      }
-      block_index = (block_index + 1) & num_blocks_mask;
-    }
-
-    success = !docker_stdin.fail();
-
+    success = docker.commit();
   } else {
-    // Digest changed from first time we took it.
-    LOG_WARNING << "Digest of " << tarball_ << " has changed from '" << org_tarball_digest_ << "' to '" << new_digest
-                << "'";
+    if (!size_changed) {
+      // Digest changed from first time we took it.
+      LOG_WARNING << "Digest of " << tarball_ << " has changed from '" << org_tarball_digest_ << "' to '"
+                  << new_digest << "'";
+    }
+    docker.abort();
   }
 
-  docker_stdin.flush();
-  docker_stdin.pipe().close();
-  docker_stdin.close();
-
-  docker_proc.wait();
+  LOG_INFO << "Loading of " << tarball_ << " finished, status: " << (success ? "success" : "failed");
+  return success;
+}
 
-  // We have success only if the loading program succeeded.
-  success = success && (docker_proc.exit_code() == 0);
+bool DockerTarballLoader::loadAndValidateImages(StringToStringSet *expected_tags_per_image) {
+  // NOLINTNEXTLINE(clang-analyzer-core.NonNullParamChecker)
+  LOG_INFO << "Loading images from tarball in a single pass: " << tarball_;
 
-  LOG_INFO << "Loading of " << tarball_ << " finished, "
-           << "code: " << docker_proc.exit_code() << ", status: " << (success ? "success" : "failed");
+  bool ordered = false;
+  bool success = false;
+  {
+    // Prevent SIGPIPE in case the child program exits unexpectedly.
+    SignalBlocker blocker(SIGPIPE);
+    DockerLoadStream docker;
+    auto archctrl = std_::make_unique<ArchiveCtrl>(tarball_, &docker);
+    int64_t manifest_offset = -1;
+    const bool loaded = readMetadata(archctrl.get(), &manifest_offset);
+
+    // Without its manifest `docker load` cannot load anything, so holding the
+    // manifest back is enough to keep unvalidated images out of the daemon.
+    ordered = manifest_offset >= 0 && static_cast<uint64_t>(manifest_offset) + docker.held() >= archctrl->nread();
+    if (!ordered) {
+      docker.abort();
+    } else if (loaded && validateMetadata(expected_tags_per_image)) {
+      success = docker.commit();
+    } else {
+      docker.abort();
+    }
+  }
 
+  if (!ordered) {
+    LOG_INFO << "Manifest is not at the end of " << tarball_ << ", falling back to validating before loading";
+    return loadMetadata() && validateMetadata(expected_tags_per_image) && loadImages();
+  }
+  LOG_INFO << "Loading of " << tarball_ << " finished, status: " << (success ? "success" : "failed");
   return success;
 }
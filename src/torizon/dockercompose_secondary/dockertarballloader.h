@@ -9,6 +9,7 @@
 
 struct archive;
 struct archive_entry;
+struct ArchiveCtrl;
 
 // TODO: Should we put this in some specific namespace?
 
@@ -83,6 +84,18 @@ class DockerTarballLoader {
    */
   bool loadImages();
 
+  /**
+   * Load the Docker images while reading the tarball a single time: the
+   * metadata is collected from the same stream that is fed to `docker load`,
+   * and the end of the stream is held back until validateMetadata() passed.
+   * This relies on `docker save` writing manifest.json at the end of the
+   * tarball; when it comes earlier, the load is aborted and redone with
+   * loadMetadata(), validateMetadata() and loadImages().
+   *
+   * @param expected_tags_per_image see validateMetadata().
+   */
+  bool loadAndValidateImages(StringToStringSet *expected_tags_per_image = nullptr);
+
  protected:
   boost::filesystem::path tarball_;
   std::string org_tarball_digest_;
@@ -90,6 +103,7 @@ class DockerTarballLoader {
   MetadataMap metamap_;
   MetaStats metastats_;
 
+  bool readMetadata(ArchiveCtrl *archctrl, int64_t *manifest_offset);
   bool loadMetadataEntry(archive *arch, archive_entry *entry);
   bool loadMetadataEntryJson(archive *arch, archive_entry *entry);
   bool loadMetadataEntryOther(archive *arch, archive_entry *entry);
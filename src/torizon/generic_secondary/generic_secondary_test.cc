@@ -4,7 +4,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/process.hpp>
 #include <cstdlib>
+#include <thread>
 
+#include <sys/resource.h>
+
+#include "logging/metrics.h"
 #include "torizongenericsecondary.h"
 #include "uptane_test_common.h"
 #include "utilities/utils.h"
@@ -200,6 +204,68 @@ TEST_F(TorizonGenericSecondaryTest, HandlerOutputExpected) {
   EXPECT_EQ(jsonOutput["status"], "ok");
 }
 
+/* Action-handlers run with the configured niceness and their duration is recorded per result. */
+TEST_F(TorizonGenericSecondaryTest, HandlerScheduling) {
+  auto handler_path = boost::filesystem::current_path() / "tests/torizon/test_action_handler.sh";
+  sconfig_ = makeTestConfig(*temp_dir_, handler_path);
+  sconfig_->action_handler_nice = 3;
+  sconfig_->action_handler_max_running = 1;
+  secondary_ = std::make_shared<Primary::TorizonGenericSecondary>(*sconfig_);
+  secondary_->init(secondary_provider_);
+
+  auto& output_latency = Metrics::instance().histogram("aktualizr_action_handler_output_duration_seconds",
+                                                     "Duration of action-handler runs with this result");
+  const uint64_t runs_before = output_latency.count();
+
+  Json::Value output;
+  EXPECT_EQ(secondary_->callActionHandler("report-scheduling", {}, &output),
+            TorizonGenericSecondary::ActionHandlerResult::ProcOutput);
+  EXPECT_EQ(output["nice"].asInt(), std::min(getpriority(PRIO_PROCESS, 0) + 3, 19));
+  EXPECT_EQ(output_latency.count(), runs_before + 1);
+
+  // With a limit of one, handlers called from several threads run one after the other.
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 3; ++i) {
+    callers.emplace_back([this]() {
+      EXPECT_EQ(secondary_->callActionHandler("exit-with-code-64", {}),
+                TorizonGenericSecondary::ActionHandlerResult::ReqNormalProc);
+    });
+  }
+  for (auto& caller : callers) {
+    caller.join();
+  }
+}
+
+/* The firmware digest is only computed again when the file changes, and survives restarts. */
+TEST_F(TorizonGenericSecondaryTest, FirmwareDigestCache) {
+  makeSecondary("tests/torizon/test_action_handler.sh");
+
+  Utils::writeFile(sconfig_->firmware_path, std::string("firmware-v1"));
+  Uptane::InstalledImageInfo info;
+  secondary_->getFirmwareDigest(info);
+  EXPECT_EQ(info.hash, Uptane::ManifestIssuer::generateVersionHashStr("firmware-v1"));
+  EXPECT_EQ(info.len, 11);
+  ASSERT_TRUE(boost::filesystem::exists(secondary_->getFirmwareDigestPath()));
+
+  // A digest stored for the same file state is used as it is.
+  Json::Value stored = Utils::parseJSONFile(secondary_->getFirmwareDigestPath());
+  stored["sha256"] = "cached";
+  Utils::writeFile(secondary_->getFirmwareDigestPath(), stored);
+  secondary_->firmware_digest_.reset();
+  secondary_->getFirmwareDigest(info);
+  EXPECT_EQ(info.hash, "cached");
+
+  Utils::writeFile(sconfig_->firmware_path, std::string("firmware-v2 is longer"));
+  secondary_->getFirmwareDigest(info);
+  EXPECT_EQ(info.hash, Uptane::ManifestIssuer::generateVersionHashStr("firmware-v2 is longer"));
+  EXPECT_EQ(info.len, 21);
+
+  boost::filesystem::remove(sconfig_->firmware_path);
+  secondary_->getFirmwareDigest(info);
+  EXPECT_EQ(info.hash, Uptane::ManifestIssuer::generateVersionHashStr(""));
+  EXPECT_EQ(info.len, 0);
+}
+
 TEST_F(TorizonGenericSecondaryTest, GetFirmwareInfoFailure) {
   logger_set_threshold(boost::log::trivial::trace);
   makeSecondary("tests/torizon/test_get_fwinfo.sh");
@@ -1,14 +1,25 @@
 #include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 // #define EXTRA_DEBUG
 
 #include <json/json.h>
 #include <boost/filesystem.hpp>
 #include <boost/process.hpp>
+#include <boost/process/extend.hpp>
 
 #include "crypto/crypto.h"
+#include "logging/metrics.h"
+#include "logging/tracing.h"
 #include "uptane/manifest.h"
 #include "utilities/utils.h"
 
@@ -36,6 +47,11 @@ TorizonGenericSecondaryConfig::TorizonGenericSecondaryConfig(const Json::Value&
   target_name_path = json_config["target_name_path"].asString();
   metadata_path = json_config["metadata_path"].asString();
   action_handler_path = json_config["action_handler_path"].asString();
+  action_handler_nice = json_config["action_handler_nice"].asInt();
+  action_handler_ionice_class = json_config["action_handler_ionice_class"].asInt();
+  action_handler_ionice_level = json_config["action_handler_ionice_level"].asInt();
+  action_handler_cgroup = json_config["action_handler_cgroup"].asString();
+  action_handler_max_running = json_config["action_handler_max_running"].asUInt();
 }
 
 std::vector<TorizonGenericSecondaryConfig> TorizonGenericSecondaryConfig::create_from_file(
@@ -67,6 +83,11 @@ void TorizonGenericSecondaryConfig::dump(const boost::filesystem::path& file_ful
   json_config["target_name_path"] = target_name_path.string();
   json_config["metadata_path"] = metadata_path.string();
   json_config["action_handler_path"] = action_handler_path.string();
+  json_config["action_handler_nice"] = action_handler_nice;
+  json_config["action_handler_ionice_class"] = action_handler_ionice_class;
+  json_config["action_handler_ionice_level"] = action_handler_ionice_level;
+  json_config["action_handler_cgroup"] = action_handler_cgroup.string();
+  json_config["action_handler_max_running"] = action_handler_max_running;
 
   Json::Value root;
   // Append to the config file if it already exists.
@@ -85,12 +106,69 @@ void TorizonGenericSecondaryConfig::dump(const boost::filesystem::path& file_ful
   json_file.close();
 }
 
+/**
+ * Process-wide limit on the number of action-handlers running at the same
+ * time, so that several generic Secondaries do not all hit the storage at
+ * once. The smallest non-zero limit set by any Secondary applies.
+ */
+class ActionHandlerSlots {
+ public:
+  static ActionHandlerSlots& instance() {
+    static ActionHandlerSlots slots;
+    return slots;
+  }
+
+  void limit(unsigned int max_running) {
+    if (max_running == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> guard(m_);
+    if (max_running_ == 0 || max_running < max_running_) {
+      max_running_ = max_running;
+    }
+  }
+
+  void acquire() {
+    std::unique_lock<std::mutex> lock(m_);
+    cv_.wait(lock, [this]() { return max_running_ == 0 || running_ < max_running_; });
+    ++running_;
+  }
+
+  void release() {
+    {
+      std::lock_guard<std::mutex> guard(m_);
+      --running_;
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  unsigned int max_running_{0};
+  unsigned int running_{0};
+};
+
+class ActionHandlerSlot {
+ public:
+  ActionHandlerSlot() { ActionHandlerSlots::instance().acquire(); }
+  ~ActionHandlerSlot() { ActionHandlerSlots::instance().release(); }
+  ActionHandlerSlot(const ActionHandlerSlot&) = delete;
+  ActionHandlerSlot(ActionHandlerSlot&&) = delete;
+  ActionHandlerSlot& operator=(const ActionHandlerSlot&) = delete;
+  ActionHandlerSlot& operator=(ActionHandlerSlot&&) = delete;
+};
+
 inline boost::filesystem::path addNewExtension(const boost::filesystem::path& fpath) {
   return boost::filesystem::path(fpath.string() + ".new");
 }
 
 TorizonGenericSecondary::TorizonGenericSecondary(const Primary::TorizonGenericSecondaryConfig& sconfig_in)
-    : ManagedSecondary(dynamic_cast<const ManagedSecondaryConfig&>(sconfig_in)), config_(sconfig_in) {}
+    : ManagedSecondary(dynamic_cast<const ManagedSecondaryConfig&>(sconfig_in)),
+      config_(sconfig_in),
+      firmware_digest_(config_.firmware_path, getFirmwareDigestPath()) {
+  ActionHandlerSlots::instance().limit(config_.action_handler_max_running);
+}
 
 bool TorizonGenericSecondary::getFirmwareInfo(Uptane::InstalledImageInfo& firmware_info) const {
   const std::string action{"get-firmware-info"};
@@ -111,7 +189,16 @@ bool TorizonGenericSecondary::getFirmwareInfo(Uptane::InstalledImageInfo& firmwa
       // Returning false here tells aktualizr that the information is not available.
       return false;
     case ActionHandlerResult::ReqNormalProc:
-      return ManagedSecondary::getFirmwareInfo(firmware_info);
+      // Same as ManagedSecondary::getFirmwareInfo() but without reading the whole file on every manifest.
+      if (!boost::filesystem::exists(config_.target_name_path) || !boost::filesystem::exists(config_.firmware_path)) {
+        firmware_info.name = std::string("noimage");
+        firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
+        firmware_info.len = 0;
+      } else {
+        firmware_info.name = Utils::readFile(config_.target_name_path.string());
+        getFirmwareDigest(firmware_info);
+      }
+      return true;
     case ActionHandlerResult::ProcOutput:
       proc_output = true;
       break;
@@ -148,18 +235,7 @@ bool TorizonGenericSecondary::getFirmwareInfo(Uptane::InstalledImageInfo& firmwa
         LOG_WARNING << action << ": Action-handler " << config_.action_handler_path
                     << " should always output both 'sha256' and 'length' fields or none of them";
       }
-      std::ifstream source(config_.firmware_path.string(), std::ios::in | std::ios::binary);
-      if (!source) {
-        // If file cannot be read generate the hash of an empty file mimicking the base class behavior.
-        firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
-        firmware_info.len = 0;
-      } else {
-        ssize_t nread = 0;
-        // TODO: [TORIZON] Consider doing the same in the base class: calculate the hash from the file
-        // instead of loading all of the file into memory to determine its hash.
-        firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(source, &nread);
-        firmware_info.len = static_cast<uint64_t>(nread);
-      }
+      getFirmwareDigest(firmware_info);
     }
 
     // ---
@@ -223,11 +299,7 @@ data::InstallationResult TorizonGenericSecondary::install(const Uptane::Target&
   boost::filesystem::path new_fwpath = getNewFirmwarePath();
   {
     LOG_TRACE << "Creating " << new_fwpath;
-    auto strm = secondary_provider_->getTargetFileHandle(target);
-    std::ofstream out_file(new_fwpath.string(), std::ios::binary);
-    out_file << strm.rdbuf();
-    strm.close();
-    out_file.close();
+    secondary_provider_->copyTargetFile(target, new_fwpath);
   }
 
   // Create new target-name file also with a temporary name.
@@ -394,15 +466,37 @@ const TorizonGenericSecondary::VarMap& TorizonGenericSecondary::getSharedVars(bo
   if (!update) {
     return shared_vars_;
   }
+  // Everything but the serial comes from the configuration, which does not change
+  const std::string serial = getSerial().ToString();
+  std::lock_guard<std::mutex> guard(cache_mutex_);
+  if (!shared_vars_.empty() && shared_vars_["SECONDARY_ECU_SERIAL"] == serial) {
+    return shared_vars_;
+  }
   shared_vars_.clear();
   shared_vars_["SECONDARY_INTERFACE_MAJOR"] = std::to_string(CURRENT_INTERFACE_MAJOR);
   shared_vars_["SECONDARY_INTERFACE_MINOR"] = std::to_string(CURRENT_INTERFACE_MINOR);
   shared_vars_["SECONDARY_FIRMWARE_PATH"] = config_.firmware_path.string();
   shared_vars_["SECONDARY_HARDWARE_ID"] = config_.ecu_hardware_id;
-  shared_vars_["SECONDARY_ECU_SERIAL"] = getSerial().ToString();
+  shared_vars_["SECONDARY_ECU_SERIAL"] = serial;
   return shared_vars_;
 }
 
+boost::filesystem::path TorizonGenericSecondary::getFirmwareDigestPath() const {
+  return config_.full_client_dir / "firmware_digest.json";
+}
+
+void TorizonGenericSecondary::getFirmwareDigest(Uptane::InstalledImageInfo& firmware_info) const {
+  std::string sha256;
+  uint64_t len = 0;
+  if (!firmware_digest_.get(&sha256, &len)) {
+    // If file cannot be read generate the hash of an empty file mimicking the base class behavior.
+    sha256 = Uptane::ManifestIssuer::generateVersionHashStr("");
+    len = 0;
+  }
+  firmware_info.hash = sha256;
+  firmware_info.len = len;
+}
+
 boost::filesystem::path TorizonGenericSecondary::getNewFirmwarePath() const {
   if (config_.firmware_path.empty()) {
     throw std::runtime_error(std::string(TorizonGenericSecondaryConfig::Type) + "firmware path not configured");
@@ -451,6 +545,51 @@ void TorizonGenericSecondary::maybeFinishInstall(data::ResultCode::Numeric resul
 TorizonGenericSecondary::ActionHandlerResult TorizonGenericSecondary::callActionHandler(const std::string& action,
                                                                                         const VarMap& action_vars,
                                                                                         Json::Value* output) const {
+  TraceSpan span("secondary", "action-handler");
+  if (span.active()) {
+    span.annotate(action);
+  }
+  static auto& wait_latency = Metrics::instance().histogram(
+      "aktualizr_action_handler_wait_seconds", "Time action-handlers waited for another one to finish");
+
+  const auto queued = std::chrono::steady_clock::now();
+  ActionHandlerSlot slot;
+  const auto started = std::chrono::steady_clock::now();
+  wait_latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(started - queued));
+
+  const ActionHandlerResult result = runActionHandler(action, action_vars, output);
+
+  const char* metric;
+  switch (result) {
+    case ActionHandlerResult::NotAvailable:
+      metric = "aktualizr_action_handler_not_available_duration_seconds";
+      break;
+    case ActionHandlerResult::ReqNormalProc:
+      metric = "aktualizr_action_handler_normal_proc_duration_seconds";
+      break;
+    case ActionHandlerResult::ReqErrorProc:
+      metric = "aktualizr_action_handler_error_proc_duration_seconds";
+      break;
+    case ActionHandlerResult::ProcNoOutput:
+      metric = "aktualizr_action_handler_no_output_duration_seconds";
+      break;
+    case ActionHandlerResult::ProcOutput:
+    default:
+      metric = "aktualizr_action_handler_output_duration_seconds";
+      break;
+  }
+
+  const auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+  Metrics::instance().histogram(metric, "Duration of action-handler runs with this result").observe(duration);
+  LOG_DEBUG << "Action-handler (action=" << action << ") took " << duration.count() / 1000 << " ms, after waiting "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(started - queued).count() << " ms";
+  return result;
+}
+
+TorizonGenericSecondary::ActionHandlerResult TorizonGenericSecondary::runActionHandler(const std::string& action,
+                                                                                       const VarMap& action_vars,
+                                                                                       Json::Value* output) const {
   // ---
   // Define action-handler environment.
   // ---
@@ -473,11 +612,45 @@ TorizonGenericSecondary::ActionHandlerResult TorizonGenericSecondary::callAction
   // Create temporary file name to hold program output.
   TemporaryFile temp_file("action");
 
+  // Scheduling settings applied by the child before running the handler. They are worked out here because only
+  // async-signal-safe calls may be made between fork() and exec().
+  errno = 0;
+  const int parent_nice = getpriority(PRIO_PROCESS, 0);
+  const bool set_nice = config_.action_handler_nice != 0 && errno == 0;
+  const int nice_value = parent_nice + config_.action_handler_nice;
+  // See ioprio_set(2) for the encoding
+  constexpr int kIoprioWhoProcess = 1;
+  constexpr int kIoprioClassShift = 13;
+  const int ioprio = (config_.action_handler_ionice_class << kIoprioClassShift) | config_.action_handler_ionice_level;
+  const bool set_ioprio = config_.action_handler_ionice_class != 0;
+  const std::string cgroup_procs =
+      config_.action_handler_cgroup.empty() ? "" : (config_.action_handler_cgroup / "cgroup.procs").string();
+  if (!cgroup_procs.empty() && !bf::exists(cgroup_procs)) {
+    LOG_WARNING << "cgroup " << config_.action_handler_cgroup << " does not exist; not moving action-handler into it";
+  }
+  auto child_setup = [&](auto& /* executor */) {
+    if (set_nice) {
+      setpriority(PRIO_PROCESS, 0, nice_value);
+    }
+    if (set_ioprio) {
+      syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, ioprio);
+    }
+    if (!cgroup_procs.empty()) {
+      // Writing 0 moves the writing process itself.
+      const int fd = open(cgroup_procs.c_str(), O_WRONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        (void)!write(fd, "0", 1);
+        close(fd);
+      }
+    }
+  };
+
   // Start action-handler program.
   std::error_code ec;
   auto start_dir_ = (!config_.full_client_dir.empty()) ? config_.full_client_dir : bf::current_path();
   auto start_dir = bp::start_dir(start_dir_);
-  bp::child action_proc(config_.action_handler_path, action, start_dir, bp::std_out > temp_file.Path(), env, ec);
+  bp::child action_proc(config_.action_handler_path, action, start_dir, bp::std_out > temp_file.Path(), env, ec,
+                        bp::extend::on_exec_setup(child_setup));
   if (ec) {
     LOG_WARNING << "Could not start action-handler " << config_.action_handler_path << ": " << ec.message();
     return ActionHandlerResult::NotAvailable;
@@ -2,11 +2,13 @@
 #define PRIMARY_TORIZONGENERICSECONDARY_H_
 
 #include <json/json.h>
+#include <mutex>
 #include <string>
 
 #include "gtest/gtest_prod.h"
 #include "libaktualizr/types.h"
 #include "managedsecondary.h"
+#include "utilities/file_digest_cache.h"
 
 namespace Primary {
 
@@ -21,6 +23,17 @@ class TorizonGenericSecondaryConfig : public ManagedSecondaryConfig {
   void dump(const boost::filesystem::path& file_full_path) const;
 
   boost::filesystem::path action_handler_path;
+  // Added to the niceness of the action-handler process; 0 keeps the one of aktualizr.
+  int action_handler_nice{0};
+  // I/O scheduling class of the action-handler process (1 = realtime, 2 = best-effort, 3 = idle) and its level
+  // (0-7, within classes 1 and 2); class 0 keeps the one of aktualizr.
+  int action_handler_ionice_class{0};
+  int action_handler_ionice_level{0};
+  // cgroup directory (e.g. /sys/fs/cgroup/updates) the action-handler process is moved into; empty to not move it.
+  boost::filesystem::path action_handler_cgroup;
+  // Maximum number of action-handlers running at the same time across all generic Secondaries; 0 for no limit.
+  // When several Secondaries set it, the smallest value applies.
+  unsigned int action_handler_max_running{0};
 };
 
 class TorizonGenericSecondary : public ManagedSecondary {
@@ -67,6 +80,8 @@ class TorizonGenericSecondary : public ManagedSecondary {
    */
   ActionHandlerResult callActionHandler(const std::string& action, const VarMap& action_vars,
                                         Json::Value* output = nullptr) const;
+  ActionHandlerResult runActionHandler(const std::string& action, const VarMap& action_vars,
+                                       Json::Value* output) const;
 
   /**
    * Get a map with the environment variables shared by all actions.
@@ -86,14 +101,26 @@ class TorizonGenericSecondary : public ManagedSecondary {
   boost::filesystem::path getNewFirmwarePath() const;
   boost::filesystem::path getNewTargetNamePath() const;
 
+  /**
+   * Set the hash and length of the current firmware file in `firmware_info`
+   * (those of an empty file when it cannot be read). The digest is cached in
+   * getFirmwareDigestPath(), see FileDigestCache.
+   */
+  void getFirmwareDigest(Uptane::InstalledImageInfo& firmware_info) const;
+  boost::filesystem::path getFirmwareDigestPath() const;
+
+  mutable std::mutex cache_mutex_;  // Guards shared_vars_ updates
   mutable VarMap shared_vars_;
   TorizonGenericSecondaryConfig config_;
+  FileDigestCache firmware_digest_;
 
   friend class TorizonGenericSecondaryTest;
   FRIEND_TEST(TorizonGenericSecondaryTest, NonExistingHandler);
   FRIEND_TEST(TorizonGenericSecondaryTest, HandlerFinishedBySignal);
   FRIEND_TEST(TorizonGenericSecondaryTest, NoHandlerOutputExpected);
   FRIEND_TEST(TorizonGenericSecondaryTest, HandlerOutputExpected);
+  FRIEND_TEST(TorizonGenericSecondaryTest, HandlerScheduling);
+  FRIEND_TEST(TorizonGenericSecondaryTest, FirmwareDigestCache);
   FRIEND_TEST(TorizonGenericSecondaryTest, CompleteInstallFailure);
   FRIEND_TEST(TorizonGenericSecondaryTest, CompleteInstallSuccess);
 };
@@ -1,5 +1,7 @@
 #include "image_repo.h"
 
+#include <map>
+
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
@@ -178,3 +180,111 @@ std::vector<std::string> ImageRepo::getDelegationTargets(const Uptane::Role &nam
   }
   return result;
 }
+
+void ImageRepo::addBulk(const BulkSpec &spec) {
+  if (spec.delegations > 0 && spec.delegation_depth == 0) {
+    throw std::runtime_error("Delegation chains need a depth of at least one.");
+  }
+  if (spec.bin_bits > 0 && spec.delegations > 0) {
+    throw std::runtime_error("Hashed bins can not be combined with delegation chains.");
+  }
+  if (spec.bin_bits > 16) {
+    throw std::runtime_error("Hashed bins need a bit length of at most 16.");
+  }
+  boost::filesystem::path repo_dir(path_ / ImageRepo::dir);
+
+  // Everything is built in memory first; roles[0] is the top-level Targets
+  std::vector<std::pair<Uptane::Role, Json::Value>> roles;
+  Json::Value top = Utils::parseJSONFile(repo_dir / "targets.json")["signed"];
+  top["version"] = (top["version"].asUInt()) + 1;
+  roles.emplace_back(Uptane::Role::Targets(), top);
+
+  std::vector<size_t> leaves{0};
+  std::vector<std::string> prefixes{"bulk/"};
+  for (uint32_t chain = 0; chain < spec.delegations; ++chain) {
+    const std::string prefix = "bulk/" + std::to_string(chain) + "/";
+    size_t parent = 0;
+    for (uint32_t level = 0; level < spec.delegation_depth; ++level) {
+      const Uptane::Role name("bulk-" + std::to_string(chain) + "-" + std::to_string(level), true);
+      if (keys_.count(name) != 0) {
+        throw std::runtime_error("Delegation with the same name already exist.");
+      }
+      generateKeyPair(spec.key_type, name);
+      const auto &keypair = keys_[name];
+
+      Json::Value role;
+      role["name"] = name.ToString();
+      role["keyids"].append(keypair.public_key.KeyId());
+      role["paths"].append(prefix + "*");
+      role["threshold"] = 1;
+      role["terminating"] = false;
+      Json::Value &parent_json = roles[parent].second;
+      parent_json["delegations"]["keys"][keypair.public_key.KeyId()] = keypair.public_key.ToUptane();
+      parent_json["delegations"]["roles"].append(role);
+
+      Json::Value delegate;
+      delegate["_type"] = "Targets";
+      delegate["expires"] = expiration_time_;
+      delegate["version"] = 1;
+      delegate["targets"] = Json::objectValue;
+      roles.emplace_back(name, delegate);
+      parent = roles.size() - 1;
+    }
+    leaves.push_back(parent);
+    prefixes.push_back(prefix);
+  }
+
+  // All bins share the keys of the role named after their prefix
+  const Uptane::Role bins_role("bulk-bins", true);
+  std::map<std::string, size_t> bins;
+  if (spec.bin_bits > 0) {
+    if (keys_.count(bins_role) != 0) {
+      throw std::runtime_error("Delegation with the same name already exist.");
+    }
+    generateKeyPair(spec.key_type, bins_role);
+    const auto &keypair = keys_[bins_role];
+
+    Json::Value succinct;
+    succinct["keyids"].append(keypair.public_key.KeyId());
+    succinct["threshold"] = 1;
+    succinct["bit_length"] = spec.bin_bits;
+    succinct["name_prefix"] = bins_role.ToString();
+    roles[0].second["delegations"]["keys"][keypair.public_key.KeyId()] = keypair.public_key.ToUptane();
+    roles[0].second["delegations"]["succinct_roles"] = succinct;
+
+    for (uint64_t bin = 0; bin < (uint64_t{1} << spec.bin_bits); ++bin) {
+      const std::string name = Uptane::Targets::binName(bins_role.ToString(), spec.bin_bits, bin);
+      Json::Value delegate;
+      delegate["_type"] = "Targets";
+      delegate["expires"] = expiration_time_;
+      delegate["version"] = 1;
+      delegate["targets"] = Json::objectValue;
+      roles.emplace_back(Uptane::Role(name, true), delegate);
+      bins.emplace(name, roles.size() - 1);
+    }
+  }
+
+  for (uint64_t i = 0; i < spec.targets; ++i) {
+    const size_t leaf = i % leaves.size();
+    const std::string name = prefixes[leaf] + "firmware-" + std::to_string(i) + ".bin";
+    const size_t holder = bins.empty()
+                              ? leaves[leaf]
+                              : bins.at(Uptane::Targets::binForPath(bins_role.ToString(), spec.bin_bits, name));
+    Json::Value target;
+    target["length"] = Json::UInt64(spec.target_length);
+    // There is no content; the hashes only have to differ between targets
+    target["hashes"]["sha256"] = Crypto::sha256digestHex(name);
+    target["custom"]["targetFormat"] = spec.target_format;
+    target["custom"]["hardwareIds"][0] = spec.hardware_id;
+    roles[holder].second["targets"][name] = target;
+  }
+
+  for (const auto &role : roles) {
+    const boost::filesystem::path role_path =
+        role.first.IsDelegation() ? (repo_dir / "delegations" / role.first.ToString()).string() + ".json"
+                                  : repo_dir / "targets.json";
+    const Uptane::Role &signer = bins.count(role.first.ToString()) != 0 ? bins_role : role.first;
+    Utils::writeFile(role_path, Utils::jsonToCanonicalStr(signTuf(signer, role.second)));
+  }
+  updateRepo();
+}
@@ -3,6 +3,25 @@
 
 #include "repo.h"
 
+/**
+ * Synthetic content for load tests. `targets` custom images are spread evenly
+ * over the top-level Targets and `delegations` chains of `delegation_depth`
+ * delegated roles each; only the last role of a chain holds targets.
+ * Alternatively, with `bin_bits` set, the top-level Targets delegates all of
+ * them to 2^bin_bits hashed bins (TAP-15).
+ */
+struct BulkSpec {
+  uint64_t targets{0};
+  uint32_t delegations{0};
+  uint32_t delegation_depth{1};
+  uint32_t bin_bits{0};
+  uint32_t root_rotations{0};
+  std::string hardware_id;
+  std::string target_format{"BINARY"};
+  uint64_t target_length{1024};
+  KeyType key_type{KeyType::kED25519};
+};
+
 class ImageRepo : public Repo {
  public:
   ImageRepo(boost::filesystem::path path, const std::string &expires, std::string correlation_id)
@@ -17,6 +36,11 @@ class ImageRepo : public Repo {
                      bool terminating, KeyType key_type);
   void revokeDelegation(const Uptane::Role &name);
   std::vector<std::string> getDelegationTargets(const Uptane::Role &name);
+  /**
+   * Add the targets and delegations of `spec` in one pass: each role is signed
+   * and written once, rather than once per target.
+   */
+  void addBulk(const BulkSpec &spec);
 
   // note: it used to be "repo/image" which is way less confusing but we've just
   // given up and adopted what the backend does
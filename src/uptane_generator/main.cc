@@ -1,4 +1,6 @@
+#include <signal.h>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <istream>
@@ -7,6 +9,7 @@
 #include <string>
 
 #include "logging/logging.h"
+#include "repo_server.h"
 #include "uptane_repo.h"
 #include "utilities/aktualizr_version.h"
 #include "utilities/utils.h"
@@ -49,7 +52,9 @@ int main(int argc, char **argv) {
                                           "sign: \tsign arbitrary metadata with repo keys\n"
                                           "addcampaigns: \tgenerate campaigns json\n"
                                           "refresh: \trefresh a metadata object (bump the version)\n"
-                                          "rotate: \trotate a Root metadata key")
+                                          "rotate: \trotate a Root metadata key\n"
+                                          "bulk: \tadd synthetic targets, delegation chains and Root rotations in one pass\n"
+                                          "serve: \tserve the repos over HTTP until interrupted")
     ("path", po::value<boost::filesystem::path>(), "path to the repository")
     ("filename", po::value<boost::filesystem::path>(), "path to the image")
     ("hwid", po::value<std::string>(), "target hardware identifier")
@@ -70,7 +75,19 @@ int main(int argc, char **argv) {
     ("dparent", po::value<std::string>()->default_value("targets"), "delegated role parent name")
     ("dpattern", po::value<std::string>(), "delegated file path pattern")
     ("url", po::value<std::string>(), "custom download URL")
-    ("customversion", po::value<int32_t>(), "custom version");
+    ("customversion", po::value<int32_t>(), "custom version")
+    ("ntargets", po::value<uint64_t>()->default_value(0), "number of targets for 'bulk' command")
+    ("ndelegations", po::value<uint32_t>()->default_value(0), "number of delegation chains for 'bulk' command")
+    ("ddepth", po::value<uint32_t>()->default_value(1), "number of delegated roles per chain for 'bulk' command")
+    ("binbits", po::value<uint32_t>()->default_value(0), "delegate the targets of 'bulk' command to 2^binbits hashed bins")
+    ("nrotations", po::value<uint32_t>()->default_value(0), "number of Root rotations for 'bulk' command")
+    ("address", po::value<std::string>()->default_value("127.0.0.1"), "address to listen on for 'serve' command")
+    ("port", po::value<uint16_t>()->default_value(0), "port to listen on for 'serve' command (0 picks a free one)")
+    ("targetsdir", po::value<boost::filesystem::path>(), "directory of the targets served by 'serve' command (default: the Image repo targets)")
+    ("latency", po::value<uint32_t>()->default_value(0), "milliseconds to wait before each answer of 'serve' command")
+    ("bandwidth", po::value<uint64_t>()->default_value(0), "bytes per second sent on each connection by 'serve' command (0 for no limit)")
+    ("errorevery", po::value<uint32_t>()->default_value(0), "make every n-th request to 'serve' command fail")
+    ("errorstatus", po::value<int>()->default_value(503), "HTTP status of the failed requests of 'serve' command (0 closes the connection)");
   // clang-format on
 
   po::positional_options_description positionalOptions;
@@ -251,6 +268,54 @@ int main(int argc, char **argv) {
         }
         KeyType key_type = parseKeyType(vm);
         repo.rotate(Uptane::RepositoryType(vm["repotype"].as<std::string>()), Uptane::Role::Root(), key_type);
+      } else if (command == "bulk") {
+        if (vm.count("hwid") == 0) {
+          std::cerr << "bulk command requires --hwid\n";
+          exit(EXIT_FAILURE);
+        }
+        BulkSpec spec;
+        spec.targets = vm["ntargets"].as<uint64_t>();
+        spec.delegations = vm["ndelegations"].as<uint32_t>();
+        spec.delegation_depth = vm["ddepth"].as<uint32_t>();
+        spec.bin_bits = vm["binbits"].as<uint32_t>();
+        spec.root_rotations = vm["nrotations"].as<uint32_t>();
+        spec.hardware_id = vm["hwid"].as<std::string>();
+        if (vm.count("targetformat") != 0) {
+          spec.target_format = vm["targetformat"].as<std::string>();
+        }
+        if (vm.count("targetlength") != 0) {
+          spec.target_length = vm["targetlength"].as<uint64_t>();
+        }
+        spec.key_type = parseKeyType(vm);
+        repo.generateBulk(spec);
+        std::cout << "Added " << spec.targets << " targets in " << spec.delegations << " delegation chains and "
+                  << spec.root_rotations << " Root rotations to the repos" << std::endl;
+      } else if (command == "serve") {
+        ServeOptions options;
+        options.address = vm["address"].as<std::string>();
+        options.port = vm["port"].as<uint16_t>();
+        if (vm.count("targetsdir") != 0) {
+          options.targets_dir = vm["targetsdir"].as<boost::filesystem::path>();
+        }
+        options.latency = std::chrono::milliseconds(vm["latency"].as<uint32_t>());
+        options.bandwidth = vm["bandwidth"].as<uint64_t>();
+        options.error_every = vm["errorevery"].as<uint32_t>();
+        options.error_status = vm["errorstatus"].as<int>();
+
+        // Blocked before the server's threads start, so that they inherit it
+        // and only sigwait() sees the signals.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        RepoServer server(repo_dir, options);
+        server.start();
+        std::cout << "Serving " << repo_dir << " on " << options.address << ":" << server.port() << std::endl;
+        int received = 0;
+        sigwait(&signals, &received);
+        server.stop();
+        std::cout << "Served " << server.requests_served() << " requests" << std::endl;
       } else {
         std::cout << desc << std::endl;
         exit(EXIT_FAILURE);
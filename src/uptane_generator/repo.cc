@@ -44,6 +44,15 @@ void Repo::addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &ro
     for (auto it = delegations_list.begin(); it != delegations_list.end(); it++) {
       addDelegationToSnapshot(snapshot, Uptane::Role((*it)["name"].asString(), true));
     }
+
+    const Json::Value &succinct = role_json["delegations"]["succinct_roles"];
+    if (succinct.isObject()) {
+      const uint32_t bits = succinct["bit_length"].asUInt();
+      for (uint64_t bin = 0; bin < (uint64_t{1} << bits); ++bin) {
+        addDelegationToSnapshot(
+            snapshot, Uptane::Role(Uptane::Targets::binName(succinct["name_prefix"].asString(), bits, bin), true));
+      }
+    }
   }
 }
 
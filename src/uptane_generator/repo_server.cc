@@ -0,0 +1,485 @@
+#include "repo_server.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <vector>
+
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+#include "crypto/crypto.h"
+#include "director_repo.h"
+#include "image_repo.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+using boost::asio::ip::tcp;
+
+struct RepoServer::Request {
+  std::string method;
+  std::string target;
+  std::string version;
+  // By lower case name
+  std::map<std::string, std::string> headers;
+
+  std::string header(const std::string &name) const {
+    auto it = headers.find(name);
+    return it == headers.end() ? std::string() : it->second;
+  }
+};
+
+struct RepoServer::Response {
+  int status{200};
+  std::vector<std::pair<std::string, std::string>> headers;
+  // The body is `length` bytes of `file` from `offset`, if there is a file.
+  boost::filesystem::path file;
+  uintmax_t offset{0};
+  uintmax_t length{0};
+};
+
+namespace {
+// Longest request head accepted.
+constexpr size_t kMaxRequestHead = 64 * 1024;
+constexpr size_t kReadChunk = 64 * 1024;
+constexpr uint64_t kMaxShapedChunk = 16 * 1024;
+
+std::string Trim(const std::string &text) {
+  const auto first = text.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return std::string();
+  }
+  return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool StartsWith(const std::string &text, const std::string &prefix) {
+  return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool EndsWith(const std::string &text, const std::string &suffix) {
+  return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string PercentDecode(const std::string &text) {
+  std::string decoded;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '%' && i + 2 < text.size() && std::isxdigit(text[i + 1]) != 0 &&
+        std::isxdigit(text[i + 2]) != 0) {
+      decoded += static_cast<char>(std::stoi(text.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      decoded += text[i];
+    }
+  }
+  return decoded;
+}
+
+bool MatchesEtag(const std::string &if_none_match, const std::string &etag) {
+  std::istringstream candidates(if_none_match);
+  std::string candidate;
+  while (std::getline(candidates, candidate, ',')) {
+    candidate = Trim(candidate);
+    if (StartsWith(candidate, "W/")) {
+      candidate = candidate.substr(2);
+    }
+    if (candidate == "*" || candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+enum class RangeResult { kIgnored, kUnsatisfiable, kSatisfiable };
+
+// Single byte ranges only: anything else is ignored and the whole file sent,
+// which RFC 7233 allows.
+RangeResult ParseRange(const std::string &range, const uintmax_t size, uintmax_t *first, uintmax_t *last) {
+  const std::string prefix = "bytes=";
+  if (!StartsWith(range, prefix) || range.find(',') != std::string::npos) {
+    return RangeResult::kIgnored;
+  }
+  const std::string spec = Trim(range.substr(prefix.size()));
+  const auto dash = spec.find('-');
+  if (dash == std::string::npos) {
+    return RangeResult::kIgnored;
+  }
+  const std::string from = spec.substr(0, dash);
+  const std::string to = spec.substr(dash + 1);
+  const auto is_number = [](const std::string &s) {
+    return !s.empty() && std::all_of(s.cbegin(), s.cend(), [](char c) { return std::isdigit(c) != 0; });
+  };
+  try {
+    if (from.empty()) {
+      // The last `to` bytes
+      if (!is_number(to)) {
+        return RangeResult::kIgnored;
+      }
+      const uintmax_t suffix = std::stoull(to);
+      if (suffix == 0 || size == 0) {
+        return RangeResult::kUnsatisfiable;
+      }
+      *first = size - std::min(suffix, size);
+      *last = size - 1;
+      return RangeResult::kSatisfiable;
+    }
+    if (!is_number(from) || (!to.empty() && !is_number(to))) {
+      return RangeResult::kIgnored;
+    }
+    *first = std::stoull(from);
+    *last = to.empty() ? size - 1 : std::min<uintmax_t>(std::stoull(to), size - 1);
+    if (!to.empty() && std::stoull(to) < *first) {
+      return RangeResult::kIgnored;
+    }
+  } catch (const std::out_of_range &) {
+    return RangeResult::kIgnored;
+  }
+  if (*first >= size) {
+    return RangeResult::kUnsatisfiable;
+  }
+  return RangeResult::kSatisfiable;
+}
+
+const char *Reason(const int status) {
+  switch (status) {
+    case 200:
+      return "OK";
+    case 206:
+      return "Partial Content";
+    case 304:
+      return "Not Modified";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 416:
+      return "Range Not Satisfiable";
+    case 500:
+      return "Internal Server Error";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Unknown";
+  }
+}
+
+/* Writes to a socket no faster than `bandwidth` bytes per second, if set. */
+class ShapedWriter {
+ public:
+  ShapedWriter(tcp::socket &socket, const uint64_t bandwidth) : socket_(socket), bandwidth_(bandwidth) {}
+
+  void write(const char *data, size_t size) {
+    if (bandwidth_ == 0) {
+      boost::asio::write(socket_, boost::asio::buffer(data, size));
+      return;
+    }
+    // Small enough pieces that the rate is even at a tenth of a second.
+    const auto piece = static_cast<size_t>(std::max<uint64_t>(1, std::min(kMaxShapedChunk, bandwidth_ / 10)));
+    while (size > 0) {
+      const size_t n = std::min(piece, size);
+      boost::asio::write(socket_, boost::asio::buffer(data, n));
+      data += n;
+      size -= n;
+      sent_ += n;
+      std::this_thread::sleep_until(start_ + std::chrono::microseconds(sent_ * 1000000 / bandwidth_));
+    }
+  }
+
+ private:
+  tcp::socket &socket_;
+  const uint64_t bandwidth_;
+  const std::chrono::steady_clock::time_point start_{std::chrono::steady_clock::now()};
+  uint64_t sent_{0};
+};
+
+}  // namespace
+
+bool RepoServer::parseRequest(std::istream &stream, Request *request) {
+  std::string line;
+  // Empty lines before a request are allowed.
+  do {
+    if (!std::getline(stream, line)) {
+      return false;
+    }
+    line = Trim(line);
+  } while (line.empty());
+  std::istringstream request_line(line);
+  if (!(request_line >> request->method >> request->target >> request->version)) {
+    return false;
+  }
+  while (std::getline(stream, line)) {
+    line = Trim(line);
+    if (line.empty()) {
+      break;
+    }
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+    request->headers[name] = Trim(line.substr(colon + 1));
+  }
+  return StartsWith(request->version, "HTTP/1.") && StartsWith(request->target, "/");
+}
+
+RepoServer::RepoServer(boost::filesystem::path repo_path, ServeOptions options)
+    : repo_path_(std::move(repo_path)),
+      options_(std::move(options)),
+      targets_dir_(options_.targets_dir.empty() ? repo_path_ / ImageRepo::dir / "targets" : options_.targets_dir) {}
+
+RepoServer::~RepoServer() { stop(); }
+
+void RepoServer::start() {
+  const tcp::endpoint endpoint(boost::asio::ip::address::from_string(options_.address), options_.port);
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+  port_ = acceptor_.local_endpoint().port();
+  accept();
+  accept_thread_ = std::thread([this]() { io_service_.run(); });
+}
+
+void RepoServer::stop() {
+  if (stopping_.exchange(true)) {
+    return;
+  }
+  io_service_.stop();
+  if (accept_thread_.joinable()) {
+    accept_thread_.join();
+  }
+  boost::system::error_code ignored;
+  acceptor_.close(ignored);
+
+  std::lock_guard<std::mutex> guard(connections_mutex_);
+  for (auto &connection : connections_) {
+    // Wakes up the connection if it waits for a request.
+    connection.socket->shutdown(tcp::socket::shutdown_both, ignored);
+  }
+  for (auto &connection : connections_) {
+    connection.thread.join();
+  }
+  connections_.clear();
+}
+
+void RepoServer::accept() {
+  auto socket = std::make_shared<tcp::socket>(io_service_);
+  acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code &error) {
+    if (stopping_) {
+      return;
+    }
+    if (!error) {
+      std::lock_guard<std::mutex> guard(connections_mutex_);
+      for (auto it = connections_.begin(); it != connections_.end();) {
+        if (it->done) {
+          it->thread.join();
+          it = connections_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      connections_.emplace_back();
+      Connection &connection = connections_.back();
+      connection.socket = socket;
+      connection.thread = std::thread([this, &connection]() { serve(connection); });
+    } else {
+      LOG_WARNING << "Failed to accept a connection: " << error.message();
+    }
+    accept();
+  });
+}
+
+void RepoServer::serve(Connection &connection) {
+  tcp::socket &socket = *connection.socket;
+  boost::asio::streambuf buffer(kMaxRequestHead);
+  try {
+    while (!stopping_) {
+      boost::system::error_code error;
+      boost::asio::read_until(socket, buffer, "\r\n\r\n", error);
+      if (error) {
+        break;
+      }
+      std::istream stream(&buffer);
+      Request request;
+      const bool valid = parseRequest(stream, &request);
+      const uint64_t number = ++requests_;
+      if (options_.latency.count() > 0) {
+        std::this_thread::sleep_for(options_.latency);
+      }
+
+      Response response;
+      if (!valid) {
+        response.status = 400;
+      } else if (options_.error_every != 0 && number % options_.error_every == 0) {
+        if (options_.error_status == 0) {
+          LOG_DEBUG << "Dropping the connection on request " << number;
+          break;
+        }
+        response.status = options_.error_status;
+      } else {
+        try {
+          response = respond(request);
+        } catch (const std::exception &e) {
+          LOG_ERROR << "Failed to answer " << request.target << ": " << e.what();
+          response = Response();
+          response.status = 500;
+        }
+      }
+      if (response.file.empty()) {
+        response.length = 0;
+      }
+      LOG_DEBUG << request.method << " " << request.target << " " << response.status;
+
+      // A request with a body is not supported, so the connection can't be
+      // reused after one.
+      const bool has_body = !request.header("transfer-encoding").empty() ||
+                            (!request.header("content-length").empty() && request.header("content-length") != "0");
+      const std::string connection_header = request.header("connection");
+      const bool keep_alive = valid && !has_body &&
+                              (request.version == "HTTP/1.1" ? connection_header != "close"
+                                                             : connection_header == "keep-alive");
+
+      std::ostringstream head;
+      head << "HTTP/1.1 " << response.status << " " << Reason(response.status) << "\r\n";
+      for (const auto &header : response.headers) {
+        head << header.first << ": " << header.second << "\r\n";
+      }
+      if (response.status != 304) {
+        head << "Content-Length: " << response.length << "\r\n";
+      }
+      head << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+
+      ShapedWriter writer(socket, options_.bandwidth);
+      const std::string head_str = head.str();
+      writer.write(head_str.data(), head_str.size());
+      if (request.method != "HEAD" && response.length > 0) {
+        std::ifstream file(response.file.c_str(), std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(response.offset));
+        std::array<char, kReadChunk> chunk{};
+        uintmax_t left = response.length;
+        while (left > 0 && file) {
+          file.read(chunk.data(), static_cast<std::streamsize>(std::min<uintmax_t>(left, chunk.size())));
+          const auto n = static_cast<size_t>(file.gcount());
+          writer.write(chunk.data(), n);
+          left -= n;
+        }
+        if (left > 0) {
+          // The length was promised, so the client can't tell otherwise.
+          break;
+        }
+      }
+      if (!keep_alive) {
+        break;
+      }
+    }
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Connection closed: " << e.what();
+  }
+  boost::system::error_code ignored;
+  socket.shutdown(tcp::socket::shutdown_both, ignored);
+  connection.done = true;
+}
+
+RepoServer::Response RepoServer::respond(const Request &request) {
+  Response response;
+  if (request.method != "GET" && request.method != "HEAD") {
+    response.status = 405;
+    response.headers.emplace_back("Allow", "GET, HEAD");
+    return response;
+  }
+  const boost::filesystem::path file = resolve(request.target);
+  if (file.empty() || !boost::filesystem::is_regular_file(file)) {
+    response.status = 404;
+    return response;
+  }
+
+  const uintmax_t size = boost::filesystem::file_size(file);
+  const std::string etag = etagOf(file);
+  response.headers.emplace_back("ETag", etag);
+  response.headers.emplace_back("Accept-Ranges", "bytes");
+  response.headers.emplace_back("Content-Type",
+                                EndsWith(file.string(), ".json") ? "application/json" : "application/octet-stream");
+  if (MatchesEtag(request.header("if-none-match"), etag)) {
+    response.status = 304;
+    return response;
+  }
+
+  response.file = file;
+  response.length = size;
+  const std::string range = request.header("range");
+  const std::string if_range = request.header("if-range");
+  uintmax_t first = 0;
+  uintmax_t last = 0;
+  if (range.empty() || (!if_range.empty() && if_range != etag)) {
+    return response;
+  }
+  switch (ParseRange(range, size, &first, &last)) {
+    case RangeResult::kUnsatisfiable:
+      response.status = 416;
+      response.headers.emplace_back("Content-Range", "bytes */" + std::to_string(size));
+      response.file.clear();
+      break;
+    case RangeResult::kSatisfiable:
+      response.status = 206;
+      response.headers.emplace_back("Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) +
+                                                         "/" + std::to_string(size));
+      response.offset = first;
+      response.length = last - first + 1;
+      break;
+    case RangeResult::kIgnored:
+    default:
+      break;
+  }
+  return response;
+}
+
+boost::filesystem::path RepoServer::resolve(const std::string &target) const {
+  const std::string path = PercentDecode(target.substr(0, target.find('?')));
+  // Nothing outside of the repos is served.
+  if ((path + "/").find("/../") != std::string::npos) {
+    return boost::filesystem::path();
+  }
+  const std::string targets_prefix = "/repo/targets/";
+  if (StartsWith(path, targets_prefix)) {
+    return targets_dir_ / path.substr(targets_prefix.size());
+  }
+  if (EndsWith(path, ".json")) {
+    if (StartsWith(path, "/director/")) {
+      return repo_path_ / DirectorRepo::dir / path.substr(std::string("/director/").size());
+    }
+    if (StartsWith(path, "/repo/")) {
+      return repo_path_ / ImageRepo::dir / path.substr(std::string("/repo/").size());
+    }
+  }
+  return boost::filesystem::path();
+}
+
+std::string RepoServer::etagOf(const boost::filesystem::path &file) {
+  const auto stamp = std::make_pair(boost::filesystem::file_size(file), boost::filesystem::last_write_time(file));
+  {
+    std::lock_guard<std::mutex> guard(etags_mutex_);
+    auto it = etags_.find(file);
+    if (it != etags_.end() && it->second.first == stamp) {
+      return it->second.second;
+    }
+  }
+
+  MultiPartSHA256Hasher hasher;
+  std::ifstream stream(file.c_str(), std::ios::binary);
+  std::array<char, kReadChunk> chunk{};
+  while (stream) {
+    stream.read(chunk.data(), chunk.size());
+    hasher.update(reinterpret_cast<const unsigned char *>(chunk.data()), static_cast<uint64_t>(stream.gcount()));
+  }
+  const std::string etag = "\"" + Utils::toHex(hasher.getDigest(), true) + "\"";
+
+  std::lock_guard<std::mutex> guard(etags_mutex_);
+  etags_[file] = std::make_pair(stamp, etag);
+  return etag;
+}
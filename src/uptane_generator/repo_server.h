@@ -0,0 +1,99 @@
+#ifndef REPO_SERVER_H_
+#define REPO_SERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/filesystem.hpp>
+
+/**
+ * How `serve` behaves. The shaping applies to every request: `latency` is
+ * waited before answering, `bandwidth` caps the bytes per second sent on each
+ * connection, and every `error_every`th request gets `error_status` instead of
+ * its answer (or, with `error_status` 0, the connection closed on it).
+ */
+struct ServeOptions {
+  std::string address{"127.0.0.1"};
+  // 0 picks a free port, see RepoServer::port().
+  uint16_t port{0};
+  // Empty means the targets of the Image repo.
+  boost::filesystem::path targets_dir;
+  std::chrono::milliseconds latency{0};
+  uint64_t bandwidth{0};
+  uint32_t error_every{0};
+  int error_status{503};
+};
+
+/**
+ * Serves the repos generated by uptane-generator over HTTP/1.1, with the same
+ * layout as the fake test server: `/director/<file>.json`,
+ * `/repo/<file>.json` (delegations included) and `/repo/targets/<target>`.
+ * Connections are kept alive; GET and HEAD are answered, with ETags (the
+ * SHA256 of the file), If-None-Match, and single byte ranges (Range and
+ * If-Range), so that clients can be benchmarked against it without Python in
+ * the way. Each connection is served by its own thread.
+ */
+class RepoServer {
+ public:
+  RepoServer(boost::filesystem::path repo_path, ServeOptions options);
+  ~RepoServer();
+  RepoServer(const RepoServer &) = delete;
+  RepoServer(RepoServer &&) = delete;
+  RepoServer &operator=(const RepoServer &) = delete;
+  RepoServer &operator=(RepoServer &&) = delete;
+
+  /* Start listening and serving in the background. Throws if the address can't
+   * be bound. */
+  void start();
+  /* Stop listening and close all connections. */
+  void stop();
+  /* The port listened on, once started. */
+  uint16_t port() const { return port_; }
+  uint64_t requests_served() const { return requests_; }
+
+ private:
+  struct Request;
+  struct Response;
+  struct Connection {
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  static bool parseRequest(std::istream &stream, Request *request);
+  void accept();
+  void serve(Connection &connection);
+  Response respond(const Request &request);
+  boost::filesystem::path resolve(const std::string &target) const;
+  std::string etagOf(const boost::filesystem::path &file);
+
+  const boost::filesystem::path repo_path_;
+  const ServeOptions options_;
+  const boost::filesystem::path targets_dir_;
+  boost::asio::io_service io_service_;
+  boost::asio::ip::tcp::acceptor acceptor_{io_service_};
+  std::thread accept_thread_;
+  uint16_t port_{0};
+  std::atomic<bool> stopping_{false};
+  std::atomic<uint64_t> requests_{0};
+
+  std::mutex connections_mutex_;
+  std::list<Connection> connections_;
+
+  // ETags by file, with the size and modification time they were computed for.
+  std::mutex etags_mutex_;
+  std::map<boost::filesystem::path, std::pair<std::pair<uintmax_t, std::time_t>, std::string>> etags_;
+};
+
+#endif  // REPO_SERVER_H_
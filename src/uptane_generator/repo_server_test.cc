@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "http/httpclient.h"
+#include "logging/logging.h"
+#include "repo_server.h"
+#include "uptane_repo.h"
+#include "utilities/utils.h"
+
+namespace {
+std::string UrlOf(const RepoServer &server, const std::string &path) {
+  return "http://127.0.0.1:" + std::to_string(server.port()) + path;
+}
+}  // namespace
+
+/*
+ * Serve metadata with its SHA256 as ETag, and tell clients that already have
+ * it so.
+ */
+TEST(RepoServer, MetadataAndEtags) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(KeyType::kED25519);
+  RepoServer server(temp_dir.Path(), ServeOptions());
+  server.start();
+
+  HttpClient http;
+  HttpValidators validators;
+  const std::string root = Utils::readFile(temp_dir.Path() / DirectorRepo::dir / "root.json");
+  HttpResponse response = http.getConditional(UrlOf(server, "/director/root.json"), -1, &validators, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, root);
+  EXPECT_EQ(validators.etag, "\"" + Crypto::sha256digestHex(root) + "\"");
+
+  response = http.getConditional(UrlOf(server, "/director/root.json"), -1, &validators, nullptr);
+  EXPECT_EQ(response.http_status_code, 304);
+  EXPECT_TRUE(response.body.empty());
+
+  response = http.get(UrlOf(server, "/repo/timestamp.json"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, Utils::readFile(temp_dir.Path() / ImageRepo::dir / "timestamp.json"));
+
+  EXPECT_EQ(http.get(UrlOf(server, "/repo/nonexistent.json"), -1, nullptr).http_status_code, 404);
+  EXPECT_EQ(http.get(UrlOf(server, "/repo/../../keys/image/root/private.key"), -1, nullptr).http_status_code, 404);
+  EXPECT_EQ(server.requests_served(), 5U);
+}
+
+/*
+ * Serve targets whole or in byte ranges.
+ */
+TEST(RepoServer, TargetRanges) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(KeyType::kED25519);
+  const std::string content = "0123456789abcdefghij";
+  Utils::writeFile(temp_dir.Path() / "image.bin", content);
+  repo.addImage(temp_dir.Path() / "image.bin", "image.bin", "hwid");
+  RepoServer server(temp_dir.Path(), ServeOptions());
+  server.start();
+
+  HttpClient http;
+  HttpResponse response = http.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, content);
+
+  const std::vector<std::string> range{"Range: bytes=5-9"};
+  HttpClient http_range(&range);
+  response = http_range.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 206);
+  EXPECT_EQ(response.body, content.substr(5, 5));
+
+  const std::vector<std::string> suffix{"Range: bytes=-3"};
+  HttpClient http_suffix(&suffix);
+  response = http_suffix.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 206);
+  EXPECT_EQ(response.body, "hij");
+
+  const std::vector<std::string> beyond{"Range: bytes=20-"};
+  HttpClient http_beyond(&beyond);
+  EXPECT_EQ(http_beyond.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr).http_status_code, 416);
+
+  // The range is for another version of the file, so all of it is sent.
+  const std::vector<std::string> stale{"Range: bytes=5-9", "If-Range: \"stale\""};
+  HttpClient http_stale(&stale);
+  response = http_stale.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, content);
+}
+
+/*
+ * Delay answers, cap the bandwidth and fail every n-th request; the client
+ * retries the failed request.
+ */
+TEST(RepoServer, Shaping) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(KeyType::kED25519);
+  Utils::writeFile(temp_dir.Path() / "image.bin", std::string(20000, 'x'));
+  repo.addImage(temp_dir.Path() / "image.bin", "image.bin", "hwid");
+
+  ServeOptions options;
+  options.latency = std::chrono::milliseconds(100);
+  options.bandwidth = 100000;
+  options.error_every = 2;
+  options.error_status = 500;
+  RepoServer server(temp_dir.Path(), options);
+  server.start();
+
+  HttpClient http;
+  const auto start = std::chrono::steady_clock::now();
+  HttpResponse response = http.get(UrlOf(server, "/repo/targets/image.bin"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body.size(), 20000U);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+
+  response = http.get(UrlOf(server, "/repo/root.json"), -1, nullptr);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(server.requests_served(), 3U);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
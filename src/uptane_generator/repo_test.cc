@@ -677,6 +677,87 @@ TEST(uptane_generator, rotateDirectorRoot) { test_rotation(Uptane::RepositoryTyp
  */
 TEST(uptane_generator, rotateImageRoot) { test_rotation(Uptane::RepositoryType::Image()); }
 
+/*
+ * Generate targets, delegation chains and Root rotations in bulk.
+ */
+TEST(uptane_generator, bulk) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  BulkSpec spec;
+  spec.targets = 100;
+  spec.delegations = 2;
+  spec.delegation_depth = 3;
+  spec.root_rotations = 2;
+  spec.hardware_id = "primary_hw";
+  spec.key_type = key_type;
+  repo.generateBulk(spec);
+  check_repo(temp_dir);
+
+  const boost::filesystem::path repo_dir = temp_dir.Path() / ImageRepo::dir;
+  EXPECT_TRUE(boost::filesystem::exists(repo_dir / "3.root.json"));
+  EXPECT_TRUE(boost::filesystem::exists(temp_dir.Path() / DirectorRepo::dir / "3.root.json"));
+
+  auto root = Uptane::Root(Uptane::RepositoryType::Image(), Utils::parseJSONFile(repo_dir / "root.json"));
+  auto parent = std::make_shared<Uptane::Targets>(Uptane::RepositoryType::Image(), Uptane::Role::Targets(),
+                                                  Utils::parseJSONFile(repo_dir / "targets.json"),
+                                                  std::make_shared<Uptane::MetaWithKeys>(root));
+  size_t count = parent->targets.size();
+  EXPECT_EQ(parent->delegated_role_names_.size(), 2);
+  const Json::Value snapshot = Utils::parseJSONFile(repo_dir / "snapshot.json")["signed"];
+  // Follow the first chain down to its last role, verifying every role against its parent
+  for (uint32_t level = 0; level < spec.delegation_depth; ++level) {
+    const Uptane::Role role("bulk-0-" + std::to_string(level), true);
+    EXPECT_TRUE(snapshot["meta"].isMember(role.ToString() + ".json"));
+    parent = std::make_shared<Uptane::Targets>(
+        Uptane::RepositoryType::Image(), role,
+        Utils::parseJSONFile((repo_dir / "delegations" / role.ToString()).string() + ".json"), parent);
+    count += parent->targets.size();
+  }
+  EXPECT_EQ(parent->targets.size(), 33);
+  EXPECT_EQ(parent->targets[0].filename(), "bulk/0/firmware-1.bin");
+  EXPECT_EQ(count, 67);
+}
+
+/*
+ * Generate targets in bulk in hashed bins, and check that each bin verifies
+ * against the keys of the top-level Targets and holds the targets hashed to it.
+ */
+TEST(uptane_generator, bulkHashedBins) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  BulkSpec spec;
+  spec.targets = 100;
+  spec.bin_bits = 3;
+  spec.hardware_id = "primary_hw";
+  spec.key_type = key_type;
+  repo.generateBulk(spec);
+  check_repo(temp_dir);
+
+  const boost::filesystem::path repo_dir = temp_dir.Path() / ImageRepo::dir;
+  auto root = Uptane::Root(Uptane::RepositoryType::Image(), Utils::parseJSONFile(repo_dir / "root.json"));
+  auto top = std::make_shared<Uptane::Targets>(Uptane::RepositoryType::Image(), Uptane::Role::Targets(),
+                                               Utils::parseJSONFile(repo_dir / "targets.json"),
+                                               std::make_shared<Uptane::MetaWithKeys>(root));
+  EXPECT_TRUE(top->targets.empty());
+  ASSERT_EQ(top->delegationCount(), 8);
+  const Json::Value snapshot = Utils::parseJSONFile(repo_dir / "snapshot.json")["signed"];
+  size_t count = 0;
+  for (size_t i = 0; i < top->delegationCount(); ++i) {
+    const Uptane::Role role = top->delegationAt(i);
+    EXPECT_TRUE(snapshot["meta"].isMember(role.ToString() + ".json"));
+    const Uptane::Targets bin(Uptane::RepositoryType::Image(), role,
+                              Utils::parseJSONFile((repo_dir / "delegations" / role.ToString()).string() + ".json"),
+                              top);
+    for (const auto &target : bin.targets) {
+      EXPECT_EQ(top->delegationsForPath(target.filename()), std::vector<Uptane::Role>{role});
+    }
+    count += bin.targets.size();
+  }
+  EXPECT_EQ(count, 100);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -60,3 +60,12 @@ void UptaneRepo::rotate(Uptane::RepositoryType repo_type, const Uptane::Role &ro
     image_repo_.rotate(role, key_type);
   }
 }
+
+void UptaneRepo::generateBulk(const BulkSpec &spec) {
+  // Rotate first, while the Snapshot to update after each rotation is small
+  for (uint32_t i = 0; i < spec.root_rotations; ++i) {
+    director_repo_.rotate(Uptane::Role::Root(), spec.key_type);
+    image_repo_.rotate(Uptane::Role::Root(), spec.key_type);
+  }
+  image_repo_.addBulk(spec);
+}
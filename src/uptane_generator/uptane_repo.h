@@ -25,6 +25,7 @@ class UptaneRepo {
   void generateCampaigns();
   void refresh(Uptane::RepositoryType repo_type, const Uptane::Role &role);
   void rotate(Uptane::RepositoryType repo_type, const Uptane::Role &role, KeyType key_type = KeyType::kRSA2048);
+  void generateBulk(const BulkSpec &spec);
 
  private:
   DirectorRepo director_repo_;
@@ -5,6 +5,7 @@
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
+#include <fstream>
 
 #include "crypto/crypto.h"
 #include "logging/logging.h"
@@ -72,8 +73,8 @@ ManagedSecondary::~ManagedSecondary() {}  // NOLINT(modernize-use-equals-default
 data::InstallationResult ManagedSecondary::putMetadata(const Uptane::Target &target) {
   detected_attack = "";
 
-  Uptane::MetaBundle bundle;
-  if (!secondary_provider_->getMetadata(&bundle, target)) {
+  auto bundle = secondary_provider_->getMetadataBundle(target);
+  if (bundle == nullptr) {
     return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
                                     "Unable to load stored metadata from Primary");
   }
@@ -147,8 +148,8 @@ data::InstallationResult ManagedSecondary::putMetadataOffUpd(const Uptane::Targe
    *
    * Are we losing some security by accessing directly the offline fetcher here?
    */
-  Uptane::MetaBundle bundle;
-  if (!secondary_provider_->getMetadata(&bundle, target)) {
+  auto bundle = secondary_provider_->getMetadataBundle(target);
+  if (bundle == nullptr) {
     return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
                                     "Unable to load stored metadata from Primary");
   }
@@ -257,11 +258,7 @@ data::InstallationResult ManagedSecondary::install(const Uptane::Target &target,
   }
 
   // TODO: check that the target is actually valid.
-  auto str = secondary_provider_->getTargetFileHandle(target);
-  std::ofstream out_file(sconfig.firmware_path.string(), std::ios::binary);
-  out_file << str.rdbuf();
-  str.close();
-  out_file.close();
+  secondary_provider_->copyTargetFile(target, sconfig.firmware_path);
 
   Utils::writeFile(sconfig.target_name_path, target.filename());
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -295,17 +292,21 @@ Uptane::Manifest ManagedSecondary::getManifest() const {
 }
 
 bool ManagedSecondary::getFirmwareInfo(Uptane::InstalledImageInfo &firmware_info) const {
-  std::string content;
-
   if (!boost::filesystem::exists(sconfig.target_name_path) || !boost::filesystem::exists(sconfig.firmware_path)) {
     firmware_info.name = std::string("noimage");
-    content = "";
-  } else {
-    firmware_info.name = Utils::readFile(sconfig.target_name_path.string());
-    content = Utils::readFile(sconfig.firmware_path.string());
+    firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
+    firmware_info.len = 0;
+    return true;
   }
-  firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(content);
-  firmware_info.len = content.size();
+
+  firmware_info.name = Utils::readFile(sconfig.target_name_path.string());
+  // Hash the firmware while reading it, instead of loading all of it into memory first
+  std::ifstream source(sconfig.firmware_path.string(), std::ios::in | std::ios::binary);
+  ssize_t nread = 0;
+  // A file that cannot be read is reported as empty, as before
+  firmware_info.hash = source ? Uptane::ManifestIssuer::generateVersionHashStr(source, &nread)
+                              : Uptane::ManifestIssuer::generateVersionHashStr("");
+  firmware_info.len = static_cast<uint64_t>(nread);
 
   return true;
 }
@@ -0,0 +1,73 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "asn1_message.h"
+#include "logging/logging.h"
+
+/* A putMetaReq carrying Image repository metadata of the given size. */
+static Asn1Message::Ptr putMetaRequest(size_t targets_size) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_putMetaReq);
+  auto m = req->putMetaReq();
+  m->director.present = director_PR_json;
+  m->image.present = image_PR_json;
+  const std::string root(4096, 'r');
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->director.choice.json.root, root);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->director.choice.json.targets, std::string(2048, 't'));
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->image.choice.json.root, root);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->image.choice.json.timestamp, std::string(512, 's'));
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->image.choice.json.snapshot, std::string(1024, 's'));
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
+  SetString(&m->image.choice.json.targets, std::string(targets_size, 't'));
+  return req;
+}
+
+static void BM_Asn1Encode(benchmark::State& state) {
+  Asn1Message::Ptr req = putMetaRequest(static_cast<size_t>(state.range(0)));
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    asn_enc_rval_t res = der_encode(&asn_DEF_AKIpUptaneMes, &req->msg_, Asn1StringAppendCallback, &out);
+    if (res.encoded == -1) {
+      state.SkipWithError("der_encode failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(out.size()));
+}
+BENCHMARK(BM_Asn1Encode)->Arg(1024)->Arg(1024 * 1024);
+
+static void BM_Asn1Decode(benchmark::State& state) {
+  std::string encoded;
+  der_encode(&asn_DEF_AKIpUptaneMes, &putMetaRequest(static_cast<size_t>(state.range(0)))->msg_,
+             Asn1StringAppendCallback, &encoded);
+  for (auto _ : state) {
+    AKIpUptaneMes_t* m = nullptr;
+    asn_codec_ctx_t context{};
+    asn_dec_rval_t res =
+        ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), encoded.data(), encoded.size());
+    // Takes ownership of m, also when decoding failed
+    Asn1Message::Ptr msg = Asn1Message::FromRaw(&m);
+    if (res.code != RC_OK) {
+      state.SkipWithError("ber_decode failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(encoded.size()));
+}
+BENCHMARK(BM_Asn1Decode)->Arg(1024)->Arg(1024 * 1024);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import sys
+
+"""
+Merge the JSON output of Google Benchmark runs and compare it against the
+results of an earlier run, e.g. the one archived with the last release.
+A benchmark fails when its real time grew by more than its tolerance in the
+thresholds file.
+"""
+
+NS_PER_UNIT = {'ns': 1, 'us': 1e3, 'ms': 1e6, 's': 1e9}
+
+
+def load_results(paths):
+    results = {}
+    context = None
+    for p in paths:
+        with open(p) as f:
+            data = json.load(f)
+        context = context or data.get('context')
+        for b in data['benchmarks']:
+            if b.get('run_type', 'iteration') != 'iteration' or 'error_occurred' in b:
+                continue
+            results[b['name']] = b['real_time'] * NS_PER_UNIT[b.get('time_unit', 'ns')]
+    return context, results
+
+
+def tolerance(thresholds, name):
+    return thresholds['benchmarks'].get(name.split('/')[0], thresholds['default_tolerance'])
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check benchmark results for regressions')
+    parser.add_argument('--thresholds', required=True, help='allowed slowdown per benchmark')
+    parser.add_argument('--baseline', help='merged results of an earlier run')
+    parser.add_argument('--output', help='write the merged results of this run here')
+    parser.add_argument('results', nargs='+', help='Google Benchmark JSON output files')
+    args = parser.parse_args()
+
+    with open(args.thresholds) as f:
+        thresholds = json.load(f)
+    context, results = load_results(args.results)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({'context': context, 'real_time_ns': results}, f, indent=2, sort_keys=True)
+
+    if not args.baseline:
+        for name, t in sorted(results.items()):
+            print(f'{name}: {t / 1e6:.3f} ms')
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)['real_time_ns']
+
+    failures = 0
+    for name, t in sorted(results.items()):
+        if name not in baseline:
+            print(f'{name}: {t / 1e6:.3f} ms (new)')
+            continue
+        change = t / baseline[name] - 1
+        allowed = tolerance(thresholds, name)
+        status = 'REGRESSION' if change > allowed else 'ok'
+        print(f'{name}: {t / 1e6:.3f} ms ({change:+.1%}, allowed {allowed:+.0%}) {status}')
+        if change > allowed:
+            failures += 1
+    for name in sorted(set(baseline) - set(results)):
+        print(f'{name}: missing from this run')
+
+    if failures:
+        print(f'{failures} benchmark(s) regressed')
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+/* Random data of the size given by the benchmark argument. */
+static std::string randomData(int64_t size) {
+  std::mt19937 gen;
+  std::string data(static_cast<size_t>(size), '\0');
+  for (auto& c : data) {
+    c = static_cast<char>(gen());
+  }
+  return data;
+}
+
+static void BM_Base64Encode(benchmark::State& state) {
+  const std::string data = randomData(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::toBase64(data));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Encode)->Arg(64)->Arg(4 * 1024)->Arg(1024 * 1024);
+
+static void BM_Base64Decode(benchmark::State& state) {
+  const std::string base64 = Utils::toBase64(randomData(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::fromBase64(base64));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Decode)->Arg(64)->Arg(4 * 1024)->Arg(1024 * 1024);
+
+static void BM_HexEncode(benchmark::State& state) {
+  const std::string data = randomData(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::toHex(data));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HexEncode)->Arg(32)->Arg(4 * 1024);
+
+static void BM_HexDecode(benchmark::State& state) {
+  const std::string hex = Utils::toHex(randomData(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::fromHex(hex));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HexDecode)->Arg(32)->Arg(4 * 1024);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+
+#include "libaktualizr/aktualizr.h"
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "test_utils.h"
+#include "uptane_repo.h"
+#include "utilities/utils.h"
+
+static std::string server = "http://127.0.0.1:";
+static boost::filesystem::path meta_dir;
+
+static Config makeConfig(const boost::filesystem::path &storage_dir) {
+  Config conf;
+  conf.pacman.type = PACKAGE_MANAGER_NONE;
+  conf.provision.device_id = "device_id";
+  conf.provision.ecu_registration_endpoint = server + "/director/ecus";
+  conf.tls.server = server;
+  conf.uptane.director_server = server + "/director";
+  conf.uptane.repo_server = server + "/repo";
+  conf.uptane.key_type = KeyType::kED25519;
+  conf.provision.server = server;
+  conf.provision.provision_path = "tests/test_data/cred.zip";
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.storage.path = storage_dir;
+  conf.bootloader.reboot_sentinel_dir = storage_dir;
+  conf.postUpdateValues();
+  return conf;
+}
+
+/* Check, download and install one update on a freshly provisioned device.
+ * Provisioning is not part of the measurement. */
+static void BM_UptaneCycle(benchmark::State &state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    TemporaryDirectory storage_dir;
+    Config conf = makeConfig(storage_dir.Path());
+    Aktualizr aktualizr(conf);
+    aktualizr.Initialize();
+    state.ResumeTiming();
+
+    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    if (update_result.status != result::UpdateStatus::kUpdatesAvailable) {
+      state.SkipWithError("no update available");
+      break;
+    }
+    result::Download download_result = aktualizr.Download(update_result.updates).get();
+    if (download_result.status != result::DownloadStatus::kSuccess) {
+      state.SkipWithError("download failed");
+      break;
+    }
+    result::Install install_result = aktualizr.Install(update_result.updates).get();
+    if (install_result.ecu_reports.size() != 1 || !install_result.ecu_reports[0].install_res.isSuccess()) {
+      state.SkipWithError("install failed");
+      break;
+    }
+  }
+}
+BENCHMARK(BM_UptaneCycle)->Unit(benchmark::kMillisecond);
+
+/* A check for updates when the metadata did not change. */
+static void BM_UptaneCheckNoChange(benchmark::State &state) {
+  TemporaryDirectory storage_dir;
+  Config conf = makeConfig(storage_dir.Path());
+  Aktualizr aktualizr(conf);
+  aktualizr.Initialize();
+  aktualizr.CheckUpdates().get();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(aktualizr.CheckUpdates().get().status);
+  }
+}
+BENCHMARK(BM_UptaneCheckNoChange)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+
+  TemporaryDirectory repo_dir;
+  UptaneRepo repo(repo_dir.Path(), "", "");
+  repo.generateRepo(KeyType::kED25519);
+  const boost::filesystem::path firmware = repo_dir / "firmware.bin";
+  Utils::writeFile(firmware, std::string(1024 * 1024, 'f'));
+  repo.addImage(firmware, firmware.filename(), "primary_hw");
+  repo.addTarget(firmware.filename().string(), "primary_hw", "CA:FE:A6:D2:84:9D");
+  repo.signTargets();
+
+  const std::string port = TestUtils::getFreePort();
+  server += port;
+  boost::process::child server_process("tests/fake_http_server/fake_test_server.py", port, "-m", repo_dir.PathString());
+  TestUtils::waitForServer(server + "/");
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
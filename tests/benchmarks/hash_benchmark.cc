@@ -0,0 +1,99 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "utilities/block_reader.h"
+#include "utilities/utils.h"
+
+/* Hash throughput with the chunk size given by the benchmark argument. */
+static void hashChunks(benchmark::State& state, Hash::Type type) {
+  const std::string chunk(static_cast<size_t>(state.range(0)), 'x');
+  auto hasher = MultiPartHasher::create(type);
+  for (auto _ : state) {
+    hasher->update(reinterpret_cast<const unsigned char*>(chunk.data()), chunk.size());
+  }
+  benchmark::DoNotOptimize(hasher->getHexDigest());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_HashSha256(benchmark::State& state) { hashChunks(state, Hash::Type::kSha256); }
+BENCHMARK(BM_HashSha256)->Arg(4 * 1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+static void BM_HashSha512(benchmark::State& state) { hashChunks(state, Hash::Type::kSha512); }
+BENCHMARK(BM_HashSha512)->Arg(4 * 1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+// Size of the stored target the file benchmarks hash
+static constexpr size_t kFileSize = 64 * 1024 * 1024;
+
+/* A stored target, dropped from the page cache before each iteration so that
+ * it is read from storage again. */
+class StoredTarget {
+ public:
+  StoredTarget() { file_.PutContents(std::string(kFileSize, 'x')); }
+  std::string path() const { return file_.PathString(); }
+  void evict() const {
+    const int fd = open(file_.PathString().c_str(), O_RDONLY | O_CLOEXEC);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+
+ private:
+  TemporaryFile file_;
+};
+
+/* Reading back and hashing a stored target through an ifstream in 64 KiB
+ * reads, as targets were hashed before BlockReader. */
+static void BM_HashFileStream(benchmark::State& state) {
+  const StoredTarget target;
+  std::vector<char> buf(64 * 1024);
+  for (auto _ : state) {
+    state.PauseTiming();
+    target.evict();
+    state.ResumeTiming();
+    auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+    std::ifstream data(target.path(), std::ios::binary);
+    while (data.read(buf.data(), static_cast<std::streamsize>(buf.size())) || data.gcount() > 0) {
+      hasher->update(reinterpret_cast<const unsigned char*>(buf.data()), static_cast<uint64_t>(data.gcount()));
+    }
+    benchmark::DoNotOptimize(hasher->getHexDigest());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(kFileSize));
+}
+BENCHMARK(BM_HashFileStream)->Unit(benchmark::kMillisecond);
+
+/* Reading back and hashing a stored target with BlockReader in reads of the
+ * size given by the benchmark argument: 1 MiB as for hashing downloads, 64 KiB
+ * like the chunks sent to IP Secondaries. */
+static void BM_HashFileBlocks(benchmark::State& state) {
+  const StoredTarget target;
+  std::vector<uint8_t> buf(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    state.PauseTiming();
+    target.evict();
+    state.ResumeTiming();
+    auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+    BlockReader reader(target.path(), 0, kFileSize);
+    while (const size_t count = reader.read(buf.data(), buf.size())) {
+      hasher->update(buf.data(), count);
+    }
+    benchmark::DoNotOptimize(hasher->getHexDigest());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(kFileSize));
+}
+BENCHMARK(BM_HashFileBlocks)->Arg(64 * 1024)->Arg(1024 * 1024)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
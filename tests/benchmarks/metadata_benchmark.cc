@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "json/json.h"
+
+#include "crypto/crypto.h"
+#include "image_repo.h"
+#include "logging/logging.h"
+#include "uptane/tuf.h"
+#include "utilities/json_reader.h"
+#include "utilities/utils.h"
+
+/* Signed Image repository metadata with a Targets role of a given size. */
+struct LargeRepo {
+  explicit LargeRepo(int64_t targets_count) {
+    ImageRepo repo(dir.Path(), "", "");
+    repo.generateRepo(KeyType::kED25519);
+    root = Utils::readFile(dir / ImageRepo::dir / "root.json");
+
+    Json::Value targets_signed = Utils::parseJSONFile(dir / ImageRepo::dir / "targets.json")["signed"];
+    for (int64_t i = 0; i < targets_count; ++i) {
+      const std::string name = "firmware-" + std::to_string(i) + ".bin";
+      Json::Value target;
+      target["length"] = Json::UInt64(1024 * 1024);
+      target["hashes"]["sha256"] = Crypto::sha256digestHex(name);
+      target["hashes"]["sha512"] = Crypto::sha512digestHex(name);
+      target["custom"]["targetFormat"] = "BINARY";
+      target["custom"]["hardwareIds"].append("primary_hw");
+      target["custom"]["version"] = Json::Int64(i);
+      targets_signed["targets"][name] = target;
+    }
+    targets = Utils::jsonToCanonicalStr(repo.signTuf(Uptane::Role::Targets(), targets_signed));
+  }
+
+  static const LargeRepo& get(int64_t targets_count) {
+    static std::map<int64_t, std::unique_ptr<LargeRepo>> repos;
+    auto& repo = repos[targets_count];
+    if (!repo) {
+      repo = std::make_unique<LargeRepo>(targets_count);
+    }
+    return *repo;
+  }
+
+  TemporaryDirectory dir;
+  std::string root;
+  std::string targets;
+};
+
+static void BM_TargetsParse(benchmark::State& state) {
+  const LargeRepo& repo = LargeRepo::get(state.range(0));
+  for (auto _ : state) {
+    Uptane::Targets targets(JsonReader::parse(repo.targets));
+    benchmark::DoNotOptimize(targets.targets.size());
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(repo.targets.size()));
+}
+BENCHMARK(BM_TargetsParse)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_TargetsVerify(benchmark::State& state) {
+  const LargeRepo& repo = LargeRepo::get(state.range(0));
+  auto root = std::make_shared<Uptane::Root>(Uptane::RepositoryType::Image(), Utils::parseJSON(repo.root));
+  for (auto _ : state) {
+    Uptane::Targets targets(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), JsonReader::parse(repo.targets),
+                            root);
+    benchmark::DoNotOptimize(targets.targets.size());
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(repo.targets.size()));
+}
+BENCHMARK(BM_TargetsVerify)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
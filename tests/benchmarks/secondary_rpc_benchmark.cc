@@ -0,0 +1,499 @@
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "aktualizr_secondary_config.h"
+#include "aktualizr_secondary_file.h"
+#include "ipuptanesecondary.h"
+#include "libaktualizr/config.h"
+#include "libaktualizr/packagemanagerfactory.h"
+#include "libaktualizr/packagemanagerinterface.h"
+#include "logging/logging.h"
+#include "logging/metrics.h"
+#include "primary/secondary_provider_builder.h"
+#include "secondary_tcp_server.h"
+#include "storage/invstorage.h"
+#include "uptane/tuf.h"
+#include "uptane_repo.h"
+#include "utilities/utils.h"
+
+namespace {
+
+/* A TCP proxy on the loopback interface that delays everything it forwards by
+ * half the round trip time in each direction. Loss is emulated by the stall it
+ * causes in TCP rather than by dropping data: a lost segment delays the rest of
+ * the stream by another round trip if enough segments follow it for a fast
+ * retransmit, or by the minimum retransmission timeout if not. */
+class NetworkEmulator {
+ public:
+  NetworkEmulator(in_port_t target_port, std::chrono::microseconds rtt, double loss)
+      : target_port_{target_port}, delay_{rtt / 2}, rtt_{rtt}, loss_{loss} {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = loopback(0);
+    socklen_t len = sizeof(addr);
+    if (listen_fd_ < 0 || bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd_, 16) != 0 || getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+      const int err = errno;
+      if (listen_fd_ >= 0) {
+        close(listen_fd_);
+      }
+      throw std::system_error(err, std::system_category(), "network emulator socket");
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread([this]() { acceptLoop(); });
+  }
+
+  ~NetworkEmulator() {
+    stop_ = true;
+    thread_.join();
+    links_.clear();
+    close(listen_fd_);
+  }
+  NetworkEmulator(const NetworkEmulator&) = delete;
+  NetworkEmulator(NetworkEmulator&&) = delete;
+  NetworkEmulator& operator=(const NetworkEmulator&) = delete;
+  NetworkEmulator& operator=(NetworkEmulator&&) = delete;
+
+  in_port_t port() const { return port_; }
+
+ private:
+  static constexpr size_t kSegmentSize{1448};
+  static constexpr std::chrono::milliseconds kMinRto{200};
+  // Segments that have to follow a lost one for three duplicate ACKs
+  static constexpr size_t kFastRetransmitSegments{4};
+
+  static sockaddr_in loopback(in_port_t port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);                     // NOLINT(readability-isolate-declaration)
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // NOLINT(readability-isolate-declaration)
+    return addr;
+  }
+
+  // Forwards one direction of a connection: a reader queues what it receives
+  // with the time it is due at the other end, a writer passes it on then.
+  class Pipe {
+   public:
+    Pipe(const NetworkEmulator& emulator, int from, int to) : emulator_{emulator}, from_{from}, to_{to} {
+      reader_ = std::thread([this]() { read(); });
+      writer_ = std::thread([this]() { write(); });
+    }
+    ~Pipe() {
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_all();
+      reader_.join();
+      writer_.join();
+    }
+    Pipe(const Pipe&) = delete;
+    Pipe(Pipe&&) = delete;
+    Pipe& operator=(const Pipe&) = delete;
+    Pipe& operator=(Pipe&&) = delete;
+
+    bool done() const {
+      std::lock_guard<std::mutex> guard(mutex_);
+      return done_;
+    }
+
+   private:
+    struct Packet {
+      std::chrono::steady_clock::time_point due;
+      std::string data;  // empty at the end of the stream
+    };
+
+    void read() {
+      std::vector<char> buf(64 * 1024);
+      std::mt19937 gen{std::random_device{}()};
+      auto last_due = std::chrono::steady_clock::now();
+      pollfd pfd{from_, POLLIN, 0};
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> guard(mutex_);
+          if (stop_ || done_) {
+            return;
+          }
+        }
+        if (poll(&pfd, 1, 100) <= 0) {
+          continue;
+        }
+        const ssize_t received = recv(from_, buf.data(), buf.size(), 0);
+        const size_t size = received > 0 ? static_cast<size_t>(received) : 0;
+        // Data never overtakes what was sent before it, like in TCP
+        auto due = std::max(std::chrono::steady_clock::now() + emulator_.delay_, last_due);
+        if (size > 0 && emulator_.loss_ > 0) {
+          const size_t segments = (size + kSegmentSize - 1) / kSegmentSize;
+          std::bernoulli_distribution lost(1.0 - std::pow(1.0 - emulator_.loss_, static_cast<double>(segments)));
+          if (lost(gen)) {
+            due += segments >= kFastRetransmitSegments
+                       ? emulator_.rtt_
+                       : std::chrono::duration_cast<std::chrono::microseconds>(kMinRto) + emulator_.rtt_;
+          }
+        }
+        last_due = due;
+        {
+          std::lock_guard<std::mutex> guard(mutex_);
+          queue_.push_back(Packet{due, std::string(buf.data(), size)});
+        }
+        cv_.notify_all();
+        if (size == 0) {
+          return;
+        }
+      }
+    }
+
+    void write() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;) {
+        cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (stop_) {
+          return;
+        }
+        const auto due = queue_.front().due;
+        if (due > std::chrono::steady_clock::now()) {
+          cv_.wait_until(lock, due, [this]() { return stop_; });
+          continue;
+        }
+        Packet packet = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        bool ok = !packet.data.empty();
+        for (size_t sent = 0; ok && sent < packet.data.size();) {
+          const ssize_t written = send(to_, packet.data.data() + sent, packet.data.size() - sent, MSG_NOSIGNAL);
+          ok = written > 0;
+          sent += ok ? static_cast<size_t>(written) : 0;
+        }
+        lock.lock();
+        if (!ok) {
+          shutdown(to_, SHUT_WR);
+          done_ = true;
+          return;
+        }
+      }
+    }
+
+    const NetworkEmulator& emulator_;
+    const int from_;
+    const int to_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Packet> queue_;
+    bool stop_{false};
+    bool done_{false};
+    std::thread reader_;
+    std::thread writer_;
+  };
+
+  struct Link {
+    Link(const NetworkEmulator& emulator, int client_fd, int server_fd)
+        : client{client_fd},
+          server{server_fd},
+          upstream{std_::make_unique<Pipe>(emulator, client_fd, server_fd)},
+          downstream{std_::make_unique<Pipe>(emulator, server_fd, client_fd)} {}
+    ~Link() {
+      upstream.reset();
+      downstream.reset();
+      close(client);
+      close(server);
+    }
+    Link(const Link&) = delete;
+    Link(Link&&) = delete;
+    Link& operator=(const Link&) = delete;
+    Link& operator=(Link&&) = delete;
+
+    int client;
+    int server;
+    std::unique_ptr<Pipe> upstream;
+    std::unique_ptr<Pipe> downstream;
+  };
+
+  void acceptLoop() {
+    pollfd pfd{listen_fd_, POLLIN, 0};
+    while (!stop_) {
+      links_.remove_if([](const std::unique_ptr<Link>& link) {
+        return link->upstream->done() && link->downstream->done();
+      });
+      if (poll(&pfd, 1, 100) <= 0) {
+        continue;
+      }
+      const int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client_fd < 0) {
+        continue;
+      }
+      const int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      const sockaddr_in addr = loopback(target_port_);
+      if (server_fd < 0 || connect(server_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        LOG_ERROR << "Network emulator failed to connect to port " << target_port_;
+        if (server_fd >= 0) {
+          close(server_fd);
+        }
+        close(client_fd);
+        continue;
+      }
+      links_.emplace_back(std_::make_unique<Link>(*this, client_fd, server_fd));
+    }
+  }
+
+  const in_port_t target_port_;
+  const std::chrono::microseconds delay_;
+  const std::chrono::microseconds rtt_;
+  const double loss_;
+  int listen_fd_{-1};
+  in_port_t port_{0};
+  std::atomic<bool> stop_{false};
+  std::list<std::unique_ptr<Link>> links_;
+  std::thread thread_;
+};
+
+/* A real Secondary with a FileUpdateAgent behind its TCP server, and the
+ * Uptane repository that signs the Targets for it. */
+class SecondaryUnderTest {
+ public:
+  explicit SecondaryUnderTest(uint64_t max_chunk_size) {
+    AktualizrSecondaryConfig config;
+    config.pacman.type = PACKAGE_MANAGER_NONE;
+    config.storage.path = storage_dir_.Path();
+    config.uptane.key_type = KeyType::kED25519;
+    config.network.max_upload_chunk_size = max_chunk_size;
+    // Every image is new, so a delta would only add a round trip
+    config.network.upload_delta = false;
+    secondary_ = std::make_shared<AktualizrSecondaryFile>(config);
+    secondary_->initialize();
+
+    server_ = std_::make_unique<SecondaryTcpServer>(*secondary_, "", 0);
+    thread_ = std::thread([this]() { server_->run(); });
+    server_->wait_until_running();
+
+    repo_.generateRepo(KeyType::kED25519);
+  }
+
+  ~SecondaryUnderTest() {
+    server_->stop();
+    thread_.join();
+  }
+  SecondaryUnderTest(const SecondaryUnderTest&) = delete;
+  SecondaryUnderTest(SecondaryUnderTest&&) = delete;
+  SecondaryUnderTest& operator=(const SecondaryUnderTest&) = delete;
+  SecondaryUnderTest& operator=(SecondaryUnderTest&&) = delete;
+
+  in_port_t port() const { return server_->port(); }
+
+  /* Signs a new image for the Secondary, hands it the metadata directly and
+   * stores the image on the Primary, ready to be uploaded. */
+  Uptane::Target prepareImage(size_t size, bool compressible, PackageManagerInterface& package_manager) {
+    std::string image(size, '\0');
+    if (compressible) {
+      const std::string line = "firmware line " + std::to_string(++generation_) + "\n";
+      for (size_t i = 0; i < size; ++i) {
+        image[i] = line[i % line.size()];
+      }
+    } else {
+      std::uniform_int_distribution<int> byte(0, 255);
+      std::generate(image.begin(), image.end(), [this, &byte]() { return static_cast<char>(byte(gen_)); });
+    }
+    const boost::filesystem::path image_path = repo_dir_ / "firmware.bin";
+    Utils::writeFile(image_path, image);
+
+    const std::string hw_id = secondary_->hwID().ToString();
+    const std::string serial = secondary_->serial().ToString();
+    repo_.addImage(image_path, image_path.filename(), hw_id);
+    repo_.addTarget(image_path.filename().string(), hw_id, serial);
+    repo_.signTargets();
+
+    const Uptane::MetaBundle bundle = metadata();
+    const data::InstallationResult result = secondary_->putMetadata(bundle);
+    if (!result.isSuccess()) {
+      throw std::runtime_error("Secondary rejected the metadata: " + result.description);
+    }
+    const Uptane::Targets targets(Utils::parseJSON(
+        Uptane::getMetaFromBundle(bundle, Uptane::RepositoryType::Director(), Uptane::Role::Targets())));
+    Uptane::Target target = targets.getTargets(secondary_->serial(), secondary_->hwID()).at(0);
+
+    auto fhandle = package_manager.createTargetFile(target);
+    fhandle.write(image.data(), static_cast<std::streamsize>(image.size()));
+    fhandle.close();
+    return target;
+  }
+
+ private:
+  Uptane::MetaBundle metadata() const {
+    const boost::filesystem::path director = repo_dir_ / "repo/director";
+    const boost::filesystem::path image = repo_dir_ / "repo/repo";
+    Uptane::MetaBundle bundle;
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Director(), Uptane::Role::Root()),
+                   Utils::readFile(director / "root.json"));
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Director(), Uptane::Role::Targets()),
+                   Utils::readFile(director / "targets.json"));
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Root()),
+                   Utils::readFile(image / "root.json"));
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Timestamp()),
+                   Utils::readFile(image / "timestamp.json"));
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Snapshot()),
+                   Utils::readFile(image / "snapshot.json"));
+    bundle.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Targets()),
+                   Utils::readFile(image / "targets.json"));
+    return bundle;
+  }
+
+  TemporaryDirectory storage_dir_;
+  TemporaryDirectory repo_dir_;
+  UptaneRepo repo_{repo_dir_.Path(), "", ""};
+  std::shared_ptr<AktualizrSecondaryFile> secondary_;
+  std::unique_ptr<SecondaryTcpServer> server_;
+  std::thread thread_;
+  std::mt19937 gen_{std::random_device{}()};
+  unsigned int generation_{0};
+};
+
+/* The Primary side: an IpUptaneSecondary that reads images from its own
+ * package manager. */
+class Primary {
+ public:
+  Primary(in_port_t port, bool keep_alive) {
+    config_.pacman.type = PACKAGE_MANAGER_NONE;
+    config_.pacman.images_path = storage_dir_ / "images";
+    config_.storage.path = storage_dir_.Path();
+    storage_ = INvStorage::newStorage(config_.storage);
+    package_manager_ = PackageManagerFactory::makePackageManager(config_.pacman, config_.bootloader, storage_, nullptr);
+    secondary_ = Uptane::IpUptaneSecondary::connectAndCreate("127.0.0.1", port, VerificationType::kFull, keep_alive);
+    if (secondary_ == nullptr) {
+      throw std::runtime_error("Failed to connect to the Secondary");
+    }
+    secondary_->init(SecondaryProviderBuilder::Build(config_, storage_, package_manager_));
+  }
+
+  PackageManagerInterface& packageManager() { return *package_manager_; }
+  SecondaryInterface& secondary() { return *secondary_; }
+
+ private:
+  TemporaryDirectory storage_dir_;
+  Config config_;
+  std::shared_ptr<INvStorage> storage_;
+  std::shared_ptr<PackageManagerInterface> package_manager_;
+  SecondaryInterface::Ptr secondary_;
+};
+
+void latencyCounters(benchmark::State& state, const MetricHistogram& latency) {
+  // Quantiles are the upper bounds of histogram buckets
+  state.counters["p50_ms"] = static_cast<double>(latency.quantileUs(0.5)) / 1000.0;
+  state.counters["p90_ms"] = static_cast<double>(latency.quantileUs(0.9)) / 1000.0;
+  state.counters["p99_ms"] = static_cast<double>(latency.quantileUs(0.99)) / 1000.0;
+}
+
+}  // namespace
+
+/* Upload and install an image on the Secondary. Arguments: image size in KiB,
+ * largest chunk the Secondary accepts in KiB, round trip time in ms, loss in
+ * permille and whether the image compresses. Only the upload and installation
+ * are measured, not the signing and the metadata. */
+static void BM_SecondaryUpload(benchmark::State& state) {
+  const auto image_size = static_cast<size_t>(state.range(0)) * 1024;
+  SecondaryUnderTest secondary(static_cast<uint64_t>(state.range(1)) * 1024);
+  NetworkEmulator network(secondary.port(), std::chrono::milliseconds(state.range(2)),
+                          static_cast<double>(state.range(3)) / 1000.0);
+  Primary primary(network.port(), false);
+
+  MetricHistogram latency;
+  double seconds = 0;
+  for (auto _ : state) {
+    const Uptane::Target target = secondary.prepareImage(image_size, state.range(4) != 0, primary.packageManager());
+    const auto start = std::chrono::steady_clock::now();
+    if (!primary.secondary().sendFirmware(target, InstallInfo(), nullptr).isSuccess()) {
+      state.SkipWithError("upload failed");
+      break;
+    }
+    if (!primary.secondary().install(target, InstallInfo(), nullptr).isSuccess()) {
+      state.SkipWithError("install failed");
+      break;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+    seconds += std::chrono::duration<double>(elapsed).count();
+    state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(image_size));
+  if (seconds > 0) {
+    state.counters["MB/s"] = static_cast<double>(state.iterations() * image_size) / seconds / 1e6;
+  }
+  latencyCounters(state, latency);
+}
+
+static void UploadArguments(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"image_kib", "chunk_kib", "rtt_ms", "loss_pm", "compressible"});
+  for (const int64_t image_kib : {256, 4096}) {
+    for (const int64_t chunk_kib : {4, 16, 64}) {
+      for (const int64_t rtt_ms : {0, 2, 20}) {
+        b->Args({image_kib, chunk_kib, rtt_ms, 0, 0});
+      }
+      b->Args({image_kib, chunk_kib, 20, 5, 0});
+    }
+    b->Args({image_kib, 64, 2, 0, 1});
+  }
+}
+BENCHMARK(BM_SecondaryUpload)->Apply(UploadArguments)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+/* Latency of a manifest request, the smallest RPC that does real work on the
+ * Secondary. Arguments: round trip time in ms, loss in permille and whether
+ * the connection is kept open between requests. */
+static void BM_SecondaryRpc(benchmark::State& state) {
+  SecondaryUnderTest secondary(64 * 1024);
+  NetworkEmulator network(secondary.port(), std::chrono::milliseconds(state.range(0)),
+                          static_cast<double>(state.range(1)) / 1000.0);
+  Primary primary(network.port(), state.range(2) != 0);
+
+  MetricHistogram latency;
+  for (auto _ : state) {
+    const auto start = std::chrono::steady_clock::now();
+    const Uptane::Manifest manifest = primary.secondary().getManifest();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (manifest.empty()) {
+      state.SkipWithError("no manifest");
+      break;
+    }
+    latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+    state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+  }
+  latencyCounters(state, latency);
+}
+BENCHMARK(BM_SecondaryRpc)
+    ->ArgNames({"rtt_ms", "loss_pm", "keep_alive"})
+    ->Args({0, 0, 0})
+    ->Args({0, 0, 1})
+    ->Args({2, 0, 0})
+    ->Args({2, 0, 1})
+    ->Args({20, 0, 0})
+    ->Args({20, 0, 1})
+    ->Args({20, 5, 1})
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+
+#include "json/json.h"
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "storage/sqlstorage.h"
+#include "utilities/utils.h"
+
+/* A fresh database in a temporary directory. */
+struct BenchStorage {
+  BenchStorage() {
+    config.path = dir.Path();
+    storage = std::make_unique<SQLStorage>(config, false);
+  }
+
+  TemporaryDirectory dir;
+  StorageConfig config;
+  std::unique_ptr<SQLStorage> storage;
+};
+
+static void BM_StoreNonRoot(benchmark::State& state) {
+  BenchStorage db;
+  const std::string meta(static_cast<size_t>(state.range(0)), 'm');
+  for (auto _ : state) {
+    db.storage->storeNonRoot(meta, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_StoreNonRoot)->Arg(1024)->Arg(1024 * 1024);
+
+static void BM_LoadNonRoot(benchmark::State& state) {
+  BenchStorage db;
+  db.storage->storeNonRoot(std::string(static_cast<size_t>(state.range(0)), 'm'), Uptane::RepositoryType::Image(),
+                           Uptane::Role::Targets());
+  std::string meta;
+  for (auto _ : state) {
+    db.storage->loadNonRoot(&meta, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LoadNonRoot)->Arg(1024)->Arg(1024 * 1024);
+
+/* Report events are written one at a time and read back in batches. */
+static void BM_ReportEvents(benchmark::State& state) {
+  BenchStorage db;
+  Json::Value event;
+  event["eventType"]["id"] = "EcuDownloadStarted";
+  event["event"]["ecu"] = "CA:FE:A6:D2:84:9D";
+  event["event"]["correlationId"] = "urn:here-ota:campaign:benchmark";
+  for (auto _ : state) {
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      event["id"] = Json::Int64(i);
+      db.storage->saveReportEvent(event);
+    }
+    Json::Value events{Json::arrayValue};
+    int64_t max_id = 0;
+    db.storage->loadReportEvents(&events, &max_id, -1);
+    db.storage->deleteReportEvents(max_id);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReportEvents)->Arg(10)->Arg(100);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,94 @@
+#!/usr/bin/python3
+
+import argparse
+import json
+import os
+import socketserver
+import threading
+import time
+
+from http.server import BaseHTTPRequestHandler
+from urllib.parse import parse_qs, urlsplit
+
+
+class Engine:
+    """Pulls served so far, and the most that ran at the same time."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.active = 0
+        self.max_active = 0
+        self.pulled = []
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_POST(self):
+        url = urlsplit(self.path)
+        if url.path != '/images/create':
+            self.reply(404, b'')
+            return
+        length = int(self.headers.get('content-length', 0))
+        self.rfile.read(length)
+        image = parse_qs(url.query)['fromImage'][0]
+
+        engine = self.server.engine
+        with engine.lock:
+            engine.active += 1
+            engine.max_active = max(engine.max_active, engine.active)
+        time.sleep(self.server.pull_time)
+        with engine.lock:
+            engine.active -= 1
+            engine.pulled.append(image)
+
+        # Like the daemon, answer 200 and report a failed pull in the stream
+        if 'broken' in image:
+            messages = [{'status': 'Pulling from ' + image}, {'error': 'manifest unknown'}]
+        else:
+            messages = [{'status': 'Pulling from ' + image},
+                        {'status': 'Pull complete', 'id': 'layer1'},
+                        {'status': 'Already exists', 'id': 'layer2'}]
+        self.reply(200, b''.join(json.dumps(m).encode('utf-8') + b'\n' for m in messages))
+
+    def do_GET(self):
+        # Not part of the Engine API: lets the tests check what was pulled
+        if self.path != '/stats':
+            self.reply(404, b'')
+            return
+        engine = self.server.engine
+        with engine.lock:
+            stats = {'pulled': sorted(engine.pulled), 'max_active': engine.max_active}
+        self.reply(200, json.dumps(stats).encode('utf-8'))
+
+    def reply(self, code, body):
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def address_string(self):
+        return 'unix'
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Fake Docker Engine API for image pulls')
+    parser.add_argument('socket', help='Unix socket to listen on')
+    parser.add_argument('--pull-time', type=float, default=0.3, help='seconds each pull takes')
+    args = parser.parse_args()
+
+    if os.path.exists(args.socket):
+        os.unlink(args.socket)
+    with Server(args.socket, Handler) as server:
+        server.engine = Engine()
+        server.pull_time = args.pull_time
+        server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
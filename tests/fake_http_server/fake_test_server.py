@@ -2,6 +2,8 @@
 
 import argparse
 import contextlib
+import gzip
+import hashlib
 import multiprocessing
 import logging
 import os
@@ -42,6 +44,18 @@ class Handler(SimpleHTTPRequestHandler):
                     break
                 self.wfile.write(data)
 
+    def _serve_validated(self, etag):
+        """Answer with 304 if the client already has this version, return True if it does"""
+        if self.headers.get('If-None-Match') == etag:
+            self.send_response(304)
+            self.send_header('ETag', etag)
+            self.end_headers()
+            return True
+        self.send_response(200)
+        self.send_header('ETag', etag)
+        self.end_headers()
+        return False
+
     def serve_meta(self, uri):
         if self.server.meta_path is None:
             raise RuntimeError("Please supply a path for metadata")
@@ -49,9 +63,10 @@ class Handler(SimpleHTTPRequestHandler):
             self.send_response(404)
             self.end_headers()
         else:
-            self.send_response(200)
-            self.end_headers()
-            self._serve_simple(self.server.meta_path + uri)
+            with open(self.server.meta_path + uri, 'rb') as source:
+                etag = '"%s"' % hashlib.sha256(source.read()).hexdigest()
+            if not self._serve_validated(etag):
+                self._serve_simple(self.server.meta_path + uri)
 
     def serve_target(self, filename):
         if self.server.target_path is None:
@@ -92,10 +107,12 @@ class Handler(SimpleHTTPRequestHandler):
             response_size = 100 * chunk_size
             if "Range" in self.headers:
                 r = self.headers["Range"]
-                r_from = int(r.split("=")[1].split("-")[0])
+                r_from, r_to = r.split("=")[1].split("-")
+                r_from = int(r_from)
+                r_to = int(r_to) if r_to else response_size - 1
                 self.send_response(206)
-                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, response_size-1, response_size))
-                response_size = response_size - r_from
+                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, r_to, response_size))
+                response_size = r_to + 1 - r_from
             else:
                 self.send_response(200)
             self.send_header('Content-Type', 'application/json')
@@ -118,6 +135,18 @@ class Handler(SimpleHTTPRequestHandler):
                 sleep(1)
         elif self.path == '/campaigner/campaigns':
             self.serve_meta("/campaigns.json")
+        elif self.path == '/etag':
+            if not self._serve_validated('"v1"'):
+                self.wfile.write(b'{"version": 1}')
+        elif self.path == '/gzip':
+            body = b'{"data": "' + b'a' * 65536 + b'"}'
+            self.send_response(200)
+            if 'gzip' in self.headers.get('Accept-Encoding', ''):
+                body = gzip.compress(body)
+                self.send_header('Content-Encoding', 'gzip')
+            self.send_header('Content-Length', len(body))
+            self.end_headers()
+            self.wfile.write(body)
         elif self.path == '/user_agent':
             user_agent = self.headers.get('user-agent')
             self.send_response(200)
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <unistd.h>
 
+#include <chrono>
+
 #include "utilities/fault_injection.h"
 #include "utilities/utils.h"
 
@@ -33,6 +35,23 @@ TEST(Fiuinfo, PassInfoWithCtrl) {
   EXPECT_FALSE(fiu_fail("failctrl"));
 }
 
+TEST(Fiuinfo, Throttle) {
+  const auto timed = []() {
+    const auto start = std::chrono::steady_clock::now();
+    fault_injection_throttle("throttle", 100);
+    return std::chrono::steady_clock::now() - start;
+  };
+
+  // 50 ms, plus 100 bytes at 1000 bytes per second
+  fault_injection_enable("throttle", 1, "50:1000", 0);
+  EXPECT_GE(timed(), std::chrono::milliseconds(150));
+  fault_injection_enable("throttle", 1, ":1000", 0);
+  EXPECT_GE(timed(), std::chrono::milliseconds(100));
+
+  fiu_disable("throttle");
+  EXPECT_LT(timed(), std::chrono::milliseconds(50));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -9,11 +9,14 @@ import subprocess
 import sys
 import time
 import hashlib
+import json
+import shutil
 from contextlib import ExitStack
 from http.server import BaseHTTPRequestHandler, HTTPServer
 from random import seed, randrange
 from pathlib import Path
 from tempfile import TemporaryDirectory
+from urllib.parse import urlsplit, parse_qs
 
 
 class TreehubServerHandler(BaseHTTPRequestHandler):
@@ -55,6 +58,12 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
     def do_POST(self):
         ctype, pdict = cgi.parse_header(self.headers['Content-Type'])
         print("Upload type: {}".format(ctype))
+        if self.path == '/objects/copy':
+            self.copy_objects()
+            return
+        if self.path.startswith('/uploads/'):
+            self.upload_chunk()
+            return
         if ctype == 'multipart/form-data':
             pdict['boundary'] = bytes(pdict['boundary'], 'utf-8')
             fields = cgi.parse_multipart(self.rfile, pdict)
@@ -93,6 +102,71 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
         self.send_response_only(400)
         self.end_headers()
 
+    def copy_objects(self):
+        # Server-side copy from the repository given with --copy-from, if any
+        if not args.copy_from:
+            self.send_response_only(404)
+            self.end_headers()
+            return
+        length = int(self.headers['content-length'])
+        request = json.loads(self.rfile.read(length))
+        copied = []
+        for obj in request['objects']:
+            source = os.path.join(args.copy_from, 'objects', obj)
+            if os.path.exists(source):
+                dest = os.path.join(repo_path, 'objects', obj)
+                os.makedirs(os.path.dirname(dest), exist_ok=True)
+                shutil.copyfile(source, dest)
+                copied.append(obj)
+        print("Copied {} of {} objects".format(len(copied), len(request['objects'])))
+        body = json.dumps({'copied': copied}).encode('utf-8')
+        self.send_response_only(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def upload_chunk(self):
+        # Chunked upload: /uploads/objects/...?offset=<start>&size=<total>
+        url = urlsplit(self.path)
+        query = parse_qs(url.query)
+        offset = int(query['offset'][0])
+        size = int(query['size'][0])
+        length = int(self.headers['content-length'])
+        body = self.rfile.read(length)
+        if args.fail_chunks and self.drop_check():
+            print("Dropping chunk at %d of %s" % (offset, url.path))
+            self.send_response_only(500)
+            self.end_headers()
+            return
+        object_path = url.path[len('/uploads/'):]
+        part_path = os.path.join(repo_path, 'uploads', object_path)
+        os.makedirs(os.path.dirname(part_path), exist_ok=True)
+        received = os.path.getsize(part_path) if os.path.exists(part_path) else 0
+        if offset > received:
+            self.send_response_only(416)
+            self.end_headers()
+            return
+        if args.lose_chunks and offset + length >= size:
+            print("Losing the chunks of %s" % url.path)
+            if os.path.exists(part_path):
+                os.remove(part_path)
+            self.send_response_only(202)
+            self.end_headers()
+            return
+        with open(part_path, 'r+b' if os.path.exists(part_path) else 'wb') as f:
+            f.seek(offset)
+            f.write(body)
+            f.truncate()
+        if offset + length < size:
+            self.send_response_only(202)
+        else:
+            full_path = os.path.join(repo_path, object_path)
+            os.makedirs(os.path.dirname(full_path), exist_ok=True)
+            os.replace(part_path, full_path)
+            self.send_response_only(204)
+        self.end_headers()
+
     def drop_check(self):
         self.__class__.made_requests += 1
         if args.fail and args.fail > 0:
@@ -167,6 +241,12 @@ if __name__ == "__main__":
                         help='sleep for n.n seconds for every GET request')
     parser.add_argument('-t', '--tls', action='store_true',
                         help='require TLS from clients')
+    parser.add_argument('--fail-chunks', action='store_true',
+                        help='with --fail, also fail every nth chunk of chunked uploads')
+    parser.add_argument('--lose-chunks', action='store_true',
+                        help='answer 202 to the last chunk of chunked uploads and discard the object')
+    parser.add_argument('--copy-from',
+                        help='OSTree repo directory to copy objects from on request')
     args = parser.parse_args()
 
     signal.signal(signal.SIGTERM, sig_handler)
@@ -34,6 +34,11 @@ exit_with_json_output() {
     exit "$codenum"
 }
 
+report_scheduling() {
+    echo "{\"nice\": $(nice)}"
+    exit 0
+}
+
 handle_command() {
     case "$1" in
         terminate-with-signal-*)
@@ -48,5 +53,8 @@ handle_command() {
         exit-with-json-output-code-*)
             exit_with_json_output "${1#exit-with-json-output-code-}"
             ;;
+        report-scheduling)
+            report_scheduling
+            ;;
     esac
 }
@@ -36,6 +36,7 @@ struct UptaneTestCommon {
     }
 
     std::shared_ptr<SotaUptaneClient>& uptane_client() { return uptane_client_; }
+    std::function<int()>& minute_of_day() { return minute_of_day_; }
   };
 
   class TestUptaneClient: public SotaUptaneClient